@@ -0,0 +1,148 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Allocation hooks feeding allocstats.h, linked only into the executables
+// that count the allocations (see MM_ALLOC_STATS in CMakeLists.txt).
+//
+// With glibc every heap allocation (operator new and Eigen both end up in
+// malloc) is counted before it is forwarded to glibc, and the heap usage is
+// tracked with malloc_usable_size(). Elsewhere (e.g. emscripten) only the
+// global operator new is replaced, so the allocations made by C code and
+// Eigen's aligned allocations are not seen and the heap is not tracked.
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include "allocstats.h"
+
+namespace {
+
+struct EnableAllocStats {
+  EnableAllocStats() { allocStatsSetEnabled(); }
+} enableAllocStats;
+
+}  // namespace
+
+#if defined(__GLIBC__)
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *ptr);
+
+static inline void *counted(void *ptr, size_t size) {
+  if (ptr != nullptr) {
+    allocStatsRecord(size);
+    allocStatsHeap(malloc_usable_size(ptr));
+  }
+  return ptr;
+}
+
+void *malloc(size_t size) noexcept {
+  return counted(__libc_malloc(size), size);
+}
+
+void *calloc(size_t n, size_t size) noexcept {
+  return counted(__libc_calloc(n, size), n * size);
+}
+
+void *realloc(void *ptr, size_t size) noexcept {
+  const int64_t prevBytes = ptr != nullptr ? malloc_usable_size(ptr) : 0;
+  void *newPtr = __libc_realloc(ptr, size);
+  // realloc to 0 bytes frees, a failed one keeps the old block
+  if (newPtr != nullptr || size == 0) allocStatsHeap(-prevBytes);
+  return counted(newPtr, size);
+}
+
+void *memalign(size_t alignment, size_t size) noexcept {
+  return counted(__libc_memalign(alignment, size), size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) noexcept {
+  return counted(__libc_memalign(alignment, size), size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) noexcept {
+  *ptr = counted(__libc_memalign(alignment, size), size);
+  return *ptr != nullptr ? 0 : ENOMEM;
+}
+
+void free(void *ptr) noexcept {
+  if (ptr != nullptr) {
+    allocStatsHeap(-static_cast<int64_t>(malloc_usable_size(ptr)));
+  }
+  __libc_free(ptr);
+}
+}
+#else
+static void *countedNew(std::size_t size, std::size_t alignment = 0) {
+  allocStatsRecord(size);
+  if (size == 0) size = 1;
+  void *ptr = nullptr;
+  if (alignment > alignof(std::max_align_t)) {
+    if (posix_memalign(&ptr, alignment, size) != 0) ptr = nullptr;
+  } else {
+    ptr = std::malloc(size);
+  }
+  return ptr;
+}
+
+void *operator new(std::size_t size) {
+  void *ptr = countedNew(size);
+  if (ptr == nullptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void *operator new[](std::size_t size) {
+  void *ptr = countedNew(size);
+  if (ptr == nullptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  return countedNew(size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  return countedNew(size);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment) {
+  void *ptr = countedNew(size, static_cast<std::size_t>(alignment));
+  if (ptr == nullptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment) {
+  void *ptr = countedNew(size, static_cast<std::size_t>(alignment));
+  if (ptr == nullptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+#endif
@@ -0,0 +1,92 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "allocstats.h"
+
+#include <atomic>
+#include <sstream>
+
+using namespace std;
+
+namespace {
+
+atomic<bool> enabled{false};
+atomic<uint64_t> calls[NUM_ALLOC_SCOPES], bytes[NUM_ALLOC_SCOPES];
+atomic<int64_t> heapBytes{0}, peakHeapBytes{0};
+thread_local int currentScope = ALLOC_OTHER;
+
+}  // namespace
+
+bool allocStatsEnabled() { return enabled.load(memory_order_relaxed); }
+
+const char *allocScopeName(int scope) {
+  static const char *const names[NUM_ALLOC_SCOPES] = {
+      "other", "deform", "normals", "glUpload", "playback", "export"};
+  return scope >= 0 && scope < NUM_ALLOC_SCOPES ? names[scope] : "";
+}
+
+AllocCounts allocStatsGet(int scope) {
+  AllocCounts counts;
+  const int begin = scope == NUM_ALLOC_SCOPES ? 0 : scope;
+  const int end = scope == NUM_ALLOC_SCOPES ? NUM_ALLOC_SCOPES : scope + 1;
+  for (int i = begin; i < end; i++) {
+    counts.calls += calls[i].load(memory_order_relaxed);
+    counts.bytes += bytes[i].load(memory_order_relaxed);
+  }
+  return counts;
+}
+
+int64_t allocStatsHeapBytes() { return heapBytes.load(memory_order_relaxed); }
+
+int64_t allocStatsPeakHeapBytes() {
+  return peakHeapBytes.load(memory_order_relaxed);
+}
+
+void allocStatsResetPeak() { peakHeapBytes.store(heapBytes.load()); }
+
+string allocStatsToJSON() {
+  ostringstream oss;
+  oss << "{\"enabled\":" << (allocStatsEnabled() ? "true" : "false")
+      << ",\"scopes\":{";
+  for (int i = 0; i < NUM_ALLOC_SCOPES; i++) {
+    const AllocCounts counts = allocStatsGet(i);
+    oss << (i > 0 ? "," : "") << "\"" << allocScopeName(i)
+        << "\":{\"calls\":" << counts.calls << ",\"bytes\":" << counts.bytes
+        << "}";
+  }
+  oss << "}}";
+  return oss.str();
+}
+
+void allocStatsSetEnabled() { enabled.store(true); }
+
+void allocStatsRecord(size_t size) {
+  calls[currentScope].fetch_add(1, memory_order_relaxed);
+  bytes[currentScope].fetch_add(size, memory_order_relaxed);
+}
+
+void allocStatsHeap(int64_t size) {
+  const int64_t heap = heapBytes.fetch_add(size, memory_order_relaxed) + size;
+  int64_t peak = peakHeapBytes.load(memory_order_relaxed);
+  while (heap > peak && !peakHeapBytes.compare_exchange_weak(
+                            peak, heap, memory_order_relaxed)) {
+  }
+}
+
+AllocScope::AllocScope(AllocScopeId scope) : prevScope(currentScope) {
+  currentScope = scope;
+}
+
+AllocScope::~AllocScope() { currentScope = prevScope; }
@@ -0,0 +1,80 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef ALLOCSTATS_H
+#define ALLOCSTATS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Heap allocations counted per subsystem, to check that the steady state of
+// the per-frame work does not allocate. The counting is opt-in: it is done
+// by allochooks.cpp, which replaces the allocation functions and is linked
+// into the benchmark and, with MM_ALLOC_STATS (on by default in Debug
+// builds), into the application. Without it the counters stay 0 and
+// allocStatsEnabled() returns false.
+//
+// ALLOC_SCOPE(ALLOC_DEFORM) attributes the allocations of the calling thread
+// in the enclosing block to the subsystem, the innermost scope wins. The
+// rest goes to ALLOC_OTHER.
+
+enum AllocScopeId {
+  ALLOC_OTHER,
+  ALLOC_DEFORM,
+  ALLOC_NORMALS,
+  ALLOC_GL_UPLOAD,
+  ALLOC_PLAYBACK,
+  ALLOC_EXPORT,
+  NUM_ALLOC_SCOPES
+};
+
+struct AllocCounts {
+  std::uint64_t calls = 0, bytes = 0;
+};
+
+bool allocStatsEnabled();
+const char *allocScopeName(int scope);
+// counts of a scope since the start, of all of them for NUM_ALLOC_SCOPES
+AllocCounts allocStatsGet(int scope = NUM_ALLOC_SCOPES);
+// bytes currently allocated and their maximum since allocStatsResetPeak(),
+// 0 where the hooks cannot tell the size of freed blocks
+std::int64_t allocStatsHeapBytes();
+std::int64_t allocStatsPeakHeapBytes();
+void allocStatsResetPeak();
+// {"enabled":b,"scopes":{"deform":{"calls":n,"bytes":n},...}}
+std::string allocStatsToJSON();
+
+// called by the hooks, must not allocate
+void allocStatsSetEnabled();
+void allocStatsRecord(std::size_t bytes);
+void allocStatsHeap(std::int64_t bytes);
+
+class AllocScope {
+ public:
+  explicit AllocScope(AllocScopeId scope);
+  ~AllocScope();
+  AllocScope(const AllocScope &) = delete;
+  AllocScope &operator=(const AllocScope &) = delete;
+
+ private:
+  int prevScope;
+};
+
+#define ALLOC_CONCAT_INNER(a, b) a##b
+#define ALLOC_CONCAT(a, b) ALLOC_CONCAT_INNER(a, b)
+#define ALLOC_SCOPE(scope) AllocScope ALLOC_CONCAT(allocScope, __LINE__)(scope)
+
+#endif  // ALLOCSTATS_H
@@ -0,0 +1,115 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "animcache.h"
+
+#include <algorithm>
+
+using namespace Eigen;
+using namespace std;
+
+void AnimCache::validate(uint64_t signature, int nFrames, int nVertices) {
+  if (signature == this->signature && nVertices == this->nVertices &&
+      nFrames == static_cast<int>(cached.size()))
+    return;
+  clear();
+  this->signature = signature;
+  this->nVertices = nVertices;
+  const size_t floatBytes = static_cast<size_t>(nVertices) * 3 * sizeof(float);
+  quantized = floatBytes * nFrames > maxBytes;
+  if (quantized) {
+    framesQuantized.resize(nFrames);
+    framesMin.resize(nFrames);
+    framesScale.resize(nFrames);
+  } else {
+    framesFloat.resize(nFrames);
+  }
+  cached.resize(nFrames, false);
+}
+
+void AnimCache::clear() {
+  signature = 0;
+  nVertices = 0;
+  framesFloat.clear();
+  framesQuantized.clear();
+  framesMin.clear();
+  framesScale.clear();
+  cached.clear();
+  nCached = 0;
+}
+
+bool AnimCache::get(int frame, MatrixXd &V) const {
+  if (frame < 0 || frame >= static_cast<int>(cached.size()) || !cached[frame])
+    return false;
+  if (quantized) {
+    V = framesQuantized[frame].cast<double>();
+    V.array().rowwise() *= framesScale[frame].cast<double>().array();
+    V.rowwise() += framesMin[frame].cast<double>();
+  } else {
+    V = framesFloat[frame].cast<double>();
+  }
+  return true;
+}
+
+void AnimCache::put(int frame, const MatrixXd &V) {
+  if (frame < 0 || frame >= static_cast<int>(cached.size()) ||
+      V.rows() != nVertices || V.cols() != 3)
+    return;
+  if (!cached[frame] && (nCached + 1) * frameBytes() > maxBytes) return;
+  if (quantized) {
+    const RowVector3d vMin = V.colwise().minCoeff();
+    const RowVector3d extent = V.colwise().maxCoeff() - vMin;
+    RowVector3d scale = extent / 65535.0;
+    for (int i = 0; i < 3; i++) {
+      if (!(scale(i) > 0)) scale(i) = 1;
+    }
+    framesMin[frame] = vMin.cast<float>();
+    framesScale[frame] = scale.cast<float>();
+    // quantize against the float min and scale used for reconstruction
+    const RowVector3d qMin = framesMin[frame].cast<double>();
+    const RowVector3d qScale = framesScale[frame].cast<double>();
+    framesQuantized[frame] =
+        ((V.rowwise() - qMin).array().rowwise() / qScale.array())
+            .round()
+            .max(0)
+            .min(65535)
+            .cast<uint16_t>();
+  } else {
+    framesFloat[frame] = V.cast<float>();
+  }
+  if (!cached[frame]) nCached++;
+  cached[frame] = true;
+}
+
+bool AnimCache::isComplete() const {
+  return !cached.empty() && nCached == static_cast<int>(cached.size());
+}
+
+bool AnimCache::isQuantized() const { return quantized; }
+
+size_t AnimCache::getBytes() const { return nCached * frameBytes(); }
+
+size_t AnimCache::frameBytes() const {
+  const size_t size = quantized ? sizeof(uint16_t) : sizeof(float);
+  return static_cast<size_t>(nVertices) * 3 * size;
+}
+
+uint64_t AnimCache::hash(uint64_t h, const void *data, size_t bytes) {
+  const unsigned char *p = static_cast<const unsigned char *>(data);
+  for (size_t i = 0; i < bytes; i++) {
+    h ^= p[i];
+    h *= 1099511628211ull;
+  }
+  return h;
+}
@@ -0,0 +1,62 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANIMCACHE_H
+#define ANIMCACHE_H
+
+#include <miscutils/mesh3d.h>
+
+#include <Eigen/Dense>
+#include <cstdint>
+#include <vector>
+
+// Deformed vertex positions for each frame of a looped animation, so that
+// later loops do not need to deform again. Frames are stored in interleaved
+// float, or quantized to 16 bits per coordinate (relative to the bounding box
+// of the frame) if the float frames would exceed maxBytes. Frames not fitting
+// into maxBytes even then are not cached.
+class AnimCache {
+ public:
+  // Drops all frames if the signature (see hash) or the sizes differ from
+  // the current ones.
+  void validate(std::uint64_t signature, int nFrames, int nVertices);
+  void clear();
+  bool get(int frame, Eigen::MatrixXd &V) const;
+  void put(int frame, const Eigen::MatrixXd &V);
+  bool isComplete() const;
+  bool isQuantized() const;
+  size_t getBytes() const;
+  std::uint64_t getSignature() const { return signature; }
+  int getNumFrames() const { return cached.size(); }
+
+  // FNV-1a hash of the given bytes continuing from h
+  static std::uint64_t hash(std::uint64_t h, const void *data, size_t bytes);
+  static const std::uint64_t hashInit = 14695981039346656037ull;
+
+  size_t maxBytes = 128 << 20;
+
+ private:
+  size_t frameBytes() const;
+
+  std::uint64_t signature = 0;
+  int nVertices = 0;
+  bool quantized = false;
+  std::vector<MatrixX3fR> framesFloat;
+  std::vector<Eigen::Matrix<std::uint16_t, -1, -1>> framesQuantized;
+  std::vector<Eigen::RowVector3f> framesMin, framesScale;
+  std::vector<bool> cached;
+  int nCached = 0;
+};
+
+#endif  // ANIMCACHE_H
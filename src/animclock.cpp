@@ -0,0 +1,43 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "animclock.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+AnimClock::AnimClock(double stepsPerSecond) : stepsPerSecond(stepsPerSecond) {}
+
+double AnimClock::advance(bool wholeSteps) {
+  const auto now = chrono::steady_clock::now();
+  if (!running) {
+    running = true;
+    last = now;
+    remainder = 0;
+    return 0;
+  }
+  const double seconds = chrono::duration<double>(now - last).count();
+  last = now;
+  double steps = min(remainder + seconds * stepsPerSecond, maxSteps);
+  remainder = 0;
+  if (wholeSteps) {
+    remainder = steps - floor(steps);
+    steps = floor(steps);
+  }
+  return steps;
+}
+
+void AnimClock::reset() { running = false; }
@@ -0,0 +1,44 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANIMCLOCK_H
+#define ANIMCLOCK_H
+
+#include <chrono>
+
+// Advances the playback of animations at a fixed rate of steps (keyposes) per
+// second independently of the frame rate. On fast displays the steps are
+// fractional and CPAnim::replay interpolates between keyposes, on slow ones
+// several steps are taken per frame so the animation keeps its speed.
+class AnimClock {
+ public:
+  explicit AnimClock(double stepsPerSecond = 60);
+
+  // Steps elapsed since the last call (0 on the first call after reset()).
+  // If wholeSteps is set, only whole steps are returned and the rest is kept
+  // for the next call. At most maxSteps are returned, so that stalls (e.g.
+  // loading a project) do not make the animation jump.
+  double advance(bool wholeSteps = false);
+  void reset();
+
+  double stepsPerSecond;
+  double maxSteps = 4;
+
+ private:
+  std::chrono::steady_clock::time_point last;
+  double remainder = 0;
+  bool running = false;
+};
+
+#endif  // ANIMCLOCK_H
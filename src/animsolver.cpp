@@ -0,0 +1,130 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "animsolver.h"
+
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+
+using namespace Eigen;
+using namespace std;
+
+AnimationSolver::AnimationSolver(CPData &cpData, DefData &defData,
+                                 DefEng *defEng)
+    : cpData(cpData),
+      defData(defData),
+      defEng(defEng != nullptr ? *defEng : defData.defEng) {}
+
+AnimationSolver::~AnimationSolver() {
+  if (running) finish();
+}
+
+void AnimationSolver::start(int preroll, bool solveForZ) {
+  if (running) finish();
+  const int length = cpData.cpAnimSync.getLength();
+  this->preroll = length > 0 ? preroll : 0;
+  nFrames = length > 0 ? length : 1;
+  nSteps = this->preroll + nFrames;
+  currStep = 0;
+  frames.clear();
+
+  auto &arap = defData.defEng;
+  prevSolveForZ = arap.solveForZ;
+  prevIterTimeBudgetMs = arap.iterTimeBudgetMs;
+  arap.solveForZ = solveForZ;
+  arap.iterTimeBudgetMs = 0;
+  running = true;
+}
+
+void replayCPAnimations(CPData &cpData, Def3D &def, CPAnimBatch &batch,
+                        double t) {
+  const auto &cps = def.getCPs();
+  batch.clear(cpData.cpAnimSync.getLength());
+  for (auto &it : cpData.cpsAnim) {
+    const int slot = cps.getSlot(it.first);
+    if (slot == -1) {
+      cerr << "replayCPs: control point " << it.first << " not found" << endl;
+      continue;
+    }
+    batch.add(it.second, slot);
+  }
+  batch.replay(t);
+  fora(i, 0, batch.size()) {
+    auto cp = def.getCPAt(batch.getKey(i));
+    cp.pos = cp.prevPos = batch.getPosition(i);
+  }
+}
+
+void AnimationSolver::replayCPs(double t) {
+  replayCPAnimations(cpData, defData.def, cpAnimBatch, t);
+}
+
+bool AnimationSolver::step(int maxSteps) {
+  for (int i = 0; i < maxSteps && running; i++) {
+    // timepoint of the step, the preroll precedes frame 0
+    const int length = cpData.cpAnimSync.getLength();
+    if (length > 0) {
+      const int wrap = 100 * length;
+      const int t = ((currStep - preroll) % wrap + wrap) % wrap;
+      cpData.cpAnimSync.lastT = t;
+      replayCPs(t);
+    }
+
+    Mesh3D &mesh = defData.mesh;
+    if (mesh.VCurr.rows() > 0 && !(lookupFrame && lookupFrame(mesh))) {
+      defEng.deform(defData.def, mesh);
+      if (storeFrame) storeFrame(mesh);
+    }
+    const int frame = currStep - preroll;
+    if (frame >= 0) {
+      if (keepFrames) frames.push_back(mesh.VCurr.cast<float>());
+      if (frameCallback) frameCallback(frame, mesh);
+    }
+    if (++currStep >= nSteps) finish();
+  }
+  return isDone();
+}
+
+bool AnimationSolver::stepFor(double timeBudgetMs) {
+  const auto tStart = chrono::high_resolution_clock::now();
+  while (running) {
+    step(1);
+    const chrono::duration<double, milli> t =
+        chrono::high_resolution_clock::now() - tStart;
+    if (t.count() >= timeBudgetMs) break;
+  }
+  return isDone();
+}
+
+void AnimationSolver::solve() {
+  while (running) step(1);
+}
+
+void AnimationSolver::finish() {
+  auto &arap = defData.defEng;
+  arap.solveForZ = prevSolveForZ;
+  arap.iterTimeBudgetMs = prevIterTimeBudgetMs;
+  running = false;
+}
+
+bool AnimationSolver::isRunning() const { return running; }
+
+bool AnimationSolver::isDone() const { return !running && currStep >= nSteps; }
+
+int AnimationSolver::getNumFrames() const { return nFrames; }
+
+double AnimationSolver::getProgress() const {
+  return nSteps > 0 ? static_cast<double>(currStep) / nSteps : 1;
+}
@@ -0,0 +1,78 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANIMSOLVER_H
+#define ANIMSOLVER_H
+
+#include <Eigen/Dense>
+#include <functional>
+#include <vector>
+
+#include "commonStructs.h"
+
+// Moves the CPs of def to the positions of their animations in cpData at
+// the timepoint t, batch is reused between the calls.
+void replayCPAnimations(CPData &cpData, Def3D &def, CPAnimBatch &batch,
+                        double t);
+
+// Deforms a recorded animation frame by frame as fast as possible and
+// without rendering, e.g. for export. The CPs are replayed from cpData for
+// each frame the same way as in the playback, the first preroll steps
+// (end of the loop) only warm up the deformation. solve() blocks, step()
+// and stepFor() process chunks of frames, so that the browser can call them
+// from its main loop. The time budget of the ARAP iterations is disabled
+// during solving to get the same result independent of the CPU speed. The
+// CPs, the mesh and the timepoint are left in the state of the last frame.
+class AnimationSolver {
+ public:
+  typedef std::function<void(int frame, const Mesh3D &mesh)> FrameCallback;
+
+  // uses defData.defEng if defEng is nullptr
+  AnimationSolver(CPData &cpData, DefData &defData, DefEng *defEng = nullptr);
+  ~AnimationSolver();
+
+  void start(int preroll, bool solveForZ);
+  // return true when all frames were solved
+  bool step(int maxSteps = 1);
+  bool stepFor(double timeBudgetMs);
+  void solve();
+  bool isRunning() const;
+  bool isDone() const;
+  int getNumFrames() const;  // 1 if there is no animation
+  double getProgress() const;  // in [0, 1]
+
+  FrameCallback frameCallback;  // called after each frame is solved
+  // Optional cache of the deformed meshes: lookupFrame sets mesh.VCurr for
+  // the current timepoint and returns true to skip the deformation,
+  // storeFrame is called after each deformation.
+  std::function<bool(Mesh3D &mesh)> lookupFrame;
+  std::function<void(const Mesh3D &mesh)> storeFrame;
+  bool keepFrames = false;       // store the solved frames in frames
+  std::vector<Eigen::MatrixXf> frames;
+
+ private:
+  void replayCPs(double t);
+  void finish();
+
+  CPData &cpData;
+  DefData &defData;
+  DefEng &defEng;
+  CPAnimBatch cpAnimBatch;
+  int preroll = 0, nFrames = 1, nSteps = 0, currStep = 0;
+  bool running = false;
+  bool prevSolveForZ = true;
+  double prevIterTimeBudgetMs = 0;
+};
+
+#endif  // ANIMSOLVER_H
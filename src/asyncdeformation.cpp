@@ -0,0 +1,69 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "asyncdeformation.h"
+
+#include "allocstats.h"
+
+using namespace std;
+using namespace Eigen;
+
+AsyncDeformation::~AsyncDeformation() { wait(); }
+
+void AsyncDeformation::start(DefEng &eng, const Def3D &def, Mesh3D &mesh,
+                             const vector<Vector3d> &pos) {
+  if (busy) return;
+  busy = true;
+  done = false;
+  this->def = def;
+  if (pos.size() == def.getCPs().size()) {
+    for (size_t i = 0; i < pos.size(); i++) this->def.getCPAt(i).pos = pos[i];
+  }
+  auto task = [this, &eng, &mesh]() {
+    {
+      ALLOC_SCOPE(ALLOC_DEFORM);
+      diff = eng.deform(this->def, mesh);
+    }
+    VBack = mesh.VCurr;
+    done = true;
+    if (finishedCallback) finishedCallback();
+  };
+#ifdef WORKERPOOL_THREADS_AVAILABLE
+  thread = std::thread(task);
+#else
+  task();
+#endif
+}
+
+bool AsyncDeformation::poll(MatrixXd &V, double &diff) {
+  if (!busy || !done) return false;
+  if (thread.joinable()) thread.join();
+  busy = false;
+  V.swap(VBack);
+  diff = this->diff;
+  return true;
+}
+
+bool AsyncDeformation::running() const { return busy; }
+
+void AsyncDeformation::wait() {
+  if (thread.joinable()) thread.join();
+  busy = false;
+  done = false;
+}
+
+void AsyncDeformation::setFinishedCallback(
+    const std::function<void()> &callback) {
+  finishedCallback = callback;
+}
@@ -0,0 +1,71 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ASYNCDEFORMATION_H
+#define ASYNCDEFORMATION_H
+
+#include <miscutils/def3d.h>
+#include <miscutils/mesh3d.h>
+
+#include <Eigen/Dense>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "defeng.h"
+#include "workerpool.h"
+
+// Runs DefEng::deform on a worker thread so that rendering and input never
+// wait for the solver.
+//
+// The worker deforms the mesh with a copy of the control points taken at
+// start() and copies the result into a back buffer. poll() hands it to the
+// renderer by swapping the back buffer with the displayed vertices, so the
+// main thread never copies them. While a deformation runs, the mesh and the
+// engine belong to the worker: the main thread may only read mesh.F and
+// mesh.VRest and has to call wait() before changing or reading anything
+// else. Without threads (WORKERPOOL_THREADS_AVAILABLE undefined) start()
+// deforms right away.
+class AsyncDeformation {
+ public:
+  AsyncDeformation() = default;
+  ~AsyncDeformation();
+  AsyncDeformation(const AsyncDeformation &) = delete;
+  AsyncDeformation &operator=(const AsyncDeformation &) = delete;
+
+  // Does nothing if a deformation is running. The CPs are moved to pos if
+  // given (one position per CP in the order of Def3D::CPs).
+  void start(DefEng &eng, const Def3D &def, Mesh3D &mesh,
+             const std::vector<Eigen::Vector3d> &pos = {});
+  // Returns true once the deformation finished, V is then swapped with the
+  // deformed vertices and diff is the result of DefEng::deform.
+  bool poll(Eigen::MatrixXd &V, double &diff);
+  bool running() const;
+  // waits for the running deformation and drops its result
+  void wait();
+  // called from the worker thread when a deformation finishes
+  void setFinishedCallback(const std::function<void()> &callback);
+
+ private:
+  std::thread thread;
+  Def3D def;
+  Eigen::MatrixXd VBack;
+  double diff = 0;
+  bool busy = false;
+  std::atomic<bool> done{false};
+  std::function<void()> finishedCallback;
+};
+
+#endif  // ASYNCDEFORMATION_H
@@ -0,0 +1,196 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "asyncexport.h"
+
+#include <cstdio>
+
+#include "allocstats.h"
+#include "tracing.h"
+
+using namespace std;
+
+AsyncExport::~AsyncExport() { wait(); }
+
+void AsyncExport::start(exportgltf::ExportGltf *exporter, const string &outFn,
+                        bool writeBinary) {
+  run(exporter, [this, outFn, writeBinary]() {
+    this->exporter->exportStop(outFn, writeBinary);
+  });
+}
+
+void AsyncExport::start(exportgltf::ExportGltf *exporter) {
+  run(exporter, [this]() { this->exporter->exportStop(glb); });
+}
+
+void AsyncExport::run(exportgltf::ExportGltf *exporter,
+                      const std::function<void()> &exportStop) {
+  wait();
+  glb.clear();
+  busy = true;
+  done = false;
+  this->exporter.reset(exporter);
+  auto task = [this, exportStop]() {
+    {
+      TRACE_SCOPE("exportStop");
+      ALLOC_SCOPE(ALLOC_EXPORT);
+      exportStop();
+    }
+    done = true;
+    if (finishedCallback) finishedCallback();
+  };
+#ifdef WORKERPOOL_THREADS_AVAILABLE
+  thread = std::thread(task);
+#else
+  task();
+#endif
+}
+
+bool AsyncExport::poll() {
+  if (!busy || !done) return false;
+  wait();
+  return true;
+}
+
+bool AsyncExport::running() const { return busy; }
+
+void AsyncExport::wait() {
+  if (thread.joinable()) thread.join();
+  exporter.reset();
+  busy = false;
+  done = false;
+}
+
+void AsyncExport::setFinishedCallback(const std::function<void()> &callback) {
+  finishedCallback = callback;
+}
+
+std::vector<unsigned char> &AsyncExport::data() { return glb; }
+
+AsyncFrameEncoder::~AsyncFrameEncoder() { finish(); }
+
+void AsyncFrameEncoder::start(const Encoder &encoder, int maxPending) {
+  finish();
+  this->encoder = encoder;
+  this->maxPending = max(maxPending, 1);
+  stopping = false;
+#ifdef WORKERPOOL_THREADS_AVAILABLE
+  thread = std::thread(&AsyncFrameEncoder::run, this);
+#endif
+}
+
+void AsyncFrameEncoder::push(exportgltf::MatrixXfR &&V,
+                             exportgltf::MatrixXfR &&N, int frame) {
+#ifdef WORKERPOOL_THREADS_AVAILABLE
+  if (thread.joinable()) {
+    unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this]() { return static_cast<int>(queue.size()) < maxPending; });
+    queue.push_back(Frame{move(V), move(N), frame});
+    cv.notify_all();
+    return;
+  }
+#endif
+  if (encoder) encoder(V, N, frame);
+}
+
+void AsyncFrameEncoder::finish() {
+  if (!thread.joinable()) return;
+  {
+    lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  cv.notify_all();
+  thread.join();
+}
+
+void AsyncFrameEncoder::run() {
+  ALLOC_SCOPE(ALLOC_EXPORT);
+  unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    cv.wait(lock, [this]() { return stopping || !queue.empty(); });
+    if (queue.empty()) break;
+    // the frame stays queued while it is encoded, so push() keeps waiting
+    // for it and the memory stays bounded
+    Frame &frame = queue.front();
+    lock.unlock();
+    {
+      TRACE_SCOPE("encodeFrame");
+      encoder(frame.V, frame.N, frame.frame);
+    }
+    lock.lock();
+    queue.pop_front();
+    cv.notify_all();
+  }
+}
+
+AsyncImageWriter::~AsyncImageWriter() { finish(); }
+
+void AsyncImageWriter::start(const string &fnPrefix, int maxPending) {
+  finish();
+  this->fnPrefix = fnPrefix;
+  this->maxPending = max(maxPending, 1);
+  numFailed = 0;
+  stopping = false;
+#ifdef WORKERPOOL_THREADS_AVAILABLE
+  thread = std::thread(&AsyncImageWriter::run, this);
+#endif
+}
+
+void AsyncImageWriter::push(Imguc &&image, int frame) {
+#ifdef WORKERPOOL_THREADS_AVAILABLE
+  if (thread.joinable()) {
+    unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this]() {
+      return static_cast<int>(queue.size()) < maxPending;
+    });
+    queue.push_back(Frame{move(image), frame});
+    cv.notify_all();
+    return;
+  }
+#endif
+  write(Frame{move(image), frame});
+}
+
+void AsyncImageWriter::finish() {
+  if (!thread.joinable()) return;
+  {
+    lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  cv.notify_all();
+  thread.join();
+}
+
+void AsyncImageWriter::write(const Frame &frame) {
+  TRACE_SCOPE("writeCapturedFrame");
+  char number[16];
+  snprintf(number, sizeof(number), "%05d", frame.frame);
+  if (!frame.image.savePNG(fnPrefix + number + ".png")) numFailed++;
+}
+
+void AsyncImageWriter::run() {
+  ALLOC_SCOPE(ALLOC_EXPORT);
+  unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    cv.wait(lock, [this]() { return stopping || !queue.empty(); });
+    if (queue.empty()) break;
+    Frame &frame = queue.front();
+    lock.unlock();
+    write(frame);
+    lock.lock();
+    queue.pop_front();
+    cv.notify_all();
+  }
+}
@@ -0,0 +1,145 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef ASYNCEXPORT_H
+#define ASYNCEXPORT_H
+
+#include <image/image.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "exportgltf.h"
+#include "workerpool.h"
+
+// Runs ExportGltf::exportStop on a worker thread, as compressing the buffers
+// and writing the file may take a while for long animations. Without
+// threads (WORKERPOOL_THREADS_AVAILABLE undefined) start() writes the file
+// right away.
+class AsyncExport {
+ public:
+  AsyncExport() = default;
+  ~AsyncExport();
+  AsyncExport(const AsyncExport &) = delete;
+  AsyncExport &operator=(const AsyncExport &) = delete;
+
+  // takes the ownership of exporter, waits for a running export first
+  void start(exportgltf::ExportGltf *exporter, const std::string &outFn,
+             bool writeBinary);
+  // the GLB is written to memory, see data()
+  void start(exportgltf::ExportGltf *exporter);
+  // returns true once after the file has been written
+  bool poll();
+  bool running() const;
+  void wait();
+  // called from the worker thread when the file has been written
+  void setFinishedCallback(const std::function<void()> &callback);
+  // GLB written by start() without a file name, valid until the next start()
+  std::vector<unsigned char> &data();
+
+ private:
+  void run(exportgltf::ExportGltf *exporter,
+           const std::function<void()> &exportStop);
+
+  std::thread thread;
+  std::unique_ptr<exportgltf::ExportGltf> exporter;
+  bool busy = false;
+  std::atomic<bool> done{false};
+  std::function<void()> finishedCallback;
+  std::vector<unsigned char> glb;
+};
+
+// Encodes the frames of an animation export on a worker thread while the
+// next ones are solved: push() queues a frame and blocks while maxPending
+// frames wait, the encoder gets them in order. finish() waits until all of
+// them are encoded, the state used by the encoder must not be touched
+// before. Without threads (WORKERPOOL_THREADS_AVAILABLE undefined) push()
+// encodes right away.
+class AsyncFrameEncoder {
+ public:
+  typedef std::function<void(exportgltf::MatrixXfR &V,
+                             exportgltf::MatrixXfR &N, int frame)>
+      Encoder;
+
+  AsyncFrameEncoder() = default;
+  ~AsyncFrameEncoder();
+  AsyncFrameEncoder(const AsyncFrameEncoder &) = delete;
+  AsyncFrameEncoder &operator=(const AsyncFrameEncoder &) = delete;
+
+  // finishes the frames of the previous encoder first
+  void start(const Encoder &encoder, int maxPending = 4);
+  void push(exportgltf::MatrixXfR &&V, exportgltf::MatrixXfR &&N, int frame);
+  void finish();
+
+ private:
+  struct Frame {
+    exportgltf::MatrixXfR V, N;
+    int frame;
+  };
+  void run();
+
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<Frame> queue;
+  bool stopping = false;
+  int maxPending = 4;
+  Encoder encoder;
+};
+
+// Writes the frames of a video capture as a PNG sequence fnPrefix00000.png,
+// fnPrefix00001.png, ... on a worker thread, so that compressing them does
+// not stall the rendering. push() blocks while maxPending frames wait.
+// Without threads push() writes right away.
+class AsyncImageWriter {
+ public:
+  AsyncImageWriter() = default;
+  ~AsyncImageWriter();
+  AsyncImageWriter(const AsyncImageWriter &) = delete;
+  AsyncImageWriter &operator=(const AsyncImageWriter &) = delete;
+
+  // finishes the frames of the previous sequence first
+  void start(const std::string &fnPrefix, int maxPending = 4);
+  void push(Imguc &&image, int frame);
+  void finish();
+  // frames that could not be written since start()
+  int getNumFailed() const { return numFailed; }
+
+ private:
+  struct Frame {
+    Imguc image;
+    int frame;
+  };
+  void write(const Frame &frame);
+  void run();
+
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<Frame> queue;
+  bool stopping = false;
+  int maxPending = 4;
+  std::string fnPrefix;
+  std::atomic<int> numFailed{0};
+};
+
+#endif  // ASYNCEXPORT_H
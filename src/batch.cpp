@@ -0,0 +1,315 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Headless batch processing of projects: each project zip is loaded,
+// reconstructed and its animation solved without a window or a GL context,
+// the result is exported as a GLB file or a sequence of OBJ files. The
+// projects are processed in parallel on a worker pool, which also runs the
+// parallel parts of loading and exporting each of them.
+//
+// monstermash-batch [options] project.zip...
+//   -o dir     output directory (default .)
+//   -f format  glb or obj (default glb)
+//   -s WxH     viewport size the projects were drawn in (default 1000x800)
+//   -j n       number of threads (default all cores)
+//   -p n       number of preroll frames (default 0)
+//   -z         solve for z during the animation
+//   -n         export per-frame normals (glb)
+//   -q         quantize the exported model (glb)
+//   -c         compress the exported model (glb)
+//   -a         pack the texture to an atlas of the parts
+//   -P profile draft, interactive or final instead of the performance
+//              profile saved in each project (see perfprofile.h)
+
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "animsolver.h"
+#include "asyncexport.h"
+#include "commonStructs.h"
+#include "exportgltf.h"
+#include "exportobj.h"
+#include "loadsave.h"
+#include "macros.h"
+#include "perfprofile.h"
+#include "pngcache.h"
+#include "reconstruction.h"
+#include "textureatlas.h"
+#include "vertexnormals.h"
+#include "workerpool.h"
+
+using namespace std;
+using namespace Eigen;
+
+namespace {
+
+struct BatchOptions {
+  string outDir = ".";
+  bool exportOBJ = false;
+  int viewportW = 1000, viewportH = 800;
+  int numThreads = WorkerPool::defaultNumThreads() + 1;
+  int preroll = 0;
+  bool solveForZ = false;
+  bool perFrameNormals = false;
+  bool quantize = false;
+  bool compress = false;
+  bool textureAtlas = false;
+  bool overrideProfile = false;
+  PerfProfile profile = PERF_PROFILE_INTERACTIVE;
+  vector<string> projects;
+};
+
+void printUsage(const char *name) {
+  cerr << "usage: " << name
+       << " [-o dir] [-f glb|obj] [-s WxH] [-j threads] [-p preroll] [-z] "
+          "[-n] [-q] [-c] [-a] [-P profile] project.zip..."
+       << endl;
+}
+
+bool parseArgs(int argc, char *argv[], BatchOptions &opts) {
+  fora(i, 1, argc) {
+    const string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "-o" && hasValue) {
+      opts.outDir = argv[++i];
+    } else if (arg == "-f" && hasValue) {
+      const string format = argv[++i];
+      if (format != "glb" && format != "obj") return false;
+      opts.exportOBJ = format == "obj";
+    } else if (arg == "-s" && hasValue) {
+      if (sscanf(argv[++i], "%dx%d", &opts.viewportW, &opts.viewportH) != 2 ||
+          opts.viewportW <= 0 || opts.viewportH <= 0) {
+        return false;
+      }
+    } else if (arg == "-j" && hasValue) {
+      opts.numThreads = max(atoi(argv[++i]), 1);
+    } else if (arg == "-p" && hasValue) {
+      opts.preroll = max(atoi(argv[++i]), 0);
+    } else if (arg == "-z") {
+      opts.solveForZ = true;
+    } else if (arg == "-n") {
+      opts.perFrameNormals = true;
+    } else if (arg == "-q") {
+      opts.quantize = true;
+    } else if (arg == "-c") {
+      opts.compress = true;
+    } else if (arg == "-a") {
+      opts.textureAtlas = true;
+    } else if (arg == "-P" && hasValue) {
+      if (!perfProfileFromName(argv[++i], opts.profile)) return false;
+      opts.overrideProfile = true;
+    } else if (!arg.empty() && arg[0] == '-') {
+      return false;
+    } else {
+      opts.projects.push_back(arg);
+    }
+  }
+  return !opts.projects.empty();
+}
+
+// file name without the directory and the extension
+string baseName(const string &fn) {
+  const size_t slash = fn.find_last_of('/');
+  string name = slash == string::npos ? fn : fn.substr(slash + 1);
+  const size_t dot = name.find_last_of('.');
+  if (dot != string::npos && dot > 0) name.resize(dot);
+  return name;
+}
+
+bool writeOBJMaterial(const string &outDir, const string &name,
+                      const Imguc &templateImg) {
+  ofstream stream(outDir + "/" + name + ".mtl");
+  if (!stream.is_open()) return false;
+  stream << "newmtl Textured\nKa 1.000 1.000 1.000\nKd 1.000 1.000 "
+            "1.000\nKs 0.000 0.000 0.000\nNs 10.000\nd 1.0\nTr "
+            "0.0\nillum 2\nmap_Ka "
+         << name << ".png"
+         << "\nmap_Kd " << name << ".png" << endl;
+  PNGCache cache;
+  return cache.save(templateImg, outDir + "/" + name + ".png");
+}
+
+// Loads, reconstructs and exports a single project, the summary of the run
+// or the reason of a failure is appended to log.
+bool processProject(const string &zipFn, const BatchOptions &opts,
+                    WorkerPool &pool, string &log) {
+  const auto tStart = chrono::steady_clock::now();
+  const string name = baseName(zipFn);
+  log = zipFn + ": ";
+
+  CPData cpData;
+  DefData defData;
+  ImgData imgData;
+  RecData recData;
+  Imguc templateImg, backgroundImg;
+  ShadingOptions shadingOpts;
+  ManipulationMode manipulationMode;
+  bool middleMouseSimulation = false;
+  loadAllFromZip(zipFn, opts.viewportW, opts.viewportH, cpData, imgData,
+                 recData, cpData.savedCPs, templateImg, backgroundImg,
+                 shadingOpts, manipulationMode, middleMouseSimulation, &pool);
+  if (imgData.layers.empty()) {
+    log += "no layers loaded";
+    return false;
+  }
+  if (opts.overrideProfile) {
+    applyPerfProfile(opts.profile, recData, shadingOpts);
+  }
+  applyPerfProfile(recData.perfProfile, defData);
+  // the projects already run in parallel
+  if (opts.projects.size() > 1) recData.numThreads = 1;
+
+  if (!performReconstruction(recData, defData, cpData, imgData)) {
+    log += "reconstruction failed";
+    return false;
+  }
+  const MatrixXi &F = defData.mesh.F;
+
+  const bool hasTexture = !templateImg.isNull();
+  // texture coordinates in pixels of the exported texture
+  const Imguc *texture = &templateImg;
+  TextureAtlas atlas;
+  MatrixXd texturePixels;
+  if (hasTexture) {
+    texturePixels = defData.mesh.VRest.leftCols(2);
+    if (opts.textureAtlas && buildTextureAtlas(defData.mesh.VRest, F,
+                                               templateImg, 2, atlas)) {
+      texture = &atlas.img;
+      texturePixels = atlas.coords;
+    }
+  }
+  exportgltf::ExportGltf gltfExporter;
+  gltfExporter.quantize = opts.quantize;
+  gltfExporter.compress = opts.compress;
+  gltfExporter.keyframeTolerance =
+      perfSettings(recData.perfProfile).exportKeyframeTolerance;
+  exportgltf::MatrixXfR baseV, baseN;
+  bool ok = true;
+  // the frames after the first one are encoded while the next are solved
+  AsyncFrameEncoder encoder;
+  // as MainWindow::computeNormals() without the smoothing
+  VertexNormals vertexNormals;
+
+  AnimationSolver animSolver(cpData, defData, &projectDefEng(defData));
+  const int nFrames = cpData.cpAnimSync.getLength();
+  animSolver.frameCallback = [&](int frame, const Mesh3D &mesh) {
+    // the same transformation as in MainWindow::writeFrameOBJ() and
+    // MainWindow::exportAnimationWriteFrame()
+    MatrixXd V = mesh.VCurr, N;
+    vertexNormals.compute(V, F, N, &pool);
+    V *= 10.0 / opts.viewportW;
+    V.array().rowwise() *= RowVector3d(1, -1, -1).array();
+    N.array().rowwise() *= RowVector3d(1, -1, -1).array();
+    V.rowwise() += RowVector3d(-5, 5, 0);
+
+    if (opts.exportOBJ) {
+      MatrixXd TC;
+      string header;
+      if (hasTexture) {
+        TC = (texturePixels.array().rowwise() /
+              Array2d(texture->w, -texture->h).transpose());
+        header = "s 1\nmtllib " + name + ".mtl\nusemtl Textured\n";
+      }
+      char suffix[16];
+      snprintf(suffix, sizeof(suffix), "_%04d.obj", frame);
+      ok &= writeMeshOBJ(opts.outDir + "/" + name + suffix, V, F, N, TC,
+                         header, &pool);
+      return;
+    }
+
+    exportgltf::MatrixXfR Vf = V.cast<float>();
+    exportgltf::MatrixXfR Nf;
+    if (frame == 0 || opts.perFrameNormals) Nf = N.cast<float>();
+    if (frame == 0) {
+      baseV = Vf;
+      baseN = Nf;
+      exportgltf::MatrixXuiR Fui = F.cast<unsigned int>();
+      exportgltf::MatrixXfR TC;
+      if (hasTexture) {
+        TC = (texturePixels.cast<float>().array().rowwise() /
+              Array2f(texture->w, texture->h).transpose());
+      }
+      gltfExporter.exportStart(Vf, Nf, Fui, TC, nFrames, opts.perFrameNormals,
+                               24, *texture);
+      gltfExporter.exportFullModel(Vf, Nf, Fui, TC);
+      encoder.start([&](exportgltf::MatrixXfR &V, exportgltf::MatrixXfR &N,
+                        int frame) {
+        V -= baseV;
+        if (opts.perFrameNormals) N -= baseN;
+        gltfExporter.exportMorphTarget(V, N, frame);
+      });
+    } else {
+      encoder.push(move(Vf), move(Nf), frame);
+    }
+  };
+  animSolver.start(opts.preroll, opts.solveForZ);
+  animSolver.solve();
+  encoder.finish();
+
+  if (opts.exportOBJ) {
+    if (hasTexture) ok &= writeOBJMaterial(opts.outDir, name, *texture);
+  } else {
+    gltfExporter.exportStop(opts.outDir + "/" + name + ".glb", true);
+  }
+  if (!ok) {
+    log += "cannot write to " + opts.outDir;
+    return false;
+  }
+
+  const chrono::duration<double, milli> t =
+      chrono::steady_clock::now() - tStart;
+  ostringstream summary;
+  summary << defData.mesh.VCurr.rows() << " vertices, " << animSolver.getNumFrames()
+          << " frames, " << lround(t.count()) << " ms";
+  log += summary.str();
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  BatchOptions opts;
+  if (!parseArgs(argc, argv, opts)) {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  // the calling thread takes part in the work as well
+  WorkerPool pool(opts.numThreads - 1);
+  const int n = opts.projects.size();
+  vector<string> logs(n);
+  vector<char> succeeded(n, false);
+  pool.parallelFor(n, 1, [&](int begin, int end) {
+    fora(i, begin, end) {
+      succeeded[i] = processProject(opts.projects[i], opts, pool, logs[i]);
+    }
+  });
+
+  int failed = 0;
+  fora(i, 0, n) {
+    (succeeded[i] ? cout : cerr) << logs[i] << endl;
+    if (!succeeded[i]) failed++;
+  }
+  if (failed > 0) cerr << failed << " of " << n << " projects failed" << endl;
+  return failed > 0 ? 1 : 0;
+}
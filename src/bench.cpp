@@ -0,0 +1,1679 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks of the engine on a set of project zips.
+//
+// Deformation (default): each project is loaded and reconstructed, then its
+// control points are moved along scripted circular trajectories and the mesh
+// is deformed by DefEngARAPL frame by frame, once in XY only and once with
+// solveForZ. Reported per mode are the precompute time, percentiles of the
+// per-frame latency, the iterations and the heap allocations per frame.
+//
+// Accuracy (-q): the trajectories are deformed by a reference DefEngARAPL,
+// iterated in double precision until it converges on every frame, and by
+// each of the candidate configurations, e.g. single precision, the two-level
+// solve, convergence control with a time budget or linear blend skinning.
+// Reported per candidate and mode are the times per frame of both, the
+// largest and the mass-weighted (by M of the mesh) distance of the vertices
+// to the reference ones and the ARAP energy of both, optionally per frame.
+//
+// Reconstruction (-r): each project is reconstructed from scratch (with an
+// empty RecCache) for every combination of the given viewport sizes,
+// subsampling factors and triangulation options, optionally also from only
+// its first 1, 2, ... layers to expose superlinear growth with the number of
+// layers. Reported per combination are the total and per-stage times of the
+// fastest of the runs, the size of the mesh and the peak heap usage.
+//
+// Export (-e): an animation of the trajectories is baked once and exported
+// as GLB with dense morph targets, sparse ones, quantized, compressed and as
+// a skin, and as a sequence of OBJ files. Reported per encoding are the
+// time per frame, the time to finish the file, its size and the peak heap
+// usage.
+//
+// Images (-i): the image primitives of the drawing modes are run on
+// synthetic layers (filled ellipses with a hole and their outlines) for
+// every combination of the given canvas sizes and numbers of layers, no
+// projects are needed. Reported per primitive is the fastest of the runs.
+// The results can be compared to an earlier -m run stored in a file,
+// primitives slower than the baseline by more than the tolerance fail the
+// benchmark.
+//
+// Allocations and heap usage are measured only with glibc (see
+// allochooks.cpp).
+//
+// With -m every mode writes the same kind of JSON object per result: the
+// schema, the benchmark (mode) and the params identifying the result, the
+// build (git revision, compiler, target, SIMD, threads), the timings as
+// distributions (n, mean, stddev, min and percentiles in ms) and the other
+// measured values. Compare (-D) diffs two such files: timings are matched by
+// benchmark and params, the means are compared with Welch's t-test if both
+// have at least 5 samples, the fastest runs otherwise. Timings slower by more
+// than the tolerance (and significantly so) fail the comparison.
+//
+// monstermash-bench [options] project.zip...
+//   -s WxH[,WxH...]  viewport sizes the projects are loaded in, the
+//                    deformation uses the first one (default 1000x800)
+//   -m               machine-readable output, a JSON object per line
+// deformation:
+//   -f n             number of measured frames (default 240)
+//   -w n             number of warm-up frames (default 24)
+//   -a x             radius of the trajectories relative to the size of the
+//                    mesh (default 0.05)
+//   -A               fail if a measured frame of the deformation allocates
+// accuracy:
+//   -q               compare solver configurations to the reference instead,
+//                    -f, -w and -a as for the deformation
+//   -C config[,config...]
+//                    candidates (default
+//                    default,float,twolevel,converge,lbs-biharmonic), the
+//                    name of an engine, lbs-biharmonic or options of the
+//                    project's DefEngARAPL joined by '+': default, float,
+//                    parallel, twolevel, supernodal, cg, components,
+//                    pgs, converge, iter=n, tol=x, budget=ms
+//   -v               also report every frame
+// reconstruction:
+//   -r               benchmark the reconstruction instead
+//   -d n[,n...]      subsampling factors (default the one of the project)
+//   -t opts[,opts...]
+//                    options of triangle (default the ones of the project)
+//   -l               also reconstruct the first 1, 2, ... layers
+//   -n n             runs of each combination, the fastest is reported
+//                    (default 3)
+// export:
+//   -e               benchmark the export instead, -f sets the number of
+//                    frames
+//   -o dir           directory of the exported files (default .)
+// images:
+//   -i               benchmark the image primitives instead, -n sets the
+//                    number of runs
+//   -c n[,n...]      sizes of the square canvases (default
+//                    512,1024,2048,4096)
+//   -k n[,n...]      numbers of layers (default 1,10,50,200)
+//   -b file          baseline, the output of an earlier run with -m
+//   -x x             tolerated slowdown relative to the baseline (default
+//                    0.1)
+// compare:
+//   -D               compare two files written with -m instead, the files are
+//                    given in place of the projects (old one first), -x sets
+//                    the tolerance
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <igl/per_vertex_normals.h>
+
+#include <image/imageUtils.h>
+#include <ir3d-utils/regionToMesh.h>
+#include <tinygltf/json.hpp>
+
+#include "allocstats.h"
+#include "commonStructs.h"
+#include "defenglbs.h"
+#include "exportgltf.h"
+#include "exportobj.h"
+#include "loadsave.h"
+#include "macros.h"
+#include "reconstruction.h"
+#include "skinfit.h"
+#include "tiledimage.h"
+#include "workerpool.h"
+
+using namespace std;
+using namespace Eigen;
+using json = nlohmann::json;
+
+
+namespace {
+
+// allochooks.cpp sees all the allocations and the heap only with glibc
+#if defined(__GLIBC__)
+const bool allocsCounted = true;
+#else
+const bool allocsCounted = false;
+#endif
+
+struct BenchOptions {
+  vector<pair<int, int>> viewports;
+  bool json = false;
+  int frames = 240;
+  int warmup = 24;
+  double amplitude = 0.05;
+  bool noAllocs = false;
+  bool accuracy = false;
+  vector<string> accuracyConfigs;
+  bool perFrame = false;
+  bool reconstruction = false;
+  vector<int> subsFactors;
+  vector<string> triangleOpts;
+  bool layerPrefixes = false;
+  int runs = 3;
+  bool exportModels = false;
+  string outDir = ".";
+  bool images = false;
+  vector<int> canvasSizes;
+  vector<int> layerCounts;
+  string baselineFn;
+  double tolerance = 0.1;
+  bool compare = false;
+  vector<string> projects;
+};
+
+void printUsage(const char *name) {
+  cerr << "usage: " << name
+       << " [-s WxH[,WxH...]] [-m] [-f frames] [-w warmup] [-a amplitude] [-A] "
+          "[-q [-C config[,config...]] [-v]] "
+          "[-r [-d n[,n...]] [-t opts[,opts...]] [-l] [-n runs]] "
+          "[-e [-o dir]] project.zip...\n       "
+       << name
+       << " -i [-m] [-n runs] [-c n[,n...]] [-k n[,n...]] [-b baseline] "
+          "[-x tolerance]\n       "
+       << name << " -D [-m] [-x tolerance] old.jsonl new.jsonl" << endl;
+}
+
+vector<string> splitList(const string &list) {
+  vector<string> items;
+  istringstream iss(list);
+  string item;
+  while (getline(iss, item, ',')) {
+    if (!item.empty()) items.push_back(item);
+  }
+  return items;
+}
+
+bool parseArgs(int argc, char *argv[], BenchOptions &opts) {
+  fora(i, 1, argc) {
+    const string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "-s" && hasValue) {
+      for (const string &size : splitList(argv[++i])) {
+        int w, h;
+        if (sscanf(size.c_str(), "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0) {
+          return false;
+        }
+        opts.viewports.emplace_back(w, h);
+      }
+    } else if (arg == "-d" && hasValue) {
+      for (const string &factor : splitList(argv[++i])) {
+        opts.subsFactors.push_back(max(atoi(factor.c_str()), 1));
+      }
+    } else if (arg == "-t" && hasValue) {
+      opts.triangleOpts = splitList(argv[++i]);
+    } else if (arg == "-q") {
+      opts.accuracy = true;
+    } else if (arg == "-C" && hasValue) {
+      opts.accuracyConfigs = splitList(argv[++i]);
+    } else if (arg == "-v") {
+      opts.perFrame = true;
+    } else if (arg == "-r") {
+      opts.reconstruction = true;
+    } else if (arg == "-l") {
+      opts.layerPrefixes = true;
+    } else if (arg == "-e") {
+      opts.exportModels = true;
+    } else if (arg == "-i") {
+      opts.images = true;
+    } else if (arg == "-c" && hasValue) {
+      for (const string &size : splitList(argv[++i])) {
+        opts.canvasSizes.push_back(max(atoi(size.c_str()), 16));
+      }
+    } else if (arg == "-k" && hasValue) {
+      for (const string &count : splitList(argv[++i])) {
+        opts.layerCounts.push_back(max(atoi(count.c_str()), 1));
+      }
+    } else if (arg == "-D") {
+      opts.compare = true;
+    } else if (arg == "-b" && hasValue) {
+      opts.baselineFn = argv[++i];
+    } else if (arg == "-x" && hasValue) {
+      opts.tolerance = atof(argv[++i]);
+    } else if (arg == "-o" && hasValue) {
+      opts.outDir = argv[++i];
+    } else if (arg == "-n" && hasValue) {
+      opts.runs = max(atoi(argv[++i]), 1);
+    } else if (arg == "-f" && hasValue) {
+      opts.frames = max(atoi(argv[++i]), 1);
+    } else if (arg == "-w" && hasValue) {
+      opts.warmup = max(atoi(argv[++i]), 0);
+    } else if (arg == "-a" && hasValue) {
+      opts.amplitude = atof(argv[++i]);
+    } else if (arg == "-A") {
+      opts.noAllocs = true;
+    } else if (arg == "-m") {
+      opts.json = true;
+    } else if (!arg.empty() && arg[0] == '-') {
+      return false;
+    } else {
+      opts.projects.push_back(arg);
+    }
+  }
+  if (opts.viewports.empty()) opts.viewports.emplace_back(1000, 800);
+  if (opts.canvasSizes.empty()) opts.canvasSizes = {512, 1024, 2048, 4096};
+  if (opts.layerCounts.empty()) opts.layerCounts = {1, 10, 50, 200};
+  if (opts.accuracyConfigs.empty()) {
+    opts.accuracyConfigs = {"default", "float", "twolevel", "converge",
+                            "lbs-biharmonic"};
+  }
+  const int modes = opts.accuracy + opts.reconstruction + opts.exportModels +
+                    opts.images + opts.compare;
+  if (modes > 1) return false;
+  if (opts.compare) return opts.projects.size() == 2;
+  return opts.images ? opts.projects.empty() : !opts.projects.empty();
+}
+
+// loads a project zip with the viewport size, false if it has no layers
+bool loadProject(const string &zipFn, const pair<int, int> &viewport,
+                 WorkerPool &pool, CPData &cpData, ImgData &imgData,
+                 RecData &recData) {
+  Imguc templateImg, backgroundImg;
+  ShadingOptions shadingOpts;
+  ManipulationMode manipulationMode;
+  bool middleMouseSimulation = false;
+  loadAllFromZip(zipFn, viewport.first, viewport.second, cpData, imgData,
+                 recData, cpData.savedCPs, templateImg, backgroundImg,
+                 shadingOpts, manipulationMode, middleMouseSimulation, &pool);
+  if (imgData.layers.empty()) {
+    cerr << zipFn << ": no layers loaded" << endl;
+    return false;
+  }
+  return true;
+}
+
+// value at fraction q of the sorted values
+double percentile(const vector<double> &sorted, double q) {
+  const int i = lround(q * (sorted.size() - 1));
+  return sorted[min(max(i, 0), static_cast<int>(sorted.size()) - 1)];
+}
+
+// summary of repeated timings (in ms) of the same thing
+struct Distribution {
+  int n = 0;
+  double mean = 0, stddev = 0;
+  double min = 0, p50 = 0, p90 = 0, p99 = 0, max = 0;
+};
+
+Distribution distribution(vector<double> samples) {
+  Distribution d;
+  d.n = samples.size();
+  if (d.n == 0) return d;
+  for (const double x : samples) d.mean += x / d.n;
+  if (d.n > 1) {
+    for (const double x : samples) {
+      d.stddev += (x - d.mean) * (x - d.mean) / (d.n - 1);
+    }
+    d.stddev = sqrt(d.stddev);
+  }
+  sort(samples.begin(), samples.end());
+  d.min = samples.front();
+  d.p50 = percentile(samples, 0.5);
+  d.p90 = percentile(samples, 0.9);
+  d.p99 = percentile(samples, 0.99);
+  d.max = samples.back();
+  return d;
+}
+
+// A result in the common format of all modes (one JSON object per line with
+// -m): the benchmark and its params identify the result across runs and
+// builds, timings are distributions in ms, values anything else measured.
+// The build is added by toJSON().
+struct BenchRecord {
+  string benchmark;
+  json params = json::object();
+  map<string, Distribution> timings;
+  json values = json::object();
+  json build;  // set by loadRecords()
+};
+
+const char *const benchSchema = "monstermash-bench/1";
+
+// what the benchmark binary was built from, for and with
+json buildInfo() {
+  json build;
+#if defined(MM_GIT_REVISION)
+  build["revision"] = MM_GIT_REVISION;
+#else
+  build["revision"] = "unknown";
+#endif
+#if defined(__clang__)
+  build["compiler"] = string("clang ") + __clang_version__;
+#elif defined(__GNUC__)
+  build["compiler"] = string("gcc ") + __VERSION__;
+#elif defined(_MSC_VER)
+  build["compiler"] = "msvc " + to_string(_MSC_VER);
+#else
+  build["compiler"] = "unknown";
+#endif
+#if defined(__EMSCRIPTEN__)
+  build["target"] = "wasm";
+#else
+  build["target"] = "native";
+#endif
+#if defined(__wasm_simd128__)
+  build["simd"] = "simd128";
+#elif defined(__AVX2__)
+  build["simd"] = "avx2";
+#elif defined(__AVX__)
+  build["simd"] = "avx";
+#elif defined(__SSE2__) || defined(_M_X64)
+  build["simd"] = "sse2";
+#elif defined(__ARM_NEON)
+  build["simd"] = "neon";
+#else
+  build["simd"] = "none";
+#endif
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+  build["threads"] = 0;
+#else
+  build["threads"] = WorkerPool::defaultNumThreads() + 1;
+#endif
+#if defined(NDEBUG)
+  build["optimized"] = true;
+#else
+  build["optimized"] = false;
+#endif
+  build["allocsCounted"] = allocsCounted;
+  return build;
+}
+
+json toJSON(const Distribution &d) {
+  return {{"n", d.n},     {"mean", d.mean}, {"stddev", d.stddev},
+          {"min", d.min}, {"p50", d.p50},   {"p90", d.p90},
+          {"p99", d.p99}, {"max", d.max}};
+}
+
+string toJSON(const BenchRecord &r) {
+  static const json build = buildInfo();
+  json timings = json::object();
+  for (const auto &it : r.timings) timings[it.first] = toJSON(it.second);
+  const json record = {{"schema", benchSchema}, {"benchmark", r.benchmark},
+                       {"params", r.params},    {"build", build},
+                       {"timings", timings},    {"values", r.values}};
+  return record.dump();
+}
+
+// the records of a file written with -m, false if it cannot be read
+bool loadRecords(const string &fn, vector<BenchRecord> &records) {
+  ifstream stream(fn);
+  if (!stream.is_open()) return false;
+  string line;
+  while (getline(stream, line)) {
+    const json record = json::parse(line, nullptr, false);
+    if (!record.is_object() || record.value("schema", "") != benchSchema) {
+      continue;
+    }
+    BenchRecord r;
+    r.benchmark = record.value("benchmark", "");
+    r.params = record.value("params", json::object());
+    r.values = record.value("values", json::object());
+    r.build = record.value("build", json::object());
+    const json timings = record.value("timings", json::object());
+    for (auto it = timings.begin(); it != timings.end(); ++it) {
+      Distribution &d = r.timings[it.key()];
+      d.n = it.value().value("n", 0);
+      d.mean = it.value().value("mean", 0.0);
+      d.stddev = it.value().value("stddev", 0.0);
+      d.min = it.value().value("min", 0.0);
+      d.p50 = it.value().value("p50", 0.0);
+      d.p90 = it.value().value("p90", 0.0);
+      d.p99 = it.value().value("p99", 0.0);
+      d.max = it.value().value("max", 0.0);
+    }
+    records.push_back(r);
+  }
+  return true;
+}
+
+// identifies the same measurement in different runs
+string recordKey(const BenchRecord &r) {
+  return r.benchmark + " " + r.params.dump();
+}
+
+// one-sided critical value of Student's t distribution with df degrees of
+// freedom at the 1% level (Cornish-Fisher expansion around the normal one)
+double tCritical(double df) {
+  const double z = 2.326;
+  return z + (z * z * z + z) / (4 * df) +
+         (5 * pow(z, 5) + 16 * z * z * z + 3 * z) / (96 * df * df);
+}
+
+// the means are compared if both have enough samples for a t-test, the
+// fastest runs otherwise
+bool compareMeans(const Distribution &old, const Distribution &cur) {
+  const int minSamples = 5;
+  return old.n >= minSamples && cur.n >= minSamples;
+}
+
+// Whether the timing got slower from old to cur by more than the tolerance
+// (a fraction). The slowdown of the mean has to be significant in Welch's
+// t-test, differences of the fastest runs below minRegressionMs are within
+// the noise of the timer.
+bool significantlySlower(const Distribution &old, const Distribution &cur,
+                         double tolerance) {
+  const double minRegressionMs = 0.05;
+  if (old.n == 0 || cur.n == 0) return false;
+  if (!compareMeans(old, cur)) {
+    return cur.min > old.min * (1 + tolerance) &&
+           cur.min - old.min > minRegressionMs;
+  }
+  if (cur.mean <= old.mean * (1 + tolerance)) return false;
+  const double vOld = old.stddev * old.stddev / old.n;
+  const double vCur = cur.stddev * cur.stddev / cur.n;
+  if (vOld + vCur == 0) return cur.mean - old.mean > minRegressionMs;
+  const double t = (cur.mean - old.mean) / sqrt(vOld + vCur);
+  const double df = (vOld + vCur) * (vOld + vCur) /
+                    (vOld * vOld / (old.n - 1) + vCur * vCur / (cur.n - 1));
+  return t > tCritical(df);
+}
+
+string viewportName(const pair<int, int> &viewport) {
+  return to_string(viewport.first) + "x" + to_string(viewport.second);
+}
+
+// measurements of one project in one mode
+struct BenchResult {
+  string mode;
+  int frames = 0;
+  double precomputeMs = 0;
+  Distribution frameMs;
+  double iterations = 0;
+  int maxIterations = 0;
+  double allocsPerFrame = 0, allocBytesPerFrame = 0;
+};
+
+// Adds control points at the extremes of the mesh in x and y if the project
+// has none, so that there is something to drag.
+void ensureControlPoints(Def3D &def, const Mesh3D &mesh) {
+  if (!def.getCPs().empty()) return;
+  const MatrixXd &V = mesh.VCurr;
+  Index extremes[4];
+  V.col(0).minCoeff(&extremes[0]);
+  V.col(0).maxCoeff(&extremes[1]);
+  V.col(1).minCoeff(&extremes[2]);
+  V.col(1).maxCoeff(&extremes[3]);
+  for (const Index v : extremes) {
+    int index;
+    def.addControlPoint(V, V(v, 0), V(v, 1), 1, true, index);
+  }
+}
+
+// Circles around the initial positions of the control points, with a phase
+// per control point. Fixed control points stay unless all of them are fixed.
+class Trajectories {
+ public:
+  Trajectories(const Def3D &def, const Mesh3D &mesh, double amplitude)
+      : restPos(def.getCPs().getPos()) {
+    const auto &cps = def.getCPs();
+    fora(i, 0, cps.size()) anyFree |= !cps.at(i).fixed;
+    const double diag = (mesh.VRest.colwise().maxCoeff() -
+                         mesh.VRest.colwise().minCoeff())
+                            .norm();
+    radius = amplitude * diag;
+  }
+
+  void apply(Def3D &def, int frame) const {
+    const double t = 2 * M_PI * frame / period;
+    const int n = restPos.size();
+    fora(i, 0, n) {
+      auto cp = def.getCPAt(i);
+      if (anyFree && cp.fixed) continue;
+      const double phase = 2 * M_PI * i / n;
+      cp.pos = cp.prevPos =
+          restPos[i] + radius * Vector3d(cos(t + phase) - cos(phase),
+                                         sin(t + phase) - sin(phase), 0);
+    }
+  }
+
+ private:
+  static const int period = 48;
+  vector<Vector3d> restPos;
+  bool anyFree = false;
+  double radius = 0;
+};
+
+// Deforms the mesh of defData (a copy per mode) along the trajectories,
+// warm-up frames included, and measures the frames after them.
+BenchResult runMode(DefData defData, bool solveForZ, const BenchOptions &opts) {
+  BenchResult result;
+  result.mode = solveForZ ? "xyz" : "xy";
+  DefEngARAPL &eng = defData.defEng;
+  Def3D &def = defData.def;
+  Mesh3D &mesh = defData.mesh;
+  eng.solveForZ = solveForZ;
+  // as in AnimationSolver, every frame is solved fully
+  eng.iterTimeBudgetMs = 0;
+  eng.resetStats();
+  eng.precompute(def, mesh);
+  result.precomputeMs = eng.getStats().precomputeMs;
+
+  const Trajectories trajectories(def, mesh, opts.amplitude);
+  vector<double> ms;
+  uint64_t allocs = 0, bytes = 0;
+  long iterations = 0;
+  fora(f, 0, opts.warmup + opts.frames) {
+    trajectories.apply(def, f);
+    const AllocCounts counts0 = allocStatsGet(ALLOC_DEFORM);
+    const auto tStart = chrono::steady_clock::now();
+    {
+      ALLOC_SCOPE(ALLOC_DEFORM);
+      eng.deform(def, mesh);
+    }
+    const chrono::duration<double, milli> tFrame =
+        chrono::steady_clock::now() - tStart;
+    if (f < opts.warmup) continue;
+    const AllocCounts counts = allocStatsGet(ALLOC_DEFORM);
+    allocs += counts.calls - counts0.calls;
+    bytes += counts.bytes - counts0.bytes;
+    ms.push_back(tFrame.count());
+    iterations += eng.getStats().iterations;
+    result.maxIterations =
+        max(result.maxIterations, eng.getStats().iterations);
+  }
+
+  const int n = ms.size();
+  result.frames = n;
+  result.frameMs = distribution(ms);
+  result.iterations = static_cast<double>(iterations) / n;
+  result.allocsPerFrame = static_cast<double>(allocs) / n;
+  result.allocBytesPerFrame = static_cast<double>(bytes) / n;
+  return result;
+}
+
+BenchRecord toRecord(const string &project, int vertices, int nCPs,
+                     const BenchOptions &opts, const BenchResult &r) {
+  BenchRecord record;
+  record.benchmark = "deformation";
+  record.params = {{"project", project},
+                   {"mode", r.mode},
+                   {"viewport", viewportName(opts.viewports.front())},
+                   {"frames", opts.frames},
+                   {"warmup", opts.warmup},
+                   {"amplitude", opts.amplitude}};
+  record.timings["frameMs"] = r.frameMs;
+  record.timings["precomputeMs"] = distribution({r.precomputeMs});
+  record.values = {{"vertices", vertices},
+                   {"cps", nCPs},
+                   {"iterations", r.iterations},
+                   {"maxIterations", r.maxIterations}};
+  if (allocsCounted) {
+    record.values["allocsPerFrame"] = r.allocsPerFrame;
+    record.values["allocBytesPerFrame"] = r.allocBytesPerFrame;
+  }
+  return record;
+}
+
+string toText(const BenchResult &r) {
+  char line[256];
+  snprintf(line, sizeof(line),
+           "  %-3s precompute %.2f ms, frame mean %.3f p50 %.3f p90 %.3f p99 "
+           "%.3f max %.3f ms, %.1f iterations (max %d)",
+           r.mode.c_str(), r.precomputeMs, r.frameMs.mean, r.frameMs.p50,
+           r.frameMs.p90, r.frameMs.p99, r.frameMs.max, r.iterations,
+           r.maxIterations);
+  string text = line;
+  if (allocsCounted) {
+    snprintf(line, sizeof(line), ", %.1f allocations (%.1f KB) per frame",
+             r.allocsPerFrame, r.allocBytesPerFrame / 1024);
+    text += line;
+  }
+  return text;
+}
+
+// loads and reconstructs the project for deforming it
+bool prepareProject(const string &zipFn, const BenchOptions &opts,
+                    WorkerPool &pool, DefData &defData) {
+  CPData cpData;
+  ImgData imgData;
+  RecData recData;
+  if (!loadProject(zipFn, opts.viewports.front(), pool, cpData, imgData,
+                   recData)) {
+    return false;
+  }
+  if (!performReconstruction(recData, defData, cpData, imgData)) {
+    cerr << zipFn << ": reconstruction failed" << endl;
+    return false;
+  }
+  ensureControlPoints(defData.def, defData.mesh);
+  return true;
+}
+
+bool benchDeformation(const string &zipFn, const BenchOptions &opts,
+                      WorkerPool &pool) {
+  DefData defData;
+  if (!prepareProject(zipFn, opts, pool, defData)) return false;
+
+  const int vertices = defData.mesh.VCurr.rows();
+  const int nCPs = defData.def.getCPs().size();
+  if (!opts.json) {
+    cout << zipFn << ": " << vertices << " vertices, " << nCPs
+         << " control points, " << opts.frames << " frames" << endl;
+  }
+  bool ok = true;
+  for (const bool solveForZ : {false, true}) {
+    const BenchResult r = runMode(defData, solveForZ, opts);
+    cout << (opts.json ? toJSON(toRecord(zipFn, vertices, nCPs, opts, r))
+                       : toText(r))
+         << endl;
+    if (opts.noAllocs && r.allocsPerFrame > 0) {
+      cerr << zipFn << ": the " << r.mode << " deformation allocates "
+           << r.allocsPerFrame << " times per frame" << endl;
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+// ARAP energy of the deformed vertices V: the spokes energy with the
+// cotangent weights of L and the best fitting rotation of each vertex, i.e.
+// the same measure whichever engine produced V
+double arapEnergy(const SparseMatrix<double> &L, const MatrixXd &VRest,
+                  const MatrixXd &V) {
+  double energy = 0;
+  fora(i, 0, L.outerSize()) {
+    Matrix3d S = Matrix3d::Zero();
+    for (SparseMatrix<double>::InnerIterator it(L, i); it; ++it) {
+      if (it.index() == i) continue;
+      const Vector3d eRest = (VRest.row(i) - VRest.row(it.index())).transpose();
+      const Vector3d e = (V.row(i) - V.row(it.index())).transpose();
+      S += it.value() * eRest * e.transpose();
+    }
+    JacobiSVD<Matrix3d> svd(S, ComputeFullU | ComputeFullV);
+    Matrix3d W = svd.matrixV();
+    if ((W * svd.matrixU().transpose()).determinant() < 0) W.col(2) *= -1;
+    const Matrix3d R = W * svd.matrixU().transpose();
+    for (SparseMatrix<double>::InnerIterator it(L, i); it; ++it) {
+      if (it.index() == i) continue;
+      const Vector3d eRest = (VRest.row(i) - VRest.row(it.index())).transpose();
+      const Vector3d e = (V.row(i) - V.row(it.index())).transpose();
+      energy += it.value() * (e - R * eRest).squaredNorm();
+    }
+  }
+  return energy;
+}
+
+// The reference of the accuracy mode: full double precision solves iterated
+// until the displacement of an iteration is negligible, on every frame.
+shared_ptr<DefEng> createReference(DefEngARAPL &base, bool solveForZ) {
+  shared_ptr<DefEngARAPL> eng = base.createInstance();
+  eng->solveForZ = solveForZ;
+  eng->singlePrecision = false;
+  eng->parallelLocalStep = false;
+  eng->twoLevel = false;
+  eng->convergenceControl = true;
+  eng->convergenceTol = 1e-6;
+  eng->convergenceMaxIter = 200;
+  eng->iterTimeBudgetMs = 0;
+  return eng;
+}
+
+// Engine of a candidate configuration of the accuracy mode: the name of a
+// registered engine, lbs-biharmonic (the playback engine) or options of the
+// project's DefEngARAPL joined by '+': default, float, parallel, twolevel
+// (for any mesh size), supernodal, cg, components, pgs, converge, iter=n,
+// tol=x and budget=ms. nullptr if the configuration is unknown.
+shared_ptr<DefEng> createCandidate(const string &config, DefEngARAPL &base,
+                                   bool solveForZ) {
+  if (config == "lbs-biharmonic") return make_shared<DefEngLBS>(true);
+  // a new "arap" would lack the setup of the reconstruction
+  if (config != "arap") {
+    shared_ptr<DefEng> other = createDefEng(config);
+    if (other) return other;
+  }
+  shared_ptr<DefEngARAPL> eng = base.createInstance();
+  eng->solveForZ = solveForZ;
+  // as in AnimationSolver unless a budget is given
+  eng->iterTimeBudgetMs = 0;
+  istringstream iss(config);
+  string option;
+  while (getline(iss, option, '+')) {
+    const size_t eq = option.find('=');
+    const string key = option.substr(0, eq);
+    const double value =
+        eq == string::npos ? 0 : atof(option.c_str() + eq + 1);
+    if (key == "default") {
+    } else if (key == "float") {
+      eng->singlePrecision = true;
+      eng->parallelLocalStep = false;
+    } else if (key == "parallel") {
+      eng->parallelLocalStep = true;
+    } else if (key == "twolevel") {
+      eng->twoLevel = true;
+      eng->twoLevelMinVertices = 0;
+    } else if (key == "supernodal") {
+      eng->supernodal = true;
+    } else if (key == "cg") {
+      eng->iterative = true;
+    } else if (key == "components") {
+      eng->componentSolves = true;
+    } else if (key == "local") {
+      eng->localUpdates = true;
+    } else if (key == "pgs") {
+      eng->pgsDepth = true;
+    } else if (key == "converge") {
+      eng->convergenceControl = true;
+    } else if (key == "iter" && value >= 1) {
+      eng->maxIter = eng->convergenceMaxIter = lround(value);
+    } else if (key == "tol" && value > 0) {
+      eng->convergenceControl = true;
+      eng->convergenceTol = value;
+    } else if (key == "budget" && value > 0) {
+      eng->convergenceControl = true;
+      eng->iterTimeBudgetMs = value;
+    } else {
+      return nullptr;
+    }
+  }
+  return eng;
+}
+
+// Deforms copies of the mesh and the control points of defData with eng
+// along the trajectories, frameDone is called for each measured frame with
+// its index (from 0) and time. Returns the precompute time.
+double runAccuracyFrames(
+    DefEng &eng, const DefData &defData, const BenchOptions &opts,
+    const function<void(int, const Mesh3D &, double)> &frameDone) {
+  Def3D def = defData.def;
+  Mesh3D mesh = defData.mesh;
+  eng.resetStats();
+  eng.precompute(def, mesh);
+  const Trajectories trajectories(def, mesh, opts.amplitude);
+  fora(f, 0, opts.warmup + opts.frames) {
+    trajectories.apply(def, f);
+    const auto tStart = chrono::steady_clock::now();
+    eng.deform(def, mesh);
+    const chrono::duration<double, milli> tFrame =
+        chrono::steady_clock::now() - tStart;
+    if (f >= opts.warmup) frameDone(f - opts.warmup, mesh, tFrame.count());
+  }
+  return eng.getStats().precomputeMs;
+}
+
+// one measured frame of a candidate compared to the reference, the errors
+// are distances of the vertices to the reference ones in pixels
+struct AccuracyFrame {
+  double refMs = 0, ms = 0;
+  double maxError = 0, massError = 0;
+  double refEnergy = 0, energy = 0;
+};
+
+// comparison of a candidate configuration to the reference in one mode
+struct AccuracyResult {
+  string config, mode;
+  double refPrecomputeMs = 0, precomputeMs = 0;
+  vector<AccuracyFrame> frames;
+  // over the frames
+  double refMeanMs = 0, meanMs = 0;
+  double maxError = 0, meanMassError = 0, maxMassError = 0;
+  double refEnergy = 0, energy = 0;  // means
+};
+
+// the reference frames of one mode, shared by the candidates
+struct AccuracyReference {
+  double precomputeMs = 0;
+  vector<MatrixXd> V;
+  vector<double> ms, energy;
+};
+
+AccuracyResult compareToReference(const string &config, DefEng &eng,
+                                  const AccuracyReference &ref,
+                                  const DefData &defData,
+                                  const BenchOptions &opts) {
+  AccuracyResult result;
+  result.config = config;
+  result.refPrecomputeMs = ref.precomputeMs;
+  const SparseMatrix<double> &L = defData.defEng.L;
+  const MatrixXd &VRest = defData.mesh.VRest;
+  // diagonal of the mass matrix, uniform masses if there is none
+  VectorXd mass = VectorXd::Ones(VRest.rows());
+  if (defData.defEng.M.rows() == VRest.rows()) {
+    mass = defData.defEng.M.diagonal();
+  }
+  result.precomputeMs = runAccuracyFrames(
+      eng, defData, opts, [&](int f, const Mesh3D &mesh, double ms) {
+        AccuracyFrame frame;
+        frame.refMs = ref.ms[f];
+        frame.ms = ms;
+        const VectorXd d2 = (mesh.VCurr - ref.V[f]).rowwise().squaredNorm();
+        frame.maxError = sqrt(d2.maxCoeff());
+        frame.massError = sqrt(mass.dot(d2) / mass.sum());
+        frame.refEnergy = ref.energy[f];
+        frame.energy = arapEnergy(L, VRest, mesh.VCurr);
+        result.frames.push_back(frame);
+      });
+
+  const int n = result.frames.size();
+  for (const AccuracyFrame &f : result.frames) {
+    result.refMeanMs += f.refMs / n;
+    result.meanMs += f.ms / n;
+    result.maxError = max(result.maxError, f.maxError);
+    result.meanMassError += f.massError / n;
+    result.maxMassError = max(result.maxMassError, f.massError);
+    result.refEnergy += f.refEnergy / n;
+    result.energy += f.energy / n;
+  }
+  return result;
+}
+
+BenchRecord toRecord(const string &project, int vertices,
+                     const BenchOptions &opts, const AccuracyResult &r) {
+  BenchRecord record;
+  record.benchmark = "accuracy";
+  record.params = {{"project", project},
+                   {"config", r.config},
+                   {"mode", r.mode},
+                   {"viewport", viewportName(opts.viewports.front())},
+                   {"frames", opts.frames},
+                   {"warmup", opts.warmup},
+                   {"amplitude", opts.amplitude}};
+  vector<double> ms, refMs;
+  for (const AccuracyFrame &f : r.frames) {
+    ms.push_back(f.ms);
+    refMs.push_back(f.refMs);
+  }
+  record.timings["frameMs"] = distribution(ms);
+  record.timings["refFrameMs"] = distribution(refMs);
+  record.timings["precomputeMs"] = distribution({r.precomputeMs});
+  record.timings["refPrecomputeMs"] = distribution({r.refPrecomputeMs});
+  record.values = {{"vertices", vertices},
+                   {"maxError", r.maxError},
+                   {"meanMassError", r.meanMassError},
+                   {"maxMassError", r.maxMassError},
+                   {"refEnergy", r.refEnergy},
+                   {"energy", r.energy}};
+  return record;
+}
+
+// a single frame, identified by its index in the params
+BenchRecord toRecord(const string &project, int frame,
+                     const BenchOptions &opts, const AccuracyResult &r,
+                     const AccuracyFrame &f) {
+  BenchRecord record = toRecord(project, 0, opts, r);
+  record.params["frame"] = frame;
+  record.timings = {{"frameMs", distribution({f.ms})},
+                    {"refFrameMs", distribution({f.refMs})}};
+  record.values = {{"maxError", f.maxError},
+                   {"massError", f.massError},
+                   {"refEnergy", f.refEnergy},
+                   {"energy", f.energy}};
+  return record;
+}
+
+string toText(int frame, const AccuracyFrame &f) {
+  char line[256];
+  snprintf(line, sizeof(line),
+           "      frame %d: %.3f ms (reference %.3f ms), error max %.4f "
+           "mass-weighted %.4f px, energy %.4g (reference %.4g)",
+           frame, f.ms, f.refMs, f.maxError, f.massError, f.energy,
+           f.refEnergy);
+  return line;
+}
+
+string toText(const AccuracyResult &r) {
+  const double speedup = r.meanMs > 0 ? r.refMeanMs / r.meanMs : 0;
+  const double energyRatio = r.refEnergy > 0 ? r.energy / r.refEnergy : 1;
+  char line[320];
+  snprintf(line, sizeof(line),
+           "  %-3s %-16s frame %.3f ms (reference %.3f ms, %.2fx), error max "
+           "%.4f px, mass-weighted mean %.4f max %.4f px, energy %.3fx the "
+           "reference",
+           r.mode.c_str(), r.config.c_str(), r.meanMs, r.refMeanMs, speedup,
+           r.maxError, r.meanMassError, r.maxMassError, energyRatio);
+  return line;
+}
+
+bool benchAccuracy(const string &zipFn, const BenchOptions &opts,
+                   WorkerPool &pool) {
+  DefData defData;
+  if (!prepareProject(zipFn, opts, pool, defData)) return false;
+  // instances of a copy share its operators and factorizations safely
+  DefEngARAPL base = defData.defEng;
+
+  for (const string &config : opts.accuracyConfigs) {
+    if (!createCandidate(config, base, false)) {
+      cerr << "unknown configuration " << config << endl;
+      return false;
+    }
+  }
+
+  const int vertices = defData.mesh.VCurr.rows();
+  if (!opts.json) {
+    cout << zipFn << ": " << vertices << " vertices, "
+         << defData.def.getCPs().size() << " control points, " << opts.frames
+         << " frames" << endl;
+  }
+  for (const bool solveForZ : {false, true}) {
+    AccuracyReference ref;
+    shared_ptr<DefEng> refEng = createReference(base, solveForZ);
+    ref.precomputeMs = runAccuracyFrames(
+        *refEng, defData, opts, [&](int, const Mesh3D &mesh, double ms) {
+          ref.V.push_back(mesh.VCurr);
+          ref.ms.push_back(ms);
+          ref.energy.push_back(
+              arapEnergy(defData.defEng.L, mesh.VRest, mesh.VCurr));
+        });
+    refEng.reset();
+
+    for (const string &config : opts.accuracyConfigs) {
+      shared_ptr<DefEng> eng = createCandidate(config, base, solveForZ);
+      AccuracyResult r = compareToReference(config, *eng, ref, defData, opts);
+      r.mode = solveForZ ? "xyz" : "xy";
+      cout << (opts.json ? toJSON(toRecord(zipFn, vertices, opts, r))
+                         : toText(r))
+           << endl;
+      if (!opts.perFrame) continue;
+      fora(f, 0, r.frames.size()) {
+        cout << (opts.json ? toJSON(toRecord(zipFn, f, opts, r, r.frames[f]))
+                           : toText(f, r.frames[f]))
+             << endl;
+      }
+    }
+  }
+  return true;
+}
+
+// measurements of one combination of the reconstruction settings
+struct RecBenchResult {
+  pair<int, int> viewport;
+  int subsFactor = 0;
+  string triangleOpts;
+  int layers = 0;
+  int vertices = 0, faces = 0;
+  RecStats stats;  // of the fastest run
+  // of all the runs, in total and per stage
+  vector<double> totalMs;
+  map<string, vector<double>> stageMs;
+  // maximum of the heap during a run above its size at the start
+  int64_t peakHeapBytes = 0;
+};
+
+// Reconstructs the first result.layers layers of the project runs times,
+// each time from scratch.
+bool runReconstruction(const CPData &cpData, const ImgData &imgData,
+                       const RecData &recData, int runs,
+                       RecBenchResult &result) {
+  fora(run, 0, runs) {
+    // fresh copies, the reconstruction modifies them and the stages would be
+    // skipped with a filled cache
+    CPData runCPData = cpData;
+    ImgData runImgData = imgData;
+    runImgData.layers.resize(result.layers);
+    RecData runRecData = recData;
+    runRecData.cache = make_shared<RecCache>();
+    runRecData.subsFactor = result.subsFactor;
+    runRecData.triangleOpts = result.triangleOpts;
+    DefData defData;
+    RecStats stats;
+    const int64_t heapStart = allocStatsHeapBytes();
+    allocStatsResetPeak();
+    if (!performReconstruction(runRecData, defData, runCPData, runImgData,
+                               &stats)) {
+      return false;
+    }
+    result.peakHeapBytes =
+        max(result.peakHeapBytes, allocStatsPeakHeapBytes() - heapStart);
+    result.totalMs.push_back(stats.totalMs());
+    for (const RecStageStats &stage : stats.stages) {
+      result.stageMs[stage.name].push_back(stage.ms);
+    }
+    if (run == 0 || stats.totalMs() < result.stats.totalMs()) {
+      result.stats = stats;
+      result.vertices = defData.mesh.VCurr.rows();
+      result.faces = defData.mesh.F.rows();
+    }
+  }
+  return true;
+}
+
+BenchRecord toRecord(const string &project, const RecBenchResult &r) {
+  BenchRecord record;
+  record.benchmark = "reconstruction";
+  record.params = {{"project", project},
+                   {"viewport", viewportName(r.viewport)},
+                   {"subsFactor", r.subsFactor},
+                   {"triangleOpts", r.triangleOpts},
+                   {"layers", r.layers}};
+  record.timings["totalMs"] = distribution(r.totalMs);
+  for (const auto &stage : r.stageMs) {
+    record.timings["stage " + stage.first] = distribution(stage.second);
+  }
+  record.values = {{"vertices", r.vertices},
+                   {"faces", r.faces},
+                   {"stats", json::parse(r.stats.toJSON())}};
+  if (allocsCounted) record.values["peakHeapBytes"] = r.peakHeapBytes;
+  return record;
+}
+
+string toText(const RecBenchResult &r) {
+  char line[256];
+  snprintf(line, sizeof(line),
+           "  %dx%d -d %d -t %s, %d layers: %.1f ms, %d vertices, %d faces",
+           r.viewport.first, r.viewport.second, r.subsFactor,
+           r.triangleOpts.c_str(), r.layers, r.stats.totalMs(), r.vertices,
+           r.faces);
+  string text = line;
+  if (allocsCounted) {
+    snprintf(line, sizeof(line), ", peak heap %.1f MB",
+             r.peakHeapBytes / (1024.0 * 1024.0));
+    text += line;
+  }
+  text += "\n   ";
+  forlist(i, r.stats.stages) {
+    const RecStageStats &stage = r.stats.stages[i];
+    snprintf(line, sizeof(line), "%s %s %.1f", i > 0 ? "," : "",
+             stage.name.c_str(), stage.ms);
+    text += line;
+  }
+  return text;
+}
+
+bool benchReconstruction(const string &zipFn, const BenchOptions &opts,
+                         WorkerPool &pool) {
+  for (const auto &viewport : opts.viewports) {
+    CPData cpData;
+    ImgData imgData;
+    RecData recData;
+    if (!loadProject(zipFn, viewport, pool, cpData, imgData, recData)) {
+      return false;
+    }
+    const int nLayers = imgData.layers.size();
+    if (!opts.json) {
+      cout << zipFn << ": " << nLayers << " layers, " << viewport.first << "x"
+           << viewport.second << endl;
+    }
+    const vector<int> subsFactors = opts.subsFactors.empty()
+                                        ? vector<int>{recData.subsFactor}
+                                        : opts.subsFactors;
+    const vector<string> triangleOpts =
+        opts.triangleOpts.empty() ? vector<string>{recData.triangleOpts}
+                                  : opts.triangleOpts;
+    for (const int subsFactor : subsFactors) {
+      for (const string &triOpts : triangleOpts) {
+        fora(layers, opts.layerPrefixes ? 1 : nLayers, nLayers + 1) {
+          RecBenchResult r;
+          r.viewport = viewport;
+          r.subsFactor = subsFactor;
+          r.triangleOpts = triOpts;
+          r.layers = layers;
+          if (!runReconstruction(cpData, imgData, recData, opts.runs, r)) {
+            cerr << zipFn << ": reconstruction failed (-d " << subsFactor
+                 << " -t " << triOpts << ", " << layers << " layers)" << endl;
+            return false;
+          }
+          cout << (opts.json ? toJSON(toRecord(zipFn, r)) : toText(r))
+               << endl;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+// file name without the directory and the extension
+string baseName(const string &fn) {
+  const size_t slash = fn.find_last_of('/');
+  string name = slash == string::npos ? fn : fn.substr(slash + 1);
+  const size_t dot = name.find_last_of('.');
+  if (dot != string::npos && dot > 0) name.resize(dot);
+  return name;
+}
+
+size_t fileSize(const string &fn) {
+  ifstream stream(fn, ios::binary | ios::ate);
+  return stream.is_open() ? static_cast<size_t>(stream.tellg()) : 0;
+}
+
+// Frames of the trajectories deformed in advance, transformed as in
+// MainWindow::exportAnimationWriteFrame(), and the skinning weights for the
+// skinned export.
+struct BakedAnimation {
+  vector<MatrixXd> V, N;
+  MatrixXi F;
+  vector<int> cpVertices;
+  MatrixXd weights;
+};
+
+bool bakeAnimation(const string &zipFn, const BenchOptions &opts,
+                   WorkerPool &pool, BakedAnimation &anim) {
+  DefData defData;
+  if (!prepareProject(zipFn, opts, pool, defData)) return false;
+  Def3D &def = defData.def;
+  Mesh3D &mesh = defData.mesh;
+  anim.F = mesh.F;
+  DefEngLBS lbs(true);
+  lbs.precompute(def, mesh);
+  anim.cpVertices = lbs.getCPVertices();
+  anim.weights = lbs.getWeights();
+
+  DefEngARAPL &eng = defData.defEng;
+  eng.iterTimeBudgetMs = 0;
+  eng.precompute(def, mesh);
+  const Trajectories trajectories(def, mesh, opts.amplitude);
+  const double scale = 10.0 / opts.viewports.front().first;
+  fora(f, 0, opts.frames) {
+    trajectories.apply(def, f);
+    eng.deform(def, mesh);
+    MatrixXd V = mesh.VCurr, N;
+    igl::per_vertex_normals(V, anim.F,
+                            igl::PER_VERTEX_NORMALS_WEIGHTING_TYPE_DEFAULT, N);
+    N = N.unaryExpr([](double x) { return isnan(x) ? 0.0 : x; });
+    V *= scale;
+    V.array().rowwise() *= RowVector3d(1, -1, -1).array();
+    N.array().rowwise() *= RowVector3d(1, -1, -1).array();
+    V.rowwise() += RowVector3d(-5, 5, 0);
+    anim.V.push_back(V);
+    anim.N.push_back(N);
+  }
+  return true;
+}
+
+// measurements of one encoding of the exported animation
+struct ExportBenchResult {
+  string encoding;
+  double msPerFrame = 0;
+  vector<double> frameMs;
+  double finishMs = 0;  // exportStop()
+  size_t bytes = 0;
+  int64_t peakHeapBytes = 0;
+};
+
+const char *const gltfEncodings[] = {"dense", "sparse", "quantized",
+                                     "compressed", "skinned"};
+
+double msSince(const chrono::steady_clock::time_point &t) {
+  return chrono::duration<double, milli>(chrono::steady_clock::now() - t)
+      .count();
+}
+
+ExportBenchResult runGltfExport(const BakedAnimation &anim,
+                                const string &encoding, const string &fn) {
+  ExportBenchResult result;
+  result.encoding = encoding;
+  exportgltf::ExportGltf exporter;
+  // sparse morph targets are the default
+  if (encoding == "dense") exporter.sparseMaxFraction = 0;
+  exporter.quantize = encoding == "quantized";
+  exporter.compress = encoding == "compressed";
+  exporter.skinned = encoding == "skinned";
+
+  const int64_t heapStart = allocStatsHeapBytes();
+  allocStatsResetPeak();
+  const auto tStart = chrono::steady_clock::now();
+  const int nFrames = anim.V.size();
+  exportgltf::MatrixXfR baseV;
+  SkinFit skinFit;
+  MatrixXd jointPos;
+  fora(f, 0, nFrames) {
+    const auto tFrame = chrono::steady_clock::now();
+    exportgltf::MatrixXfR V = anim.V[f].cast<float>();
+    if (f == 0) {
+      baseV = V;
+      const exportgltf::MatrixXfR N = anim.N[f].cast<float>();
+      const exportgltf::MatrixXuiR F = anim.F.cast<unsigned int>();
+      exporter.exportStart(V, N, F, exportgltf::MatrixXfR(), nFrames, false, 24,
+                           Imguc());
+      exporter.exportFullModel(V, N, F, exportgltf::MatrixXfR());
+      if (exporter.skinned) {
+        jointPos.resize(anim.cpVertices.size(), 3);
+        forlist(j, anim.cpVertices) {
+          jointPos.row(j) = anim.V[0].row(anim.cpVertices[j]);
+        }
+        skinFit.init(anim.V[0], jointPos, anim.weights);
+        MatrixXd rotations = MatrixXd::Zero(jointPos.rows(), 4);
+        rotations.col(3).setOnes();
+        exporter.exportSkin(jointPos.cast<float>(),
+                            skinFit.getJoints().cast<unsigned short>(),
+                            skinFit.getWeights().cast<float>());
+        exporter.exportJointPose(rotations.cast<float>(),
+                                 jointPos.cast<float>(), 0);
+      }
+    } else if (exporter.skinned) {
+      MatrixXd rotations, translations;
+      skinFit.fit(anim.V[f], rotations, translations);
+      exporter.exportJointPose(rotations.cast<float>(),
+                               translations.cast<float>(), f);
+    } else {
+      V -= baseV;
+      exporter.exportMorphTarget(V, exportgltf::MatrixXfR(), f);
+    }
+    result.frameMs.push_back(msSince(tFrame));
+  }
+  result.msPerFrame = msSince(tStart) / nFrames;
+  const auto tFinish = chrono::steady_clock::now();
+  exporter.exportStop(fn, true);
+  result.finishMs = msSince(tFinish);
+  result.peakHeapBytes = allocStatsPeakHeapBytes() - heapStart;
+  result.bytes = fileSize(fn);
+  return result;
+}
+
+// the OBJ files are removed once their sizes are known
+ExportBenchResult runOBJExport(const BakedAnimation &anim, const string &fn,
+                               WorkerPool &pool) {
+  ExportBenchResult result;
+  result.encoding = "obj";
+  const int64_t heapStart = allocStatsHeapBytes();
+  allocStatsResetPeak();
+  const auto tStart = chrono::steady_clock::now();
+  const int nFrames = anim.V.size();
+  vector<string> fns;
+  fora(f, 0, nFrames) {
+    const auto tFrame = chrono::steady_clock::now();
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), "_%04d.obj", f);
+    fns.push_back(fn + suffix);
+    writeMeshOBJ(fns.back(), anim.V[f], anim.F, anim.N[f], MatrixXd(), "",
+                 &pool);
+    result.frameMs.push_back(msSince(tFrame));
+  }
+  result.msPerFrame = msSince(tStart) / nFrames;
+  result.peakHeapBytes = allocStatsPeakHeapBytes() - heapStart;
+  for (const string &frameFn : fns) {
+    result.bytes += fileSize(frameFn);
+    remove(frameFn.c_str());
+  }
+  return result;
+}
+
+BenchRecord toRecord(const string &project, int vertices,
+                     const BenchOptions &opts, const ExportBenchResult &r) {
+  BenchRecord record;
+  record.benchmark = "export";
+  record.params = {{"project", project},
+                   {"encoding", r.encoding},
+                   {"viewport", viewportName(opts.viewports.front())},
+                   {"frames", opts.frames},
+                   {"amplitude", opts.amplitude}};
+  record.timings["frameMs"] = distribution(r.frameMs);
+  record.timings["finishMs"] = distribution({r.finishMs});
+  record.values = {{"vertices", vertices}, {"bytes", r.bytes}};
+  if (allocsCounted) record.values["peakHeapBytes"] = r.peakHeapBytes;
+  return record;
+}
+
+string toText(const ExportBenchResult &r) {
+  char line[256];
+  snprintf(line, sizeof(line),
+           "  %-10s %.3f ms per frame, finish %.1f ms, %.2f MB",
+           r.encoding.c_str(), r.msPerFrame, r.finishMs,
+           r.bytes / (1024.0 * 1024.0));
+  string text = line;
+  if (allocsCounted) {
+    snprintf(line, sizeof(line), ", peak heap %.1f MB",
+             r.peakHeapBytes / (1024.0 * 1024.0));
+    text += line;
+  }
+  return text;
+}
+
+bool benchExport(const string &zipFn, const BenchOptions &opts,
+                 WorkerPool &pool) {
+  BakedAnimation anim;
+  if (!bakeAnimation(zipFn, opts, pool, anim)) return false;
+  const int vertices = anim.V.front().rows();
+  const int frames = anim.V.size();
+  if (!opts.json) {
+    cout << zipFn << ": " << vertices << " vertices, " << frames << " frames"
+         << endl;
+  }
+  const string prefix = opts.outDir + "/" + baseName(zipFn);
+  vector<ExportBenchResult> results;
+  for (const char *encoding : gltfEncodings) {
+    results.push_back(
+        runGltfExport(anim, encoding, prefix + "_" + encoding + ".glb"));
+  }
+  results.push_back(runOBJExport(anim, prefix, pool));
+  bool ok = true;
+  for (const ExportBenchResult &r : results) {
+    if (r.bytes == 0) {
+      cerr << zipFn << ": cannot write the " << r.encoding << " export to "
+           << opts.outDir << endl;
+      ok = false;
+      continue;
+    }
+    cout << (opts.json ? toJSON(toRecord(zipFn, vertices, opts, r))
+                       : toText(r))
+         << endl;
+  }
+  return ok;
+}
+
+// Region (255 inside, 0 outside) and outline (0 on the stroke, 255 outside)
+// images of a synthetic layer: an ellipse with an elliptic hole, placed and
+// sized pseudo-randomly from the seed.
+void createLayer(int size, unsigned int seed, Imguc &region, Imguc &outline) {
+  auto random = [&seed]() {
+    seed = seed * 1103515245u + 12345u;
+    return ((seed >> 8) & 0xffff) / 65535.0;
+  };
+  const double cx = size * (0.25 + 0.5 * random());
+  const double cy = size * (0.25 + 0.5 * random());
+  const double rx = size * (0.06 + 0.14 * random());
+  const double ry = size * (0.06 + 0.14 * random());
+  const double strokeWidth = 3;
+  region = Imguc(size, size, 1);
+  outline = Imguc(size, size, 1);
+  fora(y, 0, size) fora(x, 0, size) {
+    const double dx = x - cx, dy = y - cy;
+    // approximate distance to the ellipse with radii (a, b)
+    auto dist = [&](double a, double b) {
+      const double d = sqrt(dx * dx / (a * a) + dy * dy / (b * b));
+      return (d - 1) * min(a, b);
+    };
+    const double outer = dist(rx, ry), inner = dist(rx / 3, ry / 3);
+    region(x, y, 0) = outer < 0 && inner > 0 ? 255 : 0;
+    outline(x, y, 0) =
+        abs(outer) < strokeWidth || abs(inner) < strokeWidth ? 0 : 255;
+  }
+}
+
+// the runs of a primitive on one canvas size and number of layers (0 for
+// the primitives working on a single image)
+struct ImageBenchResult {
+  string primitive;
+  int size = 0;
+  int layers = 0;
+  Distribution ms;
+  Distribution baseline;  // empty if not in the baseline
+};
+
+// runs of body() timed one after another, in ms
+vector<double> timeRuns(int runs, const function<void()> &body) {
+  vector<double> ms;
+  fora(run, 0, runs) {
+    const auto tStart = chrono::steady_clock::now();
+    body();
+    ms.push_back(msSince(tStart));
+  }
+  return ms;
+}
+
+vector<ImageBenchResult> runImagePrimitives(int size, int runs) {
+  Imguc region, outline;
+  createLayer(size, 1, region, outline);
+  vector<ImageBenchResult> results;
+  auto add = [&](const string &primitive, const function<void()> &body) {
+    ImageBenchResult r;
+    r.primitive = primitive;
+    r.size = size;
+    r.ms = distribution(timeRuns(runs, body));
+    results.push_back(r);
+  };
+
+  // the background around the region, as in scanlineFillOutline()
+  add("floodFill", [&]() {
+    Imguc I = region;
+    floodFill(I, 0, 0, 0, 128);
+  });
+  Imguc O;
+  add("dilateSquare", [&]() { dilateSquare(region, O, Cu({0}), 2); });
+  add("erodeSquare", [&]() { erodeSquare(region, O, Cu({0}), 2); });
+  add("findRegionBoundary", [&]() {
+    vector<vector<Vector2f>> bnds;
+    vector<Vector2f> holePts;
+    findRegionBoundary(region, bnds, holePts);
+  });
+  // cropping to the viewport as when a project is loaded, see
+  // fitToViewport() in loadsave.cpp
+  add("resize", [&]() {
+    const Imguc cropped = outline.resize(size * 3 / 4, size * 3 / 4, size / 8,
+                                         size / 8, Cu({255}));
+  });
+  // the encoding of the layer images in the project zip
+  vector<unsigned char> png;
+  add("pngEncode", [&]() {
+    unsigned char *data = nullptr;
+    int length = 0;
+    if (outline.savePNG(data, length)) {
+      png.assign(data, data + length);
+      free(data);
+    }
+  });
+  add("pngDecode", [&]() {
+    const Imguc decoded = Imguc::loadImage(png.data(), png.size(), -1, 1);
+  });
+  return results;
+}
+
+// Tiling, expanding and the PNG round trip of all the layers, the
+// per-layer work done when a project is opened, edited and saved.
+vector<ImageBenchResult> runLayerPrimitives(int size, int nLayers, int runs) {
+  vector<TiledImage> regions(nLayers), outlines(nLayers);
+  // the times of each run summed over the layers
+  vector<double> tileMs(runs), toImageMs(runs), encodeMs(runs),
+      decodeMs(runs);
+  auto addRuns = [runs](vector<double> &total, const vector<double> &ms) {
+    fora(run, 0, runs) total[run] += ms[run];
+  };
+  fora(i, 0, nLayers) {
+    Imguc region, outline;
+    createLayer(size, i + 1, region, outline);
+    addRuns(tileMs, timeRuns(runs, [&]() {
+              regions[i] = TiledImage(region, 0);
+              outlines[i] = TiledImage(outline, 255);
+            }));
+    addRuns(toImageMs,
+            timeRuns(runs, [&]() { outline = outlines[i].toImage(); }));
+    unsigned char *data = nullptr;
+    int length = 0;
+    addRuns(encodeMs, timeRuns(runs, [&]() {
+              free(data);
+              data = nullptr;
+              outline.savePNG(data, length);
+            }));
+    addRuns(decodeMs, timeRuns(runs, [&]() {
+              outline = Imguc::loadImage(data, length, -1, 1);
+            }));
+    free(data);
+  }
+  vector<ImageBenchResult> results;
+  for (const auto &primitive :
+       {make_pair("layersTile", tileMs), make_pair("layersToImage", toImageMs),
+        make_pair("layersPngEncode", encodeMs),
+        make_pair("layersPngDecode", decodeMs)}) {
+    ImageBenchResult r;
+    r.primitive = primitive.first;
+    r.size = size;
+    r.layers = nLayers;
+    r.ms = distribution(primitive.second);
+    results.push_back(r);
+  }
+  return results;
+}
+
+BenchRecord toRecord(const ImageBenchResult &r) {
+  BenchRecord record;
+  record.benchmark = "images";
+  record.params = {
+      {"primitive", r.primitive}, {"size", r.size}, {"layers", r.layers}};
+  record.timings["ms"] = r.ms;
+  return record;
+}
+
+// the timings of the primitives by recordKey()
+bool loadImageBaseline(const string &fn, map<string, Distribution> &baseline) {
+  vector<BenchRecord> records;
+  if (!loadRecords(fn, records)) return false;
+  for (const BenchRecord &r : records) {
+    const auto it = r.timings.find("ms");
+    if (r.benchmark == "images" && it != r.timings.end()) {
+      baseline[recordKey(r)] = it->second;
+    }
+  }
+  return true;
+}
+
+bool regressed(const ImageBenchResult &r, double tolerance) {
+  return significantlySlower(r.baseline, r.ms, tolerance);
+}
+
+string toText(const ImageBenchResult &r, double tolerance) {
+  char line[256];
+  string text = "  " + r.primitive;
+  if (r.layers > 0) text += ", " + to_string(r.layers) + " layers";
+  snprintf(line, sizeof(line), ": %.3f ms", r.ms.min);
+  text += line;
+  if (r.baseline.n > 0) {
+    const bool means = compareMeans(r.baseline, r.ms);
+    const double ms = means ? r.ms.mean : r.ms.min;
+    const double baselineMs = means ? r.baseline.mean : r.baseline.min;
+    snprintf(line, sizeof(line), ", baseline %.3f ms (%+.1f%%%s)%s",
+             baselineMs, 100 * (ms / baselineMs - 1),
+             means ? " of the mean" : "",
+             regressed(r, tolerance) ? " SLOWER" : "");
+    text += line;
+  }
+  return text;
+}
+
+bool benchImages(const BenchOptions &opts) {
+  map<string, Distribution> baseline;
+  if (!opts.baselineFn.empty() &&
+      !loadImageBaseline(opts.baselineFn, baseline)) {
+    cerr << "cannot read the baseline " << opts.baselineFn << endl;
+    return false;
+  }
+  int slower = 0;
+  for (const int size : opts.canvasSizes) {
+    if (!opts.json) cout << size << "x" << size << endl;
+    vector<ImageBenchResult> results = runImagePrimitives(size, opts.runs);
+    for (const int nLayers : opts.layerCounts) {
+      const vector<ImageBenchResult> layerResults =
+          runLayerPrimitives(size, nLayers, opts.runs);
+      results.insert(results.end(), layerResults.begin(), layerResults.end());
+    }
+    for (ImageBenchResult &r : results) {
+      const BenchRecord record = toRecord(r);
+      const auto it = baseline.find(recordKey(record));
+      if (it != baseline.end()) r.baseline = it->second;
+      if (regressed(r, opts.tolerance)) slower++;
+      cout << (opts.json ? toJSON(record) : toText(r, opts.tolerance))
+           << endl;
+    }
+  }
+  if (slower > 0) {
+    cerr << slower << " primitives slower than the baseline by more than "
+         << lround(100 * opts.tolerance) << "%" << endl;
+  }
+  return slower == 0;
+}
+
+// Compares the timings of the records of two files written with -m, matched
+// by recordKey(), and fails if any of them got significantly slower.
+bool compareResults(const string &oldFn, const string &newFn,
+                    const BenchOptions &opts) {
+  vector<BenchRecord> oldRecords, newRecords;
+  for (const auto &file : {make_pair(oldFn, &oldRecords),
+                           make_pair(newFn, &newRecords)}) {
+    if (!loadRecords(file.first, *file.second)) {
+      cerr << "cannot read " << file.first << endl;
+      return false;
+    }
+  }
+  map<string, const BenchRecord *> oldByKey;
+  for (const BenchRecord &r : oldRecords) oldByKey[recordKey(r)] = &r;
+  if (!opts.json) {
+    if (!oldRecords.empty()) cout << "old: " << oldRecords[0].build << endl;
+    if (!newRecords.empty()) cout << "new: " << newRecords[0].build << endl;
+  }
+
+  int compared = 0, slower = 0, unmatched = 0;
+  for (const BenchRecord &cur : newRecords) {
+    const auto it = oldByKey.find(recordKey(cur));
+    if (it == oldByKey.end()) {
+      unmatched++;
+      continue;
+    }
+    const BenchRecord &old = *it->second;
+    for (const auto &timing : cur.timings) {
+      const auto oldTiming = old.timings.find(timing.first);
+      if (oldTiming == old.timings.end()) continue;
+      const Distribution &o = oldTiming->second, &c = timing.second;
+      const bool means = compareMeans(o, c);
+      const double oldMs = means ? o.mean : o.min;
+      const double ms = means ? c.mean : c.min;
+      const double change = oldMs > 0 ? ms / oldMs - 1 : 0;
+      const bool slow = significantlySlower(o, c, opts.tolerance);
+      compared++;
+      if (slow) slower++;
+      if (opts.json) {
+        const json diff = {{"benchmark", cur.benchmark},
+                           {"params", cur.params},
+                           {"timing", timing.first},
+                           {"old", toJSON(o)},
+                           {"new", toJSON(c)},
+                           {"change", change},
+                           {"slower", slow}};
+        cout << diff.dump() << endl;
+        continue;
+      }
+      char line[128];
+      snprintf(line, sizeof(line), ": %.3f -> %.3f ms (%+.1f%% of the %s)%s",
+               oldMs, ms, 100 * change, means ? "mean" : "fastest run",
+               slow ? " SLOWER" : "");
+      cout << "  " << cur.benchmark << " " << cur.params.dump() << " "
+           << timing.first << line << endl;
+    }
+  }
+  cerr << compared << " timings compared, " << slower
+       << " significantly slower by more than "
+       << lround(100 * opts.tolerance) << "%";
+  if (unmatched > 0) cerr << ", " << unmatched << " results not in " << oldFn;
+  cerr << endl;
+  return slower == 0;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  BenchOptions opts;
+  if (!parseArgs(argc, argv, opts)) {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  if (opts.compare) {
+    return compareResults(opts.projects[0], opts.projects[1], opts) ? 0 : 1;
+  }
+  // the projects are measured one after another, the pool only speeds up
+  // loading them
+  if (opts.images) return benchImages(opts) ? 0 : 1;
+
+  WorkerPool pool(WorkerPool::defaultNumThreads());
+  int failed = 0;
+  for (const string &project : opts.projects) {
+    bool ok;
+    if (opts.accuracy) {
+      ok = benchAccuracy(project, opts, pool);
+    } else if (opts.reconstruction) {
+      ok = benchReconstruction(project, opts, pool);
+    } else if (opts.exportModels) {
+      ok = benchExport(project, opts, pool);
+    } else {
+      ok = benchDeformation(project, opts, pool);
+    }
+    if (!ok) failed++;
+  }
+  return failed > 0 ? 1 : 0;
+}
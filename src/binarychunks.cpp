@@ -0,0 +1,148 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "binarychunks.h"
+
+#include <cstring>
+
+using namespace std;
+
+namespace {
+
+void appendLittleEndian(string &buffer, uint64_t v, int nBytes) {
+  for (int i = 0; i < nBytes; i++) {
+    buffer.push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+  }
+}
+
+uint64_t parseLittleEndian(const char *p, int nBytes) {
+  uint64_t v = 0;
+  for (int i = 0; i < nBytes; i++) {
+    v |= static_cast<uint64_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+  }
+  return v;
+}
+
+}  // namespace
+
+BinaryWriter::BinaryWriter(const char magic[4], uint32_t version) {
+  writeBytes(magic, 4);
+  writeU32(version);
+}
+
+void BinaryWriter::beginChunk(const char tag[4]) {
+  writeBytes(tag, 4);
+  chunkStart = buffer.size();
+  writeU32(0);  // length, set by endChunk()
+}
+
+void BinaryWriter::endChunk() {
+  const uint64_t length = buffer.size() - chunkStart - 4;
+  for (int i = 0; i < 4; i++) {
+    buffer[chunkStart + i] = static_cast<char>((length >> (8 * i)) & 0xff);
+  }
+}
+
+void BinaryWriter::writeU32(uint32_t v) { appendLittleEndian(buffer, v, 4); }
+
+void BinaryWriter::writeI32(int32_t v) {
+  appendLittleEndian(buffer, static_cast<uint32_t>(v), 4);
+}
+
+void BinaryWriter::writeF64(double v) {
+  uint64_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  appendLittleEndian(buffer, bits, 8);
+}
+
+void BinaryWriter::writeString(const string &s) {
+  writeU32(s.size());
+  writeBytes(s.data(), s.size());
+}
+
+void BinaryWriter::writeBytes(const void *data, size_t n) {
+  buffer.append(static_cast<const char *>(data), n);
+}
+
+BinaryReader::BinaryReader(const char *data, size_t size)
+    : data(data), size(size) {}
+
+bool BinaryReader::readHeader(const char magic[4], uint32_t &version) {
+  const char *m = readBytes(4);
+  if (m == nullptr || memcmp(m, magic, 4) != 0) {
+    failed = true;
+    return false;
+  }
+  version = readU32();
+  return ok();
+}
+
+bool BinaryReader::readChunk(char tag[4], BinaryReader &payload) {
+  const char *t = readBytes(4);
+  const uint32_t length = readU32();
+  const char *p = readBytes(length);
+  if (t == nullptr || p == nullptr) return false;
+  memcpy(tag, t, 4);
+  payload = BinaryReader(p, length);
+  return true;
+}
+
+bool BinaryReader::findChunk(const char tag[4], BinaryReader &payload) {
+  char t[4];
+  while (!atEnd() && readChunk(t, payload)) {
+    if (memcmp(t, tag, 4) == 0) return true;
+  }
+  return false;
+}
+
+uint32_t BinaryReader::readU32() {
+  const char *p = readBytes(4);
+  return p != nullptr ? parseLittleEndian(p, 4) : 0;
+}
+
+int32_t BinaryReader::readI32() { return static_cast<int32_t>(readU32()); }
+
+double BinaryReader::readF64() {
+  const char *p = readBytes(8);
+  if (p == nullptr) return 0;
+  const uint64_t bits = parseLittleEndian(p, 8);
+  double v;
+  memcpy(&v, &bits, sizeof(v));
+  return v;
+}
+
+string BinaryReader::readString() {
+  const uint32_t n = readU32();
+  const char *p = readBytes(n);
+  return p != nullptr ? string(p, n) : string();
+}
+
+const char *BinaryReader::readBytes(size_t n) {
+  if (failed || n > size - pos) {
+    failed = true;
+    return nullptr;
+  }
+  const char *p = data + pos;
+  pos += n;
+  return p;
+}
+
+size_t BinaryReader::remaining(size_t elementSize) const {
+  return failed ? 0 : (size - pos) / elementSize;
+}
+
+bool hasBinaryMagic(const string &data, const char magic[4]) {
+  return data.size() >= 4 && memcmp(data.data(), magic, 4) == 0;
+}
@@ -0,0 +1,89 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef BINARYCHUNKS_H
+#define BINARYCHUNKS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Versioned binary files made of chunks, used for the project data (see
+// loadsave.h). A file starts with a 4 character magic and a version
+// followed by chunks, each with a 4 character tag, the length of its
+// payload and the payload. All numbers are little-endian regardless of the
+// host, unknown chunks are skipped by readers.
+class BinaryWriter {
+ public:
+  BinaryWriter() = default;
+  // starts a file
+  BinaryWriter(const char magic[4], std::uint32_t version);
+
+  // the payload of a chunk is written between these
+  void beginChunk(const char tag[4]);
+  void endChunk();
+
+  void writeU32(std::uint32_t v);
+  void writeI32(std::int32_t v);
+  void writeF64(double v);
+  void writeString(const std::string &s);
+  void writeBytes(const void *data, std::size_t n);
+
+  const std::string &data() const { return buffer; }
+
+ private:
+  std::string buffer;
+  std::size_t chunkStart = 0;
+};
+
+// Reads the data written by BinaryWriter from a buffer owned by the caller
+// (e.g. an entry read from a zip file) without copying it. Reads past the
+// end fail and leave the reader failed, so a sequence of reads can be
+// checked at once with ok().
+class BinaryReader {
+ public:
+  BinaryReader() = default;
+  BinaryReader(const char *data, std::size_t size);
+
+  // checks the magic of a file and reads its version
+  bool readHeader(const char magic[4], std::uint32_t &version);
+  // reads the next chunk, its payload is returned as a reader of its own
+  bool readChunk(char tag[4], BinaryReader &payload);
+  // finds the chunk with tag among the remaining ones (the reader is left
+  // after it)
+  bool findChunk(const char tag[4], BinaryReader &payload);
+
+  std::uint32_t readU32();
+  std::int32_t readI32();
+  double readF64();
+  std::string readString();
+  // the next n bytes or nullptr
+  const char *readBytes(std::size_t n);
+
+  bool ok() const { return !failed; }
+  bool atEnd() const { return pos == size; }
+  // number of elements of elementSize bytes that can be left at most
+  std::size_t remaining(std::size_t elementSize = 1) const;
+
+ private:
+  const char *data = nullptr;
+  std::size_t size = 0, pos = 0;
+  bool failed = false;
+};
+
+// whether data starts with the magic of a file
+bool hasBinaryMagic(const std::string &data, const char magic[4]);
+
+#endif  // BINARYCHUNKS_H
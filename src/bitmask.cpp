@@ -0,0 +1,356 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "bitmask.h"
+
+#include <array>
+#include <bitset>
+#include <cstring>
+#include <stack>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+const int wordBits = 64;
+
+int countTrailingZeros(uint64_t x) {
+#ifdef __GNUC__
+  return __builtin_ctzll(x);
+#else
+  int n = 0;
+  while (!(x & 1)) x >>= 1, n++;
+  return n;
+#endif
+}
+
+int countLeadingZeros(uint64_t x) {
+#ifdef __GNUC__
+  return __builtin_clzll(x);
+#else
+  int n = 0;
+  while (!(x >> 63)) x <<= 1, n++;
+  return n;
+#endif
+}
+
+// index of the first bit of r in [x, w) equal to value, or w if there is
+// none
+int nextBit(const uint64_t *r, int x, int w, bool value) {
+  while (x < w) {
+    const uint64_t word = value ? r[x / wordBits] : ~r[x / wordBits];
+    const uint64_t rest = word >> (x % wordBits);
+    if (rest != 0) return min(x + countTrailingZeros(rest), w);
+    x = (x / wordBits + 1) * wordBits;
+  }
+  return w;
+}
+
+int nextSet(const uint64_t *r, int x, int w) { return nextBit(r, x, w, true); }
+
+int nextUnset(const uint64_t *r, int x, int w) {
+  return nextBit(r, x, w, false);
+}
+
+// first index of the run of set bits of r ending at x
+int runBegin(const uint64_t *r, int x) {
+  while (x > 0) {
+    // unset bits below x in its word
+    const int i = (x - 1) / wordBits, o = (x - 1) % wordBits;
+    const uint64_t unset = ~r[i] << (wordBits - 1 - o);
+    if (unset != 0) return x - countLeadingZeros(unset);
+    x = i * wordBits;
+  }
+  return 0;
+}
+
+// sets bits [b, e) of r
+void setRange(uint64_t *r, int b, int e) {
+  while (b < e) {
+    const int i = b / wordBits, o = b % wordBits;
+    const int n = min(wordBits - o, e - b);
+    const uint64_t bits = n == wordBits ? ~uint64_t(0) : (uint64_t(1) << n) - 1;
+    r[i] |= bits << o;
+    b += n;
+  }
+}
+
+bool anySet(const uint64_t *r, int b, int e) {
+  while (b < e) {
+    const int i = b / wordBits, o = b % wordBits;
+    const int n = min(wordBits - o, e - b);
+    const uint64_t bits = n == wordBits ? ~uint64_t(0) : (uint64_t(1) << n) - 1;
+    if (r[i] & (bits << o)) return true;
+    b += n;
+  }
+  return false;
+}
+
+// bit i is set if byte i of the 64 bytes at p equals value
+uint64_t packEqualBytes(const unsigned char *p, unsigned char value) {
+  uint64_t bits = 0;
+#if defined(__SSE2__)
+  const __m128i v = _mm_set1_epi8(value);
+  fora(j, 0, 4) {
+    const __m128i b =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16 * j));
+    const int m = _mm_movemask_epi8(_mm_cmpeq_epi8(b, v));
+    bits |= uint64_t(m & 0xffff) << (16 * j);
+  }
+#elif defined(__wasm_simd128__)
+  const v128_t v = wasm_i8x16_splat(value);
+  fora(j, 0, 4) {
+    const v128_t b = wasm_v128_load(p + 16 * j);
+    const uint32_t m = wasm_i8x16_bitmask(wasm_i8x16_eq(b, v));
+    bits |= uint64_t(m & 0xffff) << (16 * j);
+  }
+#else
+  // 8 bytes per step: the high bit of a byte of z is set if the byte is
+  // zero, the high bits are then gathered by a multiplication (assumes a
+  // little-endian target)
+  const uint64_t lo7 = 0x7f7f7f7f7f7f7f7full;
+  const uint64_t splat = 0x0101010101010101ull * value;
+  fora(j, 0, 8) {
+    uint64_t x;
+    memcpy(&x, p + 8 * j, 8);
+    x ^= splat;
+    const uint64_t z = ~(((x & lo7) + lo7) | x | lo7);
+    bits |= (((z >> 7) * 0x0102040810204080ull) >> 56) << (8 * j);
+  }
+#endif
+  return bits;
+}
+
+// 8 bytes with 0xff for the set bits of the index
+const array<uint64_t, 256> &expandedBytes() {
+  static const array<uint64_t, 256> table = []() {
+    array<uint64_t, 256> t;
+    fora(i, 0, 256) {
+      t[i] = 0;
+      fora(j, 0, 8) if ((i >> j) & 1) t[i] |= uint64_t(0xff) << (8 * j);
+    }
+    return t;
+  }();
+  return table;
+}
+
+// gathers the even bits of x into its lower half
+uint64_t compactEvenBits(uint64_t x) {
+  x &= 0x5555555555555555ull;
+  x = (x | (x >> 1)) & 0x3333333333333333ull;
+  x = (x | (x >> 2)) & 0x0f0f0f0f0f0f0f0full;
+  x = (x | (x >> 4)) & 0x00ff00ff00ff00ffull;
+  x = (x | (x >> 8)) & 0x0000ffff0000ffffull;
+  x = (x | (x >> 16)) & 0x00000000ffffffffull;
+  return x;
+}
+
+}  // namespace
+
+BitMask::BitMask(int w, int h)
+    : w(w),
+      h(h),
+      wordsPerRow((w + wordBits - 1) / wordBits),
+      words(h * wordsPerRow, 0) {}
+
+BitMask BitMask::fromImage(const Imguc &I, unsigned char value, bool equal) {
+  BitMask M(I.w, I.h);
+  // whole words of single channel rows are packed at once
+  const int nFull = I.ch == 1 ? I.w / wordBits : 0;
+  fora(y, 0, I.h) {
+    uint64_t *r = M.row(y);
+    const unsigned char *p = &I(0, y, 0);
+    fora(k, 0, nFull) {
+      const uint64_t bits = packEqualBytes(p + k * wordBits, value);
+      r[k] = equal ? bits : ~bits;
+    }
+    fora(x, nFull * wordBits, I.w) {
+      if ((I(x, y, 0) == value) == equal) {
+        r[x / wordBits] |= uint64_t(1) << (x % wordBits);
+      }
+    }
+  }
+  return M;
+}
+
+BitMask BitMask::fromImage(const TiledImage &I, unsigned char value,
+                           bool equal) {
+  static_assert(TiledImage::tileSize == wordBits,
+                "a row of a tile is packed to a word");
+  BitMask M(I.w, I.h);
+  const uint64_t backgroundBits =
+      (I.background == value) == equal ? ~uint64_t(0) : 0;
+  fora(ty, 0, I.tilesY()) fora(tx, 0, I.tilesX()) {
+    const unsigned char *t = I.tile(tx, ty);
+    // the bits past the width stay unset
+    const int rest = I.w - tx * wordBits;
+    const uint64_t valid =
+        rest >= wordBits ? ~uint64_t(0) : (uint64_t(1) << rest) - 1;
+    const int y0 = ty * wordBits, y1 = min(y0 + wordBits, I.h);
+    fora(y, y0, y1) {
+      uint64_t bits = 0;
+      if (t == nullptr) {
+        bits = backgroundBits;
+      } else if (I.ch == 1) {
+        bits = packEqualBytes(t + (y - y0) * wordBits, value);
+        if (!equal) bits = ~bits;
+      } else {
+        const unsigned char *p = t + (y - y0) * wordBits * I.ch;
+        fora(x, 0, wordBits) {
+          if ((p[x * I.ch] == value) == equal) bits |= uint64_t(1) << x;
+        }
+      }
+      M.row(y)[tx] = bits & valid;
+    }
+  }
+  return M;
+}
+
+Imguc BitMask::toImage(unsigned char fgColor, unsigned char bgColor) const {
+  Imguc I(w, h, 1);
+  const array<uint64_t, 256> &expanded = expandedBytes();
+  const uint64_t fg = 0x0101010101010101ull * fgColor;
+  const uint64_t bg = 0x0101010101010101ull * bgColor;
+  const int nFull = w / 8;
+  fora(y, 0, h) {
+    const uint64_t *r = row(y);
+    unsigned char *p = &I(0, y, 0);
+    // 8 pixels at a time
+    fora(k, 0, nFull) {
+      const int byte = (r[k / 8] >> (8 * (k % 8))) & 0xff;
+      const uint64_t e = expanded[byte];
+      const uint64_t pixels = (e & fg) | (~e & bg);
+      memcpy(p + 8 * k, &pixels, 8);
+    }
+    fora(x, nFull * 8, w) {
+      p[x] = (r[x / wordBits] >> (x % wordBits)) & 1 ? fgColor : bgColor;
+    }
+  }
+  return I;
+}
+
+bool BitMask::get(int x, int y) const {
+  return (row(y)[x / wordBits] >> (x % wordBits)) & 1;
+}
+
+void BitMask::set(int x, int y, bool value) {
+  const uint64_t bit = uint64_t(1) << (x % wordBits);
+  if (value) {
+    row(y)[x / wordBits] |= bit;
+  } else {
+    row(y)[x / wordBits] &= ~bit;
+  }
+}
+
+int BitMask::count() const {
+  int n = 0;
+  for (const uint64_t word : words) n += bitset<wordBits>(word).count();
+  return n;
+}
+
+bool BitMask::intersects(const BitMask &other) const {
+  assert(w == other.w && h == other.h);
+  fora(i, 0, words.size()) {
+    if (words[i] & other.words[i]) return true;
+  }
+  return false;
+}
+
+BitMask BitMask::subsample(int factor) const {
+  if (factor <= 1) return *this;
+  BitMask O(w / factor, h / factor);
+  vector<uint64_t> acc(wordsPerRow);
+  fora(y, 0, O.h) {
+    // vertical reduction of the block rows
+    fill(acc.begin(), acc.end(), 0);
+    fora(j, 0, factor) {
+      const uint64_t *r = row(y * factor + j);
+      fora(k, 0, wordsPerRow) acc[k] |= r[k];
+    }
+
+    // horizontal reduction
+    uint64_t *o = O.row(y);
+    if (factor == 2) {
+      fora(k, 0, O.wordsPerRow) {
+        const uint64_t lo = acc[2 * k];
+        const uint64_t hi = 2 * k + 1 < wordsPerRow ? acc[2 * k + 1] : 0;
+        o[k] = compactEvenBits(lo | (lo >> 1)) |
+               (compactEvenBits(hi | (hi >> 1)) << 32);
+      }
+      // drop the last pixel of an odd width
+      const int rest = O.w % wordBits;
+      if (rest != 0) o[O.wordsPerRow - 1] &= (uint64_t(1) << rest) - 1;
+    } else {
+      fora(x, 0, O.w) {
+        if (anySet(acc.data(), x * factor, (x + 1) * factor)) {
+          o[x / wordBits] |= uint64_t(1) << (x % wordBits);
+        }
+      }
+    }
+  }
+  return O;
+}
+
+BitMask BitMask::floodFill(int x, int y) const {
+  BitMask F(w, h);
+  if (x < 0 || x >= w || y < 0 || y >= h || !get(x, y)) return F;
+
+  // spans of set pixels are filled at once, a pixel of the span filled means
+  // that the whole span is filled
+  stack<pair<int, int>> S;
+  S.push(make_pair(x, y));
+  while (!S.empty()) {
+    const int sx = S.top().first, sy = S.top().second;
+    S.pop();
+    if (F.get(sx, sy)) continue;
+    const uint64_t *r = row(sy);
+    const int b = runBegin(r, sx), e = nextUnset(r, sx, w);
+    setRange(F.row(sy), b, e);
+    for (int ny : {sy - 1, sy + 1}) {
+      if (ny < 0 || ny >= h) continue;
+      const uint64_t *n = row(ny);
+      for (int nx = nextSet(n, b, e); nx < e;
+           nx = nextSet(n, nextUnset(n, nx, w), e)) {
+        if (!F.get(nx, ny)) S.push(make_pair(nx, ny));
+      }
+    }
+  }
+  return F;
+}
+
+BitMask BitMask::boundary() const {
+  BitMask B(w, h);
+  const vector<uint64_t> empty(wordsPerRow, 0);
+  fora(y, 0, h) {
+    const uint64_t *r = row(y);
+    const uint64_t *up = y > 0 ? row(y - 1) : empty.data();
+    const uint64_t *down = y + 1 < h ? row(y + 1) : empty.data();
+    uint64_t *o = B.row(y);
+    fora(k, 0, wordsPerRow) {
+      const uint64_t left = (r[k] << 1) | (k > 0 ? r[k - 1] >> 63 : 0);
+      const uint64_t right =
+          (r[k] >> 1) | (k + 1 < wordsPerRow ? r[k + 1] << 63 : 0);
+      o[k] = r[k] & ~(left & right & up[k] & down[k]);
+    }
+  }
+  return B;
+}
@@ -0,0 +1,66 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef BITMASK_H
+#define BITMASK_H
+
+#include <image/image.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "tiledimage.h"
+
+// Binary image with one bit per pixel packed into 64-bit words, each row
+// starts at a new word. Used for the layer masks processed by the
+// reconstruction, which only distinguish foreground from background.
+class BitMask {
+ public:
+  BitMask() = default;
+  BitMask(int w, int h);
+
+  // foreground are the pixels of the first channel equal to value, or
+  // different from it if equal is false
+  static BitMask fromImage(const Imguc &I, unsigned char value, bool equal);
+  // the same, the tiles that are not allocated are packed without reading
+  static BitMask fromImage(const TiledImage &I, unsigned char value,
+                           bool equal);
+  Imguc toImage(unsigned char fgColor, unsigned char bgColor) const;
+
+  bool get(int x, int y) const;
+  void set(int x, int y, bool value = true);
+  int count() const;
+  // a pixel is set in both masks (of the same size)
+  bool intersects(const BitMask &other) const;
+
+  // a pixel is set if any pixel of the corresponding factor x factor block
+  // is, pixels not covered by a whole block are dropped
+  BitMask subsample(int factor) const;
+  // 4-connected component of set pixels containing (x, y)
+  BitMask floodFill(int x, int y) const;
+  // set pixels with an unset (or outside) 4-neighbour
+  BitMask boundary() const;
+
+  int w = 0, h = 0;
+
+ private:
+  std::uint64_t *row(int y) { return &words[y * wordsPerRow]; }
+  const std::uint64_t *row(int y) const { return &words[y * wordsPerRow]; }
+
+  int wordsPerRow = 0;
+  std::vector<std::uint64_t> words;
+};
+
+#endif  // BITMASK_H
@@ -0,0 +1,704 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "cdtmesher.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <deque>
+
+#include "macros.h"
+
+using namespace std;
+using namespace Eigen;
+
+namespace {
+
+// a + b = s + err exactly
+inline double twoSum(double a, double b, double &err) {
+  const double s = a + b;
+  const double bv = s - a;
+  const double av = s - bv;
+  err = (a - av) + (b - bv);
+  return s;
+}
+
+// sign of the exact sum of x[0..n), n <= 8 (Shewchuk's grow-expansion, the
+// largest non-zero component of the expansion has the sign of the sum)
+int exactSumSign(const double *x, int n) {
+  double h[8];
+  int m = 0;
+  fora(k, 0, n) {
+    double q = x[k];
+    int mm = 0;
+    fora(l, 0, m) {
+      double err;
+      q = twoSum(q, h[l], err);
+      if (err != 0) h[mm++] = err;
+    }
+    h[mm++] = q;
+    m = mm;
+  }
+  for (int l = m - 1; l >= 0; l--) {
+    if (h[l] != 0) return h[l] > 0 ? 1 : -1;
+  }
+  return 0;
+}
+
+// > 0 if a, b, c are counterclockwise, exact if the coordinate differences
+// are (always for floats of a similar magnitude)
+int orient(const Vector2d &a, const Vector2d &b, const Vector2d &c) {
+  const double acx = a(0) - c(0), acy = a(1) - c(1);
+  const double bcx = b(0) - c(0), bcy = b(1) - c(1);
+  const double l = acx * bcy, r = acy * bcx;
+  const double det = l - r;
+  const double errBound = 3.3306690738754716e-16 * (abs(l) + abs(r));
+  if (det > errBound) return 1;
+  if (-det > errBound) return -1;
+  const double x[4] = {fma(acx, bcy, -l), -fma(acy, bcx, -r), l, -r};
+  return exactSumSign(x, 4);
+}
+
+// d is inside the circumcircle of the counterclockwise a, b, c by more than
+// the rounding error (cocircular points are never flipped, so the flips
+// terminate)
+bool inCircle(const Vector2d &a, const Vector2d &b, const Vector2d &c,
+              const Vector2d &d) {
+  const double adx = a(0) - d(0), ady = a(1) - d(1);
+  const double bdx = b(0) - d(0), bdy = b(1) - d(1);
+  const double cdx = c(0) - d(0), cdy = c(1) - d(1);
+  const double alift = adx * adx + ady * ady;
+  const double blift = bdx * bdx + bdy * bdy;
+  const double clift = cdx * cdx + cdy * cdy;
+  const double bc = bdx * cdy - bdy * cdx, ca = cdx * ady - cdy * adx,
+               ab = adx * bdy - ady * bdx;
+  const double det = alift * bc + blift * ca + clift * ab;
+  const double permanent =
+      alift * (abs(bdx * cdy) + abs(bdy * cdx)) +
+      blift * (abs(cdx * ady) + abs(cdy * adx)) +
+      clift * (abs(adx * bdy) + abs(ady * bdx));
+  return det > 1e-14 * permanent;
+}
+
+Vector2d roundToFloat(const Vector2d &p) {
+  return Vector2d(float(p(0)), float(p(1)));
+}
+
+struct Tri {
+  // counterclockwise vertices
+  int v[3];
+  // neighbour across the edge opposite to v[i], -1 on the outer hull
+  int n[3];
+  // the edge opposite to v[i] is a segment
+  bool c[3];
+  bool inside;
+};
+
+struct Location {
+  int t = -1;
+  // the point lies on the edge opposite to v[edge] of t
+  int edge = -1;
+  // the point coincides with this vertex
+  int vertex = -1;
+};
+
+class Mesher {
+ public:
+  explicit Mesher(const CDTOptions &opts) : opts(opts) {}
+  void run(const vector<Vector2f> &pts, const vector<pair<int, int>> &segments,
+           const vector<Vector2f> &holes, MatrixXd &Vout, MatrixXi &Fout);
+
+ private:
+  static int next(int i) { return i == 2 ? 0 : i + 1; }
+  static int prev(int i) { return i == 0 ? 2 : i - 1; }
+
+  int newTri() {
+    tris.emplace_back();
+    return tris.size() - 1;
+  }
+  void setTri(int t, int a, int b, int c, int na, int nb, int nc, bool ca,
+              bool cb, bool cc, bool inside);
+  void replaceNeighbor(int t, int from, int to);
+  int neighborIndex(int t, int of) const;
+
+  Location locate(const Vector2d &p, int t, bool stopAtSegments) const;
+  int insertPoint(const Vector2d &p, const Location &loc, int v = -1);
+  void splitTri(int t, int v);
+  void splitEdge(int t, int i, int v);
+  void flip(int t, int i);
+  void legalize(vector<pair<int, int>> &stack);
+  void trisAround(int a, vector<int> &around) const;
+  bool findEdge(int a, int b, int &t, int &i) const;
+  void setSegment(int a, int b, bool c);
+  void insertSegment(int a, int b, int depth);
+  void markOutside(int t);
+
+  bool isBad(int t) const;
+  void refine();
+
+  const CDTOptions &opts;
+  vector<Vector2d> P;
+  vector<Tri> tris;
+  // a triangle of each vertex
+  vector<int> vertTri;
+  // triangles created or changed by the last insertion
+  vector<int> touched;
+  int numInput = 0, numSuper = 3;
+  int lastTri = 0;
+  // rotates the first edge tested by locate(), which avoids its cycles
+  mutable int walkCounter = 0;
+  double minEdgeLen2 = 0;
+};
+
+void Mesher::setTri(int t, int a, int b, int c, int na, int nb, int nc,
+                    bool ca, bool cb, bool cc, bool inside) {
+  Tri &T = tris[t];
+  T.v[0] = a, T.v[1] = b, T.v[2] = c;
+  T.n[0] = na, T.n[1] = nb, T.n[2] = nc;
+  T.c[0] = ca, T.c[1] = cb, T.c[2] = cc;
+  T.inside = inside;
+  vertTri[a] = vertTri[b] = vertTri[c] = t;
+  touched.push_back(t);
+}
+
+void Mesher::replaceNeighbor(int t, int from, int to) {
+  if (t < 0) return;
+  Tri &T = tris[t];
+  fora(i, 0, 3) {
+    if (T.n[i] == from) {
+      T.n[i] = to;
+      return;
+    }
+  }
+}
+
+int Mesher::neighborIndex(int t, int of) const {
+  const Tri &T = tris[t];
+  fora(i, 0, 3) if (T.n[i] == of) return i;
+  return -1;
+}
+
+Location Mesher::locate(const Vector2d &p, int t, bool stopAtSegments) const {
+  Location loc;
+  const int maxSteps = tris.size() + 3;
+  fora(step, 0, maxSteps) {
+    const Tri &T = tris[t];
+    const int start = walkCounter++ % 3;
+    int cross = -1, onEdge = -1;
+    fora(k, 0, 3) {
+      const int i = (start + k) % 3;
+      const int o = orient(P[T.v[next(i)]], P[T.v[prev(i)]], p);
+      if (o < 0) {
+        cross = i;
+        break;
+      }
+      if (o == 0) onEdge = i;
+    }
+    if (cross < 0) {
+      loc.t = t;
+      fora(i, 0, 3) if (P[T.v[i]] == p) loc.vertex = T.v[i];
+      if (loc.vertex < 0) loc.edge = onEdge;
+      return loc;
+    }
+    if (T.n[cross] < 0 || (stopAtSegments && T.c[cross])) return loc;
+    t = T.n[cross];
+  }
+  return loc;
+}
+
+void Mesher::splitTri(int t, int v) {
+  const Tri T = tris[t];
+  const int a = T.v[0], b = T.v[1], c = T.v[2];
+  const int t1 = newTri(), t2 = newTri();
+  setTri(t, v, b, c, T.n[0], t1, t2, T.c[0], false, false, T.inside);
+  setTri(t1, v, c, a, T.n[1], t2, t, T.c[1], false, false, T.inside);
+  setTri(t2, v, a, b, T.n[2], t, t1, T.c[2], false, false, T.inside);
+  replaceNeighbor(T.n[1], t, t1);
+  replaceNeighbor(T.n[2], t, t2);
+}
+
+void Mesher::splitEdge(int t, int i, int v) {
+  const Tri T = tris[t];
+  const int a = T.v[i], b = T.v[next(i)], c = T.v[prev(i)];
+  const int na = T.n[i], nb = T.n[next(i)], nc = T.n[prev(i)];
+  const bool cEdge = T.c[i], cb = T.c[next(i)], cc = T.c[prev(i)];
+  const int t1 = newTri();
+  if (na < 0) {
+    setTri(t, v, a, b, nc, -1, t1, cc, cEdge, false, T.inside);
+    setTri(t1, v, c, a, nb, t, -1, cb, false, cEdge, T.inside);
+    replaceNeighbor(nb, t, t1);
+    return;
+  }
+  // u = (d, c, b) on the other side of the edge b, c
+  const int u = na;
+  const Tri U = tris[u];
+  const int j = neighborIndex(u, t);
+  const int d = U.v[j];
+  const int udc = U.n[prev(j)], ubd = U.n[next(j)];
+  const bool cdc = U.c[prev(j)], cbd = U.c[next(j)];
+  const int t3 = newTri();
+  setTri(t, v, a, b, nc, t3, t1, cc, cEdge, false, T.inside);
+  setTri(t1, v, c, a, nb, t, u, cb, false, cEdge, T.inside);
+  setTri(u, v, d, c, udc, t1, t3, cdc, cEdge, false, U.inside);
+  setTri(t3, v, b, d, ubd, u, t, cbd, false, cEdge, U.inside);
+  replaceNeighbor(nb, t, t1);
+  replaceNeighbor(ubd, u, t3);
+}
+
+void Mesher::flip(int t, int i) {
+  // t = (a, b, c) and u = (d, c, b) become (a, b, d) and (a, d, c)
+  const Tri T = tris[t];
+  const int u = T.n[i];
+  const Tri U = tris[u];
+  const int j = neighborIndex(u, t);
+  const int a = T.v[i], b = T.v[next(i)], c = T.v[prev(i)], d = U.v[j];
+  const int nca = T.n[next(i)], nab = T.n[prev(i)];
+  const int nbd = U.n[next(j)], ndc = U.n[prev(j)];
+  const bool cca = T.c[next(i)], cab = T.c[prev(i)];
+  const bool cbd = U.c[next(j)], cdc = U.c[prev(j)];
+  setTri(t, a, b, d, nbd, u, nab, cbd, false, cab, T.inside);
+  setTri(u, a, d, c, ndc, nca, t, cdc, cca, false, U.inside);
+  replaceNeighbor(nbd, u, t);
+  replaceNeighbor(nca, t, u);
+}
+
+// stack of edges (t, i) opposite to the inserted point t.v[i]
+void Mesher::legalize(vector<pair<int, int>> &stack) {
+  while (!stack.empty()) {
+    const int t = stack.back().first, i = stack.back().second;
+    stack.pop_back();
+    const Tri &T = tris[t];
+    const int u = T.n[i];
+    if (T.c[i] || u < 0) continue;
+    const int d = tris[u].v[neighborIndex(u, t)];
+    if (!inCircle(P[T.v[0]], P[T.v[1]], P[T.v[2]], P[d])) continue;
+    flip(t, i);
+    stack.emplace_back(t, 0);
+    stack.emplace_back(u, 0);
+  }
+}
+
+// v is the index of p if it is already in P
+int Mesher::insertPoint(const Vector2d &p, const Location &loc, int v) {
+  if (loc.vertex >= 0) return loc.vertex;
+  if (v < 0) {
+    v = P.size();
+    P.push_back(p);
+    vertTri.push_back(loc.t);
+  }
+  touched.clear();
+  vector<pair<int, int>> stack;
+  if (loc.edge < 0) {
+    splitTri(loc.t, v);
+  } else {
+    splitEdge(loc.t, loc.edge, v);
+  }
+  for (const int t : touched) stack.emplace_back(t, 0);
+  legalize(stack);
+  lastTri = vertTri[v];
+  return v;
+}
+
+// triangles around the vertex a, counterclockwise unless it is on the hull
+void Mesher::trisAround(int a, vector<int> &around) const {
+  around.clear();
+  const int t0 = vertTri[a];
+  int s = t0;
+  do {
+    around.push_back(s);
+    const Tri &T = tris[s];
+    int k = 0;
+    while (T.v[k] != a) k++;
+    s = T.n[next(k)];
+  } while (s >= 0 && s != t0);
+  if (s == t0) return;
+  s = t0;
+  while (true) {
+    const Tri &T = tris[s];
+    int k = 0;
+    while (T.v[k] != a) k++;
+    s = T.n[prev(k)];
+    if (s < 0) return;
+    around.push_back(s);
+  }
+}
+
+// t.v[i] is the vertex of t opposite to the edge a, b
+bool Mesher::findEdge(int a, int b, int &t, int &i) const {
+  vector<int> around;
+  trisAround(a, around);
+  for (const int s : around) {
+    const Tri &T = tris[s];
+    int k = 0;
+    while (T.v[k] != a) k++;
+    if (T.v[next(k)] == b) {
+      t = s, i = prev(k);
+      return true;
+    }
+    if (T.v[prev(k)] == b) {
+      t = s, i = next(k);
+      return true;
+    }
+  }
+  return false;
+}
+
+void Mesher::setSegment(int a, int b, bool c) {
+  int t, i;
+  if (!findEdge(a, b, t, i)) return;
+  tris[t].c[i] = c;
+  const int u = tris[t].n[i];
+  if (u >= 0) tris[u].c[neighborIndex(u, t)] = c;
+}
+
+void Mesher::insertSegment(int a, int b, int depth) {
+  if (a == b) return;
+  const Vector2d A = P[a], B = P[b];
+
+  // the triangle around a crossed by a, b
+  int t = -1, i = -1;
+  {
+    vector<int> around;
+    trisAround(a, around);
+    for (const int s : around) {
+      const Tri &T = tris[s];
+      int k = 0;
+      while (T.v[k] != a) k++;
+      const int p = T.v[next(k)], q = T.v[prev(k)];
+      if (p == b || q == b) {
+        setSegment(a, b, true);
+        return;
+      }
+      const int op = orient(A, B, P[p]), oq = orient(A, B, P[q]);
+      // a vertex on the segment splits it
+      for (const int r : {p, q}) {
+        if ((r == p ? op : oq) == 0 && (P[r] - A).dot(B - A) > 0) {
+          insertSegment(a, r, depth);
+          insertSegment(r, b, depth);
+          return;
+        }
+      }
+      if (op < 0 && oq > 0) {
+        t = s, i = k;
+        break;
+      }
+    }
+  }
+  if (t < 0) return;
+
+  // edges crossed by the segment, each with its vertex right of it first
+  deque<pair<int, int>> crossing;
+  while (true) {
+    const Tri &T = tris[t];
+    const int p = T.v[next(i)], q = T.v[prev(i)];
+    if (T.c[i]) {
+      // two segments cross, both are split at their intersection
+      if (depth > 8) return;
+      const Vector2d Pp = P[p], Q = P[q];
+      const Vector2d d1 = B - A, d2 = Q - Pp;
+      const double den = d1(0) * d2(1) - d1(1) * d2(0);
+      if (den == 0) return;
+      const Vector2d w = Pp - A;
+      const double s = (w(0) * d2(1) - w(1) * d2(0)) / den;
+      const Vector2d x = roundToFloat(A + s * d1);
+      setSegment(p, q, false);
+      const Location loc = locate(x, t, false);
+      if (loc.t < 0) return;
+      const int v = insertPoint(x, loc);
+      insertSegment(p, v, depth + 1);
+      insertSegment(v, q, depth + 1);
+      insertSegment(a, v, depth + 1);
+      insertSegment(v, b, depth + 1);
+      return;
+    }
+    crossing.emplace_back(p, q);
+    const int u = T.n[i];
+    const int j = neighborIndex(u, t);
+    const int r = tris[u].v[j];
+    if (r == b) break;
+    const int o = orient(A, B, P[r]);
+    if (o == 0) {
+      insertSegment(a, r, depth);
+      insertSegment(r, b, depth);
+      return;
+    }
+    t = u;
+    i = o < 0 ? prev(j) : next(j);
+  }
+
+  // flip the crossed edges until none is left (Sloan), the edges of convex
+  // quads first
+  vector<pair<int, int>> created;
+  int guard = 0;
+  const int maxGuard = 100 * (crossing.size() + 10);
+  while (!crossing.empty() && guard++ < maxGuard) {
+    const pair<int, int> e = crossing.front();
+    crossing.pop_front();
+    int s, k;
+    if (!findEdge(e.first, e.second, s, k)) continue;
+    const Tri &T = tris[s];
+    const int u = T.n[k];
+    const int x = T.v[k], d = tris[u].v[neighborIndex(u, s)];
+    if (orient(P[x], P[T.v[next(k)]], P[d]) <= 0 ||
+        orient(P[x], P[d], P[T.v[prev(k)]]) <= 0) {
+      crossing.push_back(e);
+      continue;
+    }
+    flip(s, k);
+    const int ox = orient(A, B, P[x]), od = orient(A, B, P[d]);
+    if (ox * od < 0) {
+      crossing.emplace_back(x, d);
+    } else {
+      created.emplace_back(x, d);
+    }
+  }
+  setSegment(a, b, true);
+
+  // restore the Delaunay property of the new edges
+  bool swapped = true;
+  guard = 0;
+  while (swapped && guard++ < 100) {
+    swapped = false;
+    for (auto &e : created) {
+      int s, k;
+      if (!findEdge(e.first, e.second, s, k)) continue;
+      const Tri &T = tris[s];
+      const int u = T.n[k];
+      if (T.c[k] || u < 0) continue;
+      const int d = tris[u].v[neighborIndex(u, s)];
+      if (!inCircle(P[T.v[0]], P[T.v[1]], P[T.v[2]], P[d])) continue;
+      const int x = T.v[k];
+      flip(s, k);
+      e = make_pair(x, d);
+      swapped = true;
+    }
+  }
+}
+
+// flood fill from t up to the segments
+void Mesher::markOutside(int t) {
+  if (!tris[t].inside) return;
+  vector<int> stack = {t};
+  tris[t].inside = false;
+  while (!stack.empty()) {
+    const Tri &T = tris[stack.back()];
+    stack.pop_back();
+    fora(i, 0, 3) {
+      const int u = T.n[i];
+      if (T.c[i] || u < 0 || !tris[u].inside) continue;
+      tris[u].inside = false;
+      stack.push_back(u);
+    }
+  }
+}
+
+bool Mesher::isBad(int t) const {
+  const Tri &T = tris[t];
+  if (!T.inside) return false;
+  const Vector2d &a = P[T.v[0]], &b = P[T.v[1]], &c = P[T.v[2]];
+  const double la = (b - c).squaredNorm(), lb = (c - a).squaredNorm(),
+               lc = (a - b).squaredNorm();
+  const double lmin = min(la, min(lb, lc));
+  if (lmin < minEdgeLen2) return false;
+  const double area2 = (b - a)(0) * (c - a)(1) - (b - a)(1) * (c - a)(0);
+  if (opts.maxArea > 0 && area2 > 2 * opts.maxArea) return true;
+  if (opts.minAngle > 0) {
+    // circumradius / shortest edge > 1 / (2 sin(minAngle))
+    const double s = sin(opts.minAngle * M_PI / 180);
+    const double r2 = la * lb * lc / (4 * area2 * area2);
+    if (4 * s * s * r2 > lmin) return true;
+  }
+  return false;
+}
+
+void Mesher::refine() {
+  deque<int> queue;
+  fora(t, 0, tris.size()) if (isBad(t)) queue.push_back(t);
+  double domainArea = 0;
+  for (const Tri &T : tris) {
+    if (!T.inside) continue;
+    const Vector2d ab = P[T.v[1]] - P[T.v[0]], ac = P[T.v[2]] - P[T.v[0]];
+    domainArea += 0.5 * (ab(0) * ac(1) - ab(1) * ac(0));
+  }
+  // the segments are not split, so the termination is not guaranteed
+  const double expected =
+      numInput + (opts.maxArea > 0 ? domainArea / opts.maxArea : 0);
+  const int maxSteiner = static_cast<int>(min(8 * expected + 1000, 1e8));
+  const int maxVerts = P.size() + maxSteiner;
+
+  // inserts p visible from t, fails on segments and close to vertices
+  auto tryInsert = [&](const Vector2d &p, int t) {
+    const Location loc = locate(p, t, true);
+    if (loc.t < 0 || loc.vertex >= 0 || !tris[loc.t].inside) return false;
+    const Tri &T = tris[loc.t];
+    if (loc.edge >= 0 && T.c[loc.edge]) return false;
+    fora(i, 0, 3) {
+      if ((P[T.v[i]] - p).squaredNorm() < minEdgeLen2) return false;
+    }
+    insertPoint(p, loc);
+    return true;
+  };
+
+  while (!queue.empty() && int(P.size()) < maxVerts) {
+    const int t = queue.front();
+    queue.pop_front();
+    if (!isBad(t)) continue;
+    const Tri &T = tris[t];
+    const Vector2d a = P[T.v[0]], b = P[T.v[1]], c = P[T.v[2]];
+    const Vector2d ab = b - a, ac = c - a;
+    const double den = 2 * (ab(0) * ac(1) - ab(1) * ac(0));
+    const Vector2d cc =
+        a + Vector2d(ac(1) * ab.squaredNorm() - ab(1) * ac.squaredNorm(),
+                     ab(0) * ac.squaredNorm() - ac(0) * ab.squaredNorm()) /
+                den;
+    bool inserted = tryInsert(roundToFloat(cc), t);
+    if (!inserted && opts.maxArea > 0 && den > 4 * opts.maxArea) {
+      inserted = tryInsert(roundToFloat((a + b + c) / 3), t);
+    }
+    if (!inserted) continue;
+    for (const int u : touched) {
+      if (isBad(u)) queue.push_back(u);
+    }
+  }
+}
+
+void Mesher::run(const vector<Vector2f> &pts,
+                 const vector<pair<int, int>> &segments,
+                 const vector<Vector2f> &holes, MatrixXd &Vout,
+                 MatrixXi &Fout) {
+  numInput = pts.size();
+  Vout.resize(0, 3);
+  Fout.resize(0, 3);
+  if (numInput < 3) return;
+
+  // super triangle enclosing the points, its vertices follow the input ones
+  // and are dropped from the output
+  Vector2d lo = pts[0].cast<double>(), hi = lo;
+  for (const auto &p : pts) {
+    lo = lo.cwiseMin(p.cast<double>());
+    hi = hi.cwiseMax(p.cast<double>());
+  }
+  const Vector2d center = roundToFloat((lo + hi) / 2);
+  const double size = exp2(ceil(log2(max((hi - lo).maxCoeff(), 1.0))));
+  minEdgeLen2 = 1e-10 * size * size;
+  P.reserve(numInput + numSuper);
+  for (const auto &p : pts) P.push_back(p.cast<double>());
+  P.push_back(center + Vector2d(-32, -16) * size);
+  P.push_back(center + Vector2d(32, -16) * size);
+  P.push_back(center + Vector2d(0, 32) * size);
+  vertTri.assign(P.size(), 0);
+  tris.reserve(4 * numInput);
+  const int s0 = numInput;
+  newTri();
+  setTri(0, s0, s0 + 1, s0 + 2, -1, -1, -1, false, false, false, true);
+
+  // the points, duplicates are mapped to their first occurrence
+  vector<int> vid(numInput);
+  fora(i, 0, numInput) {
+    const Location loc = locate(P[i], lastTri, false);
+    if (loc.t < 0) return;
+    if (loc.vertex >= 0) {
+      vid[i] = loc.vertex;
+      continue;
+    }
+    vid[i] = insertPoint(P[i], loc, i);
+  }
+
+  for (const auto &s : segments) insertSegment(vid[s.first], vid[s.second], 0);
+
+  // the exterior and the holes
+  fora(t, 0, tris.size()) {
+    const Tri &T = tris[t];
+    if (T.v[0] >= s0 && T.v[0] < s0 + numSuper) markOutside(t);
+    if (T.v[1] >= s0 && T.v[1] < s0 + numSuper) markOutside(t);
+    if (T.v[2] >= s0 && T.v[2] < s0 + numSuper) markOutside(t);
+  }
+  for (const auto &h : holes) {
+    const Location loc = locate(h.cast<double>(), lastTri, false);
+    if (loc.t >= 0) markOutside(loc.t);
+  }
+
+  if (opts.minAngle > 0 || opts.maxArea > 0) refine();
+
+  // output without the super triangle vertices
+  const int nV = P.size() - numSuper;
+  Vout.resize(nV, 3);
+  auto outIdx = [&](int v) { return v < s0 ? v : v - numSuper; };
+  fora(v, 0, P.size()) {
+    if (v >= s0 && v < s0 + numSuper) continue;
+    Vout.row(outIdx(v)) << P[v](0), P[v](1), 0;
+  }
+  int nF = 0;
+  for (const Tri &T : tris) nF += T.inside;
+  Fout.resize(nF, 3);
+  nF = 0;
+  for (const Tri &T : tris) {
+    if (!T.inside) continue;
+    Fout.row(nF++) << outIdx(T.v[0]), outIdx(T.v[1]), outIdx(T.v[2]);
+  }
+}
+
+}  // namespace
+
+CDTOptions CDTOptions::fromTriangleOpts(const std::string &opts) {
+  CDTOptions o;
+  fora(i, 0, opts.size()) {
+    const char c = opts[i];
+    if (c != 'q' && c != 'a') continue;
+    const char *begin = opts.c_str() + i + 1;
+    char *end = const_cast<char *>(begin);
+    if (isdigit(*begin) || *begin == '.') {
+      const double val = strtod(begin, &end);
+      i += end - begin;
+      if (c == 'q') o.minAngle = val;
+      if (c == 'a') o.maxArea = val;
+    } else if (c == 'q') {
+      o.minAngle = 20;
+    }
+  }
+  // larger angles may prevent the refinement from terminating
+  o.minAngle = min(o.minAngle, 34.0);
+  return o;
+}
+
+void triangulateCDT(const std::vector<Eigen::Vector2f> &pts,
+                    const std::vector<std::pair<int, int>> &segments,
+                    const std::vector<Eigen::Vector2f> &holes,
+                    const CDTOptions &opts, Eigen::MatrixXd &Vout,
+                    Eigen::MatrixXi &Fout) {
+  Mesher mesher(opts);
+  mesher.run(pts, segments, holes, Vout, Fout);
+}
+
+void triangulateCDT(const TriData &triData, Eigen::MatrixXd &Vout,
+                    Eigen::MatrixXi &Fout) {
+  vector<Vector2f> pts;
+  vector<pair<int, int>> segments;
+  for (const auto &bnd : triData.regionBnds) {
+    const int n = pts.size();
+    pts.insert(pts.end(), bnd.begin(), bnd.end());
+    if (bnd.size() < 2) continue;
+    fora(l, 0, bnd.size()) {
+      segments.emplace_back(n + l, n + (l + 1) % bnd.size());
+    }
+  }
+  pts.insert(pts.end(), triData.interiorPts.begin(),
+             triData.interiorPts.end());
+  triangulateCDT(pts, segments, triData.regionHolePts,
+                 CDTOptions::fromTriangleOpts(triData.triangleOpts), Vout,
+                 Fout);
+}
@@ -0,0 +1,65 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CDTMESHER_H
+#define CDTMESHER_H
+
+#include <Eigen/Core>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <ir3d-utils/regionToMesh.h>
+
+// Refinement limits of triangulateCDT(), the ones of the Triangle switches
+// used for the regions.
+struct CDTOptions {
+  // minimum angle in degrees, 0 for no angle refinement
+  double minAngle = 0;
+  // maximum triangle area, 0 for no limit
+  double maxArea = 0;
+
+  // "q" with an optional angle (20 by default) and "a" with the area, e.g.
+  // "pqa25QYY". The other switches are ignored: the input is always a PSLG
+  // and the segments are never split (as with "YY").
+  static CDTOptions fromTriangleOpts(const std::string &opts);
+};
+
+// Constrained Delaunay triangulation of the domain bounded by the segments
+// (pairs of indices of pts), without the components containing a point of
+// holes, refined by inserting the circumcenters of the triangles violating
+// opts (Chew/Ruppert). Circumcenters that are not visible from their
+// triangle are skipped (too large triangles are split at their centroids
+// instead), so points are never inserted on the segments except where two
+// of them cross.
+//
+// Vout are pts in their order followed by the inserted points, with a zero
+// third column, Fout the counterclockwise triangles. Duplicate points are
+// kept in Vout but not referenced. It keeps no global state, i.e. it can be
+// called from several threads at once. The predicates are exact for points
+// with float coordinates of a similar magnitude, which is why the inserted
+// points are rounded to floats as well.
+void triangulateCDT(const std::vector<Eigen::Vector2f> &pts,
+                    const std::vector<std::pair<int, int>> &segments,
+                    const std::vector<Eigen::Vector2f> &holes,
+                    const CDTOptions &opts, Eigen::MatrixXd &Vout,
+                    Eigen::MatrixXi &Fout);
+
+// The same for the closed boundaries and the interior points of triData,
+// i.e. a replacement of triangulate(TriData &, ...) which does not need the
+// V, E, H matrices of Triangle (they are left empty).
+void triangulateCDT(const TriData &triData, Eigen::MatrixXd &Vout,
+                    Eigen::MatrixXi &Fout);
+
+#endif  // CDTMESHER_H
@@ -15,17 +15,28 @@
 #ifndef COMMONSTRUCTS_H
 #define COMMONSTRUCTS_H
 
-#include <miscutils/opengltools.h>
+#include <image/image.h>
 
 #include <Eigen/Dense>
 #include <chrono>
+#include <cstdint>
+#include <deque>
 #include <map>
+#include <memory>
 #include <set>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "cpanim.h"
-#include "def3dsdl.h"
 #include "defengarapl.h"
+#include "defenglbs.h"
+#include "meshlod.h"
+#include "perfprofile.h"
+#include "reccache.h"
+#include "tiledimage.h"
+
+struct RecResult;
 
 typedef enum {
   DRAW_OUTLINE,
@@ -49,21 +60,14 @@ struct ManipulationMode {
 
 enum { ERASE_PIXEL_COLOR = 128, NEUMANN_OUTLINE_PIXEL_COLOR = 64 };
 
+// ANIM_MODE_LAYER records over an existing animation of the sync length as
+// a new layer of it (see CPAnim), the other CPs as in ANIM_MODE_OVERWRITE
 typedef enum {
   ANIM_MODE_TIME_SCALED,
   ANIM_MODE_OVERWRITE,
-  ANIM_MODE_AVERAGE
+  ANIM_MODE_LAYER
 } AnimMode;
 
-struct GLData {
-  GLMeshData meshData;
-  GLuint shaderMatcap, shaderTexture;
-  std::vector<GLuint> textureNames;
-  GLuint templateImgTexName, textureImgTexName[4];
-  GLuint backgroundImgTexName;
-  Eigen::MatrixXd P, M;
-};
-
 struct ShadingOptions {
   bool showTexture = false;
   bool showTextureUseMatcapShading = true;
@@ -73,12 +77,16 @@ struct ShadingOptions {
   bool useNormalSmoothing = true;
   int normalSmoothingIters = 20;
   double normalSmoothingStep = 0.01;
+  // replaces the normalSmoothingIters explicit steps with one implicit step
+  // of the same length, it needs a factorization per mesh but only one solve
+  // per frame
+  bool implicitNormalSmoothing = false;
 };
 
 struct CPData {
   // control point animations
   std::unordered_map<int, CPAnim> cpsAnim;
-  CPAnim cpAnimSync;  // cpAnim used for synchronization only
+  CPAnimSync cpAnimSync;  // timeline of the sync animation
   int cpsAnimSyncId = -1;
   bool recordCP = false;  // true when CP position is being recorded
   bool recordCPActive =
@@ -103,17 +111,47 @@ struct DefData {
   Def3D def;
   Def3D defDeformMode;
   DefEngARAPL defEng;
+  // the faces (mesh.F) and the rest pose (mesh.VRest) are used directly,
+  // they change only when the mesh is reconstructed
   Mesh3D mesh;
   std::vector<std::vector<int>> verticesOfParts;
-  Eigen::MatrixXd VCurr, VRest, VRestOrig;
+  // coarser versions of mesh for drawing it small on the screen, built with
+  // the mesh
+  std::vector<MeshLOD> meshLODs;
+  // vertices displayed, a copy of mesh.VCurr that stays valid while an
+  // asynchronous deformation owns mesh.VCurr (see AsyncDeformation)
+  Eigen::MatrixXd VCurr;
   Eigen::MatrixXd normals;  // per vertex normals
-  Eigen::MatrixXi Faces;
+  // bumped whenever VCurr or mesh.F change, lets the normals and the GPU
+  // buffers skip work for a mesh at rest
+  std::uint64_t meshVersion = 0;
   int defEngMaxIter = 4;
   double rigidity = 0.999;
+  bool defEngParallelSolves = false;
+  bool defEngConvergenceControl = false;
+  bool defEngTwoLevel = false;
+  bool defEngSinglePrecision = false;
+  bool defEngParallelCorrespondences = false;
+  bool defEngParallelLocalStep = false;
+  bool defEngSupernodal = false;
+  bool defEngComponentSolves = false;
+  bool defEngLocalUpdates = false;
+  bool defEngPGSDepth = false;
+  // engine used for deformations (see defEngNames()), engines other than
+  // the reference one in defEng are created in defEngAlt when selected
+  std::string defEngName = "arap";
+  std::shared_ptr<DefEng> defEngAlt;
+  // skinning with biharmonic weights used instead of the selected engine
+  // during the playback of recorded animations (if enabled)
+  bool defEngPlaybackSkinning = false;
+  DefEngLBS defEngPlayback = DefEngLBS(true);
+  // reconstruction the deformation was set up from, stored in projects
+  std::shared_ptr<const RecResult> recResult;
 };
 
 struct ImgData {
-  std::deque<Imguc> outlineImgs, regionImgs;
+  // the outline images have the background 255, the region images 0
+  std::deque<TiledImage> outlineImgs, regionImgs;
   std::deque<int> layers;  // ordered IDs of images
   Imguc mergedOutlinesImg, mergedRegionsImg, mergedRegionsOneColorImg,
       currOutlineImg, minRegionsImg;
@@ -125,7 +163,16 @@ struct ImgData {
 };
 
 struct RecData {
+  // preset the settings below were last set from (see applyPerfProfile())
+  PerfProfile perfProfile = PERF_PROFILE_INTERACTIVE;
   std::string triangleOpts = "pqa25QYY";
+  // coarser triangulation used for interactive previews
+  std::string previewTriangleOpts = "pqa100QYY";
+  // maximum triangle area of each region adapted to its thickness
+  bool adaptiveTriangulation = false;
+  // triangulate the regions with the in-tree mesher (triangulateCDT())
+  // instead of Triangle
+  bool cdtTriangulation = false;
   int subsFactor = 2;
   bool armpitsStitching = false;
   bool armpitsStitchingInJointOptimization = false;
@@ -140,6 +187,19 @@ struct RecData {
   bool cpOptimizeForZ = true;
   bool cpOptimizeForXY = false;
   bool interiorDepthConditions = false;
+  // solve the inflation systems with the supernodal Cholesky (SupernodalLLT)
+  // instead of the LU of min_quad_with_fixed
+  bool supernodalSolver = false;
+  // threads of the libigl and Eigen loops (see setLibraryNumThreads()), 0 for
+  // the default of the platform
+  int numThreads = 0;
+  // per-region results of the last reconstruction, shared by the copies
+  // passed to background reconstructions
+  std::shared_ptr<RecCache> cache = std::make_shared<RecCache>();
+  std::shared_ptr<RecCache> previewCache = std::make_shared<RecCache>();
+  // reconstruction loaded from a project, used instead of reconstructing as
+  // long as the inputs match its RecResult::inputsHash
+  std::shared_ptr<const RecResult> storedResult;
 };
 
 struct PauseStatus {
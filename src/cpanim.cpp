@@ -14,6 +14,9 @@
 
 #include "cpanim.h"
 
+#include <miscutils/macros.h>
+
+#include <atomic>
 #include <iostream>
 
 #include "macros.h"
@@ -24,16 +27,89 @@ using namespace std;
 CPAnim::CPAnim() {}
 
 CPAnim::CPAnim(unsigned int length, const Eigen::Vector3d &p) {
-  keyposes.resize(length, Keypose{p, true});
+  resize(length, Keypose{p, true});
+}
+
+CPAnim::Curve &CPAnim::forWrite(std::shared_ptr<Curve> &c) {
+  if (!c) {
+    c = make_shared<Curve>();
+  } else if (c.use_count() > 1) {
+    // the copy keeps the space reserved for recording
+    auto copy = make_shared<Curve>();
+    copy->reserve(c->x.capacity());
+    *copy = *c;
+    c = copy;
+  } else {
+    // the other owners may have just released the curve on another thread
+    atomic_thread_fence(memory_order_acquire);
+  }
+  return *c;
+}
+
+CPAnim::Curve &CPAnim::curveForWrite() {
+  if (shift.isZero() || !curve) return forWrite(curve);
+  auto bake = [&](Curve &c) {
+    fora(t, 0, c.x.size()) {
+      c.x[t] += shift(0);
+      c.y[t] += shift(1);
+      c.z[t] += shift(2);
+    }
+  };
+  bake(forWrite(curve));
+  for (Layer &layer : layers) bake(forWrite(layer.curve));
+  shift.setZero();
+  return *curve;
 }
 
-CPAnim::CPAnim(const std::vector<Keypose> &keyposes) {
-  this->keyposes = keyposes;
+CPAnim::Curve &CPAnim::layerForWrite(Layer &layer) {
+  curveForWrite();
+  return forWrite(layer.curve);
+}
+
+void CPAnim::Curve::reserve(int capacity) {
+  x.reserve(capacity);
+  y.reserve(capacity);
+  z.reserve(capacity);
+  timestamps.reserve(capacity);
+  flags.reserve(capacity);
+}
+
+void CPAnim::Curve::resize(int length) {
+  x.resize(length);
+  y.resize(length);
+  z.resize(length);
+  timestamps.resize(length);
+  flags.resize(length);
+}
+
+void CPAnim::setKeypose(Curve &c, int t, const Keypose &k) {
+  c.x[t] = k.p(0);
+  c.y[t] = k.p(1);
+  c.z[t] = k.p(2);
+  c.timestamps[t] = k.timestamp;
+  c.flags[t] = (k.empty ? FLAG_EMPTY : 0) | (k.display ? FLAG_DISPLAY : 0) |
+               (k.have_timestamp ? FLAG_HAVE_TIMESTAMP : 0);
+}
+
+void CPAnim::resize(int length, const Keypose &k) {
+  const int prevLength = getLength();
+  if (length == prevLength) return;
+  Curve &c = curveForWrite();
+  c.resize(length);
+  fora(t, prevLength, length) setKeypose(c, t, k);
+  for (Layer &layer : layers) {
+    Curve &l = forWrite(layer.curve);
+    l.x.resize(length, k.p(0));
+    l.y.resize(length, k.p(1));
+    l.z.resize(length, k.p(2));
+    l.timestamps.resize(length);
+    l.flags.resize(length, FLAG_EMPTY);
+  }
 }
 
 void CPAnim::record(unsigned int t, const Keypose &k) {
   assert(t < getLength());
-  keyposes[t] = k;
+  setKeypose(curveForWrite(), t, k);
   lastT = t;
 }
 
@@ -43,27 +119,31 @@ void CPAnim::record(unsigned int t, const Eigen::Vector3d &p,
 }
 
 void CPAnim::record(const Keypose &k) {
-  keyposes.push_back(k);
-  lastT = keyposes.size() - 1;
+  const int length = getLength();
+  Curve &c = curveForWrite();
+  const int capacity = c.x.capacity();
+  if (length == capacity) {
+    // grow by whole chunks, so that long takes reallocate rarely
+    c.reserve(capacity + max(capacity, recordChunk));
+  }
+  resize(length + 1, k);
+  lastT = length;
 }
 
 void CPAnim::record(const Eigen::Vector3d &p, const int timestamp) {
   record(Keypose{p, timestamp, false, true, true});
 }
 
-Eigen::Vector3d CPAnim::replay(double t) {
+double CPAnim::getSpeedup() const {
   double speedup = temporalScalingFactor;
-  const int length = getLength();
-  if (length == 0) {
-    return Vector3d(0, 0, 0);
-  }
-  if (syncLength > 0) speedup *= length / static_cast<double>(syncLength);
-  lastT = t;
-  t = t * speedup + offset;
-  lastTTransformed = t;
+  if (syncLength > 0) speedup *= getLength() / static_cast<double>(syncLength);
+  return speedup;
+}
 
-  int i = static_cast<int>(floor(t));
-  double f = t - i;
+Eigen::Vector3d CPAnim::evaluate(double tTransformed) const {
+  const int length = getLength();
+  int i = static_cast<int>(floor(tTransformed));
+  double f = tTransformed - i;
   i = i % length;
   if (i < 0) i = length + i;
 
@@ -75,8 +155,24 @@ Eigen::Vector3d CPAnim::replay(double t) {
   }
   assert(t0 >= 0 && t1 >= 0 && t0 < length && t1 < length);
 
-  const Vector3d p = keyposes[t0].p * (1.0 - f) + keyposes[t1].p * f;
-  return (T * p.homogeneous()).hnormalized();
+  const Vector3d p = getPosition(t0) * (1.0 - f) + getPosition(t1) * f;
+  return transformed(p);
+}
+
+Eigen::Vector3d CPAnim::replay(double t) {
+  if (getLength() == 0) {
+    return Vector3d(0, 0, 0);
+  }
+  lastT = t;
+  lastTTransformed = t * getSpeedup() + offset;
+  return evaluate(lastTTransformed);
+}
+
+Eigen::Vector3d CPAnim::sample(double seconds) const {
+  if (getLength() == 0) {
+    return Vector3d(0, 0, 0);
+  }
+  return evaluate(seconds * keyposesPerSecond * getSpeedup() + offset);
 }
 
 void CPAnim::syncSetLength(int length) { syncLength = length; }
@@ -84,13 +180,57 @@ void CPAnim::syncSetLength(int length) { syncLength = length; }
 Eigen::Vector3d CPAnim::replay() {
   const Vector3d &p = replay(lastT);
   lastT++;
-  if (lastT >= keyposes.size()) lastT = 0;
+  if (lastT >= getLength()) lastT = 0;
   return p;
 }
 
-CPAnim::Keypose &CPAnim::peekk(int t) {
+CPAnim::Keypose CPAnim::getKeypose(int t) const {
+  assert(t >= 0 && t < getLength());
+  const uint8_t flags = curve->flags[t];
+  return Keypose{Vector3d(curve->x[t], curve->y[t], curve->z[t]) + shift,
+                 curve->timestamps[t],
+                 (flags & FLAG_EMPTY) != 0, (flags & FLAG_DISPLAY) != 0,
+                 (flags & FLAG_HAVE_TIMESTAMP) != 0};
+}
+
+Eigen::Vector3d CPAnim::getPosition(int t) const {
+  assert(t >= 0 && t < getLength());
+  Vector3d p(curve->x[t], curve->y[t], curve->z[t]);
+  if (layers.empty()) return p + shift;
+  double weight = 1;
+  for (const Layer &layer : layers) {
+    const Curve &l = *layer.curve;
+    if (l.flags[t] & FLAG_EMPTY) continue;
+    p += layer.weight * Vector3d(l.x[t], l.y[t], l.z[t]);
+    weight += layer.weight;
+  }
+  return p / weight + shift;
+}
+
+int CPAnim::getTimestamp(int t) const {
+  assert(t >= 0 && t < getLength());
+  return curve->timestamps[t];
+}
+
+bool CPAnim::isEmpty(int t) const {
   assert(t >= 0 && t < getLength());
-  return keyposes[t];
+  return (curve->flags[t] & FLAG_EMPTY) != 0;
+}
+
+bool CPAnim::isDisplayed(int t) const {
+  assert(t >= 0 && t < getLength());
+  return (curve->flags[t] & FLAG_DISPLAY) != 0;
+}
+
+void CPAnim::setDisplayed(int t, bool display) {
+  assert(t >= 0 && t < getLength());
+  if (isDisplayed(t) == display) return;
+  uint8_t &flags = curveForWrite().flags[t];
+  flags = display ? (flags | FLAG_DISPLAY) : (flags & ~FLAG_DISPLAY);
+}
+
+bool CPAnim::haveTimestamps() const {
+  return getLength() > 0 && (curve->flags[0] & FLAG_HAVE_TIMESTAMP) != 0;
 }
 
 Eigen::Vector3d CPAnim::peek(double t) { return replay(t); }
@@ -99,77 +239,131 @@ Eigen::Vector3d CPAnim::peek() { return replay(lastT); }
 
 void CPAnim::restart() { lastT = 0; }
 
-int CPAnim::getLength() const { return keyposes.size(); }
+int CPAnim::getLength() const { return curve ? curve->x.size() : 0; }
 
-void CPAnim::setLength(int length) { keyposes.resize(length, keyposes.back()); }
+void CPAnim::setLength(int length) {
+  resize(length, getKeypose(getLength() - 1));
+}
+
+void CPAnim::resample(int length) {
+  const int prevLength = getLength();
+  if (prevLength == 0 || length <= 0 || length == prevLength) return;
+  // keypose t of the result lies at t * step of the original, interpolated
+  // cyclically as in replay(), the flags and timestamps are taken from the
+  // nearer keypose
+  const double step = prevLength / static_cast<double>(length);
+  auto resampled = [&](const Curve &c) {
+    auto r = make_shared<Curve>();
+    r->resize(length);
+    fora(t, 0, length) {
+      const double s = t * step;
+      const int i0 = min(static_cast<int>(s), prevLength - 1);
+      const int i1 = i0 == prevLength - 1 ? 0 : i0 + 1;
+      const float f = s - i0;
+      r->x[t] = c.x[i0] * (1 - f) + c.x[i1] * f;
+      r->y[t] = c.y[i0] * (1 - f) + c.y[i1] * f;
+      r->z[t] = c.z[i0] * (1 - f) + c.z[i1] * f;
+      const int nearest = f < 0.5f ? i0 : i1;
+      r->timestamps[t] = c.timestamps[nearest];
+      r->flags[t] = c.flags[nearest];
+    }
+    return r;
+  };
+  curve = resampled(*curve);
+  for (Layer &layer : layers) layer.curve = resampled(*layer.curve);
+  offset *= length / static_cast<double>(prevLength);
+}
+
+void CPAnim::reserve(int length) { curveForWrite().reserve(length); }
 
 double CPAnim::getTransformedLength() const {
-  double speedup = temporalScalingFactor;
-  const int length = getLength();
-  if (syncLength > 0) speedup *= length / static_cast<double>(syncLength);
-  return length * speedup;
+  return getLength() * getSpeedup();
 }
 
 bool CPAnim::isActive() const { return active; }
 
 bool CPAnim::isAtBeginning() const { return lastT == 0; }
 
-void CPAnim::drawTrajectory(MyPainter &painter, const Eigen::Matrix4d &M,
-                            double beginningThicknessMult) {
-  const Matrix4d &MT = M * T;
-  fora(i, 0, keyposes.size()) {
-    const auto &k0 = keyposes[i == 0 ? keyposes.size() - 1 : (i - 1)];
-    const auto &k1 = keyposes[i];
-    if (!k0.display || !k1.display) continue;
-    const Vector3d p0 = (MT * k0.p.homogeneous()).hnormalized();
-    const Vector3d p1 = (MT * k1.p.homogeneous()).hnormalized();
-    painter.drawLine(p0(0), p0(1), p1(0), p1(1));
-    if (i == 0) {
-      int thickness = painter.getCurrentThickness();
-      painter.filledEllipse(p1(0), p1(1), beginningThicknessMult * thickness,
-                            beginningThicknessMult * thickness);
-    }
+void CPAnim::setTransform(const Eigen::Matrix4d &T) { this->T = T; }
+
+Eigen::Matrix4d &CPAnim::getTransform() { return T; }
+
+Eigen::Vector3d CPAnim::transformed(const Eigen::Vector3d &p) const {
+  if (T.row(3) == RowVector4d(0, 0, 0, 1)) {
+    return T.topLeftCorner<3, 3>() * p + T.topRightCorner<3, 1>();
   }
+  return (T * p.homogeneous()).hnormalized();
 }
 
-void CPAnim::drawKeyframes(MyPainter &painter, int r,
-                           const Eigen::Matrix4d &M) {
-  const Matrix4d &MT = M * T;
-  for (const auto &k : keyposes) {
-    if (!k.display) continue;
-    const Vector3d p = (MT * k.p.homogeneous()).hnormalized();
-    painter.drawEllipse(p(0), p(1), r, r);
+void CPAnim::applyTransform() {
+  const int length = getLength();
+  if (T.topLeftCorner<3, 3>().isIdentity() &&
+      T.row(3) == RowVector4d(0, 0, 0, 1)) {
+    // the curves stay shared
+    shift += T.topRightCorner<3, 1>();
+  } else if (length > 0) {
+    auto apply = [&](Curve &c) {
+      fora(t, 0, length) {
+        const Vector3d p = transformed(Vector3d(c.x[t], c.y[t], c.z[t]));
+        c.x[t] = p(0);
+        c.y[t] = p(1);
+        c.z[t] = p(2);
+      }
+    };
+    apply(curveForWrite());
+    for (Layer &layer : layers) apply(forWrite(layer.curve));
   }
+  T.setIdentity();
 }
 
-void CPAnim::setTransform(const Eigen::Matrix4d &T) { this->T = T; }
+const Eigen::Vector3d &CPAnim::getShift() const { return shift; }
 
-Eigen::MatrixXd &CPAnim::getTransform() { return T; }
+void CPAnim::setShift(const Eigen::Vector3d &shift) { this->shift = shift; }
 
-void CPAnim::applyTransform() {
-  for (auto &k : keyposes) {
-    k.p = (T * k.p.homogeneous()).hnormalized();
+void CPAnim::shareKeyposes(const CPAnim &other) {
+  curve = other.curve;
+  layers = other.layers;
+  shift = other.shift;
+}
+
+bool CPAnim::sharesKeyposes(const CPAnim &other) const {
+  if (curve != other.curve || layers.size() != other.layers.size()) {
+    return false;
   }
-  T.setIdentity();
+  forlist(l, layers) {
+    if (layers[l].curve != other.layers[l].curve) return false;
+  }
+  return true;
+}
+
+bool CPAnim::sameAs(const CPAnim &other) const {
+  if (!sharesKeyposes(other)) return false;
+  forlist(l, layers) {
+    if (layers[l].weight != other.layers[l].weight) return false;
+  }
+  return T == other.T && shift == other.shift && active == other.active &&
+         offset == other.offset && syncLength == other.syncLength &&
+         temporalScalingFactor == other.temporalScalingFactor;
 }
 
 Eigen::Vector3d CPAnim::getCentroid() const {
+  const int length = getLength();
   Vector3d centroid(0, 0, 0);
-  for (const auto &k : keyposes) centroid += k.p;
-  return centroid / keyposes.size();
+  fora(t, 0, length) centroid += getPosition(t);
+  return centroid / length;
 }
 
 ostream &operator<<(ostream &out, const CPAnim &cpAnim) {
-  const auto &keyposes = cpAnim.keyposes;
-  if (cpAnim.getLength() > 0) {
-    bool have_timestamps = keyposes[0].have_timestamp;
+  const int length = cpAnim.getLength();
+  if (length > 0) {
+    bool have_timestamps = cpAnim.haveTimestamps();
     out << "speedup " << cpAnim.getTemporalScalingFactor() << endl;
     out << "offset " << cpAnim.getOffset() << endl;
     out << "have_timestamps " << (have_timestamps ? 1 : 0) << endl;
-    out << static_cast<int>(keyposes.size()) << endl;
-    forlist(i, keyposes) {
-      out << keyposes[i].p.transpose();
-      if (have_timestamps) out << " " << keyposes[i].timestamp;
+    out << length << endl;
+    fora(i, 0, length) {
+      out << cpAnim.getPosition(i).transpose();
+      if (have_timestamps) out << " " << cpAnim.getTimestamp(i);
       out << endl;
     }
   }
@@ -201,6 +395,7 @@ istream &operator>>(istream &in, CPAnim &cpAnim) {
 
   int num;
   in >> num;
+  if (num > 0) cpAnim.reserve(cpAnim.getLength() + num);
   fora(i, 0, num) {
     double x, y, z;
     in >> x >> y >> z;
@@ -227,27 +422,228 @@ double CPAnim::getTemporalScalingFactor() const {
 }
 
 void CPAnim::setAll(bool empty, bool display) {
-  for (auto &k : keyposes) {
-    k.empty = empty;
-    k.display = display;
+  if (getLength() == 0) return;
+  const uint8_t set = (empty ? FLAG_EMPTY : 0) | (display ? FLAG_DISPLAY : 0);
+  for (auto &flags : curveForWrite().flags) {
+    flags = (flags & ~(FLAG_EMPTY | FLAG_DISPLAY)) | set;
   }
 }
 
-const std::vector<CPAnim::Keypose> &CPAnim::getKeyposes() { return keyposes; }
+// Solves the tridiagonal system with -lambda next to the diagonal, diag on
+// the diagonal except diagFirst and diagLast at its ends, d is replaced by
+// the solution.
+static void solveTridiagonal(double lambda, double diag, double diagFirst,
+                             double diagLast, vector<double> &d,
+                             vector<double> &scratch) {
+  const int n = d.size();
+  scratch.resize(n);
+  double m = diagFirst;
+  scratch[0] = -lambda / m;
+  d[0] /= m;
+  fora(i, 1, n) {
+    m = (i == n - 1 ? diagLast : diag) + lambda * scratch[i - 1];
+    scratch[i] = -lambda / m;
+    d[i] = (d[i] + lambda * d[i - 1]) / m;
+  }
+  for (int i = n - 2; i >= 0; i--) d[i] -= scratch[i] * d[i + 1];
+}
 
 void CPAnim::performSmoothing(int tFrom, int tTo, int iterations) {
   const int length = getLength();
-  if (length == 0) return;
-  fora(it, 0, iterations) {
-    fora(i, tFrom, tTo + 1) {
-      int i1 = (i - 1) % length;
-      if (i1 < 0) i1 = length + i1;
-      int i2 = (i1 + 1) % length;  // always positive
-      int i3 = (i1 + 2) % length;  // always positive
-      auto &k1 = keyposes[i1];
-      auto &k2 = keyposes[i2];
-      auto &k3 = keyposes[i3];
-      k2.p = (k1.p + k2.p + k3.p) / 3.0;
+  if (length < 3 || iterations <= 0 || tTo < tFrom) return;
+  // A single implicit step of the diffusion that repeated averaging of
+  // neighbours approximates: (I - lambda L) p = p0 with the second
+  // difference L, each averaging pass corresponds to lambda = 1/3. The
+  // keyposes next to the range stay fixed, if the range covers the whole
+  // animation the system is cyclic (solved by Sherman-Morrison).
+  const double lambda = iterations / 3.0;
+  const double diag = 1 + 2 * lambda;
+  const bool cyclic = tTo - tFrom + 1 >= length;
+  const int n = cyclic ? length : tTo - tFrom + 1;
+  auto index = [&](int i) {
+    i %= length;
+    return i < 0 ? i + length : i;
+  };
+  const int first = cyclic ? 0 : index(tFrom);
+
+  vector<double> d(n), z, scratch;
+  double gamma = 0, zFactor = 0;
+  if (cyclic) {
+    // the corners (-lambda) are moved to the ends of the diagonal and
+    // corrected for by the rank one update u v^T, u = (gamma, 0, ..., -lambda)
+    // and v = (1, 0, ..., -lambda / gamma)
+    gamma = -diag;
+    z.assign(n, 0);
+    z[0] = gamma;
+    z[n - 1] = -lambda;
+    solveTridiagonal(lambda, diag, diag - gamma,
+                     diag - lambda * lambda / gamma, z, scratch);
+    zFactor = 1 + z[0] - lambda * z[n - 1] / gamma;
+  }
+
+  vector<Curve *> curves = {&curveForWrite()};
+  for (Layer &layer : layers) curves.push_back(&forWrite(layer.curve));
+  for (Curve *c : curves) {
+    for (vector<float> *channel : {&c->x, &c->y, &c->z}) {
+      vector<float> &x = *channel;
+      fora(i, 0, n) d[i] = x[index(first + i)];
+      if (cyclic) {
+        solveTridiagonal(lambda, diag, diag - gamma,
+                         diag - lambda * lambda / gamma, d, scratch);
+        const double fact = (d[0] - lambda * d[n - 1] / gamma) / zFactor;
+        fora(i, 0, n) d[i] -= fact * z[i];
+      } else {
+        d[0] += lambda * x[index(first - 1)];
+        d[n - 1] += lambda * x[index(first + n)];
+        solveTridiagonal(lambda, diag, diag, diag, d, scratch);
+      }
+      fora(i, 0, n) x[index(first + i)] = d[i];
+    }
+  }
+}
+
+int CPAnim::getNumLayers() const { return layers.size(); }
+
+void CPAnim::addLayer(float weight) {
+  // the keyposes not recorded yet hold the positions of the base, so that
+  // smoothing the layer next to them does not pull it elsewhere
+  Layer layer;
+  layer.curve = make_shared<Curve>();
+  if (curve) *layer.curve = *curve;
+  for (auto &flags : layer.curve->flags) flags = FLAG_EMPTY;
+  layer.weight = weight;
+  layers.push_back(layer);
+}
+
+void CPAnim::recordLayer(unsigned int t, const Eigen::Vector3d &p) {
+  assert(!layers.empty() && t < getLength());
+  Curve &l = layerForWrite(layers.back());
+  setKeypose(l, t, Keypose{p, 0, false, true, false});
+  lastT = t;
+}
+
+void CPAnim::removeLayer(int layer) {
+  assert(layer >= 0 && layer < getNumLayers());
+  layers.erase(layers.begin() + layer);
+}
+
+float CPAnim::getLayerWeight(int layer) const { return layers[layer].weight; }
+
+void CPAnim::setLayerWeight(int layer, float weight) {
+  layers[layer].weight = weight;
+}
+
+bool CPAnim::isLayerEmpty(int layer, int t) const {
+  return (layers[layer].curve->flags[t] & FLAG_EMPTY) != 0;
+}
+
+Eigen::Vector3d CPAnim::getLayerPosition(int layer, int t) const {
+  const Curve &l = *layers[layer].curve;
+  return Vector3d(l.x[t], l.y[t], l.z[t]) + shift;
+}
+
+void CPAnim::flattenLayers() {
+  if (layers.empty()) return;
+  const int length = getLength();
+  vector<Vector3d> blended(length);
+  fora(t, 0, length) blended[t] = getPosition(t);
+  layers.clear();
+  Curve &c = curveForWrite();
+  fora(t, 0, length) {
+    c.x[t] = blended[t](0);
+    c.y[t] = blended[t](1);
+    c.z[t] = blended[t](2);
+  }
+}
+
+void CPAnimBatch::clear(int syncLength) {
+  this->syncLength = syncLength;
+  anims.clear();
+  keys.clear();
+  lengths.clear();
+  speedups.clear();
+  offsets.clear();
+  withTransform.clear();
+}
+
+void CPAnimBatch::add(CPAnim &anim, int key) {
+  anim.syncSetLength(syncLength);
+  if (!anim.T.isIdentity()) withTransform.push_back(anims.size());
+  anims.push_back(&anim);
+  keys.push_back(key);
+  lengths.push_back(anim.getLength());
+  speedups.push_back(anim.getSpeedup());
+  offsets.push_back(anim.offset);
+}
+
+int CPAnimBatch::size() const { return anims.size(); }
+
+int CPAnimBatch::getKey(int i) const { return keys[i]; }
+
+void CPAnimBatch::replay(double t) {
+  evaluate(t);
+  fora(i, 0, size()) {
+    if (lengths[i] == 0) continue;
+    anims[i]->lastT = t;
+    anims[i]->lastTTransformed = tTransformed[i];
+  }
+}
+
+void CPAnimBatch::sample(double seconds) {
+  evaluate(seconds * CPAnim::keyposesPerSecond);
+}
+
+void CPAnimBatch::evaluate(double t) {
+  const int n = anims.size();
+  tTransformed.resize(n);
+  fora(i, 0, n) tTransformed[i] = t * speedups[i] + offsets[i];
+  t0.resize(n);
+  t1.resize(n);
+  f.resize(n);
+  fora(i, 0, n) {
+    const int length = lengths[i];
+    if (length == 0) {
+      t0[i] = t1[i] = -1;
+      f(i) = 0;
+      continue;
     }
+    const double tFloor = floor(tTransformed[i]);
+    int k = static_cast<int>(tFloor) % length;
+    if (k < 0) k += length;
+    t0[i] = k;
+    t1[i] = k == length - 1 ? 0 : k + 1;
+    f(i) = tTransformed[i] - tFloor;
   }
+
+  P0.resize(3, n);
+  P1.resize(3, n);
+  fora(i, 0, n) {
+    if (t0[i] == -1) {
+      P0.col(i).setZero();
+      P1.col(i).setZero();
+      continue;
+    }
+    const CPAnim &a = *anims[i];
+    if (!a.layers.empty()) {
+      // blended in the same pass, linear in the number of layers
+      P0.col(i) = a.getPosition(t0[i]);
+      P1.col(i) = a.getPosition(t1[i]);
+      continue;
+    }
+    const CPAnim::Curve &c = *a.curve;
+    P0.col(i) << c.x[t0[i]], c.y[t0[i]], c.z[t0[i]];
+    P1.col(i) << c.x[t1[i]], c.y[t1[i]], c.z[t1[i]];
+    P0.col(i) += a.shift;
+    P1.col(i) += a.shift;
+  }
+  positions = P0.array().rowwise() * (1.0 - f.array()) +
+              P1.array().rowwise() * f.array();
+  for (int i : withTransform) {
+    if (t0[i] == -1) continue;
+    positions.col(i) = anims[i]->transformed(positions.col(i));
+  }
+}
+
+Eigen::Vector3d CPAnimBatch::getPosition(int i) const {
+  return positions.col(i);
 }
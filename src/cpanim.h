@@ -16,13 +16,27 @@
 #define CPANIM_H
 
 #include <Eigen/Dense>
+#include <cstdint>
 #include <iostream>
+#include <memory>
 #include <vector>
 
-#include "mypainter.h"
+class MyPainter;
 
+// Control point animation sampled at a fixed rate (one keypose per frame).
+// The samples are stored as a compact curve (float positions in separate
+// arrays and the flags packed into a byte per keypose) shared copy-on-write
+// between copies of the animation, e.g. the snapshots of CPData or a clip
+// pasted to many CPs. A translation of all keyposes is kept apart from the
+// curves (see getShift()), so placing a shared clip does not copy it.
+//
+// Takes recorded over an existing animation (ANIM_MODE_LAYER) are kept as
+// layers of the same length instead of being baked into its keyposes. The
+// played position at a keypose is the weighted average of the base keypose
+// (weight 1) and of the layers that recorded it.
 class CPAnim {
  public:
+  // a single keypose as recorded and read back
   struct Keypose {
     Eigen::Vector3d p;
     int timestamp;
@@ -33,7 +47,6 @@ class CPAnim {
 
   CPAnim();
   CPAnim(unsigned int length, const Eigen::Vector3d &p);
-  CPAnim(const std::vector<Keypose> &keyposes);
 
   void record(const Eigen::Vector3d &p, const int timestamp);
   void record(unsigned int t, const Eigen::Vector3d &p, const int timestamp);
@@ -41,13 +54,34 @@ class CPAnim {
   void record(unsigned int t, const Keypose &k);
   Eigen::Vector3d replay(double t);
   Eigen::Vector3d replay();
+  // position the given time after the beginning of the (sync) animation
+  // played at keyposesPerSecond, unlike replay() it does not change the
+  // state of the animation
+  Eigen::Vector3d sample(double seconds) const;
   Eigen::Vector3d peek(double t);
   Eigen::Vector3d peek();
-  Keypose &peekk(int t);
+  // keypose of the base (without the layers)
+  Keypose getKeypose(int t) const;
+  // untransformed position at keypose t blended from the base and the layers
+  Eigen::Vector3d getPosition(int t) const;
+  int getTimestamp(int t) const;
+  bool isEmpty(int t) const;
+  bool isDisplayed(int t) const;
+  void setDisplayed(int t, bool display);
+  // whether the keyposes were recorded with timestamps (given by the first)
+  bool haveTimestamps() const;
   void syncSetLength(int length);
   void restart();
   int getLength() const;
+  // truncates or pads with the last keypose
   void setLength(int length);
+  // Interpolates the base and the layers to the given number of keyposes.
+  // Synchronized animations loop once per loop of the sync animation
+  // whatever their length, the offset is scaled so that the playback stays
+  // the same.
+  void resample(int length);
+  // space for the given number of keyposes, e.g. before loading them
+  void reserve(int length);
   double getTransformedLength() const;
   bool isActive() const;
   bool isAtBeginning() const;
@@ -57,30 +91,155 @@ class CPAnim {
   void drawKeyframes(MyPainter &painter, int r,
                      const Eigen::Matrix4d &M = Eigen::Matrix4d::Identity());
   void setTransform(const Eigen::Matrix4d &T);
-  Eigen::MatrixXd &getTransform();
+  Eigen::Matrix4d &getTransform();
+  // makes the transform part of the keyposes, a translation only moves the
+  // shift
   void applyTransform();
+  // translation of all keyposes (included in the positions returned),
+  // baked into the curves when they are modified
+  const Eigen::Vector3d &getShift() const;
+  void setShift(const Eigen::Vector3d &shift);
+  // plays the keyposes and layers of other, shared until one of the
+  // animations modifies them, the timing and the transform are kept
+  void shareKeyposes(const CPAnim &other);
+  bool sharesKeyposes(const CPAnim &other) const;
+  // shares the keyposes and has the same timing and transform, true for an
+  // unmodified copy
+  bool sameAs(const CPAnim &other) const;
   Eigen::Vector3d getCentroid() const;
   void setOffset(double val);
   double getOffset() const;
   void setTemporalScalingFactor(double val);
   double getTemporalScalingFactor() const;
   void setAll(bool empty, bool display);
-  const std::vector<Keypose> &getKeyposes();
+  // smooths the positions of the keyposes tFrom to tTo (taken cyclically),
+  // as strongly as the given number of passes of neighbour averaging would
   void performSmoothing(int tFrom, int tTo, int iterations);
 
+  // the layers are numbered from the bottom, addLayer() adds an empty layer
+  // on the top and recordLayer() records to the top layer
+  int getNumLayers() const;
+  void addLayer(float weight = 1);
+  void recordLayer(unsigned int t, const Eigen::Vector3d &p);
+  void removeLayer(int layer);
+  float getLayerWeight(int layer) const;
+  void setLayerWeight(int layer, float weight);
+  bool isLayerEmpty(int layer, int t) const;
+  Eigen::Vector3d getLayerPosition(int layer, int t) const;
+  // bakes the blended positions into the base and removes the layers
+  void flattenLayers();
+
+  friend class CPAnimBatch;
   friend std::ostream &operator<<(std::ostream &out, const CPAnim &cpanim);
   friend std::istream &operator>>(std::istream &in, CPAnim &cpanim);
 
   double lastT = 0;
   double lastTTransformed = 0;
 
+  // rate of the recording and of the playback
+  static constexpr double keyposesPerSecond = 60;
+
  private:
-  Eigen::MatrixXd T = Eigen::Matrix4d::Identity();
-  std::vector<Keypose> keyposes;
+  enum KeyposeFlags : std::uint8_t {
+    FLAG_EMPTY = 1,
+    FLAG_DISPLAY = 2,
+    FLAG_HAVE_TIMESTAMP = 4,
+  };
+
+  struct Curve {
+    std::vector<float> x, y, z;
+    std::vector<int> timestamps;
+    std::vector<std::uint8_t> flags;
+
+    void reserve(int capacity);
+    void resize(int length);
+  };
+
+  // keyposes reserved at once when the recording runs out of space, the
+  // capacity grows by at least this many (about 10 s at 60 fps)
+  static constexpr int recordChunk = 600;
+
+  struct Layer {
+    std::shared_ptr<Curve> curve;
+    float weight = 1;
+  };
+
+  // the curve owned by this animation only, created or copied first if it
+  // is missing or shared
+  static Curve &forWrite(std::shared_ptr<Curve> &c);
+  // also bakes the shift into all curves
+  Curve &curveForWrite();
+  Curve &layerForWrite(Layer &layer);
+  static void setKeypose(Curve &c, int t, const Keypose &k);
+  // p transformed by T, without the homogeneous divide if T is affine
+  Eigen::Vector3d transformed(const Eigen::Vector3d &p) const;
+  // steps of this animation per step of the sync animation
+  double getSpeedup() const;
+  // transformed position at the given (transformed) time, the animation
+  // must not be empty
+  Eigen::Vector3d evaluate(double tTransformed) const;
+  void resize(int length, const Keypose &k);
+
+  Eigen::Matrix4d T = Eigen::Matrix4d::Identity();
+  // null while there are no keyposes
+  std::shared_ptr<Curve> curve;
+  std::vector<Layer> layers;
+  Eigen::Vector3d shift = Eigen::Vector3d::Zero();
   bool active = true;
   double offset = 0;
   int syncLength = 0;
   double temporalScalingFactor = 1;
 };
 
+// Replays many animations at the same timepoint at once, e.g. all animated
+// CPs of a frame. The animations are added with a key of the caller (e.g.
+// the slot of the CP), replay() and sample() evaluate them as the methods
+// of CPAnim would and store the positions in a contiguous array. The speed
+// and offset of each animation are taken when it is added, the
+// interpolation runs over arrays of all animations.
+class CPAnimBatch {
+ public:
+  // the animations added are synchronized to syncLength (see
+  // CPAnim::syncSetLength())
+  void clear(int syncLength);
+  void add(CPAnim &anim, int key);
+  int size() const;
+  int getKey(int i) const;
+  void replay(double t);
+  void sample(double seconds);
+  // position of the i-th animation added as of the last replay() or sample()
+  Eigen::Vector3d getPosition(int i) const;
+
+ private:
+  void evaluate(double t);
+
+  int syncLength = 0;
+  std::vector<CPAnim *> anims;
+  std::vector<int> keys, lengths;
+  std::vector<double> speedups, offsets, tTransformed;
+  // the animations with a transform other than identity
+  std::vector<int> withTransform;
+  // per animation: the keyposes interpolated (-1 if there are none) and the
+  // interpolation factor
+  std::vector<int> t0, t1;
+  Eigen::RowVectorXd f;
+  // keyposes gathered and the interpolated positions in columns
+  Eigen::Matrix3Xd P0, P1, positions;
+};
+
+// Timeline the animations are synchronized to: the length of the sync
+// animation (see CPData::cpsAnimSyncId) and the timepoint of the playback.
+// The keyposes stay in the sync animation.
+class CPAnimSync {
+ public:
+  CPAnimSync() = default;
+  explicit CPAnimSync(int length) : length(length) {}
+  int getLength() const { return length; }
+
+  double lastT = 0;
+
+ private:
+  int length = 0;
+};
+
 #endif  // CPANIM_H
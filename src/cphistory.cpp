@@ -0,0 +1,170 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "cphistory.h"
+
+#include <algorithm>
+
+#include "macros.h"
+
+using namespace std;
+
+CPHistory::CPHistory(int maxSteps) : maxSteps(maxSteps) {}
+
+void CPHistory::begin(const Def3D &def, const CPData &cpData,
+                      const set<int> &cpIds) {
+  if (!begun) {
+    pending = Step();
+    pending.syncIdBefore = cpData.cpsAnimSyncId;
+    begun = true;
+  }
+  for (const int cpId : cpIds) {
+    const bool included =
+        any_of(pending.changes.begin(), pending.changes.end(),
+               [&](const Change &c) { return c.cpId == cpId; });
+    if (included) continue;
+    Change change;
+    change.cpId = cpId;
+    change.before = getState(def, cpData, cpId);
+    pending.changes.push_back(std::move(change));
+  }
+}
+
+bool CPHistory::commit(const Def3D &def, const CPData &cpData,
+                       const vector<int> &addedIds) {
+  if (!begun) return false;
+  begun = false;
+
+  Step step;
+  step.syncIdBefore = pending.syncIdBefore;
+  step.syncIdAfter = cpData.cpsAnimSyncId;
+  for (const int cpId : addedIds) {
+    Change change;
+    change.cpId = cpId;
+    pending.changes.push_back(std::move(change));
+  }
+  for (Change &change : pending.changes) {
+    change.after = getState(def, cpData, change.cpId);
+    if (!sameState(change.before, change.after)) {
+      step.changes.push_back(std::move(change));
+    }
+  }
+  pending = Step();
+  if (step.changes.empty() && step.syncIdBefore == step.syncIdAfter) {
+    return false;
+  }
+
+  // a new edit drops the undone steps
+  steps.resize(applied);
+  steps.push_back(std::move(step));
+  if (steps.size() > maxSteps) steps.pop_front();
+  applied = steps.size();
+  return true;
+}
+
+bool CPHistory::undo(Def3D &def, CPData &cpData) {
+  if (!canUndo()) return false;
+  applied--;
+  apply(steps[applied], false, def, cpData);
+  return true;
+}
+
+bool CPHistory::redo(Def3D &def, CPData &cpData) {
+  if (!canRedo()) return false;
+  apply(steps[applied], true, def, cpData);
+  applied++;
+  return true;
+}
+
+bool CPHistory::canUndo() const { return applied > 0; }
+
+bool CPHistory::canRedo() const { return applied < steps.size(); }
+
+void CPHistory::clear() {
+  steps.clear();
+  applied = 0;
+  begun = false;
+  pending = Step();
+}
+
+CPHistory::CPState CPHistory::getState(const Def3D &def, const CPData &cpData,
+                                       int cpId) {
+  CPState state;
+  const auto &cps = def.getCPs();
+  const int slot = cps.getSlot(cpId);
+  if (slot == -1) return state;
+  const auto cp = cps.at(slot);
+  state.exists = true;
+  state.cp.pos = cp.pos;
+  state.cp.prevPos = cp.prevPos;
+  state.cp.fixed = cp.fixed;
+  state.cp.weight = cp.weight;
+  state.cp.ptId = cp.ptId;
+  const auto it = cpData.cpsAnim.find(cpId);
+  if (it != cpData.cpsAnim.end()) {
+    state.animated = true;
+    state.anim = it->second;
+  }
+  return state;
+}
+
+bool CPHistory::sameState(const CPState &a, const CPState &b) {
+  if (a.exists != b.exists) return false;
+  if (!a.exists) return true;
+  if (a.animated != b.animated) return false;
+  // the position of an animated control point follows the playback
+  if (a.animated) return a.anim.sameAs(b.anim) && a.cp.ptId == b.cp.ptId;
+  return a.cp.pos == b.cp.pos && a.cp.prevPos == b.cp.prevPos &&
+         a.cp.fixed == b.cp.fixed && a.cp.weight == b.cp.weight &&
+         a.cp.ptId == b.cp.ptId;
+}
+
+void CPHistory::apply(const Step &step, bool forward, Def3D &def,
+                      CPData &cpData) {
+  for (const Change &change : step.changes) {
+    const CPState &state = forward ? change.after : change.before;
+    const int cpId = change.cpId;
+    const int slot = def.getCPs().getSlot(cpId);
+    if (!state.exists) {
+      def.removeControlPoint(cpId);
+      cpData.cpsAnim.erase(cpId);
+      cpData.selectedPoints.erase(cpId);
+      if (cpData.selectedPoint == cpId) cpData.selectedPoint = -1;
+      continue;
+    }
+    if (slot != -1 && def.getCPAt(slot).ptId != state.cp.ptId) {
+      // attached to another vertex, changes the correspondences
+      def.removeControlPoint(cpId);
+      def.restoreCP(cpId, state.cp);
+    } else if (slot != -1) {
+      auto cp = def.getCPAt(slot);
+      cp.pos = state.cp.pos;
+      cp.prevPos = state.cp.prevPos;
+      cp.fixed = state.cp.fixed;
+      cp.weight = state.cp.weight;
+    } else {
+      def.restoreCP(cpId, state.cp);
+    }
+    if (state.animated) {
+      cpData.cpsAnim[cpId] = state.anim;
+    } else {
+      cpData.cpsAnim.erase(cpId);
+    }
+  }
+  cpData.cpsAnimSyncId = forward ? step.syncIdAfter : step.syncIdBefore;
+  if (cpData.selectedPoint == -1 && !cpData.selectedPoints.empty()) {
+    cpData.selectedPoint = *cpData.selectedPoints.begin();
+  }
+}
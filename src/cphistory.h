@@ -0,0 +1,78 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef CPHISTORY_H
+#define CPHISTORY_H
+
+#include <deque>
+#include <set>
+#include <vector>
+
+#include "commonStructs.h"
+
+// Undo and redo of the edits of the control points and their animations as
+// a log of operations. A step keeps the state of only the control points an
+// edit touched from before and after it, a control point missing on one side
+// was added or removed by the edit. The animations are copies sharing the
+// keyposes with the current ones (see CPAnim), so a step costs about the
+// keyposes the edit recorded and undo runs in the number of control points
+// changed.
+class CPHistory {
+ public:
+  explicit CPHistory(int maxSteps = 100);
+
+  // the control points cpIds before an edit, a call while an edit is begun
+  // adds those not included yet (their state from the time of the call)
+  void begin(const Def3D &def, const CPData &cpData,
+             const std::set<int> &cpIds);
+  // the control points of the edit begun last after it and those it added,
+  // returns false if it did not change anything
+  bool commit(const Def3D &def, const CPData &cpData,
+              const std::vector<int> &addedIds = {});
+  bool undo(Def3D &def, CPData &cpData);
+  bool redo(Def3D &def, CPData &cpData);
+  bool canUndo() const;
+  bool canRedo() const;
+  void clear();
+
+ private:
+  struct CPState {
+    bool exists = false;
+    Def3D::CP cp;
+    bool animated = false;
+    CPAnim anim;
+  };
+  struct Change {
+    int cpId;
+    CPState before, after;
+  };
+  struct Step {
+    int syncIdBefore = -1, syncIdAfter = -1;
+    std::vector<Change> changes;
+  };
+
+  static CPState getState(const Def3D &def, const CPData &cpData, int cpId);
+  static bool sameState(const CPState &a, const CPState &b);
+  static void apply(const Step &step, bool forward, Def3D &def,
+                    CPData &cpData);
+
+  int maxSteps;
+  std::deque<Step> steps;
+  int applied = 0;  // the steps before this one are applied
+  bool begun = false;
+  Step pending;
+};
+
+#endif  // CPHISTORY_H
@@ -0,0 +1,92 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpinput.h"
+
+#include <cmath>
+
+using namespace Eigen;
+using namespace std;
+
+CPInputQueue::CPInputQueue(int capacity) {
+  size_t size = 1;
+  while (size < static_cast<size_t>(capacity)) size *= 2;
+  buffer.resize(size);
+  mask = size - 1;
+}
+
+bool CPInputQueue::push(const CPInputSample &sample) {
+  const size_t t = tail.load(memory_order_relaxed);
+  if (t - head.load(memory_order_acquire) == buffer.size()) return false;
+  buffer[t & mask] = sample;
+  tail.store(t + 1, memory_order_release);
+  return true;
+}
+
+bool CPInputQueue::pop(CPInputSample &sample) {
+  const size_t h = head.load(memory_order_relaxed);
+  if (h == tail.load(memory_order_acquire)) return false;
+  sample = buffer[h & mask];
+  head.store(h + 1, memory_order_release);
+  return true;
+}
+
+void CPInputRecorder::start() {
+  tracks.clear();
+  recording = true;
+}
+
+void CPInputRecorder::stop() {
+  tracks.clear();
+  recording = false;
+}
+
+bool CPInputRecorder::isRecording() const { return recording; }
+
+bool CPInputRecorder::isRecording(int cpId) const {
+  return tracks.find(cpId) != tracks.end();
+}
+
+std::vector<int> CPInputRecorder::getRecordedCPs() const {
+  vector<int> cpIds;
+  for (const auto &it : tracks) cpIds.push_back(it.first);
+  return cpIds;
+}
+
+void CPInputRecorder::record(const CPInputSample &sample, CPAnim &anim) {
+  if (!recording) return;
+  const Vector3d p(sample.x, sample.y, sample.z);
+  auto it = tracks.find(sample.cpId);
+  if (it == tracks.end()) {
+    it = tracks.emplace(sample.cpId, Track{sample.seconds, sample.seconds, p})
+             .first;
+    anim = CPAnim();
+  }
+  Track &track = it->second;
+  if (sample.seconds < track.last) return;  // out of order
+
+  // the keyposes between the previous sample and this one
+  const double dt = sample.seconds - track.last;
+  while (true) {
+    const double elapsed = track.next / CPAnim::keyposesPerSecond;
+    const double t = track.start + elapsed;
+    if (t > sample.seconds) break;
+    const double f = dt > 0 ? (t - track.last) / dt : 1;
+    const Vector3d k = (1 - f) * track.lastPos + f * p;
+    anim.record(k, static_cast<int>(lround(1000 * elapsed)));
+    track.next++;
+  }
+  track.last = sample.seconds;
+  track.lastPos = p;
+}
@@ -0,0 +1,82 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CPINPUT_H
+#define CPINPUT_H
+
+#include <Eigen/Dense>
+#include <atomic>
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+#include "cpanim.h"
+
+// Position of a CP reported by an external input device (e.g. a tablet, a
+// MIDI controller or a pose tracker) at a time in seconds on the clock of
+// the device.
+struct CPInputSample {
+  int cpId;
+  double x, y, z;
+  double seconds;
+};
+
+// Lock-free single-producer single-consumer queue handing the samples of a
+// device thread over to the main loop. If it is full the new samples are
+// dropped.
+class CPInputQueue {
+ public:
+  explicit CPInputQueue(int capacity = 4096);
+  CPInputQueue(const CPInputQueue &) = delete;
+  CPInputQueue &operator=(const CPInputQueue &) = delete;
+
+  // called from the producer thread only
+  bool push(const CPInputSample &sample);
+  // called from the consumer thread only
+  bool pop(CPInputSample &sample);
+
+ private:
+  std::vector<CPInputSample> buffer;
+  std::size_t mask;
+  // next sample to pop and to push, both only grow
+  std::atomic<std::size_t> head{0}, tail{0};
+};
+
+// Records the streamed samples of any number of CPs into animations with
+// keyposes at CPAnim::keyposesPerSecond, interpolated by the time of the
+// samples, so the animations do not depend on the rate of the device or of
+// the rendering. The animation of a CP is restarted with its first sample
+// in a take.
+class CPInputRecorder {
+ public:
+  void start();
+  void stop();
+  bool isRecording() const;
+  // the CP received samples in the current take
+  bool isRecording(int cpId) const;
+  std::vector<int> getRecordedCPs() const;
+  void record(const CPInputSample &sample, CPAnim &anim);
+
+ private:
+  struct Track {
+    double start, last;
+    Eigen::Vector3d lastPos;
+    int next = 0;  // keypose to be recorded next
+  };
+
+  std::unordered_map<int, Track> tracks;
+  bool recording = false;
+};
+
+#endif  // CPINPUT_H
@@ -14,6 +14,8 @@
 
 #include "def3dsdl.h"
 
+#include "cpanim.h"
+
 using namespace Eigen;
 
 void drawControlPoint(const Def3D::CP &cp, MyPainter &painter, int size,
@@ -40,7 +42,35 @@ void drawControlPoints(const Def3D &def, MyPainter &painter, int size,
                        const Cu &colorBg, const Cu &colorFg) {
   auto &cps = def.getCPs();
   for (const auto &it : cps) {
-    drawControlPoint(it.second->pos, painter, size, M, thickness, colorBg,
+    drawControlPoint(it.second.pos, painter, size, M, thickness, colorBg,
                      colorFg);
   }
 }
+
+void CPAnim::drawTrajectory(MyPainter &painter, const Eigen::Matrix4d &M,
+                            double beginningThicknessMult) {
+  const Matrix4d &MT = M * T;
+  const int length = getLength();
+  fora(i, 0, length) {
+    const int i0 = i == 0 ? length - 1 : (i - 1);
+    if (!isDisplayed(i0) || !isDisplayed(i)) continue;
+    const Vector3d p0 = (MT * getPosition(i0).homogeneous()).hnormalized();
+    const Vector3d p1 = (MT * getPosition(i).homogeneous()).hnormalized();
+    painter.drawLine(p0(0), p0(1), p1(0), p1(1));
+    if (i == 0) {
+      int thickness = painter.getCurrentThickness();
+      painter.filledEllipse(p1(0), p1(1), beginningThicknessMult * thickness,
+                            beginningThicknessMult * thickness);
+    }
+  }
+}
+
+void CPAnim::drawKeyframes(MyPainter &painter, int r,
+                           const Eigen::Matrix4d &M) {
+  const Matrix4d &MT = M * T;
+  fora(i, 0, getLength()) {
+    if (!isDisplayed(i)) continue;
+    const Vector3d p = (MT * getPosition(i).homogeneous()).hnormalized();
+    painter.drawEllipse(p(0), p(1), r, r);
+  }
+}
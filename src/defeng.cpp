@@ -0,0 +1,82 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "defeng.h"
+
+#include <chrono>
+#include <utility>
+
+#include "defengarapl.h"
+#include "defenglbs.h"
+
+using namespace std;
+
+double DefEng::deform(Def3D &def, Mesh3D &mesh) {
+  const auto tStart = chrono::high_resolution_clock::now();
+  stats.iterations = 0;
+  const double diff = deformImpl(def, mesh);
+  const chrono::duration<double, milli> t =
+      chrono::high_resolution_clock::now() - tStart;
+  stats.frames++;
+  stats.deformMs = t.count();
+  stats.deformMsTotal += t.count();
+  return diff;
+}
+
+void DefEng::precompute(const Def3D &def, Mesh3D &mesh) {
+  const auto tStart = chrono::high_resolution_clock::now();
+  precomputeImpl(def, mesh);
+  const chrono::duration<double, milli> t =
+      chrono::high_resolution_clock::now() - tStart;
+  stats.precomputeMs = t.count();
+}
+
+bool DefEng::hasCapability(DefEngCapability cap) const {
+  return (capabilities() & cap) != 0;
+}
+
+const DefEngStats &DefEng::getStats() const { return stats; }
+
+void DefEng::resetStats() { stats = DefEngStats(); }
+
+// in registration order, the built-in engines first
+static vector<pair<string, DefEngFactory>> &defEngRegistry() {
+  static vector<pair<string, DefEngFactory>> registry = {
+      {"arap", []() { return make_shared<DefEngARAPL>(); }},
+      {"lbs", []() { return make_shared<DefEngLBS>(); }},
+  };
+  return registry;
+}
+
+bool registerDefEng(const string &name, const DefEngFactory &factory) {
+  auto &registry = defEngRegistry();
+  for (const auto &it : registry) {
+    if (it.first == name) return false;
+  }
+  registry.push_back(make_pair(name, factory));
+  return true;
+}
+
+vector<string> defEngNames() {
+  vector<string> names;
+  for (const auto &it : defEngRegistry()) names.push_back(it.first);
+  return names;
+}
+
+shared_ptr<DefEng> createDefEng(const string &name) {
+  for (const auto &it : defEngRegistry()) {
+    if (it.first == name) return it.second();
+  }
+  return nullptr;
+}
@@ -0,0 +1,72 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DEFENG_H
+#define DEFENG_H
+
+#include <miscutils/def3d.h>
+#include <miscutils/mesh3d.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// what an engine supports besides deforming the mesh according to CPs
+enum DefEngCapability {
+  DEF_ENG_CAP_ROTATIONS = 1 << 0,          // local rotations, not only shifts
+  DEF_ENG_CAP_DEPTH_ORDER = 1 << 1,        // relative depth order of parts
+  DEF_ENG_CAP_ARMPITS_STITCHING = 1 << 2,  // stitching of merged parts
+  DEF_ENG_CAP_ITERATIVE = 1 << 3,          // iterates towards a solution
+};
+
+// timing of an engine, filled by DefEng::deform and DefEng::precompute
+struct DefEngStats {
+  int frames = 0;
+  int iterations = 0;  // of the last frame (set by the engine, 0 if n/a)
+  double precomputeMs = 0;  // last precomputation
+  double deformMs = 0;      // last frame (including precomputation)
+  double deformMsTotal = 0;
+};
+
+// Interface of the deformation engines. deform and precompute measure the
+// time and call deformImpl and precomputeImpl of the engine.
+class DefEng {
+ public:
+  virtual ~DefEng() {}
+  // returns how much the mesh changed (infinity if unknown)
+  double deform(Def3D &def, Mesh3D &mesh);
+  void precompute(const Def3D &def, Mesh3D &mesh);
+  virtual std::string name() const = 0;
+  virtual int capabilities() const = 0;
+  bool hasCapability(DefEngCapability cap) const;
+  const DefEngStats &getStats() const;
+  void resetStats();
+
+ protected:
+  virtual double deformImpl(Def3D &def, Mesh3D &mesh) = 0;
+  virtual void precomputeImpl(const Def3D &def, Mesh3D &mesh) = 0;
+
+  DefEngStats stats;
+};
+
+// Registry of the engines by name. "arap" (DefEngARAPL) is the reference
+// engine, the others are experimental and can be swapped in at runtime.
+typedef std::function<std::shared_ptr<DefEng>()> DefEngFactory;
+bool registerDefEng(const std::string &name, const DefEngFactory &factory);
+std::vector<std::string> defEngNames();
+// returns nullptr for an unknown name
+std::shared_ptr<DefEng> createDefEng(const std::string &name);
+
+#endif  // DEFENG_H
@@ -14,25 +14,61 @@
 
 #include "defengarapl.h"
 
-#include <igl/arap_linear_block.h>
+#include <igl/cat.h>
+#include <igl/adjacency_list.h>
 #include <igl/cotmatrix.h>
-#include <igl/fit_rotations.h>
+#include <igl/cotmatrix_entries.h>
+#include <igl/doublearea.h>
 #include <igl/invert_diag.h>
+#include <igl/is_symmetric.h>
 #include <igl/massmatrix.h>
+#include <igl/vertex_components.h>
 #include <image/image.h>
 
-#include <set>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <map>
+#include <mutex>
+#include <queue>
 
 #include "macros.h"
+#include "tracing.h"
 
 using namespace Eigen;
 using namespace igl;
 using namespace std;
 
-DefEngARAPL::DefEngARAPL() { rigidity = 0.999; }
+DefEngARAPL::DefEngARAPL()
+    : dataQP(make_shared<min_quad_with_fixed_data<double>>()),
+      ops(make_shared<Operators>()),
+      fact(make_shared<Factorization>()) {
+  rigidity = 0.999;
+}
 
 DefEngARAPL::~DefEngARAPL() {}
 
+string DefEngARAPL::name() const { return "arap"; }
+
+shared_ptr<DefEngARAPL> DefEngARAPL::createInstance() {
+  if (!factCache) {
+    factCache = make_shared<FactorizationCache>();
+    factCache->facts.push_back(fact);
+  }
+  // the copy shares ops, fact and factCache, the solver of the active set is
+  // per instance
+  auto instance = make_shared<DefEngARAPL>(*this);
+  instance->dataQP = make_shared<min_quad_with_fixed_data<double>>();
+  instance->activeSetSolverValid = false;
+  return instance;
+}
+
+int DefEngARAPL::capabilities() const {
+  return DEF_ENG_CAP_ROTATIONS | DEF_ENG_CAP_DEPTH_ORDER |
+         DEF_ENG_CAP_ARMPITS_STITCHING | DEF_ENG_CAP_ITERATIVE;
+}
+
 bool DefEngARAPL::checkData(const Eigen::MatrixXd &VCurr,
                             const Eigen::MatrixXd &VRest,
                             const Eigen::MatrixXi &F) {
@@ -48,103 +84,629 @@ bool DefEngARAPL::checkData(const Mesh3D &mesh) {
   return checkData(mesh.VCurr, mesh.VRest, mesh.F);
 }
 
-void DefEngARAPL::prepare(const Eigen::MatrixXd &V, const Eigen::MatrixXi &F) {
-  SparseMatrix<double> K0, K1, K2;
-  ARAPEnergyType type = ARAP_ENERGY_TYPE_SPOKES_AND_RIMS;
-  arap_linear_block(V, F, 0, type, K0);
-  arap_linear_block(V, F, 1, type, K1);
-  arap_linear_block(V, F, 2, type, K2);
-  K = cat(2, cat(2, K0, K1), K2);
+// K = [K0 K1 K2] with Kd = arap_linear_block(V, F, d, spokes and rims) and
+// CSM = diag(K0, K1, K2)^T, written directly instead of building the blocks
+// and concatenating them. Each block has the pattern of the vertices sharing
+// a face, so the column j of K and the column j of CSM (the row j of the
+// block) are filled from the faces of the vertex j alone, in the order in
+// which arap_linear_block adds the triplets, i.e. with the same values, and
+// the vertices are processed in parallel.
+static void arapBlocks(const MatrixXd &V, const MatrixXi &F, WorkerPool &pool,
+                       SparseMatrix<double> &K, SparseMatrix<double> &CSM) {
+  const int n = V.rows(), m = F.rows();
+  MatrixXd C;
+  cotmatrix_entries(V, F, C);
+
+  // faces of each vertex in increasing order, a face with a repeated vertex
+  // is listed once
+  auto firstCorner = [&](int i, int k) {
+    fora(l, 0, k) if (F(i, l) == F(i, k)) return false;
+    return true;
+  };
+  vector<int> vfStart(n + 1, 0), vfFaces;
+  fora(i, 0, m) fora(k, 0, 3) if (firstCorner(i, k)) vfStart[F(i, k) + 1]++;
+  fora(j, 0, n) vfStart[j + 1] += vfStart[j];
+  vfFaces.resize(vfStart[n]);
+  {
+    vector<int> next(vfStart.begin(), vfStart.end() - 1);
+    fora(i, 0, m) fora(k, 0, 3) {
+      if (firstCorner(i, k)) vfFaces[next[F(i, k)]++] = i;
+    }
+  }
+
+  auto neighbors = [&](int j, vector<int> &nb) {
+    nb.clear();
+    if (vfStart[j] == vfStart[j + 1]) return;
+    fora(t, vfStart[j], vfStart[j + 1]) fora(k, 0, 3) {
+      nb.push_back(F(vfFaces[t], k));
+    }
+    sort(nb.begin(), nb.end());
+    nb.erase(unique(nb.begin(), nb.end()), nb.end());
+  };
+  const int chunkSize = 1024;
+  vector<int> start(n + 1, 0);
+  pool.parallelFor(n, chunkSize, [&](int begin, int end) {
+    vector<int> nb;
+    fora(j, begin, end) {
+      neighbors(j, nb);
+      start[j + 1] = nb.size();
+    }
+  });
+  fora(j, 0, n) start[j + 1] += start[j];
+  const int nnz = start[n];
+
+  // block d occupies the columns d*n .. of K and of CSM, at the same
+  // offsets in both
+  K.resize(n, 3 * n);
+  CSM.resize(3 * n, 3 * n);
+  K.resizeNonZeros(3 * nnz);
+  CSM.resizeNonZeros(3 * nnz);
+  fora(d, 0, 3) fora(j, 0, n) {
+    K.outerIndexPtr()[d * n + j] = d * nnz + start[j];
+    CSM.outerIndexPtr()[d * n + j] = d * nnz + start[j];
+  }
+  K.outerIndexPtr()[3 * n] = CSM.outerIndexPtr()[3 * n] = 3 * nnz;
+
+  const int edges[3][2] = {{1, 2}, {2, 0}, {0, 1}};
+  pool.parallelFor(n, chunkSize, [&](int begin, int end) {
+    vector<int> nb;
+    fora(j, begin, end) {
+      neighbors(j, nb);
+      const int s = start[j];
+      fora(d, 0, 3) fora(q, 0, (int)nb.size()) {
+        K.innerIndexPtr()[d * nnz + s + q] = nb[q];
+        CSM.innerIndexPtr()[d * nnz + s + q] = d * n + nb[q];
+        K.valuePtr()[d * nnz + s + q] = 0;
+        CSM.valuePtr()[d * nnz + s + q] = 0;
+      }
+      // the entries (r, c) of the triplets with c == j go to K and those
+      // with r == j to CSM
+      int d = 0;
+      auto add = [&](int r, int c, double v) {
+        if (c == j) {
+          const int q = lower_bound(nb.begin(), nb.end(), r) - nb.begin();
+          K.valuePtr()[d * nnz + s + q] += v;
+        }
+        if (r == j) {
+          const int q = lower_bound(nb.begin(), nb.end(), c) - nb.begin();
+          CSM.valuePtr()[d * nnz + s + q] += v;
+        }
+      };
+      fora(t, vfStart[j], vfStart[j + 1]) {
+        const int i = vfFaces[t];
+        for (d = 0; d < 3; d++) fora(e, 0, 3) {
+          const int a = F(i, edges[e][0]), b = F(i, edges[e][1]);
+          const double v = C(i, e) * (V(a, d) - V(b, d)) / 3.0;
+          fora(f, 0, 3) {
+            const int rs = F(i, edges[f][0]), rd = F(i, edges[f][1]);
+            if (rs == a && rd == b) {
+              add(rs, rd, v);
+              add(rd, rs, -v);
+            } else if (rd == a) {
+              add(rd, rs, v);
+            } else if (rs == b) {
+              add(rs, rd, -v);
+            }
+          }
+          add(a, a, v);
+          add(b, b, -v);
+        }
+      }
+    }
+  });
+}
 
+void DefEngARAPL::prepare(const Eigen::MatrixXd &V, const Eigen::MatrixXi &F) {
+  // never modify operators shared with other instances
+  ops = make_shared<Operators>();
+  SparseMatrix<double> &K = ops->K, &CSM = ops->CSM;
+  SparseMatrix<float> &Kf = ops->Kf, &CSMf = ops->CSMf;
+  auto &KBlocks = ops->KBlocks;
+  auto &KBlocksRowMajor = ops->KBlocksRowMajor;
   const int n = V.rows();
-  SparseMatrix<double> Z(n, n);
-  SparseMatrix<double> ZZ(n, n * 2);
-  CSM = cat(1, cat(1, cat(2, K0, ZZ), cat(2, cat(2, Z, K1), Z)), cat(2, ZZ, K2))
-            .transpose();
+  ops->n = n;
+  arapBlocks(V, F, getWorkerPool(), K, CSM);
+
+  // connected components that are ranges of vertices
+  VectorXi comps;
+  vertex_components(F, comps);
+  vector<int> &compStart = ops->compStart;
+  if (comps.size() == n && n > 0 && comps.maxCoeff() > 0) {
+    vector<bool> seen(comps.maxCoeff() + 1, false);
+    fora(i, 0, n) {
+      if (i > 0 && comps(i) == comps(i - 1)) continue;
+      if (seen[comps(i)]) {
+        compStart.clear();
+        break;
+      }
+      seen[comps(i)] = true;
+      compStart.push_back(i);
+    }
+    if (!compStart.empty()) compStart.push_back(n);
+  }
+
+  // patches of consecutive vertices for localUpdates
+  if (localUpdates) {
+    const int size = max(localPatchSize, 1);
+    auto &neighbors = ops->patchNeighbors;
+    neighbors.assign((n + size - 1) / size, vector<int>());
+    fora(f, 0, F.rows()) fora(k, 0, 3) {
+      const int p = F(f, k) / size, q = F(f, (k + 1) % 3) / size;
+      if (p != q) neighbors[p].push_back(q);
+    }
+    for (auto &ps : neighbors) {
+      sort(ps.begin(), ps.end());
+      ps.erase(unique(ps.begin(), ps.end()), ps.end());
+    }
+    ops->patchSize = size;
+  }
+
+  if (parallelLocalStep || componentSolves || localUpdates) {
+    // per vertex gathers: columns of K0, K1 and rows of K0, K1, K2
+    KBlocks.resize(2);
+    KBlocksRowMajor.resize(3);
+    fora(d, 0, 3) {
+      if (d < 2) KBlocks[d] = K.middleCols(d * n, n);
+      KBlocksRowMajor[d] = K.middleCols(d * n, n);
+    }
+  }
+  if (parallelLocalStep) {
+    K = SparseMatrix<double>();
+    CSM = SparseMatrix<double>();
+    return;
+  }
+
+  // keep only the single precision copies
+  if (singlePrecision) {
+    Kf = K.cast<float>();
+    CSMf = CSM.cast<float>();
+    K = SparseMatrix<double>();
+    CSM = SparseMatrix<double>();
+  }
+}
+
+// Closest rotations to the 2x2 covariance blocks of S (the same result as
+// igl::fit_rotations_planar with reflections removed). For a block [a b; c d]
+// the rotation is [cos -sin; sin cos] with cos ~ a+d and sin ~ c-b. All
+// blocks are processed at once as columns of S and the result is written in
+// the layout of R used in -K * R, i.e. rows i, n+i and 2n+i hold the rotation
+// of vertex i.
+static void fitRotationsPlanar(const MatrixX3d &S, int n, MatrixX3d &R) {
+  const auto a = S.col(0).head(n).array();
+  const auto b = S.col(1).head(n).array();
+  const auto c = S.col(0).segment(n, n).array();
+  const auto d = S.col(1).segment(n, n).array();
+  R.resize(3 * n, 3);
+  auto cs = R.col(0).head(n).array();
+  auto sn = R.col(0).segment(n, n).array();
+  auto h = R.col(2).head(n).array();  // scratch, zeroed below
+  cs = a + d;
+  sn = c - b;
+  h = (cs.square() + sn.square()).sqrt();
+  cs /= h;
+  sn /= h;
+  fora(i, 0, n) {
+    if (!(h(i) > 0)) {
+      // degenerate block, use identity
+      cs(i) = 1;
+      sn(i) = 0;
+    }
+  }
+
+  R.col(1).head(n) = -R.col(0).segment(n, n);
+  R.col(1).segment(n, n) = R.col(0).head(n);
+  R.col(2).head(2 * n).setZero();
+  R.bottomLeftCorner(n, 2).setZero();
+  R.col(2).tail(n).setOnes();
+}
+
+// Fused local step used for parallelLocalStep. The rotation of vertex i
+// needs only the columns i of K0 and K1 (rows i and n+i of CSM * VCurr) and
+// the row i of B only the rows i of K0, K1 and K2 (-K * R), so both passes
+// run independently per vertex, the second one after all rotations are
+// known. The sums are accumulated in the same order as in the sparse
+// products, so the result is the same as in computeRhs.
+void DefEngARAPL::fitRotationsFused(const MatrixX3d &VCurr, int begin,
+                                    int end, MatrixX3d &R) const {
+  const int n = VCurr.rows();
+  fora(i, begin, end) {
+    double a = 0, b = 0, c = 0, d = 0;
+    for (SparseMatrix<double>::InnerIterator it(ops->KBlocks[0], i); it; ++it) {
+      a += it.value() * VCurr(it.index(), 0);
+      b += it.value() * VCurr(it.index(), 1);
+    }
+    for (SparseMatrix<double>::InnerIterator it(ops->KBlocks[1], i); it; ++it) {
+      c += it.value() * VCurr(it.index(), 0);
+      d += it.value() * VCurr(it.index(), 1);
+    }
+    double cs = a + d, sn = c - b;
+    const double h = sqrt(cs * cs + sn * sn);
+    cs /= h;
+    sn /= h;
+    if (!(h > 0)) {
+      // degenerate block, use identity
+      cs = 1;
+      sn = 0;
+    }
+    R.row(i) << cs, -sn, 0;
+    R.row(n + i) << sn, cs, 0;
+    R.row(2 * n + i) << 0, 0, 1;
+  }
+}
+
+void DefEngARAPL::computeRhsFused(const VectorXd &lambda,
+                                  const VectorXd &lambdaInv,
+                                  const MatrixX3d &VCurr, const MatrixX3d &R,
+                                  int begin, int end, MatrixX3d &B) const {
+  typedef SparseMatrix<double, RowMajor>::InnerIterator RowIterator;
+  const int n = VCurr.rows();
+  fora(i, begin, end) {
+    double kr[3] = {0, 0, 0};
+    fora(k, 0, 3) {
+      for (RowIterator it(ops->KBlocksRowMajor[k], i); it; ++it) {
+        const int j = k * n + it.index();
+        fora(c, 0, 3) kr[c] += it.value() * R(j, c);
+      }
+    }
+    fora(c, 0, 3) B(i, c) = lambda(i) * VCurr(i, c) - lambdaInv(i) * kr[c];
+  }
+}
+
+void DefEngARAPL::computeRhs(const Eigen::VectorXd &lambda,
+                             const Eigen::VectorXd &lambdaInv,
+                             const Eigen::SparseMatrix<double> &K,
+                             const Eigen::MatrixXd &VRest,
+                             const Eigen::MatrixX3d &VCurr,
+                             Eigen::MatrixX3d &R,
+                             bool reuseRotations, SolveWorkspace &w) {
+  const int n = VRest.rows();
+
+  if (parallelLocalStep) {
+    const int chunkSize = 512;
+    if (!reuseRotations || R.rows() != 3 * n) {
+      R.resize(3 * n, 3);
+      getWorkerPool().parallelFor(n, chunkSize, [&](int begin, int end) {
+        fitRotationsFused(VCurr, begin, end, R);
+      });
+    }
+    w.B.resize(n, 3);
+    getWorkerPool().parallelFor(n, chunkSize, [&](int begin, int end) {
+      computeRhsFused(lambda, lambdaInv, VCurr, R, begin, end, w.B);
+    });
+    return;
+  }
+
+  // products with the large operators in float if singlePrecision is set,
+  // the rest in double
+  if (!reuseRotations || R.rows() != 3 * n) {
+    if (singlePrecision) {
+      w.Vf = VCurr.cast<float>().replicate(3, 1);
+      w.Sf.noalias() = ops->CSMf * w.Vf;
+      w.S = w.Sf.cast<double>();
+    } else {
+      w.VRep = VCurr.replicate(3, 1);
+      w.S.noalias() = ops->CSM * w.VRep;
+    }
+    fitRotationsPlanar(w.S, n, R);
+  }
+  if (singlePrecision) {
+    w.Rf = R.cast<float>();
+    w.KRf.noalias() = ops->Kf * w.Rf;
+    w.KR = w.KRf.cast<double>();
+  } else {
+    w.KR.noalias() = K * R;
+  }
+
+  // B = lambdaInv * -K * R + lambda * VCurr
+  w.B.noalias() = lambda.asDiagonal() * VCurr;
+  w.B.noalias() -= lambdaInv.asDiagonal() * w.KR;
 }
 
 void DefEngARAPL::solveARAP(igl::min_quad_with_fixed_data<double> &data,
-                            const Eigen::SparseMatrix<double> &lambda,
-                            const Eigen::SparseMatrix<double> &lambdaInv,
+                            const Eigen::VectorXd &lambda,
+                            const Eigen::VectorXd &lambdaInv,
                             const Eigen::SparseMatrix<double> &K,
                             const Eigen::MatrixXd &VRest,
-                            const Eigen::VectorXd &Beq, Eigen::MatrixXd &VCurr,
-                            Eigen::MatrixXd &sol) {
-  const int n = VRest.rows();
+                            const Eigen::VectorXd &Beq,
+                            Eigen::MatrixX3d &VCurr, Eigen::MatrixX3d &sol,
+                            Eigen::MatrixX3d &R,
+                            bool reuseRotations,
+                            const SparseMatrix<double> &restriction,
+                            SolveWorkspace &w) {
+  computeRhs(lambda, lambdaInv, K, VRest, VCurr, R, reuseRotations, w);
+
+  // solve all columns at once, the number of columns is given by Y
+  const MatrixX3d Y(0, 3);
+  if (!twoLevelActive()) {
+    if (&data == &fact->data && (fact->XYSupernodal || fact->XYIterative)) {
+      solveXYSplit(*fact, w.B, VCurr);
+      sol = VCurr;
+    } else {
+      min_quad_with_fixed_solve(data, w.B, Y, Beq, VCurr, sol);
+    }
+    return;
+  }
 
-  MatrixXd S = CSM * VCurr.replicate(3, 1);
-  S /= S.array().abs().maxCoeff();
+  // solve for the coarse nodes and prolongate, keep the lagrange multipliers
+  w.BCoarse.noalias() = restriction * w.B;
+  min_quad_with_fixed_solve(data, w.BCoarse, Y, Beq, w.VCoarse, w.solCoarse);
+  VCurr.noalias() = prolong * w.VCoarse;
+  const int n = VCurr.rows();
+  const int m = w.solCoarse.rows() - w.VCoarse.rows();
+  sol.resize(n + m, 3);
+  sol.topRows(n) = VCurr;
+  sol.bottomRows(m) = w.solCoarse.bottomRows(m);
+}
 
-  MatrixXd Rtmp;
-  fit_rotations_planar(S, Rtmp);
-  Rtmp.transposeInPlace();
+void DefEngARAPL::solveARAPActiveSet(
+    const Eigen::VectorXd &lambda, const Eigen::VectorXd &lambdaInv,
+    const Eigen::SparseMatrix<double> &K, const Eigen::MatrixXd &VRest,
+    const Eigen::VectorXd &Beq, Eigen::MatrixX3d &VCurr, Eigen::MatrixX3d &sol,
+    Eigen::MatrixX3d &R, bool reuseRotations, SolveWorkspace &w) {
+  if (!fact->Q2Factorized) {
+    solveARAP(*dataQP, lambda, lambdaInv, K, VRest, Beq, VCurr, sol, R,
+              reuseRotations, restrictZ, w);
+    return;
+  }
 
-  MatrixXd R(3 * n, 3);
-  fora(i, 0, n) {
-    R.row(i) = Rtmp.row(3 * i);
-    R.row(n + i) = Rtmp.row(3 * i + 1);
-    R.row(2 * n + i) = Rtmp.row(3 * i + 2);
+  computeRhs(lambda, lambdaInv, K, VRest, VCurr, R, reuseRotations, w);
+
+  // Solve the KKT system [Q2 2*A^T; A 0] [z; mu] = [-B; Beq] using the Schur
+  // complement S = 2*A*Q2^-1*A^T. The result (including the lagrange
+  // multipliers) is the same as from min_quad_with_fixed_solve.
+  const int n = VCurr.rows();
+  const int m = AeqAllRows.size();
+  sol.resize(n + m, 3);
+  // the solution of the last iteration is the initial guess of solvePCG
+  if (fact->Q2Iterative) VCurr = -VCurr;
+  solveQ2(w.B, VCurr, w);
+  VCurr = -VCurr;
+  if (m > 0) {
+    w.r.resize(m, 3);
+    fora(j, 0, m) {
+      const auto &row = AeqAllRows[j];
+      w.r.row(j) =
+          get<2>(row) * (VCurr.row(get<0>(row)) - VCurr.row(get<1>(row)));
+      w.r.row(j).array() -= Beq(j);
+    }
+    if (activeSetSolverPGS) {
+      solvePGS(w.r);
+      sol.bottomRows(m) = pgsMu;
+    } else {
+      sol.bottomRows(m) = SSolver.solve(w.r);
+    }
+    VCurr.noalias() -= 2 * W * sol.bottomRows(m);
   }
+  sol.topRows(n) = VCurr;
+}
 
-  MatrixXd B;
-  B = -K * R;
-  B = (lambdaInv * B + lambda * VCurr);
+// S * mu = r by projected Gauss-Seidel, starting from pgsMu, with the
+// multipliers of the inequalities (the first rows) of the Z column clamped
+// to be non-negative, i.e. S * mu >= r where they are zero. The other rows
+// and the X and Y columns are equalities, as with SSolver.
+void DefEngARAPL::solvePGS(const Eigen::MatrixX3d &r) {
+  const int m = S.rows();
+  if (pgsMu.rows() != m) pgsMu.setZero(m, 3);
+  const int numIneqs = reindex.size();
+  fora(c, 0, 3) {
+    auto mu = pgsMu.col(c);
+    fora(sweep, 0, pgsMaxSweeps) {
+      double change = 0;
+      fora(i, 0, m) {
+        const double d = S(i, i);
+        if (d <= 0) continue;
+        double mi = mu(i) + (r(i, c) - S.row(i).dot(mu)) / d;
+        if (c == 2 && i < numIneqs) mi = max(mi, 0.0);
+        change = max(change, abs(mi - mu(i)) * d);
+        mu(i) = mi;
+      }
+      if (change < pgsTol) break;
+    }
+  }
+}
 
-  sol.resize(data.n + Beq.rows(), VCurr.cols());
+static bool samePattern(const SparseMatrix<double> &A,
+                        const SparseMatrix<double> &B) {
+  if (A.rows() != B.rows() || A.cols() != B.cols()) return false;
+  if (!A.isCompressed() || !B.isCompressed()) return false;
+  if (A.nonZeros() != B.nonZeros()) return false;
+  return equal(A.outerIndexPtr(), A.outerIndexPtr() + A.outerSize() + 1,
+               B.outerIndexPtr()) &&
+         equal(A.innerIndexPtr(), A.innerIndexPtr() + A.nonZeros(),
+               B.innerIndexPtr());
+}
 
-  VectorXd out(VCurr.rows()), solC;
-  fora(i, 0, VCurr.cols()) {
-    VectorXd BeqC;
-    min_quad_with_fixed_solve(data, B.col(i), VectorXd(), Beq, out, solC);
-    VCurr.col(i) = out;
-    sol.col(i) = solC;
+// Same as min_quad_with_fixed_precompute(Q, VectorXi(), Aeq, false, data) but
+// if the sparsity pattern of the KKT matrix did not change since the last
+// call, the ordering and symbolic analysis are kept and only the numeric
+// factorization is redone.
+static bool precomputeKeepPattern(const SparseMatrix<double> &Q,
+                                  const SparseMatrix<double> &Aeq,
+                                  min_quad_with_fixed_data<double> &data) {
+  // data.NA is empty until the first LU precompute
+  if (data.NA.rows() == Q.rows() + Aeq.rows() && data.known.size() == 0 &&
+      data.Aeq_li &&
+      data.solver_type == min_quad_with_fixed_data<double>::LU) {
+    SparseMatrix<double> NA = 0.5 * Q;
+    if (Aeq.rows() > 0) {
+      SparseMatrix<double> AeqT = Aeq.transpose();
+      SparseMatrix<double> Z(Aeq.rows(), Aeq.rows());
+      NA = cat(1, cat(2, NA, AeqT), cat(2, Aeq, Z));
+    }
+    NA.makeCompressed();
+    if (samePattern(NA, data.NA)) {
+      data.lu.factorize(NA);
+      if (data.lu.info() == Success) {
+        data.NA = NA;
+        return true;
+      }
+    }
   }
+  return min_quad_with_fixed_precompute(Q, VectorXi(), Aeq, false, data);
 }
 
-template <typename T, typename ShaderT>
-static void rasterizeSimple(const Eigen::Matrix<T, -1, -1> &V,
-                            const Eigen::MatrixXi &F, int width, int height,
-                            ShaderT &shader) {
-  auto edgeFn2D = [](const auto &a, const auto &b,
-                     const Vector2d &p) -> double {
-    return (p(0) - a(0)) * (b(1) - a(1)) - (p(1) - a(1)) * (b(0) - a(0));
-  };
-
+void DefEngARAPL::buildFaceGrids(const Eigen::MatrixXd &V,
+                                 const Eigen::MatrixXi &F,
+                                 const std::vector<int> &verticesToParts,
+                                 int nParts) {
+  // integer bounding boxes of faces, a face covers pixels [x1,x2) x [y1,y2)
+  faceBBoxes.resize(F.rows());
+  double avgSize = 0;
   fora(i, 0, F.rows()) {
     const Vector3d &v0 = V.row(F(i, 0));
     const Vector3d &v1 = V.row(F(i, 1));
     const Vector3d &v2 = V.row(F(i, 2));
-    const int xMin =
-        max(0, static_cast<int>(floor(min(v0(0), min(v1(0), v2(0))))));
-    const int xMax =
-        min(width - 1, static_cast<int>(ceil(max(v0(0), max(v1(0), v2(0))))));
-    const int yMin =
-        max(0, static_cast<int>(floor(min(v0(1), min(v1(1), v2(1))))));
-    const int yMax =
-        min(height - 1, static_cast<int>(ceil(max(v0(1), max(v1(1), v2(1))))));
-    fora(y, yMin, yMax) fora(x, xMin, xMax) {
-      const Vector2d p(x, y);
-      const double w0 = edgeFn2D(v0, v1, p);
-      const double w1 = edgeFn2D(v1, v2, p);
-      const double w2 = edgeFn2D(v2, v0, p);
-      shader(x, y, i, F(i, 0), F(i, 1), F(i, 2), w0, w1, w2);
-    }
+    Vector4i &bb = faceBBoxes[i];
+    bb(0) = floor(min(v0(0), min(v1(0), v2(0))));
+    bb(1) = floor(min(v0(1), min(v1(1), v2(1))));
+    bb(2) = ceil(max(v0(0), max(v1(0), v2(0))));
+    bb(3) = ceil(max(v0(1), max(v1(1), v2(1))));
+    avgSize += max(bb(2) - bb(0), bb(3) - bb(1));
+  }
+  if (F.rows() > 0) avgSize /= F.rows();
+  const int cellSize = max(1, static_cast<int>(2 * avgSize));
+
+  faceGrids.resize(nParts);
+  fora(p, 0, nParts) {
+    FaceGrid &g = faceGrids[p];
+    g.cellSize = cellSize;
+    g.nx = g.ny = 0;
+    g.cellStart.clear();
+    g.cellFaces.clear();
+  }
+
+  // grid extents of each part
+  auto &partBBoxes = wsActiveSet.partBBoxes;
+  partBBoxes.assign(nParts, Vector4i(INT_MAX, INT_MAX, INT_MIN, INT_MIN));
+  fora(i, 0, F.rows()) {
+    const Vector4i &bb = faceBBoxes[i];
+    if (bb(0) >= bb(2) || bb(1) >= bb(3)) continue;  // covers no pixel
+    Vector4i &pbb = partBBoxes[verticesToParts[F(i, 0)]];
+    pbb.head(2) = pbb.head(2).cwiseMin(bb.head(2));
+    pbb.tail(2) = pbb.tail(2).cwiseMax(bb.tail(2));
+  }
+  auto cell = [&](int v, int o) {
+    return static_cast<int>(floor(static_cast<double>(v - o) / cellSize));
+  };
+  fora(p, 0, nParts) {
+    FaceGrid &g = faceGrids[p];
+    const Vector4i &pbb = partBBoxes[p];
+    if (pbb(0) > pbb(2)) continue;  // empty part
+    g.x0 = pbb(0);
+    g.y0 = pbb(1);
+    g.nx = cell(pbb(2) - 1, g.x0) + 1;
+    g.ny = cell(pbb(3) - 1, g.y0) + 1;
+    g.cellStart.assign(g.nx * g.ny + 1, 0);
+  }
+
+  // bin faces into cells (counting sort, i.e. faces in a cell stay ordered by
+  // their index)
+  auto forCells = [&](int faceId, const auto &fcn) {
+    const Vector4i &bb = faceBBoxes[faceId];
+    if (bb(0) >= bb(2) || bb(1) >= bb(3)) return;
+    FaceGrid &g = faceGrids[verticesToParts[F(faceId, 0)]];
+    fora(cy, cell(bb(1), g.y0), cell(bb(3) - 1, g.y0) + 1)
+    fora(cx, cell(bb(0), g.x0), cell(bb(2) - 1, g.x0) + 1)
+      fcn(g, cy * g.nx + cx);
+  };
+  fora(i, 0, F.rows())
+    forCells(i, [](FaceGrid &g, int c) { g.cellStart[c + 1]++; });
+  fora(p, 0, nParts) {
+    FaceGrid &g = faceGrids[p];
+    forlist(c, g.cellStart) if (c > 0) g.cellStart[c] += g.cellStart[c - 1];
+    if (!g.cellStart.empty()) g.cellFaces.resize(g.cellStart.back());
+    g.cellFill.assign(g.cellStart.begin(), g.cellStart.end());
+  }
+  fora(i, 0, F.rows()) forCells(i, [&](FaceGrid &g, int c) {
+    g.cellFaces[g.cellFill[c]++] = i;
+  });
+}
+
+int DefEngARAPL::findFace(const FaceGrid &g, const Eigen::MatrixXd &V,
+                          const Eigen::MatrixXi &F, int x, int y) const {
+  if (g.nx == 0 || x < g.x0 || y < g.y0) return -1;
+  const int cx = (x - g.x0) / g.cellSize, cy = (y - g.y0) / g.cellSize;
+  if (cx >= g.nx || cy >= g.ny) return -1;
+
+  auto edgeFn2D = [](const auto &a, const auto &b, double x,
+                     double y) -> double {
+    return (x - a(0)) * (b(1) - a(1)) - (y - a(1)) * (b(0) - a(0));
+  };
+
+  // Prefer the last face containing the point. If there is none, return the
+  // last face whose bounding box covers the point.
+  int inside = -1, covering = -1;
+  const int c = cy * g.nx + cx;
+  fora(k, g.cellStart[c], g.cellStart[c + 1]) {
+    const int i = g.cellFaces[k];
+    const Vector4i &bb = faceBBoxes[i];
+    if (x < bb(0) || x >= bb(2) || y < bb(1) || y >= bb(3)) continue;
+    covering = i;
+    const auto &v0 = V.row(F(i, 0));
+    const auto &v1 = V.row(F(i, 1));
+    const auto &v2 = V.row(F(i, 2));
+    const double w0 = edgeFn2D(v0, v1, x, y);
+    const double w1 = edgeFn2D(v1, v2, x, y);
+    const double w2 = edgeFn2D(v2, v0, x, y);
+    if ((w0 <= 0 && w1 <= 0 && w2 <= 0) || (w0 >= 0 && w1 >= 0 && w2 >= 0))
+      inside = i;
+  }
+  return inside != -1 ? inside : covering;
+}
+
+WorkerPool &DefEngARAPL::getWorkerPool() {
+  if (!workerPool) {
+    workerPool = make_shared<WorkerPool>(WorkerPool::defaultNumThreads());
+  }
+  return *workerPool;
+}
+
+void DefEngARAPL::activateConstraint(int bndId, int corrId) {
+  if (asActive[bndId] == -1) {
+    asActivePos[bndId] = asActiveList.size();
+    asActiveList.push_back(bndId);
   }
+  asActive[bndId] = corrId;
+}
+
+void DefEngARAPL::deactivateConstraint(int bndId) {
+  if (asActive[bndId] == -1) return;
+  // swap with the last one in the list
+  const int pos = asActivePos[bndId];
+  const int last = asActiveList.back();
+  asActiveList[pos] = last;
+  asActivePos[last] = pos;
+  asActiveList.pop_back();
+  asActive[bndId] = -1;
+  asActivePos[bndId] = -1;
 }
 
 void DefEngARAPL::prepareActiveSetEqs(const Eigen::MatrixXd &VCurr,
                                       const Eigen::MatrixXi &FCurr) {
-  // create corresponding points
-  vector<tuple<int, int, int>> ineqCorrs;
-  vector<bool> isBnd(VCurr.rows(), false);
+  TRACE_SCOPE("DefEngARAPL::prepareActiveSetEqs");
+  if (asActive.size() != VCurr.rows()) {
+    asActive.assign(VCurr.rows(), -1);
+    asActivePos.assign(VCurr.rows(), -1);
+    asKept.assign(VCurr.rows(), false);
+    asActiveList.clear();
+  }
+
+  // create corresponding points (buffers are kept between frames)
+  auto &ineqCorrs = wsActiveSet.ineqCorrs;
+  auto &isBnd = wsActiveSet.isBnd;
+  auto &isMergeBnd = wsActiveSet.isMergeBnd;
+  auto &used = wsActiveSet.used;
+  auto &verticesToParts = wsActiveSet.verticesToParts;
+  ineqCorrs.clear();
+  isBnd.assign(VCurr.rows(), false);
   forlist(i, bnds) forlist(j, bnds[i]) isBnd[bnds[i][j]] = true;
 
-  vector<bool> isMergeBnd(VCurr.rows(), false);
+  isMergeBnd.assign(VCurr.rows(), false);
   if (interiorDepthConditions) {
     for (int ind : mergeBnd) isMergeBnd[ind] = true;
   }
 
-  vector<bool> used(VCurr.rows(), false);
+  used.assign(VCurr.rows(), false);
   if (armpitsStitchingInJointOptimization) {
     for (auto &el : mergeArmpitsCorrs) {
       const int a = get<0>(el);
@@ -153,39 +715,67 @@ void DefEngARAPL::prepareActiveSetEqs(const Eigen::MatrixXd &VCurr,
       used[b] = true;
     }
   }
-  vector<bool> faceUsed(FCurr.rows(), false);
-
-  vector<int> verticesToParts(VCurr.rows());
+  verticesToParts.resize(VCurr.rows());
   const int nParts = partsIds.size();
   forlist(i, partsIds) forlist(j, partsIds[i]) verticesToParts[partsIds[i][j]] =
       i;
 
-  // rasterize face IDs for each part (rasterizes both front and back facing
-  // triangles)
-  Img<int> frameBuffer(1600, 800, nParts);
-  frameBuffer.fill(-1);
-  auto shader = [&](int x, int y, int faceId, int v0, int v1, int v2, double w0,
-                    double w1, double w2) {
-    //    if ((w0 < 0 && w1 < 0 && w2 < 0) || // back facing
-    //        (w0 >= 0 && w1 >= 0 && w2 >= 0)) // front facing
-    //    {
-    const int partId = verticesToParts[v0];
-    frameBuffer(x, y, partId) = faceId;
-    //    }
+  // index faces of each part in a uniform grid (includes both front and back
+  // facing triangles)
+  buildFaceGrids(VCurr, FCurr, verticesToParts, nParts);
+
+  auto regionVertexIds = [&](int regionIdBnd) -> const vector<int> & {
+    return interiorDepthConditions ? partsIds[regionIdBnd] : bnds[regionIdBnd];
   };
-  const Matrix4d M = Matrix4d::Identity();
-  rasterizeSimple<double>(VCurr, FCurr, frameBuffer.w, frameBuffer.h, shader);
 
-  for (const auto &el : ineqRegionConds) {
+  // Faces under the boundary vertices do not depend on the used flags, i.e.
+  // they can be found for all region pairs in advance (and in parallel). The
+  // correspondences are then picked in the serial order below, so the result
+  // does not depend on the number of threads.
+  auto &pairFaces = wsActiveSet.pairFaces;
+  pairFaces.resize(ineqRegionConds.size());
+  auto findFaces = [&](int pair, int begin, int end) {
+    const auto &el = ineqRegionConds[pair];
+    const vector<int> &vertexIds = regionVertexIds(get<0>(el));
+    const FaceGrid &g = faceGrids[get<1>(el)];
+    fora(k, begin, end) {
+      const int bndId = vertexIds[k];
+      int &faceId = pairFaces[pair][k];
+      faceId = -1;
+      if (interiorDepthConditions && (isBnd[bndId] || isMergeBnd[bndId]))
+        continue;
+      const Vector3d &vc = VCurr.row(bndId);
+      const int x = static_cast<int>(vc(0)), y = static_cast<int>(vc(1));
+      faceId = findFace(g, VCurr, FCurr, x, y);
+    }
+  };
+  const int chunkSize = 256;
+  forlist(pair, ineqRegionConds) {
+    const int nVertices =
+        regionVertexIds(get<0>(ineqRegionConds[pair])).size();
+    pairFaces[pair].resize(nVertices);
+    if (!parallelCorrespondences) {
+      findFaces(pair, 0, nVertices);
+      continue;
+    }
+    for (int begin = 0; begin < nVertices; begin += chunkSize) {
+      const int end = min(begin + chunkSize, nVertices);
+      getWorkerPool().run(
+          [&findFaces, pair, begin, end]() { findFaces(pair, begin, end); });
+    }
+  }
+  if (parallelCorrespondences) getWorkerPool().wait();
+
+  forlist(pair, ineqRegionConds) {
+    const auto &el = ineqRegionConds[pair];
     const int regionIdBnd = get<0>(el);
-    const int regionIdMesh = get<1>(el);
     const int sign = get<2>(el);
 
     // find existing correspondences for regions boundary
-    vector<int> *vertexIds = &bnds[regionIdBnd];
-    if (interiorDepthConditions) vertexIds = &partsIds[regionIdBnd];
+    const vector<int> &vertexIds = regionVertexIds(regionIdBnd);
 
-    for (const int bndId : *vertexIds) {
+    forlist(k, vertexIds) {
+      const int bndId = vertexIds[k];
       if (interiorDepthConditions) {
         if (isBnd[bndId]) continue;
         if (isMergeBnd[bndId]) continue;
@@ -199,9 +789,7 @@ void DefEngARAPL::prepareActiveSetEqs(const Eigen::MatrixXd &VCurr,
       const int x = static_cast<int>(vc(0)), y = static_cast<int>(vc(1));
       const RowVector2d vci(x, y);
 
-      int faceId = -1;
-      if (x >= 0 && y >= 0 && x < frameBuffer.w && y < frameBuffer.h)
-        faceId = frameBuffer(x, y, regionIdMesh);
+      const int faceId = pairFaces[pair][k];
       int corrId = -1;
       double min = numeric_limits<double>::infinity();
 
@@ -235,23 +823,22 @@ void DefEngARAPL::prepareActiveSetEqs(const Eigen::MatrixXd &VCurr,
         bool isActive = false;
         const Vector3d &vCorr = VCurr.row(corrId);
         if (sign * vc(2) - sign * vCorr(2) > 0) {  // comparing z-coordinate
-          asActive[bndId] = corrId;
+          activateConstraint(bndId, corrId);
           isActive = true;
         }
 
         if (!isActive) {
           // some constraints may be fulfilled but still active, check if it is
           // active
-          const auto &it = asActive.find(bndId);
-          if (it != asActive.end()) {
+          const int corrIdAS = asActive[bndId];
+          if (corrIdAS != -1) {
             isActive = true;
 
             // constraint is fulfilled but deactivate it if the correspondence
             // for the current bnd vertex has changed
-            const int corrIdAS = it->second;
             if (corrIdAS != corrId) {
               isActive = false;
-              asActive.erase(it);
+              deactivateConstraint(bndId);
             }
           }
         }
@@ -259,6 +846,7 @@ void DefEngARAPL::prepareActiveSetEqs(const Eigen::MatrixXd &VCurr,
         if (isActive) {
           // add to the list of inequalities that will be satisfied
           ineqCorrs.push_back(make_tuple(bndId, corrId, sign));
+          asKept[bndId] = true;
         }
 
         used[corrId] = true;
@@ -268,73 +856,667 @@ void DefEngARAPL::prepareActiveSetEqs(const Eigen::MatrixXd &VCurr,
     }
   }
 
-  // deactivate constraints that do not have a correspondence
-  set<int> hasCorr;
-  for (auto &el : ineqCorrs) hasCorr.insert(get<0>(el));
-  for (auto it = asActive.begin(); it != asActive.end(); ++it) {
-    if (hasCorr.find(it->first) == hasCorr.end()) {
-      it = asActive.erase(it);
-      if (it == asActive.end()) break;
-    }
+  // deactivate constraints that do not have a correspondence (backwards,
+  // deactivation moves the last element of the list)
+  for (int k = asActiveList.size() - 1; k >= 0; k--) {
+    const int bndId = asActiveList[k];
+    if (!asKept[bndId]) deactivateConstraint(bndId);
+    asKept[bndId] = false;
   }
 
-  int numEqs = 0;
-  vector<Triplet<double>> tripletsEq;
+  // the equalities do not change between frames, only with a new mesh and
+  // its correspondences
+  const int numEqs =
+      armpitsStitchingInJointOptimization ? mergeArmpitsCorrs.size() : 0;
   if (armpitsStitchingInJointOptimization) {
-    // create equality matrix
-    numEqs = mergeArmpitsCorrs.size();
-    Aeq = SparseMatrix<double>(numEqs, VCurr.rows());
-    Beq = VectorXd(numEqs);
-    Beq.fill(0);
-    tripletsEq.reserve(2 * numEqs);
-    int c = 0;
-    for (auto &el : mergeArmpitsCorrs) {
-      const int a = get<0>(el);
-      const int b = get<1>(el);
-      const int sign = get<2>(el);
-      tripletsEq.push_back(Triplet<double>(c, a, sign * 1));   // boundary
-      tripletsEq.push_back(Triplet<double>(c, b, sign * -1));  // mesh
-      c++;
+    if (Aeq.rows() != numEqs || Aeq.cols() != VCurr.rows() ||
+        AeqCorrs != mergeArmpitsCorrs) {
+      // create equality matrix
+      vector<Triplet<double>> tripletsEq;
+      tripletsEq.reserve(2 * numEqs);
+      int c = 0;
+      for (auto &el : mergeArmpitsCorrs) {
+        const int a = get<0>(el);
+        const int b = get<1>(el);
+        const int sign = get<2>(el);
+        tripletsEq.push_back(Triplet<double>(c, a, sign * 1));   // boundary
+        tripletsEq.push_back(Triplet<double>(c, b, sign * -1));  // mesh
+        c++;
+      }
+      Aeq = SparseMatrix<double>(numEqs, VCurr.rows());
+      Aeq.setFromTriplets(tripletsEq.begin(), tripletsEq.end());
+      Beq = VectorXd::Zero(numEqs);
+      AeqCorrs = mergeArmpitsCorrs;
+      AeqChanged = true;
     }
-    Aeq.setFromTriplets(tripletsEq.begin(), tripletsEq.end());
-  } else {
+  } else if (Aeq.rows() > 0 || Beq.size() > 0) {
     Aeq = SparseMatrix<double>();
     Beq = VectorXd();
+    AeqCorrs.clear();
+    AeqChanged = true;
   }
 
-  // create inequality matrix
-  int numIneqs = ineqCorrs.size();
-  Aieq = SparseMatrix<double>(numIneqs, VCurr.rows());
-  Bieq = VectorXd(numIneqs);
-  Bieq.fill(0);
-  vector<Triplet<double>> tripletsIeq, tripletsAll;
-  tripletsIeq.reserve(2 * numIneqs);
-  int c = 0;
-  for (auto &el : ineqCorrs) {
-    const int a = get<0>(el);
-    const int b = get<1>(el);
-    const int sign = get<2>(el);
-    tripletsIeq.push_back(Triplet<double>(c, a, sign * 1));   // boundary
-    tripletsIeq.push_back(Triplet<double>(c, b, sign * -1));  // mesh
-    c++;
+  // rows of the combined (ineqs + eqs) matrix, AeqAll itself is created in
+  // updateActiveSetSolver when needed
+  const int numIneqs = ineqCorrs.size();
+  AeqAllRows = ineqCorrs;
+  if (armpitsStitchingInJointOptimization) {
+    AeqAllRows.insert(AeqAllRows.end(), mergeArmpitsCorrs.begin(),
+                      mergeArmpitsCorrs.end());
   }
-  Aieq.setFromTriplets(tripletsIeq.begin(), tripletsIeq.end());
-
-  // create combined (ineqs + eqs) matrix
-  int numAll = numIneqs + numEqs;
-  tripletsAll = tripletsIeq;
-  tripletsAll.insert(tripletsAll.end(), tripletsEq.begin(), tripletsEq.end());
-  AeqAll = SparseMatrix<double>(numAll, VCurr.rows());
-  BeqAll = VectorXd(numAll);
-  BeqAll.fill(0);
-  AeqAll.setFromTriplets(tripletsAll.begin(), tripletsAll.end());
+  BeqAll.setZero(numIneqs + numEqs);
 
   // reindexing for active set
   reindex.resize(numIneqs, -1);
   forlist(i, ineqCorrs) reindex[i] = get<0>(ineqCorrs[i]);
 }
 
-void DefEngARAPL::precompute(const Def3D &def, Mesh3D &mesh) {
+void DefEngARAPL::updateActiveSetSolver() {
+  // the active set is the same as in the previous frame, keep the solver
+  const bool pgs = pgsDepth && fact->Q2Factorized;
+  if (activeSetSolverValid && activeSetSolverPGS == pgs &&
+      AeqAllRows == AeqAllRowsPrev) {
+    return;
+  }
+
+  if (!fact->Q2Factorized) {
+    // combined (ineqs + eqs) matrix
+    vector<Triplet<double>> triplets;
+    triplets.reserve(2 * AeqAllRows.size());
+    forlist(i, AeqAllRows) {
+      const auto &row = AeqAllRows[i];
+      triplets.push_back(Triplet<double>(i, get<0>(row), get<2>(row)));
+      triplets.push_back(Triplet<double>(i, get<1>(row), -get<2>(row)));
+    }
+    AeqAll.resize(AeqAllRows.size(), L.rows());
+    AeqAll.setFromTriplets(triplets.begin(), triplets.end());
+    precomputeKeepPattern(fact->Q2, reduceEq(AeqAll), *dataQP);
+  } else {
+    // reuse columns of Q2^-1 * AeqAll^T for rows that were already present,
+    // only the new rows require a solve
+    map<tuple<int, int, int>, int> prevRows;
+    if (activeSetSolverValid) {
+      forlist(i, AeqAllRowsPrev) prevRows[AeqAllRowsPrev[i]] = i;
+    }
+    const int n = L.rows();
+    const int m = AeqAllRows.size();
+    MatrixXd Wnew(n, m);
+    vector<int> newCols;
+    fora(i, 0, m) {
+      const auto &it = prevRows.find(AeqAllRows[i]);
+      if (it != prevRows.end()) {
+        Wnew.col(i) = W.col(it->second);
+      } else {
+        newCols.push_back(i);
+      }
+    }
+    // solve for all new rows at once
+    if (!newCols.empty()) {
+      MatrixXd E = MatrixXd::Zero(n, newCols.size());
+      forlist(j, newCols) {
+        const auto &row = AeqAllRows[newCols[j]];
+        E(get<0>(row), j) = get<2>(row);
+        E(get<1>(row), j) = -get<2>(row);
+      }
+      MatrixXd WCols;
+      solveQ2(E, WCols, wsZ);
+      forlist(j, newCols) Wnew.col(newCols[j]) = WCols.col(j);
+    }
+    W.swap(Wnew);
+
+    // multipliers of the rows that were already present are the initial
+    // guess of the next solvePGS
+    if (pgs) {
+      MatrixX3d mu = MatrixX3d::Zero(m, 3);
+      fora(i, 0, m) {
+        const auto &it = prevRows.find(AeqAllRows[i]);
+        if (it != prevRows.end() && it->second < pgsMu.rows()) {
+          mu.row(i) = pgsMu.row(it->second);
+        }
+      }
+      pgsMu.swap(mu);
+    }
+
+    // Schur complement
+    S.resize(m, m);
+    fora(i, 0, m) {
+      const auto &row = AeqAllRows[i];
+      S.row(i) = 2 * get<2>(row) * (W.row(get<0>(row)) - W.row(get<1>(row)));
+    }
+    if (m > 0 && !pgs) SSolver.compute(S);
+  }
+  activeSetSolverPGS = pgs;
+
+  AeqAllRowsPrev = AeqAllRows;
+  activeSetSolverValid = true;
+}
+
+// Coarse nodes of the two-level solve: one vertex per cell of a uniform grid
+// with the given spacing (the one closest to the cell center), separately for
+// each connected component.
+static void gridNodes(const MatrixXd &V, const MatrixXi &F, double spacing,
+                      vector<int> &nodes) {
+  VectorXi C;
+  vertex_components(F, C);
+  map<tuple<int, int, int, int>, pair<double, int>> cells;
+  fora(i, 0, V.rows()) {
+    const Vector3d p = V.row(i).transpose() / spacing;
+    const Vector3d c = p.array().floor();
+    const auto key = make_tuple(C(i), int(c(0)), int(c(1)), int(c(2)));
+    const double d = (p - c - Vector3d::Constant(0.5)).squaredNorm();
+    auto it = cells.find(key);
+    if (it == cells.end() || d < it->second.first) cells[key] = {d, i};
+  }
+  nodes.clear();
+  for (const auto &it : cells) nodes.push_back(it.second.second);
+}
+
+// Prolongation from the coarse nodes to all vertices. Each vertex is a convex
+// combination of the nodes within the given geodesic radius (Wendland kernel,
+// distances along the mesh edges), vertices with no node in range are
+// attached to the nearest node. Nodes themselves are interpolated exactly.
+static void prolongation(const MatrixXd &V, const MatrixXi &F,
+                         const vector<int> &nodes, double radius,
+                         SparseMatrix<double> &P) {
+  const int n = V.rows();
+  vector<vector<int>> adj;
+  adjacency_list(F, adj);
+  adj.resize(n);
+  vector<int> nodeId(n, -1);
+  forlist(j, nodes) nodeId[nodes[j]] = j;
+
+  typedef pair<double, int> QEl;
+  const double inf = numeric_limits<double>::infinity();
+  vector<double> dist(n, inf), wSum(n, 0);
+  vector<int> nearest(n, -1);
+  vector<int> touched;
+  vector<Triplet<double>> triplets;
+
+  // bounded Dijkstra from each node
+  forlist(j, nodes) {
+    priority_queue<QEl, vector<QEl>, greater<QEl>> q;
+    dist[nodes[j]] = 0;
+    touched.push_back(nodes[j]);
+    q.push({0, nodes[j]});
+    while (!q.empty()) {
+      const double d = q.top().first;
+      const int i = q.top().second;
+      q.pop();
+      if (d > dist[i]) continue;
+      if (nodeId[i] == -1) {
+        const double t = 1 - d / radius;
+        const double w = t * t * t * t * (4 * (1 - t) + 1);
+        triplets.push_back(Triplet<double>(i, j, w));
+        wSum[i] += w;
+      }
+      for (int k : adj[i]) {
+        const double dk = d + (V.row(i) - V.row(k)).norm();
+        if (dk < radius && dk < dist[k]) {
+          if (dist[k] == inf) touched.push_back(k);
+          dist[k] = dk;
+          q.push({dk, k});
+        }
+      }
+    }
+    for (int i : touched) dist[i] = inf;
+    touched.clear();
+  }
+
+  // unbounded multi-source Dijkstra for the vertices out of range
+  bool allReached = true;
+  fora(i, 0, n) if (nodeId[i] == -1 && wSum[i] == 0) allReached = false;
+  if (!allReached) {
+    priority_queue<QEl, vector<QEl>, greater<QEl>> q;
+    forlist(j, nodes) {
+      dist[nodes[j]] = 0;
+      nearest[nodes[j]] = j;
+      q.push({0, nodes[j]});
+    }
+    while (!q.empty()) {
+      const double d = q.top().first;
+      const int i = q.top().second;
+      q.pop();
+      if (d > dist[i]) continue;
+      for (int k : adj[i]) {
+        const double dk = d + (V.row(i) - V.row(k)).norm();
+        if (dk < dist[k]) {
+          dist[k] = dk;
+          nearest[k] = nearest[i];
+          q.push({dk, k});
+        }
+      }
+    }
+    fora(i, 0, n) {
+      if (nodeId[i] == -1 && wSum[i] == 0 && nearest[i] != -1) {
+        triplets.push_back(Triplet<double>(i, nearest[i], 1));
+        wSum[i] = 1;
+      }
+    }
+  }
+
+  for (auto &t : triplets) {
+    t = Triplet<double>(t.row(), t.col(), t.value() / wSum[t.row()]);
+  }
+  forlist(j, nodes) triplets.push_back(Triplet<double>(nodes[j], j, 1));
+  P = SparseMatrix<double>(n, nodes.size());
+  P.setFromTriplets(triplets.begin(), triplets.end());
+}
+
+void DefEngARAPL::prepareTwoLevel(const Eigen::MatrixXd &V,
+                                  const Eigen::MatrixXi &F,
+                                  const std::vector<int> &fixedNodes) {
+  const int n = V.rows();
+  if (twoLevelGridNodes.empty() || prolong.rows() != n) {
+    VectorXd dblA;
+    doublearea(V, F, dblA);
+    twoLevelSpacing =
+        sqrt(0.5 * dblA.sum() * max(twoLevelCoarsening, 1) / double(n));
+    gridNodes(V, F, twoLevelSpacing, twoLevelGridNodes);
+  }
+
+  // CP vertices have to be coarse nodes to be constrained exactly
+  vector<int> nodes = twoLevelGridNodes;
+  nodes.insert(nodes.end(), fixedNodes.begin(), fixedNodes.end());
+  sort(nodes.begin(), nodes.end());
+  nodes.erase(unique(nodes.begin(), nodes.end()), nodes.end());
+  if (nodes != twoLevelNodes || prolong.rows() != n) {
+    twoLevelNodes = nodes;
+    prolongation(V, F, twoLevelNodes, 2 * twoLevelSpacing, prolong);
+    DEBUG_CMD_MM(cout << "DefEngARAPL: two-level solve with "
+                      << twoLevelNodes.size() << " of " << n << " vertices"
+                      << endl;);
+  }
+  restrictXY = restrictionOp(lambdaInv);
+  restrictZ = restrictionOp(lambda2Inv);
+}
+
+bool DefEngARAPL::twoLevelActive() const {
+  return prolong.rows() > 0 && prolong.rows() == L.rows();
+}
+
+// Restriction of the equations to the coarse nodes: prolong^T (Galerkin),
+// except for the hard constrained vertices (zero rows of lambdaInv), the
+// equation of those is taken as it is to keep the constraint exact.
+SparseMatrix<double> DefEngARAPL::restrictionOp(
+    const VectorXd &lambdaInv) const {
+  vector<Triplet<double>> triplets;
+  triplets.reserve(prolong.nonZeros());
+  fora(j, 0, prolong.outerSize()) {
+    const int node = twoLevelNodes[j];
+    if (lambdaInv(node) == 0) {
+      triplets.push_back(Triplet<double>(j, node, 1));
+      continue;
+    }
+    for (SparseMatrix<double>::InnerIterator it(prolong, j); it; ++it) {
+      triplets.push_back(Triplet<double>(j, it.row(), it.value()));
+    }
+  }
+  SparseMatrix<double> R(prolong.cols(), prolong.rows());
+  R.setFromTriplets(triplets.begin(), triplets.end());
+  return R;
+}
+
+SparseMatrix<double> DefEngARAPL::reduce(
+    const SparseMatrix<double> &Q,
+    const SparseMatrix<double> &restriction) const {
+  if (!twoLevelActive()) return Q;
+  SparseMatrix<double> QCoarse = restriction * Q * prolong;
+  QCoarse.makeCompressed();
+  return QCoarse;
+}
+
+SparseMatrix<double> DefEngARAPL::reduceEq(
+    const SparseMatrix<double> &A) const {
+  if (!twoLevelActive() || A.rows() == 0) return A;
+  return A * prolong;
+}
+
+// X = Q2^-1 * B, in the two-level mode approximated by
+// prolong * Q2Coarse^-1 * restrictZ * B
+template <typename MatrixB, typename MatrixX>
+void DefEngARAPL::solveQ2(const MatrixB &B, MatrixX &X,
+                          SolveWorkspace &w) const {
+  const Factorization &f = *fact;
+  if (!twoLevelActive()) {
+    if (f.Q2Iterative) {
+      solvePCG(f.Q2, f.Q2InvDiag, B, X);
+    } else if (f.Q2Supernodal) {
+      X = f.Q2SupernodalSolver.solve(B);
+    } else {
+      X = f.Q2Solver.solve(B);
+    }
+    return;
+  }
+  w.BCoarse.noalias() = restrictZ * B;
+  if (f.Q2Iterative) {
+    solvePCG(f.Q2, f.Q2InvDiag, w.BCoarse, w.VCoarse);
+  } else if (f.Q2Supernodal) {
+    w.VCoarse = f.Q2SupernodalSolver.solve(w.BCoarse);
+  } else {
+    w.VCoarse = f.Q2Solver.solve(w.BCoarse);
+  }
+  X.noalias() = prolong * w.VCoarse;
+}
+
+// Splits the XY system into the free vertices and the hard constrained ones,
+// whose rows of QXY are identity rows, and factorizes Q(free, free) with
+// SupernodalLLT or keeps it for solvePCG. It is symmetric positive definite
+// when all free vertices have the same lambdaInv, otherwise XYSupernodal and
+// XYIterative stay unset and the LU of data is used.
+void DefEngARAPL::factorizeXYSplit(Factorization &f) const {
+  f.XYSupernodal = f.XYIterative = false;
+  const int n = QXY.rows();
+  vector<int> &free = f.XYFree, &fixed = f.XYFixed;
+  free.clear();
+  fixed.clear();
+  vector<int> pos(n);  // index in free, or -1 - index in fixed
+  fora(i, 0, n) {
+    if (lambdaInv(i) == 0) {
+      pos[i] = -1 - static_cast<int>(fixed.size());
+      fixed.push_back(i);
+    } else {
+      pos[i] = free.size();
+      free.push_back(i);
+    }
+  }
+  if (free.empty()) return;
+  vector<Triplet<double>> freeFree, freeFixed;
+  freeFree.reserve(QXY.nonZeros());
+  fora(j, 0, n) {
+    for (SparseMatrix<double>::InnerIterator it(QXY, j); it; ++it) {
+      const int i = it.row();
+      if (pos[i] < 0) continue;
+      if (pos[j] >= 0) {
+        freeFree.emplace_back(pos[i], pos[j], it.value());
+      } else {
+        freeFixed.emplace_back(pos[i], -1 - pos[j], it.value());
+      }
+    }
+  }
+  SparseMatrix<double> QFree(free.size(), free.size());
+  QFree.setFromTriplets(freeFree.begin(), freeFree.end());
+  QFree.makeCompressed();
+  if (!is_symmetric(QFree, DOUBLE_EPS * QFree.coeffs().abs().maxCoeff())) {
+    return;
+  }
+  f.XYFreeFixed.resize(free.size(), fixed.size());
+  f.XYFreeFixed.setFromTriplets(freeFixed.begin(), freeFixed.end());
+  if (iterative) {
+    f.XYInvDiag = QFree.diagonal().cwiseInverse();
+    f.XYFreeFree.swap(QFree);
+    f.XYIterative = true;
+    return;
+  }
+  // reuses the ordering of the previous factorization if the pattern is the
+  // same, i.e. when the CPs did not change
+  f.XYSolver.factorize(QFree);
+  f.XYSupernodal = f.XYSolver.info() == Success;
+}
+
+// X = -Q^-1 * B for the XY system split by factorizeXYSplit, the same as
+// min_quad_with_fixed_solve without equalities: X(fixed) = -B(fixed) and
+// Q(free, free) * X(free) = -B(free) - Q(free, fixed) * X(fixed). With
+// XYIterative, X is the initial guess if it has the size of B.
+template <typename MatrixB, typename MatrixX>
+void DefEngARAPL::solveXYSplit(const Factorization &f, const MatrixB &B,
+                               MatrixX &X) const {
+  const int nFree = f.XYFree.size(), nFixed = f.XYFixed.size();
+  MatrixXd XFixed(nFixed, B.cols()), BFree(nFree, B.cols());
+  fora(i, 0, nFixed) XFixed.row(i) = -B.row(f.XYFixed[i]);
+  fora(i, 0, nFree) BFree.row(i) = -B.row(f.XYFree[i]);
+  BFree.noalias() -= f.XYFreeFixed * XFixed;
+  MatrixXd XFree;
+  if (f.XYIterative) {
+    XFree.setZero(nFree, B.cols());
+    if (X.rows() == B.rows() && X.cols() == B.cols()) {
+      fora(i, 0, nFree) XFree.row(i) = X.row(f.XYFree[i]);
+    }
+    solvePCG(f.XYFreeFree, f.XYInvDiag, BFree, XFree);
+  } else {
+    XFree = f.XYSolver.solve(BFree);
+  }
+  X.resize(B.rows(), B.cols());
+  fora(i, 0, nFixed) X.row(f.XYFixed[i]) = XFixed.row(i);
+  fora(i, 0, nFree) X.row(f.XYFree[i]) = XFree.row(i);
+}
+
+// Solves A * X = B for a symmetric positive definite A with conjugate
+// gradients preconditioned by the inverse diagonal of A, each column on its
+// own, starting from X if it has the size of B (from 0 otherwise). Stops
+// when the residual of every column is below cgTol times its right hand
+// side, after cgMaxIter iterations or, with convergenceControl, when the time
+// budget of the frame is exceeded.
+template <typename MatrixB, typename MatrixX>
+void DefEngARAPL::solvePCG(const SparseMatrix<double> &A,
+                           const VectorXd &invDiag, const MatrixB &B,
+                           MatrixX &X) const {
+  if (X.rows() != B.rows() || X.cols() != B.cols()) {
+    X.setZero(B.rows(), B.cols());
+  }
+  // per column quantities as row arrays
+  const ArrayXXd threshold = cgTol * cgTol * B.colwise().squaredNorm().array();
+  MatrixXd R = B - A * X;
+  MatrixXd Z = invDiag.asDiagonal() * R;
+  MatrixXd P = Z, AP;
+  ArrayXXd rz = R.cwiseProduct(Z).colwise().sum().array();
+  fora(it, 0, cgMaxIter) {
+    if ((R.colwise().squaredNorm().array() <= threshold).all()) break;
+    if (convergenceControl && budgetExceeded()) break;
+    AP.noalias() = A * P;
+    const ArrayXXd pAp = P.cwiseProduct(AP).colwise().sum().array();
+    const VectorXd alpha = (pAp > 0).select(rz / pAp, 0).transpose();
+    X.noalias() += P * alpha.asDiagonal();
+    R.noalias() -= AP * alpha.asDiagonal();
+    Z.noalias() = invDiag.asDiagonal() * R;
+    const ArrayXXd rzNew = R.cwiseProduct(Z).colwise().sum().array();
+    const VectorXd beta = (rz > 0).select(rzNew / rz, 0).transpose();
+    P = Z + P * beta.asDiagonal();
+    rz = rzNew;
+  }
+}
+
+// Q = -(diag(lambdaInv) * L + diag(lambda)) on the pattern of L + I. When
+// rows is given, only these rows are updated.
+void DefEngARAPL::updateQ(const VectorXd &lambda, const VectorXd &lambdaInv,
+                          const vector<int> *rows,
+                          SparseMatrix<double> &Q) const {
+  const bool keepPattern = samePattern(Q, LI);
+  if (!keepPattern) Q = LI;
+  const double *LValues = LI.valuePtr();
+  double *QValues = Q.valuePtr();
+  auto updateRow = [&](int i) {
+    fora(k, LIRowStart[i], LIRowStart[i + 1]) {
+      const int pos = LIRowPos[k];
+      QValues[pos] = -lambdaInv(i) * LValues[pos];
+    }
+    QValues[LIDiagPos[i]] -= lambda(i);
+  };
+  if (rows == nullptr || !keepPattern) {
+    fora(i, 0, Q.rows()) updateRow(i);
+  } else {
+    for (int i : *rows) updateRow(i);
+  }
+}
+
+// Diagonal weights of the soft (1 - rigidity) and hard (CP) constraints,
+// lambdaInv = 1 + lambda. When only CPs were added or removed, just their
+// entries of the lambdas and their rows of QXY and QZ are updated.
+void DefEngARAPL::updateLambdas(const Def3D::CPs &cps, int n) {
+  vector<int> cpIds = cps.getPtIds();
+  sort(cpIds.begin(), cpIds.end());
+  cpIds.erase(unique(cpIds.begin(), cpIds.end()), cpIds.end());
+
+  // pattern of L + I and the positions of its entries row by row
+  const bool newPattern = LI.rows() != n || LINonZeros != L.nonZeros();
+  if (newPattern) {
+    SparseMatrix<double> I2(n, n);
+    I2.setIdentity();
+    LI = L + 0 * I2;
+    LI.makeCompressed();
+    LINonZeros = L.nonZeros();
+    LIRowStart.assign(n + 1, 0);
+    LIDiagPos.assign(n, -1);
+    fora(k, 0, LI.nonZeros()) LIRowStart[LI.innerIndexPtr()[k] + 1]++;
+    fora(i, 0, n) LIRowStart[i + 1] += LIRowStart[i];
+    LIRowPos.resize(LI.nonZeros());
+    vector<int> fill(LIRowStart.begin(), LIRowStart.end() - 1);
+    fora(j, 0, n) {
+      fora(k, LI.outerIndexPtr()[j], LI.outerIndexPtr()[j + 1]) {
+        const int i = LI.innerIndexPtr()[k];
+        LIRowPos[fill[i]++] = k;
+        if (i == j) LIDiagPos[i] = k;
+      }
+    }
+  }
+
+  const auto params = make_tuple(n, rigidity, cpOptimizeForXY, cpOptimizeForZ);
+  auto setLambdas = [&](int i, bool isCP) {
+    const double soft = -(1.0 - rigidity);  // do not constrain
+    const double hard = -1.0;               // constrain
+    lambda(i) = isCP && !cpOptimizeForXY ? hard : soft;
+    lambda2(i) = isCP && !cpOptimizeForZ ? hard : soft;
+    lambdaInv(i) = 1 + lambda(i);
+    lambda2Inv(i) = 1 + lambda2(i);
+  };
+  if (newPattern || params != lambdaParams) {
+    lambda.resize(n);
+    lambdaInv.resize(n);
+    lambda2.resize(n);
+    lambda2Inv.resize(n);
+    fora(i, 0, n) setLambdas(i, false);
+    for (int i : cpIds) setLambdas(i, true);
+    updateQ(lambda, lambdaInv, nullptr, QXY);
+    updateQ(lambda2, lambda2Inv, nullptr, QZ);
+  } else {
+    // vertices that became or stopped being CPs
+    vector<int> changed;
+    set_symmetric_difference(cpIds.begin(), cpIds.end(), lambdaCPs.begin(),
+                             lambdaCPs.end(), back_inserter(changed));
+    for (int i : changed) {
+      setLambdas(i, binary_search(cpIds.begin(), cpIds.end(), i));
+    }
+    updateQ(lambda, lambdaInv, &changed, QXY);
+    updateQ(lambda2, lambda2Inv, &changed, QZ);
+  }
+  lambdaParams = params;
+  lambdaCPs.swap(cpIds);
+}
+
+// The shared factorizations were computed for the current CP vertices, lambda
+// parameters and armpit equalities.
+bool DefEngARAPL::factorizationValid(const Factorization &f) const {
+  if (f.cps != lambdaCPs || f.params != lambdaParams) return false;
+  if (f.twoLevel != twoLevelActive() || f.supernodal != supernodal ||
+      f.iterative != iterative || f.components != componentSolves) {
+    return false;
+  }
+  if (f.Aeq.rows() != Aeq.rows() || f.Aeq.cols() != Aeq.cols()) return false;
+  if (Aeq.nonZeros() == 0) return f.Aeq.nonZeros() == 0;
+  return samePattern(f.Aeq, Aeq) &&
+         equal(Aeq.valuePtr(), Aeq.valuePtr() + Aeq.nonZeros(),
+               f.Aeq.valuePtr());
+}
+
+// Factorizes the XY system and, unless only the equalities changed, Q2. With
+// instances, the factorizations of another instance valid for this one are
+// adopted if there are any, otherwise new ones are computed and published.
+// Published factorizations are never modified.
+void DefEngARAPL::factorize(bool equalitiesOnly) {
+  localSystem.reset();
+  if (factCache) {
+    lock_guard<mutex> lock(factCache->mutex);
+    auto &facts = factCache->facts;
+    facts.erase(remove_if(facts.begin(), facts.end(),
+                          [](const weak_ptr<Factorization> &f) {
+                            return f.expired();
+                          }),
+                facts.end());
+    for (const auto &it : facts) {
+      shared_ptr<Factorization> f = it.lock();
+      if (f && factorizationValid(*f)) {
+        fact = f;
+        return;
+      }
+    }
+    fact = make_shared<Factorization>();
+    equalitiesOnly = false;
+  }
+  Factorization &f = *fact;
+  f.XYSupernodal = f.XYIterative = f.XYComponents = false;
+  const bool uncoupled = !twoLevelActive() && Aeq.rows() == 0;
+  const vector<int> &compStart = ops->compStart;
+  if (componentSolves && uncoupled && !compStart.empty()) {
+    // QXY is block diagonal with a block per component
+    const int nComps = compStart.size() - 1;
+    f.compData.resize(nComps);
+    atomic<bool> failed(false);
+    getWorkerPool().parallelFor(nComps, 1, [&](int begin, int end) {
+      fora(c, begin, end) {
+        const int b = compStart[c], m = compStart[c + 1] - b;
+        const SparseMatrix<double> Q = QXY.block(b, b, m, m);
+        f.compData[c].reset(new min_quad_with_fixed_data<double>());
+        if (!min_quad_with_fixed_precompute(Q, VectorXi(),
+                                            SparseMatrix<double>(), false,
+                                            *f.compData[c])) {
+          failed = true;
+        }
+      }
+    });
+    f.XYComponents = !failed;
+  } else if ((supernodal || iterative) && uncoupled) {
+    factorizeXYSplit(f);
+  }
+  if (!f.XYSupernodal && !f.XYIterative && !f.XYComponents) {
+    precomputeKeepPattern(reduce(QXY, restrictXY), reduceEq(Aeq), f.data);
+  }
+  f.Aeq = Aeq;
+  f.supernodal = supernodal;
+  f.iterative = iterative;
+  f.components = componentSolves;
+  if (equalitiesOnly) return;
+
+  // Q2 does not depend on the active set, factorize it once here when
+  // possible, otherwise the whole KKT system is factorized in
+  // updateActiveSetSolver
+  SparseMatrix<double> Q2New = reduce(QZ, restrictZ);
+  Q2New.makeCompressed();
+  const bool Q2SamePattern =
+      f.Q2Factorized && !f.Q2Supernodal && !f.Q2Iterative &&
+      samePattern(Q2New, f.Q2);
+  f.Q2 = Q2New;
+  f.Q2Factorized = false;
+  f.Q2Supernodal = f.Q2Iterative = false;
+  if (is_symmetric(f.Q2, DOUBLE_EPS * f.Q2.coeffs().abs().maxCoeff())) {
+    // adding or removing a CP changes only the diagonal, i.e. the AMD
+    // ordering and the symbolic factorization can be reused (SupernodalLLT
+    // checks the pattern itself)
+    if (iterative) {
+      f.Q2InvDiag = f.Q2.diagonal().cwiseInverse();
+      f.Q2Iterative = true;
+    } else if (supernodal) {
+      f.Q2SupernodalSolver.factorize(f.Q2);
+      f.Q2Supernodal = f.Q2SupernodalSolver.info() == Success;
+    }
+    if (!f.Q2Supernodal && !f.Q2Iterative) {
+      if (Q2SamePattern) {
+        f.Q2Solver.factorize(f.Q2);
+      } else {
+        f.Q2Solver.compute(f.Q2);
+      }
+    }
+    f.Q2Factorized = f.Q2Supernodal || f.Q2Iterative ||
+                     f.Q2Solver.info() == Success;
+  }
+  f.cps = lambdaCPs;
+  f.params = lambdaParams;
+  f.twoLevel = twoLevelActive();
+  if (factCache) {
+    lock_guard<mutex> lock(factCache->mutex);
+    factCache->facts.push_back(fact);
+  }
+}
+
+void DefEngARAPL::precomputeImpl(const Def3D &def, Mesh3D &mesh) {
   if (!checkData(mesh)) return;
 
   const auto &cps = def.getCPs();
@@ -347,43 +1529,18 @@ void DefEngARAPL::precompute(const Def3D &def, Mesh3D &mesh) {
   }
 
   // temporal smoothing - prepare
-  if (tempSmoothingSteps > 0 && VPrevsZ.size() < tempSmoothingSteps + 1) {
-    VPrevsZ.resize(tempSmoothingSteps + 1, VCurr.col(2));
+  if (tempSmoothingSteps > 0 && (tempZ.rows() != VCurr.rows() ||
+                                 tempZ.cols() != tempSmoothingSteps + 1)) {
+    tempZ = VCurr.col(2).replicate(1, tempSmoothingSteps + 1);
+    tempZSum = tempZ.rowwise().sum();
+    tempZHead = 0;
   }
 
-  // compute constraints
-  VectorXi b;
+  // positions of CPs
   const int n = VRest.rows();
-  Eigen::VectorXd constraints(n);
-  constraints.fill(1.0 - rigidity);
-  for (const auto &it : cps) {
-    const Def3D::CP &cp = *it.second;
-    const int ptId = cp.ptId;
-    const double w = 1;
-    constraints(ptId) = w;
-    VCurr.row(ptId) = cp.pos;
-  }
-
-  // compute lambdas
-  lambda = SparseMatrix<double>(n, n);
-  lambdaInv = SparseMatrix<double>(n, n);
-  SparseMatrix<double> I2(n, n);
-  I2.setIdentity();
-  lambda = I2 * -(1.0 - rigidity);  // do not constrain
-  if (!cpOptimizeForXY) {
-    forlist(i, constraints) lambda.coeffRef(i, i) =
-        -constraints(i);  // constrain
-  }
-  lambdaInv = I2 + lambda;
-
-  lambda2 = SparseMatrix<double>(n, n);
-  lambda2 =
-      I2 * -(1.0 - rigidity);  // do not constrain, i.e. let z-axis be free
-  if (!cpOptimizeForZ) {
-    forlist(i, constraints) lambda2.coeffRef(i, i) =
-        -constraints(i);  // constrain, i.e. fix z-axis
-  }
-  lambda2Inv = I2 + lambda2;
+  const vector<int> &cpPtIds = cps.getPtIds();
+  const vector<Vector3d> &cpPos = cps.getPos();
+  fora(i, 0, cpPtIds.size()) VCurr.row(cpPtIds[i]) = cpPos[i];
 
   if (I.rows() != n) {
     I = SparseMatrix<double>(n, n);
@@ -395,20 +1552,52 @@ void DefEngARAPL::precompute(const Def3D &def, Mesh3D &mesh) {
     massmatrix(VRest, F, MASSMATRIX_TYPE_DEFAULT, M);
     invert_diag(M, Minv);
   }
-  if (K.rows() == 0 || CSM.rows() == 0) {
+  bool operatorsReady = ops->K.rows() > 0 && ops->CSM.rows() > 0;
+  if (parallelLocalStep) {
+    operatorsReady = ops->KBlocksRowMajor.size() == 3;
+  } else if (singlePrecision) {
+    operatorsReady = ops->Kf.rows() > 0 && ops->CSMf.rows() > 0;
+  }
+  if (componentSolves || localUpdates) {
+    operatorsReady = operatorsReady && ops->KBlocksRowMajor.size() == 3;
+  }
+  if (localUpdates) {
+    operatorsReady =
+        operatorsReady && ops->patchSize == max(localPatchSize, 1);
+  }
+  operatorsReady = operatorsReady && ops->n == n;
+  if (!operatorsReady) {
     prepare(VRest, F);
   }
 
-  SparseMatrix<double> Q = -(lambdaInv * L + lambda);
-  min_quad_with_fixed_precompute(Q, VectorXi(), Aeq, false, data);
-  SparseMatrix<double> Q2 = -(lambda2Inv * L + lambda2);
-  min_quad_with_fixed_precompute(Q2, VectorXi(), AeqAll, false, dataQP);
+  updateLambdas(cps, n);
+
+  if (twoLevel && n >= twoLevelMinVertices) {
+    prepareTwoLevel(VRest, F, cps.getPtIds());
+  } else {
+    prolong = SparseMatrix<double>();
+  }
+
+  // column sums of M, (M * d).sum() == massWeights.dot(d)
+  if (M.rows() == n) {
+    massWeights = M.transpose() * VectorXd::Ones(n);
+    massSum = massWeights.sum();
+  } else {
+    massWeights = VectorXd();
+  }
+
+  AeqChanged = false;
+  if (!factorizationValid(*fact)) factorize(false);
+  activeSetSolverValid = false;
 
   prevCpsChanged = def.getCp2ptChangedNum();
 }
 
-double DefEngARAPL::deform(Def3D &def, Mesh3D &mesh) {
-  if (!checkData(mesh)) return numeric_limits<double>::infinity();
+// Everything of deform before the solves. Returns false if there is nothing
+// to solve for, diff is then the result of deform.
+bool DefEngARAPL::beginDeform(Def3D &def, Mesh3D &mesh, double &diff) {
+  diff = numeric_limits<double>::infinity();
+  if (!checkData(mesh)) return false;
 
   MatrixXd &VRest = mesh.VRest, &VCurr = mesh.VCurr;
   MatrixXi &F = mesh.F;
@@ -425,56 +1614,329 @@ double DefEngARAPL::deform(Def3D &def, Mesh3D &mesh) {
     precompute(def, mesh);
   }
 
+  // nothing moved since the last converged frame, keep the current state
+  bool cpsMoved = recompute || cpsPosPrev.size() != cps.size();
+  if (convergenceControl) {
+    if (!cpsMoved && cpsPosPrev != cps.getPos()) cpsMoved = true;
+    cpsPosPrev = cps.getPos();
+    if (converged && !cpsMoved && VPrev.size() == VCurr.size() &&
+        VPrev == VCurr) {
+      diff = 0;
+      return false;
+    }
+  }
+
   if (solveForZ) {
-    const MatrixXd &VCurrActiveSet2 =
-        (VCurrActiveSet.rows() > 0 && VCurrActiveSet.rows() == VCurr.rows())
-            ? VCurrActiveSet
-            : VCurr;
     reindex.clear();
-    prepareActiveSetEqs(VCurrActiveSet2, F);
+    prepareActiveSetEqs(VCurr, F);
   }
 
-  if (armpitsStitchingInJointOptimization) {
-    SparseMatrix<double> Q = -(lambdaInv * L + lambda);
-    min_quad_with_fixed_precompute(Q, VectorXi(), Aeq, false, data);
+  // the equalities are constant, refactorize only when they were recreated
+  if (armpitsStitchingInJointOptimization && AeqChanged) {
+    if (!factorizationValid(*fact)) factorize(true);
+    AeqChanged = false;
   }
-  if (solveForZ) {
-    SparseMatrix<double> Q2 = -(lambda2Inv * L + lambda2);
-    min_quad_with_fixed_precompute(Q2, VectorXi(), AeqAll, false, dataQP);
+  if (solveForZ) updateActiveSetSolver();
+  if (fact->XYComponents) wakeComponents(cps, VCurr);
+  frame.localXY = false;
+  if (localUpdates && !fact->XYComponents && !twoLevelActive() &&
+      Aeq.rows() == 0 && ops->patchSize > 0) {
+    updateActivePatches(cps, VCurr);
+    frame.localXY = nActivePatches < patchActive.size();
   }
 
   // update positions according to CPs
-  for (const auto &it : cps) {
-    const Def3D::CP &cp = *it.second;
-    const int p = cp.ptId;
+  const vector<int> &cpPtIds = cps.getPtIds();
+  const vector<Vector3d> &cpPos = cps.getPos();
+  fora(i, 0, cpPtIds.size()) {
+    const int p = cpPtIds[i];
     if (!cpOptimizeForXY)
-      VCurr.row(p).head(2) = cp.pos.head(2);       // update x,y only
-    if (!cpOptimizeForZ) VCurr(p, 2) = cp.pos(2);  // update z
+      VCurr.row(p).head(2) = cpPos[i].head(2);       // update x,y only
+    if (!cpOptimizeForZ) VCurr(p, 2) = cpPos[i](2);  // update z
   }
 
-  MatrixXd bc;
-  VectorXd sol;
-  MatrixXd solsXY, solsZ;
-  MatrixXd VcurXY = VCurr;
-  MatrixXd VcurZ = VCurr;
+  // all buffers below keep their size between frames, i.e. are not
+  // reallocated
+  wsXY.V = VCurr;
+  wsZ.V = VCurr;
+
+  frame.start = chrono::high_resolution_clock::now();
+  frame.nIter = convergenceControl ? convergenceMaxIter : maxIter;
+  frame.convergedXY = !convergenceControl;
+  frame.convergedZ = !convergenceControl;
+  frame.itersXY = 0;
+  frame.itersZ = 0;
+  return true;
+}
 
-  // solve (deformation for XY)
-  fora(i, 0, maxIter)
-      solveARAP(data, lambda, lambdaInv, K, VRest, Beq, VcurXY, solsXY);
-  if (solveForZ) {
-    // solve (deformation for Z & relative depths for Z)
-    fora(i, 0, maxIter)
-        solveARAP(dataQP, lambda2, lambda2Inv, K, VRest, BeqAll, VcurZ, solsZ);
+// mass-weighted average displacement of the given columns
+double DefEngARAPL::displacement(SolveWorkspace &w, const MatrixX3d &V1,
+                                 const MatrixX3d &V2, int col,
+                                 int nCols) const {
+  w.dist = (V1 - V2).middleCols(col, nCols).rowwise().norm();
+  if (massWeights.size() != w.dist.size()) return w.dist.mean();
+  return massWeights.dot(w.dist) / massSum;
+}
+
+bool DefEngARAPL::budgetExceeded() const {
+  const chrono::duration<double, milli> t =
+      chrono::high_resolution_clock::now() - frame.start;
+  return iterTimeBudgetMs > 0 && t.count() > iterTimeBudgetMs;
+}
+
+// Bookkeeping after the XY iteration i, returns true if the XY solve is done.
+bool DefEngARAPL::endIterationXY(int i) {
+  frame.itersXY = i + 1;
+  if (!convergenceControl) return i + 1 >= frame.nIter;
+  if (displacement(wsXY, wsXY.V, wsXY.VPrevIter, 0, 2) < convergenceTol) {
+    frame.convergedXY = true;
+    return true;
+  }
+  return i + 1 >= frame.nIter || budgetExceeded();
+}
+
+// solve (deformation for XY)
+void DefEngARAPL::solveXY(const MatrixXd &VRest) {
+  if (fact->XYComponents) {
+    solveXYComponents();
+    return;
+  }
+  if (frame.localXY && prepareLocalSystem()) {
+    solveXYLocal();
+    return;
+  }
+  fora(i, 0, frame.nIter) {
+    if (convergenceControl) wsXY.VPrevIter = wsXY.V;
+    // warm start: the first iteration uses the rotations of the last one
+    // from the previous frame
+    solveARAP(fact->data, lambda, lambdaInv, ops->K, VRest, Beq, wsXY.V,
+              wsXY.sol, RXY, convergenceControl && i == 0, restrictXY, wsXY);
+    if (endIterationXY(i)) break;
+  }
+}
+
+// Decides which components are solved in this frame (see componentSolves):
+// those with CPs that moved since the previous frame and those still
+// moving, all of them if the CPs or VCurr were changed from outside.
+void DefEngARAPL::wakeComponents(const Def3D::CPs &cps, const MatrixXd &VCurr) {
+  const vector<int> &start = ops->compStart;
+  const int nComps = start.size() - 1;
+  const vector<int> &ids = cps.getPtIds();
+  const vector<Vector3d> &pos = cps.getPos();
+  bool all = compMove.size() != nComps || ids != compCPIds ||
+             VPrev.rows() != VCurr.rows() ||
+             VPrev.leftCols(2) != VCurr.leftCols(2);
+  if (all) compMove.assign(nComps, numeric_limits<double>::infinity());
+  compAwake.assign(nComps, all);
+  forlist(i, ids) {
+    if (all || pos[i] == compCPPos[i]) continue;
+    const int c = upper_bound(start.begin(), start.end(), ids[i]) -
+                  start.begin() - 1;
+    compAwake[c] = true;
+  }
+  fora(c, 0, nComps) {
+    if (!(compMove[c] < convergenceTol)) compAwake[c] = true;
+  }
+  compCPIds = ids;
+  compCPPos = pos;
+}
+
+// XY solve of each awake component on its own with the fused local step,
+// the components do not share any vertices or rows of K.
+void DefEngARAPL::solveXYComponents() {
+  const vector<int> &start = ops->compStart;
+  const int nComps = start.size() - 1;
+  const int n = wsXY.V.rows();
+  const bool reuseRotations = convergenceControl && RXY.rows() == 3 * n;
+  if (RXY.rows() != 3 * n) RXY.resize(3 * n, 3);
+  wsXY.B.resize(n, 3);
+  vector<int> iters(nComps, 0);
+  getWorkerPool().parallelFor(nComps, 1, [&](int begin, int end) {
+    const MatrixX3d Y(0, 3);
+    MatrixX3d X, sol;
+    fora(c, begin, end) {
+      if (!compAwake[c]) continue;
+      const int b = start[c], m = start[c + 1] - b;
+      fora(i, 0, frame.nIter) {
+        // warm start: the first iteration uses the rotations of the last one
+        // from the previous frame
+        if (!reuseRotations || i > 0) {
+          fitRotationsFused(wsXY.V, b, b + m, RXY);
+        }
+        computeRhsFused(lambda, lambdaInv, wsXY.V, RXY, b, b + m, wsXY.B);
+        min_quad_with_fixed_solve(*fact->compData[c],
+                                  wsXY.B.middleRows(b, m), Y, VectorXd(), X,
+                                  sol);
+        // mass-weighted displacement of the component
+        double move = 0, mass = 0;
+        fora(k, 0, m) {
+          const double w = massWeights.size() == n ? massWeights(b + k) : 1;
+          move += w * (X.row(k).head(2) - wsXY.V.row(b + k).head(2)).norm();
+          mass += w;
+        }
+        wsXY.V.middleRows(b, m) = X;
+        compMove[c] = mass > 0 ? move / mass : 0;
+        iters[c] = i + 1;
+        if (!convergenceControl) continue;
+        if (compMove[c] < convergenceTol || budgetExceeded()) break;
+      }
+    }
+  });
+  frame.itersXY = *max_element(iters.begin(), iters.end());
+  if (convergenceControl) {
+    frame.convergedXY = *max_element(compMove.begin(), compMove.end()) <
+                        convergenceTol;
+  }
+}
+
+// Active patches of this frame (see localUpdates), all of them if the CPs or
+// VCurr were changed from outside.
+void DefEngARAPL::updateActivePatches(const Def3D::CPs &cps,
+                                      const MatrixXd &VCurr) {
+  const int size = ops->patchSize;
+  const int nPatches = ops->patchNeighbors.size();
+  const vector<int> &ids = cps.getPtIds();
+  const vector<Vector3d> &pos = cps.getPos();
+  const bool all = patchMove.size() != nPatches || ids != localCPIds ||
+                   VPrev.rows() != VCurr.rows() ||
+                   VPrev.leftCols(2) != VCurr.leftCols(2);
+  vector<bool> moving(nPatches, all);
+  if (!all) {
+    forlist(i, ids) {
+      if (pos[i] != localCPPos[i]) moving[ids[i] / size] = true;
+    }
+    fora(p, 0, nPatches) {
+      if (!(patchMove[p] <= convergenceTol)) moving[p] = true;
+    }
+  }
+  patchActive = moving;
+  fora(p, 0, nPatches) {
+    if (!moving[p]) continue;
+    for (int q : ops->patchNeighbors[p]) patchActive[q] = true;
+  }
+  nActivePatches = count(patchActive.begin(), patchActive.end(), true);
+  localCPIds = ids;
+  localCPPos = pos;
+}
+
+// Factorizes the XY system of the free vertices of the active patches if
+// the active patches changed or the system was refactorized. Returns false if it is
+// not positive definite, the whole system is solved then.
+bool DefEngARAPL::prepareLocalSystem() {
+  if (localSystem && localSystem->patchActive == patchActive) {
+    return localSystem->valid;
+  }
+  TRACE_SCOPE("DefEngARAPL::prepareLocalSystem");
+  auto sys = make_shared<LocalSystem>();
+  sys->patchActive = patchActive;
+  const int n = QXY.rows(), size = ops->patchSize;
+  vector<int> &free = sys->free;
+  vector<int> pos(n, -1);
+  fora(i, 0, n) {
+    // the hard constrained vertices are known as well
+    if (!patchActive[i / size] || lambdaInv(i) == 0) continue;
+    pos[i] = free.size();
+    free.push_back(i);
+  }
+  vector<Triplet<double>> freeFree, freeAll;
+  freeFree.reserve(QXY.nonZeros());
+  fora(j, 0, n) {
+    for (SparseMatrix<double>::InnerIterator it(QXY, j); it; ++it) {
+      const int i = it.row();
+      if (pos[i] < 0) continue;
+      if (pos[j] >= 0) {
+        freeFree.emplace_back(pos[i], pos[j], it.value());
+      } else {
+        freeAll.emplace_back(pos[i], j, it.value());
+      }
+    }
   }
+  SparseMatrix<double> QFree(free.size(), free.size());
+  QFree.setFromTriplets(freeFree.begin(), freeFree.end());
+  sys->QFreeAll.resize(free.size(), n);
+  sys->QFreeAll.setFromTriplets(freeAll.begin(), freeAll.end());
+  sys->solver.compute(QFree);
+  sys->valid = !free.empty() && sys->solver.info() == Success;
+  localSystem = sys;
+  return sys->valid;
+}
+
+// XY solve of the free vertices of the active patches, the other vertices
+// keep their positions: Q(free, free) * V(free) = -B(free) - Q(free, known) *
+// V(known). The local step runs on the active patches only, the frozen
+// neighbors keep the rotations of their last solve.
+void DefEngARAPL::solveXYLocal() {
+  const LocalSystem &sys = *localSystem;
+  const int n = wsXY.V.rows(), size = ops->patchSize;
+  vector<int> active;
+  forlist(p, patchActive) {
+    if (patchActive[p]) active.push_back(p);
+  }
+  const bool reuseRotations = convergenceControl && RXY.rows() == 3 * n;
+  if (RXY.rows() != 3 * n) {
+    RXY.resize(3 * n, 3);
+    fitRotationsFused(wsXY.V, 0, n, RXY);
+  }
+  wsXY.B.resize(n, 3);
+  MatrixX3d rhs(sys.free.size(), 3), X;
+  fora(i, 0, frame.nIter) {
+    if (convergenceControl) wsXY.VPrevIter = wsXY.V;
+    // warm start: the first iteration uses the rotations of the last one
+    // from the previous frame
+    if (!reuseRotations || i > 0) {
+      getWorkerPool().parallelFor(active.size(), 1, [&](int begin, int end) {
+        fora(k, begin, end) {
+          const int b = active[k] * size;
+          fitRotationsFused(wsXY.V, b, min(b + size, n), RXY);
+        }
+      });
+    }
+    getWorkerPool().parallelFor(active.size(), 1, [&](int begin, int end) {
+      fora(k, begin, end) {
+        const int b = active[k] * size;
+        computeRhsFused(lambda, lambdaInv, wsXY.V, RXY, b, min(b + size, n),
+                        wsXY.B);
+      }
+    });
+    rhs.noalias() = -sys.QFreeAll * wsXY.V;
+    forlist(k, sys.free) rhs.row(k) -= wsXY.B.row(sys.free[k]);
+    X = sys.solver.solve(rhs);
+    forlist(k, sys.free) wsXY.V.row(sys.free[k]) = X.row(k);
+    if (endIterationXY(i)) break;
+  }
+}
+
+// solve (deformation for Z & relative depths for Z)
+void DefEngARAPL::solveZ(const MatrixXd &VRest) {
+  MatrixX3d &VPrevIter = wsZ.VPrevIter;
+  fora(i, 0, frame.nIter) {
+    if (convergenceControl) VPrevIter = wsZ.V;
+    solveARAPActiveSet(lambda2, lambda2Inv, ops->K, VRest, BeqAll, wsZ.V,
+                       wsZ.sol, RZ, convergenceControl && i == 0, wsZ);
+    frame.itersZ = i + 1;
+    if (!convergenceControl) continue;
+    if (displacement(wsZ, wsZ.V, VPrevIter, 2, 1) < convergenceTol) {
+      frame.convergedZ = true;
+      break;
+    }
+    if (budgetExceeded()) break;
+  }
+}
+
+// Everything of deform after the solves, returns the result of deform.
+double DefEngARAPL::endDeform(Mesh3D &mesh) {
+  MatrixXd &VCurr = mesh.VCurr;
+  converged = frame.convergedXY && frame.convergedZ;
+  stats.iterations = max(frame.itersXY, frame.itersZ);
 
-  VCurr.leftCols(2) = VcurXY.leftCols(2);
+  VCurr.leftCols(2) = wsXY.V.leftCols(2);
   if (solveForZ) {
-    VCurr.col(2) = VcurZ.col(2);
-    sol = solsZ.col(2);
+    VCurr.col(2) = wsZ.V.col(2);
   }
 
   if (solveForZ) {
     // active set
+    const auto sol = wsZ.sol.col(2);
     fora(i, VCurr.rows(), sol.rows()) {
       if (i - VCurr.rows() >= reindex.size())
         break;  // sol contains lagrangian values for both inequalities and
@@ -482,25 +1944,170 @@ double DefEngARAPL::deform(Def3D &def, Mesh3D &mesh) {
       const int id = reindex[i - VCurr.rows()];
       if (sol(i) < igl::DOUBLE_EPS) {
         // deactivate satisfied constraints
-        if (id != -1) asActive.erase(id);
+        if (id != -1) deactivateConstraint(id);
       }
     }
   }
 
-  // temporal smoothing
+  // temporal smoothing, restarted if the number of steps changed since the
+  // precomputation
   if (tempSmoothingSteps > 0) {
-    VPrevsZ.push_front(VCurr.col(2));
-    fora(i, 1, tempSmoothingSteps + 1) { VCurr.col(2) += VPrevsZ[i]; }
-    VCurr.col(2) /= (tempSmoothingSteps + 1);
-    VPrevsZ.pop_back();
+    if (tempZ.rows() != VCurr.rows() ||
+        tempZ.cols() != tempSmoothingSteps + 1) {
+      tempZ = VCurr.col(2).replicate(1, tempSmoothingSteps + 1);
+      tempZSum = tempZ.rowwise().sum();
+      tempZHead = 0;
+    }
+    // replace the oldest state and update the running sum, which is
+    // recomputed once per cycle of the ring buffer against rounding drift
+    tempZSum -= tempZ.col(tempZHead);
+    tempZ.col(tempZHead) = VCurr.col(2);
+    tempZSum += tempZ.col(tempZHead);
+    tempZHead = (tempZHead + 1) % tempZ.cols();
+    if (tempZHead == 0) tempZSum = tempZ.rowwise().sum();
+    VCurr.col(2) = tempZSum / tempZ.cols();
   }
 
   // compute difference to the last mesh state
   double diff = numeric_limits<double>::infinity();
-  if (VPrev.size() == VCurr.size() && M.rows() == VCurr.rows()) {
-    diff = (M * (VCurr - VPrev).rowwise().norm()).sum() / M.sum();
+  if (VPrev.size() == VCurr.size() && massWeights.size() == VCurr.rows()) {
+    wsXY.dist = (VCurr - VPrev).rowwise().norm();
+    diff = massWeights.dot(wsXY.dist) / massSum;
+  }
+  // largest displacement in each patch for the next frame (localUpdates)
+  const int size = ops->patchSize;
+  if (localUpdates && size > 0 && VPrev.rows() == VCurr.rows()) {
+    patchMove.assign(ops->patchNeighbors.size(), 0);
+    fora(i, 0, VCurr.rows()) {
+      const double d = (VCurr.row(i).head(2) - VPrev.row(i).head(2)).norm();
+      patchMove[i / size] = max(patchMove[i / size], d);
+    }
+  } else {
+    patchMove.clear();
   }
   VPrev = VCurr;
 
   return diff;
 }
+
+double DefEngARAPL::deformImpl(Def3D &def, Mesh3D &mesh) {
+  TRACE_SCOPE("DefEngARAPL::deform");
+  double diff;
+  if (!beginDeform(def, mesh, diff)) return diff;
+
+  const MatrixXd &VRest = mesh.VRest;
+  if (parallelSolves && solveForZ) {
+    // both solves only read the shared state, run them concurrently
+    getWorkerPool().run([&]() { solveZ(VRest); });
+    solveXY(VRest);
+    getWorkerPool().wait();
+  } else {
+    solveXY(VRest);
+    if (solveForZ) solveZ(VRest);
+  }
+
+  return endDeform(mesh);
+}
+
+vector<double> DefEngARAPL::deformInstances(const vector<DefEngARAPL *> &engs,
+                                            const vector<Def3D *> &defs,
+                                            const vector<Mesh3D *> &meshes) {
+  const int k = engs.size();
+  vector<double> diffs(k, numeric_limits<double>::infinity());
+  if (k == 0 || defs.size() != k || meshes.size() != k) return diffs;
+  const auto tStart = chrono::high_resolution_clock::now();
+
+  vector<DefEngARAPL *> active;
+  vector<int> activeIds;
+  fora(j, 0, k) {
+    engs[j]->stats.iterations = 0;
+    if (engs[j]->beginDeform(*defs[j], *meshes[j], diffs[j])) {
+      active.push_back(engs[j]);
+      activeIds.push_back(j);
+    }
+  }
+
+  // Z solves depend on the active sets of the instances, run them on the
+  // worker pool while the XY solves are batched
+  WorkerPool &pool = engs[0]->getWorkerPool();
+  const bool parallelZ = engs[0]->parallelSolves;
+  forlist(j, active) {
+    DefEngARAPL *e = active[j];
+    if (!e->solveForZ) continue;
+    const MatrixXd &VRest = meshes[activeIds[j]]->VRest;
+    if (parallelZ) {
+      pool.run([e, &VRest]() { e->solveZ(VRest); });
+    } else {
+      e->solveZ(VRest);
+    }
+  }
+
+  // groups of instances sharing an XY factorization, the two-level solve is
+  // done per instance
+  map<Factorization *, vector<int>> groups;
+  forlist(j, active) {
+    DefEngARAPL *e = active[j];
+    if (e->twoLevelActive() || e->fact->XYComponents || e->frame.localXY) {
+      e->solveXY(meshes[activeIds[j]]->VRest);
+    } else {
+      groups[e->fact.get()].push_back(j);
+    }
+  }
+  MatrixXd B, X, sol;
+  for (const auto &g : groups) {
+    vector<int> ids = g.second;
+    fora(i, 0, INT_MAX) {
+      if (ids.empty()) break;
+      // stack the right hand sides of the instances still iterating
+      const int n = active[ids[0]]->wsXY.V.rows();
+      const int cols = active[ids[0]]->wsXY.V.cols();
+      B.resize(n, cols * ids.size());
+      forlist(c, ids) {
+        DefEngARAPL *e = active[ids[c]];
+        SolveWorkspace &w = e->wsXY;
+        if (e->convergenceControl) w.VPrevIter = w.V;
+        e->computeRhs(e->lambda, e->lambdaInv, e->ops->K,
+                      meshes[activeIds[ids[c]]]->VRest, w.V, e->RXY,
+                      e->convergenceControl && i == 0, w);
+        B.middleCols(c * cols, cols) = w.B;
+      }
+      const Factorization &f = *g.first;
+      if (f.XYIterative) {
+        // warm start from the current solutions
+        X.resize(n, B.cols());
+        forlist(c, ids) X.middleCols(c * cols, cols) = active[ids[c]]->wsXY.V;
+      }
+      if (f.XYSupernodal || f.XYIterative) {
+        active[ids[0]]->solveXYSplit(f, B, X);
+        sol = X;
+      } else {
+        const MatrixXd Y(0, B.cols());
+        min_quad_with_fixed_solve(g.first->data, B, Y, active[ids[0]]->Beq,
+                                  X, sol);
+      }
+      vector<int> next;
+      forlist(c, ids) {
+        DefEngARAPL *e = active[ids[c]];
+        e->wsXY.V = X.middleCols(c * cols, cols);
+        e->wsXY.sol = sol.middleCols(c * cols, cols);
+        if (!e->endIterationXY(i)) next.push_back(ids[c]);
+      }
+      ids.swap(next);
+    }
+  }
+  if (parallelZ) pool.wait();
+
+  forlist(j, active) {
+    diffs[activeIds[j]] = active[j]->endDeform(*meshes[activeIds[j]]);
+  }
+
+  // the same statistics as from deform, with the time of the whole batch
+  const chrono::duration<double, milli> t =
+      chrono::high_resolution_clock::now() - tStart;
+  fora(j, 0, k) {
+    engs[j]->stats.frames++;
+    engs[j]->stats.deformMs = t.count();
+    engs[j]->stats.deformMsTotal += t.count();
+  }
+  return diffs;
+}
@@ -17,6 +17,7 @@
 
 // clang-format off
 #include <Eigen/Core>
+#include <Eigen/Dense>
 #include <Eigen/src/SparseCore/SparseSolverBase-mod.h>
 #include <Eigen/Sparse>
 #include <Eigen/src/OrderingMethods/Amd-mod.h>
@@ -28,29 +29,128 @@
 #include <miscutils/mesh3d.h>
 // clang-format on
 
-#include <deque>
-#include <unordered_map>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
 
-class DefEngARAPL {
+#include "defeng.h"
+#include "supernodalllt.h"
+#include "workerpool.h"
+
+class DefEngARAPL : public DefEng {
  public:
   DefEngARAPL();
   virtual ~DefEngARAPL();
-  virtual double deform(Def3D &def, Mesh3D &mesh);
-  virtual void precompute(const Def3D &def, Mesh3D &mesh);
+  std::string name() const override;
+  int capabilities() const override;
+  // Copy of the engine (an instance) sharing the operators (K, CSM) and the
+  // factorizations read-only, everything else is per instance. When the CP
+  // vertices or armpit equalities of an instance change, it adopts the
+  // factorizations of another instance with the same ones or computes its
+  // own, i.e. instances animated with the same CP set keep sharing them.
+  std::shared_ptr<DefEngARAPL> createInstance();
+  // Deforms several instances at once, the same as calling deform for each.
+  // The XY global steps of instances sharing a factorization are done in a
+  // single multi-RHS solve per iteration.
+  static std::vector<double> deformInstances(
+      const std::vector<DefEngARAPL *> &engs, const std::vector<Def3D *> &defs,
+      const std::vector<Mesh3D *> &meshes);
+
+ protected:
+  double deformImpl(Def3D &def, Mesh3D &mesh) override;
+  void precomputeImpl(const Def3D &def, Mesh3D &mesh) override;
 
  private:
   bool checkData(const Mesh3D &mesh);
   static bool checkData(const Eigen::MatrixXd &VCurr,
                         const Eigen::MatrixXd &VRest, const Eigen::MatrixXi &F);
   void prepare(const Eigen::MatrixXd &V, const Eigen::MatrixXi &F);
+  struct Factorization;
+  bool factorizationValid(const Factorization &f) const;
+  void factorize(bool equalitiesOnly);
+  bool beginDeform(Def3D &def, Mesh3D &mesh, double &diff);
+  double endDeform(Mesh3D &mesh);
+  struct SolveWorkspace;
+  double displacement(SolveWorkspace &w, const Eigen::MatrixX3d &V1,
+                      const Eigen::MatrixX3d &V2, int col, int nCols) const;
+  bool budgetExceeded() const;
+  bool endIterationXY(int i);
+  void solveXY(const Eigen::MatrixXd &VRest);
+  void wakeComponents(const Def3D::CPs &cps, const Eigen::MatrixXd &VCurr);
+  void solveXYComponents();
+  void updateActivePatches(const Def3D::CPs &cps,
+                           const Eigen::MatrixXd &VCurr);
+  bool prepareLocalSystem();
+  void solveXYLocal();
+  void solveZ(const Eigen::MatrixXd &VRest);
   void solveARAP(igl::min_quad_with_fixed_data<double> &data,
-                 const Eigen::SparseMatrix<double> &lambda,
-                 const Eigen::SparseMatrix<double> &lambdaInv,
+                 const Eigen::VectorXd &lambda,
+                 const Eigen::VectorXd &lambdaInv,
                  const Eigen::SparseMatrix<double> &K,
                  const Eigen::MatrixXd &VRest, const Eigen::VectorXd &Beq,
-                 Eigen::MatrixXd &VCurr, Eigen::MatrixXd &sol);
+                 Eigen::MatrixX3d &VCurr, Eigen::MatrixX3d &sol,
+                 Eigen::MatrixX3d &R, bool reuseRotations,
+                 const Eigen::SparseMatrix<double> &restriction,
+                 SolveWorkspace &w);
+  void solveARAPActiveSet(const Eigen::VectorXd &lambda,
+                          const Eigen::VectorXd &lambdaInv,
+                          const Eigen::SparseMatrix<double> &K,
+                          const Eigen::MatrixXd &VRest,
+                          const Eigen::VectorXd &Beq, Eigen::MatrixX3d &VCurr,
+                          Eigen::MatrixX3d &sol, Eigen::MatrixX3d &R,
+                          bool reuseRotations, SolveWorkspace &w);
+  void solvePGS(const Eigen::MatrixX3d &r);
+  void computeRhs(const Eigen::VectorXd &lambda,
+                  const Eigen::VectorXd &lambdaInv,
+                  const Eigen::SparseMatrix<double> &K,
+                  const Eigen::MatrixXd &VRest, const Eigen::MatrixX3d &VCurr,
+                  Eigen::MatrixX3d &R, bool reuseRotations,
+                  SolveWorkspace &w);
+  void fitRotationsFused(const Eigen::MatrixX3d &VCurr, int begin, int end,
+                         Eigen::MatrixX3d &R) const;
+  void computeRhsFused(const Eigen::VectorXd &lambda,
+                       const Eigen::VectorXd &lambdaInv,
+                       const Eigen::MatrixX3d &VCurr,
+                       const Eigen::MatrixX3d &R, int begin, int end,
+                       Eigen::MatrixX3d &B) const;
+  struct FaceGrid;
+  void buildFaceGrids(const Eigen::MatrixXd &V, const Eigen::MatrixXi &F,
+                      const std::vector<int> &verticesToParts, int nParts);
+  int findFace(const FaceGrid &g, const Eigen::MatrixXd &V,
+               const Eigen::MatrixXi &F, int x, int y) const;
+  WorkerPool &getWorkerPool();
+  void activateConstraint(int bndId, int corrId);
+  void deactivateConstraint(int bndId);
   void prepareActiveSetEqs(const Eigen::MatrixXd &VCurr,
                            const Eigen::MatrixXi &FCurr);
+  void updateActiveSetSolver();
+  void updateQ(const Eigen::VectorXd &lambda, const Eigen::VectorXd &lambdaInv,
+               const std::vector<int> *rows,
+               Eigen::SparseMatrix<double> &Q) const;
+  void updateLambdas(const Def3D::CPs &cps, int n);
+  void prepareTwoLevel(const Eigen::MatrixXd &V, const Eigen::MatrixXi &F,
+                       const std::vector<int> &fixedNodes);
+  bool twoLevelActive() const;
+  Eigen::SparseMatrix<double> restrictionOp(
+      const Eigen::VectorXd &lambdaInv) const;
+  Eigen::SparseMatrix<double> reduce(
+      const Eigen::SparseMatrix<double> &Q,
+      const Eigen::SparseMatrix<double> &restriction) const;
+  Eigen::SparseMatrix<double> reduceEq(
+      const Eigen::SparseMatrix<double> &A) const;
+  // for the Z system (3 columns) and for the columns of W
+  template <typename MatrixB, typename MatrixX>
+  void solveQ2(const MatrixB &B, MatrixX &X, SolveWorkspace &w) const;
+  void factorizeXYSplit(Factorization &f) const;
+  template <typename MatrixB, typename MatrixX>
+  void solveXYSplit(const Factorization &f, const MatrixB &B,
+                    MatrixX &X) const;
+  template <typename MatrixB, typename MatrixX>
+  void solvePCG(const Eigen::SparseMatrix<double> &A,
+                const Eigen::VectorXd &invDiag, const MatrixB &B,
+                MatrixX &X) const;
 
  public:
   std::vector<std::tuple<int, int, int>> ineqRegionConds;
@@ -64,21 +164,251 @@ class DefEngARAPL {
   bool armpitsStitchingInJointOptimization = false;
   bool interiorDepthConditions = false;
   bool solveForZ = true;
+  bool parallelSolves = false;  // run XY and Z solves on separate threads
+  // search for the faces under boundary vertices in prepareActiveSetEqs on
+  // all threads of the worker pool
+  bool parallelCorrespondences = false;
+  // Convergence controlled iterations (instead of maxIter iterations):
+  // iterate until the mass-weighted displacement of an iteration is below
+  // convergenceTol, at most convergenceMaxIter times and not longer than
+  // iterTimeBudgetMs (0 for no limit). Deformation is skipped completely when
+  // the previous frame converged and CPs did not move.
+  bool convergenceControl = false;
+  double convergenceTol = 1e-3;
+  int convergenceMaxIter = 16;
+  double iterTimeBudgetMs = 8;
+  // Two-level solve for large meshes: ARAP is solved in the subspace spanned
+  // by about n/twoLevelCoarsening coarse nodes (all CP vertices included) and
+  // prolongated to the full mesh. Used only for meshes with at least
+  // twoLevelMinVertices vertices.
+  bool twoLevel = false;
+  int twoLevelCoarsening = 6;
+  int twoLevelMinVertices = 3000;
+  // store K and CSM in single precision and evaluate the products of the
+  // local step (rotation fitting and right hand side) in float
+  bool singlePrecision = false;
+  // evaluate the local step (rotation fitting and right hand side) per vertex
+  // in chunks on the worker pool, in double precision (singlePrecision is
+  // then ignored)
+  bool parallelLocalStep = false;
+  // factorize Q2 and, when it has no equalities, the XY system with the
+  // supernodal Cholesky (SupernodalLLT) instead of SimplicialLDLT and LU,
+  // faster for large meshes
+  bool supernodal = false;
+  // solve the same systems as supernodal with Jacobi preconditioned
+  // conjugate gradients warm started from the previous solution instead of
+  // factorizing them, i.e. without fill-in (memory O(nnz)) but only up to a
+  // relative residual of cgTol, at most cgMaxIter iterations and (with
+  // convergenceControl) within iterTimeBudgetMs. Takes precedence over
+  // supernodal.
+  bool iterative = false;
+  double cgTol = 1e-6;
+  int cgMaxIter = 1000;
+  // Solve the XY system of each connected component of the mesh on its own,
+  // in parallel on the worker pool, if the components are contiguous ranges
+  // of vertices (as in the reconstruction) and neither equalities nor the
+  // two-level solve couple them. A component sleeps, i.e. keeps its
+  // positions, while none of its CPs moves and its last iteration moved it
+  // by less than convergenceTol. Takes precedence over supernodal and
+  // iterative for the XY system.
+  bool componentSolves = false;
+  // Re-solve only the neighborhood of the moving parts in XY. The vertices
+  // are grouped into patches of localPatchSize consecutive indices (compact
+  // after the reordering of the reconstruction). A patch is active if one of
+  // its CPs moved or one of its vertices moved by more than convergenceTol
+  // in the previous frame, and so are its neighbors. The vertices of the
+  // other patches keep their positions and are Dirichlet constraints of the
+  // solve of the active ones.
+  bool localUpdates = false;
+  int localPatchSize = 256;
+  // Solve the depth inequalities of the Z solve by projected Gauss-Seidel on
+  // the Schur complement instead of as equalities: their multipliers are
+  // clamped to be non-negative, so a constraint pulling the wrong way is
+  // released within the solve rather than in the next frame, and the Schur
+  // complement is never factorized when the active set changes. Sweeps until
+  // the constraint values change by less than pgsTol, at most pgsMaxSweeps,
+  // starting from the multipliers of the last solve. Used only when Q2 is
+  // factorized on its own (not with the whole KKT system).
+  bool pgsDepth = false;
+  int pgsMaxSweeps = 100;
+  double pgsTol = 1e-6;
   double rigidity;
   Eigen::SparseMatrix<double> L, M, Minv;
 
  private:
   long prevCpsChanged = -1;
-  Eigen::SparseMatrix<double> lambda, lambdaInv, lambda2, lambda2Inv;
-  Eigen::MatrixXd VPrev;
-  igl::min_quad_with_fixed_data<double> data, dataQP;
-  Eigen::SparseMatrix<double> K, CSM;
-  Eigen::SparseMatrix<double> Aeq, Aieq, AeqAll, I;
-  Eigen::VectorXd Beq, Bieq, BeqAll;
-  std::unordered_map<int, int> asActive;
+  // diagonals of the constraint weights, QXY and QZ are the XY and Z system
+  // matrices on the pattern of L + I (LI), updated in place row by row
+  Eigen::VectorXd lambda, lambdaInv, lambda2, lambda2Inv;
+  std::vector<int> lambdaCPs;
+  std::tuple<int, double, bool, bool> lambdaParams;
+  Eigen::SparseMatrix<double> LI, QXY, QZ;
+  int LINonZeros = -1;
+  std::vector<int> LIRowStart, LIRowPos, LIDiagPos;
+  Eigen::MatrixX3d VPrev;
+  Eigen::MatrixX3d RXY, RZ;  // rotations from the last local step
+  bool converged = false;
+  std::vector<Eigen::Vector3d> cpsPosPrev;
+  // KKT system of the Z solve if Q2 could not be factorized
+  std::shared_ptr<igl::min_quad_with_fixed_data<double>> dataQP;
+  // operators of the rest mesh, shared by the instances
+  struct Operators {
+    int n = 0;
+    Eigen::SparseMatrix<double> K, CSM;
+    Eigen::SparseMatrix<float> Kf, CSMf;  // used instead of K, CSM if
+                                          // singlePrecision is set
+    // K0, K1 and K0, K1, K2 (K = [K0 K1 K2]) used if parallelLocalStep is set
+    std::vector<Eigen::SparseMatrix<double>> KBlocks;
+    std::vector<Eigen::SparseMatrix<double, Eigen::RowMajor>> KBlocksRowMajor;
+    // first vertex of each connected component followed by n, empty unless
+    // there are several components and they are ranges of vertices
+    std::vector<int> compStart;
+    // localUpdates: size of the patches (0 if not built) and the patches
+    // adjacent to each patch
+    int patchSize = 0;
+    std::vector<std::vector<int>> patchNeighbors;
+  };
+  std::shared_ptr<Operators> ops;
+  Eigen::SparseMatrix<double> Aeq, AeqAll, I;
+  Eigen::VectorXd Beq, BeqAll;
+  // the armpit correspondences Aeq was built from
+  std::vector<std::tuple<int, int, int>> AeqCorrs;
+  bool AeqChanged = false;
+  // active set: the corresponding vertex of each boundary vertex with an
+  // active constraint (-1 if inactive), the list of active boundary vertices
+  // and their positions in it
+  std::vector<int> asActive, asActiveList, asActivePos;
+  std::vector<bool> asKept;
   std::vector<int> reindex;
-  Eigen::MatrixXd VCurrActiveSet;
-  std::deque<Eigen::MatrixXd> VPrevsZ;
+
+  // uniform grid of faces for each part, used for finding the face under a
+  // vertex in prepareActiveSetEqs
+  struct FaceGrid {
+    int cellSize = 1;
+    int x0 = 0, y0 = 0, nx = 0, ny = 0;
+    std::vector<int> cellStart, cellFill, cellFaces;
+  };
+  std::vector<FaceGrid> faceGrids;
+  std::vector<Eigen::Vector4i> faceBBoxes;
+
+  // XY system and Q2 of the Z solve, shared by the instances. Q2 is
+  // factorized only when CPs change, the rows of AeqAll are handled through
+  // the Schur complement of the KKT system.
+  struct Factorization {
+    igl::min_quad_with_fixed_data<double> data;
+    Eigen::SparseMatrix<double> Q2;
+    bool Q2Factorized = false;
+    Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>> Q2Solver;
+    bool Q2Supernodal = false;  // Q2SupernodalSolver used instead of Q2Solver
+    SupernodalLLT Q2SupernodalSolver;
+    // Q2 solved by solvePCG (inverse of its diagonal) instead
+    bool Q2Iterative = false;
+    Eigen::VectorXd Q2InvDiag;
+    // XY system split into the free vertices and the hard constrained ones
+    // (identity rows), used instead of data if XYSupernodal or XYIterative is
+    // set: Q(free, free) is factorized by XYSolver or solved by solvePCG
+    bool XYSupernodal = false, XYIterative = false;
+    SupernodalLLT XYSolver;
+    std::vector<int> XYFree, XYFixed;
+    Eigen::SparseMatrix<double> XYFreeFree, XYFreeFixed;
+    Eigen::VectorXd XYInvDiag;
+    // XY system of each connected component used instead of data if
+    // XYComponents is set (see componentSolves)
+    bool XYComponents = false;
+    std::vector<std::unique_ptr<igl::min_quad_with_fixed_data<double>>>
+        compData;
+    // what data and Q2 were computed for
+    std::vector<int> cps;
+    std::tuple<int, double, bool, bool> params;
+    Eigen::SparseMatrix<double> Aeq;
+    bool twoLevel = false;
+    bool supernodal = false, iterative = false, components = false;
+  };
+  std::shared_ptr<Factorization> fact;
+  // factorizations of all instances of the engine, set by createInstance
+  struct FactorizationCache {
+    std::mutex mutex;
+    std::vector<std::weak_ptr<Factorization>> facts;
+  };
+  std::shared_ptr<FactorizationCache> factCache;
+  std::vector<std::tuple<int, int, int>> AeqAllRows, AeqAllRowsPrev;
+  bool activeSetSolverValid = false;
+  bool activeSetSolverPGS = false;  // built for pgsDepth
+  Eigen::MatrixXd W;  // Q2^-1 * AeqAll^T
+  Eigen::PartialPivLU<Eigen::MatrixXd> SSolver;
+  // pgsDepth: the Schur complement and the multipliers of the rows of
+  // AeqAllRows from the last solve
+  Eigen::MatrixXd S;
+  Eigen::MatrixX3d pgsMu;
+  // ring buffer of the last tempSmoothingSteps + 1 Z columns and their sum
+  Eigen::MatrixXd tempZ;
+  Eigen::VectorXd tempZSum;
+  int tempZHead = 0;
+  std::shared_ptr<WorkerPool> workerPool;
+
+  // two-level solve: fine vertices = prolong * coarse nodes, the systems are
+  // reduced to restriction * Q * prolong
+  std::vector<int> twoLevelGridNodes, twoLevelNodes;
+  double twoLevelSpacing = 0;
+  Eigen::SparseMatrix<double> prolong, restrictXY, restrictZ;
+
+  // Scratch buffers reused between frames, so that deform does not allocate
+  // once the sizes settle. There is one for each of the XY and Z solves since
+  // they may run concurrently. The per-vertex data has its 3 columns fixed at
+  // compile time, so that Eigen unrolls the work on the rows. The coarse
+  // buffers are also used for the columns of W (see solveQ2).
+  struct SolveWorkspace {
+    Eigen::MatrixX3d V, sol, VPrevIter;
+    Eigen::MatrixX3d VRep, S, KR, B, r;
+    Eigen::MatrixXd BCoarse, VCoarse, solCoarse;
+    Eigen::MatrixX3f Vf, Sf, Rf, KRf;
+    Eigen::VectorXd dist;
+  };
+  SolveWorkspace wsXY, wsZ;
+  // state of the current deform call shared by its solves
+  struct FrameState {
+    std::chrono::high_resolution_clock::time_point start;
+    int nIter = 0, itersXY = 0, itersZ = 0;
+    bool convergedXY = false, convergedZ = false;
+    bool localXY = false;  // only the active patches are solved
+  } frame;
+  struct ActiveSetWorkspace {
+    std::vector<std::tuple<int, int, int>> ineqCorrs;
+    std::vector<bool> isBnd, isMergeBnd, used;
+    std::vector<int> verticesToParts;
+    std::vector<Eigen::Vector4i> partBBoxes;
+    std::vector<std::vector<int>> pairFaces;  // face under each boundary
+                                              // vertex of each region pair
+  } wsActiveSet;
+  Eigen::VectorXd massWeights;  // column sums of M
+  double massSum = 0;
+  // componentSolves: per component the mass-weighted displacement of its
+  // last XY iteration and whether it is solved in the current frame, the
+  // CPs of the previous frame
+  std::vector<double> compMove;
+  std::vector<bool> compAwake;
+  std::vector<int> compCPIds;
+  std::vector<Eigen::Vector3d> compCPPos;
+  // localUpdates: largest displacement in each patch in the last frame, the
+  // active patches and the CPs of the previous frame
+  std::vector<double> patchMove;
+  std::vector<bool> patchActive;
+  int nActivePatches = 0;
+  std::vector<int> localCPIds;
+  std::vector<Eigen::Vector3d> localCPPos;
+  // the XY system of the free vertices of the active patches, the others
+  // are known: Q(free, free) factorized by solver and Q(free, known) as the
+  // columns of QFreeAll. Replaced, never modified, when the active patches
+  // change, since copies of the engine may share it, and dropped by
+  // factorize().
+  struct LocalSystem {
+    std::vector<bool> patchActive;
+    std::vector<int> free;
+    Eigen::SparseMatrix<double> QFreeAll;
+    Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>> solver;
+    bool valid = false;
+  };
+  std::shared_ptr<const LocalSystem> localSystem;
 };
 
 #endif  // DEFENGARAPL_H
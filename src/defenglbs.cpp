@@ -0,0 +1,170 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "defenglbs.h"
+
+#include <igl/cotmatrix.h>
+#include <igl/harmonic.h>
+#include <igl/massmatrix.h>
+#include <igl/vertex_components.h>
+
+#include <cmath>
+#include <limits>
+#include <map>
+
+#include "macros.h"
+
+using namespace Eigen;
+using namespace igl;
+using namespace std;
+
+DefEngLBS::DefEngLBS(bool biharmonicWeights)
+    : biharmonicWeights(biharmonicWeights) {}
+
+string DefEngLBS::name() const { return "lbs"; }
+
+int DefEngLBS::capabilities() const { return 0; }
+
+const vector<int> &DefEngLBS::getCPVertices() const { return cpVertices; }
+
+const MatrixXd &DefEngLBS::getWeights() const { return weights; }
+
+void DefEngLBS::addTranslations(const vector<Vector3d> &translations,
+                                MatrixXd &V) {
+  T.setZero(cpVertices.size(), 3);
+  forlist(k, cpColumns) {
+    const int col = cpColumns[k];
+    if (col == -1 || k >= translations.size()) continue;
+    T.row(col) += translations[k].transpose() / cpCounts[col];
+  }
+  if (T.rows() > 0) V.noalias() += weights * T;
+}
+
+void DefEngLBS::inverseDistanceWeights(const MatrixXd &VRest, int i) {
+  const int m = cpVertices.size();
+  fora(j, 0, m) {
+    if (cpVertices[j] == i) {
+      // the vertex follows its CP exactly
+      weights.row(i).setZero();
+      weights(i, j) = 1;
+      return;
+    }
+    const double d = (VRest.row(i) - VRest.row(cpVertices[j])).norm();
+    weights(i, j) = d > 0 ? 1.0 / pow(d, weightExponent) : 0;
+  }
+  const double sum = weights.row(i).sum();
+  if (sum > 0) weights.row(i) /= sum;
+}
+
+bool DefEngLBS::computeBiharmonicWeights(const MatrixXd &VRest,
+                                         const MatrixXi &F) {
+  const int n = VRest.rows(), m = cpVertices.size();
+  if (F.rows() == 0) return false;
+  if (L.rows() != n) {
+    cotmatrix(VRest, F, L);
+    massmatrix(VRest, F, MASSMATRIX_TYPE_VORONOI, M);
+    vertex_components(F, components);
+  }
+
+  // Known values: the CP vertices and all vertices of parts without a CP,
+  // which would make the system singular. These get inverse distance
+  // weights.
+  vector<bool> hasCP(n, false);
+  for (const int v : cpVertices) {
+    if (v < components.size()) hasCP[components(v)] = true;
+  }
+  auto isFree = [&](int i) {
+    return i < components.size() && hasCP[components(i)];
+  };
+  vector<int> known(cpVertices);
+  vector<bool> isCP(n, false);
+  for (const int v : cpVertices) isCP[v] = true;
+  fora(i, 0, n) {
+    if (!isCP[i] && !isFree(i)) known.push_back(i);
+  }
+  VectorXi b(known.size());
+  MatrixXd bc = MatrixXd::Zero(known.size(), m);
+  forlist(k, known) b(k) = known[k];
+  fora(j, 0, m) bc(j, j) = 1;
+  if (!harmonic(L, M, b, bc, 2, weights)) return false;
+  fora(i, 0, n) {
+    if (!isFree(i)) inverseDistanceWeights(VRest, i);
+  }
+  return true;
+}
+
+void DefEngLBS::precomputeImpl(const Def3D &def, Mesh3D &mesh) {
+  const MatrixXd &VRest = mesh.VRest;
+  const int n = VRest.rows();
+  prevCpsChanged = def.getCp2ptChangedNum();
+
+  // one column for each distinct CP vertex
+  map<int, int> columns;
+  cpVertices.clear();
+  cpColumns.clear();
+  cpCounts.clear();
+  for (const auto &it : def.getCPs()) {
+    const int ptId = it.second.ptId;
+    if (ptId < 0 || ptId >= n) {
+      cpColumns.push_back(-1);
+      continue;
+    }
+    auto col = columns.find(ptId);
+    if (col == columns.end()) {
+      col = columns.insert(make_pair(ptId, cpVertices.size())).first;
+      cpVertices.push_back(ptId);
+      cpCounts.push_back(0);
+    }
+    cpColumns.push_back(col->second);
+    cpCounts[col->second]++;
+  }
+  const int m = cpVertices.size();
+  weights.resize(n, m);
+  if (m == 0) return;
+
+  if (biharmonicWeights && computeBiharmonicWeights(VRest, mesh.F)) return;
+  fora(i, 0, n) inverseDistanceWeights(VRest, i);
+}
+
+double DefEngLBS::deformImpl(Def3D &def, Mesh3D &mesh) {
+  const MatrixXd &VRest = mesh.VRest;
+  MatrixXd &VCurr = mesh.VCurr;
+  if (VRest.rows() == 0) return numeric_limits<double>::infinity();
+  if (def.getCp2ptChangedNum() != prevCpsChanged ||
+      weights.rows() != VRest.rows()) {
+    precompute(def, mesh);
+  }
+
+  // translations of the CPs from the rest pose, averaged over CPs sharing
+  // a vertex
+  T.setZero(cpVertices.size(), 3);
+  int k = 0;
+  for (const auto &it : def.getCPs()) {
+    const int col = cpColumns[k++];
+    if (col == -1) continue;
+    T.row(col) +=
+        (it.second.pos.transpose() - VRest.row(cpVertices[col])) /
+        cpCounts[col];
+  }
+
+  VCurr = VRest;
+  if (T.rows() > 0) VCurr.noalias() += weights * T;
+
+  double diff = numeric_limits<double>::infinity();
+  if (VPrev.size() == VCurr.size()) {
+    diff = (VCurr - VPrev).rowwise().norm().mean();
+  }
+  VPrev = VCurr;
+  return diff;
+}
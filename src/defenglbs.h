@@ -0,0 +1,79 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DEFENGLBS_H
+#define DEFENGLBS_H
+
+// clang-format off
+#include <Eigen/Core>
+#include <Eigen/Dense>
+#include <Eigen/src/SparseCore/SparseSolverBase-mod.h>
+#include <Eigen/Sparse>
+#include <Eigen/src/OrderingMethods/Amd-mod.h>
+#include <Eigen/src/OrderingMethods/Ordering-mod.h>
+#include <Eigen/src/SparseCholesky/SimplicialCholesky.h>
+#include <Eigen/src/SparseCholesky/SimplicialCholesky_impl-mod.h>
+// clang-format on
+
+#include <vector>
+
+#include "defeng.h"
+
+// Linear blend of the CP translations with precomputed per vertex weights,
+// i.e. a single matrix product per frame. The weights are computed when the
+// set of CPs changes, either as normalized inverse distances in the rest
+// pose or as biharmonic weights (smooth along the surface, one solve per
+// CP set). There is no rotation fitting and no depth ordering, so it is much
+// cheaper than ARAP. Used for the playback of recorded animations and as a
+// baseline for comparing engines.
+class DefEngLBS : public DefEng {
+ public:
+  explicit DefEngLBS(bool biharmonicWeights = false);
+  std::string name() const override;
+  int capabilities() const override;
+
+  bool biharmonicWeights = false;
+  double weightExponent = 2;  // inverse distance weight ~ 1 / d^weightExponent
+
+  // set by precompute(): the distinct mesh vertices of the CPs and the
+  // weights of all vertices (one column per CP vertex)
+  const std::vector<int> &getCPVertices() const;
+  const Eigen::MatrixXd &getWeights() const;
+  // Adds the blend of the translations of the CPs, given in the order of
+  // Def3D::CPs, to V. Uses the weights of the last precompute().
+  void addTranslations(const std::vector<Eigen::Vector3d> &translations,
+                       Eigen::MatrixXd &V);
+
+ protected:
+  double deformImpl(Def3D &def, Mesh3D &mesh) override;
+  void precomputeImpl(const Def3D &def, Mesh3D &mesh) override;
+
+ private:
+  void inverseDistanceWeights(const Eigen::MatrixXd &VRest, int i);
+  bool computeBiharmonicWeights(const Eigen::MatrixXd &VRest,
+                                const Eigen::MatrixXi &F);
+
+  long prevCpsChanged = -1;
+  std::vector<int> cpVertices;  // distinct mesh vertices of the CPs
+  std::vector<int> cpColumns;   // column of weights for each CP
+  std::vector<int> cpCounts;    // number of CPs of each column
+  Eigen::MatrixXd weights;      // vertices x cpVertices, rows sum up to 1
+  Eigen::MatrixXd T;            // translations of cpVertices
+  Eigen::MatrixXd VPrev;
+  // operators of the rest mesh for the biharmonic weights
+  Eigen::SparseMatrix<double> L, M;
+  Eigen::VectorXi components;
+};
+
+#endif  // DEFENGLBS_H
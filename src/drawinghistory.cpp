@@ -0,0 +1,115 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "drawinghistory.h"
+
+#include <algorithm>
+
+#include "macros.h"
+
+using namespace std;
+
+DrawingHistory::DrawingHistory(int maxSteps) : maxSteps(maxSteps) {}
+
+void DrawingHistory::begin(const ImgData &imgData) {
+  outlinesBefore = imgData.outlineImgs;
+  regionsBefore = imgData.regionImgs;
+  layersBefore = imgData.layers;
+  begun = true;
+}
+
+bool DrawingHistory::commit(const ImgData &imgData) {
+  if (!begun) return false;
+  begun = false;
+
+  Step step;
+  step.nRegionsBefore = regionsBefore.size();
+  step.nRegionsAfter = imgData.regionImgs.size();
+  const int n = max(step.nRegionsBefore, step.nRegionsAfter);
+  fora(regId, 0, n) {
+    Change change;
+    change.regId = regId;
+    if (regId < step.nRegionsBefore) {
+      change.outlineBefore = outlinesBefore[regId];
+      change.regionBefore = regionsBefore[regId];
+    }
+    if (regId < step.nRegionsAfter) {
+      change.outlineAfter = imgData.outlineImgs[regId];
+      change.regionAfter = imgData.regionImgs[regId];
+    }
+    if (!change.outlineBefore.sameTiles(change.outlineAfter) ||
+        !change.regionBefore.sameTiles(change.regionAfter)) {
+      step.changes.push_back(std::move(change));
+    }
+  }
+  outlinesBefore.clear();
+  regionsBefore.clear();
+  step.layersBefore.swap(layersBefore);
+  step.layersAfter = imgData.layers;
+  if (step.changes.empty() && step.nRegionsBefore == step.nRegionsAfter &&
+      step.layersBefore == step.layersAfter) {
+    return false;
+  }
+
+  // a new edit drops the undone steps
+  steps.resize(applied);
+  steps.push_back(std::move(step));
+  if (steps.size() > maxSteps) steps.pop_front();
+  applied = steps.size();
+  return true;
+}
+
+bool DrawingHistory::undo(ImgData &imgData, vector<int> &regIds) {
+  if (!canUndo()) return false;
+  applied--;
+  apply(steps[applied], false, imgData, regIds);
+  return true;
+}
+
+bool DrawingHistory::redo(ImgData &imgData, vector<int> &regIds) {
+  if (!canRedo()) return false;
+  apply(steps[applied], true, imgData, regIds);
+  applied++;
+  return true;
+}
+
+bool DrawingHistory::canUndo() const { return applied > 0; }
+
+bool DrawingHistory::canRedo() const { return applied < steps.size(); }
+
+void DrawingHistory::clear() {
+  steps.clear();
+  applied = 0;
+  begun = false;
+  outlinesBefore.clear();
+  regionsBefore.clear();
+  layersBefore.clear();
+}
+
+void DrawingHistory::apply(const Step &step, bool forward, ImgData &imgData,
+                           vector<int> &regIds) const {
+  const int nRegions = forward ? step.nRegionsAfter : step.nRegionsBefore;
+  imgData.outlineImgs.resize(nRegions);
+  imgData.regionImgs.resize(nRegions);
+  regIds.clear();
+  for (const Change &change : step.changes) {
+    if (change.regId >= nRegions) continue;
+    imgData.outlineImgs[change.regId] =
+        forward ? change.outlineAfter : change.outlineBefore;
+    imgData.regionImgs[change.regId] =
+        forward ? change.regionAfter : change.regionBefore;
+    regIds.push_back(change.regId);
+  }
+  imgData.layers = forward ? step.layersAfter : step.layersBefore;
+}
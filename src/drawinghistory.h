@@ -0,0 +1,66 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DRAWINGHISTORY_H
+#define DRAWINGHISTORY_H
+
+#include <deque>
+#include <vector>
+
+#include "commonStructs.h"
+#include "tiledimage.h"
+
+// Undo and redo of the edits of the layers. A step keeps the images of the
+// regions an edit changed from before and after it. They share the tiles
+// with each other and with the current images (see TiledImage), so a step
+// costs the memory of the tiles it replaced.
+class DrawingHistory {
+ public:
+  explicit DrawingHistory(int maxSteps = 100);
+
+  // the layers before an edit
+  void begin(const ImgData &imgData);
+  // the layers after the edit begun last, returns false if it did not
+  // change anything
+  bool commit(const ImgData &imgData);
+  // the regions whose images were changed are stored to regIds
+  bool undo(ImgData &imgData, std::vector<int> &regIds);
+  bool redo(ImgData &imgData, std::vector<int> &regIds);
+  bool canUndo() const;
+  bool canRedo() const;
+  void clear();
+
+ private:
+  struct Change {
+    int regId;
+    TiledImage outlineBefore, regionBefore, outlineAfter, regionAfter;
+  };
+  struct Step {
+    int nRegionsBefore = 0, nRegionsAfter = 0;
+    std::deque<int> layersBefore, layersAfter;
+    std::vector<Change> changes;
+  };
+
+  void apply(const Step &step, bool forward, ImgData &imgData,
+             std::vector<int> &regIds) const;
+
+  int maxSteps;
+  std::deque<Step> steps;
+  int applied = 0;  // the steps before this one are applied
+  bool begun = false;
+  std::deque<TiledImage> outlinesBefore, regionsBefore;
+  std::deque<int> layersBefore;
+};
+
+#endif  // DRAWINGHISTORY_H
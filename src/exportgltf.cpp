@@ -14,45 +14,134 @@
 
 #include "exportgltf.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+
+#include "vertexcache.h"
+#include "vertexcodec.h"
+
 using namespace std;
 
 namespace exportgltf {
 
+namespace {
+
+const int FLOAT = TINYGLTF_COMPONENT_TYPE_FLOAT;
+const int SHORT = TINYGLTF_COMPONENT_TYPE_SHORT;
+const int BYTE = TINYGLTF_COMPONENT_TYPE_BYTE;
+const int UNSIGNED_SHORT = TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT;
+
+atomic<int> tempFileCounter{0};
+
+// Bytes per element with nComponents. The elements of vertex attributes
+// have to be aligned to 4 bytes, those of sparse values not.
+size_t elementSize(int nComponents, int componentType, bool padded) {
+  const size_t size =
+      nComponents * tinygltf::GetComponentSizeInBytes(componentType);
+  return padded ? (size + 3) / 4 * 4 : size;
+}
+
+// x as stored in the component type, normalized for integers
+double encodeComponent(float x, int componentType) {
+  switch (componentType) {
+    case SHORT:
+      return lround(clamp(x, -1.f, 1.f) * 32767);
+    case BYTE:
+      return lround(clamp(x, -1.f, 1.f) * 127);
+    case UNSIGNED_SHORT:
+      return lround(clamp(x, 0.f, 1.f) * 65535);
+    default:
+      return x;
+  }
+}
+
+vector<unsigned char> encodeAttribute(const MatrixXfR &X, int componentType,
+                                      bool padded) {
+  const size_t stride = elementSize(X.cols(), componentType, padded);
+  vector<unsigned char> data(X.rows() * stride, 0);
+  for (int i = 0; i < X.rows(); i++) {
+    unsigned char *dst = data.data() + i * stride;
+    for (int j = 0; j < X.cols(); j++) {
+      const double x = encodeComponent(X(i, j), componentType);
+      switch (componentType) {
+        case SHORT:
+          reinterpret_cast<short *>(dst)[j] = x;
+          break;
+        case BYTE:
+          reinterpret_cast<signed char *>(dst)[j] = x;
+          break;
+        case UNSIGNED_SHORT:
+          reinterpret_cast<unsigned short *>(dst)[j] = x;
+          break;
+        default:
+          reinterpret_cast<float *>(dst)[j] = x;
+      }
+    }
+  }
+  return data;
+}
+
+void setPositionBounds(const MatrixXfR &V, tinygltf::Accessor &accessor) {
+  // of the stored values, also for normalized integers
+  accessor.minValues.clear();
+  accessor.maxValues.clear();
+  for (int j = 0; j < 3; j++) {
+    accessor.minValues.push_back(
+        encodeComponent(V.col(j).minCoeff(), accessor.componentType));
+    accessor.maxValues.push_back(
+        encodeComponent(V.col(j).maxCoeff(), accessor.componentType));
+  }
+}
+
+}  // namespace
+
+ExportGltf::~ExportGltf() {
+  // the temporary file of an export which hasn't been stopped
+  binFile.close();
+  if (!binFn.empty()) remove(binFn.c_str());
+}
+
 void ExportGltf::exportStart(const MatrixXfR &V, const MatrixXfR &N,
-                             const MatrixXusR &F, const MatrixXfR &TC,
+                             const MatrixXuiR &F, const MatrixXfR &TC,
                              const int nFrames, bool mtHasNormals,
                              const int FPS, const Imguc &textureImg) {
   this->mtHasNormals = mtHasNormals;
   this->nFrames = nFrames;
   this->FPS = FPS;
   this->hasTexture = !textureImg.isNull();
-  nBytesMTCum = 0;
-
-  // allocate memory for a single one buffer containing all data
-  // buffer data for base model
-  nBytesF = F.size() * sizeof(unsigned short);
-  nBytesV = V.size() * sizeof(float);
-  nBytesN = N.size() * sizeof(float);
-  nBytesTC = TC.size() * sizeof(float);
-  nBytesBase = nBytesF + nBytesV + nBytesN + nBytesTC;
 
-  // buffer data for animation
-  nWeights = nFrames * (nFrames - 1);
-  nBytesWeights = nWeights * sizeof(float);
-  nBytesTime = nFrames * sizeof(float);
-  nBytesAnim = nBytesTime + nBytesWeights;
+  // 65535 is reserved for primitive restart
+  if (V.rows() < 65535) {
+    indexComponentType = TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT;
+    indexSize = sizeof(unsigned short);
+  } else {
+    indexComponentType = TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT;
+    indexSize = sizeof(unsigned int);
+  }
 
-  // buffer data for morph targets
-  nBytesMTTotal = 0;
-  for (int i = 0; i < nFrames - 1; ++i) {
-    nBytesMTTotal += nBytesV;
-    if (mtHasNormals) nBytesMTTotal += nBytesN;
+  if (quantize && V.rows() > 0) {
+    positionType = SHORT;
+    normalType = BYTE;
+    texCoordType = UNSIGNED_SHORT;
+    const Eigen::RowVector3f VMin = V.colwise().minCoeff();
+    const Eigen::RowVector3f VMax = V.colwise().maxCoeff();
+    positionOffset = 0.5f * (VMin + VMax);
+    positionScale = max(0.5f * (VMax - VMin).maxCoeff(), 1e-6f);
+    m.extensionsUsed.push_back("KHR_mesh_quantization");
+    m.extensionsRequired.push_back("KHR_mesh_quantization");
   }
 
+  // the binary buffer is written to a temporary file as it grows and copied
+  // to the GLB at exportStop()
+  binFn = "/tmp/exportgltf_" + to_string(tempFileCounter++) + ".bin";
+  binFile.open(binFn, ios::binary | ios::trunc);
+  binBytes = 0;
+  m.buffers.push_back(tinygltf::Buffer());
+
   // buffer data for image
-  nBytesImage = 0;
-  unsigned char *pngData;
-  int pngDataLength;
   if (hasTexture) {
     tinygltf::Sampler sampler;
     sampler.magFilter = TINYGLTF_TEXTURE_FILTER_LINEAR;
@@ -68,8 +157,12 @@ void ExportGltf::exportStart(const MatrixXfR &V, const MatrixXfR &N,
     image.bits = 8;
     image.pixel_type = TINYGLTF_COMPONENT_TYPE_BYTE;
     image.mimeType = "image/png";
-    textureImg.savePNG(pngData, pngDataLength);
-    nBytesImage = pngDataLength;
+    PNGCache localCache;
+    PNGCache &cache = textureCache != nullptr ? *textureCache : localCache;
+    const vector<unsigned char> &png = cache.get(textureImg);
+    if (!png.empty()) {
+      image.bufferView = addBufferView("texture", png.data(), png.size());
+    }
     m.images.push_back(image);
 
     tinygltf::Texture texture;
@@ -78,14 +171,6 @@ void ExportGltf::exportStart(const MatrixXfR &V, const MatrixXfR &N,
     m.textures.push_back(texture);
   }
 
-  tinygltf::Buffer buffer;
-  buffer.data.resize(nBytesBase + nBytesAnim + nBytesMTTotal + nBytesImage);
-  if (hasTexture) {
-    memcpy(buffer.data.data() + nBytesBase + nBytesAnim + nBytesMTTotal,
-           pngData, pngDataLength);
-  }
-  m.buffers.push_back(buffer);
-
   tinygltf::Material material;
   if (hasTexture) {
     material.pbrMetallicRoughness.baseColorTexture.index = 0;
@@ -95,119 +180,134 @@ void ExportGltf::exportStart(const MatrixXfR &V, const MatrixXfR &N,
   m.materials.push_back(material);
 }
 
+void ExportGltf::finishModel() {
+  if (skinned && nFrames > 1) exportSkinAnimation();
+  flushPendingFrames();
+  if (!skinned && keyframes.size() > 1) exportAnimation();
+
+  if (fallbackBytes > 0) {
+    tinygltf::Buffer fallback;
+    fallback.byteLength = fallbackBytes;
+    fallback.extensions["EXT_meshopt_compression"] = tinygltf::Value(
+        tinygltf::Value::Object{{"fallback", tinygltf::Value(true)}});
+    m.buffers.push_back(fallback);
+    m.extensionsUsed.push_back("EXT_meshopt_compression");
+    m.extensionsRequired.push_back("EXT_meshopt_compression");
+  }
+
+  binFile.close();
+}
+
 void ExportGltf::exportStop(const std::string &outFn, bool writeBinary) {
-  if (hasTexture) {
-    tinygltf::BufferView bufView;
-    bufView.name = "texture";
-    bufView.buffer = 0;
-    bufView.byteOffset = nBytesBase + nBytesAnim + nBytesMTTotal;
-    bufView.byteLength = nBytesImage;
-    //    bufView.target = TINYGLTF_TARGET_ARRAY_BUFFER;
-    m.bufferViews.push_back(bufView);
-    m.images[0].bufferView = m.bufferViews.size() - 1;
+  finishModel();
+  if (writeBinary) {
+    writeGlb(outFn);
+  } else {
+    // embedded in the JSON as base64
+    ifstream in(binFn, ios::binary);
+    m.buffers[0].data.resize(binBytes);
+    in.read(reinterpret_cast<char *>(m.buffers[0].data.data()), binBytes);
+    tinygltf::TinyGLTF gltf;
+    gltf.WriteGltfSceneToFile(&m, outFn,
+                              true,    // embedImages
+                              true,    // embedBuffers
+                              true,    // pretty print
+                              false);  // write binary
+    m.buffers[0].data.clear();
   }
+  remove(binFn.c_str());
+  binFn.clear();
+}
 
+void ExportGltf::exportStop(std::vector<unsigned char> &glb) {
+  finishModel();
+  size_t binPadded = 0;
+  const string prefix = glbPrefix(binPadded);
+  glb.assign(prefix.size() + binPadded, 0);
+  copy(prefix.begin(), prefix.end(), glb.begin());
+  ifstream in(binFn, ios::binary);
+  in.read(reinterpret_cast<char *>(glb.data() + prefix.size()), binBytes);
+  remove(binFn.c_str());
+  binFn.clear();
+}
+
+string ExportGltf::glbPrefix(size_t &binPadded) {
+  // the JSON refers to the binary chunk by the length of the first buffer
+  m.buffers[0].byteLength = binBytes;
+  stringstream jsonStream;
   tinygltf::TinyGLTF gltf;
-  gltf.WriteGltfSceneToFile(&m, outFn,
-                            true,          // embedImages
-                            true,          // embedBuffers
-                            !writeBinary,  // pretty print
-                            writeBinary);  // write binary
+  gltf.WriteGltfSceneToStream(&m, jsonStream, false, false);
+  string json = jsonStream.str();
+  json.resize((json.size() + 3) / 4 * 4, ' ');
+  binPadded = (binBytes + 3) / 4 * 4;
+
+  string prefix;
+  auto writeUint32 = [&](uint32_t value) {
+    prefix.append(reinterpret_cast<const char *>(&value), sizeof(value));
+  };
+  prefix.append("glTF", 4);
+  writeUint32(2);
+  writeUint32(12 + 8 + json.size() + 8 + binPadded);
+  writeUint32(json.size());
+  prefix.append("JSON", 4);
+  prefix.append(json);
+  writeUint32(binPadded);
+  prefix.append("BIN\0", 4);
+  return prefix;
 }
 
-void ExportGltf::exportFullModel(const MatrixXfR &V, const MatrixXfR &N,
-                                 const MatrixXusR &F, const MatrixXfR &TC) {
-  // buffer data for base model
-  tinygltf::Buffer &buffer = m.buffers[0];
-  memcpy(buffer.data.data(), F.data(), nBytesF);
-  memcpy(buffer.data.data() + nBytesF, V.data(), nBytesV);
-  memcpy(buffer.data.data() + nBytesF + nBytesV, N.data(), nBytesN);
-  if (nBytesTC > 0) {
-    memcpy(buffer.data.data() + nBytesF + nBytesV + nBytesN, TC.data(),
-           nBytesTC);
-  }
-
-  // buffer data for animation
-  if (nFrames > 1) {
-    // time
-    vector<float> time(nFrames);
-    for (int i = 0; i < nFrames; i++) time[i] = i / static_cast<float>(FPS);
-    memcpy(buffer.data.data() + nBytesBase, time.data(), nBytesTime);
-
-    // weights
-    vector<float> weights(nWeights, 0);
-    for (int i = 0; i < nFrames - 1; i++) {
-      weights[(i + 1) * (nFrames - 1) + i] = 1;
-    }
-    memcpy(buffer.data.data() + nBytesBase + nBytesTime, weights.data(),
-           nBytesWeights);
+void ExportGltf::writeGlb(const std::string &outFn) {
+  size_t binPadded = 0;
+  const string prefix = glbPrefix(binPadded);
+  ofstream out(outFn, ios::binary | ios::trunc);
+  out.write(prefix.data(), prefix.size());
+  // copied in pieces to keep the memory use low
+  ifstream in(binFn, ios::binary);
+  vector<char> piece(1 << 20);
+  while (in) {
+    in.read(piece.data(), piece.size());
+    out.write(piece.data(), in.gcount());
   }
+  const char zeros[3] = {0, 0, 0};
+  out.write(zeros, binPadded - binBytes);
+}
 
-  // buffer views for base model
-  {
-    tinygltf::BufferView bufView;
-    bufView.name = "F";
-    bufView.buffer = 0;
-    bufView.byteOffset = 0;
-    bufView.byteLength = nBytesF;
-    bufView.target = TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER;
-    m.bufferViews.push_back(bufView);
-  }
-  {
-    tinygltf::BufferView bufView;
-    bufView.name = "V";
-    bufView.buffer = 0;
-    bufView.byteOffset = nBytesF;
-    bufView.byteLength = nBytesV;
-    bufView.target = TINYGLTF_TARGET_ARRAY_BUFFER;
-    m.bufferViews.push_back(bufView);
-  }
-  {
-    tinygltf::BufferView bufView;
-    bufView.name = "N";
-    bufView.buffer = 0;
-    bufView.byteOffset = nBytesF + nBytesV;
-    bufView.byteLength = nBytesN;
-    bufView.target = TINYGLTF_TARGET_ARRAY_BUFFER;
-    m.bufferViews.push_back(bufView);
-  }
-  if (nBytesTC > 0) {
-    tinygltf::BufferView bufView;
-    bufView.name = "TC";
-    bufView.buffer = 0;
-    bufView.byteOffset = nBytesF + nBytesV + nBytesN;
-    bufView.byteLength = nBytesTC;
-    bufView.target = TINYGLTF_TARGET_ARRAY_BUFFER;
-    m.bufferViews.push_back(bufView);
-  }
-
-  // buffer views for animation
-  if (nFrames > 1) {
-    {
-      // time
-      tinygltf::BufferView bufView;
-      bufView.buffer = 0;
-      bufView.byteOffset = nBytesBase;
-      bufView.byteLength = nBytesTime;
-      m.bufferViews.push_back(bufView);
-    }
-    {
-      // weights
-      tinygltf::BufferView bufView;
-      bufView.buffer = 0;
-      bufView.byteOffset = nBytesBase + nBytesTime;
-      bufView.byteLength = nBytesWeights;
-      m.bufferViews.push_back(bufView);
-    }
+void ExportGltf::exportFullModel(const MatrixXfR &V_, const MatrixXfR &N_,
+                                 const MatrixXuiR &F, const MatrixXfR &TC_) {
+  vector<unsigned int> indices(F.data(), F.data() + F.size());
+  vertexOrder.clear();
+  if (optimizeVertexOrder) {
+    optimizeVertexCache(indices, V_.rows());
+    vertexOrder = optimizeVertexFetch(indices, V_.rows());
   }
+  const MatrixXfR V = toPositionSpace(reorderVertices(V_));
+  const MatrixXfR N = reorderVertices(N_);
+  const MatrixXfR TC = reorderVertices(TC_);
+
+  // buffer data and buffer views for base model
+  const vector<unsigned char> dataF = packIndices(indices);
+  const int bufViewIdF = addBufferView("F", dataF.data(), dataF.size());
+  m.bufferViews[bufViewIdF].target = TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER;
+  auto addAttribute = [&](const string &name, const MatrixXfR &X, int type) {
+    const vector<unsigned char> data = encodeAttribute(X, type, true);
+    const size_t stride = elementSize(X.cols(), type, true);
+    const int id = addBufferView(name, data.data(), data.size(), stride);
+    if (quantize) m.bufferViews[id].byteStride = stride;
+    m.bufferViews[id].target = TINYGLTF_TARGET_ARRAY_BUFFER;
+    return id;
+  };
+  const int bufViewIdV = addAttribute("V", V, positionType);
+  const int bufViewIdN = addAttribute("N", N, normalType);
+  const int bufViewIdTC =
+      TC.size() > 0 ? addAttribute("TC", TC, texCoordType) : -1;
 
   // accessors for base model
   {
     tinygltf::Accessor accessor;
     accessor.name = "F";
-    accessor.bufferView = 0;
+    accessor.bufferView = bufViewIdF;
     accessor.byteOffset = 0;
-    accessor.componentType = TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT;
+    accessor.componentType = indexComponentType;
     accessor.count = F.size();
     accessor.type = TINYGLTF_TYPE_SCALAR;
     m.accessors.push_back(accessor);
@@ -215,23 +315,22 @@ void ExportGltf::exportFullModel(const MatrixXfR &V, const MatrixXfR &N,
   {
     tinygltf::Accessor accessor;
     accessor.name = "V";
-    accessor.bufferView = 1;
+    accessor.bufferView = bufViewIdV;
     accessor.byteOffset = 0;
-    accessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+    accessor.componentType = positionType;
+    accessor.normalized = positionType != FLOAT;
     accessor.count = V.rows();
     accessor.type = TINYGLTF_TYPE_VEC3;
-    auto VMin = V.colwise().minCoeff();
-    auto VMax = V.colwise().maxCoeff();
-    accessor.minValues = {VMin(0), VMin(1), VMin(2)};
-    accessor.maxValues = {VMax(0), VMax(1), VMax(2)};
+    setPositionBounds(V, accessor);
     m.accessors.push_back(accessor);
   }
   {
     tinygltf::Accessor accessor;
     accessor.name = "N";
-    accessor.bufferView = 2;
+    accessor.bufferView = bufViewIdN;
     accessor.byteOffset = 0;
-    accessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+    accessor.componentType = normalType;
+    accessor.normalized = normalType != FLOAT;
     accessor.count = N.rows();
     accessor.type = TINYGLTF_TYPE_VEC3;
     m.accessors.push_back(accessor);
@@ -239,42 +338,15 @@ void ExportGltf::exportFullModel(const MatrixXfR &V, const MatrixXfR &N,
   if (TC.size() > 0) {
     tinygltf::Accessor accessor;
     accessor.name = "TC";
-    accessor.bufferView = 3;
+    accessor.bufferView = bufViewIdTC;
     accessor.byteOffset = 0;
-    accessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+    accessor.componentType = texCoordType;
+    accessor.normalized = texCoordType != FLOAT;
     accessor.count = TC.rows();
     accessor.type = TINYGLTF_TYPE_VEC2;
     m.accessors.push_back(accessor);
   }
 
-  // accessors for animation
-  if (nFrames > 1) {
-    {
-      // time
-      tinygltf::Accessor accessor;
-      accessor.name = "time";
-      accessor.bufferView = 3 + (TC.size() > 0 ? 1 : 0);
-      accessor.byteOffset = 0;
-      accessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-      accessor.count = nFrames;
-      accessor.type = TINYGLTF_TYPE_SCALAR;
-      accessor.minValues.push_back(0);
-      accessor.maxValues.push_back((nFrames - 1) / static_cast<float>(FPS));
-      m.accessors.push_back(accessor);
-    }
-    {
-      // weights
-      tinygltf::Accessor accessor;
-      accessor.name = "weights";
-      accessor.bufferView = 4 + (TC.size() > 0 ? 1 : 0);
-      accessor.byteOffset = 0;
-      accessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-      accessor.count = nWeights;
-      accessor.type = TINYGLTF_TYPE_SCALAR;
-      m.accessors.push_back(accessor);
-    }
-  }
-
   // primitive
   tinygltf::Primitive primitive;
   primitive.indices = 0;                 // accessor index for F
@@ -288,125 +360,465 @@ void ExportGltf::exportFullModel(const MatrixXfR &V, const MatrixXfR &N,
   // material
   primitive.material = 0;
 
-  // mesh
-  tinygltf::Mesh mesh;
-  mesh.primitives.push_back(primitive);
-  if (nFrames > 1) {
-    mesh.weights.resize(nFrames - 1, 0);
-    vector<tinygltf::Value> morphTargetNames;
-    for (int i = 0; i < nFrames - 1; i++) {
-      morphTargetNames.push_back(
-          tinygltf::Value("Morph Target " + to_string(i)));
-    }
-    mesh.extras =
-        tinygltf::Value({{"targetNames", tinygltf::Value(morphTargetNames)}});
+  // a mesh and a node per chunk of the animation (see framesPerChunk), all
+  // of them sharing the base model, the first one is there even without
+  // morph targets
+  basePrimitive = primitive;
+  m.scenes.push_back(tinygltf::Scene());
+  if (quantize) {
+    // the chunk nodes are scaled by the animation, dequantize in a parent
+    tinygltf::Node model;
+    model.name = "model";
+    model.scale = {positionScale, positionScale, positionScale};
+    model.translation = {positionOffset(0), positionOffset(1),
+                         positionOffset(2)};
+    m.nodes.push_back(model);
+    modelNode = m.nodes.size() - 1;
+    m.scenes[0].nodes.push_back(modelNode);
   }
+  addChunk();
+  keyframes = {0};
+  keyframeV = MatrixXfR::Zero(V.rows(), 3);
+
+  // other
+  m.asset.version = "2.0";
+  m.asset.generator = "MonsterMash.zone (using tinygltf)";
+}
+
+void ExportGltf::addChunk() {
+  tinygltf::Mesh mesh;
+  mesh.primitives.push_back(basePrimitive);
   m.meshes.push_back(mesh);
 
-  // node
   tinygltf::Node node;
-  node.mesh = 0;
+  node.mesh = m.meshes.size() - 1;
   m.nodes.push_back(node);
+  const int nodeId = m.nodes.size() - 1;
+  chunkNodes.push_back(nodeId);
+  if (modelNode != -1) {
+    m.nodes[modelNode].children.push_back(nodeId);
+  } else {
+    m.scenes[0].nodes.push_back(nodeId);
+  }
+}
 
-  // scene
-  tinygltf::Scene scene;
-  scene.nodes.push_back(0);
-  m.scenes.push_back(scene);
+void ExportGltf::exportSkin(const MatrixXfR &jointPos,
+                            const MatrixXusR &joints_,
+                            const MatrixXfR &weights_) {
+  const MatrixXusR joints = reorderVertices(joints_);
+  const MatrixXfR weights = reorderVertices(weights_);
+
+  // the mesh is deformed only by the joints, which are children of a common
+  // root
+  const int nJoints = jointPos.rows();
+  tinygltf::Skin skin;
+  tinygltf::Node root;
+  root.name = "skeleton";
+  m.nodes.push_back(root);
+  const int rootId = m.nodes.size() - 1;
+  vector<float> inverseBindMatrices;
+  for (int j = 0; j < nJoints; j++) {
+    tinygltf::Node joint;
+    joint.name = "joint " + to_string(j);
+    joint.translation = {jointPos(j, 0), jointPos(j, 1), jointPos(j, 2)};
+    m.nodes.push_back(joint);
+    m.nodes[rootId].children.push_back(m.nodes.size() - 1);
+    skin.joints.push_back(m.nodes.size() - 1);
+    // column-major translation by -jointPos after the dequantization of
+    // the positions (the transform of the model node doesn't apply to
+    // skinned meshes)
+    const float s = positionScale;
+    const Eigen::RowVector3f t = positionOffset - jointPos.row(j);
+    inverseBindMatrices.insert(
+        inverseBindMatrices.end(),
+        {s, 0, 0, 0, 0, s, 0, 0, 0, 0, s, 0, t(0), t(1), t(2), 1});
+  }
+  jointsNode = rootId + 1;
+  skin.skeleton = rootId;
+  skin.inverseBindMatrices = addFloatAccessor(
+      "inverseBindMatrices", inverseBindMatrices, TINYGLTF_TYPE_MAT4, false);
+  m.skins.push_back(skin);
+  m.scenes[0].nodes.push_back(rootId);
+  for (int node : chunkNodes) m.nodes[node].skin = 0;
+
+  // vertex attributes
+  const size_t nBytesJoints = joints.size() * sizeof(unsigned short);
+  const int bufViewIdJoints =
+      addBufferView("JOINTS_0", joints.data(), nBytesJoints,
+                    4 * sizeof(unsigned short));
+  tinygltf::Accessor accessor;
+  accessor.name = "JOINTS_0";
+  accessor.bufferView = bufViewIdJoints;
+  accessor.byteOffset = 0;
+  accessor.componentType = TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT;
+  accessor.count = joints.rows();
+  accessor.type = TINYGLTF_TYPE_VEC4;
+  m.accessors.push_back(accessor);
+  const int accIdJoints = m.accessors.size() - 1;
+  const vector<float> weightsData(weights.data(),
+                                  weights.data() + weights.size());
+  const int accIdWeights =
+      addFloatAccessor("WEIGHTS_0", weightsData, TINYGLTF_TYPE_VEC4, false);
+  for (int node : chunkNodes) {
+    tinygltf::Primitive &primitive = m.meshes[m.nodes[node].mesh].primitives[0];
+    primitive.attributes["JOINTS_0"] = accIdJoints;
+    primitive.attributes["WEIGHTS_0"] = accIdWeights;
+  }
+}
 
-  // other
-  m.asset.version = "2.0";
-  m.asset.generator = "MonsterMash.zone (using tinygltf)";
+void ExportGltf::exportJointPose(const MatrixXfR &rotations,
+                                 const MatrixXfR &translations,
+                                 const int frame) {
+  if (static_cast<int>(jointRotations.size()) <= frame) {
+    jointRotations.resize(frame + 1);
+    jointTranslations.resize(frame + 1);
+  }
+  jointRotations[frame] = rotations;
+  jointTranslations[frame] = translations;
+}
 
-  if (nFrames > 1) {
-    // sampler for animation
+void ExportGltf::exportSkinAnimation() {
+  if (jointsNode == -1 || jointRotations.empty()) return;
+  const int nJoints = jointRotations[0].rows();
+  const int nPoses = jointRotations.size();
+
+  // a translation and a rotation channel per joint sharing the time
+  vector<float> time(nPoses);
+  for (int i = 0; i < nPoses; i++) time[i] = i / static_cast<float>(FPS);
+  tinygltf::Animation anim;
+  const int accIdTime =
+      addFloatAccessor("time", time, TINYGLTF_TYPE_SCALAR, true);
+  auto addChannel = [&](int joint, const vector<MatrixXfR> &poses,
+                        const string &path, int type) {
+    const int nComponents = poses[0].cols();
+    vector<float> values;
+    values.reserve(nPoses * nComponents);
+    for (const MatrixXfR &pose : poses) {
+      values.insert(values.end(), pose.row(joint).data(),
+                    pose.row(joint).data() + nComponents);
+    }
     tinygltf::AnimationSampler sampler;
-    sampler.input = 3 + (TC.size() > 0 ? 1 : 0);  // accessor index for time
+    sampler.input = accIdTime;
+    sampler.output =
+        addFloatAccessor(path + " " + to_string(joint), values, type, false);
     sampler.interpolation = "LINEAR";
-    sampler.output = 4 + (TC.size() > 0 ? 1 : 0);  // accessor index for weights
-    tinygltf::AnimationChannel channel;
-    channel.sampler = 0;
-    channel.target_node = 0;
-    channel.target_path = "weights";
+    anim.samplers.push_back(sampler);
 
-    // animation
-    tinygltf::Animation anim;
+    tinygltf::AnimationChannel channel;
+    channel.sampler = anim.samplers.size() - 1;
+    channel.target_node = jointsNode + joint;
+    channel.target_path = path;
     anim.channels.push_back(channel);
+  };
+  for (int j = 0; j < nJoints; j++) {
+    addChannel(j, jointTranslations, "translation", TINYGLTF_TYPE_VEC3);
+    addChannel(j, jointRotations, "rotation", TINYGLTF_TYPE_VEC4);
+  }
+  m.animations.push_back(anim);
+}
+
+void ExportGltf::exportAnimation() {
+  tinygltf::Animation anim;
+  auto addSampler = [&](const vector<float> &time, const vector<float> &values,
+                        int valueType, const string &interpolation, int node,
+                        const string &path) {
+    tinygltf::AnimationSampler sampler;
+    sampler.input = addFloatAccessor(path + " time " + to_string(node), time,
+                                     TINYGLTF_TYPE_SCALAR, true);
+    sampler.output = addFloatAccessor(path + " " + to_string(node), values,
+                                      valueType, false);
+    sampler.interpolation = interpolation;
     anim.samplers.push_back(sampler);
-    m.animations.push_back(anim);
+
+    tinygltf::AnimationChannel channel;
+    channel.sampler = anim.samplers.size() - 1;
+    channel.target_node = node;
+    channel.target_path = path;
+    anim.channels.push_back(channel);
+  };
+  auto frameTime = [&](int frame) { return frame / static_cast<float>(FPS); };
+
+  const int nChunks = chunkNodes.size();
+  for (int k = 0; k < nChunks; k++) {
+    // a one-hot weight vector over the targets of the chunk per keyframe
+    const int node = chunkNodes[k];
+    const int firstKey = k * framesPerChunk, lastKey = chunkLastKeyframe(k);
+    const int firstTarget = chunkFirstTarget(k);
+    const int nTargets = lastKey - firstTarget + 1;
+    vector<float> time, weights;
+    for (int i = firstKey; i <= lastKey; i++) {
+      time.push_back(frameTime(keyframes[i]));
+      weights.resize(weights.size() + nTargets, 0);
+      if (i > 0) weights[weights.size() - nTargets + i - firstTarget] = 1;
+    }
+    addSampler(time, weights, TINYGLTF_TYPE_SCALAR, "LINEAR", node, "weights");
+
+    tinygltf::Mesh &mesh = m.meshes[m.nodes[node].mesh];
+    vector<tinygltf::Value> morphTargetNames;
+    for (int i = firstTarget; i <= lastKey; i++) {
+      mesh.weights.push_back(0);
+      morphTargetNames.push_back(
+          tinygltf::Value("Morph Target " + to_string(i - 1)));
+    }
+    mesh.extras =
+        tinygltf::Value({{"targetNames", tinygltf::Value(morphTargetNames)}});
+
+    // only the chunk of the current frame is visible
+    if (nChunks == 1) continue;
+    vector<float> visibleTime, scale;
+    auto addKey = [&](float t, float s) {
+      visibleTime.push_back(t);
+      scale.insert(scale.end(), {s, s, s});
+    };
+    if (k > 0) addKey(0, 0);
+    addKey(frameTime(keyframes[firstKey]), 1);
+    if (k < nChunks - 1) addKey(frameTime(keyframes[lastKey]), 0);
+    addSampler(visibleTime, scale, TINYGLTF_TYPE_VEC3, "STEP", node, "scale");
   }
+  m.animations.push_back(anim);
 }
 
-void ExportGltf::exportMorphTarget(const MatrixXfR &V, const MatrixXfR &N,
-                                   const int frame) {
-  // buffer data for morph target
-  tinygltf::Buffer &buffer = m.buffers[0];
-  size_t nBytesPrev = nBytesBase + nBytesAnim + nBytesMTCum;
-  memcpy(buffer.data.data() + nBytesPrev, V.data(), nBytesV);
-  if (mtHasNormals > 0) {
-    memcpy(buffer.data.data() + nBytesPrev + nBytesV, N.data(), nBytesN);
+int ExportGltf::chunkFirstTarget(int chunk) const {
+  return max(1, chunk * framesPerChunk);
+}
+
+int ExportGltf::chunkLastKeyframe(int chunk) const {
+  return min((chunk + 1) * framesPerChunk,
+             static_cast<int>(keyframes.size()) - 1);
+}
+
+int ExportGltf::addFloatAccessor(const std::string &name,
+                                 const std::vector<float> &data, int type,
+                                 bool withMinMax) {
+  const size_t nBytes = data.size() * sizeof(float);
+  tinygltf::Accessor accessor;
+  accessor.name = name;
+  accessor.bufferView =
+      addBufferView(name, data.data(), nBytes,
+                    tinygltf::GetNumComponentsInType(type) * sizeof(float));
+  accessor.byteOffset = 0;
+  accessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+  accessor.count = data.size() / tinygltf::GetNumComponentsInType(type);
+  accessor.type = type;
+  if (withMinMax && !data.empty()) {
+    accessor.minValues.push_back(*min_element(data.begin(), data.end()));
+    accessor.maxValues.push_back(*max_element(data.begin(), data.end()));
   }
-  size_t nBytesMTCurr = nBytesV + (mtHasNormals ? nBytesN : 0);
+  m.accessors.push_back(accessor);
+  return m.accessors.size() - 1;
+}
 
-  // buffer views for morph target
-  {
-    tinygltf::BufferView bufferView;
-    bufferView.name = "MT" + to_string(frame) + "_V";
-    bufferView.buffer = 0;
-    bufferView.byteOffset =
-        nBytesBase + nBytesAnim + (frame - 1) * nBytesMTCurr;
-    bufferView.byteLength = nBytesV;
-    //    bufferView.target = TINYGLTF_TARGET_ARRAY_BUFFER;
-    m.bufferViews.push_back(bufferView);
-  }
-  if (mtHasNormals > 0) {
-    tinygltf::BufferView bufferView;
-    bufferView.name = "MT" + to_string(frame) + "_N";
+size_t ExportGltf::appendToBuffer(const void *data, size_t nBytes) {
+  // keep the data aligned to 4 bytes as required for float accessors
+  const char padding[4] = {0, 0, 0, 0};
+  const size_t offset = (binBytes + 3) / 4 * 4;
+  binFile.write(padding, offset - binBytes);
+  binFile.write(static_cast<const char *>(data), nBytes);
+  binBytes = offset + nBytes;
+  return offset;
+}
+
+vector<unsigned char> ExportGltf::packIndices(
+    const vector<unsigned int> &indices) const {
+  vector<unsigned char> data(indices.size() * indexSize);
+  if (indexSize == sizeof(unsigned int)) {
+    memcpy(data.data(), indices.data(), data.size());
+  } else {
+    unsigned short *dst = reinterpret_cast<unsigned short *>(data.data());
+    for (size_t i = 0; i < indices.size(); i++) dst[i] = indices[i];
+  }
+  return data;
+}
+
+MatrixXfR ExportGltf::toPositionSpace(const MatrixXfR &V) const {
+  if (!quantize) return V;
+  return (V.rowwise() - positionOffset) / positionScale;
+}
+
+template <typename Matrix>
+Matrix ExportGltf::reorderVertices(const Matrix &X) const {
+  if (vertexOrder.empty() || X.rows() == 0) return X;
+  Matrix Y(X.rows(), X.cols());
+  for (int i = 0; i < Y.rows(); i++) Y.row(i) = X.row(vertexOrder[i]);
+  return Y;
+}
+
+int ExportGltf::addBufferView(const std::string &name, const void *data,
+                              size_t nBytes, size_t stride) {
+  tinygltf::BufferView bufferView;
+  bufferView.name = name;
+  bufferView.byteLength = nBytes;
+  vector<unsigned char> encoded;
+  if (compress && stride > 0 && stride % 4 == 0 && stride <= 256 &&
+      nBytes % stride == 0) {
+    encoded = encodeVertexBuffer(static_cast<const unsigned char *>(data),
+                                 nBytes / stride, stride);
+  }
+  if (!encoded.empty() && encoded.size() < nBytes) {
+    // the view refers to the fallback buffer without data, the data is
+    // decoded from the binary buffer given by the extension
+    tinygltf::Value::Object extension;
+    extension["buffer"] = tinygltf::Value(0);
+    extension["byteOffset"] = tinygltf::Value(
+        static_cast<int>(appendToBuffer(encoded.data(), encoded.size())));
+    extension["byteLength"] = tinygltf::Value(static_cast<int>(encoded.size()));
+    extension["byteStride"] = tinygltf::Value(static_cast<int>(stride));
+    extension["count"] = tinygltf::Value(static_cast<int>(nBytes / stride));
+    extension["mode"] = tinygltf::Value(string("ATTRIBUTES"));
+    bufferView.extensions["EXT_meshopt_compression"] =
+        tinygltf::Value(extension);
+    bufferView.buffer = 1;
+    bufferView.byteOffset = (fallbackBytes + 3) / 4 * 4;
+    fallbackBytes = bufferView.byteOffset + nBytes;
+  } else {
     bufferView.buffer = 0;
-    bufferView.byteOffset =
-        nBytesBase + nBytesAnim + (frame - 1) * nBytesMTCurr + nBytesV;
-    bufferView.byteLength = nBytesN;
-    //    bufferView.target = TINYGLTF_TARGET_ARRAY_BUFFER;
-    m.bufferViews.push_back(bufferView);
+    bufferView.byteOffset = appendToBuffer(data, nBytes);
   }
+  m.bufferViews.push_back(bufferView);
+  return m.bufferViews.size() - 1;
+}
 
-  // accessors for morph target
-  const int bufViewIdAccIdV =
-      5 + (hasTexture ? 1 : 0) + (mtHasNormals ? 2 : 1) * (frame - 1);
-  const int bufViewIdAccIdN = bufViewIdAccIdV + 1;
-  {
-    tinygltf::Accessor accessor;
-    accessor.name = "MT" + to_string(frame) + "_V";
-    accessor.bufferView = bufViewIdAccIdV;
-    accessor.byteOffset = 0;
-    accessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-    accessor.count = V.rows();
-    accessor.type = TINYGLTF_TYPE_VEC3;
-    auto VMin = V.colwise().minCoeff();
-    auto VMax = V.colwise().maxCoeff();
-    accessor.minValues = {VMin(0), VMin(1), VMin(2)};
-    accessor.maxValues = {VMax(0), VMax(1), VMax(2)};
-    m.accessors.push_back(accessor);
+void ExportGltf::exportMorphTarget(const MatrixXfR &V_, const MatrixXfR &N_,
+                                   const int frame) {
+  const MatrixXfR V = reorderVertices(V_);
+  const MatrixXfR N = reorderVertices(N_);
+  if (keyframeTolerance <= 0) {
+    addKeyframe(V, N, frame);
+    return;
   }
-  if (mtHasNormals) {
+
+  // The pending frames are dropped as long as they stay within the
+  // tolerance of the interpolation from the last keyframe to this frame,
+  // otherwise the previous frame is kept and this one starts a new run.
+  const int lastKey = keyframes.back();
+  const float tolerance2 = keyframeTolerance * keyframeTolerance;
+  bool withinTolerance =
+      static_cast<int>(pendingFrames.size()) < keyframeMaxGap;
+  for (size_t i = 0; withinTolerance && i < pendingFrames.size(); i++) {
+    const float t = (pendingFrames[i] - lastKey) /
+                    static_cast<float>(frame - lastKey);
+    const MatrixXfR error = (1 - t) * keyframeV + t * V - pendingV[i];
+    withinTolerance = error.rowwise().squaredNorm().maxCoeff() <= tolerance2;
+  }
+  if (!withinTolerance) flushPendingFrames();
+  pendingFrames.push_back(frame);
+  pendingV.push_back(V);
+  pendingN.push_back(N);
+  // the last frame is always kept
+  if (frame >= nFrames - 1) flushPendingFrames();
+}
+
+void ExportGltf::flushPendingFrames() {
+  if (pendingFrames.empty()) return;
+  addKeyframe(pendingV.back(), pendingN.back(), pendingFrames.back());
+  keyframeV = pendingV.back();
+  pendingFrames.clear();
+  pendingV.clear();
+  pendingN.clear();
+}
+
+void ExportGltf::addKeyframe(const MatrixXfR &V, const MatrixXfR &N,
+                             const int frame) {
+  const string name = "MT" + to_string(frame);
+
+  // the vertices that move more than sparseEpsilon (in the positions or the
+  // normals), the others are exported as zero deltas
+  vector<unsigned int> moving;
+  for (int i = 0; i < V.rows(); i++) {
+    if (V.row(i).cwiseAbs().maxCoeff() > sparseEpsilon ||
+        (mtHasNormals && N.row(i).cwiseAbs().maxCoeff() > sparseEpsilon)) {
+      moving.push_back(i);
+    }
+  }
+  const bool sparse = moving.size() < sparseMaxFraction * V.rows();
+
+  // the position deltas in the range of the position attributes, quantized
+  // deltas have to be within [-1, 1]
+  const MatrixXfR VA = quantize ? MatrixXfR(V / positionScale) : V;
+  auto deltaType = [&](const MatrixXfR &X) {
+    if (!quantize || (X.size() > 0 && X.cwiseAbs().maxCoeff() > 1)) {
+      return FLOAT;
+    }
+    return SHORT;
+  };
+  const int typeV = deltaType(VA);
+  const int typeN = mtHasNormals ? deltaType(N) : FLOAT;
+
+  // buffer data and buffer views for morph target, the sparse ones share
+  // the indices of the moving vertices
+  int bufViewIdV = -1, bufViewIdN = -1, bufViewIdIndices = -1;
+  if (!sparse) {
+    auto addValues = [&](const MatrixXfR &X, int type, const string &suffix) {
+      const vector<unsigned char> data = encodeAttribute(X, type, true);
+      const int id = addBufferView(name + suffix, data.data(), data.size(),
+                                   elementSize(3, type, true));
+      if (type != FLOAT) {
+        m.bufferViews[id].byteStride = elementSize(3, type, true);
+      }
+      return id;
+    };
+    bufViewIdV = addValues(VA, typeV, "_V");
+    if (mtHasNormals) bufViewIdN = addValues(N, typeN, "_N");
+  } else if (!moving.empty()) {
+    const vector<unsigned char> indices = packIndices(moving);
+    bufViewIdIndices =
+        addBufferView(name + "_indices", indices.data(), indices.size());
+    auto addValues = [&](const MatrixXfR &X, int type, const string &suffix) {
+      MatrixXfR values(moving.size(), 3);
+      for (size_t i = 0; i < moving.size(); i++) {
+        values.row(i) = X.row(moving[i]);
+      }
+      const vector<unsigned char> data = encodeAttribute(values, type, false);
+      return addBufferView(name + suffix, data.data(), data.size(),
+                           elementSize(3, type, false));
+    };
+    bufViewIdV = addValues(VA, typeV, "_V");
+    if (mtHasNormals) bufViewIdN = addValues(N, typeN, "_N");
+  }
+
+  // accessors for morph target, sparse ones have no buffer view and are
+  // initialized with zeros (all of them if no vertex moves)
+  auto addAccessor = [&](const string &suffix, int type, int bufViewId) {
     tinygltf::Accessor accessor;
-    accessor.name = "MT" + to_string(frame) + "_N";
-    accessor.bufferView = bufViewIdAccIdN;
+    accessor.name = name + suffix;
+    accessor.bufferView = sparse ? -1 : bufViewId;
     accessor.byteOffset = 0;
-    accessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
-    accessor.count = N.rows();
+    accessor.componentType = type;
+    accessor.normalized = type != FLOAT;
+    accessor.count = V.rows();
     accessor.type = TINYGLTF_TYPE_VEC3;
+    if (sparse && bufViewId != -1) {
+      accessor.sparse.isSparse = true;
+      accessor.sparse.count = moving.size();
+      accessor.sparse.indices.bufferView = bufViewIdIndices;
+      accessor.sparse.indices.byteOffset = 0;
+      accessor.sparse.indices.componentType = indexComponentType;
+      accessor.sparse.values.bufferView = bufViewId;
+      accessor.sparse.values.byteOffset = 0;
+    }
     m.accessors.push_back(accessor);
+    return static_cast<int>(m.accessors.size() - 1);
+  };
+  // bounds are required for POSITION, of the dense data even if sparse
+  const int accIdV = addAccessor("_V", typeV, bufViewIdV);
+  setPositionBounds(VA, m.accessors[accIdV]);
+  const int accIdN = mtHasNormals ? addAccessor("_N", typeN, bufViewIdN) : -1;
+
+  // alter the primitives of the chunks with the keyframe (the one ending
+  // with it and the one starting with it, added with the next keyframe)
+  map<string, int> targets = {{"POSITION", accIdV}};
+  if (mtHasNormals) targets["NORMAL"] = accIdN;
+  keyframes.push_back(frame);
+  keyframeTargets.push_back(targets);
+  const int key = keyframes.size() - 1;
+  const int k = (key - 1) / framesPerChunk;
+  if (k == static_cast<int>(chunkNodes.size())) {
+    addChunk();
+    m.meshes.back().primitives[0].targets.push_back(
+        keyframeTargets[k * framesPerChunk - 1]);
   }
-
-  // alter primitive with accessor to morph target
-  tinygltf::Primitive &primitive = m.meshes[0].primitives[0];
-  pair<string, int> targetV = {"POSITION", bufViewIdAccIdV};
-  pair<string, int> targetN = {"NORMAL", bufViewIdAccIdN};
-  map<string, int> targets = {targetV};
-  if (mtHasNormals) targets.insert(targetN);
-  primitive.targets.push_back(targets);
-
-  nBytesMTCum += nBytesMTCurr;
+  m.meshes[m.nodes[chunkNodes[k]].mesh].primitives[0].targets.push_back(
+      targets);
 }
 
 }  // namespace exportgltf
@@ -19,7 +19,12 @@
 #include <tiny_gltf.h>
 
 #include <Eigen/Core>
+#include <fstream>
+#include <map>
 #include <string>
+#include <vector>
+
+#include "pngcache.h"
 
 namespace exportgltf {
 
@@ -28,35 +33,160 @@ typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
 typedef Eigen::Matrix<unsigned short, Eigen::Dynamic, Eigen::Dynamic,
                       Eigen::RowMajor>
     MatrixXusR;
+typedef Eigen::Matrix<unsigned int, Eigen::Dynamic, Eigen::Dynamic,
+                      Eigen::RowMajor>
+    MatrixXuiR;
 
+// The binary buffer is appended to a temporary file as the model and the
+// frames are exported and copied into the GLB at exportStop(), so only the
+// JSON part of the model is kept in memory.
 class ExportGltf {
  public:
-  void exportStart(const MatrixXfR &V, const MatrixXfR &N, const MatrixXusR &F,
+  ExportGltf() = default;
+  ~ExportGltf();
+  ExportGltf(const ExportGltf &) = delete;
+  ExportGltf &operator=(const ExportGltf &) = delete;
+
+  // The indices are written as unsigned shorts if there are fewer than 65535
+  // vertices, as unsigned ints otherwise.
+  void exportStart(const MatrixXfR &V, const MatrixXfR &N, const MatrixXuiR &F,
                    const MatrixXfR &TC, const int nFrames, bool mtHasNormals,
                    const int FPS, const Imguc &textureImg);
   void exportStop(const std::string &outFn, bool writeBinary);
+  // the GLB is written to glb instead of a file, e.g. to hand it to the
+  // browser without a copy in its file system
+  void exportStop(std::vector<unsigned char> &glb);
   void exportFullModel(const MatrixXfR &V, const MatrixXfR &N,
-                       const MatrixXusR &F, const MatrixXfR &TC);
+                       const MatrixXuiR &F, const MatrixXfR &TC);
+  // V and N are the deltas from the full model, the frames have to be passed
+  // in order. A morph target is written as a sparse accessor of the
+  // vertices moving more than sparseEpsilon if there are fewer of them than
+  // sparseMaxFraction of all, the other vertices get zero deltas.
   void exportMorphTarget(const MatrixXfR &V, const MatrixXfR &N,
                          const int frame);
 
+  // Binds the full model to joints at jointPos for an animation of joint
+  // poses (skinned must be set before exportStart()). Each vertex is bound
+  // to the 4 joints in its row of joints with the weights, unused ones have
+  // zero weights. Call after exportFullModel().
+  void exportSkin(const MatrixXfR &jointPos, const MatrixXusR &joints,
+                  const MatrixXfR &weights);
+  // Pose of the joints in the frame (0 for the full model): rotations as
+  // quaternions (x, y, z, w) and translations of the joints, which are at
+  // jointPos with no rotation in the bind pose. Written at exportStop().
+  void exportJointPose(const MatrixXfR &rotations,
+                       const MatrixXfR &translations, const int frame);
+
+  // animated with a skin (exportSkin()) instead of morph targets
+  bool skinned = false;
+  // Reorders the faces for the vertex cache and the vertices in the order
+  // of their first use (see vertexcache.h) in exportFullModel(), the
+  // per-vertex data passed later is reordered the same way.
+  bool optimizeVertexOrder = true;
+  // Writes positions and morph deltas as normalized shorts, normals as
+  // normalized bytes and texture coordinates as normalized unsigned shorts
+  // (KHR_mesh_quantization). The positions are mapped to [-1, 1] by a
+  // uniform scale and translation of the model node set in exportStart(),
+  // deltas exceeding that range fall back to floats.
+  bool quantize = false;
+  // Encodes the buffer views of vertex attributes, morph targets and
+  // animation samplers with EXT_meshopt_compression as they are added (see
+  // vertexcodec.h), set before exportStart(). Indices and the texture are
+  // stored as they are.
+  bool compress = false;
+  // encodes the texture in exportStart() if set, to reuse the PNG of an
+  // unchanged texture from an earlier export
+  PNGCache *textureCache = nullptr;
+  float sparseEpsilon = 1e-5f;
+  float sparseMaxFraction = 0.5f;
+  // The animation weights have a value per keyframe and morph target, so
+  // longer animations are split into chunks of framesPerChunk keyframes.
+  // Each chunk is a node with its own mesh (sharing the accessors of the base
+  // model) with the targets of its keyframes, only the node of the current
+  // chunk is visible (scaled by 1). The weights grow linearly with the number
+  // of keyframes.
+  int framesPerChunk = 32;
+  // Frames whose positions are within keyframeTolerance (in model units) of
+  // the linear interpolation between the neighbouring kept frames get no
+  // morph target and the weights are sampled at the kept frames only. The
+  // dropped frames are held until the next kept one, at most
+  // keyframeMaxGap of them. 0 keeps all frames.
+  float keyframeTolerance = 0;
+  int keyframeMaxGap = 32;
+
  private:
-  size_t nBytesF = 0;
-  size_t nBytesV = 0;
-  size_t nBytesN = 0;
-  size_t nBytesTC = 0;
-  size_t nBytesBase = 0;
-  int nWeights = 0;
-  size_t nBytesWeights = 0;
-  size_t nBytesTime = 0;
-  size_t nBytesAnim = 0;
-  size_t nBytesImage = 0;
-  size_t nBytesMTTotal = 0;
-  size_t nBytesMTCum = 0;
+  void exportAnimation();
+  void exportSkinAnimation();
+  // adds the pending animation, closes the temporary file
+  void finishModel();
+  // the GLB header and the JSON chunk followed by the header of the binary
+  // chunk of binPadded bytes
+  std::string glbPrefix(std::size_t &binPadded);
+  void writeGlb(const std::string &outFn);
+  // writes the morph target of a kept frame (V and N already reordered)
+  void addKeyframe(const MatrixXfR &V, const MatrixXfR &N, const int frame);
+  // keeps the last of the pending frames
+  void flushPendingFrames();
+  // adds the mesh and the node of the next chunk, the chunks are added as
+  // their keyframes are exported
+  void addChunk();
+  // chunk k covers keyframes [k * framesPerChunk, chunkLastKeyframe(k)], the
+  // morph target of keyframe i > 0 is i - 1
+  int chunkFirstTarget(int chunk) const;
+  int chunkLastKeyframe(int chunk) const;
+  int addFloatAccessor(const std::string &name, const std::vector<float> &data,
+                       int type, bool withMinMax);
+  // returns the offset of the data appended to the buffer
+  size_t appendToBuffer(const void *data, size_t nBytes);
+  // Appends the data to the buffer and returns its buffer view. The data
+  // of elements of stride bytes may be compressed (see compress), stride is
+  // 0 for data that shouldn't be (indices, the texture).
+  int addBufferView(const std::string &name, const void *data, size_t nBytes,
+                    size_t stride = 0);
+  // the indices in the component type of the model
+  std::vector<unsigned char> packIndices(
+      const std::vector<unsigned int> &indices) const;
+  // V mapped to the range of the position attributes
+  MatrixXfR toPositionSpace(const MatrixXfR &V) const;
+  // the rows of X in vertexOrder
+  template <typename Matrix>
+  Matrix reorderVertices(const Matrix &X) const;
+
+  int positionType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+  int normalType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+  int texCoordType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+  float positionScale = 1;
+  Eigen::RowVector3f positionOffset = Eigen::RowVector3f::Zero();
+  int indexComponentType = TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT;
+  size_t indexSize = sizeof(unsigned short);
+  // the original index of each exported vertex, empty if not reordered
+  std::vector<int> vertexOrder;
+  // the temporary file of the binary buffer
+  std::string binFn;
+  std::ofstream binFile;
+  size_t binBytes = 0;
+  // size of the fallback buffer of the compressed buffer views
+  size_t fallbackBytes = 0;
   bool mtHasNormals = false;
   int nFrames = 0;
   int FPS = 0;
   bool hasTexture = false;
+  // per frame, see exportJointPose()
+  std::vector<MatrixXfR> jointRotations, jointTranslations;
+  int jointsNode = -1;
+  // the frame of each kept frame (0 for the full model) and the targets of
+  // their morph targets
+  std::vector<int> keyframes;
+  std::vector<std::map<std::string, int>> keyframeTargets;
+  // the frames after the last keyframe within the tolerance so far and the
+  // deltas of the last keyframe
+  std::vector<int> pendingFrames;
+  std::vector<MatrixXfR> pendingV, pendingN;
+  MatrixXfR keyframeV;
+  tinygltf::Primitive basePrimitive;
+  std::vector<int> chunkNodes;
+  // the parent of the chunk nodes dequantizing the positions or -1
+  int modelNode = -1;
   tinygltf::Model m;
 };
 
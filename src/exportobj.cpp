@@ -0,0 +1,177 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "exportobj.h"
+
+#include <miscutils/macros.h>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+using namespace std;
+using namespace Eigen;
+
+namespace {
+
+// lines formatted by a task
+const int rowsPerChunk = 4096;
+
+// Appends x with at most 6 decimals (trailing zeros removed) as the C
+// locale would.
+char *formatNumber(double x, char *p) {
+  if (!isfinite(x) || fabs(x) >= 1e12) {
+    return p + snprintf(p, 32, "%g", x);
+  }
+  const uint64_t scaled = llround(fabs(x) * 1e6);
+  if (scaled == 0) {
+    *p++ = '0';
+    return p;
+  }
+  if (x < 0) *p++ = '-';
+  char digits[20];
+  int n = 0;
+  uint64_t intPart = scaled / 1000000;
+  do {
+    digits[n++] = '0' + intPart % 10;
+    intPart /= 10;
+  } while (intPart > 0);
+  while (n > 0) *p++ = digits[--n];
+  uint64_t fracPart = scaled % 1000000;
+  if (fracPart > 0) {
+    *p++ = '.';
+    int nDecimals = 6;
+    while (fracPart % 10 == 0) {
+      fracPart /= 10;
+      nDecimals--;
+    }
+    for (int i = nDecimals - 1; i >= 0; i--) {
+      p[i] = '0' + fracPart % 10;
+      fracPart /= 10;
+    }
+    p += nDecimals;
+  }
+  return p;
+}
+
+char *formatIndex(int i, char *p) {
+  char digits[12];
+  int n = 0;
+  do {
+    digits[n++] = '0' + i % 10;
+    i /= 10;
+  } while (i > 0);
+  while (n > 0) *p++ = digits[--n];
+  return p;
+}
+
+void formatRows(const MatrixXd &X, const char *prefix, int begin, int end,
+                string &out) {
+  // longest number: sign, 12 integer digits, point and 6 decimals
+  const size_t maxLineLength = 8 + X.cols() * 24;
+  out.resize((end - begin) * maxLineLength);
+  char *p = &out[0];
+  fora(i, begin, end) {
+    for (const char *c = prefix; *c != 0; c++) *p++ = *c;
+    fora(j, 0, X.cols()) {
+      *p++ = ' ';
+      p = formatNumber(X(i, j), p);
+    }
+    *p++ = '\n';
+  }
+  out.resize(p - &out[0]);
+}
+
+// "f v/vt/vn" with the same (1-based) index for all of them as the
+// attributes are per vertex
+void formatFaces(const MatrixXi &F, bool hasNormals, bool hasTexCoords,
+                 int begin, int end, string &out) {
+  const size_t maxLineLength = 2 + F.cols() * 36;
+  out.resize((end - begin) * maxLineLength);
+  char *p = &out[0];
+  fora(i, begin, end) {
+    *p++ = 'f';
+    fora(j, 0, F.cols()) {
+      *p++ = ' ';
+      const int index = F(i, j) + 1;
+      p = formatIndex(index, p);
+      if (hasTexCoords || hasNormals) {
+        *p++ = '/';
+        if (hasTexCoords) p = formatIndex(index, p);
+      }
+      if (hasNormals) {
+        *p++ = '/';
+        p = formatIndex(index, p);
+      }
+    }
+    *p++ = '\n';
+  }
+  out.resize(p - &out[0]);
+}
+
+}  // namespace
+
+bool writeMeshOBJ(const std::string &fn, const Eigen::MatrixXd &V,
+                  const Eigen::MatrixXi &F, const Eigen::MatrixXd &N,
+                  const Eigen::MatrixXd &TC, const std::string &header,
+                  WorkerPool *pool) {
+  // the sections in the order of the file, split into chunks of rows
+  struct Chunk {
+    const MatrixXd *X;
+    const char *prefix;
+    int begin, end;
+  };
+  vector<Chunk> chunks;
+  auto addSection = [&](const MatrixXd *X, const char *prefix, int rows) {
+    for (int i = 0; i < rows; i += rowsPerChunk) {
+      chunks.push_back({X, prefix, i, min(i + rowsPerChunk, rows)});
+    }
+  };
+  addSection(&V, "v", V.rows());
+  addSection(&TC, "vt", TC.rows());
+  addSection(&N, "vn", N.rows());
+  addSection(nullptr, "f", F.rows());
+
+  vector<string> lines(chunks.size());
+  auto formatChunks = [&](int begin, int end) {
+    fora(i, begin, end) {
+      const Chunk &c = chunks[i];
+      if (c.X != nullptr) {
+        formatRows(*c.X, c.prefix, c.begin, c.end, lines[i]);
+      } else {
+        formatFaces(F, N.rows() > 0, TC.rows() > 0, c.begin, c.end,
+                    lines[i]);
+      }
+    }
+  };
+  if (pool != nullptr)
+    pool->parallelFor(chunks.size(), 1, formatChunks);
+  else
+    formatChunks(0, chunks.size());
+
+  size_t nBytes = header.size();
+  for (const string &l : lines) nBytes += l.size();
+  string buffer;
+  buffer.reserve(nBytes);
+  buffer += header;
+  for (const string &l : lines) buffer += l;
+
+  FILE *file = fopen(fn.c_str(), "wb");
+  if (file == nullptr) return false;
+  const bool written = fwrite(buffer.data(), 1, buffer.size(), file) ==
+                       buffer.size();
+  return fclose(file) == 0 && written;
+}
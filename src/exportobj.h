@@ -0,0 +1,37 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef EXPORTOBJ_H
+#define EXPORTOBJ_H
+
+#include <Eigen/Dense>
+#include <string>
+
+#include "workerpool.h"
+
+// Writes the mesh V, F as an OBJ file as igl::writeOBJ does, with per-vertex
+// normals N and texture coordinates TC (each skipped if empty) and the lines
+// of header (e.g. the material) first.
+//
+// The lines are formatted in chunks in parallel on pool (serially if it is
+// null) into a single buffer written at once. Numbers are written with 6
+// decimals independently of the locale. Returns false if the file couldn't
+// be written.
+bool writeMeshOBJ(const std::string &fn, const Eigen::MatrixXd &V,
+                  const Eigen::MatrixXi &F, const Eigen::MatrixXd &N,
+                  const Eigen::MatrixXd &TC, const std::string &header = "",
+                  WorkerPool *pool = nullptr);
+
+#endif  // EXPORTOBJ_H
@@ -0,0 +1,114 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "frameprofiler.h"
+
+#include <miscutils/macros.h>
+
+#include <algorithm>
+#include <sstream>
+
+#include "allocstats.h"
+
+using namespace std;
+
+namespace {
+
+double elapsedMs(chrono::steady_clock::time_point from,
+                 chrono::steady_clock::time_point to) {
+  return chrono::duration<double, milli>(to - from).count();
+}
+
+}  // namespace
+
+FrameProfiler::Scope::Scope(FrameProfiler &profiler, Stage stage)
+    : profiler(profiler), prevStage(profiler.switchStage(stage)) {}
+
+FrameProfiler::Scope::~Scope() { profiler.switchStage(prevStage); }
+
+FrameProfiler::FrameProfiler(int capacity) : frames(max(capacity, 1)) {}
+
+const char *FrameProfiler::stageName(int stage) {
+  static const char *names[NUM_STAGES] = {
+      "deformation", "normals", "glUpload", "draw", "compositing", "export"};
+  if (stage < 0 || stage >= NUM_STAGES) return "other";
+  return names[stage];
+}
+
+void FrameProfiler::beginFrame() {
+  curr = Frame();
+  frameStart = Clock::now();
+  frameStartAllocs = allocStatsGet().calls;
+  activeStage = -1;
+  inFrame = true;
+}
+
+void FrameProfiler::endFrame() {
+  if (!inFrame) return;
+  const auto now = Clock::now();
+  if (activeStage != -1) curr.ms[activeStage] += elapsedMs(stageStart, now);
+  curr.totalMs = elapsedMs(frameStart, now);
+  curr.allocs = allocStatsGet().calls - frameStartAllocs;
+  frames[next] = curr;
+  next = (next + 1) % frames.size();
+  count = min<int>(count + 1, frames.size());
+  activeStage = -1;
+  inFrame = false;
+}
+
+int FrameProfiler::switchStage(int stage) {
+  const int prev = activeStage;
+  if (!inFrame) return prev;
+  const auto now = Clock::now();
+  if (activeStage != -1) curr.ms[activeStage] += elapsedMs(stageStart, now);
+  stageStart = now;
+  activeStage = stage;
+  return prev;
+}
+
+int FrameProfiler::size() const { return count; }
+
+const FrameProfiler::Frame &FrameProfiler::frame(int i) const {
+  const int n = frames.size();
+  return frames[(next - count + i + n) % n];
+}
+
+void FrameProfiler::clear() {
+  next = count = 0;
+  activeStage = -1;
+  inFrame = false;
+}
+
+string FrameProfiler::toJSON() const {
+  ostringstream oss;
+  oss << "{\"stages\":[";
+  fora(i, 0, NUM_STAGES) {
+    if (i > 0) oss << ",";
+    oss << "\"" << stageName(i) << "\"";
+  }
+  oss << "],\"frames\":[";
+  fora(i, 0, count) {
+    const Frame &f = frame(i);
+    if (i > 0) oss << ",";
+    oss << "{\"totalMs\":" << f.totalMs << ",\"allocs\":" << f.allocs
+        << ",\"ms\":[";
+    fora(j, 0, NUM_STAGES) {
+      if (j > 0) oss << ",";
+      oss << f.ms[j];
+    }
+    oss << "]}";
+  }
+  oss << "]}";
+  return oss.str();
+}
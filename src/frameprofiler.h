@@ -0,0 +1,93 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FRAMEPROFILER_H
+#define FRAMEPROFILER_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Per-frame timings of the stages of the render loop kept in a ring buffer
+// of the last frames.
+//
+// The stages are measured with Scope objects. A nested scope pauses the one
+// around it, so every moment of a frame is attributed to a single stage and
+// the stages of a frame add up to at most its total (the rest is "other").
+// The times are measured on the CPU, for OpenGL they include only the
+// submission of the commands. The heap allocations of a frame are counted
+// if allocStatsEnabled() (see allocstats.h), on all threads.
+class FrameProfiler {
+ public:
+  enum Stage {
+    DEFORMATION,
+    NORMALS,
+    GL_UPLOAD,
+    DRAW,
+    COMPOSITING,
+    EXPORT,
+    NUM_STAGES
+  };
+
+  struct Frame {
+    double ms[NUM_STAGES] = {};
+    double totalMs = 0;
+    std::uint64_t allocs = 0;
+  };
+
+  class Scope {
+   public:
+    Scope(FrameProfiler &profiler, Stage stage);
+    ~Scope();
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+   private:
+    FrameProfiler &profiler;
+    int prevStage;
+  };
+
+  explicit FrameProfiler(int capacity = 240);
+
+  static const char *stageName(int stage);
+
+  void beginFrame();
+  void endFrame();
+
+  // number of recorded frames, at most the capacity
+  int size() const;
+  // i-th recorded frame, 0 is the oldest one
+  const Frame &frame(int i) const;
+  void clear();
+  // {"stages":[names],"frames":[{"totalMs":t,"allocs":n,"ms":[per stage]},
+  // ...]}, the oldest frame first
+  std::string toJSON() const;
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  // makes stage the measured one and returns the previous one (-1 if none)
+  int switchStage(int stage);
+
+  std::vector<Frame> frames;
+  int next = 0, count = 0;
+  Frame curr;
+  Clock::time_point frameStart, stageStart;
+  std::uint64_t frameStartAllocs = 0;
+  int activeStage = -1;
+  bool inFrame = false;
+};
+
+#endif  // FRAMEPROFILER_H
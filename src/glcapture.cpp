@@ -0,0 +1,121 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "glcapture.h"
+
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "macros.h"
+
+using namespace std;
+
+bool GLFrameCapture::init(int w, int h) {
+  destroy();
+  this->w = w;
+  this->h = h;
+  GLint prevTexture = 0;
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &prevTexture);
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prevFBO);
+  bool complete = true;
+  for (Target &t : targets) {
+    glGenTextures(1, &t.colorTexture);
+    glBindTexture(GL_TEXTURE_2D, t.colorTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glGenRenderbuffers(1, &t.depthRenderbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, t.depthRenderbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, w, h);
+    glGenFramebuffers(1, &t.FBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, t.FBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, t.colorTexture, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                              GL_RENDERBUFFER, t.depthRenderbuffer);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+      complete = false;
+  }
+  glBindTexture(GL_TEXTURE_2D, prevTexture);
+  glBindFramebuffer(GL_FRAMEBUFFER, prevFBO);
+  nFrames = 0;
+  lastRead = false;
+  if (!complete) {
+    DEBUG_CMD_MM(cerr << "GLFrameCapture: incomplete framebuffer" << endl;);
+    destroy();
+    return false;
+  }
+  return true;
+}
+
+void GLFrameCapture::destroy() {
+  for (Target &t : targets) {
+    if (t.FBO == 0) continue;
+    glDeleteFramebuffers(1, &t.FBO);
+    glDeleteRenderbuffers(1, &t.depthRenderbuffer);
+    glDeleteTextures(1, &t.colorTexture);
+    t = Target();
+  }
+}
+
+bool GLFrameCapture::isReady() const { return targets[0].FBO != 0; }
+
+void GLFrameCapture::beginFrame(float r, float g, float b, float a) {
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prevFBO);
+  glGetIntegerv(GL_VIEWPORT, prevViewport);
+  glGetFloatv(GL_COLOR_CLEAR_VALUE, prevClearColor);
+  glBindFramebuffer(GL_FRAMEBUFFER, targets[nFrames % 2].FBO);
+  glViewport(0, 0, w, h);
+  glClearColor(r, g, b, a);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+bool GLFrameCapture::endFrame(Imguc &image) {
+  const bool hasPrev = nFrames > 0;
+  if (hasPrev) read(targets[(nFrames + 1) % 2], image);
+  nFrames++;
+  glBindFramebuffer(GL_FRAMEBUFFER, prevFBO);
+  glViewport(prevViewport[0], prevViewport[1], prevViewport[2],
+             prevViewport[3]);
+  glClearColor(prevClearColor[0], prevClearColor[1], prevClearColor[2],
+               prevClearColor[3]);
+  return hasPrev;
+}
+
+bool GLFrameCapture::readLastFrame(Imguc &image) {
+  if (nFrames == 0 || lastRead) return false;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prevFBO);
+  read(targets[(nFrames + 1) % 2], image);
+  glBindFramebuffer(GL_FRAMEBUFFER, prevFBO);
+  lastRead = true;
+  return true;
+}
+
+void GLFrameCapture::read(const Target &target, Imguc &image) {
+  glBindFramebuffer(GL_FRAMEBUFFER, target.FBO);
+  image = Imguc(w, h, 4, 3);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, image.data);
+  // the rows of OpenGL go from the bottom up
+  vector<unsigned char> row(4 * w);
+  fora(y, 0, h / 2) {
+    unsigned char *a = &image(0, y, 0), *b = &image(0, h - 1 - y, 0);
+    memcpy(row.data(), a, row.size());
+    memcpy(a, b, row.size());
+    memcpy(b, row.data(), row.size());
+  }
+}
@@ -0,0 +1,62 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef GLCAPTURE_H
+#define GLCAPTURE_H
+
+#include <image/image.h>
+#define GL_GLEXT_PROTOTYPES 1
+#include <SDL_opengles2.h>
+
+// Renders the frames of a video capture into offscreen framebuffers and
+// reads them back one frame late: frame k is drawn into framebuffer k % 2
+// and framebuffer (k - 1) % 2 is read after it was issued, so glReadPixels
+// gets a frame the GPU had a whole frame of time to finish instead of
+// waiting for the one just drawn. OpenGL ES 2.0 (and WebGL 1) has no pixel
+// buffer objects, the ping-pong is the closest to an asynchronous readback.
+class GLFrameCapture {
+ public:
+  // false if the framebuffers of size w x h are not supported
+  bool init(int w, int h);
+  void destroy();
+  bool isReady() const;
+  int width() const { return w; }
+  int height() const { return h; }
+
+  // Binds the framebuffer of the next frame, sets the viewport and clears
+  // it with the given color.
+  void beginFrame(float r, float g, float b, float a);
+  // Restores the previous framebuffer and viewport and reads the frame
+  // before the one just drawn into image, returns false for the first one.
+  bool endFrame(Imguc &image);
+  // the last drawn frame, to be called once after the last endFrame()
+  bool readLastFrame(Imguc &image);
+
+ private:
+  struct Target {
+    GLuint FBO = 0, colorTexture = 0, depthRenderbuffer = 0;
+  };
+  void read(const Target &target, Imguc &image);
+
+  Target targets[2];
+  int w = 0, h = 0;
+  int nFrames = 0;  // drawn since init()
+  bool lastRead = false;
+  GLint prevFBO = 0;
+  GLint prevViewport[4];
+  GLfloat prevClearColor[4];
+};
+
+#endif  // GLCAPTURE_H
@@ -0,0 +1,216 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "glmorph.h"
+
+#include <shaderMatcap/shaderMatcap.h>
+
+#include <cmath>
+#include <vector>
+
+#include "shaderTextureVertexCoords.h"
+#include "vertexnormals.h"
+
+using namespace std;
+using namespace Eigen;
+
+namespace {
+
+// the shaders of shaderMatcap.h and shaderTextureVertexCoords.h with the
+// position and the normal blended between two frames
+const char *matcapVertexShaderSrc =
+    "#version 100\n"
+    "uniform mat4 view;\n"
+    "uniform mat4 proj;\n"
+    "uniform mat4 normalMatrix;\n"
+    "uniform float blend;\n"
+    "attribute vec3 position;\n"
+    "attribute vec3 normal;\n"
+    "attribute vec3 position1;\n"
+    "attribute vec3 normal1;\n"
+    "varying vec3 e;\n"
+    "varying vec3 n;\n"
+    "void main() {\n"
+    "  vec4 p = vec4(mix(position, position1, blend), 1);\n"
+    "  e = normalize(vec3(view * p));\n"
+    "  n = normalize(mat3(normalMatrix) * mix(normal, normal1, blend));\n"
+    "  gl_Position = proj * view * p;\n"
+    "}\n";
+const char *textureVertexShaderSrc =
+    "#version 100\n"
+    "uniform mat4 view;\n"
+    "uniform mat4 proj;\n"
+    "uniform mat4 normalMatrix;\n"
+    "uniform float blend;\n"
+    "attribute vec3 position;\n"
+    "attribute vec3 normal;\n"
+    "attribute vec3 position1;\n"
+    "attribute vec3 normal1;\n"
+    "attribute vec3 texCoord;\n"
+    "varying vec3 frag_texCoord;\n"
+    "varying vec3 frag_normal;\n"
+    "varying vec3 frag_lightDirection;\n"
+    "mat3 transpose(mat3 m) {\n"
+    "  return mat3(m[0][0], m[1][0], m[2][0],\n"
+    "              m[0][1], m[1][1], m[2][1],\n"
+    "              m[0][2], m[1][2], m[2][2]);\n"
+    "}\n"
+    "void main() {\n"
+    "  vec4 p = vec4(mix(position, position1, blend), 1);\n"
+    "  frag_normal = normalize(mix(normal, normal1, blend));\n"
+    "  frag_lightDirection = transpose(mat3(normalMatrix)) * vec3(0,0,1);\n"
+    "  frag_texCoord = texCoord;\n"
+    "  gl_Position = proj * view * p;\n"
+    "}\n";
+
+}  // namespace
+
+void GLMorphPlayback::initProgram(Program &program,
+                                  const char *vertexShaderSrc,
+                                  const char *fragmentShaderSrc) {
+  program.shader = loadShaders(vertexShaderSrc, fragmentShaderSrc);
+  program.camera = getCameraUniforms(program.shader);
+  program.blend = glGetUniformLocation(program.shader, "blend");
+  program.position1 = glGetAttribLocation(program.shader, "position1");
+  program.normal1 = glGetAttribLocation(program.shader, "normal1");
+}
+
+void GLMorphPlayback::init() {
+  initProgram(matcap, matcapVertexShaderSrc, SHADERMATCAP_FRAG);
+  initProgram(texture, textureVertexShaderSrc, SHADERTEXVERTCOORDS_FRAG);
+  textureTexLocation = glGetUniformLocation(texture.shader, "tex");
+  textureUseShadingLocation =
+      glGetUniformLocation(texture.shader, "useShading");
+  glGenVertexArraysOES(1, &VAO);
+  glGenBuffers(1, &VBO_V);
+  glGenBuffers(1, &VBO_N);
+  glGenBuffers(1, &VBO_T);
+  glGenBuffers(1, &VBO_F);
+  uploaded = false;
+}
+
+void GLMorphPlayback::destroy() {
+  glDeleteProgram(matcap.shader);
+  glDeleteProgram(texture.shader);
+  glDeleteVertexArraysOES(1, &VAO);
+  glDeleteBuffers(1, &VBO_V);
+  glDeleteBuffers(1, &VBO_N);
+  glDeleteBuffers(1, &VBO_T);
+  glDeleteBuffers(1, &VBO_F);
+  uploaded = false;
+}
+
+bool GLMorphPlayback::upload(const AnimCache &cache, const MatrixXi &F,
+                             const MatrixXd &T) {
+  if (isReady(cache.getSignature()) && (T.rows() == 0 || hasTexCoords))
+    return true;
+  clear();
+  if (!cache.isComplete() || cache.getNumFrames() == 0) return false;
+  MatrixXd V;
+  if (!cache.get(0, V)) return false;
+  const int n = V.rows(), frames = cache.getNumFrames();
+  const size_t frameBytes = static_cast<size_t>(n) * 3 * sizeof(float);
+  if (2 * frameBytes * frames > maxBytes) return false;
+
+  // all frames one after another, the normals computed for each of them
+  MatrixX3fR allV(static_cast<size_t>(n) * frames, 3), allN(allV.rows(), 3);
+  VertexNormals vertexNormals;
+  MatrixXd N;
+  for (int f = 0; f < frames; f++) {
+    if (f > 0 && !cache.get(f, V)) return false;
+    vertexNormals.compute(V, F, N);
+    allV.middleRows(static_cast<size_t>(f) * n, n) = V.cast<float>();
+    allN.middleRows(static_cast<size_t>(f) * n, n) = N.cast<float>();
+  }
+  const Matrix<unsigned int, Dynamic, Dynamic, RowMajor> indices =
+      F.cast<unsigned int>();
+
+  glBindVertexArrayOES(VAO);
+  glBindBuffer(GL_ARRAY_BUFFER, VBO_V);
+  glBufferData(GL_ARRAY_BUFFER, allV.size() * sizeof(float), allV.data(),
+               GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, VBO_N);
+  glBufferData(GL_ARRAY_BUFFER, allN.size() * sizeof(float), allN.data(),
+               GL_STATIC_DRAW);
+  hasTexCoords = T.rows() == n && T.cols() > 0;
+  if (hasTexCoords) {
+    const Matrix<float, Dynamic, Dynamic, RowMajor> Tf = T.cast<float>();
+    glBindBuffer(GL_ARRAY_BUFFER, VBO_T);
+    glBufferData(GL_ARRAY_BUFFER, Tf.size() * sizeof(float), Tf.data(),
+                 GL_STATIC_DRAW);
+    glVertexAttribPointer(MESH_ATTRIB_TEXCOORD, Tf.cols(), GL_FLOAT, GL_FALSE,
+                          0, 0);
+    glEnableVertexAttribArray(MESH_ATTRIB_TEXCOORD);
+  }
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, VBO_F);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
+               indices.data(), GL_STATIC_DRAW);
+
+  signature = cache.getSignature();
+  nFrames = frames;
+  nVertices = n;
+  nIndices = indices.size();
+  uploaded = true;
+  return true;
+}
+
+bool GLMorphPlayback::isReady(uint64_t signature) const {
+  return uploaded && this->signature == signature;
+}
+
+void GLMorphPlayback::clear() {
+  if (!uploaded) return;
+  // the buffers are kept, only their storage is released
+  glBindBuffer(GL_ARRAY_BUFFER, VBO_V);
+  glBufferData(GL_ARRAY_BUFFER, 0, nullptr, GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, VBO_N);
+  glBufferData(GL_ARRAY_BUFFER, 0, nullptr, GL_STATIC_DRAW);
+  uploaded = false;
+}
+
+void GLMorphPlayback::draw(double t, const Matrix4d &P, const Matrix4d &M,
+                           bool textured, bool textureShading) {
+  if (!uploaded) return;
+  textured = textured && hasTexCoords;
+  const Program &program = textured ? texture : matcap;
+  glUseProgram(program.shader);
+  uploadCameraMatrices(program.shader, program.camera, P, M,
+                       M.inverse().transpose());
+  if (textured) {
+    glUniform1i(textureTexLocation, 0);
+    glUniform1f(textureUseShadingLocation, textureShading ? 1 : 0);
+  }
+  double tw = fmod(t, nFrames);
+  if (tw < 0) tw += nFrames;
+  const int a = min(static_cast<int>(tw), nFrames - 1);
+  const int b = (a + 1) % nFrames;
+  glUniform1f(program.blend, static_cast<float>(tw - a));
+
+  // only the attribute pointers change from frame to frame
+  glBindVertexArrayOES(VAO);
+  const size_t frameBytes = static_cast<size_t>(nVertices) * 3 * sizeof(float);
+  auto setFrame = [&](GLuint VBO, GLint attrib, int frame) {
+    if (attrib < 0) return;
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glVertexAttribPointer(attrib, 3, GL_FLOAT, GL_FALSE, 0,
+                          reinterpret_cast<const void *>(frame * frameBytes));
+    glEnableVertexAttribArray(attrib);
+  };
+  setFrame(VBO_V, MESH_ATTRIB_POSITION, a);
+  setFrame(VBO_N, MESH_ATTRIB_NORMAL, a);
+  setFrame(VBO_V, program.position1, b);
+  setFrame(VBO_N, program.normal1, b);
+  glDrawElements(GL_TRIANGLES, nIndices, GL_UNSIGNED_INT, 0);
+}
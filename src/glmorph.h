@@ -0,0 +1,73 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef GLMORPH_H
+#define GLMORPH_H
+
+#include <miscutils/opengltools.h>
+
+#include <Eigen/Dense>
+#include <cstdint>
+#define GL_GLEXT_PROTOTYPES 1
+#include <SDL_opengles2.h>
+
+#include "animcache.h"
+
+// Plays a completely cached animation (see AnimCache) on the GPU as morph
+// targets: the positions and normals of all frames are uploaded once, and
+// each draw only points the attributes of the vertex shader to the two
+// frames around the timepoint and blends them by a uniform. The CPU cost of
+// a frame does not depend on the size of the mesh then.
+class GLMorphPlayback {
+ public:
+  void init();
+  void destroy();
+
+  // Uploads the frames of cache with the faces F and the texture coordinates
+  // T (may be empty) unless they were uploaded for the signature of cache
+  // already. Returns false if the cache is incomplete or the frames would
+  // exceed maxBytes.
+  bool upload(const AnimCache &cache, const Eigen::MatrixXi &F,
+              const Eigen::MatrixXd &T);
+  bool isReady(std::uint64_t signature) const;
+  void clear();
+
+  // Draws the animation at the timepoint t (in frames, the last frame is
+  // blended with the first one), with the texture bound to unit 0 if
+  // textured is set and the matcap otherwise.
+  void draw(double t, const Eigen::Matrix4d &P, const Eigen::Matrix4d &M,
+            bool textured, bool textureShading);
+
+  std::size_t maxBytes = 256 << 20;
+
+ private:
+  struct Program {
+    GLuint shader = 0;
+    GLCameraUniforms camera;
+    GLint blend = -1, position1 = -1, normal1 = -1;
+  };
+  static void initProgram(Program &program, const char *vertexShaderSrc,
+                          const char *fragmentShaderSrc);
+
+  Program matcap, texture;
+  GLint textureTexLocation = -1, textureUseShadingLocation = -1;
+  GLuint VAO = 0, VBO_V = 0, VBO_N = 0, VBO_T = 0, VBO_F = 0;
+  std::uint64_t signature = 0;
+  bool uploaded = false;
+  int nFrames = 0, nVertices = 0, nIndices = 0;
+  bool hasTexCoords = false;
+};
+
+#endif  // GLMORPH_H
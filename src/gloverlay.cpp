@@ -0,0 +1,330 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gloverlay.h"
+
+#include <miscutils/opengltools.h>
+
+#include "macros.h"
+
+using namespace std;
+using namespace Eigen;
+
+// desktop OpenGL needs these enabled to use gl_PointSize and gl_PointCoord
+#ifndef GL_VERTEX_PROGRAM_POINT_SIZE
+#define GL_VERTEX_PROGRAM_POINT_SIZE 0x8642
+#endif
+#ifndef GL_POINT_SPRITE
+#define GL_POINT_SPRITE 0x8861
+#endif
+
+namespace {
+
+// Both shaders get positions in 3D and the matrix "view" projecting them to
+// pixel coordinates (y pointing down) of the window of size "viewport".
+const char *discVertexShaderSrc =
+    "#version 100\n"
+    "uniform mat4 view;\n"
+    "uniform vec2 viewport;\n"
+    "attribute vec3 position;\n"
+    "attribute vec4 color;\n"
+    "attribute vec2 radii;\n"
+    "varying vec4 fragColor;\n"
+    "varying vec2 fragRadii;\n"
+    "varying float fragSize;\n"
+    "void main() {\n"
+    "  vec4 q = view * vec4(position, 1.0);\n"
+    "  vec2 p = q.xy / q.w;\n"
+    "  fragColor = color;\n"
+    "  fragRadii = radii;\n"
+    "  fragSize = 2.0 * radii.x + 2.0;\n"
+    "  gl_PointSize = fragSize;\n"
+    "  gl_Position = vec4(2.0 * p.x / viewport.x - 1.0,\n"
+    "                     1.0 - 2.0 * p.y / viewport.y, 0.0, 1.0);\n"
+    "}\n";
+// rings have a non-negative inner radius, discs a negative one
+const char *discFragmentShaderSrc =
+    "#version 100\n"
+    "precision mediump float;\n"
+    "varying vec4 fragColor;\n"
+    "varying vec2 fragRadii;\n"
+    "varying float fragSize;\n"
+    "void main() {\n"
+    "  float d = length(gl_PointCoord - vec2(0.5)) * fragSize;\n"
+    "  float a = clamp(fragRadii.x + 0.5 - d, 0.0, 1.0);\n"
+    "  if (fragRadii.y >= 0.0) a *= clamp(d - fragRadii.y + 0.5, 0.0, 1.0);\n"
+    "  if (a <= 0.0) discard;\n"
+    "  gl_FragColor = vec4(fragColor.rgb, fragColor.a * a);\n"
+    "}\n";
+// Each segment is a quad of two triangles. Its vertices know the other end
+// of the segment and are shifted by half of the thickness to the side given
+// by "side" in screen space.
+const char *lineVertexShaderSrc =
+    "#version 100\n"
+    "uniform mat4 view;\n"
+    "uniform vec2 viewport;\n"
+    "uniform float thickness;\n"
+    "attribute vec3 position;\n"
+    "attribute vec3 other;\n"
+    "attribute float side;\n"
+    "void main() {\n"
+    "  vec4 q0 = view * vec4(position, 1.0);\n"
+    "  vec4 q1 = view * vec4(other, 1.0);\n"
+    "  vec2 p0 = q0.xy / q0.w;\n"
+    "  vec2 p1 = q1.xy / q1.w;\n"
+    "  vec2 dir = p1 - p0;\n"
+    "  float len = length(dir);\n"
+    "  dir = len > 1e-6 ? dir / len : vec2(1.0, 0.0);\n"
+    "  vec2 p = p0 + 0.5 * thickness * side * vec2(-dir.y, dir.x);\n"
+    "  gl_Position = vec4(2.0 * p.x / viewport.x - 1.0,\n"
+    "                     1.0 - 2.0 * p.y / viewport.y, 0.0, 1.0);\n"
+    "}\n";
+const char *lineFragmentShaderSrc =
+    "#version 100\n"
+    "precision mediump float;\n"
+    "uniform vec4 color;\n"
+    "void main() {\n"
+    "  gl_FragColor = color;\n"
+    "}\n";
+
+// the largest overlay disc is a selected control point of size 7
+const float maxDiscRadius = 8;
+
+Vector4f toGLColor(const Cu &c) {
+  return Vector4f(c(0), c(1), c(2), c(3)) / 255.f;
+}
+
+}  // namespace
+
+void GLOverlay::init() {
+  discShader = loadShaders(discVertexShaderSrc, discFragmentShaderSrc);
+  lineShader = loadShaders(lineVertexShaderSrc, lineFragmentShaderSrc);
+  glGenVertexArraysOES(1, &VAO);
+  glGenBuffers(1, &VBO_discs);
+  bytesDiscs = 0;
+  GLfloat range[2] = {1, 1};
+  glGetFloatv(GL_ALIASED_POINT_SIZE_RANGE, range);
+  maxPointSize = range[1];
+}
+
+void GLOverlay::destroy() {
+  for (auto &el : trajectories) {
+    glDeleteBuffers(1, &el.second.VBO_lines);
+    glDeleteBuffers(1, &el.second.VBO_points);
+  }
+  trajectories.clear();
+  glDeleteBuffers(1, &VBO_discs);
+  glDeleteVertexArraysOES(1, &VAO);
+  glDeleteProgram(discShader);
+  glDeleteProgram(lineShader);
+}
+
+bool GLOverlay::isSupported() const {
+  return discShader != 0 && maxPointSize >= 2 * maxDiscRadius + 2;
+}
+
+void GLOverlay::begin(const Eigen::Matrix4d &M, int w, int h) {
+  this->M = M;
+  this->w = w;
+  this->h = h;
+  discs.clear();
+  glBindVertexArrayOES(VAO);
+  glDisable(GL_DEPTH_TEST);
+#ifndef __EMSCRIPTEN__
+  glEnable(GL_VERTEX_PROGRAM_POINT_SIZE);
+  glEnable(GL_POINT_SPRITE);
+#endif
+}
+
+void GLOverlay::end() {
+  if (!discs.empty()) {
+    glUseProgram(discShader);
+    setViewUniforms(discShader, M);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO_discs);
+    const GLsizeiptr bytes = discs.size() * sizeof(float);
+    if (bytes <= bytesDiscs) {
+      glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, discs.data());
+    } else {
+      glBufferData(GL_ARRAY_BUFFER, bytes, discs.data(), GL_STREAM_DRAW);
+      bytesDiscs = bytes;
+    }
+    const GLsizei stride = 9 * sizeof(float);
+    const GLint idPos = glGetAttribLocation(discShader, "position");
+    const GLint idColor = glGetAttribLocation(discShader, "color");
+    const GLint idRadii = glGetAttribLocation(discShader, "radii");
+    glVertexAttribPointer(idPos, 3, GL_FLOAT, GL_FALSE, stride, 0);
+    glEnableVertexAttribArray(idPos);
+    glVertexAttribPointer(idColor, 4, GL_FLOAT, GL_FALSE, stride,
+                          reinterpret_cast<void *>(3 * sizeof(float)));
+    glEnableVertexAttribArray(idColor);
+    glVertexAttribPointer(idRadii, 2, GL_FLOAT, GL_FALSE, stride,
+                          reinterpret_cast<void *>(7 * sizeof(float)));
+    glEnableVertexAttribArray(idRadii);
+    glDrawArrays(GL_POINTS, 0, discs.size() / 9);
+    glDisableVertexAttribArray(idColor);
+    glDisableVertexAttribArray(idRadii);
+  }
+  glEnable(GL_DEPTH_TEST);
+}
+
+void GLOverlay::addDisc(const Eigen::Vector3d &p, float r, const Cu &color) {
+  const Vector4f c = toGLColor(color);
+  discs.insert(discs.end(),
+               {static_cast<float>(p(0)), static_cast<float>(p(1)),
+                static_cast<float>(p(2)), c(0), c(1), c(2), c(3),
+                min(r, maxDiscRadius), -1.f});
+}
+
+void GLOverlay::addControlPoint(const Eigen::Vector3d &p, int size,
+                                int thickness, const Cu &colorBg,
+                                const Cu &colorFg) {
+  addDisc(p, size, colorBg);
+  addDisc(p, size - thickness, colorFg);
+}
+
+void GLOverlay::setViewUniforms(GLuint shader, const Eigen::Matrix4d &view) {
+  const Matrix4f viewf = view.cast<float>();
+  glUniformMatrix4fv(glGetUniformLocation(shader, "view"), 1, GL_FALSE,
+                     viewf.data());
+  glUniform2f(glGetUniformLocation(shader, "viewport"), w, h);
+}
+
+void GLOverlay::updateTrajectory(Trajectory &t, CPAnim &anim) {
+  const int n = anim.getLength();
+  vector<float> curr(4 * n);
+  fora(i, 0, n) {
+    const Vector3d p = anim.getPosition(i);
+    fora(j, 0, 3) curr[4 * i + j] = p(j);
+    curr[4 * i + 3] = anim.isDisplayed(i) ? 1 : 0;
+  }
+  if (t.VBO_lines != 0 && curr == t.keyposes) return;
+  t.keyposes.swap(curr);
+
+  if (t.VBO_lines == 0) {
+    glGenBuffers(1, &t.VBO_lines);
+    glGenBuffers(1, &t.VBO_points);
+  }
+
+  // segments from the previous keypose (cyclically) to the current one, each
+  // vertex is the position, the other end and the side (7 floats)
+  vector<float> lines, points;
+  lines.reserve(6 * 7 * n);
+  points.reserve(3 * n);
+  auto addVertex = [&](const Vector3d &p, const Vector3d &o, float side) {
+    lines.insert(lines.end(),
+                 {static_cast<float>(p(0)), static_cast<float>(p(1)),
+                  static_cast<float>(p(2)), static_cast<float>(o(0)),
+                  static_cast<float>(o(1)), static_cast<float>(o(2)), side});
+  };
+  fora(i, 0, n) {
+    const CPAnim::Keypose k0 = anim.getKeypose(i == 0 ? n - 1 : (i - 1));
+    const CPAnim::Keypose k1 = anim.getKeypose(i);
+    if (k1.display) {
+      points.insert(points.end(),
+                    {static_cast<float>(k1.p(0)), static_cast<float>(k1.p(1)),
+                     static_cast<float>(k1.p(2))});
+    }
+    if (!k0.display || !k1.display) continue;
+    // the vertices at k1 see the segment reversed, so their sides are swapped
+    addVertex(k0.p, k1.p, 1);
+    addVertex(k0.p, k1.p, -1);
+    addVertex(k1.p, k0.p, -1);
+    addVertex(k0.p, k1.p, -1);
+    addVertex(k1.p, k0.p, 1);
+    addVertex(k1.p, k0.p, -1);
+  }
+  t.nLineVertices = lines.size() / 7;
+  t.nPoints = points.size() / 3;
+  glBindBuffer(GL_ARRAY_BUFFER, t.VBO_lines);
+  glBufferData(GL_ARRAY_BUFFER, lines.size() * sizeof(float), lines.data(),
+               GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, t.VBO_points);
+  glBufferData(GL_ARRAY_BUFFER, points.size() * sizeof(float), points.data(),
+               GL_DYNAMIC_DRAW);
+}
+
+void GLOverlay::drawTrajectory(int id, CPAnim &anim, int thickness,
+                               double beginningThicknessMult, const Cu &color,
+                               int keyframeRadius) {
+  Trajectory &t = trajectories[id];
+  t.used = true;
+  updateTrajectory(t, anim);
+
+  const Matrix4d T = anim.getTransform();
+  const Matrix4d MT = M * T;
+  const Vector4f c = toGLColor(color);
+
+  // segments
+  if (t.nLineVertices > 0) {
+    glUseProgram(lineShader);
+    setViewUniforms(lineShader, MT);
+    glUniform1f(glGetUniformLocation(lineShader, "thickness"), thickness);
+    glUniform4f(glGetUniformLocation(lineShader, "color"), c(0), c(1), c(2),
+                c(3));
+    glBindBuffer(GL_ARRAY_BUFFER, t.VBO_lines);
+    const GLsizei stride = 7 * sizeof(float);
+    const GLint idPos = glGetAttribLocation(lineShader, "position");
+    const GLint idOther = glGetAttribLocation(lineShader, "other");
+    const GLint idSide = glGetAttribLocation(lineShader, "side");
+    glVertexAttribPointer(idPos, 3, GL_FLOAT, GL_FALSE, stride, 0);
+    glEnableVertexAttribArray(idPos);
+    glVertexAttribPointer(idOther, 3, GL_FLOAT, GL_FALSE, stride,
+                          reinterpret_cast<void *>(3 * sizeof(float)));
+    glEnableVertexAttribArray(idOther);
+    glVertexAttribPointer(idSide, 1, GL_FLOAT, GL_FALSE, stride,
+                          reinterpret_cast<void *>(6 * sizeof(float)));
+    glEnableVertexAttribArray(idSide);
+    glDrawArrays(GL_TRIANGLES, 0, t.nLineVertices);
+    glDisableVertexAttribArray(idOther);
+    glDisableVertexAttribArray(idSide);
+  }
+
+  // keyframes are 1 pixel wide rings, color and radii are constant attributes
+  if (keyframeRadius >= 0 && t.nPoints > 0) {
+    glUseProgram(discShader);
+    setViewUniforms(discShader, MT);
+    glBindBuffer(GL_ARRAY_BUFFER, t.VBO_points);
+    const GLint idPos = glGetAttribLocation(discShader, "position");
+    const GLint idColor = glGetAttribLocation(discShader, "color");
+    const GLint idRadii = glGetAttribLocation(discShader, "radii");
+    glVertexAttribPointer(idPos, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(idPos);
+    glDisableVertexAttribArray(idColor);
+    glVertexAttrib4f(idColor, c(0), c(1), c(2), c(3));
+    glDisableVertexAttribArray(idRadii);
+    glVertexAttrib2f(idRadii, keyframeRadius, keyframeRadius - 1);
+    glDrawArrays(GL_POINTS, 0, t.nPoints);
+  }
+
+  // the disc marking the beginning is drawn with the other discs
+  const int n = anim.getLength();
+  if (n > 0 && anim.isDisplayed(0) && anim.isDisplayed(n - 1)) {
+    const Vector3d p = (T * anim.getPosition(0).homogeneous()).hnormalized();
+    addDisc(p, beginningThicknessMult * thickness, color);
+  }
+}
+
+void GLOverlay::releaseUnusedTrajectories() {
+  for (auto it = trajectories.begin(); it != trajectories.end();) {
+    Trajectory &t = it->second;
+    if (t.used) {
+      t.used = false;
+      ++it;
+    } else {
+      glDeleteBuffers(1, &t.VBO_lines);
+      glDeleteBuffers(1, &t.VBO_points);
+      it = trajectories.erase(it);
+    }
+  }
+}
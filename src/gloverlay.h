@@ -0,0 +1,86 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef GLOVERLAY_H
+#define GLOVERLAY_H
+
+#include <image/image.h>
+
+#include <Eigen/Dense>
+#include <map>
+#include <vector>
+#define GL_GLEXT_PROTOTYPES 1
+#include <SDL_opengles2.h>
+
+#include "cpanim.h"
+
+// Draws the control points and animation trajectories of the geometry mode
+// directly to the window with OpenGL, as a replacement of the SDL2_gfx
+// primitives drawn into the screen image.
+//
+// Discs are collected between begin() and end() and drawn as point sprites
+// with one draw call (OpenGL ES 2.0 has no instancing). Each trajectory keeps
+// its segments and keyframes in vertex buffers which are uploaded again only
+// when its keyposes change, the projection is done in the vertex shader.
+class GLOverlay {
+ public:
+  void init();
+  void destroy();
+  // false if the point sprites are too small for the overlays, then the
+  // software primitives have to be used
+  bool isSupported() const;
+
+  // M projects 3D points to pixel coordinates of a window of size w x h
+  void begin(const Eigen::Matrix4d &M, int w, int h);
+  void end();
+
+  // filled disc of radius r, drawn at end() in the order of the calls
+  void addDisc(const Eigen::Vector3d &p, float r, const Cu &color);
+  // control point as drawn by drawControlPoint() of def3dsdl.h
+  void addControlPoint(const Eigen::Vector3d &p, int size, int thickness,
+                       const Cu &colorBg, const Cu &colorFg);
+
+  // Draws the trajectory of anim as CPAnim::drawTrajectory() and, if
+  // keyframeRadius >= 0, its keyframes as CPAnim::drawKeyframes(). The
+  // buffers are cached by id.
+  void drawTrajectory(int id, CPAnim &anim, int thickness,
+                      double beginningThicknessMult, const Cu &color,
+                      int keyframeRadius = -1);
+  // frees the buffers of the trajectories not drawn since the last call
+  void releaseUnusedTrajectories();
+
+ private:
+  struct Trajectory {
+    GLuint VBO_lines = 0, VBO_points = 0;
+    int nLineVertices = 0, nPoints = 0;
+    // positions and display flags of the keyposes as last uploaded
+    std::vector<float> keyposes;
+    bool used = false;
+  };
+
+  void updateTrajectory(Trajectory &t, CPAnim &anim);
+  void setViewUniforms(GLuint shader, const Eigen::Matrix4d &view);
+
+  GLuint VAO = 0, VBO_discs = 0;
+  GLuint discShader = 0, lineShader = 0;
+  float maxPointSize = 1;
+  Eigen::Matrix4d M = Eigen::Matrix4d::Identity();
+  int w = 1, h = 1;
+  // per disc: position (3), color (4), outer and inner radius (2)
+  std::vector<float> discs;
+  GLsizeiptr bytesDiscs = 0;
+  std::map<int, Trajectory> trajectories;
+};
+
+#endif  // GLOVERLAY_H
@@ -0,0 +1,242 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "glpicker.h"
+
+#include <cmath>
+#include <vector>
+
+#include "macros.h"
+
+using namespace std;
+using namespace Eigen;
+
+namespace {
+
+// "view" projects to pixel coordinates, the result is shifted so that the
+// pixel "pick" is in the center of the 1x1 viewport. Faces (radius = 0) keep
+// their homogeneous coordinates to be clipped properly. Control points are
+// cones of the given radius in pixels with the apex nearest to the viewer,
+// the nearest control point in the projection plane wins the depth test.
+const char *vertexShaderSrc =
+    "#version 100\n"
+    "uniform mat4 view;\n"
+    "uniform vec2 pick;\n"
+    "uniform float radius;\n"
+    "attribute vec3 position;\n"
+    "attribute vec3 offset;\n"
+    "attribute float partId;\n"
+    "varying vec3 fragColor;\n"
+    "void main() {\n"
+    "  vec4 q = view * vec4(position, 1.0);\n"
+    "  float id = partId + 1.0;\n"
+    "  fragColor = vec3(mod(id, 256.0), mod(floor(id / 256.0), 256.0),\n"
+    "                   floor(id / 65536.0)) / 255.0;\n"
+    "  if (radius > 0.0) {\n"
+    "    vec2 p = q.xy / q.w + radius * offset.xy - pick;\n"
+    "    gl_Position = vec4(2.0 * p.x, -2.0 * p.y, offset.z, 1.0);\n"
+    "  } else {\n"
+    "    gl_Position = vec4(2.0 * (q.x - pick.x * q.w),\n"
+    "                       -2.0 * (q.y - pick.y * q.w), q.z, q.w);\n"
+    "  }\n"
+    "}\n";
+const char *fragmentShaderSrc =
+    "#version 100\n"
+    "precision mediump float;\n"
+    "varying vec3 fragColor;\n"
+    "void main() {\n"
+    "  gl_FragColor = vec4(fragColor, 1.0);\n"
+    "}\n";
+
+const int coneSegments = 16;
+
+}  // namespace
+
+void GLPicker::init() {
+  shader = loadShaders(vertexShaderSrc, fragmentShaderSrc);
+  GLMeshInitBuffers(faces);
+  facesVersion = UINT64_MAX;
+  glGenVertexArraysOES(1, &VAO_cps);
+  glGenBuffers(1, &VBO_cps);
+  bytesCPs = 0;
+
+  GLint prevTexture = 0;
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &prevTexture);
+  glGenTextures(1, &colorTexture);
+  glBindTexture(GL_TEXTURE_2D, colorTexture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+               nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glBindTexture(GL_TEXTURE_2D, prevTexture);
+  glGenRenderbuffers(1, &depthRenderbuffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, depthRenderbuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, 1, 1);
+  glGenFramebuffers(1, &FBO);
+  glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                         colorTexture, 0);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                            GL_RENDERBUFFER, depthRenderbuffer);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    DEBUG_CMD_MM(cerr << "GLPicker: incomplete framebuffer" << endl;);
+    glDeleteProgram(shader);
+    shader = 0;
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void GLPicker::destroy() {
+  GLMeshDestroyBuffers(faces);
+  glDeleteBuffers(1, &VBO_cps);
+  glDeleteVertexArraysOES(1, &VAO_cps);
+  glDeleteFramebuffers(1, &FBO);
+  glDeleteRenderbuffers(1, &depthRenderbuffer);
+  glDeleteTextures(1, &colorTexture);
+  glDeleteProgram(shader);
+  shader = 0;
+}
+
+bool GLPicker::isReady() const { return shader != 0; }
+
+void GLPicker::beginPass(double x, double y, bool highest) {
+  glGetIntegerv(GL_VIEWPORT, prevViewport);
+  glGetFloatv(GL_COLOR_CLEAR_VALUE, prevClearColor);
+  glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+  glViewport(0, 0, 1, 1);
+  glDisable(GL_BLEND);
+  glEnable(GL_DEPTH_TEST);
+  glDepthFunc(highest ? GL_GREATER : GL_LESS);
+  glClearColor(0, 0, 0, 0);
+  glClearDepthf(highest ? 0 : 1);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  glUseProgram(shader);
+  glUniform2f(glGetUniformLocation(shader, "pick"), x, y);
+}
+
+int GLPicker::endPass() {
+  unsigned char rgba[4] = {0, 0, 0, 0};
+  glReadPixels(0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+
+  // restore the state expected by the rest of the rendering
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(prevViewport[0], prevViewport[1], prevViewport[2],
+             prevViewport[3]);
+  glDisable(GL_CULL_FACE);
+  glDepthFunc(GL_LESS);
+  glClearColor(prevClearColor[0], prevClearColor[1], prevClearColor[2],
+               prevClearColor[3]);
+  glClearDepthf(1);
+  glEnable(GL_BLEND);
+
+  return rgba[0] + 256 * rgba[1] + 65536 * rgba[2] - 1;
+}
+
+int GLPicker::pickFace(const MatrixXd &V, const MatrixXi &F,
+                       std::uint64_t meshVersion, const Matrix4d &M, double x,
+                       double y, bool highest, bool reverse) {
+  if (!isReady() || F.rows() == 0) return -1;
+
+  // each face gets its own vertices to carry its id
+  const bool changed = meshVersion != facesVersion;
+  if (changed) {
+    const int nF = F.rows();
+    facesV.resize(3 * nF, 3);
+    fora(i, 0, nF) fora(j, 0, 3) facesV.row(3 * i + j) = V.row(F(i, j));
+    if (facesF.rows() != nF) {
+      facesF.resize(nF, 3);
+      facesPartId.resize(3 * nF, 1);
+      fora(i, 0, nF) fora(j, 0, 3) {
+        facesF(i, j) = 3 * i + j;
+        facesPartId(3 * i + j) = i;
+      }
+    }
+    facesVersion = meshVersion;
+  }
+
+  beginPass(x, y, highest);
+  glUniform1f(glGetUniformLocation(shader, "radius"), 0);
+  const Matrix4f Mf = M.cast<float>();
+  glUniformMatrix4fv(glGetUniformLocation(shader, "view"), 1, GL_FALSE,
+                     Mf.data());
+  if (changed) {
+    GLMeshFillBuffers(faces, facesV, facesF, MatrixXd(), MatrixXd(),
+                      MatrixXd(), facesPartId, true);
+  }
+  // the faces picked by Mesh3D::getMeshFace are counter-clockwise on the
+  // screen after flipping the y axis of the pixel coordinates
+  glEnable(GL_CULL_FACE);
+  glFrontFace(GL_CCW);
+  glCullFace(reverse ? GL_FRONT : GL_BACK);
+  glVertexAttrib3f(glGetAttribLocation(shader, "offset"), 0, 0, 0);
+  GLMeshDraw(faces, GL_TRIANGLES);
+  return endPass();
+}
+
+int GLPicker::pickControlPoint(const Def3D &def, const Matrix4d &M, double x,
+                               double y, double radius) {
+  const auto &cps = def.getCPs();
+  if (!isReady() || cps.empty() || radius <= 0) return -1;
+
+  // per vertex: position (3), offset (3), control point id (1)
+  vector<float> data;
+  data.reserve(cps.size() * coneSegments * 3 * 7);
+  for (const auto &it : cps) {
+    const Vector3d &p = it.second.pos;
+    const float id = it.first;
+    auto addVertex = [&](float ox, float oy, float oz) {
+      data.insert(data.end(),
+                  {static_cast<float>(p(0)), static_cast<float>(p(1)),
+                   static_cast<float>(p(2)), ox, oy, oz, id});
+    };
+    fora(i, 0, coneSegments) {
+      const double a0 = 2 * M_PI * i / coneSegments;
+      const double a1 = 2 * M_PI * (i + 1) / coneSegments;
+      addVertex(0, 0, -1);
+      addVertex(cos(a0), sin(a0), 1);
+      addVertex(cos(a1), sin(a1), 1);
+    }
+  }
+
+  beginPass(x, y, false);
+  // the cones are circumscribed about the circle of the given radius
+  glUniform1f(glGetUniformLocation(shader, "radius"),
+              radius / cos(M_PI / coneSegments));
+  const Matrix4f Mf = M.cast<float>();
+  glUniformMatrix4fv(glGetUniformLocation(shader, "view"), 1, GL_FALSE,
+                     Mf.data());
+  glBindVertexArrayOES(VAO_cps);
+  glBindBuffer(GL_ARRAY_BUFFER, VBO_cps);
+  const GLsizeiptr bytes = data.size() * sizeof(float);
+  if (bytes <= bytesCPs) {
+    glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, data.data());
+  } else {
+    glBufferData(GL_ARRAY_BUFFER, bytes, data.data(), GL_STREAM_DRAW);
+    bytesCPs = bytes;
+  }
+  const GLsizei stride = 7 * sizeof(float);
+  const GLint idPos = glGetAttribLocation(shader, "position");
+  const GLint idOffset = glGetAttribLocation(shader, "offset");
+  const GLint idPartId = glGetAttribLocation(shader, "partId");
+  glVertexAttribPointer(idPos, 3, GL_FLOAT, GL_FALSE, stride, 0);
+  glEnableVertexAttribArray(idPos);
+  glVertexAttribPointer(idOffset, 3, GL_FLOAT, GL_FALSE, stride,
+                        reinterpret_cast<void *>(3 * sizeof(float)));
+  glEnableVertexAttribArray(idOffset);
+  glVertexAttribPointer(idPartId, 1, GL_FLOAT, GL_FALSE, stride,
+                        reinterpret_cast<void *>(6 * sizeof(float)));
+  glEnableVertexAttribArray(idPartId);
+  glDrawArrays(GL_TRIANGLES, 0, data.size() / 7);
+  return endPass();
+}
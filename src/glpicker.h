@@ -0,0 +1,66 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef GLPICKER_H
+#define GLPICKER_H
+
+#include <miscutils/def3d.h>
+#include <miscutils/opengltools.h>
+
+#include <Eigen/Dense>
+#include <cstdint>
+#define GL_GLEXT_PROTOTYPES 1
+#include <SDL_opengles2.h>
+
+// Picks mesh faces and control points on the GPU as an alternative to
+// Mesh3D::getMeshFace and Def3D::getControlPoint.
+//
+// The ids are rendered (encoded in RGB) into a 1x1 offscreen framebuffer
+// covering just the picked pixel and read back with glReadPixels. M projects
+// 3D points to pixel coordinates (y pointing down) as proj3DView does, the
+// results match the CPU picking with the same arguments up to the pixels on
+// the edges of the faces.
+class GLPicker {
+ public:
+  void init();
+  void destroy();
+  bool isReady() const;
+
+  // Returns the face of V, F at [x,y] or -1. The mesh is uploaded again only
+  // if meshVersion changes. See Mesh3D::getMeshFace for highest and reverse.
+  int pickFace(const Eigen::MatrixXd &V, const Eigen::MatrixXi &F,
+               std::uint64_t meshVersion, const Eigen::Matrix4d &M, double x,
+               double y, bool highest, bool reverse);
+  // Returns the id of the control point of def nearest to [x,y] in the
+  // projection plane within radius pixels or -1.
+  int pickControlPoint(const Def3D &def, const Eigen::Matrix4d &M, double x,
+                       double y, double radius);
+
+ private:
+  void beginPass(double x, double y, bool highest);
+  int endPass();
+
+  GLuint shader = 0, FBO = 0, colorTexture = 0, depthRenderbuffer = 0;
+  GLuint VAO_cps = 0, VBO_cps = 0;
+  GLsizeiptr bytesCPs = 0;
+  // the faces as separate triangles with their ids as part ids
+  GLMeshData faces;
+  std::uint64_t facesVersion = UINT64_MAX;
+  Eigen::MatrixXd facesV;
+  Eigen::MatrixXi facesF, facesPartId;
+  GLint prevViewport[4];
+  GLfloat prevClearColor[4];
+};
+
+#endif  // GLPICKER_H
@@ -0,0 +1,133 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "inputsession.h"
+
+#include <sstream>
+
+using namespace std;
+
+static const char *const header = "mmsession 1";
+
+bool InputSessionRecorder::open(const std::string &fn) {
+  close();
+  stream.open(fn);
+  if (!stream.is_open()) return false;
+  stream << header << "\n";
+  startMs = SDL_GetTicks();
+  tickHasEvents = false;
+  return true;
+}
+
+bool InputSessionRecorder::isOpen() const { return stream.is_open(); }
+
+void InputSessionRecorder::addEvent(const SDL_Event &event) {
+  if (!stream.is_open()) return;
+  const Uint32 ms = event.common.timestamp - startMs;
+  switch (event.type) {
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+      stream << "e " << ms << " key " << (event.type == SDL_KEYDOWN) << " "
+             << event.key.keysym.sym << " " << event.key.keysym.mod << "\n";
+      break;
+    case SDL_MOUSEMOTION:
+      stream << "e " << ms << " motion " << event.motion.x << " "
+             << event.motion.y << " " << event.motion.state << " "
+             << event.motion.which << "\n";
+      break;
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP:
+      stream << "e " << ms << " button "
+             << (event.type == SDL_MOUSEBUTTONDOWN) << " " << event.button.x
+             << " " << event.button.y << " "
+             << static_cast<int>(event.button.button) << " "
+             << static_cast<int>(event.button.clicks) << " "
+             << event.button.which << "\n";
+      break;
+    case SDL_FINGERMOTION:
+    case SDL_FINGERDOWN:
+    case SDL_FINGERUP:
+      stream << "e " << ms << " finger " << event.type << " "
+             << event.tfinger.x << " " << event.tfinger.y << " "
+             << event.tfinger.fingerId << "\n";
+      break;
+    default:
+      return;
+  }
+  tickHasEvents = true;
+}
+
+void InputSessionRecorder::endTick(bool painted, double ms) {
+  if (!stream.is_open() || (!painted && !tickHasEvents)) return;
+  stream << "t " << painted << " " << ms << "\n";
+  tickHasEvents = false;
+}
+
+void InputSessionRecorder::close() {
+  if (stream.is_open()) stream.close();
+}
+
+bool loadInputSession(const std::string &fn,
+                      std::vector<InputSessionTick> &ticks) {
+  ifstream stream(fn);
+  string line;
+  if (!getline(stream, line) || line != header) return false;
+  ticks.clear();
+  InputSessionTick tick;
+  while (getline(stream, line)) {
+    istringstream iss(line);
+    string kind;
+    iss >> kind;
+    if (kind == "t") {
+      iss >> tick.painted >> tick.ms;
+      if (!iss) return false;
+      ticks.push_back(tick);
+      tick = InputSessionTick();
+      continue;
+    }
+    if (kind != "e") return false;
+    Uint32 ms;
+    string type;
+    iss >> ms >> type;
+    SDL_Event event;
+    SDL_zero(event);
+    if (type == "key") {
+      int down, sym, mod;
+      iss >> down >> sym >> mod;
+      event.type = down ? SDL_KEYDOWN : SDL_KEYUP;
+      event.key.keysym.sym = sym;
+      event.key.keysym.mod = mod;
+    } else if (type == "motion") {
+      iss >> event.motion.x >> event.motion.y >> event.motion.state >>
+          event.motion.which;
+      event.type = SDL_MOUSEMOTION;
+    } else if (type == "button") {
+      int down, button, clicks;
+      iss >> down >> event.button.x >> event.button.y >> button >> clicks >>
+          event.button.which;
+      event.type = down ? SDL_MOUSEBUTTONDOWN : SDL_MOUSEBUTTONUP;
+      event.button.button = button;
+      event.button.clicks = clicks;
+    } else if (type == "finger") {
+      iss >> event.type >> event.tfinger.x >> event.tfinger.y >>
+          event.tfinger.fingerId;
+    } else {
+      return false;
+    }
+    if (!iss) return false;
+    event.common.timestamp = ms;
+    tick.events.push_back(event);
+  }
+  return true;
+}
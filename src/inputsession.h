@@ -0,0 +1,66 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INPUTSESSION_H
+#define INPUTSESSION_H
+
+#include <SDL.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Input sessions: the SDL input events handled by the main loop of MyWindow
+// grouped by the ticks of the loop they were handled in, with the time the
+// paint of each tick took. A session is replayed by handling the events of
+// each tick in the same order followed by the paint of the tick (see
+// MyWindow::startRecording() and MyWindow::replay()).
+//
+// The file is text with a line per event and per tick, the events of a tick
+// precede its line:
+//   mmsession 1
+//   e <ms> key <down> <sym> <mod>
+//   e <ms> motion <x> <y> <state> <which>
+//   e <ms> button <down> <x> <y> <button> <clicks> <which>
+//   e <ms> finger <type> <x> <y> <fingerId>
+//   t <painted> <paint ms>
+// Event times are in ms since the start of the recording, the coordinates of
+// finger events are normalized to [0, 1]. Ticks without events that did not
+// paint are not stored.
+
+struct InputSessionTick {
+  std::vector<SDL_Event> events;
+  bool painted = false;
+  double ms = 0;
+};
+
+class InputSessionRecorder {
+ public:
+  bool open(const std::string &fn);
+  bool isOpen() const;
+  // input events are stored, other ones are ignored
+  void addEvent(const SDL_Event &event);
+  void endTick(bool painted, double ms);
+  void close();
+
+ private:
+  std::ofstream stream;
+  Uint32 startMs = 0;
+  bool tickHasEvents = false;
+};
+
+bool loadInputSession(const std::string &fn,
+                      std::vector<InputSessionTick> &ticks);
+
+#endif  // INPUTSESSION_H
@@ -20,12 +20,32 @@
 #include <zip.h>
 
 #include <Eigen/Dense>
+#include <algorithm>
+#include <cstdint>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <tuple>
 #include <unordered_map>
 #include <vector>
 
+#ifndef __EMSCRIPTEN__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "binarychunks.h"
 #include "macros.h"
+#include "perfprofile.h"
+#include "reconstruction.h"
+#include "rlecodec.h"
+#include "tracing.h"
 
 using namespace std;
 using namespace Eigen;
@@ -48,60 +68,61 @@ bool saveControlPointsToFile(const std::string &fn,
   return true;
 }
 
-bool saveControlPointsToZip(zip_t *zip, const std::string &fn,
-                            const ManipulationMode &manipulationMode,
-                            const std::string &savedCPs, CPData &cpData,
-                            DefData &defData, ImgData &imgData) {
-  stringstream stream;
-  if (manipulationMode.isGeometryModeActive()) {
-    // in deform mode, get control points directly from Def3D
-    saveControlPointsToStream(stream, cpData, defData, imgData);
-  } else {
-    // in drawing mode, control points are stored in savedCPs
-    stream << savedCPs;
-  }
-  const string &str = stream.str();
-  const char *data = str.c_str();
-  zip_entry_open(zip, fn.c_str());
-  zip_entry_write(zip, data, str.length());
-  zip_entry_close(zip);
-  return true;
-}
+// a control point as saved, in the (text or binary) order of the file
+struct SavedCP {
+  int ptId, partId, regId, isBackPart;
+  Vector3d rest, pos;
+};
 
-bool saveControlPointsToStream(std::ostream &stream, CPData &cpData,
-                               DefData &defData, ImgData &imgData) {
-  auto &selectedPoints = cpData.selectedPoints;
-  auto &selectedPoint = cpData.selectedPoint;
-  auto &cpsAnim = cpData.cpsAnim;
-  auto &cpsAnimSyncId = cpData.cpsAnimSyncId;
+static const char cpsMagic[4] = {'M', 'M', 'C', 'P'};
+// 2: animations sharing the keyposes of an earlier one (ASHR)
+static const uint32_t cpsVersion = 2;
+
+// the control points of def in the order of the file, with the map of their
+// ids to the index in that order
+static vector<SavedCP> collectControlPoints(
+    DefData &defData, ImgData &imgData, unordered_map<int, int> &cpId2IncId) {
   auto &def = defData.def;
   auto &verticesOfParts = defData.verticesOfParts;
   auto &layers = imgData.layers;
   auto &mesh = defData.mesh;
 
-  stream << "v. " << APP_VERSION << endl;
-  if (def.getCPs().empty()) return true;
-
   vector<int> vertex2part(mesh.getNumPoints());
   forlist(i, verticesOfParts) forlist(j, verticesOfParts[i])
       vertex2part[verticesOfParts[i][j]] = i;
-  stream << static_cast<int>(def.getCPs().size()) << endl;
-  unordered_map<int, int> cpId2IncId;  // cpId to incremental id
-
-  int i = 0;
+  vector<SavedCP> cps;
   for (const auto &it : def.getCPs()) {
     const int cpId = it.first;
-    auto &cp = *it.second;
+    const auto &cp = it.second;
     const int ptId = cp.ptId;
-    const auto &pr = mesh.VRest.row(ptId);
     const int partId = vertex2part[ptId];
     const int isBackPart = partId % 2;
     const int layerId = partId / 2;
     const int regId = layers[layerId];
-    stream << ptId << " " << partId << " " << regId << " " << isBackPart << " "
-           << pr << " " << cp.pos.transpose() << endl;
-    cpId2IncId[cpId] = i;
-    i++;
+    cpId2IncId[cpId] = cps.size();
+    cps.push_back({ptId, partId, regId, isBackPart,
+                   mesh.VRest.row(ptId).transpose(), cp.pos});
+  }
+  return cps;
+}
+
+bool saveControlPointsToStream(std::ostream &stream, CPData &cpData,
+                               DefData &defData, ImgData &imgData) {
+  auto &cpsAnim = cpData.cpsAnim;
+  auto &cpsAnimSyncId = cpData.cpsAnimSyncId;
+  auto &def = defData.def;
+
+  stream << "v. " << APP_VERSION << endl;
+  if (def.getCPs().empty()) return true;
+
+  unordered_map<int, int> cpId2IncId;  // cpId to incremental id
+  const vector<SavedCP> cps =
+      collectControlPoints(defData, imgData, cpId2IncId);
+  stream << static_cast<int>(cps.size()) << endl;
+  for (const SavedCP &cp : cps) {
+    stream << cp.ptId << " " << cp.partId << " " << cp.regId << " "
+           << cp.isBackPart << " " << cp.rest.transpose() << " "
+           << cp.pos.transpose() << endl;
   }
 
   // save cps anim
@@ -117,8 +138,141 @@ bool saveControlPointsToStream(std::ostream &stream, CPData &cpData,
   return true;
 }
 
+bool saveControlPointsToBinary(std::string &data, CPData &cpData,
+                               DefData &defData, ImgData &imgData) {
+  auto &cpsAnim = cpData.cpsAnim;
+  auto &cpsAnimSyncId = cpData.cpsAnimSyncId;
+
+  BinaryWriter writer(cpsMagic, cpsVersion);
+  unordered_map<int, int> cpId2IncId;  // cpId to incremental id
+  const vector<SavedCP> cps =
+      collectControlPoints(defData, imgData, cpId2IncId);
+  if (!cps.empty()) {
+    writer.beginChunk("CPTS");
+    writer.writeU32(cps.size());
+    for (const SavedCP &cp : cps) {
+      writer.writeI32(cp.ptId);
+      writer.writeI32(cp.partId);
+      writer.writeI32(cp.regId);
+      writer.writeI32(cp.isBackPart);
+      fora(k, 0, 3) writer.writeF64(cp.rest(k));
+      fora(k, 0, 3) writer.writeF64(cp.pos(k));
+    }
+    writer.endChunk();
+
+    // the animation whose keyposes each one shares (-1 for none), e.g. a
+    // clip pasted to many CPs is saved once
+    vector<int> sharedWith;
+    vector<const CPAnim *> distinct;
+    vector<int> distinctInd;
+    for (auto &it : cpsAnim) {
+      const CPAnim &cpAnim = it.second;
+      int source = -1;
+      if (cpAnim.getLength() > 0) {
+        forlist(d, distinct) {
+          if (cpAnim.sharesKeyposes(*distinct[d])) {
+            source = distinctInd[d];
+            break;
+          }
+        }
+        if (source == -1) {
+          distinct.push_back(&cpAnim);
+          distinctInd.push_back(sharedWith.size());
+        }
+      }
+      sharedWith.push_back(source);
+    }
+
+    // per animation: the control point, timing and keyposes (position and
+    // timestamp), none for the shared ones
+    writer.beginChunk("ANIM");
+    writer.writeI32(cpId2IncId[cpsAnimSyncId]);
+    writer.writeU32(cpsAnim.size());
+    int animInd = 0;
+    for (auto &it : cpsAnim) {
+      CPAnim &cpAnim = it.second;
+      const int length =
+          sharedWith[animInd++] == -1 ? cpAnim.getLength() : 0;
+      writer.writeI32(cpId2IncId[it.first]);
+      writer.writeF64(cpAnim.getTemporalScalingFactor());
+      writer.writeF64(cpAnim.getOffset());
+      writer.writeU32(cpAnim.haveTimestamps() ? 1 : 0);
+      writer.writeU32(length);
+      fora(t, 0, length) {
+        const CPAnim::Keypose k = cpAnim.getKeypose(t);
+        fora(j, 0, 3) writer.writeF64(k.p(j));
+        writer.writeI32(k.timestamp);
+      }
+    }
+    writer.endChunk();
+
+    // layers of the animations (see CPAnim): the index of the animation in
+    // ANIM, per layer its weight and per keypose whether it was recorded
+    // and the position
+    int numLayered = 0;
+    animInd = 0;
+    for (auto &it : cpsAnim) {
+      if (it.second.getNumLayers() > 0 && sharedWith[animInd] == -1) {
+        numLayered++;
+      }
+      animInd++;
+    }
+    if (numLayered > 0) {
+      writer.beginChunk("ALYR");
+      writer.writeU32(numLayered);
+      animInd = 0;
+      for (auto &it : cpsAnim) {
+        CPAnim &cpAnim = it.second;
+        const int numLayers = cpAnim.getNumLayers();
+        if (numLayers > 0 && sharedWith[animInd] == -1) {
+          writer.writeU32(animInd);
+          writer.writeU32(numLayers);
+          fora(l, 0, numLayers) {
+            writer.writeF64(cpAnim.getLayerWeight(l));
+            fora(t, 0, cpAnim.getLength()) {
+              writer.writeU32(cpAnim.isLayerEmpty(l, t) ? 0 : 1);
+              const Vector3d p = cpAnim.getLayerPosition(l, t);
+              fora(j, 0, 3) writer.writeF64(p(j));
+            }
+          }
+        }
+        animInd++;
+      }
+      writer.endChunk();
+    }
+
+    // the animations sharing keyposes: the index of the animation and of
+    // the one saved with the keyposes, the shift relative to that one and
+    // the weights of the layers
+    const int numShared =
+        sharedWith.size() - count(sharedWith.begin(), sharedWith.end(), -1);
+    if (numShared > 0) {
+      vector<const CPAnim *> anims;
+      for (auto &it : cpsAnim) anims.push_back(&it.second);
+      writer.beginChunk("ASHR");
+      writer.writeU32(numShared);
+      forlist(i, sharedWith) {
+        if (sharedWith[i] == -1) continue;
+        const CPAnim &cpAnim = *anims[i];
+        writer.writeU32(i);
+        writer.writeU32(sharedWith[i]);
+        const Vector3d shift =
+            cpAnim.getShift() - anims[sharedWith[i]]->getShift();
+        fora(k, 0, 3) writer.writeF64(shift(k));
+        writer.writeU32(cpAnim.getNumLayers());
+        fora(l, 0, cpAnim.getNumLayers()) {
+          writer.writeF64(cpAnim.getLayerWeight(l));
+        }
+      }
+      writer.endChunk();
+    }
+  }
+  data = writer.data();
+  return true;
+}
+
 bool loadControlPointsFromFile(const std::string &fn, std::string &savedCPs) {
-  ifstream stream(fn);
+  ifstream stream(fn, ios::binary);
   if (!stream.is_open()) return false;
   savedCPs.assign((istreambuf_iterator<char>(stream)),
                   (istreambuf_iterator<char>()));
@@ -140,18 +294,134 @@ bool loadControlPointsFromZip(zip_t *zip, const std::string &fn,
   return true;
 }
 
-bool loadControlPointsFromStream(std::istream &stream, CPData &cpData,
-                                 DefData &defData, ImgData &imgData) {
+// Adds the saved control points to def (the ones whose regions still exist)
+// with their animations (if hasAnims), indexed by the order of cps. The
+// selected points are updated to the new ids.
+static void applyControlPoints(const vector<SavedCP> &cps, bool hasAnims,
+                               int cpsAnimSyncId,
+                               vector<pair<int, CPAnim>> &anims,
+                               CPData &cpData, DefData &defData,
+                               ImgData &imgData) {
   auto &selectedPoints = cpData.selectedPoints;
   auto &selectedPoint = cpData.selectedPoint;
   auto &cpsAnim = cpData.cpsAnim;
-  auto &cpsAnimSyncId = cpData.cpsAnimSyncId;
   auto &def = defData.def;
   auto &verticesOfParts = defData.verticesOfParts;
   auto &regionImgs = imgData.regionImgs;
   auto &layers = imgData.layers;
   auto &mesh = defData.mesh;
 
+  const int num = cps.size();
+  vector<int> cpId2NewCPId(num);
+  forlist(i, cpId2NewCPId) cpId2NewCPId[i] = i;
+  fora(i, 0, num) {
+    const SavedCP &saved = cps[i];
+    const int regId = saved.regId;
+    const Vector3d &r = saved.rest;
+    DEBUG_CMD_MM(cout << "loaded CP: " << saved.ptId << " " << saved.partId
+                      << " " << regId << " " << saved.isBackPart << " "
+                      << r.transpose() << " " << saved.pos.transpose();)
+    bool res = true;
+    if (regId < 0 || regId >= regionImgs.size() ||
+        regionImgs[regId].isNull()) {
+      res = false;
+      DEBUG_CMD_MM(cout << " region does not exist";)
+    } else {
+      int layerId = -1;
+      forlist(i, layers) if (layers[i] == regId) {
+        layerId = i;
+        break;
+      }
+      const int partId = 2 * layerId + saved.isBackPart;
+      if (partId >= 0 && partId < verticesOfParts.size()) {
+        MatrixXd VPart(verticesOfParts[partId].size(), 3);
+        fora(j, 0, VPart.rows()) VPart.row(j) =
+            mesh.VRest.row(verticesOfParts[partId][j]);
+        int cpInd;
+        const double maxRadius = 25;
+        if (!def.addControlPointExhaustive(VPart, r(0), r(1), maxRadius, r(2),
+                                           false, cpInd)) {
+          res = false;
+        } else {
+          try {
+            auto cp = def.getCP(cpInd);
+            // ptId is an index into VPart
+            cp.ptId = verticesOfParts[partId][cp.ptId];
+            cp.pos = cp.prevPos = saved.pos;
+          } catch (out_of_range &e) {
+            cerr << e.what() << endl;
+          }
+        }
+      } else {
+        res = false;
+      }
+      if (!res) DEBUG_CMD_MM(cout << " failed";)
+    }
+    if (!res) {
+      cpId2NewCPId[i] = -1;
+      fora(j, i + 1, num) cpId2NewCPId[j]--;
+      DEBUG_CMD_MM(cout << " (skipping)";)
+    }
+    DEBUG_CMD_MM(cout << endl;)
+  }
+  auto newCPId = [&](int cpInd) {
+    return cpInd >= 0 && cpInd < num ? cpId2NewCPId[cpInd] : -1;
+  };
+
+  // cps anim
+  if (hasAnims) {
+    cpData.cpsAnimSyncId = newCPId(cpsAnimSyncId);
+    for (auto &anim : anims) {
+      const int cpIndOrig = anim.first;
+      const int cpInd = newCPId(cpIndOrig);
+      if (cpInd == -1) {
+        DEBUG_CMD_MM(cout << "skipping cpAnim " << cpIndOrig << endl;)
+        continue;
+      }
+      DEBUG_CMD_MM(cout << "cpAnim for cp " << cpIndOrig << "->" << cpInd
+                        << " exists";)
+      const auto &cps = def.getCPs();
+      if (cps.find(cpInd) != cps.end()) {
+        cpsAnim[cpInd] = std::move(anim.second);
+      } else {
+        DEBUG_CMD_MM(cout << " - failed: cp does not exist";);
+      }
+      DEBUG_CMD_MM(cout << endl;)
+    }
+    // the sync animation and its timeline as the playback would set them up
+    const auto &itSync = cpsAnim.find(cpData.cpsAnimSyncId);
+    if (itSync != cpsAnim.end()) {
+      cpData.cpAnimSync = CPAnimSync(itSync->second.getLength());
+    } else if (!cpsAnim.empty()) {
+      cpData.cpsAnimSyncId = cpsAnim.begin()->first;
+      cpData.cpAnimSync = CPAnimSync(cpsAnim.begin()->second.getLength());
+    } else {
+      cpData.cpsAnimSyncId = -1;
+      cpData.cpAnimSync = CPAnimSync();
+    }
+    DEBUG_CMD_MM(cout << "cpsAnimSyncId: " << cpData.cpsAnimSyncId << endl;)
+  }
+
+  // update selected points
+  const auto &defCPs = def.getCPs();
+  set<int> selectedPointsNew;
+  for (int cpId : selectedPoints) {
+    const int newId = newCPId(cpId);
+    if (newId != -1 && defCPs.find(newId) != defCPs.end()) {
+      selectedPointsNew.insert(newId);
+    }
+  }
+  selectedPoints = selectedPointsNew;
+  if (selectedPoint != -1) {
+    const int newId = newCPId(selectedPoint);
+    if (newId != -1 && defCPs.find(newId) != defCPs.end()) {
+      selectedPoint = newId;
+    }
+  }
+}
+
+bool loadControlPointsFromStream(std::istream &stream, CPData &cpData,
+                                 DefData &defData, ImgData &imgData) {
   string versionStr;
   int version;
   stream >> versionStr >> version;
@@ -166,114 +436,215 @@ bool loadControlPointsFromStream(std::istream &stream, CPData &cpData,
 
   int num = -1;
   stream >> num;
-  if (num != -1) {
-    vector<int> cpId2NewCPId(num);
-    forlist(i, cpId2NewCPId) cpId2NewCPId[i] = i;
+  if (num == -1) return true;
+  vector<SavedCP> cps(max(num, 0));
+  for (SavedCP &cp : cps) {
+    Vector3d &r = cp.rest, &pos = cp.pos;
+    if (version < 200610) {
+      stream >> cp.ptId >> cp.partId >> r(0) >> r(1) >> r(2) >> pos(0) >>
+          pos(1) >> pos(2);
+      cp.regId = cp.partId / 2;
+      cp.isBackPart = cp.partId % 2;
+    } else {
+      stream >> cp.ptId >> cp.partId >> cp.regId >> cp.isBackPart >> r(0) >>
+          r(1) >> r(2) >> pos(0) >> pos(1) >> pos(2);
+    }
+  }
+
+  // cps anim
+  vector<pair<int, CPAnim>> anims;
+  int cpsAnimSyncId = -1;
+  num = -1;
+  stream >> num;
+  const bool hasAnims = num != -1;
+  if (hasAnims) {
+    stream >> cpsAnimSyncId;
     fora(i, 0, num) {
-      double x1, y1, z1, x2, y2, z2;
-      int ptId, partIdOrig, regId, isBackPart;
-      if (version < 200610) {
-        stream >> ptId >> partIdOrig >> x1 >> y1 >> z1 >> x2 >> y2 >> z2;
-        regId = partIdOrig / 2;
-        isBackPart = partIdOrig % 2;
-      } else {
-        stream >> ptId >> partIdOrig >> regId >> isBackPart >> x1 >> y1 >> z1 >>
-            x2 >> y2 >> z2;
+      int cpInd;
+      stream >> cpInd;
+      CPAnim cpAnim;
+      stream >> cpAnim;
+      anims.emplace_back(cpInd, cpAnim);
+    }
+  }
+
+  applyControlPoints(cps, hasAnims, cpsAnimSyncId, anims, cpData, defData,
+                     imgData);
+  return true;
+}
+
+// reads the data of saveControlPointsToBinary() directly from the buffer
+static bool loadControlPointsFromBinary(const std::string &data,
+                                        CPData &cpData, DefData &defData,
+                                        ImgData &imgData) {
+  BinaryReader reader(data.data(), data.size());
+  uint32_t version;
+  if (!reader.readHeader(cpsMagic, version) || version > cpsVersion) {
+    DEBUG_CMD_MM(cout << "loadControlPoints: unsupported binary data" << endl;)
+    return false;
+  }
+
+  // each chunk is looked up from the start of the body
+  const BinaryReader body = reader;
+  BinaryReader chunk, cpsChunk = body;
+  if (!cpsChunk.findChunk("CPTS", chunk)) return true;
+  const int cpSize = 4 * 4 + 6 * 8;
+  const uint32_t num = chunk.readU32();
+  if (num > chunk.remaining(cpSize)) return false;
+  vector<SavedCP> cps(num);
+  for (SavedCP &cp : cps) {
+    cp.ptId = chunk.readI32();
+    cp.partId = chunk.readI32();
+    cp.regId = chunk.readI32();
+    cp.isBackPart = chunk.readI32();
+    fora(k, 0, 3) cp.rest(k) = chunk.readF64();
+    fora(k, 0, 3) cp.pos(k) = chunk.readF64();
+  }
+  if (!chunk.ok()) return false;
+
+  vector<pair<int, CPAnim>> anims;
+  int cpsAnimSyncId = -1;
+  BinaryReader animChunk = body;
+  const bool hasAnims = animChunk.findChunk("ANIM", chunk);
+  if (hasAnims) {
+    cpsAnimSyncId = chunk.readI32();
+    const uint32_t nAnims = chunk.readU32();
+    const int keyposeSize = 3 * 8 + 4;
+    for (uint32_t i = 0; i < nAnims && chunk.ok(); i++) {
+      const int cpInd = chunk.readI32();
+      CPAnim cpAnim;
+      cpAnim.setTemporalScalingFactor(chunk.readF64());
+      cpAnim.setOffset(chunk.readF64());
+      const bool haveTimestamps = chunk.readU32() != 0;
+      const uint32_t nKeyposes = chunk.readU32();
+      if (nKeyposes > chunk.remaining(keyposeSize)) return false;
+      cpAnim.reserve(nKeyposes);
+      for (uint32_t j = 0; j < nKeyposes; j++) {
+        Vector3d p;
+        fora(k, 0, 3) p(k) = chunk.readF64();
+        const int timestamp = chunk.readI32();
+        cpAnim.record(CPAnim::Keypose{p, haveTimestamps ? timestamp : -1,
+                                      false, true, haveTimestamps});
       }
-      Vector3d r(x1, y1, z1), pos(x2, y2, z2);
-      DEBUG_CMD_MM(cout << "loaded CP: " << ptId << " " << partIdOrig << " "
-                        << regId << " " << isBackPart << " " << r.transpose()
-                        << " " << pos.transpose();)
-      bool res = true;
-      if (regId == -1 || regId >= regionImgs.size() ||
-          regionImgs[regId].isNull()) {
-        res = false;
-        DEBUG_CMD_MM(cout << " region does not exist";)
-      } else {
-        int layerId = -1;
-        forlist(i, layers) if (layers[i] == regId) {
-          layerId = i;
-          break;
-        }
-        const int partId = 2 * layerId + isBackPart;
-        if (partId < verticesOfParts.size()) {
-          MatrixXd VPart(verticesOfParts[partId].size(), 3);
-          fora(j, 0, VPart.rows()) VPart.row(j) =
-              mesh.VRest.row(verticesOfParts[partId][j]);
-          int cpInd;
-          const double maxRadius = 25;
-          if (!def.addControlPointExhaustive(VPart, x1, y1, maxRadius, z1,
-                                             false, cpInd)) {
-            res = false;
-          } else {
-            try {
-              auto &cp = def.getCP(cpInd);
-              cp.ptId += verticesOfParts[partId][0];
-              cp.pos = cp.prevPos = pos;
-            } catch (out_of_range &e) {
-              cerr << e.what() << endl;
-            }
+      anims.emplace_back(cpInd, std::move(cpAnim));
+    }
+    if (!chunk.ok()) return false;
+
+    BinaryReader layerChunk = body;
+    if (layerChunk.findChunk("ALYR", chunk)) {
+      const uint32_t nLayered = chunk.readU32();
+      for (uint32_t i = 0; i < nLayered && chunk.ok(); i++) {
+        const uint32_t animInd = chunk.readU32();
+        const uint32_t nLayers = chunk.readU32();
+        if (animInd >= anims.size()) return false;
+        CPAnim &cpAnim = anims[animInd].second;
+        const int length = cpAnim.getLength();
+        const int layerKeyposeSize = 4 + 3 * 8;
+        for (uint32_t l = 0; l < nLayers && chunk.ok(); l++) {
+          cpAnim.addLayer(chunk.readF64());
+          if (length > chunk.remaining(layerKeyposeSize)) return false;
+          fora(t, 0, length) {
+            const bool recorded = chunk.readU32() != 0;
+            Vector3d p;
+            fora(k, 0, 3) p(k) = chunk.readF64();
+            if (recorded) cpAnim.recordLayer(t, p);
           }
-        } else {
-          res = false;
         }
-        if (!res) DEBUG_CMD_MM(cout << " failed";)
       }
-      if (!res) {
-        cpId2NewCPId[i] = -1;
-        fora(j, i + 1, num) cpId2NewCPId[j]--;
-        DEBUG_CMD_MM(cout << " (skipping)";)
-      }
-      DEBUG_CMD_MM(cout << endl;)
+      if (!chunk.ok()) return false;
     }
 
-    // load cps anim
-    num = -1;
-    stream >> num;
-    if (num != -1) {
-      stream >> cpsAnimSyncId;
-      cpsAnimSyncId = cpId2NewCPId[cpsAnimSyncId];
-      fora(i, 0, num) {
-        int cpInd;
-        stream >> cpInd;
-        int cpIndOrig = cpInd;
-        cpInd = cpId2NewCPId[cpInd];
-        CPAnim cpAnim;
-        stream >> cpAnim;
-        if (cpInd == -1) {
-          DEBUG_CMD_MM(cout << "skipping cpAnim " << cpIndOrig << endl;)
-          continue;
+    BinaryReader sharedChunk = body;
+    if (sharedChunk.findChunk("ASHR", chunk)) {
+      const uint32_t nShared = chunk.readU32();
+      for (uint32_t i = 0; i < nShared && chunk.ok(); i++) {
+        const uint32_t animInd = chunk.readU32();
+        const uint32_t sourceInd = chunk.readU32();
+        Vector3d shift;
+        fora(k, 0, 3) shift(k) = chunk.readF64();
+        const uint32_t nLayers = chunk.readU32();
+        if (animInd >= anims.size() || sourceInd >= anims.size()) {
+          return false;
         }
-        DEBUG_CMD_MM(cout << "cpAnim for cp " << cpIndOrig << "->" << cpInd
-                          << " exists";)
-        const auto &cps = def.getCPs();
-        if (cps.find(cpInd) != cps.end()) {
-          cpsAnim[cpInd] = cpAnim;
-        } else {
-          DEBUG_CMD_MM(cout << " - failed: cp does not exist";);
-        }
-        DEBUG_CMD_MM(cout << endl;)
+        CPAnim &cpAnim = anims[animInd].second;
+        const CPAnim &source = anims[sourceInd].second;
+        if (nLayers != source.getNumLayers()) return false;
+        cpAnim.shareKeyposes(source);
+        cpAnim.setShift(source.getShift() + shift);
+        fora(l, 0, nLayers) cpAnim.setLayerWeight(l, chunk.readF64());
       }
-      if (cpsAnim.find(cpsAnimSyncId) == cpsAnim.end()) cpsAnimSyncId = -1;
-      DEBUG_CMD_MM(cout << "cpsAnimSyncId: " << cpsAnimSyncId << endl;)
+      if (!chunk.ok()) return false;
     }
+  }
 
-    // update selected points
-    const auto &cps = def.getCPs();
-    set<int> selectedPointsNew;
-    for (int cpId : selectedPoints) {
-      const int newId = cpId2NewCPId[cpId];
-      if (newId != -1 && cps.find(newId) != cps.end()) {
-        selectedPointsNew.insert(newId);
-      }
-    }
-    selectedPoints = selectedPointsNew;
-    if (selectedPoint != -1) {
-      const int newId = cpId2NewCPId[selectedPoint];
-      if (newId != -1 && cps.find(newId) != cps.end()) selectedPoint = newId;
-    }
+  applyControlPoints(cps, hasAnims, cpsAnimSyncId, anims, cpData, defData,
+                     imgData);
+  return true;
+}
+
+bool loadControlPoints(const std::string &savedCPs, CPData &cpData,
+                       DefData &defData, ImgData &imgData) {
+  if (hasBinaryMagic(savedCPs, cpsMagic)) {
+    return loadControlPointsFromBinary(savedCPs, cpData, defData, imgData);
   }
+  istringstream stream(savedCPs);
+  return loadControlPointsFromStream(stream, cpData, defData, imgData);
+}
 
+// Applies a setting saved as key and value, returns false for unknown keys.
+static bool applySetting(const string &key, const string &value,
+                         CPData &cpData, RecData &recData,
+                         ShadingOptions &shadingOpts,
+                         ManipulationMode &manipulationMode,
+                         bool &middleMouseSimulation) {
+  const bool b = atoi(value.c_str()) != 0;
+  if (key == "manipulationMode") {
+    if (value == "animate")
+      manipulationMode.setMode(ANIMATE_MODE);
+    else if (value == "deform")
+      manipulationMode.setMode(DEFORM_MODE);
+    else if (value == "redraw")
+      manipulationMode.setMode(REGION_REDRAW_MODE);
+    else
+      manipulationMode.setMode(DRAW_OUTLINE);
+  } else if (key == "animRecMode") {
+    if (value == "timescaled")
+      cpData.animMode = ANIM_MODE_TIME_SCALED;
+    else if (value == "layer")
+      cpData.animMode = ANIM_MODE_LAYER;
+    else
+      cpData.animMode = ANIM_MODE_OVERWRITE;
+  } else if (key == "playAnimation") {
+    cpData.playAnimation = b;
+  } else if (key == "playAnimWhenSelected") {
+    cpData.playAnimWhenSelected = b;
+  } else if (key == "showControlPoints") {
+    cpData.showControlPoints = b;
+  } else if (key == "showTemplateImg") {
+    shadingOpts.showTemplateImg = b;
+  } else if (key == "showBackgroundImg") {
+    shadingOpts.showBackgroundImg = b;
+  } else if (key == "showTextureUseMatcapShading") {
+    shadingOpts.showTextureUseMatcapShading = b;
+  } else if (key == "enableArmpitsStitching") {
+    recData.armpitsStitching = b;
+  } else if (key == "enableAdaptiveTriangulation") {
+    recData.adaptiveTriangulation = b;
+  } else if (key == "enableCDTTriangulation") {
+    recData.cdtTriangulation = b;
+  } else if (key == "enableNormalSmoothing") {
+    shadingOpts.useNormalSmoothing = b;
+  } else if (key == "enableImplicitNormalSmoothing") {
+    shadingOpts.implicitNormalSmoothing = b;
+  } else if (key == "middleMouseSimulation") {
+    middleMouseSimulation = b;
+  } else if (key == "performanceProfile") {
+    PerfProfile profile;
+    if (!perfProfileFromName(value, profile)) return false;
+    applyPerfProfile(profile, recData, shadingOpts);
+  } else {
+    return false;
+  }
   return true;
 }
 
@@ -293,58 +664,13 @@ bool loadSettingsFromStream(std::istream &stream, CPData &cpData,
   DEBUG_CMD_MM(cout << "loadSettingsFromStream: loading settings (version "
                     << version << ")" << endl;);
 
-  string str, s;
-  int i, c = 0;
-  while (!stream.eof()) {
-    long pos = stream.tellg();
-    stream >> str;
-    if (str == "manipulationMode") {
-      stream >> s;
-      if (s == "animate")
-        manipulationMode.setMode(ANIMATE_MODE);
-      else if (s == "deform")
-        manipulationMode.setMode(DEFORM_MODE);
-      else if (s == "redraw")
-        manipulationMode.setMode(REGION_REDRAW_MODE);
-      else
-        manipulationMode.setMode(DRAW_OUTLINE);
-    } else if (str == "animRecMode") {
-      stream >> s;
-      if (s == "timescaled")
-        cpData.animMode = ANIM_MODE_TIME_SCALED;
-      else
-        cpData.animMode = ANIM_MODE_OVERWRITE;
-    } else if (str == "playAnimation") {
-      stream >> i;
-      cpData.playAnimation = i;
-    } else if (str == "playAnimWhenSelected") {
-      stream >> i;
-      cpData.playAnimWhenSelected = i;
-    } else if (str == "showControlPoints") {
-      stream >> i;
-      cpData.showControlPoints = i;
-    } else if (str == "showTemplateImg") {
-      stream >> i;
-      shadingOpts.showTemplateImg = i;
-    } else if (str == "showBackgroundImg") {
-      stream >> i;
-      shadingOpts.showBackgroundImg = i;
-    } else if (str == "showTextureUseMatcapShading") {
-      stream >> i;
-      shadingOpts.showTextureUseMatcapShading = i;
-    } else if (str == "enableArmpitsStitching") {
-      stream >> i;
-      recData.armpitsStitching = i;
-    } else if (str == "enableNormalSmoothing") {
-      stream >> i;
-      shadingOpts.useNormalSmoothing = i;
-    } else if (str == "middleMouseSimulation") {
-      stream >> i;
-      middleMouseSimulation = i;
-    } else {
-      stream >> s;
-      DEBUG_CMD_MM(cout << "loadSettingsFromStream: skipping " << str << " "
-                        << s << endl;);
+  string key, value;
+  int c = 0;
+  while (stream >> key >> value) {
+    if (!applySetting(key, value, cpData, recData, shadingOpts,
+                      manipulationMode, middleMouseSimulation)) {
+      DEBUG_CMD_MM(cout << "loadSettingsFromStream: skipping " << key << " "
+                        << value << endl;);
     }
     c++;
   }
@@ -377,10 +703,10 @@ void loadSettingsFromZip(zip_t *zip, const std::string &fn, CPData &cpData,
   zip_entry_close(zip);
 }
 
-bool saveSettingsToStream(std::ostream &stream, CPData &cpData,
-                          RecData &recData, ShadingOptions &shadingOpts,
-                          ManipulationMode &manipulationMode,
-                          bool middleMouseSimulation) {
+// the settings as keys and values, in the order of the file
+static vector<pair<string, string>> collectSettings(
+    CPData &cpData, RecData &recData, ShadingOptions &shadingOpts,
+    ManipulationMode &manipulationMode, bool middleMouseSimulation) {
   string manipulationModeStr;
   switch (manipulationMode.mode) {
     case REGION_REDRAW_MODE:
@@ -402,121 +728,257 @@ bool saveSettingsToStream(std::ostream &stream, CPData &cpData,
     case ANIM_MODE_TIME_SCALED:
       animModeStr = "timescaled";
       break;
+    case ANIM_MODE_LAYER:
+      animModeStr = "layer";
+      break;
     default:
     case ANIM_MODE_OVERWRITE:
       animModeStr = "overwrite";
       break;
   }
+  auto flag = [](bool b) { return string(b ? "1" : "0"); };
+
+  return {
+      {"manipulationMode", manipulationModeStr},
+      {"animRecMode", animModeStr},
+      {"playAnimation", flag(cpData.playAnimation)},
+      {"playAnimWhenSelected", flag(cpData.playAnimWhenSelected)},
+      {"showControlPoints", flag(cpData.showControlPoints)},
+      {"showTemplateImg", flag(shadingOpts.showTemplateImg)},
+      {"showBackgroundImg", flag(shadingOpts.showBackgroundImg)},
+      {"showTextureUseMatcapShading",
+       flag(shadingOpts.showTextureUseMatcapShading)},
+      {"enableArmpitsStitching", flag(recData.armpitsStitching)},
+      {"enableAdaptiveTriangulation", flag(recData.adaptiveTriangulation)},
+      {"enableCDTTriangulation", flag(recData.cdtTriangulation)},
+      {"enableNormalSmoothing", flag(shadingOpts.useNormalSmoothing)},
+      {"enableImplicitNormalSmoothing",
+       flag(shadingOpts.implicitNormalSmoothing)},
+      {"middleMouseSimulation", flag(middleMouseSimulation)},
+      {"performanceProfile", perfProfileName(recData.perfProfile)},
+  };
+}
 
-  stream << "v. " << APP_VERSION << endl;
-  stream << "manipulationMode " << manipulationModeStr << endl;
-  stream << "animRecMode " << animModeStr << endl;
-  stream << "playAnimation " << (cpData.playAnimation ? 1 : 0) << endl;
-  stream << "playAnimWhenSelected " << (cpData.playAnimWhenSelected ? 1 : 0)
-         << endl;
-  stream << "showControlPoints " << (cpData.showControlPoints ? 1 : 0) << endl;
-  stream << "showTemplateImg " << (shadingOpts.showTemplateImg ? 1 : 0) << endl;
-  stream << "showBackgroundImg " << (shadingOpts.showBackgroundImg ? 1 : 0)
-         << endl;
-  stream << "showTextureUseMatcapShading "
-         << (shadingOpts.showTextureUseMatcapShading ? 1 : 0) << endl;
-  stream << "enableArmpitsStitching " << (recData.armpitsStitching ? 1 : 0)
-         << endl;
-  stream << "enableNormalSmoothing " << (shadingOpts.useNormalSmoothing ? 1 : 0)
-         << endl;
-  stream << "middleMouseSimulation " << (middleMouseSimulation ? 1 : 0) << endl;
-
-  return true;
+static bool readZipEntry(zip_t *zip, const std::string &fn, string &data) {
+  if (zip_entry_open(zip, fn.c_str()) != 0) return false;
+  data.resize(zip_entry_size(zip));
+  const bool ok = zip_entry_noallocread(zip, &data[0], data.size()) != -1;
+  zip_entry_close(zip);
+  return ok;
 }
 
-bool saveSettingsToZip(zip_t *zip, const std::string &fn, CPData &cpData,
-                       RecData &recData, ShadingOptions &shadingOpts,
-                       ManipulationMode &manipulationMode,
-                       bool middleMouseSimulation) {
-  stringstream stream;
-  saveSettingsToStream(stream, cpData, recData, shadingOpts, manipulationMode,
-                       middleMouseSimulation);
-  const string &str = stream.str();
-  const char *data = str.c_str();
-  zip_entry_open(zip, fn.c_str());
-  zip_entry_write(zip, data, str.length());
+// A file mapped read-only to memory on native builds, empty if it cannot be
+// mapped (and always with Emscripten, whose files are in memory anyway).
+class MappedFile {
+ public:
+  explicit MappedFile(const string &fn) {
+#ifndef __EMSCRIPTEN__
+    const int fd = open(fn.c_str(), O_RDONLY);
+    if (fd == -1) return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        mapped = static_cast<const char *>(p);
+        mappedSize = st.st_size;
+      }
+    }
+    close(fd);
+#endif
+  }
+  ~MappedFile() {
+#ifndef __EMSCRIPTEN__
+    if (mapped != nullptr) munmap(const_cast<char *>(mapped), mappedSize);
+#endif
+  }
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const char *data() const { return mapped; }
+  size_t size() const { return mappedSize; }
+
+ private:
+  const char *mapped = nullptr;
+  size_t mappedSize = 0;
+};
+
+// Reads the entry fn of zip, which is mapped to memory by archive, in place
+// if it is stored without compression, otherwise it is read to buffer. The
+// CRC of entries read in place is not checked.
+static bool readZipEntry(zip_t *zip, const MappedFile &archive,
+                         const std::string &fn, string &buffer,
+                         const char *&data, size_t &size) {
+  if (zip_entry_open(zip, fn.c_str()) != 0) return false;
+  size = zip_entry_size(zip);
+  const ssize_t offset = zip_entry_stored_offset(zip);
+  bool ok = true;
+  if (archive.data() != nullptr && offset >= 0 &&
+      static_cast<size_t>(offset) <= archive.size() &&
+      size <= archive.size() - offset) {
+    data = archive.data() + offset;
+  } else {
+    buffer.resize(size);
+    ok = zip_entry_noallocread(zip, &buffer[0], size) != -1;
+    data = buffer.data();
+  }
   zip_entry_close(zip);
-  return true;
+  return ok;
 }
 
+// An istream over memory owned by the caller, without the copy made by
+// istringstream.
+class MemoryStreamBuf : public streambuf {
+ public:
+  MemoryStreamBuf(const char *data, size_t size) {
+    char *p = const_cast<char *>(data);
+    setg(p, p, p + size);
+  }
+
+ protected:
+  pos_type seekoff(off_type off, ios_base::seekdir dir,
+                   ios_base::openmode which) override {
+    char *base = dir == ios_base::beg   ? eback()
+                 : dir == ios_base::cur ? gptr()
+                                        : egptr();
+    if (off < eback() - base || off > egptr() - base) {
+      return pos_type(off_type(-1));
+    }
+    setg(eback(), base + off, egptr());
+    return pos_type(gptr() - eback());
+  }
+  pos_type seekpos(pos_type pos, ios_base::openmode which) override {
+    return seekoff(off_type(pos), ios_base::beg, which);
+  }
+};
+
 bool loadImageFromZip(zip_t *zip, const string &fn, Imguc &I, int alphaChannel,
                       int desiredNumChannels) {
-  bool success = true;
-  int ret = zip_entry_open(zip, fn.c_str());
-  if (ret != 0) {
-    success = false;
-  } else {
-    size_t size = zip_entry_size(zip);
-    void *data = calloc(sizeof(unsigned char), size);
-    ret = zip_entry_noallocread(zip, data, size);
-    if (ret == -1) {
-      success = false;
-    } else {
-      I = Imguc::loadImage(static_cast<unsigned char *>(data),
-                           static_cast<int>(size), alphaChannel,
-                           desiredNumChannels);
+  string png;
+  if (!readZipEntry(zip, fn, png)) return false;
+  I = Imguc::loadImage(reinterpret_cast<unsigned char *>(&png[0]),
+                       static_cast<int>(png.size()), alphaChannel,
+                       desiredNumChannels);
+  return true;
+}
+
+// Runs body(begin, end) over [0, n) in parallel on pool if given.
+static void parallelFor(WorkerPool *pool, int n,
+                        const function<void(int, int)> &body) {
+  if (pool != nullptr)
+    pool->parallelFor(n, 1, body);
+  else
+    body(0, n);
+}
+
+// The names among names of the layer images prefix + "NNN.png" (NNN from
+// 000 to 255) ordered by NNN.
+static vector<string> layerImageNames(const vector<string> &names,
+                                      const string &prefix) {
+  map<int, string> images;
+  for (const string &name : names) {
+    if (name.size() != prefix.size() + 7 ||
+        name.compare(0, prefix.size(), prefix) != 0 ||
+        name.compare(name.size() - 4, 4, ".png") != 0) {
+      continue;
+    }
+    const string digits = name.substr(prefix.size(), 3);
+    if (!all_of(digits.begin(), digits.end(),
+                [](char c) { return c >= '0' && c <= '9'; })) {
+      continue;
     }
-    free(data);
+    images[stoi(digits)] = name;
   }
-  zip_entry_close(zip);
-  return success;
+  vector<string> result;
+  for (const auto &it : images) result.push_back(it.second);
+  return result;
+}
+
+// resizes I to the viewport (padded with background) unless it already has
+// its size, the data are not copied otherwise
+static void fitToViewport(Imguc &I, const int viewportW, const int viewportH,
+                          unsigned char background) {
+  if (I.w == viewportW && I.h == viewportH) return;
+  Imguc resized = I.resize(viewportW, viewportH, 0, 0, Cu({background}));
+  I.swap(resized);
 }
 
-void loadImagesFromZip(zip_t *zip, const string &dir, const int viewportW,
+// Decodes the PNGs and resizes them to the viewport (padded with
+// background), in parallel on pool if given.
+static vector<Imguc> decodeLayerImages(vector<string> &pngs,
+                                       const int viewportW,
+                                       const int viewportH,
+                                       unsigned char background,
+                                       WorkerPool *pool) {
+  vector<Imguc> images(pngs.size());
+  parallelFor(pool, pngs.size(), [&](int begin, int end) {
+    fora(i, begin, end) {
+      string &png = pngs[i];
+      Imguc I = Imguc::loadImage(reinterpret_cast<unsigned char *>(&png[0]),
+                                 static_cast<int>(png.size()), -1, 1);
+      png = string();
+      fitToViewport(I, viewportW, viewportH, background);
+      images[i].swap(I);
+    }
+  });
+  return images;
+}
+
+// The entries of the layer images are found in the list of the entries of
+// the zip, read one after another and decoded in parallel.
+void loadImagesFromZip(zip_t *zip, const string &dir,
+                       const vector<string> &entries, const int viewportW,
                        const int viewportH, vector<Imguc> &outlineImgsTmp,
-                       vector<Imguc> &regionImgsTmp,
-                       unordered_map<int, Img<float>> &depthImgsTmp,
-                       unordered_map<int, deque<Imguc>> &regionWeightImgsTmp) {
+                       vector<Imguc> &regionImgsTmp, WorkerPool *pool) {
   DEBUG_CMD_MM(cout << "Loading project from a zip file" << endl;);
 
-  string fn;
-  fora(i, 0, 255 + 1) {
-    ostringstream oss;
-    oss << setw(3) << setfill('0') << i;
-    fn = dir + "_org_" + oss.str() + ".png";
-    {
-      Imguc I;
-      if (loadImageFromZip(zip, fn, I, -1, 1))
-        outlineImgsTmp.push_back(
-            I.resize(viewportW, viewportH, 0, 0, Cu({255})));
-    }
-    fn = dir + "_seg_" + oss.str() + ".png";
-    {
-      Imguc I;
-      if (loadImageFromZip(zip, fn, I, -1, 1))
-        regionImgsTmp.push_back(I.resize(viewportW, viewportH, 0, 0, Cu({0})));
+  auto load = [&](const string &prefix, unsigned char background) {
+    vector<string> pngs;
+    for (const string &name : layerImageNames(entries, dir + prefix)) {
+      string png;
+      if (readZipEntry(zip, name, png)) pngs.push_back(std::move(png));
     }
-  }
+    return decodeLayerImages(pngs, viewportW, viewportH, background, pool);
+  };
+  outlineImgsTmp = load("_org_", 255);
+  regionImgsTmp = load("_seg_", 0);
 }
 
 void loadImagesFromDir(const std::string &dir, const int viewportW,
                        const int viewportH, vector<Imguc> &outlineImgsTmp,
-                       vector<Imguc> &regionImgsTmp) {
+                       vector<Imguc> &regionImgsTmp, WorkerPool *pool) {
   DEBUG_CMD_MM(cout << "Loading project from " << dir << endl;)
-  string fn;
 
-  fora(i, 0, 255 + 1) {
-    ostringstream oss;
-    oss << setw(3) << setfill('0') << i;
-    fn = dir + "/_org_" + oss.str() + ".png";
-    if (file_exists(fn))
-      outlineImgsTmp.push_back(Imguc::loadPNG(fn, -1, 1).resize(
-          viewportW, viewportH, 0, 0, Cu({255})));
-    fn = dir + "/_seg_" + oss.str() + ".png";
-    if (file_exists(fn))
-      regionImgsTmp.push_back(Imguc::loadPNG(fn, -1, 1).resize(
-          viewportW, viewportH, 0, 0, Cu({0})));
+  vector<string> files;
+  error_code error;
+  for (const auto &entry : filesystem::directory_iterator(dir, error)) {
+    files.push_back(entry.path().filename().string());
   }
+  auto load = [&](const string &prefix, unsigned char background) {
+    vector<string> pngs;
+    for (const string &name : layerImageNames(files, prefix)) {
+      ifstream stream(dir + "/" + name, ios::binary);
+      pngs.emplace_back((istreambuf_iterator<char>(stream)),
+                        istreambuf_iterator<char>());
+    }
+    return decodeLayerImages(pngs, viewportW, viewportH, background, pool);
+  };
+  outlineImgsTmp = load("_org_", 255);
+  regionImgsTmp = load("_seg_", 0);
 }
 
-void loadLayersFromStream(istream &stream, bool layersExist, ImgData &imgData,
-                          RecData &recData, vector<Imguc> &outlineImgsTmp,
-                          vector<Imguc> &regionImgsTmp) {
+// the saved order of the regions: the number of regions, the regions of
+// the non-empty images in the order of the files and the regions of the
+// layers
+struct SavedLayers {
+  int nRegions = 0;
+  vector<int> regIds, layers;
+};
+
+// Assigns the loaded images to their regions in the saved order or, without
+// it, in the order of the files.
+static void applyLayers(const SavedLayers *saved, ImgData &imgData,
+                        vector<Imguc> &outlineImgsTmp,
+                        vector<Imguc> &regionImgsTmp) {
   auto &regionImgs = imgData.regionImgs;
   auto &outlineImgs = imgData.outlineImgs;
   auto &layers = imgData.layers;
@@ -529,9 +991,8 @@ void loadLayersFromStream(istream &stream, bool layersExist, ImgData &imgData,
     DEBUG_CMD_MM(cout << "No outline images" << endl;)
   }
 
-  // load image order (layers)
-  if (!layersExist) {
-    DEBUG_CMD_MM(cout << "loadImages: failed to load layers.txt, assuming "
+  if (saved == nullptr) {
+    DEBUG_CMD_MM(cout << "loadImages: failed to load layers, assuming "
                          "incremental region order"
                       << endl;)
     // create layers from regions
@@ -539,50 +1000,68 @@ void loadLayersFromStream(istream &stream, bool layersExist, ImgData &imgData,
     regionImgs.resize(nRegions);
     outlineImgs.resize(nRegions);
     forlist(i, regionImgsTmp) {
-      regionImgs[i] = regionImgsTmp[i];
-      outlineImgs[i] = outlineImgsTmp[i];
+      regionImgs[i] = TiledImage(regionImgsTmp[i], 0);
+      outlineImgs[i] = TiledImage(outlineImgsTmp[i], 255);
       layers.push_back(i);
     }
-  } else {
-    string versionStr;
-    int version;
-    stream >> versionStr >> version;
-    if (versionStr != "v.") {
-      DEBUG_CMD_MM(cout << "loadImages: skipping - probably an old saved file"
-                        << endl;)
+    return;
+  }
+
+  const int nRegions = max(saved->nRegions, 0);
+  regionImgs.resize(nRegions);
+  outlineImgs.resize(nRegions);
+  const int nNonEmptyRegions =
+      min(saved->regIds.size(), regionImgsTmp.size());
+  fora(i, 0, nNonEmptyRegions) {
+    const int regId = saved->regIds[i];
+    if (regId >= 0 && regId < nRegions) {
+      regionImgs[regId] = TiledImage(regionImgsTmp[i], 0);
+      outlineImgs[regId] = TiledImage(outlineImgsTmp[i], 255);
     } else {
-      int nRegions;
-      stream >> nRegions;
-      regionImgs.resize(nRegions);
-      outlineImgs.resize(nRegions);
-      const int nNonEmptyRegions = regionImgsTmp.size();
-      fora(i, 0, nNonEmptyRegions) {
-        int regId;
-        stream >> regId;
-        if (regId >= 0 && regId < nRegions) {
-          regionImgs[regId] = regionImgsTmp[i];
-          outlineImgs[regId] = outlineImgsTmp[i];
-        } else {
-          DEBUG_CMD_MM(cout << "loadImages: incorrect regId " << regId << endl;)
-        }
-      }
-      int nLayers;
-      stream >> nLayers;
-      fora(i, 0, nLayers) {
-        int regId;
-        stream >> regId;
-        if (regId >= 0 && regId < regionImgs.size() &&
-            !regionImgs[regId].isNull()) {
-          layers.push_back(regId);
-        } else {
-          DEBUG_CMD_MM(cout << "loadImages: skipping layer " << i << "; region "
-                            << regId << " does not exist" << endl;)
-        }
-      }
+      DEBUG_CMD_MM(cout << "loadImages: incorrect regId " << regId << endl;)
+    }
+  }
+  forlist(i, saved->layers) {
+    const int regId = saved->layers[i];
+    if (regId >= 0 && regId < regionImgs.size() &&
+        !regionImgs[regId].isNull()) {
+      layers.push_back(regId);
+    } else {
+      DEBUG_CMD_MM(cout << "loadImages: skipping layer " << i << "; region "
+                        << regId << " does not exist" << endl;)
     }
   }
 }
 
+void loadLayersFromStream(istream &stream, bool layersExist, ImgData &imgData,
+                          RecData &recData, vector<Imguc> &outlineImgsTmp,
+                          vector<Imguc> &regionImgsTmp) {
+  if (!layersExist) {
+    applyLayers(nullptr, imgData, outlineImgsTmp, regionImgsTmp);
+    return;
+  }
+  SavedLayers saved;
+  string versionStr;
+  int version;
+  stream >> versionStr >> version;
+  if (versionStr != "v.") {
+    DEBUG_CMD_MM(cout << "loadImages: skipping - probably an old saved file"
+                      << endl;)
+  } else {
+    stream >> saved.nRegions;
+    saved.regIds.resize(regionImgsTmp.size());
+    for (int &regId : saved.regIds) stream >> regId;
+    int nLayers = 0;
+    stream >> nLayers;
+    fora(i, 0, nLayers) {
+      int regId;
+      stream >> regId;
+      saved.layers.push_back(regId);
+    }
+  }
+  applyLayers(&saved, imgData, outlineImgsTmp, regionImgsTmp);
+}
+
 void loadLayersFromFile(const std::string &fn, ImgData &imgData,
                         RecData &recData, vector<Imguc> &outlineImgsTmp,
                         vector<Imguc> &regionImgsTmp) {
@@ -618,59 +1097,454 @@ void loadLayersFromZip(zip_t *zip, const std::string &fn, ImgData &imgData,
 
 void loadAllFromDir(const std::string &dir, const int viewportW,
                     const int viewportH, ImgData &imgData, RecData &recData,
-                    std::string &savedCPs) {
+                    std::string &savedCPs, WorkerPool *pool) {
   vector<Imguc> outlineImgsTmp;
   vector<Imguc> regionImgsTmp;
-  loadImagesFromDir(dir, viewportW, viewportH, outlineImgsTmp, regionImgsTmp);
+  loadImagesFromDir(dir, viewportW, viewportH, outlineImgsTmp, regionImgsTmp,
+                    pool);
   loadLayersFromFile(dir + "/layers.txt", imgData, recData, outlineImgsTmp,
                      regionImgsTmp);
   loadControlPointsFromFile(dir + "/cps.txt", savedCPs);
 }
 
+static const char reconstructionMagic[4] = {'M', 'M', 'R', 'C'};
+static const int reconstructionVersion = 1;
+
+template <typename T>
+static void writeRaw(ostream &stream, const T *data, size_t n) {
+  stream.write(reinterpret_cast<const char *>(data), n * sizeof(T));
+}
+
+template <typename T>
+static bool readRaw(istream &stream, T *data, size_t n) {
+  stream.read(reinterpret_cast<char *>(data), n * sizeof(T));
+  return static_cast<bool>(stream);
+}
+
+// sizes are checked against the remaining length of the stream before
+// anything is allocated
+static bool fitsInStream(istream &stream, int64_t n, size_t elemSize) {
+  if (n < 0) return false;
+  const auto pos = stream.tellg();
+  stream.seekg(0, ios::end);
+  const auto end = stream.tellg();
+  stream.seekg(pos);
+  return static_cast<uint64_t>(n) <= (end - pos) / elemSize;
+}
+
+static bool readSize(istream &stream, size_t elemSize, int64_t &n) {
+  return readRaw(stream, &n, 1) && fitsInStream(stream, n, elemSize);
+}
+
+template <typename T, int Options>
+static void writeMatrix(ostream &stream,
+                        const Matrix<T, Dynamic, Dynamic, Options> &M) {
+  const int64_t dims[] = {M.rows(), M.cols()};
+  writeRaw(stream, dims, 2);
+  writeRaw(stream, M.data(), M.size());
+}
+
+template <typename T, int Options>
+static bool readMatrix(istream &stream,
+                       Matrix<T, Dynamic, Dynamic, Options> &M) {
+  int64_t dims[2];
+  if (!readRaw(stream, dims, 2) || dims[0] < 0 || dims[1] < 0) return false;
+  if (dims[1] > 0 && dims[0] > numeric_limits<int>::max() / dims[1]) {
+    return false;
+  }
+  if (!fitsInStream(stream, dims[0] * dims[1], sizeof(T))) return false;
+  M.resize(dims[0], dims[1]);
+  return readRaw(stream, M.data(), M.size());
+}
+
+static void writeSparse(ostream &stream, const SparseMatrix<double> &M) {
+  vector<Triplet<double>> triplets;
+  fora(k, 0, M.outerSize()) {
+    for (SparseMatrix<double>::InnerIterator it(M, k); it; ++it) {
+      triplets.emplace_back(it.row(), it.col(), it.value());
+    }
+  }
+  const int64_t dims[] = {M.rows(), M.cols(),
+                          static_cast<int64_t>(triplets.size())};
+  writeRaw(stream, dims, 3);
+  for (const auto &t : triplets) {
+    const int ij[] = {t.row(), t.col()};
+    const double value = t.value();
+    writeRaw(stream, ij, 2);
+    writeRaw(stream, &value, 1);
+  }
+}
+
+static bool readSparse(istream &stream, SparseMatrix<double> &M) {
+  int64_t rows, cols, n;
+  if (!readRaw(stream, &rows, 1) || !readRaw(stream, &cols, 1)) return false;
+  if (rows < 0 || cols < 0 || rows > numeric_limits<int>::max() ||
+      cols > numeric_limits<int>::max()) {
+    return false;
+  }
+  if (!readSize(stream, 2 * sizeof(int) + sizeof(double), n)) return false;
+  vector<Triplet<double>> triplets;
+  triplets.reserve(n);
+  fora(k, 0, n) {
+    int ij[2];
+    double value;
+    if (!readRaw(stream, ij, 2) || !readRaw(stream, &value, 1)) return false;
+    if (ij[0] < 0 || ij[0] >= rows || ij[1] < 0 || ij[1] >= cols) {
+      return false;
+    }
+    triplets.emplace_back(ij[0], ij[1], value);
+  }
+  M.resize(rows, cols);
+  M.setFromTriplets(triplets.begin(), triplets.end());
+  return true;
+}
+
+template <typename T>
+static void writeVector(ostream &stream, const vector<T> &v) {
+  const int64_t n = v.size();
+  writeRaw(stream, &n, 1);
+  writeRaw(stream, v.data(), n);
+}
+
+template <typename T>
+static bool readVector(istream &stream, vector<T> &v) {
+  int64_t n;
+  if (!readSize(stream, sizeof(T), n)) return false;
+  v.resize(n);
+  return readRaw(stream, v.data(), n);
+}
+
+static void writeLists(ostream &stream, const vector<vector<int>> &lists) {
+  const int64_t n = lists.size();
+  writeRaw(stream, &n, 1);
+  for (const auto &l : lists) writeVector(stream, l);
+}
+
+static bool readLists(istream &stream, vector<vector<int>> &lists) {
+  int64_t n;
+  if (!readSize(stream, sizeof(int64_t), n)) return false;
+  lists.resize(n);
+  for (auto &l : lists) {
+    if (!readVector(stream, l)) return false;
+  }
+  return true;
+}
+
+static void writeTriples(ostream &stream,
+                         const vector<tuple<int, int, int>> &triples) {
+  vector<int> v;
+  for (const auto &t : triples) {
+    v.insert(v.end(), {get<0>(t), get<1>(t), get<2>(t)});
+  }
+  writeVector(stream, v);
+}
+
+static bool readTriples(istream &stream,
+                        vector<tuple<int, int, int>> &triples) {
+  vector<int> v;
+  if (!readVector(stream, v) || v.size() % 3 != 0) return false;
+  triples.clear();
+  for (size_t i = 0; i < v.size(); i += 3) {
+    triples.emplace_back(v[i], v[i + 1], v[i + 2]);
+  }
+  return true;
+}
+
+bool saveReconstructionToStream(std::ostream &stream,
+                                const RecResult &result) {
+  writeRaw(stream, reconstructionMagic, 4);
+  writeRaw(stream, &reconstructionVersion, 1);
+  writeRaw(stream, &result.inputsHash, 1);
+  writeMatrix(stream, result.V);
+  writeMatrix(stream, result.VPreinf);
+  writeMatrix(stream, result.F);
+  writeLists(stream, result.verticesOfParts);
+  writeSparse(stream, result.M);
+  // formerly the inverse mass matrix, kept empty so the format is unchanged
+  writeSparse(stream, SparseMatrix<double>());
+  writeTriples(stream, result.ineqRegionConds);
+  writeLists(stream, result.bnds);
+  writeVector(stream, result.mergeBnd);
+  writeTriples(stream, result.mergeArmpitsCorrs);
+  return static_cast<bool>(stream);
+}
+
+bool loadReconstructionFromStream(std::istream &stream, RecResult &result) {
+  char magic[4];
+  int version;
+  if (!readRaw(stream, magic, 4) ||
+      !equal(magic, magic + 4, reconstructionMagic)) {
+    return false;
+  }
+  if (!readRaw(stream, &version, 1) || version != reconstructionVersion) {
+    return false;
+  }
+  SparseMatrix<double> unusedMinv;
+  return readRaw(stream, &result.inputsHash, 1) &&
+         readMatrix(stream, result.V) && readMatrix(stream, result.VPreinf) &&
+         readMatrix(stream, result.F) &&
+         readLists(stream, result.verticesOfParts) &&
+         readSparse(stream, result.M) && readSparse(stream, unusedMinv) &&
+         readTriples(stream, result.ineqRegionConds) &&
+         readLists(stream, result.bnds) &&
+         readVector(stream, result.mergeBnd) &&
+         readTriples(stream, result.mergeArmpitsCorrs);
+}
+
+static bool saveReconstructionToZip(zip_t *zip, const std::string &fn,
+                                    const RecResult &result) {
+  stringstream stream;
+  if (!saveReconstructionToStream(stream, result)) return false;
+  const string &str = stream.str();
+  zip_entry_open(zip, fn.c_str());
+  zip_entry_write(zip, str.data(), str.length());
+  zip_entry_close(zip);
+  return true;
+}
+
+static bool loadReconstructionFromZip(zip_t *zip, const MappedFile &archive,
+                                      const std::string &fn,
+                                      RecData &recData) {
+  recData.storedResult.reset();
+  string buffer;
+  const char *data;
+  size_t size;
+  if (!readZipEntry(zip, archive, fn, buffer, data, size)) return false;
+  MemoryStreamBuf streamBuf(data, size);
+  istream stream(&streamBuf);
+  auto result = make_shared<RecResult>();
+  if (!loadReconstructionFromStream(stream, *result)) {
+    DEBUG_CMD_MM(cout << "loadReconstructionFromZip: invalid " << fn << endl;);
+    return false;
+  }
+  recData.storedResult = result;
+  return true;
+}
+
+static const char projectMagic[4] = {'M', 'M', 'P', 'J'};
+// 2: the layer images in the MASK chunk instead of PNG files
+static const uint32_t projectVersion = 2;
+
+// Reads the chunks of project.bin (see writeProject()), the images of a MASK
+// chunk are decoded to outlineImgsTmp and regionImgsTmp.
+static bool readProject(const char *data, size_t size, CPData &cpData,
+                        RecData &recData, std::string &savedCPs,
+                        ShadingOptions &shadingOpts,
+                        ManipulationMode &manipulationMode,
+                        bool &middleMouseSimulation, SavedLayers &layers,
+                        bool &layersExist, bool &cpsExist,
+                        vector<Imguc> &outlineImgsTmp,
+                        vector<Imguc> &regionImgsTmp) {
+  BinaryReader reader(data, size);
+  uint32_t version;
+  if (!reader.readHeader(projectMagic, version) || version > projectVersion) {
+    return false;
+  }
+
+  char tag[4];
+  BinaryReader chunk;
+  layersExist = cpsExist = false;
+  while (!reader.atEnd() && reader.readChunk(tag, chunk)) {
+    const string tagStr(tag, 4);
+    if (tagStr == "LAYR") {
+      layers.nRegions = chunk.readI32();
+      for (auto *ids : {&layers.regIds, &layers.layers}) {
+        const uint32_t n = chunk.readU32();
+        if (n > chunk.remaining(4)) break;
+        ids->resize(n);
+        for (int &id : *ids) id = chunk.readI32();
+      }
+      layersExist = chunk.ok();
+    } else if (tagStr == "SETT") {
+      const uint32_t n = chunk.readU32();
+      for (uint32_t i = 0; i < n && chunk.ok(); i++) {
+        const string key = chunk.readString();
+        const string value = chunk.readString();
+        if (chunk.ok()) {
+          applySetting(key, value, cpData, recData, shadingOpts,
+                       manipulationMode, middleMouseSimulation);
+        }
+      }
+    } else if (tagStr == "CPS ") {
+      const size_t n = chunk.remaining();
+      savedCPs.assign(chunk.readBytes(n), n);
+      cpsExist = true;
+    } else if (tagStr == "MASK") {
+      const uint32_t n = chunk.readU32();
+      outlineImgsTmp.clear();
+      regionImgsTmp.clear();
+      for (uint32_t i = 0; i < n; i++) {
+        outlineImgsTmp.emplace_back();
+        regionImgsTmp.emplace_back();
+        if (!decodeRLE(chunk, outlineImgsTmp.back()) ||
+            !decodeRLE(chunk, regionImgsTmp.back())) {
+          outlineImgsTmp.pop_back();
+          regionImgsTmp.pop_back();
+          break;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+// resizes the loaded layer images to the viewport in parallel on pool if
+// given
+static void resizeLayerImages(vector<Imguc> &outlineImgsTmp,
+                              vector<Imguc> &regionImgsTmp,
+                              const int viewportW, const int viewportH,
+                              WorkerPool *pool) {
+  parallelFor(pool, outlineImgsTmp.size(), [&](int begin, int end) {
+    fora(i, begin, end) {
+      fitToViewport(outlineImgsTmp[i], viewportW, viewportH, 255);
+      fitToViewport(regionImgsTmp[i], viewportW, viewportH, 0);
+    }
+  });
+}
+
+// Loads project.bin (see saveProjectToZip()), read in place from the entry.
+// Returns false if the project has none and the text files have to be
+// loaded instead.
+static bool loadProjectFromZip(
+    zip_t *zip, const MappedFile &archive, const std::string &fn,
+    CPData &cpData, ImgData &imgData,
+    RecData &recData, std::string &savedCPs, ShadingOptions &shadingOpts,
+    ManipulationMode &manipulationMode, bool &middleMouseSimulation,
+    const int viewportW, const int viewportH, vector<Imguc> &outlineImgsTmp,
+    vector<Imguc> &regionImgsTmp, WorkerPool *pool) {
+  string buffer;
+  const char *data;
+  size_t size;
+  if (!readZipEntry(zip, archive, fn, buffer, data, size)) return false;
+  SavedLayers layers;
+  bool layersExist, cpsExist;
+  if (!readProject(data, size, cpData, recData, savedCPs, shadingOpts,
+                   manipulationMode, middleMouseSimulation, layers,
+                   layersExist, cpsExist, outlineImgsTmp, regionImgsTmp)) {
+    DEBUG_CMD_MM(cout << "loadProjectFromZip: unsupported " << fn << endl;);
+    return false;
+  }
+  resizeLayerImages(outlineImgsTmp, regionImgsTmp, viewportW, viewportH,
+                    pool);
+  applyLayers(layersExist ? &layers : nullptr, imgData, outlineImgsTmp,
+              regionImgsTmp);
+  // control points in the text format
+  if (!cpsExist) {
+    const string dir = filesystem::path(fn).parent_path();
+    loadControlPointsFromZip(zip, dir.empty() ? "cps.txt" : dir + "/cps.txt",
+                             savedCPs);
+  }
+  return true;
+}
+
+bool loadProjectFromBinary(
+    const std::string &data,
+    const std::unordered_map<int, std::pair<Imguc, Imguc>> &layerImgs,
+    const int viewportW, const int viewportH, CPData &cpData,
+    ImgData &imgData, RecData &recData, std::string &savedCPs,
+    ShadingOptions &shadingOpts, ManipulationMode &manipulationMode,
+    bool &middleMouseSimulation, WorkerPool *pool) {
+  SavedLayers layers;
+  bool layersExist, cpsExist;
+  vector<Imguc> outlineImgsTmp, regionImgsTmp;
+  if (!readProject(data.data(), data.size(), cpData, recData, savedCPs, shadingOpts,
+                   manipulationMode, middleMouseSimulation, layers,
+                   layersExist, cpsExist, outlineImgsTmp, regionImgsTmp) ||
+      !layersExist) {
+    DEBUG_CMD_MM(cout << "loadProjectFromBinary: unsupported data" << endl;);
+    return false;
+  }
+  // the images in the order of the saved region IDs, a missing one ends them
+  outlineImgsTmp.clear();
+  regionImgsTmp.clear();
+  for (const int regId : layers.regIds) {
+    const auto it = layerImgs.find(regId);
+    if (it == layerImgs.end()) break;
+    outlineImgsTmp.push_back(it->second.first);
+    regionImgsTmp.push_back(it->second.second);
+  }
+  resizeLayerImages(outlineImgsTmp, regionImgsTmp, viewportW, viewportH,
+                    pool);
+  applyLayers(&layers, imgData, outlineImgsTmp, regionImgsTmp);
+  return true;
+}
+
+// The names of the entries of zip and the directory in it containing
+// project.bin or, in projects saved by older versions, _org_000.png. We
+// assume that the whole project is contained in this directory.
+static string findProjectDir(zip_t *zip, vector<string> &entries) {
+  const int n = zip_total_entries(zip);
+  string dir = "";
+  bool dirFound = false;
+  fora(i, 0, n) {
+    if (zip_entry_openbyindex(zip, i) != 0) continue;
+    entries.push_back(zip_entry_name(zip));
+    zip_entry_close(zip);
+    auto path = filesystem::path(entries.back());
+    if (!dirFound && (path.filename() == "project.bin" ||
+                      path.filename() == "_org_000.png")) {
+      dir = path.parent_path();
+      if (!dir.empty()) dir += "/";
+      dirFound = true;
+    }
+  }
+  return dir;
+}
+
 void loadAllFromZip(const std::string &zipFn, const int viewportW,
                     const int viewportH, CPData &cpData, ImgData &imgData,
                     RecData &recData, std::string &savedCPs, Imguc &templateImg,
                     Imguc &backgroundImg, ShadingOptions &shadingOpts,
                     ManipulationMode &manipulationMode,
-                    bool &middleMouseSimulation) {
+                    bool &middleMouseSimulation, WorkerPool *pool) {
+  TRACE_SCOPE("loadAllFromZip");
   vector<Imguc> outlineImgsTmp;
   vector<Imguc> regionImgsTmp;
-  unordered_map<int, Img<float>> depthImgsTmp;
-  unordered_map<int, deque<Imguc>> regionWeightImgsTmp;
   zip_t *zip = zip_open(zipFn.c_str(), 0, 'r');
   if (zip == nullptr) {
     DEBUG_CMD_MM(cout << "loadAllFromZip: Could not open " << zipFn << endl;);
     return;
   }
-
-  // Find a directory in the zip file containing _org_000.png.
-  // We assume that the whole project is contained in this directory.
-  const int n = zip_total_entries(zip);
-  string dir = "";
-  fora(i, 0, n) {
-    zip_entry_openbyindex(zip, i);
-    const char *name = zip_entry_name(zip);
-    auto path = filesystem::path(name);
-    if (path.filename() == "_org_000.png") {
-      dir = path.parent_path();
-      if (!dir.empty()) dir += "/";
-      break;
-    }
-    zip_entry_close(zip);
+  const MappedFile archive(zipFn);
+  vector<string> entries;
+  const string dir = findProjectDir(zip, entries);
+
+  loadImagesFromZip(zip, dir, entries, viewportW, viewportH, outlineImgsTmp,
+                    regionImgsTmp, pool);
+  // projects saved by older versions have text files instead of project.bin
+  if (!loadProjectFromZip(zip, archive, dir + "project.bin", cpData, imgData, recData,
+                          savedCPs, shadingOpts, manipulationMode,
+                          middleMouseSimulation, viewportW, viewportH,
+                          outlineImgsTmp, regionImgsTmp, pool)) {
+    loadLayersFromZip(zip, dir + "layers.txt", imgData, recData,
+                      outlineImgsTmp, regionImgsTmp);
+    loadControlPointsFromZip(zip, dir + "cps.txt", savedCPs);
+    loadSettingsFromZip(zip, dir + "settings.txt", cpData, recData,
+                        shadingOpts, manipulationMode, middleMouseSimulation);
   }
-
-  loadImagesFromZip(zip, dir, viewportW, viewportH, outlineImgsTmp,
-                    regionImgsTmp, depthImgsTmp, regionWeightImgsTmp);
-  loadLayersFromZip(zip, dir + "layers.txt", imgData, recData, outlineImgsTmp,
-                    regionImgsTmp);
-  loadControlPointsFromZip(zip, dir + "cps.txt", savedCPs);
   loadImageFromZip(zip, dir + "template.png", templateImg, 3, 4);
   loadImageFromZip(zip, dir + "bg.png", backgroundImg, 3, 4);
-  loadSettingsFromZip(zip, dir + "settings.txt", cpData, recData, shadingOpts,
-                      manipulationMode, middleMouseSimulation);
+  loadReconstructionFromZip(zip, archive, dir + "reconstruction.bin",
+                            recData);
   zip_close(zip);
 }
 
+bool loadProjectImagesFromZip(const std::string &zipFn, Imguc &templateImg,
+                              Imguc &backgroundImg) {
+  zip_t *zip = zip_open(zipFn.c_str(), 0, 'r');
+  if (zip == nullptr) {
+    DEBUG_CMD_MM(
+        cout << "loadProjectImagesFromZip: Could not open " << zipFn << endl;);
+    return false;
+  }
+  vector<string> entries;
+  const string dir = findProjectDir(zip, entries);
+  bool loaded = loadImageFromZip(zip, dir + "template.png", templateImg, 3, 4);
+  loaded |= loadImageFromZip(zip, dir + "bg.png", backgroundImg, 3, 4);
+  zip_close(zip);
+  return loaded;
+}
+
 void saveLayersToStream(ostream &stream, const ImgData &imgData) {
   auto &regionImgs = imgData.regionImgs;
   auto &layers = imgData.layers;
@@ -699,93 +1573,213 @@ bool saveLayersToFile(const std::string &fn, const ImgData &imgData) {
   return true;
 }
 
-bool saveLayersToZip(zip_t *zip, const std::string &fn,
-                     const ImgData &imgData) {
-  stringstream stream;
-  saveLayersToStream(stream, imgData);
-  const string &str = stream.str();
-  const char *data = str.c_str();
-  zip_entry_open(zip, fn.c_str());
-  zip_entry_write(zip, data, str.length());
-  zip_entry_close(zip);
-  return true;
-}
-
-void saveImagesToDir(const string &dir, const ImgData &imgData,
-                     const RecData &recData) {
+// the layer images with the names they are saved under, the outline and the
+// region image of each non-empty region
+static vector<pair<string, const TiledImage *>> layerImagesToSave(
+    const ImgData &imgData) {
   auto &regionImgs = imgData.regionImgs;
   auto &outlineImgs = imgData.outlineImgs;
 
-  DEBUG_CMD_MM(cout << "Saving project to " << dir << endl;)
+  vector<pair<string, const TiledImage *>> images;
   int j = 0;
   forlist(regId, regionImgs) {
     if (regionImgs[regId].isNull()) continue;
     ostringstream oss;
     oss << setw(3) << setfill('0') << j;
-    outlineImgs[regId].savePNG(dir + "/_org_" + oss.str() + ".png");
-    regionImgs[regId].savePNG(dir + "/_seg_" + oss.str() + ".png");
-
+    images.emplace_back("_org_" + oss.str() + ".png", &outlineImgs[regId]);
+    images.emplace_back("_seg_" + oss.str() + ".png", &regionImgs[regId]);
     j++;
   }
+  return images;
 }
 
-void saveImageToZip(zip_t *zip, const string &fn, const Imguc &I) {
-  unsigned char *data = nullptr;
-  int length = 0;
-  I.savePNG(data, length);
-  zip_entry_open(zip, fn.c_str());
-  zip_entry_write(zip, data, length);
-  zip_entry_close(zip);
-  free(data);
+void saveImagesToDir(const string &dir, const ImgData &imgData,
+                     const RecData &recData, WorkerPool *pool) {
+  DEBUG_CMD_MM(cout << "Saving project to " << dir << endl;)
+  const auto images = layerImagesToSave(imgData);
+  parallelFor(pool, images.size(), [&](int begin, int end) {
+    fora(i, begin, end) {
+      images[i].second->toImage().savePNG(dir + "/" + images[i].first);
+    }
+  });
 }
 
-void saveImagesToZip(zip_t *zip, const ImgData &imgData,
-                     const RecData &recData) {
-  auto &regionImgs = imgData.regionImgs;
-  auto &outlineImgs = imgData.outlineImgs;
-  auto &layers = imgData.layers;
+// Encodes the images to PNG in parallel on pool if given. Only the writes
+// of the encoded images are serial, the entries of the zip have to be
+// written one after another.
+static void saveImagesToZip(zip_t *zip,
+                            const vector<pair<string, const Imguc *>> &images,
+                            WorkerPool *pool) {
+  vector<unsigned char *> pngs(images.size(), nullptr);
+  vector<int> lengths(images.size(), 0);
+  parallelFor(pool, images.size(), [&](int begin, int end) {
+    fora(i, begin, end) images[i].second->savePNG(pngs[i], lengths[i]);
+  });
+  forlist(i, images) {
+    if (pngs[i] == nullptr) continue;
+    zip_entry_open(zip, images[i].first.c_str());
+    zip_entry_write(zip, pngs[i], lengths[i]);
+    zip_entry_close(zip);
+    free(pngs[i]);
+  }
+}
 
-  DEBUG_CMD_MM(cout << "Saving project to a zip file" << endl;)
-  int j = 0;
+// the control points to save, in drawing mode they are stored in savedCPs,
+// which are text if loaded from an older project
+static string controlPointsToSave(CPData &cpData, DefData &defData,
+                                  ImgData &imgData, const std::string &savedCPs,
+                                  const ManipulationMode &manipulationMode) {
+  string cps;
+  if (manipulationMode.isGeometryModeActive()) {
+    saveControlPointsToBinary(cps, cpData, defData, imgData);
+  } else {
+    cps = savedCPs;
+  }
+  return cps;
+}
+
+// Writes project.bin with the layers, their images run-length coded (see
+// rlecodec.h) in parallel on pool if withImages is set, the settings and the
+// control points cps unless they are empty.
+static void writeProject(BinaryWriter &writer, CPData &cpData,
+                         ImgData &imgData, RecData &recData,
+                         const std::string &cps, ShadingOptions &shadingOpts,
+                         ManipulationMode &manipulationMode,
+                         bool middleMouseSimulation, bool withImages,
+                         WorkerPool *pool) {
+  writer.beginChunk("LAYR");
+  const auto &regionImgs = imgData.regionImgs;
+  writer.writeI32(regionImgs.size());
+  vector<int> regIds;
   forlist(regId, regionImgs) {
-    if (regionImgs[regId].isNull()) continue;
-    ostringstream oss;
-    oss << setw(3) << setfill('0') << j;
-    saveImageToZip(zip, "_org_" + oss.str() + ".png", outlineImgs[regId]);
-    saveImageToZip(zip, "_seg_" + oss.str() + ".png", regionImgs[regId]);
-    j++;
+    if (!regionImgs[regId].isNull()) regIds.push_back(regId);
+  }
+  auto writeIds = [&](const auto &ids) {
+    writer.writeU32(ids.size());
+    for (int id : ids) writer.writeI32(id);
+  };
+  writeIds(regIds);
+  writeIds(imgData.layers);
+  writer.endChunk();
+
+  if (withImages) {
+    // the outline and the region image of each saved region in the order of
+    // regIds
+    vector<BinaryWriter> masks(regIds.size());
+    parallelFor(pool, regIds.size(), [&](int begin, int end) {
+      fora(i, begin, end) {
+        encodeRLE(imgData.outlineImgs[regIds[i]], masks[i]);
+        encodeRLE(regionImgs[regIds[i]], masks[i]);
+      }
+    });
+    writer.beginChunk("MASK");
+    writer.writeU32(masks.size());
+    for (const auto &mask : masks) {
+      writer.writeBytes(mask.data().data(), mask.data().size());
+    }
+    writer.endChunk();
+  }
+
+  writer.beginChunk("SETT");
+  const auto settings = collectSettings(cpData, recData, shadingOpts,
+                                        manipulationMode,
+                                        middleMouseSimulation);
+  writer.writeU32(settings.size());
+  for (const auto &setting : settings) {
+    writer.writeString(setting.first);
+    writer.writeString(setting.second);
+  }
+  writer.endChunk();
+
+  if (!cps.empty()) {
+    writer.beginChunk("CPS ");
+    writer.writeBytes(cps.data(), cps.size());
+    writer.endChunk();
   }
 }
 
+// Writes project.bin with the layer images (see writeProject()). The control
+// points are written to cps.txt instead if they are text.
+static void saveProjectToZip(zip_t *zip, CPData &cpData, DefData &defData,
+                             ImgData &imgData, RecData &recData,
+                             const std::string &savedCPs,
+                             ShadingOptions &shadingOpts,
+                             ManipulationMode &manipulationMode,
+                             bool middleMouseSimulation, WorkerPool *pool) {
+  const string cps = controlPointsToSave(cpData, defData, imgData, savedCPs,
+                                         manipulationMode);
+  const bool binaryCPs = hasBinaryMagic(cps, cpsMagic);
+  BinaryWriter writer(projectMagic, projectVersion);
+  writeProject(writer, cpData, imgData, recData, binaryCPs ? cps : string(),
+               shadingOpts, manipulationMode, middleMouseSimulation, true,
+               pool);
+  if (!binaryCPs) {
+    zip_entry_open(zip, "cps.txt");
+    zip_entry_write(zip, cps.data(), cps.size());
+    zip_entry_close(zip);
+  }
+
+  const string &data = writer.data();
+  zip_entry_open(zip, "project.bin");
+  zip_entry_write(zip, data.data(), data.size());
+  zip_entry_close(zip);
+}
+
+bool saveProjectToBinary(std::string &data, CPData &cpData, DefData &defData,
+                         ImgData &imgData, RecData &recData,
+                         const std::string &savedCPs,
+                         ShadingOptions &shadingOpts,
+                         ManipulationMode &manipulationMode,
+                         bool middleMouseSimulation) {
+  const string cps = controlPointsToSave(cpData, defData, imgData, savedCPs,
+                                         manipulationMode);
+  BinaryWriter writer(projectMagic, projectVersion);
+  writeProject(writer, cpData, imgData, recData, cps, shadingOpts,
+               manipulationMode, middleMouseSimulation, false, nullptr);
+  data = writer.data();
+  return true;
+}
+
 void saveAllToZip(const std::string &zipFn, CPData &cpData, DefData &defData,
                   ImgData &imgData, RecData &recData,
                   const std::string &savedCPs, const Imguc &templateImg,
                   const Imguc &backgroundImg, ShadingOptions &shadingOpts,
                   ManipulationMode &manipulationMode,
-                  bool middleMouseSimulation) {
+                  bool middleMouseSimulation, bool saveReconstruction,
+                  WorkerPool *pool) {
+  TRACE_SCOPE("saveAllToZip");
   zip_t *zip = zip_open(zipFn.c_str(), ZIP_DEFAULT_COMPRESSION_LEVEL, 'w');
   if (zip == nullptr) {
     DEBUG_CMD_MM(cout << "saveAllToZip: Could not open " << zipFn << endl;);
     return;
   }
-  saveImagesToZip(zip, imgData, recData);
-  saveLayersToZip(zip, "layers.txt", imgData);
-  saveControlPointsToZip(zip, "cps.txt", manipulationMode, savedCPs, cpData,
-                         defData, imgData);
-  if (!templateImg.isNull()) saveImageToZip(zip, "template.png", templateImg);
-  if (!backgroundImg.isNull()) saveImageToZip(zip, "bg.png", backgroundImg);
-  saveSettingsToZip(zip, "settings.txt", cpData, recData, shadingOpts,
-                    manipulationMode, middleMouseSimulation);
+  DEBUG_CMD_MM(cout << "Saving project to a zip file" << endl;)
+  vector<pair<string, const Imguc *>> images;
+  if (!templateImg.isNull()) images.emplace_back("template.png", &templateImg);
+  if (!backgroundImg.isNull()) images.emplace_back("bg.png", &backgroundImg);
+  saveImagesToZip(zip, images, pool);
+  saveProjectToZip(zip, cpData, defData, imgData, recData, savedCPs,
+                   shadingOpts, manipulationMode, middleMouseSimulation, pool);
+  // only a reconstruction of the current drawings at full resolution
+  const auto &result = defData.recResult;
+  if (saveReconstruction && result &&
+      result->inputsHash ==
+          reconstructionInputsHash(recData, imgData, recData.triangleOpts)) {
+    // stored without compression to be read in place (see loadAllFromZip())
+    zip_set_level(zip, 0);
+    saveReconstructionToZip(zip, "reconstruction.bin", *result);
+    zip_set_level(zip, ZIP_DEFAULT_COMPRESSION_LEVEL);
+  }
   zip_close(zip);
 }
 
 void saveAllToDir(const std::string &dir,
                   const ManipulationMode &manipulationMode,
                   const std::string &savedCPs, CPData &cpData, DefData &defData,
-                  ImgData &imgData, RecData &recData) {
+                  ImgData &imgData, RecData &recData, WorkerPool *pool) {
   auto &VCurr = defData.VCurr;
-  auto &VRest = defData.VRest;
-  auto &Faces = defData.Faces;
+  auto &VRest = defData.mesh.VRest;
+  auto &Faces = defData.mesh.F;
 
   auto &layers = imgData.layers;
   auto &mergedOutlinesImg = imgData.mergedOutlinesImg;
@@ -803,7 +1797,7 @@ void saveAllToDir(const std::string &dir,
     }
   }
 
-  saveImagesToDir(dir, imgData, recData);
+  saveImagesToDir(dir, imgData, recData, pool);
 
   // remove images not belonging to the current project anymore
   fora(i, layers.size(), 255 + 1) {
@@ -16,8 +16,11 @@
 #define LOADSAVE_H
 
 #include <string>
+#include <unordered_map>
+#include <utility>
 
 #include "commonStructs.h"
+#include "workerpool.h"
 
 bool saveControlPointsToStream(std::ostream &stream, CPData &cpData,
                                DefData &defData, ImgData &imgData);
@@ -28,27 +31,78 @@ bool saveControlPointsToFile(const std::string &fn,
 bool loadControlPointsFromFile(const std::string &fn, std::string &savedCPs);
 bool loadControlPointsFromStream(std::istream &stream, CPData &cpData,
                                  DefData &defData, ImgData &imgData);
+// The control points and their animations in a versioned little-endian
+// binary format (see binarychunks.h), which is faster to load than the text
+// of long recorded animations. Projects store them in project.bin along
+// with the layers and the settings, older projects with text files are
+// still loaded.
+bool saveControlPointsToBinary(std::string &data, CPData &cpData,
+                               DefData &defData, ImgData &imgData);
+// loads savedCPs in either format
+bool loadControlPoints(const std::string &savedCPs, CPData &cpData,
+                       DefData &defData, ImgData &imgData);
+
+// project.bin without the layer images (the layer order, the settings and
+// the control points), e.g. for the autosave journal (see projectjournal.h)
+bool saveProjectToBinary(std::string &data, CPData &cpData, DefData &defData,
+                         ImgData &imgData, RecData &recData,
+                         const std::string &savedCPs,
+                         ShadingOptions &shadingOpts,
+                         ManipulationMode &manipulationMode,
+                         bool middleMouseSimulation);
+// Loads data written by saveProjectToBinary() with the outline and the region
+// image of each layer given by its region ID at the time it was saved.
+bool loadProjectFromBinary(
+    const std::string &data,
+    const std::unordered_map<int, std::pair<Imguc, Imguc>> &layerImgs,
+    const int viewportW, const int viewportH, CPData &cpData,
+    ImgData &imgData, RecData &recData, std::string &savedCPs,
+    ShadingOptions &shadingOpts, ManipulationMode &manipulationMode,
+    bool &middleMouseSimulation, WorkerPool *pool = nullptr);
+
+// binary snapshot of a reconstruction, it is reused when a project is opened
+// (see RecData::storedResult)
+bool saveReconstructionToStream(std::ostream &stream, const RecResult &result);
+bool loadReconstructionFromStream(std::istream &stream, RecResult &result);
 
 void loadImages(const std::string &dir, const int viewportW,
                 const int viewportH, ImgData &imgData, RecData &recData);
+// The layer images are found in a single listing of the directory or the
+// entries of the zip file and decoded in parallel on pool if given. Zip
+// projects store them run-length coded in project.bin instead (see
+// rlecodec.h), the PNG files of older projects are still loaded. On native
+// builds the zip file is mapped to memory and entries stored without
+// compression (the saved reconstruction) are read in place. The performance
+// profile of the settings is applied to recData and shadingOpts, the caller
+// applies it to the deformation (see applyPerfProfile()).
 void loadAllFromDir(const std::string &dir, const int viewportW,
                     const int viewportH, ImgData &imgData, RecData &recData,
-                    std::string &savedCPs);
+                    std::string &savedCPs, WorkerPool *pool = nullptr);
 void loadAllFromZip(const std::string &zipFn, const int viewportW,
                     const int viewportH, CPData &cpData, ImgData &imgData,
                     RecData &recData, std::string &savedCPs, Imguc &templateImg,
                     Imguc &backgroundImg, ShadingOptions &shadingOpts,
                     ManipulationMode &manipulationMode,
-                    bool &middleMouseSimulation);
+                    bool &middleMouseSimulation, WorkerPool *pool = nullptr);
+// Only the template and the background image of the project zipFn, for
+// projects opened before these entries were available (see
+// MainWindow::loadProjectImages()). False if there was neither.
+bool loadProjectImagesFromZip(const std::string &zipFn, Imguc &templateImg,
+                              Imguc &backgroundImg);
 void saveAllToDir(const std::string &dir,
                   const ManipulationMode &manipulationMode,
                   const std::string &savedCPs, CPData &cpData, DefData &defData,
-                  ImgData &imgData, RecData &recData);
+                  ImgData &imgData, RecData &recData,
+                  WorkerPool *pool = nullptr);
+// The images are encoded in parallel on pool if given, only the writes of the
+// zip entries are serial. The layer images are stored run-length coded in
+// project.bin, the template and the background as PNG files.
 void saveAllToZip(const std::string &zipFn, CPData &cpData, DefData &defData,
                   ImgData &imgData, RecData &recData,
                   const std::string &savedCPs, const Imguc &templateImg,
                   const Imguc &backgroundImg, ShadingOptions &shadingOpts,
                   ManipulationMode &manipulationMode,
-                  bool middleMouseSimulation);
+                  bool middleMouseSimulation, bool saveReconstruction = true,
+                  WorkerPool *pool = nullptr);
 
 #endif  // LOADSAVE_H
@@ -12,12 +12,20 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <cstdlib>
 #include <iostream>
+#include <string>
 
 #include "mainwindow.h"
+#include "recremote.h"
+#include "workerpool.h"
 #ifdef __EMSCRIPTEN__
 #include <emscripten.h>
 #endif
+#ifdef MM_ENGINE_WORKER
+#include <emscripten/proxying.h>
+#include <pthread.h>
+#endif
 
 using namespace std;
 
@@ -37,10 +45,34 @@ EMSCRIPTEN_KEEPALIVE void pasteSelectedAnim() {
   mainWindow.pasteSelectedAnim();
 }
 
+EMSCRIPTEN_KEEPALIVE int getSelectedAnimNumLayers() {
+  return mainWindow.getSelectedAnimNumLayers();
+}
+
+EMSCRIPTEN_KEEPALIVE void setSelectedAnimLayerWeight(int layer, float weight) {
+  mainWindow.setSelectedAnimLayerWeight(layer, weight);
+}
+
+EMSCRIPTEN_KEEPALIVE void removeSelectedAnimLayer(int layer) {
+  mainWindow.removeSelectedAnimLayer(layer);
+}
+
+EMSCRIPTEN_KEEPALIVE void flattenSelectedAnimLayers() {
+  mainWindow.flattenSelectedAnimLayers();
+}
+
 EMSCRIPTEN_KEEPALIVE void offsetSelectedCpAnimsByFrames(double offset) {
   mainWindow.offsetSelectedCpAnimsByFrames(offset);
 }
 
+EMSCRIPTEN_KEEPALIVE void offsetSelectedCpAnimsByPercentage(double offset) {
+  mainWindow.offsetSelectedCpAnimsByPercentage(offset);
+}
+
+EMSCRIPTEN_KEEPALIVE void resampleCpAnims(int length, bool selectedOnly) {
+  mainWindow.resampleCpAnims(length, selectedOnly);
+}
+
 EMSCRIPTEN_KEEPALIVE void loadBackgroundImage() {
   mainWindow.loadBackgroundImageFromFile();
 }
@@ -85,13 +117,55 @@ EMSCRIPTEN_KEEPALIVE bool getCPsVisibility() {
   return mainWindow.getCPsVisibility();
 }
 
+EMSCRIPTEN_KEEPALIVE void setPlaybackSkinning(bool enabled) {
+  mainWindow.setPlaybackSkinning(enabled);
+}
+
+EMSCRIPTEN_KEEPALIVE bool getPlaybackSkinning() {
+  return mainWindow.getPlaybackSkinning();
+}
+
+EMSCRIPTEN_KEEPALIVE void setAnimCacheEnabled(bool enabled) {
+  mainWindow.setAnimCacheEnabled(enabled);
+}
+
+EMSCRIPTEN_KEEPALIVE bool getAnimCacheEnabled() {
+  return mainWindow.getAnimCacheEnabled();
+}
+
+EMSCRIPTEN_KEEPALIVE void setLibraryNumThreads(int numThreads) {
+  mainWindow.setLibraryNumThreads(numThreads);
+}
+
+EMSCRIPTEN_KEEPALIVE int getLibraryNumThreads() {
+  return mainWindow.getLibraryNumThreads();
+}
+
+EMSCRIPTEN_KEEPALIVE void setPerformanceProfile(int profile) {
+  mainWindow.setPerformanceProfile(profile);
+}
+
+EMSCRIPTEN_KEEPALIVE int getPerformanceProfile() {
+  return mainWindow.getPerformanceProfile();
+}
+
 EMSCRIPTEN_KEEPALIVE bool isAnimationPlaying() {
   return mainWindow.isAnimationPlaying();
 }
 
+EMSCRIPTEN_KEEPALIVE bool pushCPInput(int cpId, double x, double y, double z,
+                                      double seconds) {
+  return mainWindow.pushCPInput(cpId, x, y, z, seconds);
+}
+
+EMSCRIPTEN_KEEPALIVE void setCPInputRecording(bool active) {
+  mainWindow.setCPInputRecording(active);
+}
+
 EMSCRIPTEN_KEEPALIVE void setAnimRecMode(int animModeInt) {
   AnimMode animMode = ANIM_MODE_TIME_SCALED;
-  if (animModeInt != 0) animMode = ANIM_MODE_OVERWRITE;
+  if (animModeInt == 1) animMode = ANIM_MODE_OVERWRITE;
+  if (animModeInt == 2) animMode = ANIM_MODE_LAYER;
   mainWindow.setAnimRecMode(animMode);
 }
 
@@ -99,6 +173,7 @@ EMSCRIPTEN_KEEPALIVE int getAnimRecMode() {
   AnimMode mode = mainWindow.getAnimRecMode();
   int modeInt = 0;
   if (mode == ANIM_MODE_OVERWRITE) modeInt = 1;
+  if (mode == ANIM_MODE_LAYER) modeInt = 2;
   return modeInt;
 }
 
@@ -151,6 +226,79 @@ EMSCRIPTEN_KEEPALIVE bool isArmpitsStitchingEnabled() {
   return mainWindow.isArmpitsStitchingEnabled();
 }
 
+EMSCRIPTEN_KEEPALIVE void setInflationAmount(double amount, bool preview) {
+  mainWindow.setInflationAmount(amount, preview);
+}
+
+EMSCRIPTEN_KEEPALIVE double getInflationAmount() {
+  return mainWindow.getInflationAmount();
+}
+
+// the string is valid until the next call
+EMSCRIPTEN_KEEPALIVE const char *getReconstructionStats() {
+  static std::string stats;
+  stats = mainWindow.getReconstructionStats();
+  return stats.c_str();
+}
+
+// the string is valid until the next call
+EMSCRIPTEN_KEEPALIVE const char *getMemoryStats() {
+  static std::string stats;
+  stats = mainWindow.getMemoryStats();
+  return stats.c_str();
+}
+
+// the string is valid until the next call
+EMSCRIPTEN_KEEPALIVE const char *getFrameProfile() {
+  static std::string profile;
+  profile = mainWindow.getFrameProfile();
+  return profile.c_str();
+}
+
+// the string is valid until the next call
+EMSCRIPTEN_KEEPALIVE const char *getAllocStats() {
+  static std::string stats;
+  stats = mainWindow.getAllocStats();
+  return stats.c_str();
+}
+
+EMSCRIPTEN_KEEPALIVE void setFrameProfileVisibility(bool visible) {
+  mainWindow.setFrameProfileVisibility(visible);
+}
+
+EMSCRIPTEN_KEEPALIVE bool getFrameProfileVisibility() {
+  return mainWindow.getFrameProfileVisibility();
+}
+
+EMSCRIPTEN_KEEPALIVE void enableAdaptiveQuality(bool enabled) {
+  mainWindow.enableAdaptiveQuality(enabled);
+}
+
+EMSCRIPTEN_KEEPALIVE bool isAdaptiveQualityEnabled() {
+  return mainWindow.isAdaptiveQualityEnabled();
+}
+
+EMSCRIPTEN_KEEPALIVE void setFrameBudget(double ms) {
+  mainWindow.setFrameBudget(ms);
+}
+
+EMSCRIPTEN_KEEPALIVE double getFrameBudget() {
+  return mainWindow.getFrameBudget();
+}
+
+EMSCRIPTEN_KEEPALIVE void setTracing(bool enabled) {
+  mainWindow.setTracing(enabled);
+}
+
+EMSCRIPTEN_KEEPALIVE bool getTracing() { return mainWindow.getTracing(); }
+
+// the string is valid until the next call
+EMSCRIPTEN_KEEPALIVE const char *getTrace() {
+  static std::string trace;
+  trace = mainWindow.getTrace();
+  return trace.c_str();
+}
+
 EMSCRIPTEN_KEEPALIVE void enableNormalSmoothing(bool enabled) {
   mainWindow.enableNormalSmoothing(enabled);
 }
@@ -159,6 +307,14 @@ EMSCRIPTEN_KEEPALIVE bool isNormalSmoothingEnabled() {
   return mainWindow.isNormalSmoothingEnabled();
 }
 
+EMSCRIPTEN_KEEPALIVE void enableImplicitNormalSmoothing(bool enabled) {
+  mainWindow.enableImplicitNormalSmoothing(enabled);
+}
+
+EMSCRIPTEN_KEEPALIVE bool isImplicitNormalSmoothingEnabled() {
+  return mainWindow.isImplicitNormalSmoothingEnabled();
+}
+
 EMSCRIPTEN_KEEPALIVE void enableMiddleMouseSimulation(bool enabled) {
   mainWindow.enableMiddleMouseSimulation(enabled);
 }
@@ -169,47 +325,111 @@ EMSCRIPTEN_KEEPALIVE bool isMiddleMouseSimulationEnabled() {
 
 EMSCRIPTEN_KEEPALIVE int getVersion() { return APP_VERSION; }
 
+// what the module was built from and with as JSON, the "build" of the
+// records of ui/perfshell.html (see buildInfo() in bench.cpp)
+EMSCRIPTEN_KEEPALIVE const char *getBuildInfo() {
+  static std::string info;
+#if defined(MM_GIT_REVISION)
+  info = "{\"revision\":\"" MM_GIT_REVISION "\"";
+#else
+  info = "{\"revision\":\"unknown\"";
+#endif
+  info += ",\"compiler\":\"clang " __clang_version__ "\",\"target\":\"wasm\"";
+#if defined(__wasm_simd128__)
+  info += ",\"simd\":\"simd128\"";
+#else
+  info += ",\"simd\":\"none\"";
+#endif
+#if defined(__EMSCRIPTEN_PTHREADS__)
+  info += ",\"threads\":" + std::to_string(WorkerPool::defaultNumThreads() + 1);
+#else
+  info += ",\"threads\":0";
+#endif
+#if defined(MM_ENGINE_WORKER)
+  info += ",\"engineWorker\":true";
+#else
+  info += ",\"engineWorker\":false";
+#endif
+#if defined(NDEBUG)
+  info += ",\"optimized\":true}";
+#else
+  info += ",\"optimized\":false}";
+#endif
+  return info.c_str();
+}
+
+// the project written to /tmp/sceneCharacter.zip is added to the scene
+EMSCRIPTEN_KEEPALIVE int addSceneCharacter(double x, double y) {
+  return mainWindow.addSceneCharacter("/tmp/sceneCharacter.zip",
+                                      Eigen::Vector3d(x, y, 0));
+}
+
+EMSCRIPTEN_KEEPALIVE void clearScene() { mainWindow.clearScene(); }
+
 EMSCRIPTEN_KEEPALIVE void openProject() {
   int prevMode = getManipulationMode();
   ManipulationMode mode =
       mainWindow.openProject("/tmp/projectOpened.zip", false);
   int newMode = convertManipulationModeToInt(mode);
-  EM_ASM(js_projectOpened(););
+  MAIN_THREAD_ASYNC_EM_ASM(js_projectOpened(););
   //  if (prevMode != newMode) {
-  EM_ASM({ js_manipulationModeChanged($0); }, newMode);
+  MAIN_THREAD_ASYNC_EM_ASM({ js_manipulationModeChanged($0); }, newMode);
   //  }
 }
 
 EMSCRIPTEN_KEEPALIVE void saveProject() {
   mainWindow.saveProject("/tmp/mm_project.zip");
-  EM_ASM(js_projectSaved(););
+  MAIN_THREAD_ASYNC_EM_ASM(js_projectSaved(););
+}
+
+EMSCRIPTEN_KEEPALIVE void setAutosaveInterval(double seconds) {
+  mainWindow.setAutosaveInterval(seconds);
+}
+
+EMSCRIPTEN_KEEPALIVE double getAutosaveInterval() {
+  return mainWindow.getAutosaveInterval();
+}
+
+EMSCRIPTEN_KEEPALIVE void recoverAutosave() {
+  ManipulationMode mode = mainWindow.recoverAutosave(false);
+  int newMode = convertManipulationModeToInt(mode);
+  MAIN_THREAD_ASYNC_EM_ASM(js_projectOpened(););
+  MAIN_THREAD_ASYNC_EM_ASM({ js_manipulationModeChanged($0); }, newMode);
 }
 
 EMSCRIPTEN_KEEPALIVE void exportTextureTemplate() {
   mainWindow.exportTextureTemplate("/tmp/mm_template.png");
-  EM_ASM(js_textureTemplateExported(););
+  MAIN_THREAD_ASYNC_EM_ASM(js_textureTemplateExported(););
 }
 
 EMSCRIPTEN_KEEPALIVE void resetView() { mainWindow.resetView(); }
 
-EMSCRIPTEN_KEEPALIVE void openExampleProject(unsigned int id) {
-  if (id > 8) return;
-  int prevMode = getManipulationMode();
-  char examples[8][20] = {
+// the zip of the example id, written by openExample() in main.js without
+// its template and background image first and complete after
+static std::string exampleProjectFn(unsigned int id) {
+  const char *examples[8] = {
       "antelope",         "bird",  "box",       "helene-dino",
       "helene-wienerdog", "heart", "chihuahua", "helene-tree",
   };
-  char fn[255];
-  sprintf(fn, "/tmp/examples/%s.zip", examples[id]);
-  ManipulationMode mode = mainWindow.openProject(fn, false);
+  return std::string("/tmp/examples/") + examples[id] + ".zip";
+}
+
+EMSCRIPTEN_KEEPALIVE void openExampleProject(unsigned int id) {
+  if (id >= 8) return;
+  ManipulationMode mode = mainWindow.openProject(exampleProjectFn(id), false);
   int newMode = convertManipulationModeToInt(mode);
-  EM_ASM(js_projectOpened(););
-  EM_ASM({ js_manipulationModeChanged($0); }, newMode);
+  MAIN_THREAD_ASYNC_EM_ASM(js_projectOpened(););
+  MAIN_THREAD_ASYNC_EM_ASM({ js_manipulationModeChanged($0); }, newMode);
+}
+
+EMSCRIPTEN_KEEPALIVE void loadExampleProjectImages(unsigned int id) {
+  if (id >= 8) return;
+  mainWindow.loadProjectImages(exampleProjectFn(id));
 }
 
 EMSCRIPTEN_KEEPALIVE void exportAsOBJ() {
   mainWindow.exportAsOBJ("/tmp", "mm_frame", true);
-  EM_ASM(js_frameExportedToOBJ(););
+  MAIN_THREAD_ASYNC_EM_ASM(js_frameExportedToOBJ(););
 }
 
 EMSCRIPTEN_KEEPALIVE void exportAnimationStart(int preroll, bool solveForZ,
@@ -227,10 +447,63 @@ EMSCRIPTEN_KEEPALIVE void exportAnimationAbort() {
   }
 }
 
+EMSCRIPTEN_KEEPALIVE void setExportSkinning(bool enabled) {
+  mainWindow.setExportSkinning(enabled);
+}
+
+EMSCRIPTEN_KEEPALIVE bool getExportSkinning() {
+  return mainWindow.getExportSkinning();
+}
+
+EMSCRIPTEN_KEEPALIVE void setExportQuantized(bool enabled) {
+  mainWindow.setExportQuantized(enabled);
+}
+
+EMSCRIPTEN_KEEPALIVE bool getExportQuantized() {
+  return mainWindow.getExportQuantized();
+}
+
+EMSCRIPTEN_KEEPALIVE void setExportCompressed(bool enabled) {
+  mainWindow.setExportCompressed(enabled);
+}
+
+EMSCRIPTEN_KEEPALIVE bool getExportCompressed() {
+  return mainWindow.getExportCompressed();
+}
+
+EMSCRIPTEN_KEEPALIVE void setExportOBJSequence(bool enabled) {
+  mainWindow.setExportOBJSequence(enabled);
+}
+
+EMSCRIPTEN_KEEPALIVE bool getExportOBJSequence() {
+  return mainWindow.getExportOBJSequence();
+}
+
+EMSCRIPTEN_KEEPALIVE void setExportKeyframeTolerance(float tolerance) {
+  mainWindow.setExportKeyframeTolerance(tolerance);
+}
+
+EMSCRIPTEN_KEEPALIVE float getExportKeyframeTolerance() {
+  return mainWindow.getExportKeyframeTolerance();
+}
+
 EMSCRIPTEN_KEEPALIVE bool exportAnimationRunning() {
   return mainWindow.exportAnimationRunning();
 }
 
+// the page reads the GLB as a view of the WASM memory
+EMSCRIPTEN_KEEPALIVE const unsigned char *getExportedModelData() {
+  return mainWindow.getExportedModel().data();
+}
+
+EMSCRIPTEN_KEEPALIVE int getExportedModelSize() {
+  return mainWindow.getExportedModel().size();
+}
+
+EMSCRIPTEN_KEEPALIVE void releaseExportedModel() {
+  mainWindow.releaseExportedModel();
+}
+
 EMSCRIPTEN_KEEPALIVE void pauseAnimation() { mainWindow.pauseAnimation(); }
 
 EMSCRIPTEN_KEEPALIVE void resumeAnimation() { mainWindow.resumeAnimation(); }
@@ -252,13 +525,110 @@ EMSCRIPTEN_KEEPALIVE void moveSelectedLayersInDepth(int step,
   mainWindow.moveSelectedLayersInDepth(step, overlapping);
 }
 
+EMSCRIPTEN_KEEPALIVE bool undoDrawing() { return mainWindow.undoDrawing(); }
+
+EMSCRIPTEN_KEEPALIVE bool redoDrawing() { return mainWindow.redoDrawing(); }
+
+EMSCRIPTEN_KEEPALIVE bool undoControlPoints() {
+  return mainWindow.undoControlPoints();
+}
+
+EMSCRIPTEN_KEEPALIVE bool redoControlPoints() {
+  return mainWindow.redoControlPoints();
+}
+
 EMSCRIPTEN_KEEPALIVE int getNumberOfLayers() {
   return mainWindow.getNumberOfLayers();
 }
+
+#ifdef MM_ENGINE_WORKER
+// With MM_EMSCRIPTEN_ENGINE_WORKER main() and with it the whole MainWindow
+// run on a worker and draw to the canvas transferred to it as an
+// OffscreenCanvas. The page must not call the functions above directly, it
+// posts them to the worker with engineCall() instead and gets the result
+// back in js_engineReply() (see mm.call() in ui/main.js).
+static pthread_t engineThread;
+
+struct EngineCall {
+  int requestId;
+  std::string name;
+  double args[6];
+};
+
+static void runEngineCall(void *arg) {
+  EngineCall *call = static_cast<EngineCall *>(arg);
+  // strings and pointers are returned as addresses, the memory is shared
+  const double result = EM_ASM_DOUBLE(
+      {
+        var args = [];
+        for (var i = 0; i < 6; i++) args.push(HEAPF64[($1 >> 3) + i]);
+        return Number(Module['_' + UTF8ToString($0)].apply(null, args)) || 0;
+      },
+      call->name.c_str(), call->args);
+  MAIN_THREAD_ASYNC_EM_ASM({ js_engineReply($0, $1); }, call->requestId,
+                           result);
+  delete call;
+}
+
+EMSCRIPTEN_KEEPALIVE void engineCall(int requestId, const char *name,
+                                     double a0, double a1, double a2,
+                                     double a3, double a4, double a5) {
+  EngineCall *call =
+      new EngineCall{requestId, name, {a0, a1, a2, a3, a4, a5}};
+  emscripten_proxy_async(emscripten_proxy_get_system_queue(), engineThread,
+                         runEngineCall, call);
+}
+#endif
 }
 #endif
 
 int main(int argc, char *argv[]) {
+#ifdef MM_ENGINE_WORKER
+  engineThread = pthread_self();
+  MAIN_THREAD_ASYNC_EM_ASM(js_engineStarted(););
+#endif
+#ifdef __EMSCRIPTEN__
+  // ?recserver=URL of the page: the reconstructions are run on that server
+  // (see recserver.cpp), locally only if it fails
+  char recServer[1024];
+  const int recServerLength = MAIN_THREAD_EM_ASM_INT(
+      {
+        var url = new URLSearchParams(location.search).get('recserver') || '';
+        if (url.length >= $1 || /[^\x20-\x7e]/.test(url)) return 0;
+        for (var i = 0; i < url.length; i++) {
+          HEAPU8[$0 + i] = url.charCodeAt(i);
+        }
+        return url.length;
+      },
+      recServer, sizeof(recServer));
+  setReconstructionServer(string(recServer, recServerLength));
+#endif
+#ifndef __EMSCRIPTEN__
+  // --record session: saves the project to session.zip and records the
+  // input to session, --replay session: replays it as fast as possible and
+  // writes the paint times to session.report
+  if (argc == 3 && string(argv[1]) == "--replay") {
+    const string session = argv[2];
+    return mainWindow.replaySession(session, session + ".report") ? 0 : 1;
+  }
+  if (argc == 3 && string(argv[1]) == "--record") {
+    if (!mainWindow.startSessionRecording(argv[2])) return 1;
+  }
+  // --character project.zip x y, can be repeated: adds a character moved
+  // by (x, y) pixels to the scene
+  for (int i = 1; i + 3 < argc; i++) {
+    if (string(argv[i]) != "--character") continue;
+    mainWindow.addSceneCharacter(
+        argv[i + 1], Eigen::Vector3d(atof(argv[i + 2]), atof(argv[i + 3]), 0));
+    i += 3;
+  }
+  // --recserver URL: reconstructs on that server like ?recserver= does in
+  // the browser
+  for (int i = 1; i + 1 < argc; i++) {
+    if (string(argv[i]) == "--recserver") setReconstructionServer(argv[i + 1]);
+  }
+#endif
   mainWindow.runLoop();
+  mainWindow.stopSessionRecording();
   return 0;
 }
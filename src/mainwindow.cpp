@@ -14,71 +14,149 @@
 
 #include "mainwindow.h"
 
-#include <igl/per_vertex_normals.h>
-#include <igl/writeOBJ.h>
 #include <image/imageUtils.h>
 #include <miscutils/camera.h>
 #include <shaderMatcap/shaderMatcap.h>
 
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "allocstats.h"
+#include "bitmask.h"
+#include "exportobj.h"
 #include "loadsave.h"
 #include "macros.h"
+#include "matcapOrange.h"
+#include "memorystats.h"
+#include "perfprofile.h"
 #include "reconstruction.h"
 #include "shaderTextureVertexCoords.h"
+#include "softrasterizer.h"
+#include "tracing.h"
+#include "workerpool.h"
 
 using namespace std;
 using namespace igl;
 using namespace Eigen;
 
+template <typename Derived>
+static bool sameMatrix(const PlainObjectBase<Derived> &A,
+                       const PlainObjectBase<Derived> &B) {
+  return A.rows() == B.rows() && A.cols() == B.cols() &&
+         memcmp(A.data(), B.data(),
+                A.size() * sizeof(typename Derived::Scalar)) == 0;
+}
+
+static bool sameMatrix(const SparseMatrix<double> &A,
+                       const SparseMatrix<double> &B) {
+  if (A.rows() != B.rows() || A.cols() != B.cols() ||
+      A.nonZeros() != B.nonZeros() || !A.isCompressed() ||
+      !B.isCompressed())
+    return false;
+  const int nnz = A.nonZeros();
+  return memcmp(A.outerIndexPtr(), B.outerIndexPtr(),
+                (A.outerSize() + 1) * sizeof(int)) == 0 &&
+         memcmp(A.innerIndexPtr(), B.innerIndexPtr(), nnz * sizeof(int)) ==
+             0 &&
+         memcmp(A.valuePtr(), B.valuePtr(), nnz * sizeof(double)) == 0;
+}
+
 MainWindow::MainWindow(int w, int h, const std::string &windowTitle)
     : MyWindow(w, h, windowTitle) {
   viewportW = w;
   viewportH = h;
   //  setMouseEventsSimulationByTouch(false);
+  recTask.setFinishedCallback([this]() { wakeUp(); });
+  defTask.setFinishedCallback([this]() { wakeUp(); });
+  exportTask.setFinishedCallback([this]() { wakeUp(); });
+  ::setLibraryNumThreads(recData.numThreads);
 
-  initOpenGL();
+  // the OpenGL state is created by the first drawing of the model, the
+  // image mode doesn't need it
   initImageLayers();
   recreateMergedImgs();
 
-  // main
-  depthBuffer = Img<float>(windowWidth, windowHeight, 1);
-  frameBuffer = Imguc(windowWidth, windowHeight, 4);
-
   // init screen image
   screenImg = Imguc(windowWidth, windowHeight, 4, 3);
 }
 
 MainWindow::~MainWindow() { destroyOpenGL(); }
 
+// the matcap images compiled into the application (see embed_file in
+// CMakeLists.txt), indexed by ShadingOptions::matcapImg
+static const struct {
+  const unsigned char *data;
+  int length;
+} matcaps[] = {
+    {matcapOrange, sizeof(matcapOrange)},
+};
+static const int numMatcaps = sizeof(matcaps) / sizeof(matcaps[0]);
+
+static Imguc loadMatcap(int i) {
+  return Imguc::loadImage(const_cast<unsigned char *>(matcaps[i].data),
+                          matcaps[i].length, -1, 3);
+}
+
 void MainWindow::initOpenGL() {
+  if (glInitialized) return;
+  glInitialized = true;
   // opengl
   GLMeshInitBuffers(glData.meshData);
+  GLMeshInitBuffers(glData.lodMeshData);
+  glData.uploadedLOD = -1;
+  GLMeshInitBuffers(glData.sceneMeshData);
+  glData.uploadedSceneVersion = UINT64_MAX;
   glData.shaderMatcap = loadShaders(SHADERMATCAP_VERT, SHADERMATCAP_FRAG);
   glData.shaderTexture =
       loadShaders(SHADERTEXVERTCOORDS_VERT, SHADERTEXVERTCOORDS_FRAG);
-  deque<string> textureFns{
-      datadirname + "/shaders/matcapOrange.jpg",
-  };
-  loadTexturesToGPU(textureFns, glData.textureNames);
-  if (shadingOpts.matcapImg != -1)
-    glBindTexture(GL_TEXTURE_2D, glData.textureNames[shadingOpts.matcapImg]);
+  glData.matcapUniforms = getCameraUniforms(glData.shaderMatcap);
+  glData.textureUniforms = getCameraUniforms(glData.shaderTexture);
+  glData.textureTexLocation =
+      glGetUniformLocation(glData.shaderTexture, "tex");
+  glData.textureUseShadingLocation =
+      glGetUniformLocation(glData.shaderTexture, "useShading");
+  // matcaps are decoded and uploaded on their first use
+  glData.textureNames.assign(numMatcaps, 0);
+  glOverlay.init();
+  glPicker.init();
+  glMorph.init();
+}
+
+void MainWindow::destroyOpenGL() {
+  if (!glInitialized) return;
+  glInitialized = false;
+  GLMeshDestroyBuffers(glData.meshData);
+  GLMeshDestroyBuffers(glData.lodMeshData);
+  GLMeshDestroyBuffers(glData.sceneMeshData);
+  glOverlay.destroy();
+  glPicker.destroy();
+  glMorph.destroy();
 }
 
-void MainWindow::destroyOpenGL() { GLMeshDestroyBuffers(glData.meshData); }
+GLuint MainWindow::matcapTexture(int i) {
+  GLuint &name = glData.textureNames[i];
+  if (name == 0) loadTextureToGPU(loadMatcap(i), name);
+  return name;
+}
 
 bool MainWindow::paintEvent() {
-  if (!repaint) {
-    SDL_Delay(1);
-    return false;
-  }
+  applyAsyncReconstruction();
+  applyAsyncExport();
+  autosave();
+  if (!repaint) return false;
   repaint = false;
-  MEASURE_TIME_START(tStartAll);
+  frameProfiler.beginFrame();
+  applyQuality();
 
   MyPainter painter(this);
 
   painter.setColor(bgColor);
   painter.clearToColor();
   rasterizeGPUClear();
-  screenImg.fill(0);
+  // overlays are drawn into screenImg only when needed, so clear it only
+  // when the last frame actually painted into it
+  if (screenImgPainted) screenImg.fill(0);
   MyPainter painterOther(screenImg);
 
   bool transitionRunning = drawModeTransition(painter, painterOther);
@@ -94,16 +172,36 @@ bool MainWindow::paintEvent() {
 
     // animation
     if (manipulationMode.mode == ANIMATE_MODE) {
+      ALLOC_SCOPE(ALLOC_PLAYBACK);
       cpAnimationPlaybackAndRecord();
     }
+    if (manipulationMode.mode == ANIMATE_MODE && scene.size() > 0) {
+      FrameProfiler::Scope scope(frameProfiler, FrameProfiler::DEFORMATION);
+      ALLOC_SCOPE(ALLOC_DEFORM);
+      updateScene();
+    }
 
     // draw 3D model
-    computeNormals(shadingOpts.useNormalSmoothing);
-    drawGeometryMode(painter, painterOther);
+    {
+      FrameProfiler::Scope scope(frameProfiler, FrameProfiler::NORMALS);
+      ALLOC_SCOPE(ALLOC_NORMALS);
+      // a level of detail drawn in the last frame computes its own normals
+      if (meshLODLevel == -1 || softwareRendering)
+        computeNormals(shadingOpts.useNormalSmoothing);
+    }
+    {
+      FrameProfiler::Scope scope(frameProfiler, FrameProfiler::DRAW);
+      drawGeometryMode(painter, painterOther);
+    }
 
     // deformation
     if (!defPaused) {
-      double defDiff = handleDeformations();
+      double defDiff = 0;
+      {
+        FrameProfiler::Scope scope(frameProfiler, FrameProfiler::DEFORMATION);
+        ALLOC_SCOPE(ALLOC_DEFORM);
+        defDiff = handleDeformations();
+      }
       //    DEBUG_CMD_MM(cout << defDiff << endl;);
       if (defDiff < 0.01 &&
           !(manipulationMode.mode == ANIMATE_MODE && isAnimationPlaying() &&
@@ -117,46 +215,340 @@ bool MainWindow::paintEvent() {
 
     // export animation frame
     //    cout << exportAnimationRunning() << endl;
-    if (exportAnimationRunning()) exportAnimationFrame();
+    if (exportAnimationRunning()) {
+      FrameProfiler::Scope scope(frameProfiler, FrameProfiler::EXPORT);
+      ALLOC_SCOPE(ALLOC_EXPORT);
+      exportAnimationFrame();
+    }
+    if (captureVideoRunning()) {
+      FrameProfiler::Scope scope(frameProfiler, FrameProfiler::EXPORT);
+      ALLOC_SCOPE(ALLOC_EXPORT);
+      captureVideoFrame();
+    }
 
-    if (showMessages) drawMessages(painter);
+    if (showMessages) drawMessages(painterOther);
   }
-  if (manipulationMode.isImageModeActive() && !transitionRunning) {
-    drawImageMode(painter, painterOther);
-    painterOther.paint();
+  {
+    FrameProfiler::Scope scope(frameProfiler, FrameProfiler::COMPOSITING);
+    if (manipulationMode.isImageModeActive() && !transitionRunning) {
+      drawImageMode(painter, painterOther);
+      painterOther.paint();
+    }
+
+    screenImgPainted = painterOther.hasPainted();
+    if (!transitionRunning && screenImgPainted) {
+      painter.drawImage(0, 0, screenImg);
+    }
+    painter.paint();
   }
 
-  if (!transitionRunning) painter.drawImage(0, 0, screenImg);
-  painter.paint();
+  frameProfiler.endFrame();
+  updateQuality();
 
-  double tAllElapsed = 0;
-  MEASURE_TIME_END(tStartAll, tAllElapsed);
-#ifndef __EMSCRIPTEN__
-//  cout << tAllElapsed << "ms, " << 1000.0/tAllElapsed << " FPS" << endl;
-#endif
+  return true;
+}
 
-  const int delay = 8 - tAllElapsed;
-  if (delay > 0) SDL_Delay(delay);
+void MainWindow::updateQuality() {
+  // the governor sees only the frames of continuous interaction, a still
+  // (no further frame requested), a pause or an export restores the full
+  // quality, with one more frame for a still drawn at a lowered one
+  const bool interactive = repaint && !defPaused &&
+                           !exportAnimationRunning() && !captureVideoRunning();
+  if (interactive && frameProfiler.size() > 0) {
+    qualityGovernor.frameFinished(
+        frameProfiler.frame(frameProfiler.size() - 1));
+  } else if (!interactive && qualityGovernor.lowered()) {
+    qualityGovernor.reset();
+    repaint = true;
+  }
+}
 
-  return true;
+void MainWindow::applyQuality() {
+  QualityGovernor::Settings full;
+  full.defEngMaxIter = defData.defEngMaxIter;
+  full.tempSmoothingSteps = recData.tempSmoothingSteps;
+  full.normalSmoothingIters = shadingOpts.normalSmoothingIters;
+  full.textureShading = shadingOpts.showTextureUseMatcapShading;
+  quality = qualityGovernor.apply(full);
+  // one step of the implicit smoothing costs the same for any length,
+  // changing it would only refactorize
+  if (shadingOpts.implicitNormalSmoothing) {
+    quality.normalSmoothingIters = full.normalSmoothingIters;
+  }
+  // a running asynchronous deformation reads them, they are set before the
+  // next one starts
+  if (!defTask.running()) {
+    defEng.maxIter = quality.defEngMaxIter;
+    defEng.tempSmoothingSteps = quality.tempSmoothingSteps;
+  }
+}
+
+void MainWindow::applyPerformanceProfile() {
+  applyPerfProfile(recData.perfProfile, defData);
+  exportKeyframeTolerance =
+      perfSettings(recData.perfProfile).exportKeyframeTolerance;
+  applyQuality();
+}
+
+DefEng &MainWindow::activeDefEng() {
+  auto &name = defData.defEngName;
+  auto &defEngAlt = defData.defEngAlt;
+  if (name == defEng.name()) return defEng;
+  if (!defEngAlt || defEngAlt->name() != name) {
+    defEngAlt = createDefEng(name);
+    if (!defEngAlt) {
+      DEBUG_CMD_MM(cout << "unknown deformation engine " << name << endl;);
+      name = defEng.name();
+      return defEng;
+    }
+  }
+  return *defEngAlt;
+}
+
+bool MainWindow::purePlayback() {
+  // not recording and not grabbing a CP
+  return manipulationMode.mode == ANIMATE_MODE && cpData.playAnimation &&
+         !cpData.cpsAnim.empty() && !cpData.recordCP &&
+         !(mousePressed && cpData.selectedPoint != -1);
+}
+
+bool MainWindow::playbackSkinningActive() {
+  // full deformation when the timepoint is set manually (e.g. for export)
+  return defData.defEngPlaybackSkinning && purePlayback() && !manualTimepoint;
+}
+
+bool MainWindow::animCacheActive() {
+  return animCacheEnabled && purePlayback() &&
+         (!manualTimepoint || exportAnimationRunning()) &&
+         cpAnimSync.getLength() > 0;
+}
+
+bool MainWindow::morphPlaybackActive() {
+  return morphPlayback && !softwareRendering && !exportAnimationRunning() &&
+         animCacheActive() && animCache.isComplete() &&
+         animCache.getSignature() != morphFailedSignature;
+}
+
+void MainWindow::syncMorphedVertices() {
+  if (morphFrame == -1) return;
+  if (animCache.get(morphFrame, mesh.VCurr)) {
+    defData.VCurr = mesh.VCurr;
+    defData.meshVersion++;
+  }
+  morphFrame = -1;
+}
+
+uint64_t MainWindow::animCacheSignature() {
+  // everything the deformed frames depend on besides the timepoint
+  uint64_t h = AnimCache::hashInit;
+  auto hashValue = [&](const auto &v) { h = AnimCache::hash(h, &v, sizeof v); };
+  auto hashMatrix = [&](const MatrixXd &M) {
+    h = AnimCache::hash(h, M.data(), M.size() * sizeof(double));
+  };
+  hashMatrix(mesh.VRest);
+  hashValue(mesh.F.rows());
+  hashValue(rigidity);
+  hashValue(defEng.solveForZ);
+  hashValue(cpAnimSync.getLength());
+  const bool skinning = playbackSkinningActive();
+  hashValue(skinning);
+  h = AnimCache::hash(h, defData.defEngName.data(), defData.defEngName.size());
+  // combined independently of the iteration order of cpsAnim
+  uint64_t hAnims = 0;
+  for (auto &it : cpData.cpsAnim) {
+    uint64_t hAnim = AnimCache::hash(AnimCache::hashInit, &it.first,
+                                     sizeof it.first);
+    CPAnim &a = it.second;
+    fora(t, 0, a.getLength()) {
+      const Vector3d p = a.getPosition(t);
+      hAnim = AnimCache::hash(hAnim, p.data(), sizeof(double) * 3);
+    }
+    const double offset = a.getOffset(), s = a.getTemporalScalingFactor();
+    hAnim = AnimCache::hash(hAnim, &offset, sizeof offset);
+    hAnim = AnimCache::hash(hAnim, &s, sizeof s);
+    const Matrix4d &T = a.getTransform();
+    hAnim = AnimCache::hash(hAnim, T.data(), T.size() * sizeof(double));
+    hAnims ^= hAnim;
+  }
+  hashValue(hAnims);
+  // CPs without animation
+  for (const auto &it : def.getCPs()) {
+    if (cpData.cpsAnim.find(it.first) != cpData.cpsAnim.end()) continue;
+    hashValue(it.first);
+    h = AnimCache::hash(h, it.second.pos.data(), sizeof(double) * 3);
+  }
+  return h;
+}
+
+int MainWindow::animCacheFrame(int &nFrames) {
+  // The animation repeats after the sync length unless a CP animation is
+  // scaled in time, then only after the wrap of lastT.
+  nFrames = cpAnimSync.getLength();
+  for (auto &it : cpData.cpsAnim) {
+    if (it.second.getTemporalScalingFactor() != 1) {
+      nFrames *= 100;
+      break;
+    }
+  }
+  return static_cast<int>(cpAnimSync.lastT) % nFrames;
+}
+
+void MainWindow::selectNextDefEng() {
+  const DefEngStats &stats = activeDefEng().getStats();
+  DEBUG_CMD_MM(cout << defData.defEngName << ": " << stats.frames
+                    << " frames, "
+                    << stats.deformMsTotal / max(stats.frames, 1)
+                    << " ms per frame, last precompute "
+                    << stats.precomputeMs << " ms" << endl;);
+  const vector<string> names = defEngNames();
+  auto it = find(names.begin(), names.end(), defData.defEngName);
+  if (it == names.end() || ++it == names.end()) it = names.begin();
+  defData.defEngName = *it;
+  activeDefEng().resetStats();
+  DEBUG_CMD_MM(cout << "deformation engine: " << defData.defEngName << endl;);
 }
 
 double MainWindow::handleDeformations() {
   double tElapsedMsARAP = 0;
   auto *defCurr = &def;
   if (manipulationMode.mode == DEFORM_MODE) defCurr = &defDeformMode;
-  if (mesh.VCurr.rows() == 0) {
+  if (!defTask.running() && mesh.VCurr.rows() == 0) {
     // mesh empty, skipping
     return 0;
   }
-  double defDiff;
-  MEASURE_TIME(defDiff = defEng.deform(*defCurr, mesh), tElapsedMsARAP);
-  defData.VCurr = mesh.VCurr;
-  defData.Faces = mesh.F;
-  defData.VRestOrig = mesh.VRest;
+  double defDiff = numeric_limits<double>::infinity();
+  int frame = -1;
+  if (animCacheActive()) {
+    int nFrames = 0;
+    frame = animCacheFrame(nFrames);
+    animCache.validate(animCacheSignature(), nFrames, mesh.VRest.rows());
+  }
+  if (frame != -1 && morphPlaybackActive()) {
+    // drawn from the frames uploaded to glMorph
+    morphFrame = frame;
+    return 0;
+  }
+  syncMorphedVertices();
+  DefEng &eng =
+      playbackSkinningActive() ? defData.defEngPlayback : activeDefEng();
+  if (asyncDeformation && frame == -1 && !exportAnimationRunning()) {
+    return handleDeformationsAsync(eng, *defCurr);
+  }
+  finishDeformation();
+  if (frame == -1 || !animCache.get(frame, mesh.VCurr)) {
+    MEASURE_TIME(defDiff = eng.deform(*defCurr, mesh), tElapsedMsARAP);
+    if (frame != -1) animCache.put(frame, mesh.VCurr);
+  }
+  if (!sameMatrix(defData.VCurr, mesh.VCurr)) {
+    defData.VCurr = mesh.VCurr;
+    defData.meshVersion++;
+  }
   return defDiff;
 }
 
+double MainWindow::handleDeformationsAsync(DefEng &eng, const Def3D &def) {
+  MatrixXd &V = latencyHiding ? defResultV : defData.VCurr;
+  if (defTask.poll(V, defTaskDiff)) {
+    const chrono::duration<double, milli> t =
+        chrono::steady_clock::now() - defTaskStart;
+    defTaskLatencyMs = t.count();
+    if (latencyHiding) {
+      defResultDef = defTaskDef;
+      defResultCPsChangedNum = defTaskCPsChangedNum;
+      defResultPos = defTaskPos;
+      previewPos.clear();
+    } else {
+      defData.meshVersion++;
+    }
+  }
+  if (latencyHiding) updateDeformationPreview(def);
+  if (defTask.running()) return numeric_limits<double>::infinity();
+
+  // keep iterating until converged and start over when the control points
+  // move
+  const auto &pos = def.getCPs().getPos();
+  const bool cpsChanged = &def != defTaskDef ||
+                          def.getCp2ptChangedNum() != defTaskCPsChangedNum ||
+                          pos != defTaskPos;
+  if (defTaskDiff < 0.01 && !cpsChanged) return defTaskDiff;
+  // extrapolate the CPs by their velocity since the last start, the
+  // result then arrives about when they get there
+  const auto now = chrono::steady_clock::now();
+  vector<Vector3d> solvePos = pos;
+  if (latencyHiding && &def == defTaskDef &&
+      def.getCp2ptChangedNum() == defTaskCPsChangedNum &&
+      defTaskInputPos.size() == pos.size()) {
+    const chrono::duration<double, milli> dt = now - defTaskStart;
+    const double ahead = min(defTaskLatencyMs, maxPredictionMs);
+    if (dt.count() > 0) {
+      forlist(i, pos) {
+        solvePos[i] += (pos[i] - defTaskInputPos[i]) * (ahead / dt.count());
+      }
+    }
+  }
+  defTaskDef = &def;
+  defTaskCPsChangedNum = def.getCp2ptChangedNum();
+  // compared to the next positions, so a prediction overshooting a stop is
+  // solved again
+  defTaskPos = solvePos;
+  defTaskInputPos = pos;
+  defTaskStart = now;
+  // mesh.VCurr belongs to the worker now, the vertices displayed meanwhile
+  // are in defData.VCurr
+  applyQuality();
+  defTask.start(eng, def, mesh, solvePos);
+  return numeric_limits<double>::infinity();
+}
+
+// Shows the last result of defTask moved by the linear blend of the CP
+// translations since the positions it was solved for.
+void MainWindow::updateDeformationPreview(const Def3D &def) {
+  const auto &pos = def.getCPs().getPos();
+  if (defResultV.rows() != mesh.VRest.rows() || pos == previewPos) return;
+  previewPos = pos;
+  defData.VCurr = defResultV;
+  // the weights only read the rest mesh, which the running deformation
+  // leaves alone
+  const long cpsChangedNum = def.getCp2ptChangedNum();
+  if (&def == defResultDef && cpsChangedNum == defResultCPsChangedNum &&
+      defResultPos.size() == pos.size()) {
+    if (cpsChangedNum != previewCPsChangedNum ||
+        previewLBS.getWeights().rows() != defResultV.rows()) {
+      previewLBS.precompute(def, mesh);
+      previewCPsChangedNum = cpsChangedNum;
+    }
+    vector<Vector3d> translations(pos.size());
+    forlist(i, pos) translations[i] = pos[i] - defResultPos[i];
+    previewLBS.addTranslations(translations, defData.VCurr);
+  }
+  defData.meshVersion++;
+}
+
+void MainWindow::finishDeformation() {
+  defTask.wait();
+  // the next asynchronous deformation starts from scratch
+  defTaskDef = nullptr;
+  defResultV.resize(0, 3);
+  previewCPsChangedNum = -1;
+}
+
+void MainWindow::setAsyncDeformation(bool enabled) {
+  if (!enabled) finishDeformation();
+  asyncDeformation = enabled;
+  defTaskDef = nullptr;
+  repaint = true;
+}
+
+bool MainWindow::getAsyncDeformation() { return asyncDeformation; }
+
+void MainWindow::setLatencyHiding(bool enabled) {
+  finishDeformation();
+  latencyHiding = enabled;
+  repaint = true;
+}
+
+bool MainWindow::getLatencyHiding() { return latencyHiding; }
+
 void MainWindow::startModeTransition(const ManipulationMode &prevMode,
                                      const ManipulationMode &currMode) {
   transitionPrevMode = prevMode;
@@ -252,7 +644,8 @@ bool MainWindow::drawModeTransition(MyPainter &painter,
   else if (transitionPrevMode.isImageModeActive())
     t2 = 1 - t;
   if (t2 > 0) {
-    if (transitionPrevMode.mode == ANIMATE_MODE) {
+    if (transitionPrevMode.mode == ANIMATE_MODE &&
+        painterOther.hasPainted()) {
       // we assume that screenImg contains geometry mode rasterized information
       // only
       painter.drawImage(0, 0, screenImg, 1 - t2);
@@ -266,10 +659,16 @@ bool MainWindow::drawModeTransition(MyPainter &painter,
   return true;
 }
 
+// for the per-vertex and per-pixel loops of the main thread
+static WorkerPool &getMainWorkerPool() {
+  static WorkerPool pool(WorkerPool::defaultNumThreads());
+  return pool;
+}
+
 void MainWindow::computeNormals(bool smoothing) {
   // compute normals
   auto &V = defData.VCurr;
-  auto &F = defData.Faces;
+  auto &F = mesh.F;
   auto &N = defData.normals;
 
   if (V.rows() == 0) {
@@ -277,41 +676,148 @@ void MainWindow::computeNormals(bool smoothing) {
     return;
   }
 
-  per_vertex_normals(V, F, PER_VERTEX_NORMALS_WEIGHTING_TYPE_DEFAULT, N);
-  // normals may have some NaN's, treat them before smoothing
-  fora(i, 0, N.rows()) {
-    bool nan = false;
-    fora(j, 0, 3) {
-      if (isnan(N(i, j))) {
-        nan = true;
-        break;
-      }
-    }
-    if (nan) {
-      N.row(i) = Vector3d(0, 0, 1);
-    }
-  }
+  // the model is often at rest, e.g. when the deformation converged
+  if (N.rows() == V.rows() && smoothing == normalsSmoothing &&
+      quality.normalSmoothingIters == normalsSmoothingIters &&
+      shadingOpts.normalSmoothingStep == normalsSmoothingStep &&
+      shadingOpts.implicitNormalSmoothing == normalsImplicitSmoothing &&
+      defData.meshVersion == normalsMeshVersion &&
+      (!smoothing || sameMatrix(defEng.L, normalSmoothingL)))
+    return;
+  normalsMeshVersion = defData.meshVersion;
+  normalsVersion++;
+  normalsSmoothing = smoothing;
+  normalsSmoothingIters = quality.normalSmoothingIters;
+  normalsSmoothingStep = shadingOpts.normalSmoothingStep;
+  normalsImplicitSmoothing = shadingOpts.implicitNormalSmoothing;
+
+  // degenerate normals come out as (0, 0, 1), i.e. no NaN's to smooth
+  vertexNormals.compute(V, F, N, &getMainWorkerPool());
 
   if (smoothing) {
     auto &L = defEng.L;
-    if (L.rows() == N.rows()) {
-      fora(i, 0, shadingOpts.normalSmoothingIters) {
-        N += shadingOpts.normalSmoothingStep * L * N;
+    if (L.rows() == N.rows() && !sameMatrix(L, normalSmoothingL)) {
+      normalSmoothingL = L;
+      normalSmoothingOpStep = 0;
+      normalSmoothingSolverTime = 0;
+    }
+    SparseMatrix<double> I(L.rows(), L.cols());
+    I.setIdentity();
+    if (L.rows() == N.rows() && shadingOpts.implicitNormalSmoothing) {
+      // one backward Euler step over the time of all explicit iterations,
+      // (I - t * L) is positive definite as L is the cotangent Laplacian
+      const double t =
+          quality.normalSmoothingIters * shadingOpts.normalSmoothingStep;
+      if (normalSmoothingSolverTime != t) {
+        normalSmoothingSolver.compute(I - t * L);
+        normalSmoothingSolverTime = t;
+      }
+      if (normalSmoothingSolver.info() == Success) {
+        N = normalSmoothingSolver.solve(N);
         N.rowwise().normalize();
       }
+    } else if (L.rows() == N.rows()) {
+      if (normalSmoothingOpStep != shadingOpts.normalSmoothingStep) {
+        normalSmoothingOp = I + shadingOpts.normalSmoothingStep * L;
+        normalSmoothingOpStep = shadingOpts.normalSmoothingStep;
+      }
+      // N = normalize((I + step * L) * N), rows are independent
+      const auto &S = normalSmoothingOp;
+      MatrixXd N2(N.rows(), 3);
+      fora(it, 0, quality.normalSmoothingIters) {
+        getMainWorkerPool().parallelFor(
+            N.rows(), 1024, [&](int begin, int end) {
+              fora(i, begin, end) {
+                RowVector3d n = RowVector3d::Zero();
+                for (SparseMatrix<double, RowMajor>::InnerIterator e(S, i); e;
+                     ++e)
+                  n += e.value() * N.row(e.col());
+                const double norm = n.norm();
+                N2.row(i) = norm > 0 ? RowVector3d(n / norm) : n;
+              }
+            });
+        N.swap(N2);
+      }
     }
   }
 }
 
+// X (n x 3, or empty) converted to the interleaved float layout
+static void toInterleaved(const MatrixXd &X, MatrixX3fR &out) {
+  if (X.cols() == 3) {
+    out = X.cast<float>();
+  } else {
+    out.resize(0, 3);
+  }
+}
+
+void MainWindow::updateInterleavedVertices() {
+  if (interleavedMeshVersion != defData.meshVersion ||
+      VCurrInterleaved.rows() != defData.VCurr.rows()) {
+    toInterleaved(defData.VCurr, VCurrInterleaved);
+    interleavedMeshVersion = defData.meshVersion;
+  }
+  if (interleavedNormalsVersion != normalsVersion ||
+      normalsInterleaved.rows() != defData.normals.rows()) {
+    toInterleaved(defData.normals, normalsInterleaved);
+    interleavedNormalsVersion = normalsVersion;
+  }
+}
+
+const MatrixXd &MainWindow::updateTextureCoords() {
+  const Imguc &I = templateImg;
+  const MatrixXd &VRest = defData.mesh.VRest;
+  if (textureCoordsRec != defData.recResult || textureCoordsW != I.w ||
+      textureCoordsH != I.h || textureCoordsAtlas != textureAtlas ||
+      textureCoords.rows() != VRest.rows()) {
+    const bool atlasUploaded = !templateAtlas.img.isNull();
+    templateAtlas = TextureAtlas();
+    if (textureAtlas && !I.isNull() &&
+        buildTextureAtlas(VRest, defData.mesh.F, I, 2, templateAtlas)) {
+      const Imguc &A = templateAtlas.img;
+      textureCoords.resize(VRest.rows(), 3);
+      textureCoords.leftCols(2) = templateAtlas.coords.array().rowwise() /
+                                  Array2d(A.w, A.h).transpose();
+      loadTextureToGPU(A, glData.templateImgTexName);
+    } else {
+      textureCoords =
+          VRest.array().rowwise() / Array3d(I.w, I.h, 1).transpose();
+      if (atlasUploaded) loadTextureToGPU(I, glData.templateImgTexName);
+    }
+    textureCoords.col(2).fill(-1);
+    textureCoordsRec = defData.recResult;
+    textureCoordsW = I.w;
+    textureCoordsH = I.h;
+    textureCoordsAtlas = textureAtlas;
+    // the frames on the GPU carry the previous coordinates
+    glMorph.clear();
+  }
+  return textureCoords;
+}
+
+const Imguc &MainWindow::textureImage() {
+  updateTextureCoords();
+  return templateAtlas.img.isNull() ? templateImg : templateAtlas.img;
+}
+
+void MainWindow::loadTemplateTexture() {
+  loadTextureToGPU(templateImg, glData.templateImgTexName);
+  // packed again from the new image
+  templateAtlas = TextureAtlas();
+  textureCoords.resize(0, 3);
+}
+
 void MainWindow::drawGeometryMode(MyPainter &painterModel,
                                   MyPainter &painterOther) {
   auto *defData = &this->defData;
   auto &V = defData->VCurr;
-  auto &Vr = defData->VRestOrig;
-  auto &F = defData->Faces;
+  auto &Vr = defData->mesh.VRest;
+  auto &F = defData->mesh.F;
   auto &N = defData->normals;
   auto &showControlPoints = cpData.showControlPoints;
 
+  initOpenGL();
+
   if (false && autoRotateDir != -1 && manipulationMode.mode == DEFORM_MODE) {
     // auto rotate
     int redrawFPS = 60;
@@ -368,52 +874,77 @@ void MainWindow::drawGeometryMode(MyPainter &painterModel,
     far = 10000;
   }
 
-  buildCameraMatrices(ortho, viewportW / scale2, viewportH / scale2, near, far,
-                      rotVer2, rotHor2, translateView2, centroid, glData.P,
-                      glData.M);
-  if (imageSpaceView) {
-    // translate in image space
-    const Vector3d shift =
-        (glData.P * (cameraCenterViewSpace +
-                     Vector3d(translateView.x(), translateView.y(), 0))
-                        .homogeneous())
-            .hnormalized();
-    glData.P = Affine3d(Translation3d(Vector3d(shift(0), shift(1), 0) +
-                                      Vector3d(-1, -1, 0))) *
-               Ref<Matrix4d>(glData.P);
-  }
-  flyCameraM =
-      Affine3d(                        // from bottom to top
-          Translation3d(translateCam)  // translate
-          *
-          AngleAxisd(rotateCam(2) / 180.0 * M_PI, Vector3d::UnitZ())  // rotate
-          *
-          AngleAxisd(rotateCam(1) / 180.0 * M_PI, Vector3d::UnitY())  // rotate
-          *
-          AngleAxisd(rotateCam(0) / 180.0 * M_PI, Vector3d::UnitX())  // rotate
-          )
-          .matrix();
-  glData.M = flyCameraM * glData.M;
-  proj3DView = Affine3d(Scaling<double>(0.5 * viewportW, 0.5 * viewportH, 1) *
-                        Translation3d(1, 1, 0)) *
-               Ref<Matrix4d>(glData.P) * Ref<Matrix4d>(glData.M);
-  proj3DViewInv = proj3DView.inverse();
-
-  glData.P =
-      Affine3d(Scaling(1., -1., 1.)).matrix() *
-      glData
-          .P;  // convert from cartesian (OpenGL) to image coordinates (flip y)
+  VectorXd key(25);
+  key << ortho, imageSpaceView, viewportW, viewportH, scale2, near, far,
+      rotVer2, rotHor2, translateView2, translateView, centroid,
+      cameraCenterViewSpace, translateCam, rotateCam;
+  if (key.size() != cameraKey.size() || key != cameraKey) {
+    cameraKey = key;
+    cameraVersion++;
+    buildCameraMatrices(ortho, viewportW / scale2, viewportH / scale2, near,
+                        far, rotVer2, rotHor2, translateView2, centroid,
+                        glData.P, glData.M);
+    if (imageSpaceView) {
+      // translate in image space
+      const Vector3d shift =
+          (glData.P * (cameraCenterViewSpace +
+                       Vector3d(translateView.x(), translateView.y(), 0))
+                          .homogeneous())
+              .hnormalized();
+      glData.P = Affine3d(Translation3d(Vector3d(shift(0), shift(1), 0) +
+                                        Vector3d(-1, -1, 0))) *
+                 Ref<Matrix4d>(glData.P);
+    }
+    flyCameraM =
+        Affine3d(                        // from bottom to top
+            Translation3d(translateCam)  // translate
+            * AngleAxisd(rotateCam(2) / 180.0 * M_PI,
+                         Vector3d::UnitZ())  // rotate
+            * AngleAxisd(rotateCam(1) / 180.0 * M_PI,
+                         Vector3d::UnitY())  // rotate
+            * AngleAxisd(rotateCam(0) / 180.0 * M_PI,
+                         Vector3d::UnitX())  // rotate
+            )
+            .matrix();
+    glData.M = flyCameraM * glData.M;
+    proj3DView =
+        Affine3d(Scaling<double>(0.5 * viewportW, 0.5 * viewportH, 1) *
+                 Translation3d(1, 1, 0)) *
+        Ref<Matrix4d>(glData.P) * Ref<Matrix4d>(glData.M);
+    proj3DViewInv = proj3DView.inverse();
+
+    // convert from cartesian (OpenGL) to image coordinates (flip y)
+    glData.P = Affine3d(Scaling(1., -1., 1.)).matrix() * glData.P;
+    glData.normalMatrix = glData.M.inverse().transpose();
+  }
 
   glViewport(0, 0, viewportW, viewportH);
-  drawModelOpenGL(V, Vr, F, N);
+  if (softwareRendering) {
+    drawModelSoftware(V, Vr, F, N);
+    painterModel.drawImage(0, 0, frameBuffer);
+  } else {
+    drawModelOpenGL(V, Vr, F, N);
+    drawSceneOpenGL();
+  }
 
   if (showControlPoints) {
+    // draw the overlays directly to the window, during mode transitions they
+    // are faded with screenImg
+    GLOverlay *overlay = nullptr;
+    if (glOverlay.isSupported() && !transitionRunning) {
+      overlay = &glOverlay;
+      overlay->begin(proj3DView, windowWidth, windowHeight);
+    }
     if (manipulationMode.mode == ANIMATE_MODE) {
       if (!use3DCPTrajectoryVisualization)
-        visualizeCPAnimTrajectories2D(painterOther);
+        visualizeCPAnimTrajectories2D(painterOther, overlay);
     }
     if (!use3DCPVisualization) {
-      cpVisualize2D(painterOther);
+      cpVisualize2D(painterOther, overlay);
+    }
+    if (overlay != nullptr) {
+      overlay->end();
+      overlay->releaseUnusedTrajectories();
     }
   }
 
@@ -430,47 +961,218 @@ void MainWindow::drawGeometryMode(MyPainter &painterModel,
   }
 }
 
+const MeshPicker &MainWindow::getMeshPicker() {
+  syncMorphedVertices();
+  // reprojected and refit only if the mesh or the view changed since the
+  // last pick
+  meshPicker.update(defData.VCurr, mesh.F, proj3DView,
+                    defData.meshVersion);
+  return meshPicker;
+}
+
+bool MainWindow::addControlPointOnFace(Def3D &def, double x, double y,
+                                       double radius, bool reverse,
+                                       int &index) {
+  syncMorphedVertices();
+  if (!gpuPicking || !glPicker.isReady()) {
+    return def.addControlPointOnFace(getMeshPicker(), x, y, radius, reverse,
+                                     reverse, index);
+  }
+  const int cpId = glPicker.pickControlPoint(def, proj3DView, x, y, radius);
+  if (cpId != -1) {
+    index = cpId;
+    return false;
+  }
+  const int faceId =
+      glPicker.pickFace(defData.VCurr, mesh.F, defData.meshVersion,
+                        proj3DView, x, y, reverse, reverse);
+  return def.addControlPointOnFaceId(defData.VCurr, mesh.F, faceId, x,
+                                     y, index, proj3DView);
+}
+
 void MainWindow::rotateViewportIncrement(double rotHorInc, double rotVerInc) {
   rotPrev += Vector2d(rotHorInc, rotVerInc);
   rotHor = rotPrev(0);
   rotVer = rotPrev(1);
 }
 
+// Largest scale from the units of V to pixels along the axes of its bounding
+// box.
+static double pixelsPerUnit(const MatrixXd &V, const MatrixXd &proj3DView) {
+  if (V.rows() == 0 || V.cols() != 3) return 0;
+  const Vector3d lo = V.colwise().minCoeff(), hi = V.colwise().maxCoeff();
+  auto project = [&](const Vector3d &p) {
+    const Vector4d q = proj3DView * p.homogeneous();
+    return Vector2d(q.head<2>() / q(3));
+  };
+  const Vector2d origin = project(lo);
+  double scale = 0;
+  fora(i, 0, 3) {
+    const double size = hi(i) - lo(i);
+    if (size <= 0) continue;
+    Vector3d p = lo;
+    p(i) = hi(i);
+    scale = max(scale, (project(p) - origin).norm() / size);
+  }
+  return scale;
+}
+
 void MainWindow::drawModelOpenGL(Eigen::MatrixXd &V, Eigen::MatrixXd &Vr,
                                  Eigen::MatrixXi &F, Eigen::MatrixXd &N) {
   auto *templateImg = &this->templateImg;
 
   MatrixXd colors;
-  MatrixXd textureCoords;
+  static const MatrixXd noTextureCoords;
+  const MatrixXd *textureCoords = &noTextureCoords;
   MatrixXi PARTID;
   GLuint activeShader;
+  const GLCameraUniforms *activeUniforms = &glData.matcapUniforms;
   glActiveTexture(GL_TEXTURE0);
+  glData.boundShader = 0;
   if (shadingOpts.showTexture && !templateImg->isNull()) {
     activeShader = glData.shaderTexture;
+    activeUniforms = &glData.textureUniforms;
     glUseProgram(activeShader);
-    glUniform1i(glGetUniformLocation(activeShader, "tex"), 0);
-    glUniform1f(glGetUniformLocation(activeShader, "useShading"),
-                shadingOpts.showTextureUseMatcapShading ? 1 : 0);
-    // texture coords
-    const Imguc &I = *templateImg;
-    textureCoords = (Vr.array().rowwise() / Array3d(I.w, I.h, 1).transpose());
-    textureCoords.col(2).fill(-1);
+    glData.boundShader = activeShader;
+    glUniform1i(glData.textureTexLocation, 0);
+    glUniform1f(glData.textureUseShadingLocation,
+                quality.textureShading ? 1 : 0);
+    textureCoords = &updateTextureCoords();
     glBindTexture(GL_TEXTURE_2D, glData.templateImgTexName);
   } else if (shadingOpts.matcapImg != -1) {
     activeShader = glData.shaderMatcap;
     glUseProgram(activeShader);
-    glBindTexture(GL_TEXTURE_2D, glData.textureNames[shadingOpts.matcapImg]);
+    glData.boundShader = activeShader;
+    glBindTexture(GL_TEXTURE_2D, matcapTexture(shadingOpts.matcapImg));
   }
 
   MatrixXd C;
-  uploadCameraMatrices(activeShader, glData.P, glData.M,
-                       glData.M.inverse().transpose());
-  GLMeshFillBuffers(activeShader, glData.meshData, V, F, N, textureCoords, C,
-                    PARTID);
+  uploadCameraMatrices(activeShader, *activeUniforms, glData.P, glData.M,
+                       glData.normalMatrix);
+
+  if (morphPlaybackActive()) {
+    if (glMorph.upload(animCache, F, *textureCoords)) {
+      glMorph.draw(cpAnimSync.lastT, glData.P, glData.M,
+                   activeShader == glData.shaderTexture,
+                   quality.textureShading);
+      glData.boundShader = 0;
+      return;
+    }
+    // too large, the CPU deformation takes over from the next frame
+    morphFailedSignature = animCache.getSignature();
+  }
+
+  meshLODLevel = -1;
+  if (meshLOD && V.rows() == defData.VCurr.rows())
+    meshLODLevel = selectMeshLOD(defData.meshLODs,
+                                 pixelsPerUnit(V, proj3DView),
+                                 meshLODMaxPixels);
+  if (meshLODLevel != -1) {
+    drawMeshLODOpenGL(V, *textureCoords, PARTID);
+    return;
+  }
+  // the normals are not computed in frames after one that drew a level of
+  // detail, it is a no-op otherwise
+  {
+    FrameProfiler::Scope scope(frameProfiler, FrameProfiler::NORMALS);
+    computeNormals(shadingOpts.useNormalSmoothing);
+  }
+
+  // positions and normals are uploaded only if they changed
+  const bool meshChanged = glData.uploadedMeshVersion != defData.meshVersion ||
+                           glData.uploadedNormalsVersion != normalsVersion;
+  {
+    FrameProfiler::Scope scope(frameProfiler, FrameProfiler::GL_UPLOAD);
+    ALLOC_SCOPE(ALLOC_GL_UPLOAD);
+    // V and N are defData.VCurr and defData.normals
+    if (meshChanged) updateInterleavedVertices();
+    GLMeshFillBuffers(glData.meshData, VCurrInterleaved, F, normalsInterleaved,
+                      *textureCoords, C, PARTID, meshChanged);
+  }
+  glData.uploadedMeshVersion = defData.meshVersion;
+  glData.uploadedNormalsVersion = normalsVersion;
   GLMeshDraw(glData.meshData, GL_TRIANGLES);
 }
 
-void MainWindow::cpVisualize2D(MyPainter &screenPainter) {
+void MainWindow::drawMeshLODOpenGL(const MatrixXd &V, const MatrixXd &T,
+                                   const MatrixXi &PARTID) {
+  const MeshLOD &lod = defData.meshLODs[meshLODLevel];
+  const int n = lod.vertices.size();
+  const bool changed = glData.uploadedLODMeshVersion != defData.meshVersion ||
+                       glData.uploadedLOD != meshLODLevel;
+  {
+    FrameProfiler::Scope scope(frameProfiler, FrameProfiler::GL_UPLOAD);
+    ALLOC_SCOPE(ALLOC_GL_UPLOAD);
+    if (changed) {
+      // only the vertices of the level, the normal smoothing is skipped as
+      // its triangles are small anyway
+      meshLODV.resize(n, 3);
+      fora(i, 0, n) meshLODV.row(i) = V.row(lod.vertices[i]);
+      meshLODNormals.compute(meshLODV, lod.F, meshLODN, &getMainWorkerPool());
+    }
+    meshLODT.resize(T.rows() == V.rows() ? n : 0, T.cols());
+    fora(i, 0, meshLODT.rows()) meshLODT.row(i) = T.row(lod.vertices[i]);
+    MatrixXd C;
+    GLMeshFillBuffers(glData.lodMeshData, meshLODV, lod.F, meshLODN, meshLODT,
+                      C, PARTID, changed);
+  }
+  glData.uploadedLODMeshVersion = defData.meshVersion;
+  glData.uploadedLOD = meshLODLevel;
+  GLMeshDraw(glData.lodMeshData, GL_TRIANGLES);
+}
+
+void MainWindow::updateScene() {
+  // the characters follow the timeline of the sync animation, or run on
+  // their own if there is none
+  if (cpData.cpsAnimSyncId != -1 && cpData.cpAnimSync.getLength() > 0)
+    sceneT = cpData.cpAnimSync.lastT;
+  else if (cpData.playAnimation)
+    sceneT++;
+  scene.update(sceneT, getMainWorkerPool());
+  repaint = true;
+}
+
+void MainWindow::drawSceneOpenGL() {
+  if (scene.getF().rows() == 0) return;
+  // the program, the matcap and the camera set for the model are kept
+  if (glData.boundShader != glData.shaderMatcap) {
+    glUseProgram(glData.shaderMatcap);
+    glActiveTexture(GL_TEXTURE0);
+    if (shadingOpts.matcapImg != -1)
+      glBindTexture(GL_TEXTURE_2D, matcapTexture(shadingOpts.matcapImg));
+    uploadCameraMatrices(glData.shaderMatcap, glData.matcapUniforms, glData.P,
+                         glData.M, glData.normalMatrix);
+    glData.boundShader = glData.shaderMatcap;
+  }
+  const bool changed = glData.uploadedSceneVersion != scene.getVersion();
+  {
+    FrameProfiler::Scope scope(frameProfiler, FrameProfiler::GL_UPLOAD);
+    ALLOC_SCOPE(ALLOC_GL_UPLOAD);
+    static const MatrixXd noTextureCoords, noColors;
+    static const MatrixXi noPartIds;
+    GLMeshFillBuffers(glData.sceneMeshData, scene.getV(), scene.getF(),
+                      scene.getN(), noTextureCoords, noColors, noPartIds,
+                      changed);
+  }
+  glData.uploadedSceneVersion = scene.getVersion();
+  GLMeshDraw(glData.sceneMeshData, GL_TRIANGLES);
+}
+
+void MainWindow::drawModelSoftware(Eigen::MatrixXd &Vc, Eigen::MatrixXd &Vr,
+                                   Eigen::MatrixXi &F, Eigen::MatrixXd &N) {
+  // only matcap shading is supported, textures are ignored
+  if (matcapImg.isNull() && shadingOpts.matcapImg != -1) {
+    matcapImg = loadMatcap(shadingOpts.matcapImg);
+  }
+  if (frameBuffer.w != windowWidth || frameBuffer.h != windowHeight) {
+    depthBuffer = Img<float>(windowWidth, windowHeight, 1);
+    frameBuffer = Imguc(windowWidth, windowHeight, 4);
+  }
+  rasterizeMatcap(Vc, F, N, glData.P, glData.M, matcapImg, frameBuffer,
+                  depthBuffer, &getMainWorkerPool());
+}
+
+void MainWindow::cpVisualize2D(MyPainter &screenPainter, GLOverlay *overlay) {
   auto *cpData = &this->cpData;
   auto *defData = &this->defData;
   auto &selectedPoints = cpData->selectedPoints;
@@ -491,15 +1193,30 @@ void MainWindow::cpVisualize2D(MyPainter &screenPainter) {
     colorRed = Cu{192, 192, 192, 255};
   }
 
+  auto drawCP = [&](const Vector3d &p, int thickness, const Cu &colorBg,
+                    const Cu &colorFg) {
+    if (overlay != nullptr) {
+      overlay->addControlPoint(p, 7, thickness, colorBg, colorFg);
+    } else {
+      drawControlPoint(p, screenPainter, 7, proj3DView, thickness, colorBg,
+                       colorFg);
+    }
+  };
+
   // show handles
-  drawControlPoints(*defCurr, screenPainter, 7, proj3DView, 1, colorBlack,
-                    colorRed);  // 3D view
+  if (overlay != nullptr) {
+    for (const auto &it : defCurr->getCPs()) {
+      drawCP(it.second.pos, 1, colorBlack, colorRed);
+    }
+  } else {
+    drawControlPoints(*defCurr, screenPainter, 7, proj3DView, 1, colorBlack,
+                      colorRed);  // 3D view
+  }
 
   if (!displaySyncCPAnim && cpsAnimSyncId != -1) {
     try {
       const Vector3d p = defCurr->getCP(cpsAnimSyncId).pos;
-      drawControlPoint(p, screenPainter, 7, proj3DView, 1, colorBlack,
-                       colorGreen);
+      drawCP(p, 1, colorBlack, colorGreen);
     } catch (out_of_range &e) {
       cerr << e.what() << endl;
     }
@@ -508,23 +1225,31 @@ void MainWindow::cpVisualize2D(MyPainter &screenPainter) {
     try {
       Cu colorFg = colorRed;
       if (!displaySyncCPAnim && cpId == cpsAnimSyncId) colorFg = colorGreen;
-      const Eigen::VectorXd &p = defCurr->getCP(cpId).pos;
-      drawControlPoint(p, screenPainter, 7, proj3DView, 4, colorBlack, colorFg);
+      const Vector3d &p = defCurr->getCP(cpId).pos;
+      drawCP(p, 4, colorBlack, colorFg);
     } catch (out_of_range &e) {
       cerr << e.what() << endl;
     }
   }
 }
 
-void MainWindow::visualizeCPAnimTrajectories2D(MyPainter &screenPainter) {
+void MainWindow::visualizeCPAnimTrajectories2D(MyPainter &screenPainter,
+                                               GLOverlay *overlay) {
   auto *cpData = &this->cpData;
   auto &cpsAnim = cpData->cpsAnim;
   auto &selectedPoints = cpData->selectedPoints;
-  auto &cpAnimSync = cpData->cpAnimSync;
 
   // visualize animations of control points
-  auto drawTrajectoriesAndKeyframes = [&](CPAnim &a,
+  auto drawTrajectoriesAndKeyframes = [&](int id, CPAnim &a, const Cu &color,
+                                          int thickness,
                                           float beginningThicknessMult) {
+    if (overlay != nullptr) {
+      overlay->drawTrajectory(id, a, thickness, beginningThicknessMult, color,
+                              displayKeyframes ? 1 : -1);
+      return;
+    }
+    screenPainter.setColor(color);
+    screenPainter.setThickness(thickness);
     a.drawTrajectory(screenPainter, proj3DView,
                      beginningThicknessMult);  // 3D view
     if (displayKeyframes) {
@@ -538,25 +1263,109 @@ void MainWindow::visualizeCPAnimTrajectories2D(MyPainter &screenPainter) {
     CPAnim &cpAnim = el.second;
     Cu black{0, 0, 0, 255};
     if (rotationModeActive) black = Cu{128, 128, 128, 255};
-    screenPainter.setColor(black);
+    int thickness = 3;
     float beginningThicknessMult = 2;
-    if (selectedPoints.find(cpId) != selectedPoints.end()) {
-      screenPainter.setThickness(3);
-    } else {
-      screenPainter.setThickness(1);
+    if (selectedPoints.find(cpId) == selectedPoints.end()) {
+      thickness = 1;
       beginningThicknessMult = 4;
     }
-    drawTrajectoriesAndKeyframes(cpAnim, beginningThicknessMult);
+    drawTrajectoriesAndKeyframes(cpId, cpAnim, black, thickness,
+                                 beginningThicknessMult);
+  }
+  // draw control points trajectory of sync anim (control point ids are
+  // non-negative, -1 identifies its buffers in the overlay)
+  const auto &itSync = cpsAnim.find(cpData->cpsAnimSyncId);
+  if (displaySyncCPAnim && itSync != cpsAnim.end()) {
+    drawTrajectoriesAndKeyframes(-1, itSync->second, Cu{0, 255, 0, 255}, 1, 2);
+  }
+}
+
+void MainWindow::drawMessages(MyPainter &painter) {
+  if (showFrameProfile) drawFrameProfile(painter);
+}
+
+void MainWindow::drawFrameProfile(MyPainter &painter) {
+  // a bar per frame stacked from the stages (the rest of the frame in gray)
+  // over the lines of 60 and 30 FPS budgets, the latest frame on the right,
+  // frames that allocated on the heap marked above their bar
+  static const Cu stageColors[FrameProfiler::NUM_STAGES] = {
+      {230, 25, 75, 255}, {255, 225, 25, 255},  {0, 130, 200, 255},
+      {60, 180, 75, 255}, {145, 30, 180, 255}, {245, 130, 48, 255}};
+  const Cu colorOther{128, 128, 128, 255};
+  const Cu colorAllocs{255, 0, 0, 255};
+  const double pxPerMs = 4;
+  const int barW = 2, maxH = 160, margin = 10;
+  const int n = min(frameProfiler.size(), (viewportW - 2 * margin) / barW);
+  const int x0 = margin, y0 = viewportH - margin;
+
+  fora(i, 0, n) {
+    const auto &f = frameProfiler.frame(frameProfiler.size() - n + i);
+    const int x = x0 + i * barW + barW / 2;
+    double ms = 0;
+    auto drawSegment = [&](double segmentMs, const Cu &color) {
+      const int yFrom = y0 - min<int>(maxH, round(ms * pxPerMs));
+      ms += segmentMs;
+      const int yTo = y0 - min<int>(maxH, round(ms * pxPerMs));
+      if (yTo == yFrom) return;
+      painter.setColor(color);
+      painter.drawLine(x, yFrom, x, yTo, barW);
+    };
+    fora(j, 0, FrameProfiler::NUM_STAGES) drawSegment(f.ms[j], stageColors[j]);
+    drawSegment(max(0.0, f.totalMs - ms), colorOther);
+    if (f.allocs > 0) {
+      painter.setColor(colorAllocs);
+      painter.drawLine(x, y0 - maxH - 6, x, y0 - maxH - 2, barW);
+    }
   }
-  // draw control points trajectory of sync anim
-  if (displaySyncCPAnim) {
-    screenPainter.setColor(0, 255, 0, 255);
-    screenPainter.setThickness(1);
-    drawTrajectoriesAndKeyframes(cpAnimSync, 2);
+
+  painter.setColor(255, 255, 255, 255);
+  for (double budgetMs : {1000.0 / 60, 1000.0 / 30}) {
+    const int y = y0 - round(budgetMs * pxPerMs);
+    painter.drawLine(x0, y, x0 + max(n, 1) * barW, y, 1);
   }
 }
 
-void MainWindow::drawMessages(MyPainter &painter) {}
+std::string MainWindow::getFrameProfile() {
+  return frameProfiler.toJSON();
+}
+
+std::string MainWindow::getAllocStats() { return allocStatsToJSON(); }
+
+void MainWindow::setFrameProfileVisibility(bool visible) {
+  showFrameProfile = visible;
+  repaint = true;
+}
+
+bool MainWindow::getFrameProfileVisibility() { return showFrameProfile; }
+
+void MainWindow::enableAdaptiveQuality(bool enabled) {
+  qualityGovernor.enabled = enabled;
+  if (!enabled) qualityGovernor.reset();
+  applyQuality();
+  repaint = true;
+}
+
+bool MainWindow::isAdaptiveQualityEnabled() { return qualityGovernor.enabled; }
+
+void MainWindow::setFrameBudget(double ms) {
+  if (ms > 0) qualityGovernor.budgetMs = ms;
+}
+
+double MainWindow::getFrameBudget() { return qualityGovernor.budgetMs; }
+
+void MainWindow::setTracing(bool enabled) {
+  if (enabled == traceEnabled()) return;
+  if (enabled) traceClear();
+  traceEnable(enabled);
+#ifndef __EMSCRIPTEN__
+  // on the web the trace is fetched with getTrace()
+  if (!enabled) traceSave("/tmp/mm_trace.json");
+#endif
+}
+
+bool MainWindow::getTracing() { return traceEnabled(); }
+
+std::string MainWindow::getTrace() { return traceToJSON(); }
 
 void MainWindow::pauseOrResumeZDeformation(bool pause) {}
 
@@ -628,6 +1437,11 @@ void MainWindow::mouseReleaseEvent(const MyMouseEvent &event) {
     handleMouseReleaseEventGeometryMode(event);
   } else {
     handleMouseReleaseEventImageMode(event);
+    // the drawing changed, the pending reconstruction is outdated
+    if (modeChangePending) {
+      finishDeformation();
+      recTask.start(recData, imgData, defData, cpData);
+    }
   }
 }
 
@@ -638,6 +1452,8 @@ void MainWindow::keyPressEvent(const MyKeyEvent &keyEvent) {
   if (keyEvent.key == SDLK_0) {
     if (getAnimRecMode() == ANIM_MODE_TIME_SCALED) {
       setAnimRecMode(ANIM_MODE_OVERWRITE);
+    } else if (getAnimRecMode() == ANIM_MODE_OVERWRITE) {
+      setAnimRecMode(ANIM_MODE_LAYER);
     } else {
       setAnimRecMode(ANIM_MODE_TIME_SCALED);
     }
@@ -694,6 +1510,61 @@ void MainWindow::keyPressEvent(const MyKeyEvent &keyEvent) {
   if (keyEvent.key == SDLK_o) {
     defEng.solveForZ = !defEng.solveForZ;
   }
+  if (keyEvent.key == SDLK_g) {
+    selectNextDefEng();
+  }
+  if (keyEvent.key == SDLK_i) {
+    setAnimCacheEnabled(!getAnimCacheEnabled());
+    DEBUG_CMD_MM(cout << "animation cache: " << getAnimCacheEnabled() << endl;);
+  }
+  if (keyEvent.key == SDLK_k) {
+    setPlaybackSkinning(!getPlaybackSkinning());
+    DEBUG_CMD_MM(cout << "playback skinning: " << getPlaybackSkinning()
+                      << endl;);
+  }
+  if (keyEvent.key == SDLK_r) {
+    setSoftwareRendering(!getSoftwareRendering());
+    DEBUG_CMD_MM(cout << "software rendering: " << getSoftwareRendering()
+                      << endl;);
+  }
+  if (keyEvent.key == SDLK_u) {
+    setGPUPicking(!getGPUPicking());
+    DEBUG_CMD_MM(cout << "GPU picking: " << getGPUPicking() << endl;);
+  }
+  if (keyEvent.key == SDLK_f) {
+    setFrameProfileVisibility(!getFrameProfileVisibility());
+  }
+  if (keyEvent.key == SDLK_F2) {
+    setTracing(!getTracing());
+    DEBUG_CMD_MM(cout << "tracing: " << getTracing() << endl;);
+  }
+  if (keyEvent.key == SDLK_y) {
+    setAsyncDeformation(!getAsyncDeformation());
+    DEBUG_CMD_MM(cout << "async deformation: " << getAsyncDeformation()
+                      << endl;);
+  }
+  if (keyEvent.key == SDLK_F3) {
+    setLatencyHiding(!getLatencyHiding());
+    DEBUG_CMD_MM(cout << "latency hiding: " << getLatencyHiding() << endl;);
+  }
+  if (keyEvent.key == SDLK_F4) {
+    setMeshLOD(!getMeshLOD());
+    DEBUG_CMD_MM(cout << "mesh LOD: " << getMeshLOD() << endl;);
+  }
+  if (keyEvent.key == SDLK_F5) {
+    setMorphPlayback(!getMorphPlayback());
+    DEBUG_CMD_MM(cout << "morph playback: " << getMorphPlayback() << endl;);
+  }
+  if (keyEvent.key == SDLK_F6) {
+    if (!captureVideoRunning())
+      captureVideoStart("/tmp/mm_capture_");
+    else
+      captureVideoStop();
+  }
+  if (keyEvent.key == SDLK_F7) {
+    setTextureAtlas(!getTextureAtlas());
+    DEBUG_CMD_MM(cout << "texture atlas: " << getTextureAtlas() << endl;);
+  }
   if (keyEvent.key == SDLK_p) {
     recData.armpitsStitching = !recData.armpitsStitching;
     DEBUG_CMD_MM(cout << "recData.armpitsStitching: "
@@ -702,9 +1573,9 @@ void MainWindow::keyPressEvent(const MyKeyEvent &keyEvent) {
   if (keyEvent.key == SDLK_w) {
     //    exportAsOBJ("/tmp", "mm_frame", true);
 
-    //    writeOBJ("/tmp/mm_frame.obj", defData.VCurr, defData.Faces,
+    //    writeOBJ("/tmp/mm_frame.obj", defData.VCurr, mesh.F,
     //    defData.normals,
-    //             defData.Faces, MatrixXd(), defData.Faces);
+    //             mesh.F, MatrixXd(), mesh.F);
 
     if (!exportAnimationRunning())
       exportAnimationStart(0, false, false);
@@ -724,6 +1595,14 @@ void MainWindow::keyPressEvent(const MyKeyEvent &keyEvent) {
       // CTRL+A
       selectAll();
     }
+    if (keyEvent.key == SDLK_z) {
+      // CTRL+Z
+      if (!undoDrawing()) undoControlPoints();
+    }
+    if (keyEvent.key == SDLK_y) {
+      // CTRL+Y
+      if (!redoDrawing()) redoControlPoints();
+    }
   }
   if (keyEvent.key == SDLK_ESCAPE) {
     deselectAll();
@@ -795,8 +1674,13 @@ void MainWindow::handleMouseMoveEventImageMode(const MyMouseEvent &event) {
       recreateMergedImgs();
     }
 
-    drawLine(event, mousePrevPos(0), mousePrevPos(1), mouseCurrPos(0),
-             mouseCurrPos(1), 2 * circleRadius, paintColor);
+    // the stroke follows all the motions coalesced into the event
+    Vector2d prev = mousePrevPos;
+    for (const Vector2d &p : event.path) {
+      drawLine(event, prev(0), prev(1), p(0), p(1), 2 * circleRadius,
+               paintColor);
+      prev = p;
+    }
   }
 }
 
@@ -816,6 +1700,8 @@ void MainWindow::handleMouseReleaseEventImageMode(const MyMouseEvent &event) {
   const bool rightMouseButtonActive =
       event.rightButton || (event.leftButton && rightMouseButtonSimulation);
 
+  drawingHistory.begin(*imgData);
+
   if (event.rightButton) {
     drawLine(event, mousePrevPos(0), mousePrevPos(1), mouseCurrPos(0),
              mouseCurrPos(1), 2 * circleRadius, paintColor);
@@ -895,7 +1781,7 @@ void MainWindow::handleMouseReleaseEventImageMode(const MyMouseEvent &event) {
             mouseReleaseEnd(0), mouseReleaseEnd(1), leftMouseButtonActive);
         if (selectedLayerCurr != -1) {
           const int regId = layers[selectedLayerCurr];
-          const Imguc &Ir = regionImgs[regId];
+          const TiledImage &Ir = regionImgs[regId];
           int regIdDup = -1;
           forlist(i,
                   regionImgs) if (i != regId && Ir.equalData(regionImgs[i])) {
@@ -973,23 +1859,32 @@ void MainWindow::handleMouseReleaseEventImageMode(const MyMouseEvent &event) {
         bool createRegions =
             manipulationMode.mode == DRAW_OUTLINE || regionModify;
         bool closeDrawnShape = false;
+        // the images of the edited layer are expanded while they are drawn
+        // into and stored back as tiles at the end
+        int editedRegion = -1;
+        Imguc regionImg, outlineImg;
 
         if (weightsMode) {
           createRegions = createOutlines = false;
         } else if (regionModifyRedraw) {
           DEBUG_CMD_MM(cout << "region modification (redraw)" << endl;)
           // replace the outline of the selected region with the newly drawn one
-          Ir = &regionImgs[selectedRegion];
-          Imguc &I = outlineImgs[selectedRegion];
-          I = *Io;
-          *Ir = *Io;
-          Io = &I;
+          editedRegion = selectedRegion;
+          autosaveJournal.markLayerModified(selectedRegion);
+          outlineImg = *Io;
+          regionImg = *Io;
+          Ir = &regionImg;
+          Io = &outlineImg;
           closeDrawnShape = true;
         } else if (regionModify || eraseMode) {
           // modifying a selected region
-          Ir = &regionImgs[selectedRegion];
+          editedRegion = selectedRegion;
+          regionImg = regionImgs[selectedRegion].toImage();
+          outlineImg = outlineImgs[selectedRegion].toImage();
+          Ir = &regionImg;
           // compose drawn outline image with the selected one
-          Imguc &I = outlineImgs[selectedRegion];
+          Imguc &I = outlineImg;
+          autosaveJournal.markLayerModified(selectedRegion);
 
           fora(y, 0, I.h) fora(x, 0, I.w) {
             if ((*Io)(x, y, 0) == 0)
@@ -1016,11 +1911,14 @@ void MainWindow::handleMouseReleaseEventImageMode(const MyMouseEvent &event) {
         } else if (createOutlines || createRegions) {
           // insert a new layer under the layer specified using
           // drawingUnderLayer
-          regionImgs.push_back(*Io);
-          outlineImgs.push_back(*Io);
-          Ir = &regionImgs.back();
-          Io = &outlineImgs.back();
+          regionImgs.emplace_back();
+          outlineImgs.emplace_back();
+          regionImg = *Io;
+          outlineImg = *Io;
+          Ir = &regionImg;
+          Io = &outlineImg;
           const int lastRegionId = regionImgs.size() - 1;
+          editedRegion = lastRegionId;
           if (drawingUnderLayer != numeric_limits<int>::max()) {
             int underId = 0;
             forlist(i, layerGrayIds) if (layerGrayIds[i] == drawingUnderLayer)
@@ -1091,15 +1989,25 @@ void MainWindow::handleMouseReleaseEventImageMode(const MyMouseEvent &event) {
             floodFill(*Ir, M, startX, startY, color, 255);
           }
         }
+
+        if (editedRegion != -1) {
+          // the unchanged tiles stay shared with the undo history
+          regionImgs[editedRegion] =
+              TiledImage(regionImg, 0, regionImgs[editedRegion]);
+          outlineImgs[editedRegion] =
+              TiledImage(outlineImg, 255, outlineImgs[editedRegion]);
+        }
       }
     }
   }
+  drawingHistory.commit(*imgData);
 
   // merge all regions into a single image (for displaying it)
   recreateMergedImgs();
 
   // clear the outline image
   currOutlineImg.fill(255);
+  strokeBox.setEmpty();
 }
 
 void MainWindow::handleMousePressEventGeometryMode(const MyMouseEvent &event) {
@@ -1109,7 +2017,7 @@ void MainWindow::handleMousePressEventGeometryMode(const MyMouseEvent &event) {
   auto &selectedPoints = cpData->selectedPoints;
   auto &def = defData->def;
   auto &VCurr = defData->VCurr;
-  auto &Faces = defData->Faces;
+  auto &Faces = defData->mesh.F;
   auto &rightMouseButtonSimulation = *this->rightMouseButtonSimulation;
 
   const bool leftMouseButtonActive =
@@ -1133,9 +2041,9 @@ void MainWindow::handleMousePressEventGeometryMode(const MyMouseEvent &event) {
     if (event.leftButton || event.rightButton) {
       bool reverse = true;
       if (leftMouseButtonActive) reverse = false;
-      bool added = defDeformMode.addControlPointOnFace(
-          VCurr, Faces, mouseCurrPos(0), mouseCurrPos(1), radius, reverse,
-          reverse, selectedPoint, proj3DView);
+      bool added = addControlPointOnFace(defDeformMode, mouseCurrPos(0),
+                                         mouseCurrPos(1), radius, reverse,
+                                         selectedPoint);
       if (selectedPoint != -1) {
         selectedPoints.insert(selectedPoint);
       }
@@ -1155,9 +2063,13 @@ void MainWindow::handleMousePressEventGeometryMode(const MyMouseEvent &event) {
     bool reverse = true;
     if (leftMouseButtonActive) reverse = false;
 
-    bool added = def.addControlPointOnFace(VCurr, Faces, mouseCurrPos(0),
-                                           mouseCurrPos(1), radius, reverse,
-                                           reverse, selectedPoint, proj3DView);
+    bool added = addControlPointOnFace(def, mouseCurrPos(0), mouseCurrPos(1),
+                                       radius, reverse, selectedPoint);
+    if (added) {
+      // a step of its own, dragging it is another one
+      cpHistory.begin(def, *cpData, {});
+      cpHistory.commit(def, *cpData, {selectedPoint});
+    }
     temporaryPoint = false;
     if (selectedPoint != -1) {
       if (!event.shiftModifier) {
@@ -1188,6 +2100,9 @@ void MainWindow::handleMousePressEventGeometryMode(const MyMouseEvent &event) {
     if (selectedPoint == -1) {
       if (!event.shiftModifier) selectedPoints.clear();
       rubberBandActive = true;
+    } else {
+      // the selection may be dragged until the button is released
+      cpHistory.begin(def, *cpData, selectedPoints);
     }
   }
 }
@@ -1249,7 +2164,7 @@ void MainWindow::handleMouseMoveEventGeometryMode(const MyMouseEvent &event) {
 
   // compute translation vector (based on a single control point)
   try {
-    auto &cpFirst = defCurr->getCP(*selectedPoints.begin());
+    auto cpFirst = defCurr->getCP(*selectedPoints.begin());
     const Vector3d cpProj =
         (proj3DView * cpFirst.prevPos.homogeneous()).hnormalized();
     const Vector3d mouseCurrProj(mouseCurrPos(0), mouseCurrPos(1), cpProj(2));
@@ -1260,7 +2175,7 @@ void MainWindow::handleMouseMoveEventGeometryMode(const MyMouseEvent &event) {
 
     // apply the translation vector to all selected control points
     for (const int cpId : selectedPoints) {
-      auto &cp = defCurr->getCP(cpId);
+      auto cp = defCurr->getCP(cpId);
       const auto &it = cpsAnim.find(cpId);
       if (it != cpsAnim.end() && !recordCP) {
         auto &cpAnim = it->second;
@@ -1287,7 +2202,7 @@ void MainWindow::handleMouseReleaseEventGeometryMode(
   auto &mesh = defData->mesh;
   auto &verticesOfParts = defData->verticesOfParts;
   auto &VCurr = defData->VCurr;
-  auto &Faces = defData->Faces;
+  auto &Faces = defData->mesh.F;
   auto &rightMouseButtonSimulation = *this->rightMouseButtonSimulation;
   auto &recordCPWaitForClick = cpData->recordCPWaitForClick;
 
@@ -1324,9 +2239,10 @@ void MainWindow::handleMouseReleaseEventGeometryMode(
 
     // always stop recording CP after releasing the button
     setRecordingCP(false);
+    cpHistory.commit(def, *cpData);
     recordCPWaitForClick = false;  // also stop recording mode
 #ifdef __EMSCRIPTEN__
-    EM_ASM(js_recordingModeStopped(););
+    MAIN_THREAD_ASYNC_EM_ASM(js_recordingModeStopped(););
 #endif
     return;
   }
@@ -1336,10 +2252,12 @@ void MainWindow::handleMouseReleaseEventGeometryMode(
       transformApply();
     else
       transformDiscard();
+    cpHistory.commit(def, *cpData);
     return;
   }
 
   transformApply();
+  cpHistory.commit(def, *cpData);
 
   if (rubberBandActive) {
     // select points inside the rubber band
@@ -1416,27 +2334,45 @@ void MainWindow::drawLine(const MyMouseEvent &event, int x1, int y1, int x2,
   else if (eraseMode || outlineRecolorMode)
     c = Cu{ERASE_PIXEL_COLOR, ERASE_PIXEL_COLOR, ERASE_PIXEL_COLOR, 255};
 
+  // a segment continuing the stroke does not redraw the cap it starts at
+  const bool continued = !strokeBox.isEmpty() &&
+                         strokeEnd == Vector2i(x1, y1) &&
+                         strokeThickness == thickness;
   MyPainter painter(currOutlineImg);
   painter.setColor(c(0), c(1), c(2), c(3));
-  painter.drawLine(x1, y1, x2, y2, thickness);
+  painter.drawStrokeSegment(x1, y1, x2, y2, thickness, continued);
+  strokeEnd = Vector2i(x2, y2);
+  strokeThickness = thickness;
 
-  drawingUnderLayer = numeric_limits<int>::max();
   Imguc &I = currOutlineImg, &MI = mergedOutlinesImg;
+  // only the pixels around this segment are new, unless mergedOutlinesImg was
+  // recreated since the stroke started
+  const int r = thickness + 2;
+  const AlignedBox2i segBox(
+      Vector2i(max(min(x1, x2) - r, 0), max(min(y1, y2) - r, 0)),
+      Vector2i(min(max(x1, x2) + r, I.w - 1), min(max(y1, y2) + r, I.h - 1)));
+  strokeBox.extend(segBox);
+  const bool wholeStroke = strokeBoxMerged.isEmpty();
+  const AlignedBox2i &box = wholeStroke ? strokeBox : segBox;
+  strokeBoxMerged = strokeBox;
+  const int bx0 = box.min().x(), bx1 = box.max().x() + 1;
+  const int by0 = box.min().y(), by1 = box.max().y() + 1;
+  if (wholeStroke) drawingUnderLayer = numeric_limits<int>::max();
   if (neumannOutline) {
-    fora(y, 0, I.h)
-        fora(x, 0, I.w) if (I(x, y, 0) == NEUMANN_OUTLINE_PIXEL_COLOR) {
+    fora(y, by0, by1)
+        fora(x, bx0, bx1) if (I(x, y, 0) == NEUMANN_OUTLINE_PIXEL_COLOR) {
       MI(x, y, 1) = 255;
       MI(x, y, 2) = MI(x, y, 0) = 0;
       MI.alpha(x, y) = 255;  // green
     }
   } else if (eraseMode) {
-    fora(y, 0, I.h) fora(x, 0, I.w) if (I(x, y, 0) == ERASE_PIXEL_COLOR) {
+    fora(y, by0, by1) fora(x, bx0, bx1) if (I(x, y, 0) == ERASE_PIXEL_COLOR) {
       MI.alpha(x, y) = 0;
     }
   } else if (outlineRecolorMode) {
   } else if (leftMouseButtonActive) {
     // compose current outline image on top of merged outlines image
-    fora(y, 0, I.h) fora(x, 0, I.w) if (I(x, y, 0) == 0) {
+    fora(y, by0, by1) fora(x, bx0, bx1) if (I(x, y, 0) == 0) {
       MI(x, y, 2) = MI(x, y, 1) = MI(x, y, 0) = 0;
       MI.alpha(x, y) = 255;
     }
@@ -1444,7 +2380,7 @@ void MainWindow::drawLine(const MyMouseEvent &event, int x1, int y1, int x2,
     // When drawing under already drawn regions, change pen color and also
     // identify the backmost region.
     Imguc &Mr = mergedRegionsImg, &Mm = minRegionsImg;
-    fora(y, 0, I.h) fora(x, 0, I.w) {
+    fora(y, by0, by1) fora(x, bx0, bx1) {
       if (I(x, y, 0) == 0) {
         if (Mm(x, y, 0) > 0 && Mm(x, y, 0) < drawingUnderLayer)
           drawingUnderLayer = Mm(x, y, 0);
@@ -1509,9 +2445,12 @@ void MainWindow::initImageLayers() {
 
 void MainWindow::clearImgs() {
   currOutlineImg.fill(255);
+  strokeBox.setEmpty();
   outlineImgs.clear();
   regionImgs.clear();
   layers.clear();
+  autosaveJournal.reset();
+  drawingHistory.clear();
   mergedRegionsImg.fill(Cu{0, 0, 0, 255});
   mergedRegionsOneColorImg.fill(0);
   mergedOutlinesImg.fill(0);
@@ -1520,71 +2459,102 @@ void MainWindow::clearImgs() {
 }
 
 void MainWindow::recreateMergedImgs() {
+  TRACE_SCOPE("recreateMergedImgs");
   Imguc &Mr = mergedRegionsImg, &Mo = mergedOutlinesImg, &Mm = minRegionsImg;
-  Mr.fill(Cu{0, 0, 0, 255});
-  /*Mr.clear();*/ Mo.fill(0);
-  Mm.clear();
+  Imguc &M1 = mergedRegionsOneColorImg;
+  strokeBoxMerged.setEmpty();
   const int w = Mr.w, h = Mr.h;
   const int N = layers.size();
   layerGrayIds.clear();
+  vector<bool> layerSelected(N);
   fora(i, 0, N) {
-    const int regId = layers[i];
-    const int n = (i + 1) / (float)N * 255;
-    layerGrayIds.push_back(n);
-    Imguc &IrCurr = regionImgs[regId];
-    Imguc &IoCurr = outlineImgs[regId];
-    const bool selected = selectedLayers.find(i) != selectedLayers.end();
-    fora(y, 0, h) fora(x, 0, w) {
-      if (IrCurr(x, y, 0) == 255) {  // we're inside a region
-        fora(c, 0, 3) Mr(x, y, c) = n;
-
-        if (Mo.alpha(x, y) != 0) fora(c, 0, 3) {
-            // light outlines
-            int v = Mo(x, y, c);
-            if (v == 0) v += 220;
-            Mo(x, y, c) = v;
-          }
-        if (Mm(x, y, 0) == 0 || Mm(x, y, 0) > n) Mm(x, y, 0) = n;
-      }
-      if (IoCurr(x, y, 0) != 255) {  // we're inside a stroke
-        if (IoCurr(x, y, 0) == NEUMANN_OUTLINE_PIXEL_COLOR) {
-          if ((showNeumannOutlines || selected)) {
-            Mo(x, y, 1) = 255;
-            Mo(x, y, 0) = Mo(x, y, 2) = 0;
-            Mo.alpha(x, y) = 255;
-          }
-        } else {
-          if (selected) {
-            Mo(x, y, 2) = 255;
-            Mo(x, y, 0) = Mo(x, y, 1) = 0;
-            Mo.alpha(x, y) = 255;
-          } else if (!showSelectedRegionOnly) {
-            if (Mo.alpha(x, y) != 0) {
-              if (!hideRedAnnotations)
-                Mo(x, y, 0) = 255;
-              else
-                Mo(x, y, 0) = 0;
-              Mo(x, y, 2) = Mo(x, y, 1) = 0;
-            } else {
-              Mo(x, y, 0) = Mo(x, y, 2) = Mo(x, y, 1) = 0;
+    layerGrayIds.push_back((i + 1) / (float)N * 255);
+    layerSelected[i] = selectedLayers.find(i) != selectedLayers.end();
+  }
+
+  // The rows are independent, each row is cleared and the layers are
+  // composited into it one after another while it is in cache. The tiles of
+  // a layer without any region or stroke pixels are skipped.
+  const int tileSize = TiledImage::tileSize;
+  const int nTileRows = (h + tileSize - 1) / tileSize;
+  getMainWorkerPool().parallelFor(nTileRows, 1, [&](int ty0, int ty1) {
+    fora(y, ty0 * tileSize, min(ty1 * tileSize, h)) {
+      const int ty = y / tileSize, tileRow = y % tileSize;
+      // Mr is cleared to opaque black (RGBA), the others to 0
+      unsigned char *mr = &Mr(0, y, 0);
+      memset(mr, 0, w * Mr.ch);
+      fora(x, 0, w) mr[x * Mr.ch + 3] = 255;
+      memset(&Mo(0, y, 0), 0, w * Mo.ch);
+      memset(&Mm(0, y, 0), 0, w * Mm.ch);
+      memset(&M1(0, y, 0), 0, w * M1.ch);
+
+      fora(i, 0, N) {
+        const int regId = layers[i];
+        const int n = layerGrayIds[i];
+        const TiledImage &Ir = regionImgs[regId];
+        const TiledImage &Io = outlineImgs[regId];
+        const bool selected = layerSelected[i];
+        const bool skipEmptyTiles =
+            Ir.background != 255 && Io.background == 255;
+        fora(tx, 0, Ir.tilesX()) {
+          const unsigned char *rt = Ir.tile(tx, ty), *ot = Io.tile(tx, ty);
+          if (rt == nullptr && ot == nullptr && skipEmptyTiles) continue;
+          if (rt != nullptr) rt += tileRow * tileSize * Ir.ch;
+          if (ot != nullptr) ot += tileRow * tileSize * Io.ch;
+          const int x0 = tx * tileSize;
+          fora(x, x0, min(x0 + tileSize, w)) {
+            const unsigned char r =
+                rt != nullptr ? rt[(x - x0) * Ir.ch] : Ir.background;
+            const unsigned char o =
+                ot != nullptr ? ot[(x - x0) * Io.ch] : Io.background;
+            if (r == 255) {  // we're inside a region
+              fora(c, 0, 3) Mr(x, y, c) = n;
+
+              if (Mo.alpha(x, y) != 0) fora(c, 0, 3) {
+                  // light outlines
+                  int v = Mo(x, y, c);
+                  if (v == 0) v += 220;
+                  Mo(x, y, c) = v;
+                }
+              if (Mm(x, y, 0) == 0 || Mm(x, y, 0) > n) Mm(x, y, 0) = n;
+            }
+            if (o != 255) {  // we're inside a stroke
+              if (o == NEUMANN_OUTLINE_PIXEL_COLOR) {
+                if ((showNeumannOutlines || selected)) {
+                  Mo(x, y, 1) = 255;
+                  Mo(x, y, 0) = Mo(x, y, 2) = 0;
+                  Mo.alpha(x, y) = 255;
+                }
+              } else {
+                if (selected) {
+                  Mo(x, y, 2) = 255;
+                  Mo(x, y, 0) = Mo(x, y, 1) = 0;
+                  Mo.alpha(x, y) = 255;
+                } else if (!showSelectedRegionOnly) {
+                  if (Mo.alpha(x, y) != 0) {
+                    if (!hideRedAnnotations)
+                      Mo(x, y, 0) = 255;
+                    else
+                      Mo(x, y, 0) = 0;
+                    Mo(x, y, 2) = Mo(x, y, 1) = 0;
+                  } else {
+                    Mo(x, y, 0) = Mo(x, y, 2) = Mo(x, y, 1) = 0;
+                  }
+                  Mo.alpha(x, y) = 255;
+                }
+              }
             }
-            Mo.alpha(x, y) = 255;
           }
         }
       }
-      if (IrCurr(x, y, 0) == 255) {  // we're inside a region
-      }
-    }
-  }
 
-  // create a one color region layer that will be placed under outline image to
-  // better convey the regions
-  mergedRegionsOneColorImg.fill(0);
-  fora(y, 0, h) fora(x, 0, w) {
-    if (Mr(x, y, 0) > 0) {
-      fora(c, 0, 4) mergedRegionsOneColorImg(x, y, c) = 255;
+      // create a one color region layer that will be placed under outline
+      // image to better convey the regions
+      fora(x, 0, w) {
+        if (mr[x * Mr.ch] > 0) memset(&M1(x, y, 0), 255, M1.ch);
+      }
     }
-  }
+  });
 
   repaint = true;
 }
@@ -1599,6 +2569,9 @@ void MainWindow::reset() {
   showModel = false;
 
   // reset reconstruction data
+  modeChangePending = modeChangeReconstructed = false;
+  recTask.discard();
+  finishDeformation();
   recData = RecData();
 
   // reset shading options
@@ -1607,6 +2580,7 @@ void MainWindow::reset() {
   // reset control points
   cpData = CPData();
   cpDataBackup = CPData();
+  cpHistory.clear();
 
   // reset deformation
   defData = DefData();
@@ -1627,6 +2601,9 @@ void MainWindow::reset() {
 
 void MainWindow::changeManipulationMode(
     const ManipulationMode &manipulationMode, bool saveCPs) {
+  // any mode change cancels a pending switch to geometry mode
+  cancelPendingModeChange();
+
   ManipulationMode prevMode = this->manipulationMode;
   this->manipulationMode = manipulationMode;
 
@@ -1638,6 +2615,9 @@ void MainWindow::changeManipulationMode(
   DEBUG_CMD_MM(cout << "changeManipulationMode: " << prevMode.mode << " -> "
                     << manipulationMode.mode << endl;);
 
+  // results of reconstructions started in the previous mode are not used
+  recTask.cancel();
+
   // going from DEFORM_MODE
   if (prevMode.mode == DEFORM_MODE && manipulationMode.mode != DEFORM_MODE) {
     DEBUG_CMD_MM(cout << "restoring data from backup" << endl;);
@@ -1647,39 +2627,36 @@ void MainWindow::changeManipulationMode(
     cpData.showControlPoints = showControlPointsPrev;
   }
 
-  // going from image to geometry mode
+  // going from image to geometry mode, the reconstruction runs in the
+  // background and the drawing stays active until it has finished (see
+  // applyAsyncReconstruction())
   if (prevMode.isImageModeActive() && manipulationMode.isGeometryModeActive()) {
-    progressMessage = "Reconstruction running";
-
-    if (performReconstruction(recData, defData, cpData, imgData)) {
-      progressMessage = "";
-
-      // reset camera matrix (needed for proper transitions)
-      proj3DView = proj3DViewInv = Matrix4d::Identity();
+    if (!modeChangeReconstructed) {
+      this->manipulationMode = prevMode;
+      pendingManipulationMode = manipulationMode;
+      modeChangePending = true;
+      progressMessage = "Reconstruction running";
+      finishDeformation();
+      recTask.start(recData, imgData, defData, cpData);
+      repaint = true;
+      return;
+    }
+    modeChangeReconstructed = false;
 
-    } else {
-      progressMessage = "Reconstruction failed";
-      changeManipulationMode(DRAW_OUTLINE);
+    // reset camera matrix (needed for proper transitions)
+    proj3DView = proj3DViewInv = Matrix4d::Identity();
+    cameraKey.resize(0);
 
 #ifdef __EMSCRIPTEN__
-      EM_ASM(js_reconstructionFailed(););
+    MAIN_THREAD_ASYNC_EM_ASM(js_reconstructionFinished(););
 #endif
-
-      return;
-    }
-
-#ifdef __EMSCRIPTEN__
-    EM_ASM(js_reconstructionFinished(););
-#endif
-  }
+  }
 
   // going from geometry to image mode
   if (prevMode.isGeometryModeActive() && manipulationMode.isImageModeActive()) {
     if (saveCPs) {
       // save control points and their animations
-      ostringstream oss;
-      saveControlPointsToStream(oss, cpData, defData, imgData);
-      savedCPs = oss.str();
+      saveControlPointsToBinary(savedCPs, cpData, defData, imgData);
     }
 
     recreateMergedImgs();
@@ -1729,7 +2706,7 @@ void MainWindow::transformEnd(bool apply) {
 
   for (int cpId : selectedPoints) {
     try {
-      auto &cp = def.getCP(cpId);
+      auto cp = def.getCP(cpId);
       if (apply) {
         cp.pos.z() =
             VCurr.row(cp.ptId).z();  // don't allow z-translation: update
@@ -1744,7 +2721,7 @@ void MainWindow::transformEnd(bool apply) {
         if (apply) {
           // don't allow z-translation: update z-coordinate of control point by
           // z-coordinate of corresponding mesh point
-          MatrixXd &T = cpAnim.getTransform();
+          Matrix4d &T = cpAnim.getTransform();
           T(2, 3) = 0;
           cpAnim.applyTransform();  // apply
         } else
@@ -1768,9 +2745,11 @@ void MainWindow::removeControlPointOrRegion() {
     // otherwise
     if (!removeCPAnims()) removeControlPoints();
   } else {
+    drawingHistory.begin(imgData);
     if (!removeSelectedLayers()) {
       removeLastRegion();
     }
+    drawingHistory.commit(imgData);
     recreateMergedImgs();
   }
   repaint = true;
@@ -1783,6 +2762,7 @@ void MainWindow::removeControlPoints() {
   auto &cpsAnimSyncId = this->cpData.cpsAnimSyncId;
 
   // remove selected control points and their animations
+  cpHistory.begin(def, cpData, selectedPoints);
   selectedPoint = -1;
   for (auto it = selectedPoints.begin(); it != selectedPoints.end();) {
     const int cpId = *it;
@@ -1791,6 +2771,7 @@ void MainWindow::removeControlPoints() {
     cpsAnim.erase(cpId);
     if (cpId == cpsAnimSyncId) cpsAnimSyncId = -1;
   }
+  cpHistory.commit(def, cpData);
   repaint = true;
 }
 
@@ -1907,6 +2888,21 @@ void computeScaledImage(const T targetW, const T targetH, T &newW, T &newH,
   }
 }
 
+// Imguc::scale() run in horizontal strips on the worker pool, e.g. for large
+// reference images
+static Imguc scaleImage(const Imguc &I, int newW, int newH) {
+  if (newW == I.w && newH == I.h) return I;
+  Imguc O(newW, newH, I.ch, I.alphaChannel);
+  const int stripH = 64;
+  const int nStrips = (newH + stripH - 1) / stripH;
+  getMainWorkerPool().parallelFor(nStrips, 1, [&](int begin, int end) {
+    fora(i, begin, end) {
+      I.scaleRows(O, i * stripH, min((i + 1) * stripH, newH));
+    }
+  });
+  return O;
+}
+
 void MainWindow::loadTemplateImageFromFile(bool scale) {
   Imguc tmp = Imguc::loadImage("/tmp/template.img", 3, 4);
   DEBUG_CMD_MM(cout << "loadTemplateImageFromFile: " << tmp << endl;);
@@ -1916,13 +2912,14 @@ void MainWindow::loadTemplateImageFromFile(bool scale) {
       int shiftX = 0, shiftY = 0;
       computeScaledImage(viewportW, viewportH, newW, newH, shiftX, shiftY);
       templateImg.setNull() =
-          tmp.scale(newW, newH)
+          scaleImage(tmp, newW, newH)
               .resize(windowWidth, windowHeight, shiftX, shiftY, Cu{255});
     } else {
       templateImg.setNull() =
           tmp.resize(windowWidth, windowHeight, 0, 0, Cu{255});
     }
-    loadTextureToGPU(templateImg, glData.templateImgTexName);
+    loadTemplateTexture();
+    autosaveJournal.markImagesModified();
     shadingOpts.showTemplateImg = true;
     shadingOpts.showTexture = true;
   }
@@ -1938,13 +2935,14 @@ void MainWindow::loadBackgroundImageFromFile(bool scale) {
       int shiftX = 0, shiftY = 0;
       computeScaledImage(viewportW, viewportH, newW, newH, shiftX, shiftY);
       backgroundImg.setNull() =
-          tmp.scale(newW, newH)
+          scaleImage(tmp, newW, newH)
               .resize(windowWidth, windowHeight, shiftX, shiftY, Cu{255});
     } else {
       backgroundImg.setNull() =
           tmp.resize(windowWidth, windowHeight, 0, 0, Cu{255});
     }
     loadTextureToGPU(backgroundImg, glData.backgroundImgTexName);
+    autosaveJournal.markImagesModified();
     shadingOpts.showBackgroundImg = true;
   }
   repaint = true;
@@ -1976,33 +2974,46 @@ void MainWindow::setRecordingCP(bool active) {
   auto &animMode = cpData.animMode;
 
   recordCP = active;
-
+  // committed when the button is released
+  if (recordCP) cpHistory.begin(def, cpData, selectedPoints);
+
+  int smoothFrom = autoSmoothAnimFrom;
+  int smoothTo = autoSmoothAnimTo;
+  if (animMode == ANIM_MODE_OVERWRITE || animMode == ANIM_MODE_LAYER) {
+    int syncLength = cpAnimSync.getLength();
+    int syncT =
+        syncLength > 0 ? static_cast<int>(cpAnimSync.lastT) % syncLength : 0;
+    smoothFrom = syncT + autoSmoothAnimFrom;
+    smoothTo = syncT + autoSmoothAnimTo;
+  }
+  vector<CPAnim *> smoothed;
   for (int i : selectedPoints) {
     const auto &it = cpsAnim.find(i);
     if (it == cpsAnim.end()) continue;
     auto &cpAnim = it->second;
     if (recordCP) {
-      // recording started - clear previously recorded control point animation
-      // if it exists
-      cpAnim = CPAnim();
+      if (animMode == ANIM_MODE_LAYER && i != cpData.cpsAnimSyncId &&
+          cpAnim.getLength() > 0 &&
+          cpAnim.getLength() == cpAnimSync.getLength()) {
+        // recording started - the take goes to a new layer
+        cpAnim.addLayer();
+      } else {
+        // recording started - clear previously recorded control point
+        // animation if it exists
+        cpAnim = CPAnim();
+      }
     } else {
       // recording stopped
       cpAnim.setAll(false, true);
-      if (autoSmoothAnim) {
-        int from = autoSmoothAnimFrom;
-        int to = autoSmoothAnimTo;
-        if (animMode == ANIM_MODE_OVERWRITE || animMode == ANIM_MODE_AVERAGE) {
-          int syncLength = cpAnimSync.getLength();
-          int syncT = syncLength > 0
-                          ? static_cast<int>(cpAnimSync.lastT) % syncLength
-                          : 0;
-          from = syncT + autoSmoothAnimFrom;
-          to = syncT + autoSmoothAnimTo;
-        }
-        cpAnim.performSmoothing(from, to, autoSmoothAnimIts);
-      }
+      if (autoSmoothAnim) smoothed.push_back(&cpAnim);
     }
   }
+  // the animations are independent, smooth them in parallel
+  getMainWorkerPool().parallelFor(smoothed.size(), 1, [&](int begin, int end) {
+    fora(i, begin, end) {
+      smoothed[i]->performSmoothing(smoothFrom, smoothTo, autoSmoothAnimIts);
+    }
+  });
   if (recordCP) {
     // recording started
     recordCPActive = true;
@@ -2034,19 +3045,15 @@ void MainWindow::cpAnimationPlaybackAndRecord() {
   if (!cpsAnim.empty()) {
     const auto &it = cpsAnim.find(cpsAnimSyncId);
     if (it == cpsAnim.end()) {
-      // sync anim does not exist anymore - create it from the first cpAnim in
-      // the list
+      // sync anim does not exist anymore - take the first cpAnim in the list
       cpsAnimSyncId = cpsAnim.begin()->first;
-      cpAnimSync =
-          CPAnim(cpsAnim.begin()
-                     ->second.getKeyposes());  // initialize only with keyposes
-                                               // of the first cpAnim
+      cpAnimSync = CPAnimSync(cpsAnim.begin()->second.getLength());
       DEBUG_CMD_MM(cout << "cpsanimfirst " << cpsAnimSyncId << endl;)
     } else {
       if (cpAnimSync.getLength() != it->second.getLength()) {
-        // Lengths of sync animation and its assigned animations differ:
-        // update cpAnimSync: only by keyposes of the first cpAnim.
-        cpAnimSync = CPAnim(it->second.getKeyposes());
+        // the sync animation changed its length (e.g. while it is being
+        // recorded), restart the timeline
+        cpAnimSync = CPAnimSync(it->second.getLength());
       }
     }
 
@@ -2056,28 +3063,42 @@ void MainWindow::cpAnimationPlaybackAndRecord() {
     }
   } else {
     cpsAnimSyncId = -1;
-    cpAnimSync = CPAnim();
+    cpAnimSync = CPAnimSync();
   }
 
   // sync timepoint hack allowing for animation speed-up/slow-down
+  bool clockRunning = false;
   if (cpsAnimSyncId != -1 && cpAnimSync.getLength() > 0) {
     if (playAnimation || recordCP) {
       if (!manualTimepoint) {
-        cpAnimSync.lastT++;
-        if (cpAnimSync.lastT >= 100 * cpAnimSync.getLength())
-          cpAnimSync.lastT = 0;
+        // recording samples one keypose per frame, playback follows the
+        // clock (in whole steps if the frames are cached)
+        if (recordCP) {
+          cpAnimSync.lastT++;
+        } else {
+          // the morph playback blends the cached frames
+          cpAnimSync.lastT += animClock.advance(animCacheActive() &&
+                                                !morphPlaybackActive());
+          clockRunning = true;
+        }
+        const double wrap = 100 * cpAnimSync.getLength();
+        if (cpAnimSync.lastT >= wrap)
+          cpAnimSync.lastT = fmod(cpAnimSync.lastT, wrap);
       }
     }
   }
+  if (!clockRunning) animClock.reset();
 
   if (!def.getCPs().empty()) {
+    processCPInput();
+
     // recording
     if (recordCP && selectedPoint != -1) {
       bool overwriteMode = false;
       int syncLength = 0;
       int syncT = 0;
       if (!cpAnimSyncUpdating &&
-          (animMode == ANIM_MODE_OVERWRITE || animMode == ANIM_MODE_AVERAGE)) {
+          (animMode == ANIM_MODE_OVERWRITE || animMode == ANIM_MODE_LAYER)) {
         if (cpsAnimSyncId != -1 && cpAnimSync.getLength() > 0)
           overwriteMode = true;
         if (overwriteMode) {
@@ -2089,36 +3110,32 @@ void MainWindow::cpAnimationPlaybackAndRecord() {
         }
       }
 
+      // one timestamp for all the keyposes of the frame
+      const int timestamp =
+          chrono::duration_cast<chrono::milliseconds>(
+              chrono::high_resolution_clock::now() - cpData.timestampStart)
+              .count();
       for (int cpId : selectedPoints) {
         try {
           Vector3d p = def.getCP(cpId).pos;
           auto &cpAnim = cpsAnim[cpId];
-          int timestamp =
-              chrono::duration_cast<chrono::milliseconds>(
-                  chrono::high_resolution_clock::now() - cpData.timestampStart)
-                  .count();
 
           if (!cpAnimSyncUpdating && overwriteMode) {
             if (cpAnim.getLength() != syncLength) {
               // lengths do not match, recreate, initialize with empty flag
               cpAnim = CPAnim(syncLength, p);
             }
-            const auto &kPrev = cpAnim.peekk(syncT);
-            // If the value at the current timepoint is empty, set it to the
-            // current position, otherwise compute average of previous and
-            // current position.
-            if (animMode == ANIM_MODE_AVERAGE && !kPrev.empty) {
-              p = 0.75 * p + 0.25 * kPrev.p;
+            if (animMode == ANIM_MODE_LAYER && cpAnim.getNumLayers() > 0) {
+              cpAnim.recordLayer(syncT, p);
+            } else {
+              cpAnim.record(syncT,
+                            CPAnim::Keypose{p, timestamp, false, true, true});
             }
-            cpAnim.record(syncT,
-                          CPAnim::Keypose{p, timestamp, false, true, true});
             const int syncTNext = syncLength > 0 ? (syncT + 1) % syncLength : 0;
-            auto &kNext = cpAnim.peekk(syncTNext);
-            kNext.display = false;
+            cpAnim.setDisplayed(syncTNext, false);
           } else {
             if (cpAnim.lastT >= 1) {
-              auto &k = cpAnim.peekk(static_cast<int>(cpAnim.lastT));
-              k.display = true;
+              cpAnim.setDisplayed(static_cast<int>(cpAnim.lastT), true);
             }
             cpAnim.record(CPAnim::Keypose{p, timestamp, true, false, true});
           }
@@ -2133,26 +3150,74 @@ void MainWindow::cpAnimationPlaybackAndRecord() {
       defEng.solveForZ = false;  // pause z-deformation
     }
     if (playAnimation || recordCP) {
+      const auto &cps = def.getCPs();
+      cpAnimBatch.clear(cpAnimSync.getLength());
       for (auto &it2 : cpsAnim) {
         const int cpId = it2.first;
-        CPAnim &a = it2.second;
         // skip selected points
         if (selectedPoints.find(cpId) != selectedPoints.end() &&
             (!playAnimWhenSelected || recordCP)) {
           continue;
         }
-        a.syncSetLength(cpAnimSync.getLength());
-        try {
-          auto &cp = def.getCP(cpId);
-          cp.pos = cp.prevPos = a.replay(cpAnimSync.lastT);
-        } catch (out_of_range &e) {
-          cerr << e.what() << endl;
+        // skip points recorded from an input device
+        if (cpInputRecorder.isRecording(cpId)) continue;
+        const int slot = cps.getSlot(cpId);
+        if (slot == -1) {
+          cerr << "playback: control point " << cpId << " not found" << endl;
+          continue;
         }
+        cpAnimBatch.add(it2.second, slot);
+      }
+      cpAnimBatch.replay(cpAnimSync.lastT);
+      fora(i, 0, cpAnimBatch.size()) {
+        auto cp = def.getCPAt(cpAnimBatch.getKey(i));
+        cp.pos = cp.prevPos = cpAnimBatch.getPosition(i);
       }
     }
   }
 }
 
+void MainWindow::processCPInput() {
+  const auto &cps = def.getCPs();
+  CPInputSample sample;
+  while (cpInputQueue.pop(sample)) {
+    const int slot = cps.getSlot(sample.cpId);
+    if (slot == -1) continue;
+    auto cp = def.getCPAt(slot);
+    cp.pos = cp.prevPos = Vector3d(sample.x, sample.y, sample.z);
+    if (cpInputRecorder.isRecording()) {
+      cpInputRecorder.record(sample, cpData.cpsAnim[sample.cpId]);
+    }
+  }
+}
+
+bool MainWindow::pushCPInput(int cpId, double x, double y, double z,
+                             double seconds) {
+  return cpInputQueue.push(CPInputSample{cpId, x, y, z, seconds});
+}
+
+void MainWindow::setCPInputRecording(bool active) {
+  if (active) {
+    cpInputRecorder.start();
+    return;
+  }
+
+  // recording stopped
+  vector<CPAnim *> smoothed;
+  for (int cpId : cpInputRecorder.getRecordedCPs()) {
+    auto &cpAnim = cpData.cpsAnim[cpId];
+    cpAnim.setAll(false, true);
+    if (autoSmoothAnim) smoothed.push_back(&cpAnim);
+  }
+  cpInputRecorder.stop();
+  getMainWorkerPool().parallelFor(smoothed.size(), 1, [&](int begin, int end) {
+    fora(i, begin, end) {
+      smoothed[i]->performSmoothing(autoSmoothAnimFrom, autoSmoothAnimTo,
+                                    autoSmoothAnimIts);
+    }
+  });
+}
+
 void MainWindow::setAnimRecMode(AnimMode animMode) {
   cpData.animMode = animMode;
 }
@@ -2173,27 +3238,65 @@ void MainWindow::toggleAnimationSelectedPlayback() {
 }
 
 void MainWindow::offsetSelectedCpAnimsByFrames(double offset) {
+  offsetSelectedCpAnims(offset, false);
+}
+
+void MainWindow::offsetSelectedCpAnimsByPercentage(double offset) {
+  offsetSelectedCpAnims(offset, true);
+}
+
+void MainWindow::offsetSelectedCpAnims(double offset, bool percentage) {
   auto &selectedPoints = this->cpData.selectedPoints;
   auto &cpsAnim = this->cpData.cpsAnim;
 
+  cpHistory.begin(def, cpData, selectedPoints);
   for (auto &it : cpsAnim) {
     const int cpId = it.first;
     if (selectedPoints.find(cpId) == selectedPoints.end()) continue;
     auto &cpAnim = it.second;
-    cpAnim.setOffset(cpAnim.getOffset() + offset);
+    const double frames =
+        percentage ? offset / 100 * cpAnim.getLength() : offset;
+    cpAnim.setOffset(cpAnim.getOffset() + frames);
     try {
-      auto &cp = def.getCP(cpId);
+      auto cp = def.getCP(cpId);
       cp.pos = cp.prevPos = cpAnim.peek();
     } catch (out_of_range &e) {
       cerr << e.what() << endl;
     }
   }
+  cpHistory.commit(def, cpData);
 
   repaint = true;
 }
 
-void MainWindow::offsetSelectedCpAnimsByPercentage(double offset) {
-  // TODO: not implemented
+void MainWindow::resampleCpAnims(int length, bool selectedOnly) {
+  auto &selectedPoints = this->cpData.selectedPoints;
+  auto &cpsAnim = this->cpData.cpsAnim;
+
+  if (length <= 0) length = cpAnimSync.getLength();
+  if (length <= 0) return;
+  vector<CPAnim *> anims;
+  for (auto &it : cpsAnim) {
+    if (selectedOnly && selectedPoints.find(it.first) == selectedPoints.end()) {
+      continue;
+    }
+    anims.push_back(&it.second);
+  }
+  // the animations are independent, resample them in parallel
+  getMainWorkerPool().parallelFor(anims.size(), 1, [&](int begin, int end) {
+    fora(i, begin, end) anims[i]->resample(length);
+  });
+  // the sync animation follows the resampled one it was created from
+  const auto &it = cpsAnim.find(cpData.cpsAnimSyncId);
+  if (it != cpsAnim.end()) {
+    const double lastT = cpAnimSync.lastT;
+    const int prevLength = cpAnimSync.getLength();
+    cpAnimSync = CPAnimSync(it->second.getLength());
+    if (prevLength > 0) {
+      cpAnimSync.lastT = lastT * cpAnimSync.getLength() / prevLength;
+    }
+  }
+
   repaint = true;
 }
 
@@ -2212,6 +3315,45 @@ bool MainWindow::copySelectedAnim() {
   return true;
 }
 
+int MainWindow::getSelectedAnimNumLayers() {
+  const auto &it = cpData.cpsAnim.find(cpData.selectedPoint);
+  return it == cpData.cpsAnim.end() ? 0 : it->second.getNumLayers();
+}
+
+void MainWindow::setSelectedAnimLayerWeight(int layer, float weight) {
+  for (int cpId : cpData.selectedPoints) {
+    const auto &it = cpData.cpsAnim.find(cpId);
+    if (it == cpData.cpsAnim.end()) continue;
+    CPAnim &cpAnim = it->second;
+    if (layer >= 0 && layer < cpAnim.getNumLayers()) {
+      cpAnim.setLayerWeight(layer, weight);
+    }
+  }
+  repaint = true;
+}
+
+void MainWindow::removeSelectedAnimLayer(int layer) {
+  cpHistory.begin(def, cpData, cpData.selectedPoints);
+  for (int cpId : cpData.selectedPoints) {
+    const auto &it = cpData.cpsAnim.find(cpId);
+    if (it == cpData.cpsAnim.end()) continue;
+    CPAnim &cpAnim = it->second;
+    if (layer >= 0 && layer < cpAnim.getNumLayers()) cpAnim.removeLayer(layer);
+  }
+  cpHistory.commit(def, cpData);
+  repaint = true;
+}
+
+void MainWindow::flattenSelectedAnimLayers() {
+  cpHistory.begin(def, cpData, cpData.selectedPoints);
+  for (int cpId : cpData.selectedPoints) {
+    const auto &it = cpData.cpsAnim.find(cpId);
+    if (it != cpData.cpsAnim.end()) it->second.flattenLayers();
+  }
+  cpHistory.commit(def, cpData);
+  repaint = true;
+}
+
 bool MainWindow::pasteSelectedAnim() {
   auto &selectedPoints = this->cpData.selectedPoints;
   auto &selectedPoint = this->cpData.selectedPoint;
@@ -2221,9 +3363,10 @@ bool MainWindow::pasteSelectedAnim() {
     DEBUG_CMD_MM(cout << "No control point selected." << endl;);
     return false;
   }
+  cpHistory.begin(def, cpData, selectedPoints);
   for (int cpId : selectedPoints) {
     try {
-      auto &cp = def.getCP(cpId);
+      auto cp = def.getCP(cpId);
       auto &cpAnim = cpsAnim[cpId];
       cpAnim = copiedAnim;
       Vector3d t = -cpAnim.peek(0) + cp.pos;
@@ -2234,6 +3377,7 @@ bool MainWindow::pasteSelectedAnim() {
       cerr << e.what() << endl;
     }
   }
+  cpHistory.commit(def, cpData);
 
   repaint = true;
 
@@ -2246,11 +3390,13 @@ bool MainWindow::removeCPAnims() {
   auto &cpsAnimSyncId = this->cpData.cpsAnimSyncId;
 
   // remove only animations of selected control points
+  cpHistory.begin(def, cpData, selectedPoints);
   bool cpErased = false;
   for (const int cpId : selectedPoints) {
     if (cpId == cpsAnimSyncId) cpsAnimSyncId = -1;
     if (cpsAnim.erase(cpId) != 0) cpErased = true;
   }
+  cpHistory.commit(def, cpData);
 
   repaint = true;
 
@@ -2265,17 +3411,107 @@ void MainWindow::setCPsVisibility(bool visible) {
 
 bool MainWindow::getCPsVisibility() { return cpData.showControlPoints; }
 
+void MainWindow::setPlaybackSkinning(bool enabled) {
+  defData.defEngPlaybackSkinning = enabled;
+}
+
+bool MainWindow::getPlaybackSkinning() {
+  return defData.defEngPlaybackSkinning;
+}
+
+void MainWindow::setAnimCacheEnabled(bool enabled) {
+  animCacheEnabled = enabled;
+  if (!enabled) animCache.clear();
+}
+
+bool MainWindow::getAnimCacheEnabled() { return animCacheEnabled; }
+
+void MainWindow::setLibraryNumThreads(int numThreads) {
+  recData.numThreads = numThreads;
+  ::setLibraryNumThreads(numThreads);
+}
+
+int MainWindow::getLibraryNumThreads() { return recData.numThreads; }
+
+void MainWindow::setPerformanceProfile(int profile) {
+  if (profile < 0 || profile >= NUM_PERF_PROFILES) return;
+  finishDeformation();
+  applyPerfProfile(static_cast<PerfProfile>(profile), recData, shadingOpts);
+  applyPerformanceProfile();
+  if (manipulationMode.isGeometryModeActive()) reconstructInGeometryMode(false);
+  repaint = true;
+}
+
+int MainWindow::getPerformanceProfile() { return recData.perfProfile; }
+
+void MainWindow::setSoftwareRendering(bool enabled) {
+  softwareRendering = enabled;
+  repaint = true;
+}
+
+bool MainWindow::getSoftwareRendering() { return softwareRendering; }
+
+void MainWindow::setGPUPicking(bool enabled) { gpuPicking = enabled; }
+
+bool MainWindow::getGPUPicking() { return gpuPicking; }
+
+void MainWindow::setMeshLOD(bool enabled) {
+  meshLOD = enabled;
+  repaint = true;
+}
+
+bool MainWindow::getMeshLOD() { return meshLOD; }
+
+void MainWindow::setMorphPlayback(bool enabled) {
+  morphPlayback = enabled;
+  repaint = true;
+}
+
+bool MainWindow::getMorphPlayback() { return morphPlayback; }
+
+void MainWindow::setTextureAtlas(bool enabled) {
+  textureAtlas = enabled;
+  repaint = true;
+}
+
+bool MainWindow::getTextureAtlas() { return textureAtlas; }
+
+int MainWindow::addSceneCharacter(const std::string &zipFn,
+                                  const Eigen::Vector3d &offset) {
+  const int i = scene.addCharacter(zipFn, offset, viewportW, viewportH,
+                                   &getMainWorkerPool());
+  if (i == -1) {
+    DEBUG_CMD_MM(cout << "cannot add the character " << zipFn << endl;);
+    return -1;
+  }
+  // deformed once to show up outside of the animate mode as well
+  scene.update(sceneT, getMainWorkerPool());
+  repaint = true;
+  return i;
+}
+
+void MainWindow::clearScene() {
+  scene.clear();
+  scene.update(sceneT, getMainWorkerPool());
+  repaint = true;
+}
+
 ManipulationMode MainWindow::openProject(const std::string &zipFn,
                                          bool changeMode) {
   reset();
   ManipulationMode newManipulationMode;
   loadAllFromZip(zipFn, viewportW, viewportH, cpData, imgData, recData,
                  savedCPs, templateImg, backgroundImg, shadingOpts,
-                 newManipulationMode, middleMouseSimulation);
+                 newManipulationMode, middleMouseSimulation,
+                 &getMainWorkerPool());
+  return applyOpenedProject(newManipulationMode, changeMode);
+}
+
+ManipulationMode MainWindow::applyOpenedProject(
+    const ManipulationMode &newManipulationMode, bool changeMode) {
+  applyPerformanceProfile();
   shadingOpts.showTexture = shadingOpts.showTemplateImg;
-  if (!templateImg.isNull()) {
-    loadTextureToGPU(templateImg, glData.templateImgTexName);
-  }
+  if (!templateImg.isNull()) loadTemplateTexture();
   if (!backgroundImg.isNull()) {
     loadTextureToGPU(backgroundImg, glData.backgroundImgTexName);
   }
@@ -2287,12 +3523,86 @@ ManipulationMode MainWindow::openProject(const std::string &zipFn,
   return newManipulationMode;
 }
 
+void MainWindow::loadProjectImages(const std::string &zipFn) {
+  Imguc newTemplateImg, newBackgroundImg;
+  if (!loadProjectImagesFromZip(zipFn, newTemplateImg, newBackgroundImg))
+    return;
+  if (templateImg.isNull() && !newTemplateImg.isNull()) {
+    templateImg = std::move(newTemplateImg);
+    loadTemplateTexture();
+    autosaveJournal.markImagesModified();
+  }
+  if (backgroundImg.isNull() && !newBackgroundImg.isNull()) {
+    backgroundImg = std::move(newBackgroundImg);
+    loadTextureToGPU(backgroundImg, glData.backgroundImgTexName);
+    autosaveJournal.markImagesModified();
+  }
+  repaint = true;
+}
+
 void MainWindow::saveProject(const std::string &zipFn) {
   auto *cpDataAnimateMode = &cpData;
   if (manipulationMode.mode == DEFORM_MODE) cpDataAnimateMode = &cpDataBackup;
+  finishDeformation();
   saveAllToZip(zipFn, *cpDataAnimateMode, defData, imgData, recData, savedCPs,
                templateImg, backgroundImg, shadingOpts, manipulationMode,
-               middleMouseSimulation);
+               middleMouseSimulation, true, &getMainWorkerPool());
+  // compact the journal
+  if (autosaveInterval > 0) {
+    autosaveJournal.reset();
+    writeAutosave();
+  }
+}
+
+bool MainWindow::startSessionRecording(const std::string &fn) {
+  saveProject(fn + ".zip");
+  return startRecording(fn);
+}
+
+void MainWindow::stopSessionRecording() { stopRecording(); }
+
+bool MainWindow::replaySession(const std::string &fn,
+                               const std::string &reportFn) {
+  openProject(fn + ".zip");
+  return replay(fn, reportFn);
+}
+
+static const char *autosaveFn = "/tmp/mm_autosave.bin";
+
+void MainWindow::autosave() {
+  if (autosaveInterval <= 0) return;
+  const auto now = chrono::steady_clock::now();
+  if (now - lastAutosave < chrono::duration<double>(autosaveInterval)) return;
+  lastAutosave = now;
+  writeAutosave();
+}
+
+void MainWindow::writeAutosave() {
+  TRACE_SCOPE("writeAutosave");
+  auto *cpDataAnimateMode = &cpData;
+  if (manipulationMode.mode == DEFORM_MODE) cpDataAnimateMode = &cpDataBackup;
+  finishDeformation();
+  autosaveJournal.append(autosaveFn, *cpDataAnimateMode, defData, imgData,
+                         recData, savedCPs, templateImg, backgroundImg,
+                         shadingOpts, manipulationMode, middleMouseSimulation,
+                         &getMainWorkerPool());
+}
+
+void MainWindow::setAutosaveInterval(double seconds) {
+  autosaveInterval = seconds;
+  lastAutosave = chrono::steady_clock::now();
+}
+
+double MainWindow::getAutosaveInterval() { return autosaveInterval; }
+
+ManipulationMode MainWindow::recoverAutosave(bool changeMode) {
+  reset();
+  ManipulationMode newManipulationMode;
+  loadProjectJournal(autosaveFn, viewportW, viewportH, cpData, imgData,
+                     recData, savedCPs, templateImg, backgroundImg,
+                     shadingOpts, newManipulationMode, middleMouseSimulation,
+                     &getMainWorkerPool());
+  return applyOpenedProject(newManipulationMode, changeMode);
 }
 
 void MainWindow::setTemplateImageVisibility(bool visible) {
@@ -2325,7 +3635,10 @@ bool MainWindow::isTextureShadingEnabled() {
   return shadingOpts.showTextureUseMatcapShading;
 }
 
-ManipulationMode &MainWindow::getManipulationMode() { return manipulationMode; }
+ManipulationMode &MainWindow::getManipulationMode() {
+  // report the mode being switched to while its reconstruction is running
+  return modeChangePending ? pendingManipulationMode : manipulationMode;
+}
 
 void MainWindow::recomputeCameraCenter() {
   auto &V = defData.VCurr;
@@ -2350,6 +3663,88 @@ void MainWindow::enableArmpitsStitching(bool enabled) {
 
 bool MainWindow::isArmpitsStitchingEnabled() { return armpitsStitching; }
 
+void MainWindow::setInflationAmount(double amount, bool preview) {
+  if (selectedLayers.empty()) {
+    defaultInflationAmount = amount;
+  } else {
+    for (int layerId : selectedLayers)
+      regionInflationAmount[layers[layerId]] = amount;
+  }
+  if (manipulationMode.isGeometryModeActive()) {
+    reconstructInGeometryMode(preview);
+  }
+}
+
+double MainWindow::getInflationAmount() {
+  if (!selectedLayers.empty()) {
+    auto it = regionInflationAmount.find(layers[*selectedLayers.begin()]);
+    if (it != regionInflationAmount.end()) return it->second;
+  }
+  return defaultInflationAmount;
+}
+
+std::string MainWindow::getReconstructionStats() {
+  if (!defData.recResult) return RecStats().toJSON();
+  return defData.recResult->stats.toJSON();
+}
+
+std::string MainWindow::getMemoryStats() {
+  MemoryStats stats = ::getMemoryStats();
+  stats.reclaimable += animCache.getBytes();
+  return stats.toJSON();
+}
+
+void MainWindow::reconstructInGeometryMode(bool preview) {
+  // the control points are kept as when switching modes
+  saveControlPointsToBinary(savedCPs, cpData, defData, imgData);
+  if (preview) {
+    // the full resolution result would be outdated
+    recTask.cancel();
+    finishDeformation();
+    performReconstructionPreview(recData, defData, cpData, imgData);
+    cpHistory.clear();
+  } else {
+    progressMessage = "Reconstruction running";
+    finishDeformation();
+    recTask.start(recData, imgData, defData, cpData);
+  }
+  repaint = true;
+}
+
+void MainWindow::applyAsyncReconstruction() {
+  // the result replaces defData including the mesh being deformed
+  if (recTask.hasResult()) finishDeformation();
+  bool success;
+  if (!recTask.poll(defData, cpData, success)) return;
+  if (success) cpHistory.clear();
+  progressMessage = success ? "" : "Reconstruction failed";
+  repaint = true;
+  if (!modeChangePending) return;
+
+  // finish the switch to geometry mode
+  modeChangePending = false;
+  if (success) {
+    modeChangeReconstructed = true;
+    changeManipulationMode(pendingManipulationMode);
+  } else {
+    changeManipulationMode(DRAW_OUTLINE);
+    progressMessage = "Reconstruction failed";
+#ifdef __EMSCRIPTEN__
+    MAIN_THREAD_ASYNC_EM_ASM(js_reconstructionFailed(););
+#endif
+  }
+}
+
+void MainWindow::cancelPendingModeChange() {
+  if (!modeChangePending) return;
+  modeChangePending = false;
+  recTask.cancel();
+  progressMessage = "";
+#ifdef __EMSCRIPTEN__
+  MAIN_THREAD_ASYNC_EM_ASM(js_reconstructionFinished(););
+#endif
+}
+
 void MainWindow::enableNormalSmoothing(bool enabled) {
   shadingOpts.useNormalSmoothing = enabled;
   repaint = true;
@@ -2359,6 +3754,15 @@ bool MainWindow::isNormalSmoothingEnabled() {
   return shadingOpts.useNormalSmoothing;
 }
 
+void MainWindow::enableImplicitNormalSmoothing(bool enabled) {
+  shadingOpts.implicitNormalSmoothing = enabled;
+  repaint = true;
+}
+
+bool MainWindow::isImplicitNormalSmoothingEnabled() {
+  return shadingOpts.implicitNormalSmoothing;
+}
+
 void MainWindow::exportTextureTemplate(const std::string &fn) {
   const Imguc &Io = mergedOutlinesImg;
   Imguc I;
@@ -2408,6 +3812,17 @@ void MainWindow::resumeAll(PauseStatus &status) {
 void MainWindow::exportAsOBJ(const std::string &outDir,
                              const std::string &outFnWithoutExtension,
                              bool saveTexture) {
+  const bool textured = !templateImg.isNull() && saveTexture;
+  writeFrameOBJ(outDir + "/" + outFnWithoutExtension + ".obj",
+                textured ? outFnWithoutExtension : "");
+  if (textured) writeOBJMaterial(outDir, outFnWithoutExtension);
+}
+
+void MainWindow::writeFrameOBJ(const std::string &objFn,
+                               const std::string &materialName) {
+  // not computed while a level of detail or the morph playback is drawn
+  syncMorphedVertices();
+  computeNormals(shadingOpts.useNormalSmoothing);
   MatrixXd V = defData.VCurr;
   MatrixXd N = defData.normals;
   V *= 10.0 / viewportW;
@@ -2417,82 +3832,95 @@ void MainWindow::exportAsOBJ(const std::string &outDir,
   V.rowwise() += RowVector3d(-5, 5, 0);
 
   MatrixXd textureCoords;
-  if (!templateImg.isNull() && saveTexture) {
-    textureCoords = (defData.VRestOrig.array().rowwise() /
-                     Array3d(templateImg.w, -templateImg.h, 1).transpose());
-  }
-  string objFn = outDir + "/" + outFnWithoutExtension + ".obj";
-  writeOBJ(objFn, V, defData.Faces, N, defData.Faces, textureCoords,
-           defData.Faces);
-  if (!templateImg.isNull() && saveTexture) {
-    // Write material to the beginning of the exported file.
-    {
-      ostringstream objContent;
-      ifstream istr(objFn);
-      objContent << istr.rdbuf();
-      istr.close();
-
-      ofstream stream(objFn, ofstream::out);
-      if (stream.is_open()) {
-        stream << "s 1" << endl;
-        stream << "mtllib " << outFnWithoutExtension << ".mtl" << endl;
-        stream << "usemtl Textured" << endl;
-        stream << objContent.str();
-        stream.close();
-      }
-    }
-    {
-      ofstream stream(outDir + "/" + outFnWithoutExtension + ".mtl");
-      if (stream.is_open()) {
-        stream << "newmtl Textured\nKa 1.000 1.000 1.000\nKd 1.000 1.000 "
-                  "1.000\nKs 0.000 0.000 0.000\nNs 10.000\nd 1.0\nTr "
-                  "0.0\nillum 2\nmap_Ka "
-               << outFnWithoutExtension << ".png"
-               << "\nmap_Kd " << outFnWithoutExtension << ".png" << endl;
-        stream.close();
-      }
-    }
-    templateImg.savePNG(outDir + "/" + outFnWithoutExtension + ".png");
+  string header;
+  if (!materialName.empty()) {
+    textureCoords = updateTextureCoords().leftCols(2);
+    textureCoords.col(1) *= -1;
+    header = "s 1\nmtllib " + materialName + ".mtl\nusemtl Textured\n";
+  }
+  if (!writeMeshOBJ(objFn, V, mesh.F, N, textureCoords, header,
+                    &getMainWorkerPool())) {
+    DEBUG_CMD_MM(cerr << "exportAsOBJ: cannot write " << objFn << endl;);
   }
 }
 
+void MainWindow::writeOBJMaterial(const std::string &outDir,
+                                  const std::string &name) {
+  ofstream stream(outDir + "/" + name + ".mtl");
+  if (stream.is_open()) {
+    stream << "newmtl Textured\nKa 1.000 1.000 1.000\nKd 1.000 1.000 "
+              "1.000\nKs 0.000 0.000 0.000\nNs 10.000\nd 1.0\nTr "
+              "0.0\nillum 2\nmap_Ka "
+           << name << ".png"
+           << "\nmap_Kd " << name << ".png" << endl;
+    stream.close();
+  }
+  templatePNG.save(textureImage(), outDir + "/" + name + ".png");
+}
+
 void MainWindow::exportAnimationStart(int preroll, bool solveForZ,
                                       bool perFrameNormals) {
-  const int nFrames = cpAnimSync.getLength();
   manualTimepoint = true;
-  if (nFrames > 0) {
-    cpAnimSync.lastT = (100 * nFrames - preroll) % nFrames;
-  }
   cpData.playAnimation = true;
-  defEng.solveForZ = solveForZ;  // resume z-deformation
-  defPaused = false;
+  defPaused = true;  // frames are deformed by animSolver
+  finishDeformation();
+  qualityGovernor.reset();
+  applyQuality();
 
+  exportEncoder.finish();
   if (gltfExporter != nullptr) delete gltfExporter;
   gltfExporter = new exportgltf::ExportGltf;
-  exportAnimationWaitForBeginning = true;
-  exportAnimationPreroll = preroll;
+  gltfExporter->quantize = exportQuantized;
+  gltfExporter->compress = exportCompressed;
+  gltfExporter->keyframeTolerance = exportKeyframeTolerance;
+  gltfExporter->textureCache = &templatePNG;
   exportPerFrameNormals = perFrameNormals;
   exportedFrames = 0;
 
+  animSolver.reset(new AnimationSolver(cpData, defData, &activeDefEng()));
+  if (animCacheEnabled) {
+    animSolver->lookupFrame = [this](Mesh3D &mesh) {
+      if (!animCacheActive()) return false;
+      int nFrames = 0;
+      const int frame = animCacheFrame(nFrames);
+      animCache.validate(animCacheSignature(), nFrames, mesh.VRest.rows());
+      return animCache.get(frame, mesh.VCurr);
+    };
+    animSolver->storeFrame = [this](const Mesh3D &mesh) {
+      if (!animCacheActive()) return;
+      int nFrames = 0;
+      animCache.put(animCacheFrame(nFrames), mesh.VCurr);
+    };
+  }
+  animSolver->frameCallback = [this](int frame, const Mesh3D &mesh) {
+    exportAnimationWriteFrame();
+  };
+  animSolver->start(preroll, solveForZ);
+
   repaint = true;
 
   DEBUG_CMD_MM(cout << "exportAnimationStart" << endl;);
 }
 
 void MainWindow::exportAnimationStop(bool exportModel) {
+  animSolver.reset();
   manualTimepoint = false;
   defEng.solveForZ = false;  // pause z-deformation
   cpData.playAnimation = false;
   defPaused = true;
 
+  exportEncoder.finish();
   if (gltfExporter != nullptr) {
     if (exportModel) {
-      gltfExporter->exportStop("/tmp/mm_project.glb", true);
+      // the GLB is written on a worker, see applyAsyncExport()
 #ifdef __EMSCRIPTEN__
-      EM_ASM(js_exportAnimationFinished(););
+      exportTask.start(gltfExporter);
+#else
+      exportTask.start(gltfExporter, "/tmp/mm_project.glb", true);
 #endif
+    } else {
+      delete gltfExporter;
     }
-    delete gltfExporter;
     gltfExporter = nullptr;
   }
 
@@ -2501,95 +3929,244 @@ void MainWindow::exportAnimationStop(bool exportModel) {
   DEBUG_CMD_MM(cout << "exportAnimationStop" << endl;);
 }
 
+bool MainWindow::captureVideoStart(const std::string &fnPrefix, int preroll) {
+  if (exportAnimationRunning() || captureVideoRunning()) return false;
+  if (!frameCapture.init(viewportW, viewportH)) return false;
+  manualTimepoint = true;
+  cpData.playAnimation = true;
+  defPaused = true;  // frames are deformed by captureSolver
+  finishDeformation();
+  qualityGovernor.reset();
+  applyQuality();
+
+  captureWriter.start(fnPrefix);
+  capturedFrames = 0;
+  captureSolver.reset(new AnimationSolver(cpData, defData, &activeDefEng()));
+  captureSolver->frameCallback = [this](int frame, const Mesh3D &mesh) {
+    captureVideoWriteFrame();
+  };
+  captureSolver->start(preroll, defEng.solveForZ);
+  repaint = true;
+
+  DEBUG_CMD_MM(cout << "captureVideoStart " << fnPrefix << endl;);
+  return true;
+}
+
+void MainWindow::captureVideoStop() {
+  if (!captureSolver) return;
+  captureSolver.reset();
+  Imguc image;
+  if (frameCapture.readLastFrame(image))
+    captureWriter.push(std::move(image), capturedFrames - 1);
+  frameCapture.destroy();
+  captureWriter.finish();
+  manualTimepoint = false;
+  cpData.playAnimation = false;
+  defPaused = true;
+  repaint = true;
+
+  DEBUG_CMD_MM(cout << "captureVideoStop: " << capturedFrames << " frames, "
+                    << captureWriter.getNumFailed() << " failed" << endl;);
+}
+
+bool MainWindow::captureVideoRunning() { return captureSolver != nullptr; }
+
+void MainWindow::captureVideoFrame() {
+  TRACE_SCOPE("captureVideoFrame");
+  // as many frames as fit into the time budget, the readback of a frame
+  // happens while the next one is drawn and the writer compresses them on
+  // its thread
+  captureSolver->stepFor(exportAnimationTimeBudgetMs);
+  if (captureSolver->isDone()) {
+    captureVideoStop();
+    return;
+  }
+  repaint = true;
+}
+
+void MainWindow::captureVideoWriteFrame() {
+  defData.VCurr = mesh.VCurr;
+  defData.meshVersion++;
+  computeNormals(shadingOpts.useNormalSmoothing);
+
+  initOpenGL();
+  frameCapture.beginFrame(bgColor(0) / 255.0f, bgColor(1) / 255.0f,
+                          bgColor(2) / 255.0f, 1);
+  drawModelOpenGL(defData.VCurr, mesh.VRest, mesh.F, defData.normals);
+  Imguc image;
+  if (frameCapture.endFrame(image))
+    captureWriter.push(std::move(image), capturedFrames - 1);
+  capturedFrames++;
+}
+
+void MainWindow::applyAsyncExport() {
+  if (!exportTask.poll()) return;
+  // the solver and the encoder are gone, only the exported model is kept
+  sampleMemoryPeak();
+  releaseFreeMemory();
+#ifdef __EMSCRIPTEN__
+  MAIN_THREAD_ASYNC_EM_ASM(js_exportAnimationFinished(););
+#endif
+  repaint = true;
+}
+
 void MainWindow::exportAnimationFrame() {
-  if (gltfExporter == nullptr) {
+  TRACE_SCOPE("exportAnimationFrame");
+  if (gltfExporter == nullptr || !animSolver) {
     DEBUG_CMD_MM(cerr << "exportAnimationFrame: gltfModel == nullptr" << endl;);
     return;
   }
 
+  // solve as many frames as fit into the time budget, then return to the
+  // main loop to keep the UI responsive
+  animSolver->stepFor(exportAnimationTimeBudgetMs);
+
+#ifdef __EMSCRIPTEN__
+  // update progress bar
+  const int progress = round(100.0 * animSolver->getProgress());
+  MAIN_THREAD_ASYNC_EM_ASM({ js_exportAnimationProgress($0); }, progress);
+#endif
+
+  if (animSolver->isDone()) {
+    // reached the end of animation
+    exportAnimationStop();
+    return;
+  }
+
+  repaint = true;
+}
+
+void MainWindow::exportAnimationWriteFrame() {
+  defData.VCurr = mesh.VCurr;
+  defData.meshVersion++;
+  computeNormals(shadingOpts.useNormalSmoothing);
+
+  DEBUG_CMD_MM(cout << "exportAnimationFrame: " << exportedFrames << endl;);
+  updateInterleavedVertices();
+  exportgltf::MatrixXfR V = VCurrInterleaved;
+  V *= 10.0 / viewportW;
+  V.array().rowwise() *= RowVector3f(1, -1, -1).array();
+  V.rowwise() += RowVector3f(-5, 5, 0);
+
   const int nFrames = cpAnimSync.getLength();
-  bool exportSingleFrame = nFrames == 0;
-
-  int prerollCurr = 0;
-  if (!exportSingleFrame) {
-    const int prerollStart = (100 * nFrames - exportAnimationPreroll) % nFrames;
-    prerollCurr = static_cast<int>(cpAnimSync.lastT) - prerollStart;
-    if (exportAnimationWaitForBeginning) {
-      if (prerollCurr >= exportAnimationPreroll) {
-        exportAnimationWaitForBeginning = false;
-      } else {
-        DEBUG_CMD_MM(cout << "exportAnimationFrame: waiting for beginning ("
-                          << cpAnimSync.lastT << ")" << endl;);
-      }
+  const bool hasTexture = !templateImg.isNull();
+
+  exportgltf::MatrixXfR N;
+  if (exportedFrames == 0 || exportPerFrameNormals) {
+    N = normalsInterleaved;
+    N.array().rowwise() *= RowVector3f(1, -1, -1).array();
+  }
+  if (exportedFrames == 0) {
+    exportBaseV = V;
+    exportBaseN = N;
+    exportgltf::MatrixXuiR F = mesh.F.cast<unsigned int>();
+
+    exportgltf::MatrixXfR TC;
+    if (hasTexture) {
+      TC = updateTextureCoords().leftCols(2).cast<float>();
     }
-  } else {
-    exportAnimationWaitForBeginning = false;
-  }
-
-  if (!exportAnimationWaitForBeginning) {
-    prerollCurr = exportAnimationPreroll;
-    DEBUG_CMD_MM(cout << "exportAnimationFrame: " << exportedFrames << endl;);
-    exportgltf::MatrixXfR V = defData.VCurr.cast<float>();
-    V *= 10.0 / viewportW;
-    V.array().rowwise() *= RowVector3f(1, -1, -1).array();
-    V.rowwise() += RowVector3f(-5, 5, 0);
-
-    const int nFrames = cpAnimSync.getLength();
-    const bool hasTexture = !templateImg.isNull();
-
-    exportgltf::MatrixXfR N;
-    if (exportedFrames == 0 || exportPerFrameNormals) {
-      N = defData.normals.cast<float>();
-      N.array().rowwise() *= RowVector3f(1, -1, -1).array();
-    }
-    if (exportedFrames == 0) {
-      exportBaseV = V;
-      exportBaseN = N;
-      exportgltf::MatrixXusR F = defData.Faces.cast<unsigned short>();
-
-      exportgltf::MatrixXfR TC;
-      if (hasTexture) {
-        TC = (defData.VRestOrig.leftCols(2).cast<float>().array().rowwise() /
-              Array2f(templateImg.w, templateImg.h).transpose());
+
+    // the joints are at the control points, bound to the first frame
+    MatrixXd jointPos;
+    if (exportSkinning) {
+      DefEngLBS lbs(true);
+      lbs.precompute(def, mesh);
+      const auto &cpVertices = lbs.getCPVertices();
+      jointPos.resize(cpVertices.size(), 3);
+      forlist(j, cpVertices) {
+        jointPos.row(j) = exportBaseV.row(cpVertices[j]).cast<double>();
       }
+      exportSkinFit.init(exportBaseV.cast<double>(), jointPos,
+                         lbs.getWeights());
+    }
+    gltfExporter->skinned = jointPos.rows() > 0;
+
+    gltfExporter->exportStart(V, N, F, TC, nFrames, exportPerFrameNormals, 24,
+                              hasTexture ? textureImage() : templateImg);
+    gltfExporter->exportFullModel(V, N, F, TC);
+    if (gltfExporter->skinned) {
+      MatrixXd rotations = MatrixXd::Zero(jointPos.rows(), 4);
+      rotations.col(3).setOnes();
+      gltfExporter->exportSkin(jointPos.cast<float>(),
+                               exportSkinFit.getJoints().cast<unsigned short>(),
+                               exportSkinFit.getWeights().cast<float>());
+      gltfExporter->exportJointPose(rotations.cast<float>(),
+                                    jointPos.cast<float>(), 0);
+    }
 
-      gltfExporter->exportStart(V, N, F, TC, nFrames, exportPerFrameNormals, 24,
-                                templateImg);
-      gltfExporter->exportFullModel(V, N, F, TC);
-    } else {
-      V -= exportBaseV;
-      if (exportPerFrameNormals) N -= exportBaseN;
-      gltfExporter->exportMorphTarget(V, N, exportedFrames);
+    // the deltas or the joint poses of the next frames are computed and
+    // encoded meanwhile the following frames are solved
+    exportgltf::ExportGltf *exporter = gltfExporter;
+    const bool perFrameNormals = exportPerFrameNormals;
+    exportEncoder.start([this, exporter, perFrameNormals](
+                            exportgltf::MatrixXfR &V, exportgltf::MatrixXfR &N,
+                            int frame) {
+      if (exporter->skinned) {
+        MatrixXd rotations, translations;
+        exportSkinFit.fit(V.cast<double>(), rotations, translations);
+        exporter->exportJointPose(rotations.cast<float>(),
+                                  translations.cast<float>(), frame);
+      } else {
+        V -= exportBaseV;
+        if (perFrameNormals) N -= exportBaseN;
+        exporter->exportMorphTarget(V, N, frame);
+      }
+    });
+  } else {
+    exportEncoder.push(move(V), move(N), exportedFrames);
+  }
+  if (exportOBJSequence) {
+    // the frames share the material written with the first one
+    const string materialName = hasTexture ? "mm_frames" : "";
+    char fn[32];
+    snprintf(fn, sizeof(fn), "/tmp/mm_frame_%04d.obj", exportedFrames);
+    writeFrameOBJ(fn, materialName);
+    if (hasTexture && exportedFrames == 0) {
+      writeOBJMaterial("/tmp", materialName);
     }
-    exportedFrames++;
   }
+  exportedFrames++;
+}
 
-  // update progress bar
-  int progress = 100;
-  if (!exportSingleFrame) {
-    progress = round(100.0 * (prerollCurr + exportedFrames) /
-                     (nFrames + exportAnimationPreroll));
-  }
-#ifdef __EMSCRIPTEN__
-  EM_ASM({ js_exportAnimationProgress($0); }, progress);
-#endif
+bool MainWindow::exportAnimationRunning() { return gltfExporter != nullptr; }
+
+const std::vector<unsigned char> &MainWindow::getExportedModel() {
+  exportTask.wait();
+  return exportTask.data();
+}
 
-  cpAnimSync.lastT++;
-  if (cpAnimSync.lastT >= 100 * nFrames) cpAnimSync.lastT = 0;
+void MainWindow::releaseExportedModel() {
+  exportTask.wait();
+  vector<unsigned char>().swap(exportTask.data());
+}
 
-  if (!exportAnimationWaitForBeginning) {
-    if (exportSingleFrame ||
-        (nFrames > 0 && (static_cast<int>(cpAnimSync.lastT) % nFrames == 0))) {
-      // reached the end of animation
-      exportAnimationStop();
-      return;
-    }
-  }
+void MainWindow::setExportSkinning(bool enabled) { exportSkinning = enabled; }
 
-  repaint = true;
+bool MainWindow::getExportSkinning() { return exportSkinning; }
+
+void MainWindow::setExportQuantized(bool enabled) { exportQuantized = enabled; }
+
+bool MainWindow::getExportQuantized() { return exportQuantized; }
+
+void MainWindow::setExportCompressed(bool enabled) {
+  exportCompressed = enabled;
 }
 
-bool MainWindow::exportAnimationRunning() { return gltfExporter != nullptr; }
+bool MainWindow::getExportCompressed() { return exportCompressed; }
+
+void MainWindow::setExportKeyframeTolerance(float tolerance) {
+  exportKeyframeTolerance = max(tolerance, 0.f);
+}
+
+float MainWindow::getExportKeyframeTolerance() {
+  return exportKeyframeTolerance;
+}
+
+void MainWindow::setExportOBJSequence(bool enabled) {
+  exportOBJSequence = enabled;
+}
+
+bool MainWindow::getExportOBJSequence() { return exportOBJSequence; }
 
 void MainWindow::pauseAnimation() { pauseAll(animStatus); }
 void MainWindow::resumeAnimation() { resumeAll(animStatus); }
@@ -2598,6 +4175,7 @@ int MainWindow::getNumberOfAnimationFrames() { return cpAnimSync.getLength(); }
 
 void MainWindow::moveSelectedLayersInDepth(int step, bool overlapping) {
   if (selectedLayer == -1 || step == 0) return;
+  drawingHistory.begin(imgData);
 
   // Find overlaps of each selected layer with other non-selected layers and
   // create an overlap matrix (first column is a flag denoting whether a layer
@@ -2605,26 +4183,23 @@ void MainWindow::moveSelectedLayersInDepth(int step, bool overlapping) {
   MatrixXi OM(layers.size(), layers.size() + 1);
   OM.fill(0);  // Empty values are 0.
   if (overlapping) {
-    // Find overlapping layers.
+    // Find overlapping layers. The regions are packed to bit masks once, the
+    // overlap of a pair is then a word-wise AND.
+    vector<BitMask> masks(layers.size());
+    getMainWorkerPool().parallelFor(layers.size(), 1, [&](int begin, int end) {
+      fora(layerId, begin, end) {
+        masks[layerId] = BitMask::fromImage(regionImgs[layers[layerId]], 0,
+                                            false);
+      }
+    });
     for (const int selLayerId : selectedLayers) {
       OM(selLayerId, 0) = 1;
-      const Imguc &ISel = regionImgs[layers[selLayerId]];
       forlist(layerId, layers) {
         // Skip selected layers.
         if (selectedLayers.find(layerId) != selectedLayers.end()) continue;
         // Check overlap.
-        const int regId = layers[layerId];
-        const Imguc &I = regionImgs[regId];
-        bool exit = false;
-        fora(y, 0, ISel.h) {
-          fora(x, 0, ISel.w) {
-            if (ISel(x, y, 0) == 0 || I(x, y, 0) == 0) continue;
-            // Regions are overlapping.
-            OM(layerId, selLayerId + 1) = 1;
-            exit = true;
-            break;
-          }
-          if (exit) break;
+        if (masks[selLayerId].intersects(masks[layerId])) {
+          OM(layerId, selLayerId + 1) = 1;
         }
       }
     }
@@ -2689,7 +4264,39 @@ void MainWindow::moveSelectedLayersInDepth(int step, bool overlapping) {
   fora(i, 0, OM.rows()) {
     if (OM(i, 0)) selectedLayers.insert(i);
   }
+  drawingHistory.commit(imgData);
+  recreateMergedImgs();
+}
+
+bool MainWindow::undoDrawing() { return applyDrawingHistory(false); }
+
+bool MainWindow::redoDrawing() { return applyDrawingHistory(true); }
+
+bool MainWindow::undoControlPoints() { return applyCPHistory(false); }
+
+bool MainWindow::redoControlPoints() { return applyCPHistory(true); }
+
+bool MainWindow::applyCPHistory(bool redo) {
+  if (manipulationMode.mode != ANIMATE_MODE || cpData.recordCP) return false;
+  const bool applied =
+      redo ? cpHistory.redo(def, cpData) : cpHistory.undo(def, cpData);
+  if (!applied) return false;
+  repaint = true;
+  return true;
+}
+
+bool MainWindow::applyDrawingHistory(bool redo) {
+  if (!manipulationMode.isImageModeActive()) return false;
+  vector<int> regIds;
+  const bool applied = redo ? drawingHistory.redo(imgData, regIds)
+                            : drawingHistory.undo(imgData, regIds);
+  if (!applied) return false;
+  for (int regId : regIds) autosaveJournal.markLayerModified(regId);
+  selectedLayer = -1;
+  selectedLayers.clear();
   recreateMergedImgs();
+  repaint = true;
+  return true;
 }
 
 int MainWindow::getNumberOfLayers() { return layers.size(); }
@@ -15,9 +15,63 @@
 #ifndef MAINWINDOW_H
 #define MAINWINDOW_H
 
+#include <miscutils/opengltools.h>
+
+#include <chrono>
+
+#include "animcache.h"
+#include "animclock.h"
+#include "animsolver.h"
+#include "asyncdeformation.h"
+#include "asyncexport.h"
 #include "commonStructs.h"
+#include "cphistory.h"
+#include "cpinput.h"
+#include "drawinghistory.h"
+#include "def3dsdl.h"
 #include "exportgltf.h"
+#include "frameprofiler.h"
+#include "gloverlay.h"
+#include "glcapture.h"
+#include "glmorph.h"
+#include "glpicker.h"
 #include "mywindow.h"
+#include "pngcache.h"
+#include "projectjournal.h"
+#include "qualitygovernor.h"
+#include "reconstruction.h"
+#include "scene.h"
+#include "skinfit.h"
+#include "textureatlas.h"
+#include "vertexnormals.h"
+
+struct GLData {
+  GLMeshData meshData;
+  GLuint shaderMatcap, shaderTexture;
+  // uniform locations of the shaders, looked up once in initOpenGL()
+  GLCameraUniforms matcapUniforms, textureUniforms;
+  GLint textureTexLocation = -1, textureUseShadingLocation = -1;
+  std::vector<GLuint> textureNames;
+  GLuint templateImgTexName, textureImgTexName[4];
+  GLuint backgroundImgTexName;
+  // camera matrices and the inverse transpose of M for the normals, rebuilt
+  // in drawGeometryMode only when the camera changes
+  Eigen::MatrixXd P, M, normalMatrix;
+  // versions of the mesh and its normals in meshData (see DefData)
+  std::uint64_t uploadedMeshVersion = UINT64_MAX;
+  std::uint64_t uploadedNormalsVersion = UINT64_MAX;
+  // the level of detail drawn instead of meshData when the model is small
+  // on the screen, with its version of the mesh and the index of the level
+  GLMeshData lodMeshData;
+  std::uint64_t uploadedLODMeshVersion = UINT64_MAX;
+  int uploadedLOD = -1;
+  // the characters of the scene merged into one mesh and its version
+  GLMeshData sceneMeshData;
+  std::uint64_t uploadedSceneVersion = UINT64_MAX;
+  // program used by drawModelOpenGL() in this frame, 0 if none, the scene
+  // reuses its state if it is the matcap one
+  GLuint boundShader = 0;
+};
 
 class MainWindow : public MyWindow {
  public:
@@ -28,6 +82,12 @@ class MainWindow : public MyWindow {
   void selectAll();
   bool copySelectedAnim();
   bool pasteSelectedAnim();
+  // layers of the animation of the selected CP, changes apply to all
+  // selected CPs that have the layer
+  int getSelectedAnimNumLayers();
+  void setSelectedAnimLayerWeight(int layer, float weight);
+  void removeSelectedAnimLayer(int layer);
+  void flattenSelectedAnimLayers();
   void loadTemplateImageFromFile(bool scale = true);
   void setTemplateImageVisibility(bool visible);
   bool getTemplateImageVisibility();
@@ -39,9 +99,70 @@ class MainWindow : public MyWindow {
   bool isTextureShadingEnabled();
   void setCPsVisibility(bool visible);
   bool getCPsVisibility();
+  void setPlaybackSkinning(bool enabled);
+  bool getPlaybackSkinning();
+  void setAnimCacheEnabled(bool enabled);
+  bool getAnimCacheEnabled();
+  // threads of the libigl and Eigen loops, 0 for the default of the platform
+  void setLibraryNumThreads(int numThreads);
+  int getLibraryNumThreads();
+  // Switches to a preset of the reconstruction, deformation, shading and
+  // export settings (PerfProfile), saved with the project. The model is
+  // reconstructed again in the geometry modes.
+  void setPerformanceProfile(int profile);
+  int getPerformanceProfile();
+  // renders the model with the CPU rasterizer instead of OpenGL
+  void setSoftwareRendering(bool enabled);
+  bool getSoftwareRendering();
+  void setGPUPicking(bool enabled);
+  bool getGPUPicking();
+  // draws a coarser level of the mesh (see DefData::meshLODs) when its
+  // triangles are small on the screen, computing the normals only for it
+  void setMeshLOD(bool enabled);
+  bool getMeshLOD();
+  // plays a completely cached animation (see setAnimCacheEnabled()) on the
+  // GPU by blending the uploaded frames in the vertex shader
+  void setMorphPlayback(bool enabled);
+  bool getMorphPlayback();
+  // draws and exports the template image packed to an atlas of the islands
+  // of the mesh (see buildTextureAtlas()) instead of the whole canvas
+  void setTextureAtlas(bool enabled);
+  bool getTextureAtlas();
+  // Adds the project zipFn as a character of the scene moved by offset, it
+  // is animated along the timeline of the edited model and drawn with it.
+  // Returns its index or -1 if the project could not be loaded.
+  int addSceneCharacter(const std::string &zipFn,
+                        const Eigen::Vector3d &offset);
+  void clearScene();
+  // deforms on a worker thread and displays the latest finished result
+  void setAsyncDeformation(bool enabled);
+  bool getAsyncDeformation();
+  // Hides the latency of the asynchronous deformation while dragging: the
+  // deformation is started for the CP positions extrapolated by the time it
+  // took last, and until it finishes its last result is shown moved by a
+  // linear blend of the CP translations since.
+  void setLatencyHiding(bool enabled);
+  bool getLatencyHiding();
   ManipulationMode openProject(const std::string &zipFn,
                                bool changeMode = true);
+  // Adds the template and the background image of the project zipFn opened
+  // without them, those imported since it was opened are kept. Used for
+  // the examples, whose images are downloaded after the project is shown.
+  void loadProjectImages(const std::string &zipFn);
   void saveProject(const std::string &zipFn);
+  // Saves the project to fn.zip and records the input handled from now on
+  // to the session fn, replaySession() opens the project and replays the
+  // input on it (see MyWindow::replay()).
+  bool startSessionRecording(const std::string &fn);
+  void stopSessionRecording();
+  bool replaySession(const std::string &fn, const std::string &reportFn);
+  // Appends the changes of the project to the journal /tmp/mm_autosave.bin
+  // (see ProjectJournal) every given seconds, 0 disables it. Saving the
+  // project compacts the journal.
+  void setAutosaveInterval(double seconds);
+  double getAutosaveInterval();
+  // opens the project from the autosave journal
+  ManipulationMode recoverAutosave(bool changeMode = true);
   AnimMode getAnimRecMode();
   bool isAnimationPlaying();
   ManipulationMode &getManipulationMode();
@@ -53,9 +174,41 @@ class MainWindow : public MyWindow {
   void reset();
   void recomputeCameraCenter();
   void enableArmpitsStitching(bool enabled = true);
+  // inflation of the selected regions (or the default one if none is
+  // selected), preview is for intermediate values while it is being changed
+  void setInflationAmount(double amount, bool preview = false);
+  double getInflationAmount();
+  // per-stage profile of the last reconstruction as JSON (see RecStats)
+  std::string getReconstructionStats();
+  // memory in use, its peak, the size of the heap and how much of it could
+  // be reused (free or held by the animation cache) as JSON (see MemoryStats)
+  std::string getMemoryStats();
+  // timings of the last frames, see FrameProfiler::toJSON()
+  std::string getFrameProfile();
+  // heap allocations per subsystem since the start, see allocStatsToJSON()
+  std::string getAllocStats();
+  // shows the timings of the last frames as a graph
+  void setFrameProfileVisibility(bool visible);
+  bool getFrameProfileVisibility();
+  // Lowers the deformation iterations, the normal smoothing and the texture
+  // shading of the interactive frames while they take longer than the frame
+  // budget, stills, pauses and exports get the full quality (see
+  // QualityGovernor).
+  void enableAdaptiveQuality(bool enabled = true);
+  bool isAdaptiveQualityEnabled();
+  void setFrameBudget(double ms);
+  double getFrameBudget();
+  // Records trace events (see tracing.h) while enabled, the native build
+  // writes them to /tmp/mm_trace.json when disabled.
+  void setTracing(bool enabled);
+  bool getTracing();
+  // the events recorded by the last tracing in the Chrome trace-event format
+  std::string getTrace();
   bool isArmpitsStitchingEnabled();
   void enableNormalSmoothing(bool enabled = true);
   bool isNormalSmoothingEnabled();
+  void enableImplicitNormalSmoothing(bool enabled = true);
+  bool isImplicitNormalSmoothingEnabled();
   void exportTextureTemplate(const std::string &fn);
   void enableMiddleMouseSimulation(bool enabled = true);
   bool isMiddleMouseSimulationEnabled();
@@ -64,15 +217,68 @@ class MainWindow : public MyWindow {
                    const std::string &outFnWithoutExtension, bool saveTexture);
   int getNumberOfLayers();
   void moveSelectedLayersInDepth(int step, bool overlapping);
+  // undo and redo of the edits of the layers (image modes only)
+  bool undoDrawing();
+  bool redoDrawing();
+  // undo and redo of the edits of the control points and their animations
+  // (ANIMATE_MODE only)
+  bool undoControlPoints();
+  bool redoControlPoints();
 
   // animation
   void offsetSelectedCpAnimsByFrames(double offset);
+  // offset in percent of the length of each animation
   void offsetSelectedCpAnimsByPercentage(double offset);
+  // resamples the animations of the selected CPs (all if selectedOnly is
+  // false) to the given number of keyposes, length 0 means the length of
+  // the sync animation
+  void resampleCpAnims(int length, bool selectedOnly);
   void setAnimRecMode(AnimMode animMode);
+  // Positions of CPs streamed from an external device, may be called from
+  // one thread other than the main one. Returns false if the sample was
+  // dropped because the main loop did not keep up.
+  bool pushCPInput(int cpId, double x, double y, double z, double seconds);
+  // records the streamed CPs at the rate of their samples
+  void setCPInputRecording(bool active);
   void exportAnimationStart(int preroll, bool solveForZ, bool perFrameNormals);
   void exportAnimationStop(bool exportModel = true);
+  // Renders every frame of the animation, solved the same way as for the
+  // export, offscreen at the size of the viewport and writes them to the PNG
+  // sequence fnPrefix00000.png, fnPrefix00001.png, ... at
+  // CPAnim::keyposesPerSecond. Returns false if an export or capture is
+  // running or the framebuffers are not supported.
+  bool captureVideoStart(const std::string &fnPrefix, int preroll = 0);
+  void captureVideoStop();
+  bool captureVideoRunning();
+  // exports the animation as a skin with a joint per control point instead
+  // of morph targets
+  void setExportSkinning(bool enabled);
+  bool getExportSkinning();
+  // writes quantized attributes (KHR_mesh_quantization) for smaller files
+  void setExportQuantized(bool enabled);
+  bool getExportQuantized();
+  // compresses the exported buffers with EXT_meshopt_compression
+  void setExportCompressed(bool enabled);
+  bool getExportCompressed();
+  // also writes the frames of the exported animation as OBJ files
+  // (/tmp/mm_frame_0000.obj, ...) sharing the material mm_frames.mtl
+  void setExportOBJSequence(bool enabled);
+  bool getExportOBJSequence();
+  // drops the frames within tolerance (in model units) of the interpolation
+  // of their neighbours from the exported morph targets, 0 keeps all
+  void setExportKeyframeTolerance(float tolerance);
+  float getExportKeyframeTolerance();
   void exportAnimationFrame();
+  void exportAnimationWriteFrame();
+  void captureVideoFrame();
+  void captureVideoWriteFrame();
   bool exportAnimationRunning();
+  // The browser build keeps the GLB of a finished export in memory for the
+  // page to read it without a copy in the file system, the native build
+  // writes /tmp/mm_project.glb. The data are valid until the next export or
+  // releaseExportedModel().
+  const std::vector<unsigned char> &getExportedModel();
+  void releaseExportedModel();
   void pauseAnimation();
   void resumeAnimation();
   int getNumberOfAnimationFrames();
@@ -91,22 +297,70 @@ class MainWindow : public MyWindow {
   virtual void keyPressEvent(const MyKeyEvent &event);
 
  private:
+  // creates the OpenGL state on the first call
   void initOpenGL();
   void destroyOpenGL();
+  // texture of the matcap i, uploaded on its first use
+  GLuint matcapTexture(int i);
   void drawModelOpenGL(Eigen::MatrixXd &V, Eigen::MatrixXd &Vr,
                        Eigen::MatrixXi &F, Eigen::MatrixXd &N);
   void pauseOrResumeZDeformation(bool pause);
+  DefEng &activeDefEng();
+  bool purePlayback();
+  bool playbackSkinningActive();
+  bool animCacheActive();
+  bool morphPlaybackActive();
+  // sets the mesh to the frame drawn by glMorph, the CPU side is not
+  // updated during the morph playback
+  void syncMorphedVertices();
+  std::uint64_t animCacheSignature();
+  int animCacheFrame(int &nFrames);
+  void selectNextDefEng();
   double handleDeformations();
+  double handleDeformationsAsync(DefEng &eng, const Def3D &def);
+  // waits for defTask, needed before touching the mesh or the engines
+  void finishDeformation();
+  void updateDeformationPreview(const Def3D &def);
   void startModeTransition(const ManipulationMode &prevMode,
                            const ManipulationMode &currMode);
   bool drawModeTransition(MyPainter &painter, MyPainter &painterOther);
   void computeNormals(bool smoothing);
+  // feeds the last frame to qualityGovernor
+  void updateQuality();
+  // sets quality and the deformation engine from the governor's levels
+  void applyQuality();
+  // the settings of recData.perfProfile kept outside of the project settings
+  void applyPerformanceProfile();
+  // converts the mesh and the normals to VCurrInterleaved and
+  // normalsInterleaved if they changed since the last call
+  void updateInterleavedVertices();
+  // texture coordinates of the rest pose in the template image, see
+  // textureCoords
+  const Eigen::MatrixXd &updateTextureCoords();
+  // the image sampled with updateTextureCoords()
+  const Imguc &textureImage();
+  void loadTemplateTexture();
   void drawGeometryMode(MyPainter &painterModel, MyPainter &painterOther);
   void rotateViewportIncrement(double rotHorInc, double rotVerInc);
+  // picking structure of the current mesh and view (see MeshPicker)
+  const MeshPicker &getMeshPicker();
+  // Def3D::addControlPointOnFace at [x,y] of the current mesh and view, picks
+  // with glPicker if gpuPicking is set
+  bool addControlPointOnFace(Def3D &def, double x, double y, double radius,
+                             bool reverse, int &index);
+  // replays and deforms the characters of the scene
+  void updateScene();
+  // all characters of the scene in one draw call with the matcap shader
+  void drawSceneOpenGL();
+  // draws defData.meshLODs[meshLODLevel] with the vertices of V
+  void drawMeshLODOpenGL(const Eigen::MatrixXd &V, const Eigen::MatrixXd &T,
+                         const Eigen::MatrixXi &PARTID);
   void drawModelSoftware(Eigen::MatrixXd &Vc, Eigen::MatrixXd &Vr,
                          Eigen::MatrixXi &F, Eigen::MatrixXd &N);
-  void cpVisualize2D(MyPainter &screenPainter);
+  // draws with overlay instead of screenPainter if it is given
+  void cpVisualize2D(MyPainter &screenPainter, GLOverlay *overlay = nullptr);
   void drawMessages(MyPainter &painter);
+  void drawFrameProfile(MyPainter &painter);
   int selectLayerUnderCoords(int x, int y, bool nearest);
   void handleMousePressEventImageMode(const MyMouseEvent &event);
   void handleMouseMoveEventImageMode(const MyMouseEvent &event);
@@ -121,6 +375,21 @@ class MainWindow : public MyWindow {
   void initImageLayers();
   void clearImgs();
   void recreateMergedImgs();
+  bool applyDrawingHistory(bool redo);
+  bool applyCPHistory(bool redo);
+  void reconstructInGeometryMode(bool preview);
+  void applyAsyncReconstruction();
+  void applyAsyncExport();
+  // the rest of opening a project loaded to the data
+  ManipulationMode applyOpenedProject(
+      const ManipulationMode &newManipulationMode, bool changeMode);
+  void autosave();
+  void writeAutosave();
+  // the current frame as OBJ using the material of materialName (none if
+  // empty) and the material with the template image as texture
+  void writeFrameOBJ(const std::string &objFn, const std::string &materialName);
+  void writeOBJMaterial(const std::string &outDir, const std::string &name);
+  void cancelPendingModeChange();
   void transformEnd(bool apply);
   void transformApply();
   void transformDiscard();
@@ -138,14 +407,33 @@ class MainWindow : public MyWindow {
 
   // animation
   void setRecordingCP(bool active);
+  void offsetSelectedCpAnims(double offset, bool percentage);
   void cpAnimationPlaybackAndRecord();
+  void processCPInput();
   void toggleAnimationSelectedPlayback();
   void toggleAutoSmoothAnim();
   bool removeCPAnims();
-  void visualizeCPAnimTrajectories2D(MyPainter &screenPainter);
+  void visualizeCPAnimTrajectories2D(MyPainter &screenPainter,
+                                     GLOverlay *overlay = nullptr);
 
+  bool glInitialized = false;
+  // targets of drawModelSoftware, allocated on its first use
   Img<float> depthBuffer;
   Imguc frameBuffer;
+  Imguc matcapImg;
+  bool softwareRendering = false;
+  bool gpuPicking = false;
+  bool meshLOD = true;
+  // largest error of a drawn level of detail in pixels and the level drawn
+  // in the last frame, -1 for the full mesh
+  double meshLODMaxPixels = 1.5;
+  int meshLODLevel = -1;
+  VertexNormals meshLODNormals;
+  Eigen::MatrixXd meshLODV, meshLODN, meshLODT;
+  // characters shown besides the edited model and their timepoint
+  Scene scene;
+  double sceneT = 0;
+  bool asyncDeformation = false;
   const int circleRadius = 2;
   const int minPressReleaseDurationMs = 200;
 
@@ -157,6 +445,12 @@ class MainWindow : public MyWindow {
   Cu paintColor = Cu{0, 0, 0, 255};
   const float defaultThickness = 3;
   int drawingUnderLayer = std::numeric_limits<int>::max();
+  // pixels of currOutlineImg drawn since it was cleared and the part of them
+  // already composited into mergedOutlinesImg
+  Eigen::AlignedBox2i strokeBox, strokeBoxMerged;
+  // end point and thickness of the last segment of the stroke
+  Eigen::Vector2i strokeEnd;
+  int strokeThickness = 0;
   bool rightMouseButtonSimulation2 = false;
   ;
   bool *rightMouseButtonSimulation = &rightMouseButtonSimulation2;
@@ -164,6 +458,11 @@ class MainWindow : public MyWindow {
   bool showSegmentation = false;
   std::string progressMessage = "";
   bool showMessages = true;
+  bool showFrameProfile = false;
+  FrameProfiler frameProfiler;
+  QualityGovernor qualityGovernor;
+  // the settings of the governor's levels in use
+  QualityGovernor::Settings quality;
   bool middleMouseSimulation = false;
   std::string datadirname = "../../data/";
   bool mousePressed = false;
@@ -179,13 +478,14 @@ class MainWindow : public MyWindow {
   float rotHorFrom, rotHorTo, rotVerFrom, rotVerTo;
 
   Imguc screenImg;
+  bool screenImgPainted = false;  // screenImg has to be cleared
 
   int viewportW;
   int viewportH;
 
   // image layers
   ImgData imgData;
-  std::deque<Imguc> &outlineImgs = imgData.outlineImgs,
+  std::deque<TiledImage> &outlineImgs = imgData.outlineImgs,
                     &regionImgs = imgData.regionImgs;
   std::deque<int> &layers = imgData.layers;
   Imguc &mergedOutlinesImg = imgData.mergedOutlinesImg;
@@ -199,6 +499,7 @@ class MainWindow : public MyWindow {
   int &selectedLayer = imgData.selectedLayer;
   std::set<int> &selectedLayers = imgData.selectedLayers;
   Imguc templateImg, backgroundImg;
+  PNGCache templatePNG;  // for the exports
 
   // deformation
   DefData defData;
@@ -231,6 +532,34 @@ class MainWindow : public MyWindow {
   bool &cpOptimizeForZ = recData.cpOptimizeForZ;
   bool &cpOptimizeForXY = recData.cpOptimizeForXY;
   bool &interiorDepthConditions = recData.interiorDepthConditions;
+  // full resolution reconstruction following previews or a mode change
+  AsyncReconstruction recTask;
+  // switch to geometry mode waiting for recTask
+  bool modeChangePending = false, modeChangeReconstructed = false;
+  ManipulationMode pendingManipulationMode = ManipulationMode(DRAW_OUTLINE);
+  // deformation running on a worker thread if asyncDeformation is set,
+  // started from defTaskPos of the control points of defTaskDef
+  AsyncDeformation defTask;
+  const Def3D *defTaskDef = nullptr;
+  long defTaskCPsChangedNum = 0;
+  std::vector<Eigen::Vector3d> defTaskPos;
+  double defTaskDiff = 0;
+  // latencyHiding: the CP positions when defTask was started, the time
+  // and the duration of its last run
+  bool latencyHiding = false;
+  std::vector<Eigen::Vector3d> defTaskInputPos;
+  std::chrono::steady_clock::time_point defTaskStart;
+  double defTaskLatencyMs = 0;
+  // the last result of defTask, the CPs it was solved for and the CP
+  // positions of the preview shown in defData.VCurr
+  Eigen::MatrixXd defResultV;
+  const Def3D *defResultDef = nullptr;
+  long defResultCPsChangedNum = 0;
+  std::vector<Eigen::Vector3d> defResultPos, previewPos;
+  DefEngLBS previewLBS;
+  long previewCPsChangedNum = -1;
+  // limit of the extrapolation of the CPs
+  const double maxPredictionMs = 100;
 
   // control points
   CPData cpData, cpDataBackup;
@@ -264,6 +593,11 @@ class MainWindow : public MyWindow {
   // 3D view
   Eigen::MatrixXd proj3DView = Eigen::Matrix4d::Identity();
   Eigen::MatrixXd proj3DViewInv = Eigen::Matrix4d::Identity();
+  // inputs of the camera matrices when they were last built and a counter
+  // bumped whenever they change, so that the per-frame matrices and anything
+  // projected by proj3DView are only recomputed when the view moves
+  Eigen::VectorXd cameraKey;
+  std::uint64_t cameraVersion = 0;
   Eigen::MatrixXd flyCameraM = Eigen::Matrix4d::Identity();
   float rotFactor = 0.5;
   Eigen::Vector3d cameraCenter = Eigen::Vector3d::Zero();
@@ -287,6 +621,16 @@ class MainWindow : public MyWindow {
 
   // opengl
   GLData glData;
+  GLOverlay glOverlay;
+  GLPicker glPicker;
+  GLMorphPlayback glMorph;
+  // video capture, the frames are solved by captureSolver, read back by
+  // frameCapture and written by captureWriter
+  std::unique_ptr<AnimationSolver> captureSolver;
+  GLFrameCapture frameCapture;
+  AsyncImageWriter captureWriter;
+  int capturedFrames = 0;
+  MeshPicker meshPicker;
 
   // visualization
   bool use3DCPVisualization = false;
@@ -298,6 +642,39 @@ class MainWindow : public MyWindow {
 
   // shading
   ShadingOptions shadingOpts;
+  // inputs the normals were last computed for, they are reused if unchanged,
+  // normalsVersion is bumped whenever they are recomputed
+  std::uint64_t normalsMeshVersion = 0, normalsVersion = 0;
+  VertexNormals vertexNormals;
+  bool normalsSmoothing = false;
+  int normalsSmoothingIters = 0;
+  double normalsSmoothingStep = 0;
+  bool normalsImplicitSmoothing = false;
+  // I + normalSmoothingStep * L as one step of the normal smoothing, it is
+  // rebuilt when L changes
+  Eigen::SparseMatrix<double> normalSmoothingL;
+  Eigen::SparseMatrix<double, Eigen::RowMajor> normalSmoothingOp;
+  double normalSmoothingOpStep = 0;
+  // factorization of I - t * L for the implicit normal smoothing
+  Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>> normalSmoothingSolver;
+  double normalSmoothingSolverTime = 0;
+  // defData.VCurr and defData.normals interleaved in float, shared by the
+  // GPU upload and the export, see updateInterleavedVertices()
+  MatrixX3fR VCurrInterleaved, normalsInterleaved;
+  std::uint64_t interleavedMeshVersion = UINT64_MAX;
+  std::uint64_t interleavedNormalsVersion = UINT64_MAX;
+  // mesh.VRest divided by the size of the template image (the third column
+  // is -1), shared by the drawing and the export. The rest pose changes only
+  // with a new reconstruction, so they are recomputed only for a different
+  // defData.recResult or image size.
+  Eigen::MatrixXd textureCoords;
+  std::shared_ptr<const RecResult> textureCoordsRec;
+  int textureCoordsW = 0, textureCoordsH = 0;
+  // templateImg packed for textureCoords if textureAtlas is set and the
+  // atlas is smaller, it replaces templateImg on the GPU
+  bool textureAtlas = false;
+  TextureAtlas templateAtlas;
+  bool textureCoordsAtlas = false;
 
   // animation
   bool manualTimepoint = false;
@@ -307,13 +684,44 @@ class MainWindow : public MyWindow {
   bool autoSmoothAnim = true;
   int autoSmoothAnimFrom = -5, autoSmoothAnimTo = 5, autoSmoothAnimIts = 5;
   CPAnim copiedAnim;
-  CPAnim &cpAnimSync = cpData.cpAnimSync;
-  int exportAnimationPreroll = 0;
+  CPAnimSync &cpAnimSync = cpData.cpAnimSync;
   bool exportPerFrameNormals = false;
-  bool exportAnimationWaitForBeginning = true;
   int exportedFrames = 0;
+  double exportAnimationTimeBudgetMs = 30;  // per repaint
+  std::unique_ptr<AnimationSolver> animSolver;
   exportgltf::ExportGltf *gltfExporter = nullptr;
   exportgltf::MatrixXfR exportBaseV, exportBaseN;
+  bool exportSkinning = false;
+  bool exportQuantized = false;
+  bool exportCompressed = false;
+  float exportKeyframeTolerance = 0;
+  bool exportOBJSequence = false;
+  AsyncExport exportTask;  // writes the file of a finished export
+  SkinFit exportSkinFit;  // joint poses of the frames if skinned
+  // Encodes the frames after the first one into gltfExporter while the next
+  // ones are solved. It owns gltfExporter, exportBaseV, exportBaseN and
+  // exportSkinFit until finish().
+  AsyncFrameEncoder exportEncoder;
+  AnimCache animCache;  // deformed frames of the played animation
+  // timepoint of the playback
+  AnimClock animClock{CPAnim::keyposesPerSecond};
+  CPAnimBatch cpAnimBatch;  // replays the CP animations of a frame
+  CPInputQueue cpInputQueue;  // streamed CP positions, see pushCPInput()
+  CPInputRecorder cpInputRecorder;
+  ProjectJournal autosaveJournal;
+  DrawingHistory drawingHistory;
+  // the control points are renumbered when the mesh is reconstructed, the
+  // history is cleared then
+  CPHistory cpHistory;
+  double autosaveInterval = 0;  // seconds
+  std::chrono::steady_clock::time_point lastAutosave;
+  bool animCacheEnabled = false;
+  // the completely cached animation is played by glMorph, morphFrame is the
+  // cached frame shown last (-1 if the mesh is up to date) and
+  // morphFailedSignature the cache glMorph could not take
+  bool morphPlayback = true;
+  int morphFrame = -1;
+  std::uint64_t morphFailedSignature = 0;
   PauseStatus animStatus;
 };
 
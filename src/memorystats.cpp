@@ -0,0 +1,77 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "memorystats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+
+#if defined(__EMSCRIPTEN__) || defined(__GLIBC__)
+#include <malloc.h>
+#define MEMORYSTATS_MALLINFO
+#endif
+#ifdef __EMSCRIPTEN__
+#include <emscripten/heap.h>
+#endif
+
+using namespace std;
+
+static atomic<size_t> peakBytes{0};
+
+string MemoryStats::toJSON() const {
+  ostringstream oss;
+  oss << "{\"current\":" << current << ",\"peak\":" << peak
+      << ",\"heap\":" << heap << ",\"reclaimable\":" << reclaimable << "}";
+  return oss.str();
+}
+
+static void updatePeak(size_t current) {
+  size_t peak = peakBytes.load(memory_order_relaxed);
+  while (current > peak &&
+         !peakBytes.compare_exchange_weak(peak, current,
+                                          memory_order_relaxed)) {
+  }
+}
+
+MemoryStats getMemoryStats() {
+  MemoryStats stats;
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+  const struct mallinfo2 info = mallinfo2();
+#elif defined(MEMORYSTATS_MALLINFO)
+  const struct mallinfo info = mallinfo();
+#endif
+#ifdef MEMORYSTATS_MALLINFO
+  // uordblks and fordblks are only the main arena of glibc, hblkhd the
+  // chunks mapped separately
+  stats.current = size_t(info.uordblks) + size_t(info.hblkhd);
+  stats.heap = size_t(info.arena) + size_t(info.hblkhd);
+  stats.reclaimable = size_t(info.fordblks);
+#endif
+#ifdef __EMSCRIPTEN__
+  stats.heap = emscripten_get_heap_size();
+#endif
+  updatePeak(stats.current);
+  stats.peak = peakBytes.load(memory_order_relaxed);
+  return stats;
+}
+
+void sampleMemoryPeak() { getMemoryStats(); }
+
+void releaseFreeMemory() {
+#ifdef MEMORYSTATS_MALLINFO
+  malloc_trim(0);
+#endif
+}
@@ -0,0 +1,43 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef MEMORYSTATS_H
+#define MEMORYSTATS_H
+
+#include <cstddef>
+#include <string>
+
+// Memory of the process as seen by the allocator. The WASM heap only grows,
+// memory freed inside it is reused but never returned to the browser, so
+// heap is what the page costs and current is what is actually in use.
+struct MemoryStats {
+  std::size_t current = 0;  // allocated bytes
+  std::size_t peak = 0;     // maximum of current sampled so far
+  std::size_t heap = 0;     // bytes taken from the system
+  // free bytes inside the heap plus caches that could be dropped
+  std::size_t reclaimable = 0;
+  std::string toJSON() const;
+};
+
+// fields are 0 where the allocator does not report them
+MemoryStats getMemoryStats();
+// samples current for the peak, called at the end of the stages of the
+// reconstruction and the export
+void sampleMemoryPeak();
+// returns the free memory at the end of the heap to the system (native
+// builds) or to the top of the WASM heap where it is not fragmented
+void releaseFreeMemory();
+
+#endif  // MEMORYSTATS_H
@@ -0,0 +1,154 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "meshlod.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "vertexnormals.h"
+
+using namespace std;
+using namespace Eigen;
+
+namespace {
+
+// levels keeping more of the triangles of the previous one are skipped
+const double minReduction = 0.6;
+// levels with less triangles than this are not worth drawing
+const int minTriangles = 64;
+
+uint64_t cellKey(const Vector3d &p, double cellSize, int part, bool front) {
+  auto coord = [&](double x) {
+    return static_cast<uint64_t>(static_cast<int64_t>(floor(x / cellSize)) &
+                                 0x3ffff);
+  };
+  return (coord(p(0)) << 46) | (coord(p(1)) << 28) | (coord(p(2)) << 10) |
+         (static_cast<uint64_t>(part & 0x1ff) << 1) | (front ? 1 : 0);
+}
+
+MeshLOD clusterMesh(const MatrixXd &V, const MatrixXi &F,
+                    const vector<int> &partOfVertex, const MatrixXd &N,
+                    double cellSize) {
+  const int n = V.rows();
+  // cell of each vertex and the mean of each cell
+  vector<int> cellOf(n);
+  vector<Vector3d> cellSum;
+  vector<int> cellCount;
+  unordered_map<uint64_t, int> cells;
+  for (int i = 0; i < n; i++) {
+    const Vector3d p = V.row(i).transpose();
+    const uint64_t key = cellKey(p, cellSize, partOfVertex[i], N(i, 2) >= 0);
+    auto it = cells.emplace(key, static_cast<int>(cellSum.size())).first;
+    if (it->second == static_cast<int>(cellSum.size())) {
+      cellSum.push_back(Vector3d::Zero());
+      cellCount.push_back(0);
+    }
+    cellOf[i] = it->second;
+    cellSum[it->second] += p;
+    cellCount[it->second]++;
+  }
+  // the representative is the vertex closest to the mean
+  vector<int> rep(cellSum.size(), -1);
+  vector<double> repDist(cellSum.size(), numeric_limits<double>::max());
+  for (int i = 0; i < n; i++) {
+    const int c = cellOf[i];
+    const Vector3d mean = cellSum[c] / cellCount[c];
+    const double d = (V.row(i).transpose() - mean).squaredNorm();
+    if (d < repDist[c]) {
+      repDist[c] = d;
+      rep[c] = i;
+    }
+  }
+
+  MeshLOD lod;
+  lod.cellSize = cellSize;
+  vector<int> newIndex(n, -1);
+  vector<array<int, 3>> faces;
+  unordered_set<uint64_t> seen;
+  for (int f = 0; f < F.rows(); f++) {
+    array<int, 3> t;
+    for (int k = 0; k < 3; k++) t[k] = rep[cellOf[F(f, k)]];
+    if (t[0] == t[1] || t[1] == t[2] || t[2] == t[0]) continue;
+    // the same triangle may come from several ones of the full mesh
+    array<int, 3> s = t;
+    sort(s.begin(), s.end());
+    const uint64_t key = (static_cast<uint64_t>(s[0]) * n + s[1]) * n + s[2];
+    if (!seen.insert(key).second) continue;
+    // the vertices are numbered in the order of their first use
+    for (int &v : t) {
+      if (newIndex[v] == -1) {
+        newIndex[v] = lod.vertices.size();
+        lod.vertices.push_back(v);
+      }
+      v = newIndex[v];
+    }
+    faces.push_back(t);
+  }
+  lod.F.resize(faces.size(), 3);
+  for (int f = 0; f < lod.F.rows(); f++)
+    for (int k = 0; k < 3; k++) lod.F(f, k) = faces[f][k];
+  return lod;
+}
+
+}  // namespace
+
+vector<MeshLOD> buildMeshLODs(const MatrixXd &V, const MatrixXi &F,
+                              const vector<vector<int>> &verticesOfParts,
+                              int maxLevels) {
+  vector<MeshLOD> lods;
+  if (V.rows() == 0 || F.rows() == 0 || V.cols() != 3) return lods;
+
+  vector<int> partOfVertex(V.rows(), 0);
+  for (int p = 0; p < static_cast<int>(verticesOfParts.size()); p++)
+    for (int v : verticesOfParts[p])
+      if (v >= 0 && v < V.rows()) partOfVertex[v] = p;
+  MatrixXd N;
+  VertexNormals().compute(V, F, N);
+
+  double edgeSum = 0;
+  for (int f = 0; f < F.rows(); f++)
+    for (int k = 0; k < 3; k++)
+      edgeSum += (V.row(F(f, k)) - V.row(F(f, (k + 1) % 3))).norm();
+  const double avgEdge = edgeSum / (3 * F.rows());
+  if (avgEdge <= 0) return lods;
+
+  int prevTriangles = F.rows();
+  double cellSize = avgEdge;
+  for (int level = 0; level < maxLevels + 2 &&
+                      static_cast<int>(lods.size()) < maxLevels;
+       level++) {
+    cellSize *= 2;
+    MeshLOD lod = clusterMesh(V, F, partOfVertex, N, cellSize);
+    if (lod.F.rows() < minTriangles) break;
+    if (lod.F.rows() > minReduction * prevTriangles) continue;
+    prevTriangles = lod.F.rows();
+    lods.push_back(std::move(lod));
+  }
+  return lods;
+}
+
+int selectMeshLOD(const vector<MeshLOD> &lods, double pixelsPerUnit,
+                  double maxPixels) {
+  int selected = -1;
+  for (int i = 0; i < static_cast<int>(lods.size()); i++)
+    if (lods[i].cellSize * pixelsPerUnit <= maxPixels) selected = i;
+  return selected;
+}
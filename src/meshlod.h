@@ -0,0 +1,51 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef MESHLOD_H
+#define MESHLOD_H
+
+#include <Eigen/Dense>
+#include <vector>
+
+// Coarser version of a mesh made of a subset of its vertices, so that it
+// stays valid when the vertices of the full mesh are deformed: the
+// positions of the level are rows vertices of the deformed full mesh.
+struct MeshLOD {
+  // indices in the full mesh of the vertices of the level, F indexes them
+  std::vector<int> vertices;
+  Eigen::MatrixXi F;
+  // size of the clustering cells in the units of the rest pose, i.e. the
+  // largest error of the level
+  double cellSize = 0;
+};
+
+// Builds up to maxLevels levels of detail of the mesh (V, F) in the rest
+// pose by vertex clustering on grids with cells of 2, 4, 8, ... times the
+// average edge length. Each cell is represented by its vertex closest to
+// the mean of the cell, the triangles are remapped to the representatives
+// and those that collapse are dropped. The vertices of different parts
+// (see DefData::verticesOfParts) and of the front and back side of the
+// inflated mesh are never merged. Levels that would not save enough
+// triangles are skipped, the result is ordered from fine to coarse.
+std::vector<MeshLOD> buildMeshLODs(
+    const Eigen::MatrixXd &V, const Eigen::MatrixXi &F,
+    const std::vector<std::vector<int>> &verticesOfParts, int maxLevels = 3);
+
+// Index of the coarsest level whose cells are at most maxPixels on the
+// screen, -1 for the full mesh.
+int selectMeshLOD(const std::vector<MeshLOD> &lods, double pixelsPerUnit,
+                  double maxPixels);
+
+#endif  // MESHLOD_H
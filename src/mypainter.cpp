@@ -16,10 +16,130 @@
 
 #include <SDL2_gfxPrimitives-mod.h>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 
+#include "macros.h"
+
 using namespace std;
 
+namespace {
+
+// Span [lo, hi] of the row y covered by the disc of radius r centered at
+// (cx, cy), empty if lo > hi.
+void discSpan(double cx, double cy, double r, double y, double &lo,
+              double &hi) {
+  const double dy = y - cy;
+  const double d2 = r * r - dy * dy;
+  if (d2 < 0) {
+    lo = 1;
+    hi = 0;
+    return;
+  }
+  const double d = sqrt(d2);
+  lo = cx - d;
+  hi = cx + d;
+}
+
+// restricts [lo, hi] to the x for which a * x <= c
+void clipSpan(double a, double c, double &lo, double &hi) {
+  if (a > 0) {
+    hi = min(hi, c / a);
+  } else if (a < 0) {
+    lo = max(lo, c / a);
+  } else if (c < 0) {
+    lo = 1;
+    hi = 0;
+  }
+}
+
+// Span of the row y covered by the rectangle around the segment (x1, y1) -
+// (x2, y2) that is 2 * r wide, the caps are not included.
+void bodySpan(double x1, double y1, double x2, double y2, double r, double y,
+              double &lo, double &hi) {
+  const double dx = x2 - x1, dy = y2 - y1;
+  const double rLen = r * sqrt(dx * dx + dy * dy);
+  lo = -numeric_limits<double>::infinity();
+  hi = numeric_limits<double>::infinity();
+  clipSpan(-dx, -x1 * dx + (y - y1) * dy, lo, hi);
+  clipSpan(dx, x2 * dx - (y - y2) * dy, lo, hi);
+  clipSpan(dy, rLen + x1 * dy + (y - y1) * dx, lo, hi);
+  clipSpan(-dy, rLen - x1 * dy - (y - y1) * dx, lo, hi);
+}
+
+// [lo, hi] = [lo, hi] united with [l, h], the spans overlap if both are
+// non-empty
+void uniteSpan(double l, double h, double &lo, double &hi) {
+  if (l > h) return;
+  if (lo > hi) {
+    lo = l;
+    hi = h;
+  } else {
+    lo = min(lo, l);
+    hi = max(hi, h);
+  }
+}
+
+void fillSpan(Imguc &I, int y, int x0, int x1, const SDL_Color &color) {
+  x0 = max(x0, 0);
+  x1 = min(x1, I.w - 1);
+  if (x0 > x1) return;
+  unsigned char *row = &I.data[(y * I.w + x0) * I.ch];
+  const int n = x1 - x0 + 1;
+  if (I.ch == 1) {
+    memset(row, color.r, n);
+  } else {
+    const unsigned char px[4] = {color.r, color.g, color.b, color.a};
+    uint32_t value;
+    memcpy(&value, px, 4);
+    uint32_t *p = reinterpret_cast<uint32_t *>(row);
+    fill(p, p + n, value);
+  }
+}
+
+// Rasterizes the capsule of radius r around the segment into I one span per
+// row, a pixel is covered if its center is. If skipStartCap, the pixels of
+// the disc at (x1, y1) are left out.
+void fillCapsule(Imguc &I, int x1, int y1, int x2, int y2, double r,
+                 bool skipStartCap, const SDL_Color &color) {
+  const int yMin = max(int(ceil(min(y1, y2) - r)), 0);
+  const int yMax = min(int(floor(max(y1, y2) + r)), I.h - 1);
+  const bool hasBody = x1 != x2 || y1 != y2;
+  if (skipStartCap && !hasBody) return;
+  fora(y, yMin, yMax + 1) {
+    double lo, hi, l, h;
+    discSpan(x2, y2, r, y, lo, hi);
+    if (hasBody) {
+      bodySpan(x1, y1, x2, y2, r, y, l, h);
+      uniteSpan(l, h, lo, hi);
+      if (!skipStartCap) {
+        discSpan(x1, y1, r, y, l, h);
+        uniteSpan(l, h, lo, hi);
+      }
+    }
+    if (lo > hi) continue;
+    const int xa = ceil(lo), xb = floor(hi);
+    if (!skipStartCap) {
+      fillSpan(I, y, xa, xb, color);
+      continue;
+    }
+    // the pixels of the start cap were drawn by the previous segment
+    discSpan(x1, y1, r, y, l, h);
+    if (l > h) {
+      fillSpan(I, y, xa, xb, color);
+      continue;
+    }
+    const int ca = ceil(l), cb = floor(h);
+    fillSpan(I, y, xa, min(xb, ca - 1), color);
+    fillSpan(I, y, max(xa, cb + 1), xb, color);
+  }
+}
+
+}  // namespace
+
 MyPainter::MyPainter() {
 #ifdef USE_OPENGL_FOR_DRAWING_INSTEAD_OF_SDL
   useOpenGLForDrawingInsteadOfSDL = true;
@@ -47,6 +167,7 @@ MyPainter::MyPainter(Imguc &I) {
            "MyPainter::MyPainter(Imguc &I): error: unsupported number of "
            "channels");
 
+  image = &I;
   surface = SDL_CreateRGBSurfaceWithFormatFrom(
       I.data, I.w, I.h, I.ch * 8, sizeof(unsigned char) * I.w * I.ch, format);
   renderer = SDL_CreateSoftwareRenderer(surface);
@@ -93,18 +214,21 @@ void MyPainter::setThickness(int thickness) { currThickness = thickness; }
 
 void MyPainter::drawEllipse(int x, int y, int rx, int ry) {
   if (!checkRenderingContext()) return;
+  painted = true;
   aaellipseRGBA(renderer, x, y, rx, ry, currColor.r, currColor.g, currColor.b,
                 currColor.a);
 }
 
 void MyPainter::filledEllipse(int x, int y, int rx, int ry) {
   if (!checkRenderingContext()) return;
+  painted = true;
   aaFilledEllipseRGBA(renderer, x, y, rx, ry, currColor.r, currColor.g,
                       currColor.b, currColor.a);
 }
 
 void MyPainter::drawLine(int x1, int y1, int x2, int y2, int thickness) {
   if (!checkRenderingContext()) return;
+  painted = true;
   if ((x1 == x2) && (y1 == y2)) {
     const int t = ceil(0.5 * thickness);
     // there is a bug in filledEllipseRGBA; it doesn't draw perfect circles;
@@ -121,7 +245,19 @@ void MyPainter::drawLine(int x1, int y1, int x2, int y2) {
   drawLine(x1, y1, x2, y2, currThickness);
 }
 
+void MyPainter::drawStrokeSegment(int x1, int y1, int x2, int y2,
+                                  int thickness, bool continued) {
+  if (image == nullptr || currColor.a != 255) {
+    // blending is left to SDL
+    drawLine(x1, y1, x2, y2, thickness);
+    return;
+  }
+  painted = true;
+  fillCapsule(*image, x1, y1, x2, y2, 0.5 * thickness, continued, currColor);
+}
+
 void MyPainter::drawRect(int x1, int y1, int x2, int y2) {
+  painted = true;
   rectangleRGBA(renderer, x1, y1, x2, y2, currColor.r, currColor.g, currColor.b,
                 currColor.a);
 }
@@ -201,10 +337,14 @@ void MyPainter::drawStaticImage(int x, int y, const Imguc &I, float alpha) {
   } else {
     SDL_PixelFormatEnum format = SDL_PIXELFORMAT_ABGR8888;
     if (I.ch == 3) format = SDL_PIXELFORMAT_BGR888;
+    // textures of the window's renderer are reused across frames
+    const bool cached = myWindow != nullptr;
     SDL_Texture *texture =
-        SDL_CreateTexture(renderer, format, SDL_TEXTUREACCESS_STATIC, I.w, I.h);
+        cached ? myWindow->getImageTexture(I, format, SDL_TEXTUREACCESS_STATIC)
+               : SDL_CreateTexture(renderer, format, SDL_TEXTUREACCESS_STATIC,
+                                   I.w, I.h);
     SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
-    if (alpha < 1) SDL_SetTextureAlphaMod(texture, alpha);
+    SDL_SetTextureAlphaMod(texture, alpha < 1 ? alpha : 255);
     SDL_UpdateTexture(texture, nullptr, I.data,
                       sizeof(unsigned char) * I.w * I.ch);
     SDL_Rect rect;
@@ -213,7 +353,7 @@ void MyPainter::drawStaticImage(int x, int y, const Imguc &I, float alpha) {
     rect.w = I.w;
     rect.h = I.h;
     SDL_RenderCopy(renderer, texture, nullptr, &rect);
-    SDL_DestroyTexture(texture);
+    if (!cached) SDL_DestroyTexture(texture);
   }
 }
 
@@ -223,18 +363,32 @@ void MyPainter::drawDynamicImage(int x, int y, const Imguc &I) {
     if (!checkRenderingContext()) return;
     SDL_PixelFormatEnum format = SDL_PIXELFORMAT_ABGR8888;
     if (I.ch == 3) format = SDL_PIXELFORMAT_BGR888;
-    SDL_Texture *texture = SDL_CreateTexture(
-        renderer, format, SDL_TEXTUREACCESS_STREAMING, I.w, I.h);
+    const bool cached = myWindow != nullptr;
+    SDL_Texture *texture =
+        cached ? myWindow->getImageTexture(I, format,
+                                           SDL_TEXTUREACCESS_STREAMING)
+               : SDL_CreateTexture(renderer, format,
+                                   SDL_TEXTUREACCESS_STREAMING, I.w, I.h);
     SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
-    SDL_UpdateTexture(texture, nullptr, I.data,
-                      sizeof(unsigned char) * I.w * I.ch);
+    // copy the rows to the locked texture, its pitch may differ from the
+    // image's
+    void *pixels;
+    int pitch;
+    if (SDL_LockTexture(texture, nullptr, &pixels, &pitch) == 0) {
+      const int rowBytes = sizeof(unsigned char) * I.w * I.ch;
+      fora(row, 0, I.h) {
+        memcpy(static_cast<unsigned char *>(pixels) + row * pitch,
+               I.data + row * rowBytes, rowBytes);
+      }
+      SDL_UnlockTexture(texture);
+    }
     SDL_Rect rect;
     rect.x = x;
     rect.y = y;
     rect.w = I.w;
     rect.h = I.h;
     SDL_RenderCopy(renderer, texture, nullptr, &rect);
-    SDL_DestroyTexture(texture);
+    if (!cached) SDL_DestroyTexture(texture);
   }
 }
 
@@ -259,3 +413,5 @@ void MyPainter::clearToColor() {
 }
 
 int MyPainter::getCurrentThickness() { return currThickness; }
+
+bool MyPainter::hasPainted() const { return painted; }
@@ -44,6 +44,12 @@ class MyPainter {
   void filledEllipse(int x, int y, int rx, int ry);
   void drawLine(int x1, int y1, int x2, int y2, int thickness);
   void drawLine(int x1, int y1, int x2, int y2);
+  // Segment of a stroke drawn into the image given to the constructor, as a
+  // capsule with round caps. If continued, the segment starts where the
+  // previous one of the same thickness ended and the pixels of its cap are
+  // not touched again.
+  void drawStrokeSegment(int x1, int y1, int x2, int y2, int thickness,
+                         bool continued);
   void drawRect(int x1, int y1, int x2, int y2);
   void drawArrow(double x1, double y1, double x2, double y2,
                  double arrowHeadSize, double alphaDeg, int thickness,
@@ -59,6 +65,8 @@ class MyPainter {
   void clearToColor();
 
   int getCurrentThickness();
+  // whether any primitive has been drawn since construction
+  bool hasPainted() const;
 
  private:
   bool checkRenderingContext();
@@ -67,9 +75,11 @@ class MyPainter {
   SDL_Renderer *renderer = nullptr;
   SDL_Window *window = nullptr;
   SDL_Surface *surface = nullptr;
+  Imguc *image = nullptr;
   SDL_Color currColor;
   int currThickness = 1;
   bool useOpenGLForDrawingInsteadOfSDL = false;
+  bool painted = false;
 };
 
 #endif  // MYPAINTER_H
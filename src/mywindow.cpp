@@ -16,7 +16,11 @@
 
 #include <miscutils/opengltools.h>
 
+#include <algorithm>
+#include <chrono>
+#include <fstream>
 #include <iostream>
+#include <vector>
 
 #include "macros.h"
 
@@ -44,9 +48,8 @@ int MyWindow::init(const std::string& windowTitle) {
                             SDL_WINDOWPOS_CENTERED, windowWidth, windowHeight,
                             SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN);
   context = SDL_GL_CreateContext(window);
-  if (SDL_GL_SetSwapInterval(-1) == -1) {
-    SDL_GL_SetSwapInterval(1);
-  }
+  vsync = SDL_GL_SetSwapInterval(-1) == 0 || SDL_GL_SetSwapInterval(1) == 0;
+  wakeUpEventType = SDL_RegisterEvents(1);
   cout << "GL version: " << glGetString(GL_VERSION) << endl;
   if (window == nullptr) {
     cerr << "SDL_CreateWindow error: " << SDL_GetError() << endl;
@@ -162,6 +165,8 @@ void MyWindow::runLoop() {
 
 void MyWindow::destroy() {
   destroyOpenGLBuffers();
+  for (auto &el : imageTextures) SDL_DestroyTexture(el.second.texture);
+  imageTextures.clear();
   SDL_DestroyRenderer(renderer);
   SDL_GL_DeleteContext(context);
   SDL_DestroyWindow(window);
@@ -170,112 +175,199 @@ void MyWindow::destroy() {
 
 bool MyWindow::mainTick() {
   SDL_Event event;
-
-  int lastTimestamp = event.motion.timestamp;
   bool quit = false;
-  while (SDL_PollEvent(&event)) {
-    switch (event.type) {
-      case SDL_QUIT:
-        quit = true;
-        break;
-      case SDL_KEYUP:
-      case SDL_KEYDOWN: {
-        MyKeyEvent keyEvent;
-        if (event.key.keysym.mod & KMOD_SHIFT) keyEvent.shiftModifier = true;
-        if (event.key.keysym.mod & KMOD_CTRL) keyEvent.ctrlModifier = true;
-        if (event.key.keysym.mod & KMOD_ALT) keyEvent.altModifier = true;
-        if (event.key.keysym.mod & KMOD_NONE) keyEvent.noModifier = true;
-        keyEvent.key = event.key.keysym.sym;
-        lastKeyEvent = keyEvent;  // store this for usage in mouse events
-        if (event.type == SDL_KEYDOWN)
-          keyPressEvent(keyEvent);
-        else
-          keyReleaseEvent(keyEvent);
-
-        this->keyEvent(keyEvent);
-      } break;
-      case SDL_MOUSEMOTION:
-      case SDL_MOUSEBUTTONDOWN:
-      case SDL_MOUSEBUTTONUP: {
-        if (!simulateMouseEventByTouch &&
-            event.button.which == SDL_TOUCH_MOUSEID)
-          break;
-        MyMouseEvent mouseEvent;
-        mouseEvent.pos = Vector2d(event.button.x, event.button.y);
-        mouseEvent.shiftModifier = lastKeyEvent.shiftModifier;
-        mouseEvent.ctrlModifier = lastKeyEvent.ctrlModifier;
-        mouseEvent.altModifier = lastKeyEvent.altModifier;
-        mouseEvent.noModifier = lastKeyEvent.noModifier;
-
-        if (event.type == SDL_MOUSEMOTION) {
-          mouseEvent.leftButton = event.motion.state & SDL_BUTTON_LMASK;
-          mouseEvent.middleButton = event.motion.state & SDL_BUTTON_MMASK;
-          mouseEvent.rightButton = event.motion.state & SDL_BUTTON_RMASK;
-          //            mouseEvent.rightButton = false; // temporary
-        } else {
-          mouseEvent.leftButton = event.button.button == SDL_BUTTON_LEFT;
-          mouseEvent.middleButton = event.button.button == SDL_BUTTON_MIDDLE;
-          mouseEvent.rightButton = event.button.button == SDL_BUTTON_RIGHT;
-          //            mouseEvent.rightButton = false; // temporary
-          mouseEvent.numClicks = event.button.clicks;
-        }
-
-        if (event.type == SDL_MOUSEBUTTONDOWN)
-          lastPressTimestamp = event.button.timestamp;
-        else if (event.type == SDL_MOUSEBUTTONUP)
-          mouseEvent.pressReleaseDurationMs =
-              event.button.timestamp - lastPressTimestamp;
-
-        if (event.type == SDL_MOUSEMOTION)
-          mouseMoveEvent(mouseEvent);
-        else if (event.type == SDL_MOUSEBUTTONDOWN)
-          mousePressEvent(mouseEvent);
-        else
-          mouseReleaseEvent(mouseEvent);
-
-        this->mouseEvent(mouseEvent);
-      } break;
-      case SDL_FINGERMOTION:
-      case SDL_FINGERDOWN:
-      case SDL_FINGERUP: {
-        MyFingerEvent fingerEvent;
-        // event.tfinger.x and event.tfinger.y are normalized to [0, 1]
-        fingerEvent.pos = Vector2d(event.tfinger.x * windowWidth,
-                                   event.tfinger.y * windowHeight);
-        fingerEvent.fingerId = event.tfinger.fingerId;
-
-        if (event.tfinger.type == SDL_FINGERDOWN)
-          currFingerIds.insert(fingerEvent.fingerId);
-        else if (event.tfinger.type == SDL_FINGERUP)
-          currFingerIds.erase(fingerEvent.fingerId);
-
-        fingerEvent.numFingers = currFingerIds.size();
-
-        if (event.tfinger.type == SDL_FINGERDOWN)
-          fingerPressEvent(fingerEvent);
-        else if (event.tfinger.type == SDL_FINGERUP)
-          fingerReleaseEvent(fingerEvent);
-        else
-          fingerMoveEvent(fingerEvent);
-
-        this->fingerEvent(fingerEvent);
-      } break;
-    }
+#ifndef __EMSCRIPTEN__
+  // nothing to paint, sleep until an event or a wake-up arrives (on the web
+  // the loop is driven by requestAnimationFrame instead)
+  if (!repaint) waitEvent(idleTimeoutMs, quit);
+#endif
+  while (SDL_PollEvent(&event)) handleEvent(event, quit);
+  flushMotionEvents();
+
+  const Uint32 frameStartMs = SDL_GetTicks();
+  const auto paintStart = chrono::steady_clock::now();
+  const bool painted = paintEvent();
+  if (recorder) {
+    const chrono::duration<double, milli> paintTime =
+        chrono::steady_clock::now() - paintStart;
+    recorder->endTick(painted, paintTime.count());
   }
-
-  if (paintEvent()) {
+  if (painted) {
     SDL_GL_SwapWindow(window);
+#ifndef __EMSCRIPTEN__
+    // without vsync cap the frame rate, input arriving meanwhile is handled
+    // right away
+    const int elapsed = SDL_GetTicks() - frameStartMs;
+    if (!vsync && elapsed < minFrameMs) waitEvent(minFrameMs - elapsed, quit);
+#endif
   }
 
   return quit;
 }
 
+void MyWindow::waitEvent(int timeoutMs, bool& quit) {
+  SDL_Event event;
+  if (SDL_WaitEventTimeout(&event, timeoutMs)) handleEvent(event, quit);
+}
+
+void MyWindow::wakeUp() {
+  if (wakeUpEventType == static_cast<Uint32>(-1)) return;
+  SDL_Event event;
+  SDL_zero(event);
+  event.type = wakeUpEventType;
+  SDL_PushEvent(&event);
+}
+
+void MyWindow::flushMotionEvents() {
+  if (mouseMotionPending) {
+    mouseMotionPending = false;
+    mouseMoveEvent(pendingMouseMotion);
+    this->mouseEvent(pendingMouseMotion);
+  }
+  for (const auto& it : pendingFingerMotions) {
+    fingerMoveEvent(it.second);
+    this->fingerEvent(it.second);
+  }
+  pendingFingerMotions.clear();
+}
+
+void MyWindow::handleEvent(const SDL_Event& event, bool& quit) {
+  if (recorder) recorder->addEvent(event);
+  if (event.type != SDL_MOUSEMOTION && event.type != SDL_FINGERMOTION) {
+    flushMotionEvents();
+  }
+  switch (event.type) {
+    case SDL_QUIT:
+      quit = true;
+      break;
+    case SDL_KEYUP:
+    case SDL_KEYDOWN: {
+      MyKeyEvent keyEvent;
+      if (event.key.keysym.mod & KMOD_SHIFT) keyEvent.shiftModifier = true;
+      if (event.key.keysym.mod & KMOD_CTRL) keyEvent.ctrlModifier = true;
+      if (event.key.keysym.mod & KMOD_ALT) keyEvent.altModifier = true;
+      if (event.key.keysym.mod & KMOD_NONE) keyEvent.noModifier = true;
+      keyEvent.key = event.key.keysym.sym;
+      lastKeyEvent = keyEvent;  // store this for usage in mouse events
+      if (event.type == SDL_KEYDOWN)
+        keyPressEvent(keyEvent);
+      else
+        keyReleaseEvent(keyEvent);
+
+      this->keyEvent(keyEvent);
+    } break;
+    case SDL_MOUSEMOTION:
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP: {
+      if (!simulateMouseEventByTouch &&
+          event.button.which == SDL_TOUCH_MOUSEID)
+        break;
+      MyMouseEvent mouseEvent;
+      mouseEvent.pos = Vector2d(event.button.x, event.button.y);
+      mouseEvent.shiftModifier = lastKeyEvent.shiftModifier;
+      mouseEvent.ctrlModifier = lastKeyEvent.ctrlModifier;
+      mouseEvent.altModifier = lastKeyEvent.altModifier;
+      mouseEvent.noModifier = lastKeyEvent.noModifier;
+
+      if (event.type == SDL_MOUSEMOTION) {
+        mouseEvent.leftButton = event.motion.state & SDL_BUTTON_LMASK;
+        mouseEvent.middleButton = event.motion.state & SDL_BUTTON_MMASK;
+        mouseEvent.rightButton = event.motion.state & SDL_BUTTON_RMASK;
+        //            mouseEvent.rightButton = false; // temporary
+      } else {
+        mouseEvent.leftButton = event.button.button == SDL_BUTTON_LEFT;
+        mouseEvent.middleButton = event.button.button == SDL_BUTTON_MIDDLE;
+        mouseEvent.rightButton = event.button.button == SDL_BUTTON_RIGHT;
+        //            mouseEvent.rightButton = false; // temporary
+        mouseEvent.numClicks = event.button.clicks;
+      }
+
+      if (event.type == SDL_MOUSEBUTTONDOWN)
+        lastPressTimestamp = event.button.timestamp;
+      else if (event.type == SDL_MOUSEBUTTONUP)
+        mouseEvent.pressReleaseDurationMs =
+            event.button.timestamp - lastPressTimestamp;
+
+      if (event.type == SDL_MOUSEMOTION) {
+        // buttons and modifiers change only by other events, which flush
+        // the pending motion
+        if (mouseMotionPending) mouseEvent.path.swap(pendingMouseMotion.path);
+        mouseEvent.path.push_back(mouseEvent.pos);
+        pendingMouseMotion = mouseEvent;
+        mouseMotionPending = true;
+        break;
+      }
+      if (event.type == SDL_MOUSEBUTTONDOWN)
+        mousePressEvent(mouseEvent);
+      else
+        mouseReleaseEvent(mouseEvent);
+
+      this->mouseEvent(mouseEvent);
+    } break;
+    case SDL_FINGERMOTION:
+    case SDL_FINGERDOWN:
+    case SDL_FINGERUP: {
+      MyFingerEvent fingerEvent;
+      // event.tfinger.x and event.tfinger.y are normalized to [0, 1]
+      fingerEvent.pos = Vector2d(event.tfinger.x * windowWidth,
+                                 event.tfinger.y * windowHeight);
+      fingerEvent.fingerId = event.tfinger.fingerId;
+
+      if (event.tfinger.type == SDL_FINGERDOWN)
+        currFingerIds.insert(fingerEvent.fingerId);
+      else if (event.tfinger.type == SDL_FINGERUP)
+        currFingerIds.erase(fingerEvent.fingerId);
+
+      fingerEvent.numFingers = currFingerIds.size();
+
+      if (event.tfinger.type == SDL_FINGERMOTION) {
+        pendingFingerMotions[fingerEvent.fingerId] = fingerEvent;
+        break;
+      }
+      if (event.tfinger.type == SDL_FINGERDOWN)
+        fingerPressEvent(fingerEvent);
+      else
+        fingerReleaseEvent(fingerEvent);
+
+      this->fingerEvent(fingerEvent);
+    } break;
+  }
+}
+
 SDL_Renderer* MyWindow::getRenderer() const { return renderer; }
 
 SDL_Window* MyWindow::getWindow() const { return window; }
 
 const MyWindowGLData& MyWindow::getGLData() const { return glData; }
 
+SDL_Texture* MyWindow::getImageTexture(const Imguc& I, Uint32 format,
+                                       int access) {
+  const size_t maxTextures = 16;
+  imageTexturesTick++;
+  MyWindowTexture& t = imageTextures[make_pair(&I, access)];
+  if (t.texture == nullptr || t.format != format || t.w != I.w ||
+      t.h != I.h) {
+    if (t.texture != nullptr) SDL_DestroyTexture(t.texture);
+    t.texture = SDL_CreateTexture(renderer, format, access, I.w, I.h);
+    t.format = format;
+    t.w = I.w;
+    t.h = I.h;
+  }
+  t.lastUsed = imageTexturesTick;
+  SDL_Texture* texture = t.texture;
+
+  // images drawn only temporarily would accumulate textures, drop the least
+  // recently used one
+  if (imageTextures.size() > maxTextures) {
+    auto lru = imageTextures.begin();
+    for (auto it = imageTextures.begin(); it != imageTextures.end(); it++)
+      if (it->second.lastUsed < lru->second.lastUsed) lru = it;
+    SDL_DestroyTexture(lru->second.texture);
+    imageTextures.erase(lru);
+  }
+  return texture;
+}
+
 void MyWindow::setMouseEventsSimulationByTouch(bool enable) {
   simulateMouseEventByTouch = enable;
 }
@@ -294,3 +386,76 @@ void MyWindow::setKeyboardEventState(bool enabled) {
 void MyWindow::enableKeyboardEvents() { setKeyboardEventState(true); }
 
 void MyWindow::disableKeyboardEvents() { setKeyboardEventState(false); }
+
+bool MyWindow::startRecording(const std::string& fn) {
+  recorder.reset(new InputSessionRecorder());
+  if (!recorder->open(fn)) {
+    cerr << "cannot record the session to " << fn << endl;
+    recorder.reset();
+    return false;
+  }
+  return true;
+}
+
+void MyWindow::stopRecording() {
+  if (recorder) recorder->close();
+  recorder.reset();
+}
+
+bool MyWindow::replay(const std::string& fn, const std::string& reportFn) {
+  vector<InputSessionTick> ticks;
+  if (!loadInputSession(fn, ticks)) {
+    cerr << "cannot load the session " << fn << endl;
+    return false;
+  }
+  stopRecording();
+
+  // the ticks must not wait for the display
+  if (vsync) SDL_GL_SetSwapInterval(0);
+  vector<double> recordedMs, replayedMs;
+  bool quit = false;
+  for (const InputSessionTick& tick : ticks) {
+    for (const SDL_Event& event : tick.events) handleEvent(event, quit);
+    flushMotionEvents();
+    const auto paintStart = chrono::steady_clock::now();
+    const bool painted = paintEvent();
+    const chrono::duration<double, milli> paintTime =
+        chrono::steady_clock::now() - paintStart;
+    if (painted) SDL_GL_SwapWindow(window);
+    // only the ticks painted in both runs are comparable
+    if (painted && tick.painted) {
+      recordedMs.push_back(tick.ms);
+      replayedMs.push_back(paintTime.count());
+    }
+  }
+  if (vsync) {
+    vsync = SDL_GL_SetSwapInterval(-1) == 0 || SDL_GL_SetSwapInterval(1) == 0;
+  }
+
+  if (!reportFn.empty()) {
+    ofstream report(reportFn);
+    report << "tick recordedMs replayedMs" << endl;
+    fora(i, 0, recordedMs.size()) {
+      report << i << " " << recordedMs[i] << " " << replayedMs[i] << endl;
+    }
+  }
+
+  auto summary = [](vector<double> ms, double& mean, double& p95) {
+    mean = p95 = 0;
+    if (ms.empty()) return;
+    for (double t : ms) mean += t;
+    mean /= ms.size();
+    sort(ms.begin(), ms.end());
+    p95 = ms[min(ms.size() - 1, ms.size() * 95 / 100)];
+  };
+  double recMean, recP95, repMean, repP95;
+  summary(recordedMs, recMean, recP95);
+  summary(replayedMs, repMean, repP95);
+  cout << fn << ": " << ticks.size() << " ticks, " << recordedMs.size()
+       << " painted" << endl;
+  cout << "recorded paint: mean " << recMean << " ms, p95 " << recP95 << " ms"
+       << endl;
+  cout << "replayed paint: mean " << repMean << " ms, p95 " << repP95 << " ms"
+       << endl;
+  return true;
+}
@@ -20,7 +20,11 @@
 
 #include <Eigen/Dense>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <set>
+#include <string>
+#include <vector>
 
 #ifdef __EMSCRIPTEN__
 #include <emscripten.h>
@@ -29,6 +33,8 @@
 #define GL_GLEXT_PROTOTYPES 1
 #include <SDL_opengles2.h>
 
+#include "inputsession.h"
+
 struct MyCommonEvent {
   bool shiftModifier = false;
   bool ctrlModifier = false;
@@ -43,6 +49,9 @@ struct MyMouseEvent : public MyCommonEvent {
   bool rightButton = false;
   int pressReleaseDurationMs = 0;
   int numClicks = 0;
+  // motion events: the positions of the motions of the tick coalesced into
+  // this one, oldest first and ending with pos
+  std::vector<Eigen::Vector2d> path;
   void display() const {
     std::cout << pos(0) << " " << pos(1) << " " << leftButton << " "
               << middleButton << " " << rightButton << std::endl;
@@ -69,6 +78,13 @@ struct MyWindowGLData {
   GLuint screenTexture, screenShader;
 };
 
+struct MyWindowTexture {
+  SDL_Texture *texture = nullptr;
+  Uint32 format = 0;
+  int w = 0, h = 0;
+  int lastUsed = 0;
+};
+
 class MyWindow {
  public:
   MyWindow(int w, int h, const std::string &windowTitle);
@@ -84,6 +100,22 @@ class MyWindow {
   void setKeyboardEventState(bool enabled);
   void enableKeyboardEvents();
   void disableKeyboardEvents();
+  // Wakes up the main loop waiting for events, e.g. when a result of
+  // background work is ready. Can be called from any thread.
+  void wakeUp();
+  // Returns a texture of the renderer to draw the image I with. Textures are
+  // kept per image and access type and reallocated only if the size or the
+  // format of the image changes.
+  SDL_Texture *getImageTexture(const Imguc &I, Uint32 format, int access);
+  // Records the input events handled by the main loop and the paint time of
+  // each tick to the session file fn until stopRecording() is called.
+  bool startRecording(const std::string &fn);
+  void stopRecording();
+  // Handles the events of a recorded session tick by tick, each followed by
+  // the paint of the tick, as fast as possible. The recorded and the replayed
+  // paint times of the ticks are written to reportFn if given and a summary
+  // to the standard output.
+  bool replay(const std::string &fn, const std::string &reportFn = "");
 
  protected:
   virtual bool paintEvent() = 0;
@@ -106,6 +138,11 @@ class MyWindow {
   void openGLDrawScreen(const Imguc &screenImg);
   void destroy();
   virtual bool mainTick();
+  void handleEvent(const SDL_Event &event, bool &quit);
+  // dispatches the coalesced motion events
+  void flushMotionEvents();
+  // waits at most timeoutMs for an event and handles it
+  void waitEvent(int timeoutMs, bool &quit);
 #ifdef __EMSCRIPTEN__
   static void mainTickEmscripten(void *data);
 #endif
@@ -119,7 +156,26 @@ class MyWindow {
   bool simulateMouseEventByTouch = true;
   std::set<int> currFingerIds;
   MyWindowGLData glData;
+  // Set when a frame should be painted. The main loop waits for events
+  // while it is false, so anything changing the picture outside of the event
+  // handlers has to set it and call wakeUp().
   bool repaint = true;
+  bool vsync = false;
+  Uint32 wakeUpEventType = 0;
+  // the loop wakes up periodically even without events
+  const int idleTimeoutMs = 100;
+  // frame rate cap when vsync is not available
+  const int minFrameMs = 8;
+  std::map<std::pair<const Imguc *, int>, MyWindowTexture> imageTextures;
+  int imageTexturesTick = 0;
+  std::unique_ptr<InputSessionRecorder> recorder;
+  // Motion events are coalesced within a tick into the latest one of the
+  // mouse and of each finger. They are dispatched before any other event,
+  // so the order relative to presses and releases is kept, and at the end
+  // of the tick.
+  bool mouseMotionPending = false;
+  MyMouseEvent pendingMouseMotion;
+  std::map<FingerId, MyFingerEvent> pendingFingerMotions;
 };
 
 #endif  // MYWINDOW_H
@@ -14,9 +14,13 @@
 
 #include "depthInfAlgs.h"
 
+#include <algorithm>
 #include <iostream>
 #include <set>
 
+#include "macros.h"
+#include "workerpool.h"
+
 using namespace std;
 using namespace Eigen;
 
@@ -150,6 +154,24 @@ void findTJunctions(const Image8 &segImg,
                  outAngles, angles);
 }
 
+// Number of distinct values in the 3x3 neighborhood of (x,y), the values are
+// stored in colors.
+static int neighborhoodColors(const Image8 &I, int x, int y, int colors[9]) {
+  int numColors = 0;
+  fora(wy, -1, 2) fora(wx, -1, 2) {
+    const int c = I(x + wx, y + wy, 0);
+    if (find(colors, colors + numColors, c) == colors + numColors) {
+      colors[numColors++] = c;
+    }
+  }
+  return numColors;
+}
+
+static WorkerPool &getDepthInfWorkerPool() {
+  static WorkerPool pool(WorkerPool::defaultNumThreads());
+  return pool;
+}
+
 void findTJunctions(const Image8 &segImg,
                     const std::vector<int> &bndToRegionId,
                     const std::vector<std::vector<Eigen::Vector2f>> &bnds,
@@ -161,9 +183,19 @@ void findTJunctions(const Image8 &segImg,
                     std::vector<float> &outAngles) {
   const Image8 &I = segImg;
 
-  // find T-junctions centroids and angles
-  forlist(k, bnds) {
+  // T-junctions found along a single boundary
+  struct BndTJunctions {
+    vector<pair<int, pair<int, float>>> edges;
+    vector<Vector2f> centroids;
+    vector<float> inAngles, outAngles, angles;
+  };
+  vector<BndTJunctions> results(bnds.size());
+
+  // find T-junctions centroids and angles, the boundaries are independent and
+  // processed in parallel
+  auto processBoundary = [&](const int k) {
     const int regionId = bndToRegionId[k];
+    BndTJunctions &res = results[k];
     vector<Vector2f> centroids;
     vector<int> centroidsBndId;
 
@@ -176,17 +208,8 @@ void findTJunctions(const Image8 &segImg,
 
       // Check 3x3 neighborhood for T-junctions, if there are subsequent
       // candidates, average them to find their centroid.
-      const int N = 1;
-      int numColors = 0;
-      vector<bool> visited(256, false);
-      fora(wy, -N, N + 1) fora(wx, -N, N + 1) {
-        const int i = I(x + wx, y + wy, 0);
-        if (!visited[i]) {
-          visited[i] = true;
-          numColors++;
-        }
-      }
-      if (numColors == 3) {
+      int colors[9];
+      if (neighborhoodColors(I, x, y, colors) == 3) {
         centroid += Vector2f(x, y);
         subseqNum++;
       } else {
@@ -201,7 +224,7 @@ void findTJunctions(const Image8 &segImg,
 
     if (centroids.empty()) {
       cout << "centroids empty" << endl;
-      continue;
+      return;
     }
 
     // Assign each centroid (which is a 2D point with float coordinates) the
@@ -240,28 +263,23 @@ void findTJunctions(const Image8 &segImg,
         int x = coord(0), y = coord(1);
         if (dist < maxDist) {
           // check 3x3 neighborhood for adjacent regions
-          const int N = 1;
-          vector<int> adjacentRegionIds;
-          vector<bool> visited(256, false);
-          fora(wy, -N, N + 1) fora(wx, -N, N + 1) {
-            const int i = I(x + wx, y + wy, 0);
-            if (!visited[i]) {
-              visited[i] = true;
-              adjacentRegionIds.push_back(i);
-            }
-          }
+          int adjacentRegionIds[9];
+          const int numAdjacent =
+              neighborhoodColors(I, x, y, adjacentRegionIds);
 
           // Only gather samples along boundary having 2 different regions on
           // both sides also neglect all samples withing radius of 3 of the
           // T-junction centroid (as in Palou '13).
-          if (adjacentRegionIds.size() == 2 && dist > 3) {
+          if (numAdjacent == 2 && dist > 3) {
             float ang = atan2(diff(1), diff(0));
             angles.push_back(ang);
             float weight = dist / maxDist;
             weight = weight * weight * weight;
             weights.push_back(weight);
-            for (const int id : adjacentRegionIds)
+            fora(a, 0, numAdjacent) {
+              const int id = adjacentRegionIds[a];
               if (id != regionId) allAdjRegionIds.insert(id);
+            }
           }
 
           return true;
@@ -323,82 +341,98 @@ void findTJunctions(const Image8 &segImg,
         if (id == 0) continue;   // skip background
         float sigma = M_PI / 6;  // Palou '13
         float prob = exp(-fabs(ang - M_PI) / (sigma * sigma));  // Palou '13
-        E[id].push_back(make_pair(regionId, prob));
+        res.edges.push_back(make_pair(id, make_pair(regionId, prob)));
       }
 
-      outCentroids.push_back(centroids[i]);
-      outInAngles.push_back(inAng);
-      outOutAngles.push_back(outAng);
-      outAngles.push_back(ang);
+      res.centroids.push_back(centroids[i]);
+      res.inAngles.push_back(inAng);
+      res.outAngles.push_back(outAng);
+      res.angles.push_back(ang);
+    }
+  };
+  getDepthInfWorkerPool().parallelFor(bnds.size(), 1, [&](int begin, int end) {
+    fora(k, begin, end) processBoundary(k);
+  });
+
+  // merge in the order of the boundaries, i.e. independently of scheduling
+  for (const BndTJunctions &res : results) {
+    for (const auto &e : res.edges) E[e.first].push_back(e.second);
+    outCentroids.insert(outCentroids.end(), res.centroids.begin(),
+                        res.centroids.end());
+    outInAngles.insert(outInAngles.end(), res.inAngles.begin(),
+                       res.inAngles.end());
+    outOutAngles.insert(outOutAngles.end(), res.outAngles.begin(),
+                        res.outAngles.end());
+    outAngles.insert(outAngles.end(), res.angles.begin(), res.angles.end());
+  }
+}
+
+DepthGraph::DepthGraph(
+    const std::map<int, std::list<std::pair<int, float>>> &E) {
+  // nodes are all sources and targets of edges in ascending order
+  for (const auto &el : E) {
+    nodes.push_back(el.first);
+    for (const auto &el2 : el.second) nodes.push_back(el2.first);
+  }
+  sort(nodes.begin(), nodes.end());
+  nodes.erase(unique(nodes.begin(), nodes.end()), nodes.end());
+
+  offsets.assign(nodes.size() + 1, 0);
+  for (const auto &el : E) offsets[index(el.first) + 1] = el.second.size();
+  forlist(i, nodes) offsets[i + 1] += offsets[i];
+  targets.resize(offsets.back());
+  weights.resize(offsets.back());
+  for (const auto &el : E) {
+    int j = offsets[index(el.first)];
+    for (const auto &el2 : el.second) {
+      targets[j] = index(el2.first);
+      weights[j] = el2.second;
+      j++;
     }
   }
 }
 
+int DepthGraph::index(int regionId) const {
+  const auto it = lower_bound(nodes.begin(), nodes.end(), regionId);
+  return it != nodes.end() && *it == regionId ? it - nodes.begin() : -1;
+}
+
 bool topologicalSort(
     const std::vector<int> &N,
-    const std::map<int, std::list<std::pair<int, float>>> &Eout2,
+    const std::map<int, std::list<std::pair<int, float>>> &Eout,
     std::vector<int> &NSorted) {
-  map<int, list<pair<int, float>>> Eout = Eout2;  // outgoing edges
-  map<int, list<int>> Ein;                        // incoming edges
-
-  // create Ein from Eout
-  for (const auto &el : Eout) {
-    const int n = el.first;
-    for (const pair<int, float> &el2 : el.second) {
-      const int m = el2.first;
-      Ein[m].push_back(n);
-    }
-  }
+  // Kahn's algorithm on the CSR form of the graph with counts of the
+  // remaining incoming edges
+  const DepthGraph G(Eout);
+  vector<int> inDegree(G.nodes.size(), 0);
+  for (const int m : G.targets) inDegree[m]++;
 
   vector<int> L;  // empty set at the beginning, sorted nodes at the end
   vector<int> S;  // all nodes having no incoming edges, i.e. start nodes
 
   // create S
   for (const int n : N) {
-    if (Ein.find(n) == Ein.end()) S.push_back(n);
+    const int i = G.index(n);
+    if (i == -1 || inDegree[i] == 0) S.push_back(n);
   }
 
+  int numRemoved = 0;
   while (!S.empty()) {
     const int n = S.back();
     S.pop_back();
     L.push_back(n);
-    // find all outgoing edges for node n, i.e. n->m edges
-    map<int, list<pair<int, float>>>::iterator itOut = Eout.find(n);
-    if (itOut != Eout.end()) {
-      list<pair<int, float>> &Eoutn = Eout[n];
-      for (list<pair<int, float>>::iterator it1 = Eoutn.begin();
-           it1 != Eoutn.end();) {
-        const int m = it1->first;
-        // remove the n->m edge from Eout
-        Eoutn.erase(it1++);
-        // find incoming edges for node m, i.e. l->m edges
-        bool emptyin = false;
-        map<int, list<int>>::iterator itIn = Ein.find(m);
-        if (itIn != Ein.end()) {
-          list<int> &Einm = itIn->second;
-          for (list<int>::iterator it2 = Einm.begin(); it2 != Einm.end();) {
-            const int l = *it2;
-            // remove the n->m edge from Ein
-            if (l == n)
-              Einm.erase(it2++);
-            else
-              it2++;
-          }
-          if (Einm.empty()) {
-            Ein.erase(itIn);
-            emptyin = true;
-          }
-        } else
-          emptyin = true;
-        if (emptyin) S.push_back(m);  // m has no other incoming edges
-      }
-      if (Eoutn.empty()) {
-        Eout.erase(itOut);
-      }
+    // remove all outgoing edges n->m of node n
+    const int i = G.index(n);
+    if (i == -1) continue;
+    fora(j, G.offsets[i], G.offsets[i + 1]) {
+      const int m = G.targets[j];
+      numRemoved++;
+      // m has no other incoming edges
+      if (--inDegree[m] == 0) S.push_back(G.nodes[m]);
     }
   }
 
-  if (!Eout.empty()) {
+  if (numRemoved < static_cast<int>(G.targets.size())) {
     cout << "oriented cycles exist" << endl;
     return false;
   }
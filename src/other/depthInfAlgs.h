@@ -21,6 +21,20 @@
 #include <map>
 #include <vector>
 
+// Directed graph of regions with weighted edges in compressed sparse row
+// form: edges leaving the node i go to targets[offsets[i]] ..
+// targets[offsets[i + 1] - 1], nodes are indices to the sorted region IDs.
+struct DepthGraph {
+  explicit DepthGraph(
+      const std::map<int, std::list<std::pair<int, float>>> &E);
+  // index of the node of the region or -1 if it has no edges
+  int index(int regionId) const;
+
+  std::vector<int> nodes;
+  std::vector<int> offsets, targets;
+  std::vector<float> weights;
+};
+
 void eliminateCycles(
     const std::map<int, std::list<std::pair<int, float>>> &Eout,
     const std::vector<int> &regionsIdsUniq,
@@ -0,0 +1,70 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "perfprofile.h"
+
+#include "commonStructs.h"
+
+using namespace std;
+
+namespace {
+
+// Draft halves the resolution of the outlines and makes the triangles four
+// times larger, final triangulates finer at the full resolution, where the
+// supernodal solvers pay off (see SupernodalLLT), and iterates the
+// deformation until it converges.
+const PerfSettings profiles[NUM_PERF_PROFILES] = {
+    {"pqa100QYY", "pqa400QYY", 4, 5, false, 2, false, false, 10, 0.005f},
+    {"pqa25QYY", "pqa100QYY", 2, 10, false, 4, false, false, 20, 0},
+    {"pqa10QYY", "pqa50QYY", 1, 10, true, 8, true, true, 20, 0},
+};
+
+const char *names[NUM_PERF_PROFILES] = {"draft", "interactive", "final"};
+
+}  // namespace
+
+const PerfSettings &perfSettings(PerfProfile profile) {
+  return profiles[profile];
+}
+
+const char *perfProfileName(PerfProfile profile) { return names[profile]; }
+
+bool perfProfileFromName(const std::string &name, PerfProfile &profile) {
+  for (int i = 0; i < NUM_PERF_PROFILES; i++) {
+    if (name == names[i]) {
+      profile = static_cast<PerfProfile>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+void applyPerfProfile(PerfProfile profile, RecData &recData,
+                      ShadingOptions &shadingOpts) {
+  const PerfSettings &s = perfSettings(profile);
+  recData.perfProfile = profile;
+  recData.triangleOpts = s.triangleOpts;
+  recData.previewTriangleOpts = s.previewTriangleOpts;
+  recData.subsFactor = s.subsFactor;
+  recData.smoothFactor = s.smoothFactor;
+  recData.supernodalSolver = s.supernodalSolver;
+  shadingOpts.normalSmoothingIters = s.normalSmoothingIters;
+}
+
+void applyPerfProfile(PerfProfile profile, DefData &defData) {
+  const PerfSettings &s = perfSettings(profile);
+  defData.defEngMaxIter = s.defEngMaxIter;
+  defData.defEngSupernodal = s.defEngSupernodal;
+  defData.defEngConvergenceControl = s.defEngConvergenceControl;
+}
@@ -0,0 +1,67 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PERFPROFILE_H
+#define PERFPROFILE_H
+
+#include <string>
+
+struct RecData;
+struct DefData;
+struct ShadingOptions;
+
+// Presets of the settings that trade quality for speed, saved with the
+// project settings (see loadsave.h) so an asset is reconstructed, deformed,
+// shaded and exported the same way by everyone working on it. The
+// interactive profile has the defaults of RecData, DefData and
+// ShadingOptions.
+enum PerfProfile {
+  PERF_PROFILE_DRAFT,
+  PERF_PROFILE_INTERACTIVE,
+  PERF_PROFILE_FINAL,
+  NUM_PERF_PROFILES
+};
+
+struct PerfSettings {
+  // reconstruction (RecData)
+  std::string triangleOpts;
+  std::string previewTriangleOpts;
+  int subsFactor;
+  int smoothFactor;
+  bool supernodalSolver;
+  // deformation (DefData), the adaptive quality lowers the iterations
+  // further while the frames are slow (see QualityGovernor)
+  int defEngMaxIter;
+  bool defEngSupernodal;
+  bool defEngConvergenceControl;
+  // rendering (ShadingOptions)
+  int normalSmoothingIters;
+  // export (see ExportGltf::keyframeTolerance)
+  float exportKeyframeTolerance;
+};
+
+const PerfSettings &perfSettings(PerfProfile profile);
+// the name in the project settings, e.g. "draft"
+const char *perfProfileName(PerfProfile profile);
+// false for an unknown name
+bool perfProfileFromName(const std::string &name, PerfProfile &profile);
+
+// Sets the settings of profile and recData.perfProfile. The deformation ones
+// are used by the next reconstruction (see applyReconstruction()), the
+// reconstruction ones change its inputs, so it is redone.
+void applyPerfProfile(PerfProfile profile, RecData &recData,
+                      ShadingOptions &shadingOpts);
+void applyPerfProfile(PerfProfile profile, DefData &defData);
+
+#endif  // PERFPROFILE_H
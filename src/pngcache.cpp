@@ -0,0 +1,50 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "pngcache.h"
+
+#include <cstdlib>
+#include <fstream>
+
+#include "animcache.h"
+
+using namespace std;
+
+const vector<unsigned char> &PNGCache::get(const Imguc &I) {
+  uint64_t h = AnimCache::hashInit;
+  const int size[3] = {I.w, I.h, I.ch};
+  h = AnimCache::hash(h, size, sizeof(size));
+  if (!I.isNull()) h = AnimCache::hash(h, I.data, I.w * I.h * I.ch);
+  if (valid && h == key) return data;
+
+  data.clear();
+  unsigned char *pngData = nullptr;
+  int length = 0;
+  if (!I.isNull() && I.savePNG(pngData, length)) {
+    data.assign(pngData, pngData + length);
+    free(pngData);
+  }
+  key = h;
+  valid = true;
+  return data;
+}
+
+bool PNGCache::save(const Imguc &I, const string &fn) {
+  const vector<unsigned char> &png = get(I);
+  if (png.empty()) return false;
+  ofstream stream(fn, ios::binary);
+  stream.write(reinterpret_cast<const char *>(png.data()), png.size());
+  return stream.good();
+}
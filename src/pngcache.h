@@ -0,0 +1,40 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PNGCACHE_H
+#define PNGCACHE_H
+
+#include <image/image.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The PNG encoding of the last image passed to get(), reused as long as the
+// image content (hashed, see AnimCache::hash) doesn't change. Encoding a
+// large template image takes far longer than hashing it.
+class PNGCache {
+ public:
+  // empty if the image is null or can't be encoded
+  const std::vector<unsigned char> &get(const Imguc &I);
+  bool save(const Imguc &I, const std::string &fn);
+
+ private:
+  std::uint64_t key = 0;
+  bool valid = false;
+  std::vector<unsigned char> data;
+};
+
+#endif  // PNGCACHE_H
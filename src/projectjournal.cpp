@@ -0,0 +1,239 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "projectjournal.h"
+
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <unordered_map>
+#include <utility>
+
+#include "animcache.h"
+#include "binarychunks.h"
+#include "loadsave.h"
+#include "macros.h"
+#include "rlecodec.h"
+
+using namespace std;
+
+namespace {
+
+const char journalMagic[4] = {'M', 'M', 'J', 'N'};
+const uint32_t journalVersion = 1;
+
+void parallelFor(WorkerPool *pool, int n,
+                 const function<void(int, int)> &body) {
+  if (pool != nullptr)
+    pool->parallelFor(n, 1, body);
+  else
+    body(0, n);
+}
+
+// an image or its absence
+void writeImage(BinaryWriter &writer, const Imguc &I) {
+  writer.writeU32(!I.isNull());
+  if (!I.isNull()) encodeRLE(I, writer);
+}
+
+void writeImage(BinaryWriter &writer, const TiledImage &I) {
+  writer.writeU32(!I.isNull());
+  if (!I.isNull()) encodeRLE(I, writer);
+}
+
+bool readImage(BinaryReader &reader, Imguc &I) {
+  const uint32_t present = reader.readU32();
+  if (!reader.ok()) return false;
+  if (!present) {
+    I.setNull();
+    return true;
+  }
+  return decodeRLE(reader, I);
+}
+
+}  // namespace
+
+bool ProjectJournal::append(const std::string &fn, CPData &cpData,
+                            DefData &defData, ImgData &imgData,
+                            RecData &recData, const std::string &savedCPs,
+                            const Imguc &templateImg,
+                            const Imguc &backgroundImg,
+                            ShadingOptions &shadingOpts,
+                            ManipulationMode &manipulationMode,
+                            bool middleMouseSimulation, WorkerPool *pool) {
+  const auto &regionImgs = imgData.regionImgs;
+  // the layers were cleared without reset()
+  if (regionImgs.size() < layerStates.size()) reset();
+  const bool start = !started;
+
+  // the layers whose images in the journal are not the current ones
+  vector<int> changed;
+  forlist(regId, regionImgs) {
+    const char state =
+        regId < layerStates.size() ? layerStates[regId] : notJournaled;
+    const bool removed = regionImgs[regId].isNull();
+    if (removed ? state != journaledRemoved
+                : state != journaledImages || modifiedLayers.count(regId)) {
+      changed.push_back(regId);
+    }
+  }
+  vector<BinaryWriter> layerRecords(changed.size());
+  parallelFor(pool, changed.size(), [&](int begin, int end) {
+    fora(i, begin, end) {
+      const int regId = changed[i];
+      BinaryWriter &writer = layerRecords[i];
+      writer.beginChunk("LIMG");
+      writer.writeI32(regId);
+      writeImage(writer, imgData.outlineImgs[regId]);
+      writeImage(writer, regionImgs[regId]);
+      writer.endChunk();
+    }
+  });
+
+  string project;
+  saveProjectToBinary(project, cpData, defData, imgData, recData, savedCPs,
+                      shadingOpts, manipulationMode, middleMouseSimulation);
+  const uint64_t hash =
+      AnimCache::hash(AnimCache::hashInit, project.data(), project.size());
+  const bool projectChanged = start || hash != projectHash;
+  const bool imagesChanged = start || imagesModified;
+  if (changed.empty() && !projectChanged && !imagesChanged) return true;
+
+  BinaryWriter writer = start ? BinaryWriter(journalMagic, journalVersion)
+                              : BinaryWriter();
+  for (const auto &record : layerRecords) {
+    writer.writeBytes(record.data().data(), record.data().size());
+  }
+  if (imagesChanged) {
+    writer.beginChunk("IMGS");
+    writeImage(writer, templateImg);
+    writeImage(writer, backgroundImg);
+    writer.endChunk();
+  }
+  if (projectChanged) {
+    writer.beginChunk("PROJ");
+    writer.writeBytes(project.data(), project.size());
+    writer.endChunk();
+  }
+  writer.beginChunk("DONE");
+  writer.endChunk();
+
+  ofstream stream(fn, ios::binary | (start ? ios::trunc : ios::app));
+  const string &data = writer.data();
+  stream.write(data.data(), data.size());
+  stream.close();
+  if (!stream) {
+    DEBUG_CMD_MM(cout << "ProjectJournal: failed to write " << fn << endl;);
+    // a partially written append would break the following ones
+    reset();
+    return false;
+  }
+
+  started = true;
+  layerStates.resize(regionImgs.size(), notJournaled);
+  for (const int regId : changed) {
+    layerStates[regId] =
+        regionImgs[regId].isNull() ? journaledRemoved : journaledImages;
+  }
+  modifiedLayers.clear();
+  imagesModified = false;
+  projectHash = hash;
+  return true;
+}
+
+void ProjectJournal::markLayerModified(int regId) {
+  modifiedLayers.insert(regId);
+}
+
+void ProjectJournal::markImagesModified() { imagesModified = true; }
+
+void ProjectJournal::reset() {
+  started = false;
+  layerStates.clear();
+  modifiedLayers.clear();
+  imagesModified = false;
+}
+
+bool loadProjectJournal(const std::string &fn, const int viewportW,
+                        const int viewportH, CPData &cpData, ImgData &imgData,
+                        RecData &recData, std::string &savedCPs,
+                        Imguc &templateImg, Imguc &backgroundImg,
+                        ShadingOptions &shadingOpts,
+                        ManipulationMode &manipulationMode,
+                        bool &middleMouseSimulation, WorkerPool *pool) {
+  ifstream stream(fn, ios::binary);
+  const string data((istreambuf_iterator<char>(stream)),
+                    istreambuf_iterator<char>());
+  BinaryReader reader(data.data(), data.size());
+  uint32_t version;
+  if (!reader.readHeader(journalMagic, version) || version > journalVersion) {
+    DEBUG_CMD_MM(cout << "loadProjectJournal: unsupported " << fn << endl;);
+    return false;
+  }
+
+  // the latest records of the complete appends, only these are decoded
+  unordered_map<int, BinaryReader> layers, pendingLayers;
+  BinaryReader images, project, pendingImages, pendingProject;
+  char tag[4];
+  BinaryReader chunk;
+  while (!reader.atEnd() && reader.readChunk(tag, chunk)) {
+    const string tagStr(tag, 4);
+    if (tagStr == "LIMG") {
+      const int regId = chunk.readI32();
+      if (chunk.ok()) pendingLayers[regId] = chunk;
+    } else if (tagStr == "IMGS") {
+      pendingImages = chunk;
+    } else if (tagStr == "PROJ") {
+      pendingProject = chunk;
+    } else if (tagStr == "DONE") {
+      for (const auto &it : pendingLayers) layers[it.first] = it.second;
+      pendingLayers.clear();
+      if (pendingImages.remaining() > 0) images = pendingImages;
+      if (pendingProject.remaining() > 0) project = pendingProject;
+      pendingImages = pendingProject = BinaryReader();
+    }
+  }
+  if (project.remaining() == 0) {
+    DEBUG_CMD_MM(cout << "loadProjectJournal: no project in " << fn << endl;);
+    return false;
+  }
+
+  vector<pair<int, BinaryReader>> records(layers.begin(), layers.end());
+  vector<pair<Imguc, Imguc>> decoded(records.size());
+  vector<char> valid(records.size());
+  parallelFor(pool, records.size(), [&](int begin, int end) {
+    fora(i, begin, end) {
+      // removed layers are not among the layers of the project
+      BinaryReader &record = records[i].second;
+      valid[i] = readImage(record, decoded[i].first) &&
+                 readImage(record, decoded[i].second) &&
+                 !decoded[i].second.isNull();
+    }
+  });
+  unordered_map<int, pair<Imguc, Imguc>> layerImgs;
+  forlist(i, records) {
+    if (valid[i]) layerImgs[records[i].first] = decoded[i];
+  }
+
+  if (!readImage(images, templateImg) || !readImage(images, backgroundImg)) {
+    templateImg.setNull();
+    backgroundImg.setNull();
+  }
+  const size_t n = project.remaining();
+  const string projectData(project.readBytes(n), n);
+  return loadProjectFromBinary(projectData, layerImgs, viewportW, viewportH,
+                               cpData, imgData, recData, savedCPs, shadingOpts,
+                               manipulationMode, middleMouseSimulation, pool);
+}
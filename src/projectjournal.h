@@ -0,0 +1,74 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PROJECTJOURNAL_H
+#define PROJECTJOURNAL_H
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "commonStructs.h"
+#include "workerpool.h"
+
+// Autosave of a project as an append-only journal, so that saving every few
+// seconds costs only the changes. Each append() adds the images of the layers
+// created, removed or marked modified since the last one, the template and
+// the background image if marked modified and the project data (the layer
+// order, the settings and the control points, see saveProjectToBinary())
+// if it changed. The layer images are run-length coded (see rlecodec.h).
+//
+// The journal is a file of binary chunks (see binarychunks.h), every append
+// ends with a DONE chunk and an interrupted one is ignored when the journal
+// is loaded. It is written from scratch by the first append() after reset(),
+// which is how it gets compacted.
+class ProjectJournal {
+ public:
+  bool append(const std::string &fn, CPData &cpData, DefData &defData,
+              ImgData &imgData, RecData &recData, const std::string &savedCPs,
+              const Imguc &templateImg, const Imguc &backgroundImg,
+              ShadingOptions &shadingOpts, ManipulationMode &manipulationMode,
+              bool middleMouseSimulation, WorkerPool *pool = nullptr);
+  // The images of the layer regId were modified in place. Created and
+  // removed layers are found without it.
+  void markLayerModified(int regId);
+  // the template or the background image changed
+  void markImagesModified();
+  // the next append() starts a new journal, e.g. when another project is
+  // opened
+  void reset();
+
+ private:
+  enum LayerState : char { notJournaled, journaledImages, journaledRemoved };
+  bool started = false;
+  std::vector<char> layerStates;  // per region ID
+  std::set<int> modifiedLayers;
+  bool imagesModified = false;
+  std::uint64_t projectHash = 0;
+};
+
+// Loads the project from the journal fn written by ProjectJournal, the layer
+// images are decoded in parallel on pool if given.
+bool loadProjectJournal(const std::string &fn, const int viewportW,
+                        const int viewportH, CPData &cpData, ImgData &imgData,
+                        RecData &recData, std::string &savedCPs,
+                        Imguc &templateImg, Imguc &backgroundImg,
+                        ShadingOptions &shadingOpts,
+                        ManipulationMode &manipulationMode,
+                        bool &middleMouseSimulation,
+                        WorkerPool *pool = nullptr);
+
+#endif  // PROJECTJOURNAL_H
@@ -0,0 +1,221 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Generator of synthetic projects for stress testing the reconstruction and
+// the deformation with more layers, overlaps and boundary detail than the
+// drawn projects have. Every layer is a star-shaped blob: a circle whose
+// radius is modulated by a few harmonics of random phase, outlined by a
+// stroke. The blobs are placed at random over the canvas and sized so that
+// their total area is the given multiple of the canvas area.
+//
+// The project is written as a directory of _org_NNN.png and _seg_NNN.png
+// images with layers.txt (as loadAllFromDir() reads it) or, if the output
+// ends with .zip, as a project zip for monstermash-bench and
+// monstermash-batch.
+//
+// monstermash-gen [options] output
+//   -n n       number of layers (default 10, at most 1000)
+//   -s WxH     canvas size (default 1000x800)
+//   -d x       overlap density, the total area of the layers relative to
+//              the canvas (default 1)
+//   -c n       boundary complexity, the number of harmonics modulating the
+//              outline (default 3, 0 for circles)
+//   -w n       stroke width in pixels (default 3)
+//   -r n       seed of the random numbers (default 1)
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "commonStructs.h"
+#include "loadsave.h"
+#include "macros.h"
+#include "workerpool.h"
+
+using namespace std;
+
+namespace {
+
+struct GenOptions {
+  int layers = 10;
+  int w = 1000, h = 800;
+  double density = 1;
+  int complexity = 3;
+  int strokeWidth = 3;
+  unsigned int seed = 1;
+  string output;
+};
+
+// the layer images are numbered with three digits
+const int maxLayers = 1000;
+
+void printUsage(const char *name) {
+  cerr << "usage: " << name
+       << " [-n layers] [-s WxH] [-d density] [-c complexity] [-w width] "
+          "[-r seed] output[.zip]"
+       << endl;
+}
+
+bool parseArgs(int argc, char *argv[], GenOptions &opts) {
+  fora(i, 1, argc) {
+    const string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "-n" && hasValue) {
+      opts.layers = atoi(argv[++i]);
+      if (opts.layers < 1 || opts.layers > maxLayers) return false;
+    } else if (arg == "-s" && hasValue) {
+      if (sscanf(argv[++i], "%dx%d", &opts.w, &opts.h) != 2 || opts.w < 16 ||
+          opts.h < 16) {
+        return false;
+      }
+    } else if (arg == "-d" && hasValue) {
+      opts.density = atof(argv[++i]);
+      if (opts.density <= 0) return false;
+    } else if (arg == "-c" && hasValue) {
+      opts.complexity = max(atoi(argv[++i]), 0);
+    } else if (arg == "-w" && hasValue) {
+      opts.strokeWidth = max(atoi(argv[++i]), 1);
+    } else if (arg == "-r" && hasValue) {
+      opts.seed = strtoul(argv[++i], nullptr, 10);
+    } else if (!arg.empty() && arg[0] == '-') {
+      return false;
+    } else if (opts.output.empty()) {
+      opts.output = arg;
+    } else {
+      return false;
+    }
+  }
+  return !opts.output.empty();
+}
+
+// r(angle) = radius * (1 + sum of amplitude * sin(frequency * angle + phase))
+struct Blob {
+  double cx, cy, radius;
+  vector<double> frequencies, amplitudes, phases;
+
+  // approximate signed distance of the point (dx, dy) relative to the
+  // center from the boundary, negative inside
+  double distance(double dx, double dy) const {
+    const double angle = atan2(dy, dx);
+    double r = 1, dr = 0;
+    forlist(k, frequencies) {
+      const double a = frequencies[k] * angle + phases[k];
+      r += amplitudes[k] * sin(a);
+      dr += amplitudes[k] * frequencies[k] * cos(a);
+    }
+    // the radial distance shortened by the slope of the boundary
+    return (sqrt(dx * dx + dy * dy) - radius * r) * r / sqrt(r * r + dr * dr);
+  }
+};
+
+Blob randomBlob(const GenOptions &opts, mt19937 &rng) {
+  uniform_real_distribution<double> uniform(0, 1);
+  Blob blob;
+  // the layers together cover density times the canvas
+  blob.radius = sqrt(opts.density * opts.w * opts.h / (opts.layers * M_PI));
+  blob.radius = min(blob.radius, 0.45 * min(opts.w, opts.h));
+  // the harmonics move the boundary by at most half of the radius
+  fora(k, 0, opts.complexity) {
+    blob.frequencies.push_back(
+        floor(2 + uniform(rng) * (2 + 2 * opts.complexity)));
+    blob.amplitudes.push_back(0.5 / opts.complexity * (0.5 + uniform(rng)));
+    blob.phases.push_back(2 * M_PI * uniform(rng));
+  }
+  // whole blobs stay inside the canvas
+  const double margin = 1.5 * blob.radius + opts.strokeWidth;
+  blob.cx = margin + uniform(rng) * max(opts.w - 2 * margin, 0.0);
+  blob.cy = margin + uniform(rng) * max(opts.h - 2 * margin, 0.0);
+  return blob;
+}
+
+// The region image is 255 inside the outline including the stroke, the
+// outline image 0 on the stroke, both as drawn in the application.
+void rasterize(const Blob &blob, const GenOptions &opts, Imguc &region,
+               Imguc &outline) {
+  region = Imguc(opts.w, opts.h, 1);
+  outline = Imguc(opts.w, opts.h, 1);
+  region.fill(0);
+  outline.fill(255);
+  const double halfStroke = 0.5 * opts.strokeWidth;
+  const double maxR = 1.5 * blob.radius + halfStroke;
+  const int x0 = max<int>(0, floor(blob.cx - maxR));
+  const int x1 = min<int>(opts.w, ceil(blob.cx + maxR));
+  const int y0 = max<int>(0, floor(blob.cy - maxR));
+  const int y1 = min<int>(opts.h, ceil(blob.cy + maxR));
+  fora(y, y0, y1) fora(x, x0, x1) {
+    const double d = blob.distance(x + 0.5 - blob.cx, y + 0.5 - blob.cy);
+    if (d < halfStroke) region(x, y, 0) = 255;
+    if (abs(d) < halfStroke) outline(x, y, 0) = 0;
+  }
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  GenOptions opts;
+  if (!parseArgs(argc, argv, opts)) {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  // the blobs are drawn from a single sequence, so the project depends only
+  // on the options and not on the number of threads
+  mt19937 rng(opts.seed);
+  vector<Blob> blobs;
+  fora(i, 0, opts.layers) blobs.push_back(randomBlob(opts, rng));
+
+  WorkerPool pool(WorkerPool::defaultNumThreads());
+  ImgData imgData;
+  imgData.regionImgs.resize(opts.layers);
+  imgData.outlineImgs.resize(opts.layers);
+  pool.parallelFor(opts.layers, 1, [&](int begin, int end) {
+    fora(i, begin, end) {
+      Imguc region, outline;
+      rasterize(blobs[i], opts, region, outline);
+      imgData.regionImgs[i] = TiledImage(region, 0);
+      imgData.outlineImgs[i] = TiledImage(outline, 255);
+    }
+  });
+  fora(i, 0, opts.layers) imgData.layers.push_back(i);
+
+  CPData cpData;
+  DefData defData;
+  RecData recData;
+  ManipulationMode manipulationMode;
+  const string &out = opts.output;
+  if (out.size() > 4 && out.compare(out.size() - 4, 4, ".zip") == 0) {
+    ShadingOptions shadingOpts;
+    saveAllToZip(out, cpData, defData, imgData, recData, "", Imguc(), Imguc(),
+                 shadingOpts, manipulationMode, false, false, &pool);
+  } else {
+    error_code error;
+    filesystem::create_directories(out, error);
+    if (error) {
+      cerr << "cannot create " << out << ": " << error.message() << endl;
+      return 1;
+    }
+    saveAllToDir(out, manipulationMode, "", cpData, defData, imgData, recData,
+                 &pool);
+  }
+  cout << out << ": " << opts.layers << " layers, " << opts.w << "x" << opts.h
+       << endl;
+  return 0;
+}
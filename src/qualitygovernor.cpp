@@ -0,0 +1,83 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "qualitygovernor.h"
+
+#include <miscutils/macros.h>
+
+#include <algorithm>
+
+using namespace std;
+
+void QualityGovernor::frameFinished(const FrameProfiler::Frame &frame) {
+  if (!enabled) return;
+  typedef FrameProfiler P;
+  const double knobMs[NUM_KNOBS] = {
+      frame.ms[P::DEFORMATION],
+      frame.ms[P::NORMALS] + frame.ms[P::GL_UPLOAD] + frame.ms[P::DRAW]};
+  const double alpha = numFrames == 0 ? 1 : 0.2;
+  avgMs += alpha * (frame.totalMs - avgMs);
+  fora(k, 0, NUM_KNOBS) avgKnobMs[k] += alpha * (knobMs[k] - avgKnobMs[k]);
+  numFrames++;
+  sinceChange++;
+  sinceRaise++;
+  // a raise that held for the whole wait lets the next one come sooner
+  if (sinceRaise == raiseHold) raiseHold = max(raiseHold / 2, minRaiseHold);
+
+  // the average needs a few frames to show the effect of a change
+  if (sinceChange < settleFrames) return;
+  if (avgMs > 1.1 * budgetMs) {
+    int knob = -1;
+    fora(k, 0, NUM_KNOBS) {
+      if (levels[k] < maxLevel &&
+          (knob == -1 || avgKnobMs[k] > avgKnobMs[knob])) {
+        knob = k;
+      }
+    }
+    if (knob == -1) return;
+    levels[knob]++;
+    sinceChange = 0;
+    if (sinceRaise < raiseHold) raiseHold = min(2 * raiseHold, maxRaiseHold);
+  } else if (avgMs < 0.6 * budgetMs && sinceChange >= raiseHold) {
+    // the shading first on a tie, it is the cheaper one
+    const int knob = levels[DEFORMATION] > levels[SHADING] ? DEFORMATION
+                                                            : SHADING;
+    if (levels[knob] == 0) return;
+    levels[knob]--;
+    sinceChange = sinceRaise = 0;
+  }
+}
+
+void QualityGovernor::reset() {
+  fill(levels, levels + NUM_KNOBS, 0);
+  numFrames = 0;
+  sinceChange = 0;
+  sinceRaise = maxRaiseHold;
+  raiseHold = minRaiseHold;
+}
+
+bool QualityGovernor::lowered() const {
+  return levels[DEFORMATION] > 0 || levels[SHADING] > 0;
+}
+
+QualityGovernor::Settings QualityGovernor::apply(const Settings &full) const {
+  Settings s = full;
+  const int d = levels[DEFORMATION], sh = levels[SHADING];
+  s.defEngMaxIter = max(full.defEngMaxIter >> d, 1);
+  if (d == maxLevel) s.tempSmoothingSteps = 0;
+  s.normalSmoothingIters = sh == maxLevel ? 0 : full.normalSmoothingIters >> sh;
+  s.textureShading = full.textureShading && sh < 2;
+  return s;
+}
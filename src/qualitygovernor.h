@@ -0,0 +1,69 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef QUALITYGOVERNOR_H
+#define QUALITYGOVERNOR_H
+
+#include "frameprofiler.h"
+
+// Lowers the quality of the interactive frames when they take longer than a
+// budget and raises it back when they are fast again.
+//
+// There are two knobs with levels 0 (full quality) to maxLevel: the
+// deformation (iterations per frame and temporal smoothing) and the shading
+// (normal smoothing iterations and texture shading). When the average frame
+// time is over the budget the knob whose stages took longer is lowered by a
+// level. When it is well below the budget the more lowered knob is raised,
+// but only after the frames stayed fast for a while, and that wait doubles
+// every time a raise had to be taken back soon after, so the levels do not
+// oscillate around the budget.
+class QualityGovernor {
+ public:
+  enum Knob { DEFORMATION, SHADING, NUM_KNOBS };
+  static constexpr int maxLevel = 3;
+
+  // the quality settings controlled by the knobs
+  struct Settings {
+    int defEngMaxIter = 1;
+    int tempSmoothingSteps = 0;
+    int normalSmoothingIters = 0;
+    bool textureShading = true;
+  };
+
+  bool enabled = false;
+  double budgetMs = 16;
+
+  // timings of the frame just finished, ignored unless enabled
+  void frameFinished(const FrameProfiler::Frame &frame);
+  // full quality, e.g. for stills and exports
+  void reset();
+  int level(Knob knob) const { return levels[knob]; }
+  bool lowered() const;
+  // the settings of the current levels for the full quality ones
+  Settings apply(const Settings &full) const;
+
+ private:
+  static constexpr int settleFrames = 8;
+  static constexpr int minRaiseHold = 30, maxRaiseHold = 480;
+
+  int levels[NUM_KNOBS] = {};
+  // exponential moving averages of the frame and of the stages of each knob
+  double avgMs = 0, avgKnobMs[NUM_KNOBS] = {};
+  int numFrames = 0;
+  int sinceChange = 0, sinceRaise = maxRaiseHold;
+  int raiseHold = minRaiseHold;
+};
+
+#endif  // QUALITYGOVERNOR_H
@@ -0,0 +1,93 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reccache.h"
+
+using namespace std;
+using namespace Eigen;
+
+void RecCache::beginReconstruction() {
+  // keep only the entries used by the previous reconstruction
+  for (auto it = triangulations.begin(); it != triangulations.end();) {
+    it = it->second.generation < generation ? triangulations.erase(it)
+                                            : next(it);
+  }
+  for (auto it = inflations.begin(); it != inflations.end();) {
+    it = it->second.generation < generation ? inflations.erase(it) : next(it);
+  }
+  for (auto it = inflationSolvers.begin(); it != inflationSolvers.end();) {
+    it = it->second.generation < generation ? inflationSolvers.erase(it)
+                                            : next(it);
+  }
+  generation++;
+}
+
+void RecCache::clear() {
+  triangulations.clear();
+  inflations.clear();
+  inflationSolvers.clear();
+}
+
+bool RecCache::getTriangulation(uint64_t key, MatrixXd &V, MatrixXi &F) {
+  if (!enabled) return false;
+  auto it = triangulations.find(key);
+  if (it == triangulations.end()) return false;
+  it->second.generation = generation;
+  V = it->second.V;
+  F = it->second.F;
+  return true;
+}
+
+void RecCache::putTriangulation(uint64_t key, const MatrixXd &V,
+                                const MatrixXi &F) {
+  if (!enabled) return;
+  Triangulation &t = triangulations[key];
+  t.V = V;
+  t.F = F;
+  t.generation = generation;
+}
+
+bool RecCache::getInflation(uint64_t key, VectorXd &z) {
+  if (!enabled) return false;
+  auto it = inflations.find(key);
+  if (it == inflations.end()) return false;
+  it->second.generation = generation;
+  z = it->second.z;
+  return true;
+}
+
+void RecCache::putInflation(uint64_t key, const VectorXd &z) {
+  if (!enabled) return;
+  Inflation &inf = inflations[key];
+  inf.z = z;
+  inf.generation = generation;
+}
+
+shared_ptr<const RecCache::SolverData> RecCache::getInflationSolver(
+    uint64_t key) {
+  if (!enabled) return nullptr;
+  auto it = inflationSolvers.find(key);
+  if (it == inflationSolvers.end()) return nullptr;
+  it->second.generation = generation;
+  return it->second.data;
+}
+
+void RecCache::putInflationSolver(uint64_t key,
+                                  const shared_ptr<const SolverData> &data) {
+  if (!enabled) return;
+  Solver &solver = inflationSolvers[key];
+  solver.data = data;
+  solver.generation = generation;
+}
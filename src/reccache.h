@@ -0,0 +1,67 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef RECCACHE_H
+#define RECCACHE_H
+
+#include <Eigen/Dense>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+
+// Results of the per-region steps of the reconstruction (triangulation and
+// inflation) keyed by a hash of their inputs, so that regions whose drawing
+// did not change are not processed again. The factorizations of the
+// inflation systems are kept as well, they do not depend on the inflation
+// amount. Entries not used during the last reconstruction are dropped when
+// the next one begins.
+class RecCache {
+ public:
+  void beginReconstruction();
+  void clear();
+  bool getTriangulation(std::uint64_t key, Eigen::MatrixXd &V,
+                        Eigen::MatrixXi &F);
+  void putTriangulation(std::uint64_t key, const Eigen::MatrixXd &V,
+                        const Eigen::MatrixXi &F);
+  bool getInflation(std::uint64_t key, Eigen::VectorXd &z);
+  void putInflation(std::uint64_t key, const Eigen::VectorXd &z);
+  struct SolverData;  // defined by the reconstruction
+  std::shared_ptr<const SolverData> getInflationSolver(std::uint64_t key);
+  void putInflationSolver(std::uint64_t key,
+                          const std::shared_ptr<const SolverData> &data);
+
+  bool enabled = true;
+
+ private:
+  struct Triangulation {
+    Eigen::MatrixXd V;
+    Eigen::MatrixXi F;
+    int generation = 0;
+  };
+  struct Inflation {
+    Eigen::VectorXd z;
+    int generation = 0;
+  };
+  std::unordered_map<std::uint64_t, Triangulation> triangulations;
+  std::unordered_map<std::uint64_t, Inflation> inflations;
+  struct Solver {
+    std::shared_ptr<const SolverData> data;
+    int generation = 0;
+  };
+  std::unordered_map<std::uint64_t, Solver> inflationSolvers;
+  int generation = 0;
+};
+
+#endif  // RECCACHE_H
@@ -19,15 +19,40 @@
 #include <igl/invert_diag.h>
 #include <igl/massmatrix.h>
 #include <igl/min_quad_with_fixed.h>
+#include <igl/parallel_for.h>
+#include <igl/vertex_components.h>
 #include <image/imageUtils.h>
 #include <ir3d-utils/MeshBuilder.h>
 #include <ir3d-utils/regionToMesh.h>
 
 #include <Eigen/Core>
 #include <Eigen/Sparse>
-
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "animcache.h"
+#include "bitmask.h"
+#include "cdtmesher.h"
 #include "loadsave.h"
 #include "macros.h"
+#include "memorystats.h"
+#include "recremote.h"
+#include "supernodalllt.h"
+#include "tracing.h"
+#include "workerpool.h"
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten/heap.h>
+#elif defined(__linux__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
 
 #define ENABLE_MERGING_COMMON_BOUNDARY_IN_PREPROCESS
 
@@ -35,6 +60,254 @@ using namespace std;
 using namespace Eigen;
 using namespace igl;
 
+double RecStats::totalMs() const {
+  double ms = 0;
+  for (const auto &stage : stages) ms += stage.ms;
+  return ms;
+}
+
+string RecStats::toJSON() const {
+  ostringstream oss;
+  oss << "{\"totalMs\":" << totalMs() << ",\"stages\":[";
+  forlist(i, stages) {
+    const RecStageStats &stage = stages[i];
+    if (i > 0) oss << ",";
+    oss << "{\"name\":\"" << stage.name << "\",\"ms\":" << stage.ms
+        << ",\"peakMemory\":" << stage.peakMemory
+        << ",\"vertices\":" << stage.vertices
+        << ",\"faces\":" << stage.faces << "}";
+  }
+  oss << "]}";
+  return oss.str();
+}
+
+// peak memory used by the process (the size of the heap in the Emscripten
+// build, it only grows), 0 if not available
+static size_t peakMemoryBytes() {
+#if defined(__EMSCRIPTEN__)
+  return emscripten_get_heap_size();
+#elif defined(__linux__) || defined(__APPLE__)
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+  return usage.ru_maxrss;  // bytes
+#else
+  return static_cast<size_t>(usage.ru_maxrss) * 1024;  // kilobytes
+#endif
+#else
+  return 0;
+#endif
+}
+
+// Records consecutive stages, each one ends with a call of next(). The
+// stages are also recorded as trace events.
+class RecStageTimer {
+ public:
+  explicit RecStageTimer(RecStats &stats)
+      : stats(stats), start(chrono::steady_clock::now()) {}
+
+  void next(const string &name, int vertices = 0, int faces = 0) {
+    const auto now = chrono::steady_clock::now();
+    traceEvent(name, start, now);
+    RecStageStats stage;
+    stage.name = name;
+    stage.ms = chrono::duration<double, milli>(now - start).count();
+    stage.peakMemory = peakMemoryBytes();
+    sampleMemoryPeak();
+    stage.vertices = vertices;
+    stage.faces = faces;
+    stats.stages.push_back(stage);
+    DEBUG_CMD_MM(cout << "Reconstruction stage " << name << ": " << stage.ms
+                      << " ms" << endl;);
+    start = now;
+  }
+
+ private:
+  RecStats &stats;
+  chrono::steady_clock::time_point start;
+};
+
+// for the per-region steps of the reconstruction
+static WorkerPool &getRecWorkerPool() {
+  static WorkerPool pool(WorkerPool::defaultNumThreads());
+  return pool;
+}
+
+void setLibraryNumThreads(int numThreads) {
+  if (numThreads <= 0) {
+#ifdef __EMSCRIPTEN__
+    numThreads = 1;
+#else
+    // libigl starts new threads for every loop, more of them rarely pay off
+    const int n = thread::hardware_concurrency();
+    numThreads = min(max(n, 1), 4);
+#endif
+  }
+  igl::parallel_for_num_threads() = numThreads;
+  // starting the threads costs more than the loops over small meshes
+  igl::parallel_for_min_loop_size() = 10000;
+  Eigen::setNbThreads(numThreads);
+}
+
+// Triangle options with the maximum triangle area (the 'a' switch) adapted to
+// the mean thickness of the region: thin regions get about
+// trianglesAcross triangles across, the area stays within [1/4, 4] times
+// the one of opts. Triangles near the boundary are fine anyway because of
+// the boundary sampling and the quality constraint.
+static string adaptiveTriangleOpts(const string &opts, const Imguc &region) {
+  const double trianglesAcross = 8;
+  const size_t pos = opts.find('a');
+  if (pos == string::npos) return opts;
+  size_t end = pos + 1;
+  while (end < opts.size() && (isdigit(opts[end]) || opts[end] == '.')) end++;
+  if (end == pos + 1) return opts;  // area constraints not given by a value
+  const double area = stod(opts.substr(pos + 1, end - pos - 1));
+
+  const BitMask mask = BitMask::fromImage(region, 0, false);
+  const int perimeter = mask.boundary().count();
+  if (perimeter == 0) return opts;
+  // area / perimeter is half of the thickness for strips and disks
+  const double thickness = 4.0 * mask.count() / perimeter;
+  const double edge = thickness / trianglesAcross;
+  const double adaptedArea =
+      min(max(sqrt(3.0) / 4.0 * edge * edge, area / 4), area * 4);
+
+  ostringstream oss;
+  oss << opts.substr(0, pos + 1) << fixed << setprecision(2) << adaptedArea
+      << opts.substr(end);
+  return oss.str();
+}
+
+// Factorization of the inflation system of a connected component: with
+// supernodal set, -L(interior, interior) factorized by llt (the rows of the
+// boundary vertices are known), otherwise the LU of data.
+struct RecCache::SolverData {
+  bool supernodal = false;
+  min_quad_with_fixed_data<double> data;
+  SupernodalLLT llt;
+  vector<int> interior;
+  VectorXd mass;  // diagonal of M of the interior vertices
+};
+
+// Reverse Cuthill-McKee ordering of the vertices of the mesh: a breadth
+// first search of each connected component from a pseudo-peripheral vertex,
+// visiting the neighbors by increasing degree, reversed. Neighboring
+// vertices get close indices, so the operators built on the mesh (L, K,
+// CSM) have a small bandwidth. Returns the old index of each new vertex.
+static vector<int> reverseCuthillMcKee(const MatrixXi &F, int n) {
+  // adjacency lists in compressed form
+  vector<pair<int, int>> edges;
+  edges.reserve(6 * F.rows());
+  fora(f, 0, F.rows()) fora(k, 0, 3) {
+    const int a = F(f, k), b = F(f, (k + 1) % 3);
+    edges.emplace_back(a, b);
+    edges.emplace_back(b, a);
+  }
+  sort(edges.begin(), edges.end());
+  edges.erase(unique(edges.begin(), edges.end()), edges.end());
+  vector<int> start(n + 1, 0), adj(edges.size());
+  for (const auto &e : edges) start[e.first + 1]++;
+  fora(i, 0, n) start[i + 1] += start[i];
+  forlist(k, edges) adj[k] = edges[k].second;
+  auto byDegree = [&](int a, int b) {
+    return start[a + 1] - start[a] < start[b + 1] - start[b];
+  };
+
+  // breadth first search from root, leaves the visited vertices in queue
+  // with the last level starting at lastLevel, returns the number of levels
+  vector<int> mark(n, -1), queue;
+  queue.reserve(n);
+  int stamp = 0;
+  size_t lastLevel = 0;
+  auto bfs = [&](int root) {
+    stamp++;
+    queue.clear();
+    queue.push_back(root);
+    mark[root] = stamp;
+    int levels = 1;
+    size_t levelEnd = 1;
+    lastLevel = 0;
+    for (size_t i = 0; i < queue.size(); i++) {
+      if (i == levelEnd) {
+        levels++;
+        lastLevel = i;
+        levelEnd = queue.size();
+      }
+      const int v = queue[i];
+      const size_t first = queue.size();
+      fora(k, start[v], start[v + 1]) {
+        if (mark[adj[k]] == stamp) continue;
+        mark[adj[k]] = stamp;
+        queue.push_back(adj[k]);
+      }
+      sort(queue.begin() + first, queue.end(), byDegree);
+    }
+    return levels;
+  };
+
+  vector<int> order;
+  order.reserve(n);
+  vector<bool> done(n, false);
+  fora(v, 0, n) {
+    if (done[v]) continue;
+    // pseudo-peripheral root [George and Liu 1979]: restart from a vertex
+    // of minimal degree of the last level while the depth increases
+    int root = v;
+    int levels = bfs(root);
+    fora(iter, 0, 8) {
+      const int candidate =
+          *min_element(queue.begin() + lastLevel, queue.end(), byDegree);
+      const int candidateLevels = bfs(candidate);
+      if (candidateLevels <= levels) {
+        bfs(root);
+        break;
+      }
+      root = candidate;
+      levels = candidateLevels;
+    }
+    for (int u : queue) done[u] = true;
+    order.insert(order.end(), queue.begin(), queue.end());
+  }
+  reverse(order.begin(), order.end());
+  return order;
+}
+
+// Renumbers the vertices of the reconstruction by reverseCuthillMcKee, the
+// order of the mesh builder follows the construction of the parts and their
+// boundaries instead of the locality of the vertices. Everything indexing
+// the vertices is remapped (control points are placed by their positions
+// when the reconstruction is applied).
+static void reorderVertices(RecResult &result) {
+  const int n = result.V.rows();
+  const vector<int> order = reverseCuthillMcKee(result.F, n);
+  vector<int> newIndex(n);
+  fora(i, 0, n) newIndex[order[i]] = i;
+  auto remap = [&](int &v) {
+    if (v >= 0 && v < n) v = newIndex[v];
+  };
+
+  MatrixXd V(n, result.V.cols()), VPreinf(n, result.VPreinf.cols());
+  fora(i, 0, n) {
+    V.row(i) = result.V.row(order[i]);
+    VPreinf.row(i) = result.VPreinf.row(order[i]);
+  }
+  result.V.swap(V);
+  result.VPreinf.swap(VPreinf);
+  fora(f, 0, result.F.rows()) fora(k, 0, 3) remap(result.F(f, k));
+
+  PermutationMatrix<Dynamic, Dynamic, int> P(n);
+  fora(i, 0, n) P.indices()(i) = newIndex[i];
+  result.M = P * result.M * P.transpose();
+
+  for (auto &vs : result.verticesOfParts) for (int &v : vs) remap(v);
+  for (auto &vs : result.bnds) for (int &v : vs) remap(v);
+  for (int &v : result.mergeBnd) remap(v);
+  for (auto &corr : result.mergeArmpitsCorrs) {
+    remap(get<0>(corr));
+    remap(get<1>(corr));
+  }
+}
+
 template <typename T>
 int sgn(T val) {
   return (T(0) < val) - (val < T(0));
@@ -42,83 +315,158 @@ int sgn(T val) {
 
 bool reconstruction(
     const RecData &recData, const ImgData &imgData,
-    const std::vector<Imguc> &outlineImgs, const std::vector<Imguc> &regionImgs,
+    std::vector<Imguc> &outlineImgs, std::vector<Imguc> &regionImgs,
     const std::string &triangleOpts, Eigen::MatrixXd &Vout,
     Eigen::MatrixXi &Fout, Eigen::MatrixXd &VPreinfOut,
     std::vector<std::vector<int>> &verticesOfParts,
-    Eigen::SparseMatrix<double> &I, Eigen::SparseMatrix<double> &LFlat,
-    Eigen::SparseMatrix<double> &LPreinf, Eigen::SparseMatrix<double> &LFinal,
-    Eigen::SparseMatrix<double> &MFinal, Eigen::SparseMatrix<double> &MinvFinal,
-    Eigen::SparseMatrix<double> &Aeq, Eigen::VectorXd &Beq,
-    Eigen::SparseMatrix<double> &Aieq, Eigen::VectorXd &Bieq,
+    Eigen::SparseMatrix<double> &MFinal,
     std::vector<std::tuple<int, int, int>> &ineqRegionConds,
     std::vector<std::vector<int>> &bnds, std::vector<int> &mergeBnd,
     std::vector<std::tuple<int, int, int>> &mergeArmpitsCorrs,
     std::vector<TriData> &triData, const int smoothFactor,
     const double defaultInflationAmount, const bool armpitsStitching,
     const bool armpitsStitchingInJointOptimization,
-    std::set<int> &mergeBothSides) {
+    std::set<int> &mergeBothSides, RecCache &recCache, RecStats &stats) {
   auto &regionInflationAmount = recData.regionInflationAmount;
+  RecStageTimer timer(stats);
   auto &layers = imgData.layers;
 
   const int N = regionImgs.size();
   const int numRegions = 2 * N;
 
-  // convert regions into flat meshes
-  vector<MatrixXd> VsFront, VsBack;
-  vector<MatrixXi> FsFront, FsBack;
-  vector<vector<vector<Vector2f>>> regionsBnds;
-  const bool interiorMergingPtsOnly = true;
-  outlineToMesh(outlineImgs, regionImgs, true, false, interiorMergingPtsOnly,
-                triangleOpts, mergeBothSides, VsFront, FsFront, smoothFactor,
-                regionsBnds, triData);
-  outlineToMesh(outlineImgs, regionImgs, false, true, interiorMergingPtsOnly,
-                triangleOpts, mergeBothSides, VsBack, FsBack, smoothFactor);
-
-  // create vectors of indices of boundary points (customBnds) from regionsBnds
-  vector<vector<vector<int>>> customBnds;
-  forlist(k, regionsBnds) {
-    vector<vector<int>> bnd1;
-    int c = 0;
-    forlist(l, regionsBnds[k]) {
-      vector<int> bnd2;
-      forlist(m, regionsBnds[k][l]) {
-        bnd2.push_back(c);
-        c++;
-      }
-      bnd1.push_back(bnd2);
+  // triangulations of regions with the same boundaries and interior points
+  // (i.e. the region and its merge neighbours did not change) are reused,
+  // called concurrently for the regions
+  mutex recCacheMutex;
+  auto triangulateCached = [&](const MatrixXd &V, const MatrixXi &E,
+                               const MatrixXd &H, const string &opts,
+                               MatrixXd &Vout, MatrixXi &Fout) {
+    uint64_t key = AnimCache::hashInit;
+    const int sizes[3] = {int(V.rows()), int(E.rows()), int(H.rows())};
+    key = AnimCache::hash(key, sizes, sizeof(sizes));
+    key = AnimCache::hash(key, V.data(), V.size() * sizeof(double));
+    key = AnimCache::hash(key, E.data(), E.size() * sizeof(int));
+    key = AnimCache::hash(key, H.data(), H.size() * sizeof(double));
+    key = AnimCache::hash(key, opts.data(), opts.size());
+    {
+      lock_guard<mutex> lock(recCacheMutex);
+      if (recCache.getTriangulation(key, Vout, Fout)) return;
     }
-    customBnds.push_back(bnd1);
-  }
+    triangulateSerialized(V, E, H, opts, Vout, Fout);
+    lock_guard<mutex> lock(recCacheMutex);
+    recCache.putTriangulation(key, Vout, Fout);
+  };
+  // the same with the in-tree mesher, which runs concurrently and is keyed
+  // on the region boundaries directly
+  auto triangulateCDTCached = [&](const TriData &td, MatrixXd &Vout,
+                                  MatrixXi &Fout) {
+    uint64_t key = AnimCache::hashInit;
+    const char tag[] = "cdt";
+    key = AnimCache::hash(key, tag, sizeof(tag));
+    auto hashPts = [&](const vector<Vector2f> &pts) {
+      const int size = pts.size();
+      key = AnimCache::hash(key, &size, sizeof(size));
+      key = AnimCache::hash(key, pts.data(), pts.size() * sizeof(Vector2f));
+    };
+    for (const auto &bnd : td.regionBnds) hashPts(bnd);
+    hashPts(td.interiorPts);
+    hashPts(td.regionHolePts);
+    key = AnimCache::hash(key, td.triangleOpts.data(),
+                          td.triangleOpts.size());
+    {
+      lock_guard<mutex> lock(recCacheMutex);
+      if (recCache.getTriangulation(key, Vout, Fout)) return;
+    }
+    triangulateCDT(td, Vout, Fout);
+    lock_guard<mutex> lock(recCacheMutex);
+    recCache.putTriangulation(key, Vout, Fout);
+  };
+  auto parallelFor = [](int n, const function<void(int)> &body) {
+    getRecWorkerPool().parallelFor(n, 1, [&](int begin, int end) {
+      fora(i, begin, end) body(i);
+    });
+  };
 
-  {
-    int count = 0;
-    forlist(i, VsFront) count += VsFront[i].rows();
-    forlist(i, VsBack) count += VsBack[i].rows();
-    DEBUG_CMD_MM(cout << endl
-                      << "-- TRACE: total vertices: " << count << endl
-                      << endl;)
+  // triangulation options of each region
+  vector<string> regionTriangleOpts(regionImgs.size(), triangleOpts);
+  if (recData.adaptiveTriangulation) {
+    parallelFor(regionImgs.size(), [&](int i) {
+      regionTriangleOpts[i] = adaptiveTriangleOpts(triangleOpts, regionImgs[i]);
+    });
   }
 
-  // process all planar meshes
+  // the mesh builder takes over the per region meshes
   const int Z_COORD = 2;
   MeshBuilder mb;
   mb.graftingBndStitching = false;
   mb.graftingBndIneq = false;
   mb.flipReg.resize(2 * N, false);
-  forlist(i, regionImgs) {
+  {
+    // convert regions into flat meshes
+    vector<MatrixXd> VsFront, VsBack;
+    vector<MatrixXi> FsFront, FsBack;
+    vector<vector<vector<Vector2f>>> regionsBnds;
+    const bool interiorMergingPtsOnly = true;
+    outlineToMeshBothSides(outlineImgs, regionImgs, interiorMergingPtsOnly,
+                           regionTriangleOpts, mergeBothSides, VsFront,
+                           FsFront, VsBack, FsBack, smoothFactor, regionsBnds,
+                           triData, triangulateCached, parallelFor,
+                           recData.cdtTriangulation
+                               ? TriDataTriangulateFn(triangulateCDTCached)
+                               : TriDataTriangulateFn());
+    vector<Imguc>().swap(outlineImgs);
+    vector<Imguc>().swap(regionImgs);
+
+    // create vectors of indices of boundary points (customBnds) from
+    // regionsBnds
+    vector<vector<vector<int>>> customBnds;
+    forlist(k, regionsBnds) {
+      vector<vector<int>> bnd1;
+      int c = 0;
+      forlist(l, regionsBnds[k]) {
+        vector<int> bnd2;
+        forlist(m, regionsBnds[k][l]) {
+          bnd2.push_back(c);
+          c++;
+        }
+        bnd1.push_back(bnd2);
+      }
+      customBnds.push_back(bnd1);
+    }
+
+    {
+      int count = 0, countF = 0;
+      forlist(i, VsFront) count += VsFront[i].rows();
+      forlist(i, VsBack) count += VsBack[i].rows();
+      forlist(i, FsFront) countF += FsFront[i].rows();
+      forlist(i, FsBack) countF += FsBack[i].rows();
+      DEBUG_CMD_MM(cout << endl
+                        << "-- TRACE: total vertices: " << count << endl
+                        << endl;)
+      timer.next("triangulation", count, countF);
+    }
+
+    // process all planar meshes, each one is freed once the builder has
+    // its copy
+    fora(i, 0, N) {
 #ifdef ENABLE_MERGING_COMMON_BOUNDARY_IN_PREPROCESS
-    mb.processTwoSidedMesh(VsFront[i], FsFront[i], VsBack[i], FsBack[i], false,
-                           customBnds[i], true);
+      mb.processTwoSidedMesh(VsFront[i], FsFront[i], VsBack[i], FsBack[i],
+                             false, customBnds[i], true);
 #else
-    mb.processPlanarMesh(VsFront[i], FsFront[i], false, customBndsFront[i],
-                         false);
-    mb.processPlanarMesh(VsBack[i], FsBack[i], false, customBndsBack[i], false);
+      mb.processPlanarMesh(VsFront[i], FsFront[i], false, customBndsFront[i],
+                           false);
+      mb.processPlanarMesh(VsBack[i], FsBack[i], false, customBndsBack[i],
+                           false);
 #endif
+      VsFront[i].resize(0, 0);
+      FsFront[i].resize(0, 0);
+      VsBack[i].resize(0, 0);
+      FsBack[i].resize(0, 0);
+    }
   }
   // default inflation amount
   vector<float> inflationAmount(2 * N, defaultInflationAmount);
-  forlist(i, regionImgs) {
+  fora(i, 0, N) {
     const int regId = layers[i];
     mb.flipReg[2 * i + 1] = true;
     auto it = regionInflationAmount.find(regId);
@@ -127,8 +475,12 @@ bool reconstruction(
     }
     inflationAmount[2 * i + 1] *= -1;
   }
+  timer.next("mesh building", mb.Vc.rows(), mb.Fc.rows());
   mb.createCompleteMesh();
   bnds = mb.bnds;
+  // the parts are in the complete mesh now
+  vector<MatrixXd>().swap(mb.Vs);
+  vector<MatrixXi>().swap(mb.Fs);
 
   // Determine relative depth conditions for a region B based on the following
   // rules:
@@ -145,7 +497,7 @@ bool reconstruction(
   // leg) and merge B_backConnBnd with C_backConnIn
   typedef MeshBuilder::VertexType VertexType;
   vector<bool> &flipReg = mb.flipReg;
-  vector<tuple<int, int, int, int>> selectedVCondsIneq, selectedVCondsEq;
+  vector<tuple<int, int, int, int>> selectedVCondsEq;
   vector<vector<pair<int, int>>> selectedMergingCorrs;
   vector<bool> reverseNs;
   unordered_map<int, bool> vertexUsedMerge;
@@ -252,8 +604,11 @@ bool reconstruction(
   MatrixXd V;
   MatrixXi F;
   vector<int> bnd, neumannBnd;
-  mb.getCompleteMesh(V, F);
+  V.swap(mb.Vc);
+  F.swap(mb.Fc);
   mb.getCompleteBoundary(bnd, neumannBnd);
+  decltype(mb.mergingCorr)().swap(mb.mergingCorr);
+  timer.next("correspondences", V.rows(), F.rows());
 
   // convert relative depth conditions into a matrix form suitable for quadratic
   // programming
@@ -307,9 +662,8 @@ bool reconstruction(
   DEBUG_CMD_MM(cout << "eqsnum: " << num << ", bndA: " << numBndA << ", inA: "
                     << numInA << ", bndB: " << numBndB << ", inB: " << numInB
                     << ", skipped: " << numSkipped << endl;)
-  Beq = VectorXd(num);
-  Beq.fill(0);
-  Aeq = SparseMatrix<double>(num, V.rows());
+  VectorXd Beq = VectorXd::Zero(num);
+  SparseMatrix<double> Aeq(num, V.rows());
   int c = 0;
   unordered_map<int, set<int>> verticesToMerge;
   vector<pair<int, int>> bnd2bnd;
@@ -350,57 +704,147 @@ bool reconstruction(
     }
   }
 
-  // inequalities
-  num = selectedVCondsIneq.size();
-  Bieq = VectorXd(num);
-  Bieq.fill(0);
-  Aieq = SparseMatrix<double>(num, V.rows());
-  {
-    int c = 0;
-    forlist(i, selectedVCondsIneq) {
-      const auto &s = selectedVCondsIneq[i];
-      const auto &bc = mb.ineqCorr[get<0>(s)][get<1>(s)][get<2>(s)];
-      const int sign = get<3>(s);
-      Aieq.insert(c, bc.a) = sign * 1;   // boundary
-      Aieq.insert(c, bc.b) = sign * -1;  // mesh
-      c++;
-    }
-  }
-  DEBUG_CMD_MM(cout << "ineqsNum: " << num << endl;)
+  // the vertex inequalities are not used, the depth order is enforced by
+  // the deformation from ineqRegionConds
+  decltype(mb.eqCorr)().swap(mb.eqCorr);
+  decltype(mb.ineqCorr)().swap(mb.ineqCorr);
 
-  // preinflation
+  // preinflation, solved for each connected component separately and
+  // concurrently since they are independent, components that did not change
+  // reuse the cached result
   DEBUG_CMD_MM(cout << "Inflation " << endl;)
-  SparseMatrix<double> M, Minv, LFlatNotMerged, LPreinfNotMerged;
-  massmatrix(V, F, igl::MASSMATRIX_TYPE_VORONOI, M);
-
-  if (M.nonZeros() - M.rows() != 0) {
-    DEBUG_CMD_MM(
-        cout << "error: M.nonZeros()-M.rows()=" << M.nonZeros() - M.rows()
-             << " probably a problem in interconnection (non-manifold mesh?)"
-             << endl;)
-    return false;
-  }
-
-  invert_diag(M, Minv);
-  cotmatrix(V, F, LFlatNotMerged);
-
   const int nBnd = bnd.size();
   const int nV = V.rows();
-  // sqrt
-  VectorXi b(nBnd);
-  VectorXd bc(nBnd);
-  VectorXd inB(nV);
-  VectorXd outZ;
-  fora(i, 0, nBnd) b(i) = bnd[i];
-  bc.fill(0);
-
+  VectorXi b;
+  VectorXd bc;
+  VectorXd inB = VectorXd::Zero(nV);
+  VectorXd outZ = VectorXd::Zero(nV);
   fora(i, 0, mb.getMeshesCount()) {
     forlist(j, mb.parts1[i]) inB(mb.parts1[i][j]) = -inflationAmount[i];
   }
 
-  SparseMatrix<double> Q = Minv * LFlatNotMerged;
-  min_quad_with_fixed(Q, inB, b, bc, SparseMatrix<double>(), VectorXd(), false,
-                      outZ);
+  VectorXi comps;
+  vertex_components(F, comps);
+  const int nComps = comps.size() > 0 ? comps.maxCoeff() + 1 : 0;
+  vector<vector<int>> compVertices(nComps), compFaces(nComps);
+  fora(i, 0, comps.size()) compVertices[comps(i)].push_back(i);
+  fora(i, 0, F.rows()) compFaces[comps(F(i, 0))].push_back(i);
+  vector<bool> isBnd(nV, false);
+  fora(i, 0, nBnd) isBnd[bnd[i]] = true;
+  VectorXi local(nV);  // components touch disjoint entries
+  atomic<bool> inflationFailed(false);
+  parallelFor(nComps, [&](int c) {
+    const vector<int> &vs = compVertices[c];
+    const vector<int> &fs = compFaces[c];
+    const int n = vs.size();
+    MatrixXd Vc(n, 3);
+    VectorXd inBc(n);
+    vector<int> bLocal;
+    fora(k, 0, n) {
+      local(vs[k]) = k;
+      Vc.row(k) = V.row(vs[k]);
+      inBc(k) = inB(vs[k]);
+      if (isBnd[vs[k]]) bLocal.push_back(k);
+    }
+    MatrixXi Fc(fs.size(), 3);
+    forlist(k, fs) fora(l, 0, 3) Fc(k, l) = local(F(fs[k], l));
+
+    // the system depends only on the mesh and its boundary, the solution
+    // also on the inflation amounts
+    uint64_t systemKey = AnimCache::hashInit;
+    const int sizes[4] = {n, int(fs.size()), int(bLocal.size()),
+                          recData.supernodalSolver};
+    systemKey = AnimCache::hash(systemKey, sizes, sizeof(sizes));
+    systemKey =
+        AnimCache::hash(systemKey, Vc.data(), Vc.size() * sizeof(double));
+    systemKey = AnimCache::hash(systemKey, Fc.data(), Fc.size() * sizeof(int));
+    systemKey = AnimCache::hash(systemKey, bLocal.data(),
+                                bLocal.size() * sizeof(int));
+    const uint64_t key =
+        AnimCache::hash(systemKey, inBc.data(), n * sizeof(double));
+    VectorXd zc;
+    bool found;
+    shared_ptr<const RecCache::SolverData> data;
+    {
+      lock_guard<mutex> lock(recCacheMutex);
+      found = recCache.getInflation(key, zc);
+      if (!found) data = recCache.getInflationSolver(systemKey);
+    }
+    if (!found) {
+      if (!data) {
+        SparseMatrix<double> M, Minv, LFlatNotMerged;
+        massmatrix(Vc, Fc, igl::MASSMATRIX_TYPE_VORONOI, M);
+        if (M.nonZeros() - M.rows() != 0) {
+          DEBUG_CMD_MM(cout << "error: M.nonZeros()-M.rows()="
+                            << M.nonZeros() - M.rows()
+                            << " probably a problem in interconnection "
+                               "(non-manifold mesh?)"
+                            << endl;)
+          inflationFailed = true;
+          return;
+        }
+        invert_diag(M, Minv);
+        cotmatrix(Vc, Fc, LFlatNotMerged);
+        auto newData = make_shared<RecCache::SolverData>();
+        if (recData.supernodalSolver) {
+          // Minv * L * z = -inB on the interior with z = 0 on the boundary
+          // is the SPD system -L_ii * z_i = M_i * inB_i
+          vector<int> pos(n, -1);
+          vector<int> &interior = newData->interior;
+          fora(k, 0, n) {
+            if (binary_search(bLocal.begin(), bLocal.end(), k)) continue;
+            pos[k] = interior.size();
+            interior.push_back(k);
+          }
+          vector<Triplet<double>> triplets;
+          triplets.reserve(LFlatNotMerged.nonZeros());
+          fora(j, 0, n) {
+            if (pos[j] < 0) continue;
+            for (SparseMatrix<double>::InnerIterator it(LFlatNotMerged, j); it;
+                 ++it) {
+              if (pos[it.row()] < 0) continue;
+              triplets.emplace_back(pos[it.row()], pos[j], -it.value());
+            }
+          }
+          SparseMatrix<double> A(interior.size(), interior.size());
+          A.setFromTriplets(triplets.begin(), triplets.end());
+          newData->llt.compute(A);
+          newData->supernodal = newData->llt.info() == Success;
+          newData->mass.resize(interior.size());
+          forlist(k, interior) {
+            newData->mass(k) = M.coeff(interior[k], interior[k]);
+          }
+        }
+        if (!newData->supernodal) {
+          VectorXi bcomp = Map<VectorXi>(bLocal.data(), bLocal.size());
+          SparseMatrix<double> Q = Minv * LFlatNotMerged;
+          min_quad_with_fixed_precompute(Q, bcomp, SparseMatrix<double>(),
+                                         false, newData->data);
+        }
+        data = newData;
+        lock_guard<mutex> lock(recCacheMutex);
+        recCache.putInflationSolver(systemKey, data);
+      }
+      if (data->supernodal) {
+        const vector<int> &interior = data->interior;
+        VectorXd rhs(interior.size());
+        forlist(k, interior) rhs(k) = data->mass(k) * inBc(interior[k]);
+        const VectorXd zi = data->llt.solve(rhs);
+        zc = VectorXd::Zero(n);
+        forlist(k, interior) zc(interior[k]) = zi(k);
+      } else {
+        min_quad_with_fixed_solve(data->data, inBc,
+                                  VectorXd::Zero(bLocal.size()), VectorXd(),
+                                  zc);
+      }
+      lock_guard<mutex> lock(recCacheMutex);
+      recCache.putInflation(key, zc);
+    }
+    fora(k, 0, n) outZ(vs[k]) = zc(k);
+  });
+  if (inflationFailed) return false;
+  vector<vector<int>>().swap(compVertices);
+  vector<vector<int>>().swap(compFaces);
 
   fora(i, 0, mb.getMeshesCount()) {
     forlist(j, mb.parts1[i]) {
@@ -410,10 +854,7 @@ bool reconstruction(
   }
   MatrixXd VPreinf = V;
   DEBUG_CMD_MM(cout << "Inflation done" << endl;)
-
-  cotmatrix(VPreinf, F, LPreinfNotMerged);
-
-  I = SparseMatrix<double>(V.rows(), V.rows());
+  timer.next("inflation", V.rows(), F.rows());
 
   // merging of interior vertices
   if (armpitsStitching || armpitsStitchingInJointOptimization) {
@@ -438,18 +879,9 @@ bool reconstruction(
 #endif
 
         } else {
-          const auto &mc = mb.mergingCorr[p1][p2];
-          int counterpartId = -1;
-          forlist(k, mc) {
-            int i1 = mc[k].second;
-            int i2 = mc[k].first;
-            if (bndId == i1) {
-              counterpartId = i2;
-              //          cout << "found counterpart: " << counterpartId <<
-              //          endl;
-              break;
-            }
-          }
+          const auto &mc = mb.mergingCorrByBnd[p1][p2];
+          const auto it = mc.find(bndId);
+          const int counterpartId = it != mc.end() ? it->second : -1;
 
           if (counterpartId >= 0) {
             //        if (verticesToMergeUsed.find(counterpartId) ==
@@ -511,7 +943,10 @@ bool reconstruction(
       fora(i, 0, nBnd) { b(i + 2 * mergeArmpitsCorrs.size()) = bnd[i]; }
 #endif
 
+      SparseMatrix<double> I(V.rows(), V.rows());
       fora(i, 0, bnd.size()) I.insert(bnd[i], bnd[i]) = 0.00001;
+      SparseMatrix<double> LPreinfNotMerged;
+      cotmatrix(VPreinf, F, LPreinfNotMerged);
       SparseMatrix<double> Q;
       Q = -(LPreinfNotMerged - I);
       inB = LPreinfNotMerged * V.col(Z_COORD);
@@ -525,6 +960,11 @@ bool reconstruction(
     }
   }
 
+  decltype(mb.mergingCorrByBnd)().swap(mb.mergingCorrByBnd);
+  Aeq = SparseMatrix<double>();
+  Beq.resize(0);
+  timer.next("stitching", V.rows(), F.rows());
+
 #ifndef DISABLE_EQUALITY_VERTICES_MERGING
   DEBUG_CMD_MM(cout << "Merge mesh and remove duplicates ("
                     << verticesToMerge.size() << ") " << flush;)
@@ -536,24 +976,21 @@ bool reconstruction(
   VPreinfOut = Vout;
   fora(i, 0, V.rows()) if (!removeV[i]) VPreinfOut(reindex[i], Z_COORD) =
       VPreinf(i, Z_COORD);
-
-  cotmatrix(VPreinfOut, Fout, LPreinf);
   DEBUG_CMD_MM(cout << "done" << endl;)
 #else
   verticesOfParts = mb.parts1;
   // return the result
   Vout = V;
   Fout = F;
-  LPreinf = LPreinfNotMerged;
 #endif
+  // only the merged mesh is used from here on
+  vector<vector<int>>().swap(mb.parts1);
+  V.resize(0, 0);
+  F.resize(0, 0);
+  VPreinf.resize(0, 0);
+  timer.next("duplicate merge", Vout.rows(), Fout.rows());
 
   massmatrix(Vout, Fout, igl::MASSMATRIX_TYPE_VORONOI, MFinal);
-  invert_diag(MFinal, MinvFinal);
-  cotmatrix(Vout, Fout, LFinal);
-
-  MatrixXd VoutFlat = Vout;
-  VoutFlat.col(Z_COORD).fill(0);
-  cotmatrix(VoutFlat, Fout, LFlat);
 
 #ifndef DISABLE_EQUALITY_VERTICES_MERGING
   // recompute
@@ -575,106 +1012,143 @@ bool reconstruction(
   for (int ind : mergeBnd2) {
     if (!removeV[ind]) mergeBnd.push_back(reindex[ind]);
   }
-
-  Aeq.resize(0, 0);
-  Beq.resize(0);
-  Aieq.resize(0, 0);
-  Bieq.resize(0);
 #endif
+  timer.next("operators", Vout.rows(), Fout.rows());
 
   return true;
 }
 
-bool performReconstruction(RecData &recData, DefData &defData, CPData &cpData,
-                           ImgData &imgData) {
-  auto &def = defData.def;
-  auto &verticesOfParts = defData.verticesOfParts;
-  auto &defEng = defData.defEng;
-  auto &mesh = defData.mesh;
-  auto &defEngMaxIter = defData.defEngMaxIter;
-  auto &rigidity = defData.rigidity;
-
-  auto &outlineImgs = imgData.outlineImgs;
-  auto &regionImgs = imgData.regionImgs;
-  auto &layers = imgData.layers;
+uint64_t reconstructionInputsHash(const RecData &recData,
+                                  const ImgData &imgData,
+                                  const std::string &triangleOpts) {
+  // per layer, region IDs may be renumbered when a project is saved
+  const int version = 1;
+  uint64_t h = AnimCache::hashInit;
+  h = AnimCache::hash(h, &version, sizeof(version));
+  h = AnimCache::hash(h, triangleOpts.data(), triangleOpts.size());
+  const int params[] = {recData.adaptiveTriangulation,
+                        recData.subsFactor,
+                        recData.armpitsStitching,
+                        recData.armpitsStitchingInJointOptimization,
+                        recData.smoothFactor,
+                        recData.shiftModelX,
+                        recData.shiftModelY,
+                        static_cast<int>(imgData.layers.size())};
+  h = AnimCache::hash(h, params, sizeof(params));
+  // hashed only when set, which keeps the hashes of the stored results
+  if (recData.cdtTriangulation) {
+    const char tag[] = "cdt";
+    h = AnimCache::hash(h, tag, sizeof(tag));
+  }
+  for (const int i : recData.mergeBothSides) {
+    h = AnimCache::hash(h, &i, sizeof(i));
+  }
+  for (const int regId : imgData.layers) {
+    const auto it = recData.regionInflationAmount.find(regId);
+    const double amount = it != recData.regionInflationAmount.end()
+                              ? it->second
+                              : recData.defaultInflationAmount;
+    h = AnimCache::hash(h, &amount, sizeof(amount));
+    for (const TiledImage *I :
+         {&imgData.outlineImgs[regId], &imgData.regionImgs[regId]}) {
+      const int dims[] = {I->w, I->h, I->ch, I->background};
+      h = AnimCache::hash(h, dims, sizeof(dims));
+      const int tileBytes =
+          TiledImage::tileSize * TiledImage::tileSize * I->ch;
+      fora(ty, 0, I->tilesY()) fora(tx, 0, I->tilesX()) {
+        const unsigned char *t = I->tile(tx, ty);
+        const int present = t != nullptr;
+        h = AnimCache::hash(h, &present, sizeof(present));
+        if (present) h = AnimCache::hash(h, t, tileBytes);
+      }
+    }
+  }
+  return h;
+}
 
-  auto &cpsAnim = cpData.cpsAnim;
-  auto &savedCPs = cpData.savedCPs;
+bool computeReconstruction(const RecData &recData, const ImgData &imgData,
+                           const std::string &triangleOpts, RecCache &recCache,
+                           RecResult &result, bool remote) {
+  TRACE_SCOPE("computeReconstruction");
+  setLibraryNumThreads(recData.numThreads);
+  RecStats stats;
+  RecStageTimer timer(stats);
+  const uint64_t inputsHash =
+      reconstructionInputsHash(recData, imgData, triangleOpts);
+  if (recData.storedResult && recData.storedResult->inputsHash == inputsHash) {
+    result = *recData.storedResult;
+    timer.next("stored reconstruction", result.V.rows(), result.F.rows());
+    result.stats = stats;
+    return true;
+  }
+  const string server = remote ? reconstructionServer() : string();
+  if (!server.empty() && !imgData.layers.empty() &&
+      computeReconstructionRemotely(server, recData, imgData, triangleOpts,
+                                    inputsHash, result)) {
+    timer.next("remote reconstruction", result.V.rows(), result.F.rows());
+    result.stats = stats;
+    return true;
+  }
 
-  auto &triangleOpts = recData.triangleOpts;
   auto &subsFactor = recData.subsFactor;
   auto &armpitsStitching = recData.armpitsStitching;
   auto &armpitsStitchingInJointOptimization =
       recData.armpitsStitchingInJointOptimization;
   auto &smoothFactor = recData.smoothFactor;
   auto &defaultInflationAmount = recData.defaultInflationAmount;
-  auto &mergeBothSides = recData.mergeBothSides;
+  auto mergeBothSides = recData.mergeBothSides;
   auto &shiftModelX = recData.shiftModelX;
   auto &shiftModelY = recData.shiftModelY;
-  auto &tempSmoothingSteps = recData.tempSmoothingSteps;
-  auto &searchThreshold = recData.searchThreshold;
-  auto &cpOptimizeForXY = recData.cpOptimizeForXY;
-  auto &cpOptimizeForZ = recData.cpOptimizeForZ;
-  auto &interiorDepthConditions = recData.interiorDepthConditions;
+
+  auto &outlineImgs = imgData.outlineImgs;
+  auto &regionImgs = imgData.regionImgs;
+  auto &layers = imgData.layers;
 
   if (layers.empty()) {
     return false;
   }
 
   // 3D reconstruction
-  MatrixXd V, VPreinf;
-  MatrixXi F;
+  auto &V = result.V;
+  auto &VPreinf = result.VPreinf;
+  auto &F = result.F;
   const int nLayers = layers.size();
 
-  // subsample the input drawings
-  // works for binary images only!
-  auto subsample = [](auto &I, int subsampleFactor, int bgColor) -> auto {
-    typename remove_reference<decltype(I)>::type out(
-        I.w / subsampleFactor, I.h / subsampleFactor, I.ch, I.alphaChannel);
-    out.fill(bgColor);
-    fora(y, 0, I.h) fora(x, 0, I.w) fora(c, 0, I.ch) {
-      const auto &val = I(x, y, c);
-      if (val != bgColor)
-        out(x / subsampleFactor, y / subsampleFactor, c) = val;
+  // subsample the input drawings, they are binary for the reconstruction
+  // (outline or not, region or not) so packed masks are used, the
+  // reconstruction releases them after the triangulation
+  vector<Imguc> regionImgsSubs(nLayers), outlineImgsSubs(nLayers);
+  getRecWorkerPool().parallelFor(nLayers, 1, [&](int begin, int end) {
+    fora(layerId, begin, end) {
+      const int regId = layers[layerId];
+      const BitMask region = BitMask::fromImage(regionImgs[regId], 0, false);
+      const BitMask outline = BitMask::fromImage(outlineImgs[regId], 0, true);
+      regionImgsSubs[layerId] = closeSquare(
+          region.subsample(subsFactor).toImage(255, 0), Cu{0}, 0);
+      outlineImgsSubs[layerId] = closeSquare(
+          outline.subsample(subsFactor).toImage(0, 255), Cu{255}, 0);
     }
-    return out;
-  };
-  vector<Imguc> regionImgsSubs;
-  regionImgsSubs.reserve(nLayers);
-  vector<Imguc> outlineImgsSubs;
-  outlineImgsSubs.reserve(nLayers);
-  int nRegionsToInflate = 0;
-  forlist(layerId, layers) {
-    const int regId = layers[layerId];
-    regionImgsSubs.push_back(
-        closeSquare(subsample(regionImgs[regId], subsFactor, 0), Cu{0}, 0));
-    outlineImgsSubs.push_back(closeSquare(
-        subsample(outlineImgs[regId], subsFactor, 255), Cu{255}, 0));
-    nRegionsToInflate++;
-  }
-
-  // not used after inflation
-  SparseMatrix<double> I, LFlat, LPreinf, LFinal, Aeq, Aieq, MFinal, MinvFinal;
-  VectorXd Beq, Bieq;
-
-  vector<tuple<int, int, int>> ineqRegionConds;
-  vector<vector<int>> bnds;
-  vector<int> mergeBnd;
-  vector<tuple<int, int, int>> mergeArmpitsCorrs;
+  });
+  timer.next("subsampling");
+  const int nRegionsToInflate = nLayers;
+
   vector<TriData> triData;
   bool success = true;
+  recCache.beginReconstruction();
   if (nRegionsToInflate > 0) {
     success = reconstruction(
         recData, imgData, outlineImgsSubs, regionImgsSubs, triangleOpts, V, F,
-        VPreinf, verticesOfParts, I, LFlat, LPreinf, LFinal, MFinal, MinvFinal,
-        Aeq, Beq, Aieq, Bieq, ineqRegionConds, bnds, mergeBnd,
-        mergeArmpitsCorrs, triData, smoothFactor, defaultInflationAmount,
-        armpitsStitching, armpitsStitchingInJointOptimization, mergeBothSides);
+        VPreinf, result.verticesOfParts, result.M, result.ineqRegionConds,
+        result.bnds, result.mergeBnd, result.mergeArmpitsCorrs, triData,
+        smoothFactor, defaultInflationAmount, armpitsStitching,
+        armpitsStitchingInJointOptimization, mergeBothSides, recCache, stats);
   }
 
   if (!success) {
     return false;
   }
+  reorderVertices(result);
+  timer.next("vertex reordering", V.rows(), F.rows());
 
   fora(i, 0, V.rows()) fora(j, 0, 3) {
     V(i, j) *= subsFactor;
@@ -685,29 +1159,71 @@ bool performReconstruction(RecData &recData, DefData &defData, CPData &cpData,
   V.col(1).array() += shiftModelY;
   VPreinf.col(0).array() += shiftModelX;
   VPreinf.col(1).array() += shiftModelY;
+  result.inputsHash = inputsHash;
+  result.stats = stats;
+
+  return true;
+}
+
+void applyReconstruction(std::shared_ptr<RecResult> stored,
+                         const RecData &recData, DefData &defData,
+                         CPData &cpData, ImgData &imgData) {
+  TRACE_SCOPE("applyReconstruction");
+  auto &def = defData.def;
+  auto &verticesOfParts = defData.verticesOfParts;
+  auto &defEng = defData.defEng;
+  auto &mesh = defData.mesh;
+  auto &defEngMaxIter = defData.defEngMaxIter;
+  auto &rigidity = defData.rigidity;
+  auto &defEngParallelSolves = defData.defEngParallelSolves;
+  auto &defEngConvergenceControl = defData.defEngConvergenceControl;
+  auto &defEngTwoLevel = defData.defEngTwoLevel;
+  auto &defEngSinglePrecision = defData.defEngSinglePrecision;
+  auto &defEngParallelCorrespondences = defData.defEngParallelCorrespondences;
+  auto &defEngParallelLocalStep = defData.defEngParallelLocalStep;
+  auto &defEngSupernodal = defData.defEngSupernodal;
+  auto &defEngComponentSolves = defData.defEngComponentSolves;
+  auto &defEngLocalUpdates = defData.defEngLocalUpdates;
+  auto &defEngPGSDepth = defData.defEngPGSDepth;
+
+  auto &cpsAnim = cpData.cpsAnim;
+  auto &savedCPs = cpData.savedCPs;
+
+  auto &armpitsStitchingInJointOptimization =
+      recData.armpitsStitchingInJointOptimization;
+  auto &tempSmoothingSteps = recData.tempSmoothingSteps;
+  auto &searchThreshold = recData.searchThreshold;
+  auto &cpOptimizeForXY = recData.cpOptimizeForXY;
+  auto &cpOptimizeForZ = recData.cpOptimizeForZ;
+  auto &interiorDepthConditions = recData.interiorDepthConditions;
+
+  const RecResult &result = *stored;
+  RecStageTimer timer(stored->stats);
 
   // prepare for deformation
   mesh = Mesh3D();
   def = Def3D();
-  mesh.createFromMesh(VPreinf, F);
+  mesh.createFromMesh(result.VPreinf, result.F);
+  verticesOfParts = result.verticesOfParts;
+  defData.meshLODs = buildMeshLODs(mesh.VCurr, mesh.F, verticesOfParts);
 
   defData.VCurr = mesh.VCurr;
-  defData.Faces = mesh.F;
-  defData.VRestOrig = mesh.VRest;
+  defData.meshVersion++;
 
   // load control points and their animations
   cpsAnim.clear();
-  istringstream iss(savedCPs);
-  loadControlPointsFromStream(iss, cpData, defData, imgData);
+  loadControlPoints(savedCPs, cpData, defData, imgData);
 
   defEng = DefEngARAPL();
-  defEng.ineqRegionConds = ineqRegionConds;
-  defEng.mergeArmpitsCorrs = mergeArmpitsCorrs;
-  defEng.bnds = bnds;
+  defData.defEngAlt.reset();
+  defData.defEngPlayback = DefEngLBS(true);
+  defEng.ineqRegionConds = result.ineqRegionConds;
+  defEng.mergeArmpitsCorrs = result.mergeArmpitsCorrs;
+  defEng.bnds = result.bnds;
   defEng.partsIds = verticesOfParts;
   defEng.tempSmoothingSteps = tempSmoothingSteps;
   defEng.maxIter = defEngMaxIter;
-  defEng.mergeBnd = mergeBnd;
+  defEng.mergeBnd = result.mergeBnd;
   defEng.searchThreshold = searchThreshold;
   defEng.cpOptimizeForXY = cpOptimizeForXY;
   defEng.cpOptimizeForZ = cpOptimizeForZ;
@@ -716,12 +1232,143 @@ bool performReconstruction(RecData &recData, DefData &defData, CPData &cpData,
       armpitsStitchingInJointOptimization;
 
   defEng.rigidity = rigidity;
-  defEng.L = LFinal;
-  defEng.M = MFinal;
-  defEng.Minv = MinvFinal;
-  cotmatrix(VPreinf, F, defEng.L);
+  defEng.parallelSolves = defEngParallelSolves;
+  defEng.parallelCorrespondences = defEngParallelCorrespondences;
+  defEng.convergenceControl = defEngConvergenceControl;
+  defEng.twoLevel = defEngTwoLevel;
+  defEng.singlePrecision = defEngSinglePrecision;
+  defEng.parallelLocalStep = defEngParallelLocalStep;
+  defEng.supernodal = defEngSupernodal;
+  defEng.componentSolves = defEngComponentSolves;
+  defEng.localUpdates = defEngLocalUpdates;
+  defEng.pgsDepth = defEngPGSDepth;
+  defEng.M = result.M;
+  invert_diag(result.M, defEng.Minv);
+  cotmatrix(result.VPreinf, result.F, defEng.L);
 
   defEng.precompute(def, mesh);
+  timer.next("deformation setup", mesh.VCurr.rows(), mesh.F.rows());
+  defData.recResult = stored;
+}
 
+bool performReconstruction(RecData &recData, DefData &defData, CPData &cpData,
+                           ImgData &imgData, RecStats *stats) {
+  {
+    auto result = make_shared<RecResult>();
+    if (!computeReconstruction(recData, imgData, recData.triangleOpts,
+                               *recData.cache, *result, true)) {
+      return false;
+    }
+    applyReconstruction(move(result), recData, defData, cpData, imgData);
+  }
+  // the temporaries of all the stages are freed by now
+  releaseFreeMemory();
+  if (stats) *stats = defData.recResult->stats;
   return true;
 }
+
+bool performReconstructionPreview(RecData &recData, DefData &defData,
+                                  CPData &cpData, ImgData &imgData) {
+  auto result = make_shared<RecResult>();
+  if (!computeReconstruction(recData, imgData, recData.previewTriangleOpts,
+                             *recData.previewCache, *result)) {
+    return false;
+  }
+  applyReconstruction(move(result), recData, defData, cpData, imgData);
+  return true;
+}
+
+DefEng &projectDefEng(DefData &defData) {
+  if (defData.defEngName == defData.defEng.name()) return defData.defEng;
+  if (!defData.defEngAlt || defData.defEngAlt->name() != defData.defEngName)
+    defData.defEngAlt = createDefEng(defData.defEngName);
+  if (!defData.defEngAlt) {
+    defData.defEngName = defData.defEng.name();
+    return defData.defEng;
+  }
+  return *defData.defEngAlt;
+}
+
+AsyncReconstruction::~AsyncReconstruction() { discard(); }
+
+void AsyncReconstruction::start(const RecData &recData,
+                                const ImgData &imgData,
+                                const DefData &defData,
+                                const CPData &cpData) {
+  // only the inputs of the reconstruction are copied
+  pending.recData = recData;
+  pending.imgData = ImgData();
+  pending.imgData.outlineImgs = imgData.outlineImgs;
+  pending.imgData.regionImgs = imgData.regionImgs;
+  pending.imgData.layers = imgData.layers;
+  pending.defData = defData;
+  pending.cpData = cpData;
+  hasPending = true;
+  if (!busy) startPending();
+}
+
+void AsyncReconstruction::startPending() {
+  hasPending = false;
+  canceled = false;
+  busy = true;
+  done = false;
+  run = move(pending);
+  pending = Snapshot();
+  auto task = [this]() {
+    {
+      auto result = make_shared<RecResult>();
+      succeeded = computeReconstruction(run.recData, run.imgData,
+                                        run.recData.triangleOpts,
+                                        *run.recData.cache, *result, true);
+      if (succeeded) {
+        applyReconstruction(move(result), run.recData, run.defData,
+                            run.cpData, run.imgData);
+      }
+    }
+    releaseFreeMemory();
+    done = true;
+    if (finishedCallback) finishedCallback();
+  };
+#ifdef WORKERPOOL_THREADS_AVAILABLE
+  thread = std::thread(task);
+#else
+  task();
+#endif
+}
+
+bool AsyncReconstruction::poll(DefData &defData, CPData &cpData,
+                               bool &success) {
+  if (!busy || !done) return false;
+  if (thread.joinable()) thread.join();
+  busy = false;
+  // the result is outdated if a newer request arrived while running
+  const bool finished = !hasPending && !canceled;
+  success = finished && succeeded;
+  if (success) {
+    defData = move(run.defData);
+    cpData = move(run.cpData);
+  }
+  run = Snapshot();
+  if (hasPending) startPending();
+  return finished;
+}
+
+bool AsyncReconstruction::running() const { return busy; }
+
+bool AsyncReconstruction::hasResult() const { return busy && done; }
+
+void AsyncReconstruction::cancel() {
+  hasPending = false;
+  canceled = true;
+}
+
+void AsyncReconstruction::setFinishedCallback(
+    const std::function<void()> &callback) {
+  finishedCallback = callback;
+}
+
+void AsyncReconstruction::discard() {
+  if (thread.joinable()) thread.join();
+  busy = done = hasPending = canceled = false;
+  pending = run = Snapshot();
+}
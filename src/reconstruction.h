@@ -15,9 +15,129 @@
 #ifndef RECONSTRUCTION_H
 #define RECONSTRUCTION_H
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
 #include "commonStructs.h"
 
+// wall time of a stage of the reconstruction, peak memory of the process at
+// its end (0 if not available) and the size of the mesh it produced
+struct RecStageStats {
+  std::string name;
+  double ms = 0;
+  std::size_t peakMemory = 0;
+  int vertices = 0, faces = 0;
+};
+
+// per-stage profile of a reconstruction, filled by computeReconstruction()
+// and applyReconstruction()
+struct RecStats {
+  std::vector<RecStageStats> stages;
+  double totalMs() const;
+  std::string toJSON() const;
+};
+
+// Mesh and constraints reconstructed from the drawings, the deformation is
+// set up from them in applyReconstruction().
+struct RecResult {
+  Eigen::MatrixXd V, VPreinf;
+  Eigen::MatrixXi F;
+  std::vector<std::vector<int>> verticesOfParts;
+  Eigen::SparseMatrix<double> M;
+  std::vector<std::tuple<int, int, int>> ineqRegionConds;
+  std::vector<std::vector<int>> bnds;
+  std::vector<int> mergeBnd;
+  std::vector<std::tuple<int, int, int>> mergeArmpitsCorrs;
+  // see reconstructionInputsHash()
+  std::uint64_t inputsHash = 0;
+  RecStats stats;
+};
+
+// hash of everything computeReconstruction() depends on
+std::uint64_t reconstructionInputsHash(const RecData &recData,
+                                       const ImgData &imgData,
+                                       const std::string &triangleOpts);
+
+// Does not modify anything except the cache, can run on any thread. With
+// remote set it is tried on the reconstructionServer() first if there is
+// one (see recremote.h), and run locally only if that fails.
+bool computeReconstruction(const RecData &recData, const ImgData &imgData,
+                           const std::string &triangleOpts, RecCache &recCache,
+                           RecResult &result, bool remote = false);
+// result is kept in defData.recResult as it is, its stats get the timings of
+// the deformation setup
+void applyReconstruction(std::shared_ptr<RecResult> result,
+                         const RecData &recData, DefData &defData,
+                         CPData &cpData, ImgData &imgData);
+
+// Threads used by the parallel loops of libigl (e.g. in massmatrix and
+// per_vertex_normals) and by Eigen from now on, 0 for the default of the
+// platform. Applied by computeReconstruction() from RecData::numThreads.
+void setLibraryNumThreads(int numThreads);
+
+// the profile of the reconstruction is stored to stats if given
 bool performReconstruction(RecData &recData, DefData &defData, CPData &cpData,
-                           ImgData &imgData);
+                           ImgData &imgData, RecStats *stats = nullptr);
+// coarse reconstruction (RecData::previewTriangleOpts) fast enough to be
+// run while the inflation amounts are being changed interactively
+bool performReconstructionPreview(RecData &recData, DefData &defData,
+                                  CPData &cpData, ImgData &imgData);
+// the deformation engine selected in the project (DefData::defEngName), an
+// engine other than defData.defEng is created in defData.defEngAlt, see
+// MainWindow::activeDefEng()
+DefEng &projectDefEng(DefData &defData);
+
+// Full resolution reconstruction and setup of the deformation computed on a
+// background thread (or synchronously if threads are not available) from
+// snapshots of the inputs. A request started while another one is running
+// replaces the outdated one and only the latest result is returned by
+// poll(). The cache of the RecData is used by the thread until poll()
+// returns true or discard() is called.
+class AsyncReconstruction {
+ public:
+  AsyncReconstruction() = default;
+  ~AsyncReconstruction();
+  AsyncReconstruction(const AsyncReconstruction &) = delete;
+  AsyncReconstruction &operator=(const AsyncReconstruction &) = delete;
+
+  void start(const RecData &recData, const ImgData &imgData,
+             const DefData &defData, const CPData &cpData);
+  // returns true once the latest requested reconstruction finished, if it
+  // succeeded (success) defData and cpData are replaced by the new ones
+  bool poll(DefData &defData, CPData &cpData, bool &success);
+  bool running() const;
+  // a finished run is waiting to be polled
+  bool hasResult() const;
+  // the running reconstruction is left to finish and its result dropped
+  void cancel();
+  // waits for the running reconstruction and drops its result
+  void discard();
+  // called from the worker thread when a reconstruction finishes, e.g. to
+  // wake up the main loop to poll it
+  void setFinishedCallback(const std::function<void()> &callback);
+
+ private:
+  struct Snapshot {
+    RecData recData;
+    ImgData imgData;
+    DefData defData;
+    CPData cpData;
+  };
+
+  void startPending();
+
+  Snapshot pending, run;
+  std::thread thread;
+  bool busy = false, hasPending = false, canceled = false;
+  std::atomic<bool> done{false}, succeeded{false};
+  std::function<void()> finishedCallback;
+};
 
 #endif  // RECONSTRUCTION_H
@@ -0,0 +1,288 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "recremote.h"
+
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <utility>
+
+#include "binarychunks.h"
+#include "loadsave.h"
+#include "macros.h"
+#include "rlecodec.h"
+#include "tracing.h"
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten.h>
+#else
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static const char requestMagic[4] = {'M', 'M', 'R', 'Q'};
+static const uint32_t requestVersion = 1;
+
+static mutex serverMutex;
+static string serverUrl;
+
+void setReconstructionServer(const std::string &url) {
+  lock_guard<mutex> lock(serverMutex);
+  serverUrl = url;
+}
+
+std::string reconstructionServer() {
+  lock_guard<mutex> lock(serverMutex);
+  return serverUrl;
+}
+
+void writeReconstructionRequest(std::string &request, const RecData &recData,
+                                const ImgData &imgData,
+                                const std::string &triangleOpts) {
+  BinaryWriter writer(requestMagic, requestVersion);
+  // everything reconstructionInputsHash() depends on except the layers
+  writer.beginChunk("PARM");
+  writer.writeString(triangleOpts);
+  writer.writeI32(recData.adaptiveTriangulation);
+  writer.writeI32(recData.cdtTriangulation);
+  writer.writeI32(recData.subsFactor);
+  writer.writeI32(recData.armpitsStitching);
+  writer.writeI32(recData.armpitsStitchingInJointOptimization);
+  writer.writeI32(recData.smoothFactor);
+  writer.writeF64(recData.defaultInflationAmount);
+  writer.writeI32(recData.shiftModelX);
+  writer.writeI32(recData.shiftModelY);
+  writer.writeI32(recData.supernodalSolver);
+  writer.writeU32(recData.mergeBothSides.size());
+  for (const int i : recData.mergeBothSides) writer.writeI32(i);
+  writer.endChunk();
+
+  // the inflation amount, the outline and the region image of each layer
+  // in their order
+  writer.beginChunk("LAYR");
+  writer.writeU32(imgData.layers.size());
+  for (const int regId : imgData.layers) {
+    const auto it = recData.regionInflationAmount.find(regId);
+    writer.writeF64(it != recData.regionInflationAmount.end()
+                        ? it->second
+                        : recData.defaultInflationAmount);
+    encodeRLE(imgData.outlineImgs[regId], writer);
+    encodeRLE(imgData.regionImgs[regId], writer);
+  }
+  writer.endChunk();
+  request = writer.data();
+}
+
+bool readReconstructionRequest(const std::string &request, RecData &recData,
+                               ImgData &imgData, std::string &triangleOpts) {
+  BinaryReader reader(request.data(), request.size());
+  uint32_t version;
+  if (!reader.readHeader(requestMagic, version) || version > requestVersion) {
+    return false;
+  }
+
+  BinaryReader chunk;
+  if (!reader.findChunk("PARM", chunk)) return false;
+  triangleOpts = chunk.readString();
+  recData.adaptiveTriangulation = chunk.readI32() != 0;
+  recData.cdtTriangulation = chunk.readI32() != 0;
+  recData.subsFactor = chunk.readI32();
+  recData.armpitsStitching = chunk.readI32() != 0;
+  recData.armpitsStitchingInJointOptimization = chunk.readI32() != 0;
+  recData.smoothFactor = chunk.readI32();
+  recData.defaultInflationAmount = chunk.readF64();
+  recData.shiftModelX = chunk.readI32();
+  recData.shiftModelY = chunk.readI32();
+  recData.supernodalSolver = chunk.readI32() != 0;
+  const uint32_t nMerged = chunk.readU32();
+  if (nMerged > chunk.remaining(4)) return false;
+  recData.mergeBothSides.clear();
+  for (uint32_t i = 0; i < nMerged; i++) {
+    recData.mergeBothSides.insert(chunk.readI32());
+  }
+  if (!chunk.ok() || recData.subsFactor <= 0) return false;
+
+  if (!reader.findChunk("LAYR", chunk)) return false;
+  const uint32_t n = chunk.readU32();
+  if (n > chunk.remaining(8)) return false;
+  imgData = ImgData();
+  recData.regionInflationAmount.clear();
+  for (uint32_t i = 0; i < n; i++) {
+    recData.regionInflationAmount[i] = chunk.readF64();
+    Imguc outline, region;
+    if (!decodeRLE(chunk, outline) || !decodeRLE(chunk, region)) return false;
+    imgData.outlineImgs.emplace_back(outline, 255);
+    imgData.regionImgs.emplace_back(region, 0);
+    imgData.layers.push_back(i);
+  }
+  return chunk.ok();
+}
+
+bool answerReconstructionRequest(const std::string &request,
+                                 RecCache &recCache, std::string &reply) {
+  TRACE_SCOPE("answerReconstructionRequest");
+  RecData recData;
+  ImgData imgData;
+  string triangleOpts;
+  if (!readReconstructionRequest(request, recData, imgData, triangleOpts)) {
+    return false;
+  }
+  RecResult result;
+  if (!computeReconstruction(recData, imgData, triangleOpts, recCache,
+                             result)) {
+    return false;
+  }
+  ostringstream stream;
+  if (!saveReconstructionToStream(stream, result)) return false;
+  reply = stream.str();
+  return true;
+}
+
+#ifdef __EMSCRIPTEN__
+// Synchronous, so it blocks the thread of the reconstruction (or the page
+// in the builds without threads, as the local reconstruction would). The
+// reply is kept by the thread in Module.recReply until it is copied.
+static bool httpPost(const string &url, const string &body, string &reply) {
+  const int length = EM_ASM_INT(
+      {
+        var url = '';
+        for (var p = $0; HEAPU8[p] != 0; p++) {
+          url += String.fromCharCode(HEAPU8[p]);
+        }
+        try {
+          var xhr = new XMLHttpRequest();
+          xhr.open('POST', url, false);
+          xhr.setRequestHeader('Content-Type', 'application/octet-stream');
+          // the reply as a string of bytes, responseType cannot be set for
+          // synchronous requests on the main thread
+          xhr.overrideMimeType('text/plain; charset=x-user-defined');
+          xhr.send(HEAPU8.slice($1, $1 + $2));
+          if (xhr.status != 200) return -1;
+          Module.recReply = xhr.responseText;
+          return xhr.responseText.length;
+        } catch (e) {
+          return -1;
+        }
+      },
+      url.c_str(), body.data(), body.size());
+  if (length < 0) return false;
+  reply.resize(length);
+  EM_ASM(
+      {
+        var text = Module.recReply;
+        for (var i = 0; i < $1; i++) HEAPU8[$0 + i] = text.charCodeAt(i) & 255;
+        delete Module.recReply;
+      },
+      &reply[0], length);
+  return true;
+}
+#else
+static bool sendAll(int fd, const string &data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    const ssize_t n = send(fd, data.data() + sent, data.size() - sent, 0);
+    if (n <= 0) return false;
+    sent += n;
+  }
+  return true;
+}
+
+// HTTP/1.0 POST to url of the form http://host[:port]/path, the connection
+// is closed by the server after the reply
+static bool httpPost(const string &url, const string &body, string &reply) {
+  const string scheme = "http://";
+  if (url.compare(0, scheme.size(), scheme) != 0) return false;
+  const size_t pathStart = url.find('/', scheme.size());
+  const string hostPort = url.substr(scheme.size(), pathStart - scheme.size());
+  const string path = pathStart == string::npos ? "/" : url.substr(pathStart);
+  const size_t colon = hostPort.find(':');
+  const string host = hostPort.substr(0, colon);
+  const string port =
+      colon == string::npos ? "80" : hostPort.substr(colon + 1);
+
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *addrs = nullptr;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addrs) != 0) {
+    return false;
+  }
+  int fd = -1;
+  for (addrinfo *a = addrs; a != nullptr && fd == -1; a = a->ai_next) {
+    fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (fd != -1 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(addrs);
+  if (fd == -1) return false;
+
+  ostringstream header;
+  header << "POST " << path << " HTTP/1.0\r\n"
+         << "Host: " << hostPort << "\r\n"
+         << "Content-Type: application/octet-stream\r\n"
+         << "Content-Length: " << body.size() << "\r\n\r\n";
+  string response;
+  if (sendAll(fd, header.str()) && sendAll(fd, body)) {
+    char buffer[65536];
+    ssize_t n;
+    while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+      response.append(buffer, n);
+    }
+  }
+  close(fd);
+
+  int status = 0;
+  const size_t headerEnd = response.find("\r\n\r\n");
+  if (headerEnd == string::npos ||
+      sscanf(response.c_str(), "HTTP/%*s %d", &status) != 1 || status != 200) {
+    return false;
+  }
+  reply = response.substr(headerEnd + 4);
+  return true;
+}
+#endif
+
+bool computeReconstructionRemotely(const std::string &url,
+                                   const RecData &recData,
+                                   const ImgData &imgData,
+                                   const std::string &triangleOpts,
+                                   std::uint64_t inputsHash,
+                                   RecResult &result) {
+  TRACE_SCOPE("computeReconstructionRemotely");
+  string request, reply;
+  writeReconstructionRequest(request, recData, imgData, triangleOpts);
+  if (!httpPost(url, request, reply)) {
+    DEBUG_CMD_MM(cout << "computeReconstructionRemotely: no reply from "
+                      << url << endl;);
+    return false;
+  }
+  istringstream stream(reply);
+  RecResult remote;
+  // a server of another version may reconstruct other inputs
+  if (!loadReconstructionFromStream(stream, remote) ||
+      remote.inputsHash != inputsHash) {
+    DEBUG_CMD_MM(cout << "computeReconstructionRemotely: unusable reply"
+                      << endl;);
+    return false;
+  }
+  result = move(remote);
+  return true;
+}
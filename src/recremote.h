@@ -0,0 +1,59 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RECREMOTE_H
+#define RECREMOTE_H
+
+#include <cstdint>
+#include <string>
+
+#include "commonStructs.h"
+#include "reccache.h"
+#include "reconstruction.h"
+
+// Reconstruction on a native server (monstermash-recserver, see
+// recserver.cpp) for clients too slow to run it themselves. The client
+// posts a request with the layer images and the inputs of RecData over
+// HTTP and gets back the reconstruction in the format stored in projects
+// (see saveReconstructionToStream()), the deformation is set up from it
+// locally. Any failure leaves the reconstruction to the client.
+
+// URL of the server (http://host[:port]/path) used by the reconstructions
+// from now on, empty to reconstruct locally. Set for the whole process,
+// like the threads of setLibraryNumThreads().
+void setReconstructionServer(const std::string &url);
+std::string reconstructionServer();
+
+// the request for computeReconstruction(recData, imgData, triangleOpts)
+void writeReconstructionRequest(std::string &request, const RecData &recData,
+                                const ImgData &imgData,
+                                const std::string &triangleOpts);
+// The inputs of a request, the layers are numbered by their order. False
+// if the request is not supported.
+bool readReconstructionRequest(const std::string &request, RecData &recData,
+                               ImgData &imgData, std::string &triangleOpts);
+// Server side, reconstructs the request with recCache kept between the
+// requests and writes the result to reply.
+bool answerReconstructionRequest(const std::string &request,
+                                 RecCache &recCache, std::string &reply);
+// Client side, true if the server returned the reconstruction of inputs
+// with the hash inputsHash (see reconstructionInputsHash()).
+bool computeReconstructionRemotely(const std::string &url,
+                                   const RecData &recData,
+                                   const ImgData &imgData,
+                                   const std::string &triangleOpts,
+                                   std::uint64_t inputsHash,
+                                   RecResult &result);
+
+#endif  // RECREMOTE_H
@@ -0,0 +1,192 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Reconstruction server for clients too slow to reconstruct themselves (see
+// recremote.h). The HTTP POST requests are answered one after another with
+// the per-region results cached between them, so a client that changed one
+// layer gets the others reused. The replies allow any origin, the page is
+// usually served from another host.
+//
+// monstermash-recserver [options]
+//   -p port    port to listen on (default 8090)
+//   -m MB      largest request accepted (default 256)
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "macros.h"
+#include "reccache.h"
+#include "recremote.h"
+
+using namespace std;
+
+namespace {
+
+struct ServerOptions {
+  int port = 8090;
+  size_t maxRequestSize = size_t(256) << 20;
+};
+
+void printUsage(const char *name) {
+  cerr << "usage: " << name << " [-p port] [-m MB]" << endl;
+}
+
+bool parseArgs(int argc, char *argv[], ServerOptions &opts) {
+  fora(i, 1, argc) {
+    const string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "-p" && hasValue) {
+      opts.port = atoi(argv[++i]);
+      if (opts.port <= 0 || opts.port > 65535) return false;
+    } else if (arg == "-m" && hasValue) {
+      const int mb = atoi(argv[++i]);
+      if (mb <= 0) return false;
+      opts.maxRequestSize = size_t(mb) << 20;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool sendAll(int fd, const string &data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    const ssize_t n = send(fd, data.data() + sent, data.size() - sent, 0);
+    if (n <= 0) return false;
+    sent += n;
+  }
+  return true;
+}
+
+// the method and the body of the request on fd, false if it is malformed or
+// its body is longer than maxSize
+bool readRequest(int fd, size_t maxSize, string &method, string &body) {
+  string data;
+  char buffer[65536];
+  size_t headerEnd;
+  while ((headerEnd = data.find("\r\n\r\n")) == string::npos) {
+    if (data.size() > sizeof(buffer)) return false;
+    const ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+    if (n <= 0) return false;
+    data.append(buffer, n);
+  }
+  string header = data.substr(0, headerEnd);
+  method = header.substr(0, header.find(' '));
+  // the names of the fields are case-insensitive
+  transform(header.begin(), header.end(), header.begin(),
+            [](unsigned char c) { return tolower(c); });
+  const string field = "\r\ncontent-length:";
+  const size_t pos = header.find(field);
+  const size_t length =
+      pos == string::npos
+          ? 0
+          : strtoull(header.c_str() + pos + field.size(), nullptr, 10);
+  if (length > maxSize) return false;
+  body = data.substr(headerEnd + 4);
+  while (body.size() < length) {
+    const ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+    if (n <= 0) return false;
+    body.append(buffer, n);
+  }
+  body.resize(length);
+  return true;
+}
+
+void writeReply(int fd, const string &status, const string &body) {
+  ostringstream header;
+  header << "HTTP/1.0 " << status << "\r\n"
+         << "Access-Control-Allow-Origin: *\r\n"
+         << "Access-Control-Allow-Methods: POST, OPTIONS\r\n"
+         << "Access-Control-Allow-Headers: Content-Type\r\n"
+         << "Content-Type: application/octet-stream\r\n"
+         << "Content-Length: " << body.size() << "\r\n\r\n";
+  if (sendAll(fd, header.str())) sendAll(fd, body);
+}
+
+void handleConnection(int fd, const ServerOptions &opts, RecCache &recCache) {
+  string method, request, reply;
+  if (!readRequest(fd, opts.maxRequestSize, method, request)) {
+    writeReply(fd, "400 Bad Request", "");
+    return;
+  }
+  // the preflight of the cross-origin POST from the page
+  if (method == "OPTIONS") {
+    writeReply(fd, "204 No Content", "");
+    return;
+  }
+  if (method != "POST") {
+    writeReply(fd, "405 Method Not Allowed", "");
+    return;
+  }
+  const auto start = chrono::steady_clock::now();
+  const bool ok = answerReconstructionRequest(request, recCache, reply);
+  const double ms = chrono::duration<double, milli>(
+                        chrono::steady_clock::now() - start)
+                        .count();
+  cout << "request of " << request.size() << " B: "
+       << (ok ? "reconstructed in " : "failed after ") << ms << " ms"
+       << endl;
+  if (ok) {
+    writeReply(fd, "200 OK", reply);
+  } else {
+    writeReply(fd, "422 Unprocessable Entity", "");
+  }
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  ServerOptions opts;
+  if (!parseArgs(argc, argv, opts)) {
+    printUsage(argv[0]);
+    return 1;
+  }
+  // a client that disconnects must not end the server
+  signal(SIGPIPE, SIG_IGN);
+
+  const int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  const int reuse = 1;
+  setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(opts.port);
+  if (listenFd == -1 ||
+      bind(listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+      listen(listenFd, 16) != 0) {
+    cerr << "cannot listen on port " << opts.port << endl;
+    return 1;
+  }
+  cout << "listening on port " << opts.port << endl;
+
+  RecCache recCache;
+  for (;;) {
+    const int fd = accept(listenFd, nullptr, nullptr);
+    if (fd == -1) continue;
+    handleConnection(fd, opts, recCache);
+    close(fd);
+  }
+}
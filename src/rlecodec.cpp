@@ -0,0 +1,176 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "rlecodec.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+using namespace std;
+
+namespace {
+
+enum Encoding : uint32_t { raw = 0, rle = 1 };
+
+// run-length codes a stream of bytes given in pieces, runs continue across
+// the pieces
+class RunCoder {
+ public:
+  void add(const unsigned char *p, size_t n) {
+    size_t i = 0;
+    while (i < n) {
+      if (length == 0 || p[i] != value) {
+        flush();
+        value = p[i];
+      }
+      size_t j = i + 1;
+      while (j < n && p[j] == value) j++;
+      length += j - i;
+      i = j;
+    }
+  }
+
+  void add(unsigned char v, size_t n) {
+    if (n == 0) return;
+    if (length == 0 || v != value) {
+      flush();
+      value = v;
+    }
+    length += n;
+  }
+
+  const string &finish() {
+    flush();
+    return runs;
+  }
+
+ private:
+  void flush() {
+    if (length == 0) return;
+    runs.push_back(value);
+    for (;; length >>= 7) {
+      if (length < 0x80) {
+        runs.push_back(static_cast<char>(length));
+        break;
+      }
+      runs.push_back(static_cast<char>(0x80 | (length & 0x7f)));
+    }
+    length = 0;
+  }
+
+  string runs;
+  unsigned char value = 0;
+  size_t length = 0;
+};
+
+// images that are not masks are stored raw if the runs don't pay off
+void writeEncoded(const string &runs, const unsigned char *data, size_t n,
+                  BinaryWriter &writer) {
+  if (runs.size() < n) {
+    writer.writeU32(rle);
+    writer.writeU32(runs.size());
+    writer.writeBytes(runs.data(), runs.size());
+  } else {
+    writer.writeU32(raw);
+    writer.writeU32(n);
+    writer.writeBytes(data, n);
+  }
+}
+
+void writeHeader(int w, int h, int ch, int alphaChannel,
+                 BinaryWriter &writer) {
+  writer.writeI32(w);
+  writer.writeI32(h);
+  writer.writeI32(ch);
+  writer.writeI32(alphaChannel);
+}
+
+}  // namespace
+
+void encodeRLE(const Imguc &I, BinaryWriter &writer) {
+  const size_t n = static_cast<size_t>(I.w) * I.h * I.ch;
+  RunCoder coder;
+  coder.add(I.data, n);
+  writeHeader(I.w, I.h, I.ch, I.alphaChannel, writer);
+  writeEncoded(coder.finish(), I.data, n, writer);
+}
+
+void encodeRLE(const TiledImage &I, BinaryWriter &writer) {
+  const int tileSize = TiledImage::tileSize;
+  RunCoder coder;
+  fora(y, 0, I.h) {
+    const int ty = y / tileSize, offset = (y % tileSize) * tileSize * I.ch;
+    fora(tx, 0, I.tilesX()) {
+      const size_t n = min(tileSize, I.w - tx * tileSize) * I.ch;
+      const unsigned char *t = I.tile(tx, ty);
+      if (t == nullptr) {
+        coder.add(I.background, n);
+      } else {
+        coder.add(t + offset, n);
+      }
+    }
+  }
+  const string &runs = coder.finish();
+  const size_t n = static_cast<size_t>(I.w) * I.h * I.ch;
+  Imguc dense;
+  if (runs.size() >= n) dense = I.toImage();
+  writeHeader(I.w, I.h, I.ch, I.alphaChannel, writer);
+  writeEncoded(runs, dense.data, n, writer);
+}
+
+bool decodeRLE(BinaryReader &reader, Imguc &I) {
+  const int w = reader.readI32();
+  const int h = reader.readI32();
+  const int ch = reader.readI32();
+  const int alphaChannel = reader.readI32();
+  const uint32_t encoding = reader.readU32();
+  const uint32_t size = reader.readU32();
+  if (!reader.ok() || w < 0 || h < 0 || ch <= 0 || ch > 4 ||
+      alphaChannel >= ch || (encoding != raw && encoding != rle) ||
+      size > reader.remaining()) {
+    return false;
+  }
+  const auto *runs =
+      reinterpret_cast<const unsigned char *>(reader.readBytes(size));
+  const size_t n = static_cast<size_t>(w) * h * ch;
+  if (runs == nullptr || (encoding == raw && size != n)) return false;
+
+  Imguc J(w, h, ch, alphaChannel);
+  if (encoding == raw) {
+    memcpy(J.data, runs, n);
+    I.swap(J);
+    return true;
+  }
+  size_t pos = 0, i = 0;
+  while (pos < size) {
+    if (size - pos < 2) return false;
+    const unsigned char value = runs[pos++];
+    size_t length = 0;
+    for (int shift = 0;; shift += 7) {
+      if (pos == size || shift > 56) return false;
+      const unsigned char b = runs[pos++];
+      length |= static_cast<size_t>(b & 0x7f) << shift;
+      if (!(b & 0x80)) break;
+    }
+    if (length == 0 || length > n - i) return false;
+    memset(J.data + i, value, length);
+    i += length;
+  }
+  if (i != n) return false;
+  I.swap(J);
+  return true;
+}
@@ -0,0 +1,36 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef RLECODEC_H
+#define RLECODEC_H
+
+#include <image/image.h>
+
+#include "binarychunks.h"
+#include "tiledimage.h"
+
+// Lossless run-length coding of 8-bit images. The layer masks (outlines and
+// regions) are mostly long runs of a few values, so they are a fraction of
+// the size of a PNG and coded without zlib. Each run is its value followed by
+// its length as an unsigned LEB128 varint, the pixels are in the order of
+// Imguc::data (rows of interleaved channels).
+void encodeRLE(const Imguc &I, BinaryWriter &writer);
+// the same data as for I.toImage(), the tiles that are not allocated are
+// coded without expanding them
+void encodeRLE(const TiledImage &I, BinaryWriter &writer);
+// fails on corrupted data, I is left untouched then
+bool decodeRLE(BinaryReader &reader, Imguc &I);
+
+#endif  // RLECODEC_H
@@ -0,0 +1,127 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "scene.h"
+
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+
+#include "animsolver.h"
+#include "loadsave.h"
+#include "reconstruction.h"
+
+using namespace Eigen;
+using namespace std;
+
+int Scene::addCharacter(const string &zipFn, const Vector3d &offset,
+                        int viewportW, int viewportH, WorkerPool *pool) {
+  auto c = make_unique<SceneCharacter>();
+  c->fn = zipFn;
+  c->offset = offset;
+  ImgData imgData;
+  RecData recData;
+  Imguc templateImg, backgroundImg;
+  ShadingOptions shadingOpts;
+  ManipulationMode manipulationMode;
+  bool middleMouseSimulation = false;
+  loadAllFromZip(zipFn, viewportW, viewportH, c->cpData, imgData, recData,
+                 c->cpData.savedCPs, templateImg, backgroundImg, shadingOpts,
+                 manipulationMode, middleMouseSimulation, pool);
+  if (imgData.layers.empty()) return -1;
+  if (!performReconstruction(recData, c->defData, c->cpData, imgData))
+    return -1;
+  characters.push_back(std::move(c));
+  charactersChanged = true;
+  return characters.size() - 1;
+}
+
+void Scene::removeCharacter(int i) {
+  characters.erase(characters.begin() + i);
+  charactersChanged = true;
+}
+
+void Scene::clear() {
+  characters.clear();
+  charactersChanged = true;
+}
+
+int Scene::size() const { return characters.size(); }
+
+SceneCharacter &Scene::getCharacter(int i) { return *characters[i]; }
+
+void Scene::update(double t, WorkerPool &pool) {
+  // longest processing time first, parallelFor() hands out the characters
+  // in this order
+  vector<int> order(characters.size());
+  iota(order.begin(), order.end(), 0);
+  stable_sort(order.begin(), order.end(), [&](int a, int b) {
+    return characters[a]->lastUpdateMs > characters[b]->lastUpdateMs;
+  });
+  pool.parallelFor(order.size(), 1, [&](int begin, int end) {
+    for (int j = begin; j < end; j++) {
+      SceneCharacter &c = *characters[order[j]];
+      const auto tStart = chrono::steady_clock::now();
+      DefData &defData = c.defData;
+      Mesh3D &mesh = defData.mesh;
+      if (mesh.VCurr.rows() == 0) continue;
+      if (c.cpData.cpAnimSync.getLength() > 0)
+        replayCPAnimations(c.cpData, defData.def, c.cpAnimBatch,
+                           t + c.timeOffset);
+      projectDefEng(defData).deform(defData.def, mesh);
+      defData.VCurr = mesh.VCurr;
+      defData.meshVersion++;
+      c.vertexNormals.compute(defData.VCurr, mesh.F, c.normals);
+      const chrono::duration<double, milli> elapsed =
+          chrono::steady_clock::now() - tStart;
+      c.lastUpdateMs = elapsed.count();
+    }
+  });
+  mergeMeshes(pool);
+}
+
+void Scene::mergeMeshes(WorkerPool &pool) {
+  const int n = characters.size();
+  if (charactersChanged) {
+    vertexStart.assign(n + 1, 0);
+    vector<int> faceStart(n + 1, 0);
+    for (int i = 0; i < n; i++) {
+      const Mesh3D &mesh = characters[i]->defData.mesh;
+      vertexStart[i + 1] = vertexStart[i] + mesh.VCurr.rows();
+      faceStart[i + 1] = faceStart[i] + mesh.F.rows();
+    }
+    F.resize(faceStart[n], 3);
+    for (int i = 0; i < n; i++) {
+      const MatrixXi &Fi = characters[i]->defData.mesh.F;
+      F.middleRows(faceStart[i], Fi.rows()) =
+          Fi.array() + vertexStart[i];
+    }
+    V.resize(vertexStart[n], 3);
+    N.resize(vertexStart[n], 3);
+    charactersChanged = false;
+  }
+  pool.parallelFor(n, 1, [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      const SceneCharacter &c = *characters[i];
+      const int rows = vertexStart[i + 1] - vertexStart[i];
+      if (c.defData.VCurr.rows() != rows || c.normals.rows() != rows)
+        continue;
+      V.middleRows(vertexStart[i], rows) =
+          c.defData.VCurr.rowwise() + c.offset.transpose();
+      N.middleRows(vertexStart[i], rows) = c.normals;
+    }
+  });
+  version++;
+}
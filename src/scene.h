@@ -0,0 +1,83 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <Eigen/Dense>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "commonStructs.h"
+#include "vertexnormals.h"
+#include "workerpool.h"
+
+// Character of a Scene: a project with its own CPs, animations and
+// deformation state, placed in the scene by offset.
+struct SceneCharacter {
+  std::string fn;
+  CPData cpData;
+  DefData defData;
+  Eigen::Vector3d offset = Eigen::Vector3d::Zero();
+  // the animation runs this many frames ahead of the scene
+  double timeOffset = 0;
+  Eigen::MatrixXd normals;
+  VertexNormals vertexNormals;
+  CPAnimBatch cpAnimBatch;
+  // duration of the last update, orders the characters in the next one
+  double lastUpdateMs = 0;
+};
+
+// Several independently animated characters shown together. update()
+// replays the animations of all of them and deforms them on a worker pool,
+// the slowest characters of the last update are started first so that the
+// threads finish together. The deformed characters are merged into a
+// single mesh (V, N, F) moved by their offsets, drawn at once.
+class Scene {
+ public:
+  // Loads and reconstructs the project zipFn (see loadAllFromZip()) as a
+  // new character, returns its index or -1 if it failed.
+  int addCharacter(const std::string &zipFn, const Eigen::Vector3d &offset,
+                   int viewportW, int viewportH, WorkerPool *pool = nullptr);
+  void removeCharacter(int i);
+  void clear();
+  int size() const;
+  SceneCharacter &getCharacter(int i);
+
+  // sets the animations of all characters to the timepoint t (plus their
+  // timeOffset) and deforms them
+  void update(double t, WorkerPool &pool);
+
+  // merged mesh of all characters, version is bumped when it changes
+  const Eigen::MatrixXd &getV() const { return V; }
+  const Eigen::MatrixXd &getN() const { return N; }
+  const Eigen::MatrixXi &getF() const { return F; }
+  std::uint64_t getVersion() const { return version; }
+
+ private:
+  void mergeMeshes(WorkerPool &pool);
+
+  std::vector<std::unique_ptr<SceneCharacter>> characters;
+  Eigen::MatrixXd V, N;
+  Eigen::MatrixXi F;
+  // first row of each character in V, the last entry is the total
+  std::vector<int> vertexStart;
+  bool charactersChanged = false;
+  std::uint64_t version = 0;
+};
+
+#endif  // SCENE_H
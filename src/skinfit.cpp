@@ -0,0 +1,95 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "skinfit.h"
+
+#include <miscutils/macros.h>
+
+#include <algorithm>
+#include <numeric>
+
+using namespace std;
+using namespace Eigen;
+
+void SkinFit::init(const MatrixXd &VBind, const MatrixXd &jointPos,
+                   const MatrixXd &weights) {
+  this->VBind = VBind;
+  this->jointPos = jointPos;
+  const int n = VBind.rows(), m = jointPos.rows();
+  joints.setZero(n, maxInfluences);
+  this->weights.setZero(n, maxInfluences);
+  influenced.assign(m, {});
+
+  vector<int> order(m);
+  fora(i, 0, n) {
+    iota(order.begin(), order.end(), 0);
+    const int k = min(m, maxInfluences);
+    partial_sort(order.begin(), order.begin() + k, order.end(),
+                 [&](int a, int b) { return weights(i, a) > weights(i, b); });
+    double sum = 0;
+    fora(j, 0, k) sum += max(0.0, weights(i, order[j]));
+    if (sum <= 0) continue;
+    fora(j, 0, k) {
+      const double w = max(0.0, weights(i, order[j])) / sum;
+      joints(i, j) = order[j];
+      this->weights(i, j) = w;
+      if (w > 0) influenced[order[j]].emplace_back(i, w);
+    }
+  }
+}
+
+void SkinFit::fit(const MatrixXd &V, MatrixXd &rotations,
+                  MatrixXd &translations) const {
+  const int m = jointPos.rows();
+  rotations.resize(m, 4);
+  translations.resize(m, 3);
+  fora(j, 0, m) {
+    const RowVector3d c = jointPos.row(j);
+    Quaterniond q = Quaterniond::Identity();
+    RowVector3d t = c;
+    const auto &verts = influenced[j];
+    double wSum = 0;
+    RowVector3d pMean = RowVector3d::Zero(), qMean = RowVector3d::Zero();
+    for (const auto &it : verts) {
+      wSum += it.second;
+      pMean += it.second * (VBind.row(it.first) - c);
+      qMean += it.second * V.row(it.first);
+    }
+    if (wSum > 0) {
+      pMean /= wSum;
+      qMean /= wSum;
+      // weighted Kabsch
+      Matrix3d H = Matrix3d::Zero();
+      for (const auto &it : verts) {
+        const RowVector3d p = VBind.row(it.first) - c - pMean;
+        const RowVector3d v = V.row(it.first) - qMean;
+        H += it.second * p.transpose() * v;
+      }
+      JacobiSVD<Matrix3d> svd(H, ComputeFullU | ComputeFullV);
+      Matrix3d D = Matrix3d::Identity();
+      D(2, 2) = (svd.matrixV() * svd.matrixU().transpose()).determinant() < 0
+                    ? -1
+                    : 1;
+      const Matrix3d R = svd.matrixV() * D * svd.matrixU().transpose();
+      q = Quaterniond(R).normalized();
+      t = qMean - (R * pMean.transpose()).transpose();
+    }
+    rotations.row(j) << q.x(), q.y(), q.z(), q.w();
+    translations.row(j) = t;
+  }
+}
+
+const MatrixXi &SkinFit::getJoints() const { return joints; }
+
+const MatrixXd &SkinFit::getWeights() const { return weights; }
@@ -0,0 +1,53 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SKINFIT_H
+#define SKINFIT_H
+
+#include <Eigen/Dense>
+#include <vector>
+
+// Approximates deformed frames of a mesh by linear blend skinning with given
+// joints and per-vertex weights, e.g. a joint per control point with the
+// weights of DefEngLBS, to export animations as joint poses.
+//
+// Each vertex keeps its maxInfluences largest weights (renormalized), as
+// glTF skins support. The pose of a joint is the rigid transform of its
+// position in the bind pose (R * (v - jointPos) + t) that best maps the
+// vertices it influences to the frame, in the weighted least squares sense.
+class SkinFit {
+ public:
+  static constexpr int maxInfluences = 4;
+
+  // VBind are the vertices in the bind pose, weights has a column per joint
+  void init(const Eigen::MatrixXd &VBind, const Eigen::MatrixXd &jointPos,
+            const Eigen::MatrixXd &weights);
+  // rotations as quaternions (x, y, z, w) and translations of the joints
+  // for the deformed vertices V
+  void fit(const Eigen::MatrixXd &V, Eigen::MatrixXd &rotations,
+           Eigen::MatrixXd &translations) const;
+
+  // vertices x maxInfluences, the joints and weights kept for each vertex
+  const Eigen::MatrixXi &getJoints() const;
+  const Eigen::MatrixXd &getWeights() const;
+
+ private:
+  Eigen::MatrixXd VBind, jointPos;
+  Eigen::MatrixXi joints;
+  Eigen::MatrixXd weights;
+  // vertices influenced by each joint and their weights
+  std::vector<std::vector<std::pair<int, double>>> influenced;
+};
+
+#endif  // SKINFIT_H
@@ -0,0 +1,306 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "softrasterizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "macros.h"
+
+using namespace std;
+using namespace Eigen;
+
+namespace {
+
+const int tileSize = 64;
+// pixels processed at once by the vectorized part
+const int lanes = 8;
+typedef Array<float, lanes, 1> Lanes;
+typedef Array<bool, lanes, 1> LanesMask;
+
+struct ProjectedVertex {
+  float x, y, z;  // pixel coordinates and NDC depth
+  float invW;     // for perspective correct interpolation
+  Vector3f e, n;  // view direction and normal in view space
+};
+
+// Edge i gives the barycentric coordinate of vertex i as a linear function
+// a * x + b * y + c of the pixel position.
+struct Triangle {
+  int v[3];
+  float a[3], b[3], c[3];
+  int x0, y0, x1, y1;  // bounding box, x1 and y1 excluded
+};
+
+bool setupTriangle(const vector<ProjectedVertex> &pv, const RowVector3i &f,
+                   int w, int h, Triangle &t) {
+  const ProjectedVertex *p[3];
+  fora(i, 0, 3) {
+    t.v[i] = f(i);
+    p[i] = &pv[f(i)];
+    // no clipping, triangles reaching behind the camera are skipped
+    if (p[i]->invW <= 0) return false;
+  }
+  const float area = (p[1]->x - p[0]->x) * (p[2]->y - p[0]->y) -
+                     (p[1]->y - p[0]->y) * (p[2]->x - p[0]->x);
+  if (fabs(area) < 1e-8f) return false;
+  fora(i, 0, 3) {
+    // edge opposite to vertex i, normalized so that it is 1 at vertex i
+    const ProjectedVertex &q0 = *p[(i + 1) % 3];
+    const ProjectedVertex &q1 = *p[(i + 2) % 3];
+    t.a[i] = (q0.y - q1.y) / area;
+    t.b[i] = (q1.x - q0.x) / area;
+    t.c[i] = (q0.x * q1.y - q1.x * q0.y) / area;
+  }
+  const float minX = min({p[0]->x, p[1]->x, p[2]->x});
+  const float maxX = max({p[0]->x, p[1]->x, p[2]->x});
+  const float minY = min({p[0]->y, p[1]->y, p[2]->y});
+  const float maxY = max({p[0]->y, p[1]->y, p[2]->y});
+  t.x0 = max(0, static_cast<int>(floor(minX)));
+  t.y0 = max(0, static_cast<int>(floor(minY)));
+  t.x1 = min(w, static_cast<int>(ceil(maxX)) + 1);
+  t.y1 = min(h, static_cast<int>(ceil(maxY)) + 1);
+  return t.x0 < t.x1 && t.y0 < t.y1;
+}
+
+// the matcap fragment shader
+void shade(const ProjectedVertex *p[3], const float l[3], const Imguc &matcap,
+           unsigned char *rgba) {
+  float q[3], sum = 0;
+  fora(i, 0, 3) {
+    q[i] = l[i] * p[i]->invW;
+    sum += q[i];
+  }
+  Vector3f e = Vector3f::Zero(), n = Vector3f::Zero();
+  fora(i, 0, 3) {
+    e += (q[i] / sum) * p[i]->e;
+    n += (q[i] / sum) * p[i]->n;
+  }
+  e.normalize();
+  n.normalize();
+  if (matcap.isNull()) {
+    const unsigned char g = 255 * max(n(2), 0.f);
+    rgba[0] = rgba[1] = rgba[2] = g;
+  } else {
+    const Vector3f r = e - 2 * n.dot(e) * n;
+    const float m =
+        2 * sqrt(r(0) * r(0) + r(1) * r(1) + (r(2) + 1) * (r(2) + 1));
+    const int u = clamp(static_cast<int>((r(0) / m + 0.5f) * matcap.w), 0,
+                        matcap.w - 1);
+    const int v = clamp(static_cast<int>((r(1) / m + 0.5f) * matcap.h), 0,
+                        matcap.h - 1);
+    fora(c, 0, 3) rgba[c] = matcap(u, v, min(c, matcap.ch - 1));
+  }
+  rgba[3] = 255;
+}
+
+void rasterizeTile(int tx0, int ty0, int tx1, int ty1,
+                   const vector<int> &triangleIds,
+                   const vector<Triangle> &triangles,
+                   const vector<ProjectedVertex> &pv, const Imguc &matcap,
+                   Imguc &colorBuffer, Img<float> &depthBuffer) {
+  const int w = colorBuffer.w;
+  fora(y, ty0, ty1) {
+    fill(colorBuffer.data + 4 * (y * w + tx0),
+         colorBuffer.data + 4 * (y * w + tx1), 0);
+    fill(&depthBuffer(tx0, y, 0), &depthBuffer(tx0, y, 0) + (tx1 - tx0), 1.f);
+  }
+
+  Lanes ramp;
+  fora(i, 0, lanes) ramp(i) = i + 0.5f;
+  for (int id : triangleIds) {
+    const Triangle &t = triangles[id];
+    const ProjectedVertex *p[3] = {&pv[t.v[0]], &pv[t.v[1]], &pv[t.v[2]]};
+    const int x0 = max(tx0, t.x0), x1 = min(tx1, t.x1);
+    const int y0 = max(ty0, t.y0), y1 = min(ty1, t.y1);
+    fora(y, y0, y1) {
+      const float py = y + 0.5f;
+      float *depthRow = &depthBuffer(0, y, 0);
+      for (int x = x0; x < x1; x += lanes) {
+        const int n = min(lanes, x1 - x);
+        const Lanes px = ramp + x;
+        const Lanes l0 = t.a[0] * px + (t.b[0] * py + t.c[0]);
+        const Lanes l1 = t.a[1] * px + (t.b[1] * py + t.c[1]);
+        const Lanes l2 = t.a[2] * px + (t.b[2] * py + t.c[2]);
+        const Lanes z = l0 * p[0]->z + l1 * p[1]->z + l2 * p[2]->z;
+        Lanes depth = Lanes::Constant(-2);  // beyond the row nothing passes
+        copy(depthRow + x, depthRow + x + n, depth.data());
+        const LanesMask pass = (l0.min(l1).min(l2) >= 0.f) && (z < depth) &&
+                               (z >= -1.f);
+        if (!pass.any()) continue;
+        fora(i, 0, n) {
+          if (!pass(i)) continue;
+          depthRow[x + i] = z(i);
+          const float l[3] = {l0(i), l1(i), l2(i)};
+          shade(p, l, matcap, &colorBuffer(x + i, y, 0));
+        }
+      }
+    }
+  }
+}
+
+// floor(a / b) for b > 0
+int64_t floorDiv(int64_t a, int64_t b) {
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+}  // namespace
+
+bool setupRasterTriangle(const double p[3][2], int w, int h,
+                         RasterTriangle &t) {
+  const int subpixelBits = 8;
+  const int64_t one = 1 << subpixelBits, half = one / 2;
+  const double maxCoord = 1 << 20;
+  int64_t X[3], Y[3];
+  fora(i, 0, 3) {
+    // also false for NaN
+    if (!(fabs(p[i][0]) <= maxCoord && fabs(p[i][1]) <= maxCoord)) {
+      return false;
+    }
+    X[i] = llround(p[i][0] * one);
+    Y[i] = llround(p[i][1] * one);
+    t.corner[i] = i;
+  }
+  int64_t area = (X[1] - X[0]) * (Y[2] - Y[0]) - (Y[1] - Y[0]) * (X[2] - X[0]);
+  if (area == 0) return false;
+  if (area < 0) {
+    swap(X[1], X[2]);
+    swap(Y[1], Y[2]);
+    swap(t.corner[1], t.corner[2]);
+    area = -area;
+  }
+  fora(i, 0, 3) {
+    // the edge from q to r is positive on the side of vertex i, at the
+    // center (x * one + half, y * one + half) of the pixel (x, y)
+    const int q = (i + 1) % 3, r = (i + 2) % 3;
+    const int64_t dx = X[r] - X[q], dy = Y[r] - Y[q];
+    t.a[i] = -dy * one;
+    t.b[i] = dx * one;
+    // with y down, a top edge is horizontal with the triangle below it and
+    // a left edge has the triangle on its right, the other edges do not
+    // own their pixels
+    const bool topLeft = dy < 0 || (dy == 0 && dx > 0);
+    t.bias[i] = topLeft ? 0 : 1;
+    t.c[i] = dx * (half - Y[q]) - dy * (half - X[q]) - t.bias[i];
+  }
+  t.invArea = 1.0f / area;
+  // the first and last pixel centers inside the bounding box
+  const int64_t minX = min({X[0], X[1], X[2]}), maxX = max({X[0], X[1], X[2]});
+  const int64_t minY = min({Y[0], Y[1], Y[2]}), maxY = max({Y[0], Y[1], Y[2]});
+  t.x0 = max<int64_t>(0, floorDiv(minX - half + one - 1, one));
+  t.y0 = max<int64_t>(0, floorDiv(minY - half + one - 1, one));
+  t.x1 = min<int64_t>(w, floorDiv(maxX - half, one) + 1);
+  t.y1 = min<int64_t>(h, floorDiv(maxY - half, one) + 1);
+  return t.x0 < t.x1 && t.y0 < t.y1;
+}
+
+void forEachRasterTile(
+    const std::vector<RasterTriangle> &triangles, int w, int h,
+    const std::function<void(int, int, int, int, const std::vector<int> &)>
+        &tile,
+    WorkerPool *pool) {
+  const int tilesX = (w + tileSize - 1) / tileSize;
+  const int tilesY = (h + tileSize - 1) / tileSize;
+  vector<vector<int>> bins(tilesX * tilesY);
+  forlist(i, triangles) {
+    const RasterTriangle &t = triangles[i];
+    if (t.face < 0) continue;
+    fora(ty, t.y0 / tileSize, (t.y1 - 1) / tileSize + 1) {
+      fora(tx, t.x0 / tileSize, (t.x1 - 1) / tileSize + 1) {
+        bins[ty * tilesX + tx].push_back(i);
+      }
+    }
+  }
+  auto body = [&](int begin, int end) {
+    fora(i, begin, end) {
+      if (bins[i].empty()) continue;
+      const int tx = i % tilesX, ty = i / tilesX;
+      tile(tx * tileSize, ty * tileSize, min(w, (tx + 1) * tileSize),
+           min(h, (ty + 1) * tileSize), bins[i]);
+    }
+  };
+  if (pool != nullptr)
+    pool->parallelFor(bins.size(), 1, body);
+  else
+    body(0, bins.size());
+}
+
+void rasterizeMatcap(const Eigen::MatrixXd &V, const Eigen::MatrixXi &F,
+                     const Eigen::MatrixXd &N, const Eigen::Matrix4d &P,
+                     const Eigen::Matrix4d &M, const Imguc &matcap,
+                     Imguc &colorBuffer, Img<float> &depthBuffer,
+                     WorkerPool *pool) {
+  const int w = colorBuffer.w, h = colorBuffer.h;
+  if (depthBuffer.w != w || depthBuffer.h != h || depthBuffer.ch != 1) {
+    depthBuffer = Img<float>(w, h, 1);
+  }
+  auto parallelFor = [&](int n, int chunkSize,
+                         const function<void(int, int)> &body) {
+    if (pool != nullptr)
+      pool->parallelFor(n, chunkSize, body);
+    else
+      body(0, n);
+  };
+
+  // vertex shader
+  const Matrix4d PM = P * M;
+  const Matrix3d normalMatrix = M.inverse().transpose().topLeftCorner<3, 3>();
+  vector<ProjectedVertex> pv(V.rows());
+  parallelFor(V.rows(), 1024, [&](int begin, int end) {
+    fora(i, begin, end) {
+      const Vector4d v = V.row(i).transpose().homogeneous();
+      const Vector4d clip = PM * v;
+      ProjectedVertex &q = pv[i];
+      q.invW = 1.0 / clip(3);
+      q.x = (clip(0) * q.invW + 1) * 0.5 * w;
+      q.y = (1 - clip(1) * q.invW) * 0.5 * h;
+      q.z = clip(2) * q.invW;
+      q.e = (M * v).head<3>().normalized().cast<float>();
+      q.n = (normalMatrix * N.row(i).transpose()).normalized().cast<float>();
+    }
+  });
+
+  vector<Triangle> triangles(F.rows());
+  vector<char> valid(F.rows());
+  parallelFor(F.rows(), 1024, [&](int begin, int end) {
+    fora(i, begin, end) {
+      valid[i] = setupTriangle(pv, F.row(i), w, h, triangles[i]);
+    }
+  });
+
+  // bin the triangles to the tiles, in their order to keep depth ties stable
+  const int tilesX = (w + tileSize - 1) / tileSize;
+  const int tilesY = (h + tileSize - 1) / tileSize;
+  vector<vector<int>> bins(tilesX * tilesY);
+  fora(i, 0, F.rows()) {
+    if (!valid[i]) continue;
+    const Triangle &t = triangles[i];
+    fora(ty, t.y0 / tileSize, (t.y1 - 1) / tileSize + 1) {
+      fora(tx, t.x0 / tileSize, (t.x1 - 1) / tileSize + 1) {
+        bins[ty * tilesX + tx].push_back(i);
+      }
+    }
+  }
+
+  parallelFor(bins.size(), 1, [&](int begin, int end) {
+    fora(i, begin, end) {
+      const int tx = i % tilesX, ty = i / tilesX;
+      rasterizeTile(tx * tileSize, ty * tileSize, min(w, (tx + 1) * tileSize),
+                    min(h, (ty + 1) * tileSize), bins[i], triangles, pv,
+                    matcap, colorBuffer, depthBuffer);
+    }
+  });
+}
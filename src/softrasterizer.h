@@ -0,0 +1,165 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SOFTRASTERIZER_H
+#define SOFTRASTERIZER_H
+
+#include <image/image.h>
+
+#include <Eigen/Dense>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "workerpool.h"
+
+// Renders the mesh V, F with per-vertex normals N on the CPU as the matcap
+// shader does on the GPU (see shaderMatcap.h). P and M are the projection
+// and view matrices as uploaded to the shader, so the result matches
+// drawModelOpenGL.
+//
+// The image is split into tiles, the triangles are binned to the tiles they
+// overlap and the tiles are rasterized in parallel on pool (serially if it is
+// null). Edge functions and depth test are evaluated for 8 pixels at once
+// with Eigen's vectorized arrays. colorBuffer (RGBA) and depthBuffer (one
+// channel of the same size) are cleared first, pixels not covered by the
+// mesh are left transparent.
+void rasterizeMatcap(const Eigen::MatrixXd &V, const Eigen::MatrixXi &F,
+                     const Eigen::MatrixXd &N, const Eigen::Matrix4d &P,
+                     const Eigen::Matrix4d &M, const Imguc &matcap,
+                     Imguc &colorBuffer, Img<float> &depthBuffer,
+                     WorkerPool *pool = nullptr);
+
+// A triangle of rasterizeTriangles() in fixed point with 8 subpixel bits.
+// Edge i (opposite to vertex i) is e[i] = a[i] * x + b[i] * y + c[i] at the
+// center of the pixel (x, y), biased so that the pixels covered by the
+// triangle are those with all three non-negative (top-left fill rule).
+struct RasterTriangle {
+  int face = -1;
+  // column of the face in F of each vertex, the order is the one of
+  // positive area
+  int corner[3];
+  std::int64_t a[3], b[3], c[3], bias[3];
+  float invArea = 0;
+  int x0 = 0, y0 = 0, x1 = 0, y1 = 0;  // pixels covered, x1 and y1 excluded
+};
+
+// Sets up the triangle with the vertices p (pixel coordinates) for an image
+// w x h, false if it covers no pixel center. Triangles with a vertex more
+// than 2^20 pixels away are skipped, their edge functions would overflow.
+bool setupRasterTriangle(const double p[3][2], int w, int h,
+                         RasterTriangle &t);
+
+// Calls tile(x0, y0, x1, y1, ids) for each tile of an image w x h that
+// overlaps triangles, ids being these triangles in their order. The tiles
+// are processed in parallel on pool (serially if it is null).
+void forEachRasterTile(
+    const std::vector<RasterTriangle> &triangles, int w, int h,
+    const std::function<void(int, int, int, int, const std::vector<int> &)>
+        &tile,
+    WorkerPool *pool);
+
+// Calls shader(x, y, face, l) for the pixels of t in the rectangle
+// [x0, x1) x [y0, y1), l being the barycentric coordinates of the pixel
+// center in the order of the vertices of the face. The edge functions are
+// stepped incrementally over blocks of 4 pixels and a row is left as soon
+// as its covered span ends.
+template <typename ShaderT>
+void rasterizeTriangleInRect(const RasterTriangle &t, int x0, int y0, int x1,
+                             int y1, ShaderT &shader) {
+  constexpr int block = 4;
+  x0 = std::max(x0, t.x0);
+  y0 = std::max(y0, t.y0);
+  x1 = std::min(x1, t.x1);
+  y1 = std::min(y1, t.y1);
+  if (x0 >= x1 || y0 >= y1) return;
+  std::int64_t row[3];
+  for (int i = 0; i < 3; i++) row[i] = t.a[i] * x0 + t.b[i] * y0 + t.c[i];
+  for (int y = y0; y < y1; y++) {
+    std::int64_t e[3][block];
+    for (int i = 0; i < 3; i++) {
+      for (int k = 0; k < block; k++) e[i][k] = row[i] + t.a[i] * k;
+    }
+    bool entered = false;
+    for (int x = x0; x < x1; x += block) {
+      // all three edges non-negative, i.e. no sign bit in their or
+      int mask = 0;
+      for (int k = 0; k < block; k++) {
+        mask |= ((e[0][k] | e[1][k] | e[2][k]) >= 0) << k;
+      }
+      if (x1 - x < block) mask &= (1 << (x1 - x)) - 1;
+      if (mask != 0) {
+        entered = true;
+        for (int k = 0; k < block; k++) {
+          if (!(mask & (1 << k))) continue;
+          Eigen::Vector3f l;
+          for (int i = 0; i < 3; i++) {
+            l(t.corner[i]) = (e[i][k] + t.bias[i]) * t.invArea;
+          }
+          shader(x + k, y, t.face, l);
+        }
+      } else if (entered) {
+        break;  // the covered pixels of a row are contiguous
+      }
+      for (int i = 0; i < 3; i++) {
+        for (int k = 0; k < block; k++) e[i][k] += t.a[i] * block;
+      }
+    }
+    for (int i = 0; i < 3; i++) row[i] += t.b[i];
+  }
+}
+
+// Calls shader(x, y, face, l) for each pixel of an image width x height
+// whose center is covered by a face of F, the vertices V having the pixel
+// coordinates in their first two columns (x to the right, y down, pixel
+// (x, y) spanning [x, x + 1) x [y, y + 1)), l being the barycentric
+// coordinates (Eigen::Vector3f) of the center. A pixel on an edge shared by
+// two faces goes to one of them (top-left rule), e.g. for ID buffers
+// without gaps or overlaps. The image is split into tiles with the faces
+// binned to them and the tiles are rasterized in parallel on pool, so the
+// shader is called concurrently but never for the same pixel, and for each
+// pixel in the order of F.
+template <typename Derived, typename ShaderT>
+void rasterizeTriangles(const Eigen::MatrixBase<Derived> &V,
+                        const Eigen::MatrixXi &F, int width, int height,
+                        ShaderT &&shader, WorkerPool *pool = nullptr) {
+  std::vector<RasterTriangle> triangles(F.rows());
+  auto setup = [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      double p[3][2];
+      for (int j = 0; j < 3; j++) {
+        p[j][0] = static_cast<double>(V(F(i, j), 0));
+        p[j][1] = static_cast<double>(V(F(i, j), 1));
+      }
+      if (setupRasterTriangle(p, width, height, triangles[i])) {
+        triangles[i].face = i;
+      }
+    }
+  };
+  if (pool != nullptr)
+    pool->parallelFor(F.rows(), 1024, setup);
+  else
+    setup(0, F.rows());
+  forEachRasterTile(
+      triangles, width, height,
+      [&](int x0, int y0, int x1, int y1, const std::vector<int> &ids) {
+        for (int id : ids) {
+          rasterizeTriangleInRect(triangles[id], x0, y0, x1, y1, shader);
+        }
+      },
+      pool);
+}
+
+#endif  // SOFTRASTERIZER_H
@@ -0,0 +1,369 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "supernodalllt.h"
+
+#include <Eigen/src/OrderingMethods/Amd-mod.h>
+#include <Eigen/src/OrderingMethods/Ordering-mod.h>
+#include <miscutils/macros.h>
+
+#include <algorithm>
+
+using namespace std;
+using namespace Eigen;
+
+namespace {
+
+// Strictly upper (upper set) or lower triangle of P A P^T by columns: the
+// rows of column j are idx[start[j] .. start[j + 1] - 1], unsorted.
+void permutedPattern(const SparseMatrix<double> &A, const vector<int> &iperm,
+                     bool upper, vector<int> &start, vector<int> &idx) {
+  const int n = A.rows();
+  const int *outer = A.outerIndexPtr(), *inner = A.innerIndexPtr();
+  auto keep = [&](int i, int j) { return upper ? i < j : i > j; };
+  start.assign(n + 1, 0);
+  fora(c, 0, n) {
+    fora(k, outer[c], outer[c + 1]) {
+      if (keep(iperm[inner[k]], iperm[c])) start[iperm[c] + 1]++;
+    }
+  }
+  fora(j, 0, n) start[j + 1] += start[j];
+  idx.resize(start[n]);
+  vector<int> fill(start.begin(), start.end() - 1);
+  fora(c, 0, n) {
+    fora(k, outer[c], outer[c + 1]) {
+      const int i = iperm[inner[k]], j = iperm[c];
+      if (keep(i, j)) idx[fill[j]++] = i;
+    }
+  }
+}
+
+// parent of each column in the elimination tree (-1 for roots) given the
+// upper triangle of the matrix, with path compression through ancestor
+vector<int> eliminationTree(const vector<int> &upperStart,
+                            const vector<int> &upper) {
+  const int n = upperStart.size() - 1;
+  vector<int> parent(n, -1), ancestor(n, -1);
+  fora(k, 0, n) {
+    fora(p, upperStart[k], upperStart[k + 1]) {
+      for (int i = upper[p]; i != -1 && i < k;) {
+        const int next = ancestor[i];
+        ancestor[i] = k;
+        if (next == -1) parent[i] = k;
+        i = next;
+      }
+    }
+  }
+  return parent;
+}
+
+// nodes of the forest in a depth-first postorder, the children of a node
+// and the roots in increasing order
+vector<int> postorder(const vector<int> &parent) {
+  const int n = parent.size();
+  vector<int> head(n, -1), next(n, -1), stack, post;
+  for (int j = n - 1; j >= 0; j--) {
+    if (parent[j] == -1) continue;
+    next[j] = head[parent[j]];
+    head[parent[j]] = j;
+  }
+  post.reserve(n);
+  fora(root, 0, n) {
+    if (parent[root] != -1) continue;
+    stack.push_back(root);
+    while (!stack.empty()) {
+      const int p = stack.back();
+      const int child = head[p];
+      if (child == -1) {
+        stack.pop_back();
+        post.push_back(p);
+      } else {
+        head[p] = next[child];
+        stack.push_back(child);
+      }
+    }
+  }
+  return post;
+}
+
+}  // namespace
+
+void SupernodalLLT::compute(const SparseMatrix<double> &A) {
+  analyzePattern(A);
+  factorize(A);
+}
+
+bool SupernodalLLT::samePattern(const SparseMatrix<double> &A) const {
+  return A.rows() == n && A.cols() == n &&
+         static_cast<int>(AInner.size()) == A.nonZeros() &&
+         equal(AOuter.begin(), AOuter.end(), A.outerIndexPtr()) &&
+         equal(AInner.begin(), AInner.end(), A.innerIndexPtr());
+}
+
+void SupernodalLLT::analyzePattern(const SparseMatrix<double> &A) {
+  if (!A.isCompressed()) {
+    SparseMatrix<double> C = A;
+    C.makeCompressed();
+    analyzePattern(C);
+    return;
+  }
+  n = A.rows();
+  status = Success;
+  if (n == 0) {
+    nSuper = 0;
+    perm.clear();
+    iperm.clear();
+    superStart.assign(1, 0);
+    colToSuper.clear();
+    rowStart.assign(1, 0);
+    rowIdx.clear();
+    valStart.assign(1, 0);
+    values.clear();
+    AOuter.assign(1, 0);
+    AInner.clear();
+    AToL.clear();
+    return;
+  }
+
+  // fill-reducing ordering, relabeled in a postorder of its elimination
+  // tree so that the chains of columns forming the supernodes are
+  // consecutive
+  PermutationMatrix<Dynamic, Dynamic, int> P;
+  AMDOrdering<int> ordering;
+  ordering(A, P);
+  perm.assign(P.indices().data(), P.indices().data() + n);
+  iperm.resize(n);
+  fora(i, 0, n) iperm[perm[i]] = i;
+  vector<int> upperStart, upper;
+  permutedPattern(A, iperm, true, upperStart, upper);
+  const vector<int> post = postorder(eliminationTree(upperStart, upper));
+  vector<int> permAMD = perm;
+  fora(i, 0, n) perm[i] = permAMD[post[i]];
+  fora(i, 0, n) iperm[perm[i]] = i;
+  permutedPattern(A, iperm, true, upperStart, upper);
+  const vector<int> parent = eliminationTree(upperStart, upper);
+
+  // entries of the columns of L (including the diagonal) from the row
+  // subtrees of the elimination tree
+  vector<int> colCount(n, 1), mark(n, -1);
+  fora(k, 0, n) {
+    mark[k] = k;
+    fora(p, upperStart[k], upperStart[k + 1]) {
+      for (int j = upper[p]; mark[j] != k; j = parent[j]) {
+        colCount[j]++;
+        mark[j] = k;
+      }
+    }
+  }
+
+  // Column j joins the supernode of column j - 1 if it is its parent. The
+  // supernode then has the rows of column j and the columns before it, which
+  // adds explicit zeros unless the structures of the columns are nested.
+  // Some are allowed for narrow supernodes (the relaxed amalgamation of
+  // CHOLMOD with its default limits), the dense kernels are faster than
+  // many tiny supernodes.
+  superStart.assign(1, 0);
+  long long nonZeros = n > 0 ? colCount[0] : 0;
+  fora(j, 1, n) {
+    const int s = superStart.back();
+    bool merge = parent[j - 1] == j;
+    if (merge) {
+      const long long w = j - s + 1, m = j - s + colCount[j];
+      const long long stored = w * m - w * (w - 1) / 2;
+      const double zeros = stored - nonZeros - colCount[j];
+      merge = colCount[j - 1] == colCount[j] + 1 || w <= 4 ||
+              (w <= 16 && zeros <= 0.8 * stored) ||
+              (w <= 48 && zeros <= 0.1 * stored) || zeros <= 0.05 * stored;
+    }
+    if (merge) {
+      nonZeros += colCount[j];
+    } else {
+      superStart.push_back(j);
+      nonZeros = colCount[j];
+    }
+  }
+  superStart.push_back(n);
+  nSuper = superStart.size() - 1;
+  colToSuper.resize(n);
+  fora(S, 0, nSuper) {
+    fora(j, superStart[S], superStart[S + 1]) colToSuper[j] = S;
+  }
+
+  // rows of each supernode: its columns, the entries of A below them and
+  // the rows of its children below it
+  vector<int> lowerStart, lower;
+  permutedPattern(A, iperm, false, lowerStart, lower);
+  vector<int> childHead(nSuper, -1), childNext(nSuper, -1);
+  for (int S = nSuper - 1; S >= 0; S--) {
+    const int p = parent[superStart[S + 1] - 1];
+    if (p == -1) continue;
+    childNext[S] = childHead[colToSuper[p]];
+    childHead[colToSuper[p]] = S;
+  }
+  rowStart.assign(1, 0);
+  rowIdx.clear();
+  fill(mark.begin(), mark.end(), -1);
+  fora(S, 0, nSuper) {
+    const int s = superStart[S], e = superStart[S + 1];
+    fora(j, s, e) {
+      rowIdx.push_back(j);
+      mark[j] = S;
+    }
+    const size_t below = rowIdx.size();
+    auto add = [&](int i) {
+      if (i < e || mark[i] == S) return;
+      rowIdx.push_back(i);
+      mark[i] = S;
+    };
+    fora(j, s, e) fora(p, lowerStart[j], lowerStart[j + 1]) add(lower[p]);
+    for (int C = childHead[S]; C != -1; C = childNext[C]) {
+      const int w = superStart[C + 1] - superStart[C];
+      fora(p, rowStart[C] + w, rowStart[C + 1]) add(rowIdx[p]);
+    }
+    sort(rowIdx.begin() + below, rowIdx.end());
+    rowStart.push_back(rowIdx.size());
+  }
+  valStart.assign(1, 0);
+  fora(S, 0, nSuper) {
+    const size_t w = superStart[S + 1] - superStart[S];
+    valStart.push_back(valStart.back() + w * (rowStart[S + 1] - rowStart[S]));
+  }
+  values.assign(valStart.back(), 0.0);
+
+  // where factorize() puts the entries of A
+  AOuter.assign(A.outerIndexPtr(), A.outerIndexPtr() + n + 1);
+  AInner.assign(A.innerIndexPtr(), A.innerIndexPtr() + A.nonZeros());
+  AToL.assign(AInner.size(), -1);
+  fora(c, 0, n) {
+    const int j = iperm[c];
+    const int S = colToSuper[j];
+    const int *rowsBegin = rowIdx.data() + rowStart[S];
+    const int *rowsEnd = rowIdx.data() + rowStart[S + 1];
+    const size_t m = rowsEnd - rowsBegin;
+    fora(k, AOuter[c], AOuter[c + 1]) {
+      const int i = iperm[AInner[k]];
+      if (i < j) continue;
+      const size_t row = lower_bound(rowsBegin, rowsEnd, i) - rowsBegin;
+      AToL[k] = valStart[S] + (j - superStart[S]) * m + row;
+    }
+  }
+}
+
+void SupernodalLLT::factorize(const SparseMatrix<double> &A) {
+  if (!A.isCompressed()) {
+    SparseMatrix<double> C = A;
+    C.makeCompressed();
+    factorize(C);
+    return;
+  }
+  if (!samePattern(A)) analyzePattern(A);
+  fill(values.begin(), values.end(), 0.0);
+  const double *AValues = A.valuePtr();
+  fora(k, 0, AToL.size()) {
+    if (AToL[k] >= 0) values[AToL[k]] += AValues[k];
+  }
+
+  // Left-looking: each supernode receives the updates of its descendants
+  // before it is factorized. head[S] lists the descendants with rows in the
+  // columns of S not applied yet, ptr[D] is the first such row of D.
+  vector<int> head(nSuper, -1), next(nSuper, -1), ptr(nSuper, 0), rel(n);
+  vector<double> buffer;
+  fora(S, 0, nSuper) {
+    const int s = superStart[S], w = superStart[S + 1] - s;
+    const int *rows = rowIdx.data() + rowStart[S];
+    const int m = rowStart[S + 1] - rowStart[S];
+    fora(i, 0, m) rel[rows[i]] = i;
+    Map<MatrixXd> LS(values.data() + valStart[S], m, w);
+
+    for (int D = head[S]; D != -1;) {
+      const int nextD = next[D];
+      const int *rowsD = rowIdx.data() + rowStart[D];
+      const int mD = rowStart[D + 1] - rowStart[D];
+      const int wD = superStart[D + 1] - superStart[D];
+      const int p1 = ptr[D];
+      int p2 = p1;
+      while (p2 < mD && rowsD[p2] < s + w) p2++;
+      Map<const MatrixXd> LD(values.data() + valStart[D], mD, wD);
+      // the lower part of the update of the columns p1 .. p2 - 1
+      const int mU = mD - p1, wU = p2 - p1;
+      buffer.resize(size_t(mU) * wU);
+      Map<MatrixXd> U(buffer.data(), mU, wU);
+      U.noalias() = LD.middleRows(p1, mU) * LD.middleRows(p1, wU).transpose();
+      fora(jj, 0, wU) {
+        double *col = LS.col(rowsD[p1 + jj] - s).data();
+        fora(ii, jj, mU) col[rel[rowsD[p1 + ii]]] -= U(ii, jj);
+      }
+      ptr[D] = p2;
+      if (p2 < mD) {
+        const int T = colToSuper[rowsD[p2]];
+        next[D] = head[T];
+        head[T] = D;
+      }
+      D = nextD;
+    }
+
+    Ref<MatrixXd> L11 = LS.topRows(w);
+    if (internal::llt_inplace<double, Lower>::blocked(L11) >= 0) {
+      status = NumericalIssue;
+      return;
+    }
+    if (m > w) {
+      L11.triangularView<Lower>().transpose().solveInPlace<OnTheRight>(
+          LS.bottomRows(m - w));
+      ptr[S] = w;
+      const int T = colToSuper[rows[w]];
+      next[S] = head[T];
+      head[T] = S;
+    }
+  }
+  status = Success;
+}
+
+MatrixXd SupernodalLLT::solve(const MatrixXd &B) const {
+  const int cols = B.cols();
+  MatrixXd X(n, cols), T;
+  fora(i, 0, n) X.row(i) = B.row(perm[i]);
+
+  // L Y = P B
+  fora(S, 0, nSuper) {
+    const int s = superStart[S], w = superStart[S + 1] - s;
+    const int *rows = rowIdx.data() + rowStart[S];
+    const int m = rowStart[S + 1] - rowStart[S];
+    Map<const MatrixXd> LS(values.data() + valStart[S], m, w);
+    auto XS = X.middleRows(s, w);
+    LS.topRows(w).triangularView<Lower>().solveInPlace(XS);
+    if (m == w) continue;
+    T.noalias() = LS.bottomRows(m - w) * XS;
+    fora(i, 0, m - w) X.row(rows[w + i]) -= T.row(i);
+  }
+
+  // L^T P X = Y
+  for (int S = nSuper - 1; S >= 0; S--) {
+    const int s = superStart[S], w = superStart[S + 1] - s;
+    const int *rows = rowIdx.data() + rowStart[S];
+    const int m = rowStart[S + 1] - rowStart[S];
+    Map<const MatrixXd> LS(values.data() + valStart[S], m, w);
+    auto XS = X.middleRows(s, w);
+    if (m > w) {
+      T.resize(m - w, cols);
+      fora(i, 0, m - w) T.row(i) = X.row(rows[w + i]);
+      XS.noalias() -= LS.bottomRows(m - w).transpose() * T;
+    }
+    LS.topRows(w).transpose().triangularView<Upper>().solveInPlace(XS);
+  }
+
+  MatrixXd result(n, cols);
+  fora(i, 0, n) result.row(perm[i]) = X.row(i);
+  return result;
+}
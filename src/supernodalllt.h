@@ -0,0 +1,71 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SUPERNODALLLT_H
+#define SUPERNODALLLT_H
+
+#include <Eigen/Core>
+#include <Eigen/Dense>
+#include <Eigen/src/SparseCore/SparseSolverBase-mod.h>
+#include <Eigen/Sparse>
+#include <cstddef>
+#include <vector>
+
+// Sparse Cholesky factorization P A P^T = L L^T of a symmetric positive
+// definite matrix. Unlike Eigen's SimplicialLLT, which updates L an entry at
+// a time, consecutive columns of L with the same structure below the
+// diagonal are grouped into supernodes stored as dense blocks, so the
+// factorization and the solves run as dense matrix products and triangular
+// solves on the blocks. It pays off for large meshes, where the separators
+// of the fill-reducing ordering give wide supernodes.
+//
+// The matrix has to be given with both triangles. factorize() reuses the
+// ordering and the symbolic factorization of analyzePattern() for a matrix
+// of the same pattern, it redoes them if the pattern differs.
+class SupernodalLLT {
+ public:
+  void compute(const Eigen::SparseMatrix<double> &A);
+  void analyzePattern(const Eigen::SparseMatrix<double> &A);
+  void factorize(const Eigen::SparseMatrix<double> &A);
+  // NumericalIssue if the matrix is not positive definite
+  Eigen::ComputationInfo info() const { return status; }
+  // A^-1 * B for any number of columns of B
+  Eigen::MatrixXd solve(const Eigen::MatrixXd &B) const;
+
+  int rows() const { return n; }
+  int numSupernodes() const { return nSuper; }
+  // stored entries of L including the explicit zeros of the supernodes
+  std::size_t nonZeros() const { return values.size(); }
+
+ private:
+  bool samePattern(const Eigen::SparseMatrix<double> &A) const;
+
+  int n = 0, nSuper = 0;
+  // perm[new] = old index of the rows and columns of A
+  std::vector<int> perm, iperm;
+  // columns superStart[s] .. superStart[s + 1] - 1 of L form the supernode
+  // s, its rows are rowIdx[rowStart[s] ..], the first ones being its own
+  // columns, and its values the column-major block at values[valStart[s]]
+  std::vector<int> superStart, colToSuper;
+  std::vector<int> rowStart, rowIdx;
+  std::vector<std::size_t> valStart;
+  std::vector<double> values;
+  // pattern of the analyzed A and the position in values of each of its
+  // entries (-1 for those of the upper triangle of P A P^T)
+  std::vector<int> AOuter, AInner;
+  std::vector<std::ptrdiff_t> AToL;
+  Eigen::ComputationInfo status = Eigen::InvalidInput;
+};
+
+#endif  // SUPERNODALLLT_H
@@ -0,0 +1,133 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "textureatlas.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <vector>
+
+#define STB_RECT_PACK_IMPLEMENTATION
+#include <stb_rect_pack.h>
+
+#include "macros.h"
+
+using namespace std;
+using namespace Eigen;
+
+namespace {
+
+int findRoot(vector<int> &parent, int i) {
+  while (parent[i] != i) {
+    parent[i] = parent[parent[i]];
+    i = parent[i];
+  }
+  return i;
+}
+
+}  // namespace
+
+bool buildTextureAtlas(const MatrixXd &VRest, const MatrixXi &F,
+                       const Imguc &canvas, int padding, TextureAtlas &atlas) {
+  const int n = VRest.rows();
+  if (F.rows() == 0 || n == 0 || canvas.w <= 0 || canvas.h <= 0) return false;
+
+  // islands of vertices connected by the faces
+  vector<int> parent(n);
+  iota(parent.begin(), parent.end(), 0);
+  fora(i, 0, F.rows()) {
+    const int a = findRoot(parent, F(i, 0));
+    fora(j, 1, F.cols()) {
+      const int b = findRoot(parent, F(i, j));
+      if (a != b) parent[b] = a;
+    }
+  }
+  vector<int> island(n, -1), roots(n, -1);
+  vector<char> used(n, 0);
+  fora(i, 0, F.rows()) fora(j, 0, F.cols()) used[F(i, j)] = 1;
+  int nIslands = 0;
+  fora(i, 0, n) {
+    if (!used[i]) continue;
+    const int r = findRoot(parent, i);
+    if (roots[r] == -1) roots[r] = nIslands++;
+    island[i] = roots[r];
+  }
+
+  // their bounding boxes on the canvas
+  vector<int> x0(nIslands, canvas.w), y0(nIslands, canvas.h);
+  vector<int> x1(nIslands, 0), y1(nIslands, 0);
+  fora(i, 0, n) {
+    const int k = island[i];
+    if (k == -1) continue;
+    x0[k] = min(x0[k], static_cast<int>(floor(VRest(i, 0))) - padding);
+    y0[k] = min(y0[k], static_cast<int>(floor(VRest(i, 1))) - padding);
+    x1[k] = max(x1[k], static_cast<int>(ceil(VRest(i, 0))) + padding);
+    y1[k] = max(y1[k], static_cast<int>(ceil(VRest(i, 1))) + padding);
+  }
+  vector<stbrp_rect> rects(nIslands);
+  long long area = 0;
+  int maxW = 1;
+  fora(k, 0, nIslands) {
+    x0[k] = max(x0[k], 0);
+    y0[k] = max(y0[k], 0);
+    x1[k] = max(min(x1[k], canvas.w), x0[k] + 1);
+    y1[k] = max(min(y1[k], canvas.h), y0[k] + 1);
+    rects[k].id = k;
+    rects[k].w = x1[k] - x0[k];
+    rects[k].h = y1[k] - y0[k];
+    area += static_cast<long long>(rects[k].w) * rects[k].h;
+    maxW = max(maxW, static_cast<int>(rects[k].w));
+  }
+
+  // about square, the height is trimmed to the rectangles placed
+  const int w = min(max(static_cast<int>(ceil(sqrt(area * 1.1))), maxW),
+                    canvas.w);
+  long long sumH = 0;
+  for (const auto &r : rects) sumH += r.h;
+  const int hMax = static_cast<int>(min<long long>(sumH, 0xffff));
+  stbrp_context context;
+  vector<stbrp_node> nodes(w);
+  stbrp_init_target(&context, w, hMax, nodes.data(), nodes.size());
+  if (!stbrp_pack_rects(&context, rects.data(), rects.size())) return false;
+  int h = 1;
+  for (const auto &r : rects) h = max(h, r.y + r.h);
+  if (static_cast<long long>(w) * h >=
+      static_cast<long long>(canvas.w) * canvas.h) {
+    return false;
+  }
+
+  atlas.img = Imguc(w, h, canvas.ch, canvas.alphaChannel);
+  atlas.img.fill(0);
+  const int ch = canvas.ch;
+  for (const auto &r : rects) {
+    const int k = r.id;
+    fora(y, 0, r.h) {
+      memcpy(&atlas.img.data[((r.y + y) * w + r.x) * ch],
+             &canvas.data[((y0[k] + y) * canvas.w + x0[k]) * ch],
+             r.w * ch);
+    }
+  }
+  atlas.coords = MatrixXd::Zero(n, 2);
+  fora(i, 0, n) {
+    const int k = island[i];
+    if (k == -1) continue;
+    const stbrp_rect &r = rects[k];
+    atlas.coords(i, 0) = VRest(i, 0) - x0[k] + r.x;
+    atlas.coords(i, 1) = VRest(i, 1) - y0[k] + r.y;
+  }
+  return true;
+}
@@ -0,0 +1,42 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef TEXTUREATLAS_H
+#define TEXTUREATLAS_H
+
+#include <image/image.h>
+
+#include <Eigen/Dense>
+
+// Texture of a mesh drawn over the whole canvas (its texture coordinates are
+// the x, y of the rest pose in pixels of the canvas) packed to a smaller
+// image. The faces are split into islands connected through their vertices
+// and the bounding box of each island on the canvas, with padding pixels
+// around, is copied to a rectangle placed by stb_rect_pack. Most of the
+// canvas of a drawing is background, so the atlas of a character is usually
+// a fraction of it.
+struct TextureAtlas {
+  Imguc img;
+  // per vertex texture coordinates in pixels of img, replacing the x, y of
+  // the rest pose
+  Eigen::MatrixXd coords;
+};
+
+// false if there are no faces or the atlas would not be smaller than the
+// canvas
+bool buildTextureAtlas(const Eigen::MatrixXd &VRest, const Eigen::MatrixXi &F,
+                       const Imguc &canvas, int padding, TextureAtlas &atlas);
+
+#endif  // TEXTUREATLAS_H
@@ -0,0 +1,123 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tiledimage.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "macros.h"
+
+using namespace std;
+
+TiledImage::TiledImage(const Imguc &I, unsigned char background)
+    : w(I.w),
+      h(I.h),
+      ch(I.ch),
+      alphaChannel(I.alphaChannel),
+      background(background),
+      nTilesX((I.w + tileSize - 1) / tileSize),
+      nTilesY((I.h + tileSize - 1) / tileSize),
+      tiles(nTilesX * nTilesY) {
+  const int rowBytes = tileSize * ch;
+  fora(ty, 0, nTilesY) fora(tx, 0, nTilesX) {
+    const int x0 = tx * tileSize, y0 = ty * tileSize;
+    const int n = min(tileSize, w - x0) * ch, th = min(tileSize, h - y0);
+    bool empty = true;
+    fora(y, 0, th) {
+      const unsigned char *p = &I(x0, y0 + y, 0);
+      if (!all_of(p, p + n,
+                  [&](unsigned char v) { return v == background; })) {
+        empty = false;
+        break;
+      }
+    }
+    if (empty) continue;
+    auto t = make_shared<Tile>(tileSize * rowBytes, background);
+    fora(y, 0, th) memcpy(&(*t)[y * rowBytes], &I(x0, y0 + y, 0), n);
+    tiles[ty * nTilesX + tx] = std::move(t);
+  }
+}
+
+TiledImage::TiledImage(const Imguc &I, unsigned char background,
+                       const TiledImage &previous)
+    : TiledImage(I, background) {
+  if (w != previous.w || h != previous.h || ch != previous.ch ||
+      background != previous.background) {
+    return;
+  }
+  forlist(i, tiles) {
+    const shared_ptr<const Tile> &p = previous.tiles[i];
+    if (tiles[i] != nullptr && p != nullptr && *tiles[i] == *p) tiles[i] = p;
+  }
+}
+
+Imguc TiledImage::toImage() const {
+  if (isNull()) return Imguc();
+  Imguc I(w, h, ch, alphaChannel);
+  memset(I.data, background, static_cast<size_t>(w) * h * ch);
+  const int rowBytes = tileSize * ch;
+  fora(ty, 0, nTilesY) fora(tx, 0, nTilesX) {
+    const unsigned char *t = tile(tx, ty);
+    if (t == nullptr) continue;
+    const int x0 = tx * tileSize, y0 = ty * tileSize;
+    const int n = min(tileSize, w - x0) * ch, th = min(tileSize, h - y0);
+    fora(y, 0, th) memcpy(&I(x0, y0 + y, 0), t + y * rowBytes, n);
+  }
+  return I;
+}
+
+bool TiledImage::isNull() const { return w == 0 && h == 0; }
+
+void TiledImage::setNull() { *this = TiledImage(); }
+
+unsigned char TiledImage::operator()(int x, int y, int c) const {
+  const unsigned char *t = tile(x / tileSize, y / tileSize);
+  if (t == nullptr) return background;
+  return t[((y % tileSize) * tileSize + x % tileSize) * ch + c];
+}
+
+bool TiledImage::equalData(const TiledImage &other) const {
+  if (w != other.w || h != other.h || ch != other.ch) return false;
+  const int rowBytes = tileSize * ch;
+  fora(ty, 0, nTilesY) fora(tx, 0, nTilesX) {
+    const unsigned char *a = tile(tx, ty), *b = other.tile(tx, ty);
+    if (a == b && (a != nullptr || background == other.background)) continue;
+    const int n = min(tileSize, w - tx * tileSize) * ch;
+    const int th = min(tileSize, h - ty * tileSize);
+    fora(y, 0, th) fora(i, 0, n) {
+      const unsigned char va = a != nullptr ? a[y * rowBytes + i] : background;
+      const unsigned char vb =
+          b != nullptr ? b[y * rowBytes + i] : other.background;
+      if (va != vb) return false;
+    }
+  }
+  return true;
+}
+
+bool TiledImage::sameTiles(const TiledImage &other) const {
+  return w == other.w && h == other.h && ch == other.ch &&
+         alphaChannel == other.alphaChannel &&
+         background == other.background && tiles == other.tiles;
+}
+
+const unsigned char *TiledImage::tile(int tx, int ty) const {
+  const Tile *t = tiles[ty * nTilesX + tx].get();
+  return t != nullptr ? t->data() : nullptr;
+}
+
+int TiledImage::numAllocatedTiles() const {
+  return count_if(tiles.begin(), tiles.end(),
+                  [](const shared_ptr<const Tile> &t) { return t != nullptr; });
+}
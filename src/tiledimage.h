@@ -0,0 +1,65 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TILEDIMAGE_H
+#define TILEDIMAGE_H
+
+#include <image/image.h>
+
+#include <memory>
+#include <vector>
+
+// 8-bit image stored in square tiles, only the tiles with a pixel different
+// from the background value are allocated. Used for the layer images, so
+// their memory follows the drawn area instead of the size of the canvas.
+// The tiles are never modified, copies of an image share them.
+class TiledImage {
+ public:
+  static constexpr int tileSize = 64;
+
+  TiledImage() = default;
+  TiledImage(const Imguc &I, unsigned char background);
+  // the tiles equal to the ones of previous (an image of the same size and
+  // background) are shared with it, e.g. to keep the earlier version of an
+  // edited image for undo at the cost of the changed tiles only
+  TiledImage(const Imguc &I, unsigned char background,
+             const TiledImage &previous);
+
+  Imguc toImage() const;
+  bool isNull() const;
+  void setNull();
+  unsigned char operator()(int x, int y, int c) const;
+  bool equalData(const TiledImage &other) const;
+  // the images are copies of each other, cheaper than equalData()
+  bool sameTiles(const TiledImage &other) const;
+
+  int tilesX() const { return nTilesX; }
+  int tilesY() const { return nTilesY; }
+  // the pixels of the tile (tx, ty) in rows of tileSize pixels of
+  // interleaved channels, the tiles on the right and bottom edges are padded
+  // with the background, nullptr if all the pixels are background
+  const unsigned char *tile(int tx, int ty) const;
+  int numAllocatedTiles() const;
+
+  int w = 0, h = 0, ch = 0, alphaChannel = -1;
+  unsigned char background = 0;
+
+ private:
+  using Tile = std::vector<unsigned char>;
+
+  int nTilesX = 0, nTilesY = 0;
+  std::vector<std::shared_ptr<const Tile>> tiles;
+};
+
+#endif  // TILEDIMAGE_H
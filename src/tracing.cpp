@@ -0,0 +1,98 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tracing.h"
+
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+
+std::atomic<bool> traceEnabledFlag{false};
+
+namespace {
+
+struct Event {
+  string name;
+  int tid;
+  double tsUs, durUs;
+};
+
+// keeps a forgotten trace from eating all the memory
+const size_t maxEvents = 1000000;
+
+mutex eventsMutex;
+vector<Event> events;
+const TraceTimepoint traceOrigin = chrono::steady_clock::now();
+
+int threadId() {
+  static atomic<int> nextId{1};
+  thread_local int id = nextId++;
+  return id;
+}
+
+void writeEscaped(ostream &os, const string &s) {
+  for (char c : s) {
+    if (c == '"' || c == '\\') os << '\\';
+    os << c;
+  }
+}
+
+}  // namespace
+
+void traceEnable(bool enabled) { traceEnabledFlag = enabled; }
+
+void traceClear() {
+  lock_guard<mutex> lock(eventsMutex);
+  events.clear();
+}
+
+void traceEvent(const std::string &name, TraceTimepoint begin,
+                TraceTimepoint end) {
+  if (!traceEnabled()) return;
+  Event e;
+  e.name = name;
+  e.tid = threadId();
+  e.tsUs = chrono::duration<double, micro>(begin - traceOrigin).count();
+  e.durUs = chrono::duration<double, micro>(end - begin).count();
+  lock_guard<mutex> lock(eventsMutex);
+  if (events.size() < maxEvents) events.push_back(move(e));
+}
+
+std::string traceToJSON() {
+  lock_guard<mutex> lock(eventsMutex);
+  ostringstream oss;
+  oss << fixed;
+  oss.precision(3);
+  oss << "{\"traceEvents\":[";
+  for (size_t i = 0; i < events.size(); i++) {
+    const Event &e = events[i];
+    if (i > 0) oss << ",";
+    oss << "{\"name\":\"";
+    writeEscaped(oss, e.name);
+    oss << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.tid
+        << ",\"ts\":" << e.tsUs << ",\"dur\":" << e.durUs << "}";
+  }
+  oss << "]}";
+  return oss.str();
+}
+
+bool traceSave(const std::string &fn) {
+  ofstream file(fn);
+  if (!file) return false;
+  file << traceToJSON();
+  return static_cast<bool>(file);
+}
@@ -0,0 +1,68 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TRACING_H
+#define TRACING_H
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+// Trace events in the Chrome trace-event format (chrome://tracing, Perfetto)
+// recorded from any thread while tracing is enabled at runtime. A disabled
+// TraceScope costs one relaxed atomic load.
+//
+// TRACE_SCOPE("name") records the enclosing block as a complete event. The
+// name has to outlive the TraceScope (e.g. a string literal), it is copied
+// only if tracing is enabled.
+
+typedef std::chrono::steady_clock::time_point TraceTimepoint;
+
+extern std::atomic<bool> traceEnabledFlag;
+
+inline bool traceEnabled() {
+  return traceEnabledFlag.load(std::memory_order_relaxed);
+}
+void traceEnable(bool enabled);
+void traceClear();
+// records a complete event of the calling thread
+void traceEvent(const std::string &name, TraceTimepoint begin,
+                TraceTimepoint end);
+// all recorded events as {"traceEvents":[...]}
+std::string traceToJSON();
+bool traceSave(const std::string &fn);
+
+class TraceScope {
+ public:
+  explicit TraceScope(const char *name) : name(name) {
+    if (traceEnabled()) begin = std::chrono::steady_clock::now();
+  }
+  ~TraceScope() {
+    if (traceEnabled() && begin != TraceTimepoint()) {
+      traceEvent(name, begin, std::chrono::steady_clock::now());
+    }
+  }
+  TraceScope(const TraceScope &) = delete;
+  TraceScope &operator=(const TraceScope &) = delete;
+
+ private:
+  const char *name;
+  TraceTimepoint begin;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+
+#endif  // TRACING_H
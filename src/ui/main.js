@@ -12,6 +12,68 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+// Calls a function exported from main.cpp and returns a promise of its
+// result. In the build with the engine in a worker
+// (MM_EMSCRIPTEN_ENGINE_WORKER) the call is posted to the worker with
+// engineCall(), calls made before the engine started are queued and the
+// replies come back in order through js_engineReply(). Otherwise the
+// function is called right away.
+var mm = {
+  started: false,
+  queued: [],
+  pending: {},
+  nextRequestId: 0,
+  call: function(name) {
+    var args = Array.prototype.slice.call(arguments, 1);
+    if (typeof Module._engineCall !== 'function') {
+      return Promise.resolve(Module['_' + name].apply(null, args));
+    }
+    return new Promise(function(resolve) {
+      var requestId = mm.nextRequestId++;
+      mm.pending[requestId] = resolve;
+      var post = function() {
+        var numArgs = args.map(Number);
+        while (numArgs.length < 6) numArgs.push(0);
+        ccall('engineCall', null,
+              ['number', 'string', 'number', 'number', 'number', 'number',
+               'number', 'number'],
+              [requestId, name].concat(numArgs));
+      };
+      if (mm.started) post();
+      else mm.queued.push(post);
+    });
+  }
+};
+function js_engineStarted() {
+  mm.started = true;
+  mm.queued.forEach(function(post) { post(); });
+  mm.queued = [];
+}
+function js_engineReply(requestId, result) {
+  var resolve = mm.pending[requestId];
+  delete mm.pending[requestId];
+  resolve(result);
+}
+
+// Downloads the profile of the functions called so far in the instrumented
+// build (MM_EMSCRIPTEN_SPLIT_MODULE), call it from the console after using
+// everything that should be in the primary module.
+function saveSplitProfile() {
+  var writeProfile = Module['___write_profile'] ||
+      (typeof wasmExports !== 'undefined' && wasmExports['__write_profile']);
+  if (!writeProfile) {
+    console.log('not an instrumented build');
+    return;
+  }
+  const size = writeProfile(0, 0);
+  const ptr = _malloc(size);
+  writeProfile(ptr, size);
+  var blob = new Blob([HEAPU8.slice(ptr, ptr + size)],
+                      { type: "application/octet-stream" });
+  _free(ptr);
+  saveAs(blob, "profile.data");
+}
+
 function importFile(obj, fileName, onloadendFunc) {
   if (obj.files.length == 0) return;
   var reader = new FileReader();
@@ -24,6 +86,126 @@ function importFile(obj, fileName, onloadendFunc) {
   obj.value = ''; // clear the value so that it's possible to upload the same file once again
 }
 
+// Example projects are streamed with HTTP range requests: the central
+// directory of the zip is read from its end, then the entries needed to show
+// the project (project.bin with the layers, settings and control points, the
+// reconstruction) are fetched and the project is opened from a zip of just
+// these. The template and the background image follow in the background and
+// are added with loadExampleProjectImages(). A server ignoring the ranges
+// sends the whole zip in the first response, it is opened at once.
+const exampleProjects = ['antelope', 'bird', 'box', 'helene-dino',
+                         'helene-wienerdog', 'heart', 'chihuahua',
+                         'helene-tree'];
+// incremented by every opened project, the images of an example arriving
+// after another project was opened are dropped
+var exampleRequest = 0;
+function fetchRange(url, range) {
+  return fetch(url, { headers: { Range: 'bytes=' + range } })
+      .then(function(response) {
+    if (!response.ok) throw new Error(url + ': ' + response.status);
+    return response.arrayBuffer().then(function(data) {
+      const total = (response.headers.get('Content-Range') || '').split('/')[1];
+      return { partial: response.status == 206, total: parseInt(total),
+               data: new Uint8Array(data) };
+    });
+  });
+}
+// the entries of the zip central directory cd as {name, record, offset}
+function zipCentralDirectory(cd) {
+  const view = new DataView(cd.buffer, cd.byteOffset, cd.byteLength);
+  var entries = [];
+  for (var p = 0; p + 46 <= cd.length && view.getUint32(p, true) == 0x02014b50;) {
+    const nameLength = view.getUint16(p + 28, true);
+    const length = 46 + nameLength + view.getUint16(p + 30, true) +
+                   view.getUint16(p + 32, true);
+    entries.push({
+      name: new TextDecoder().decode(cd.subarray(p + 46, p + 46 + nameLength)),
+      record: cd.subarray(p, p + length),
+      offset: view.getUint32(p + 42, true)
+    });
+    p += length;
+  }
+  return entries;
+}
+// a zip of the given entries, each with the bytes of its local record in
+// data (header, data and descriptor as stored in the original zip)
+function makeZip(entries) {
+  var size = 22;
+  entries.forEach(function(e) { size += e.data.length + e.record.length; });
+  var zip = new Uint8Array(size);
+  const view = new DataView(zip.buffer);
+  var p = 0;
+  entries.forEach(function(e) { zip.set(e.data, p); e.newOffset = p; p += e.data.length; });
+  const cdOffset = p;
+  entries.forEach(function(e) {
+    zip.set(e.record, p);
+    view.setUint32(p + 42, e.newOffset, true);
+    p += e.record.length;
+  });
+  view.setUint32(p, 0x06054b50, true);
+  view.setUint16(p + 8, entries.length, true);
+  view.setUint16(p + 10, entries.length, true);
+  view.setUint32(p + 12, p - cdOffset, true);
+  view.setUint32(p + 16, cdOffset, true);
+  return zip;
+}
+function isDeferredExampleEntry(name) {
+  return /(^|\/)(template|bg)\.png$/.test(name);
+}
+function openExample(exampleId) {
+  const request = ++exampleRequest;
+  const url = 'examples/' + exampleProjects[exampleId] + '.zip';
+  const fn = '/tmp/examples/' + exampleProjects[exampleId] + '.zip';
+  const open = function(zip, name) {
+    FS.mkdirTree('/tmp/examples');
+    FS.writeFile(fn, zip);
+    return request == exampleRequest ? mm.call(name, exampleId) : null;
+  };
+  // the end of central directory record with up to a 64 kB comment
+  fetchRange(url, '-65557').then(function(tail) {
+    if (!tail.partial) return open(tail.data, 'openExampleProject');
+    const view = new DataView(tail.data.buffer);
+    var eocd = tail.data.length - 22;
+    while (eocd >= 0 && view.getUint32(eocd, true) != 0x06054b50) eocd--;
+    if (eocd < 0) throw new Error(url + ': not a zip file');
+    const cdSize = view.getUint32(eocd + 12, true);
+    const cdOffset = view.getUint32(eocd + 16, true);
+    const tailOffset = tail.total - tail.data.length;
+    const cd = cdOffset >= tailOffset ?
+        Promise.resolve(tail.data.subarray(cdOffset - tailOffset,
+                                           cdOffset - tailOffset + cdSize)) :
+        fetchRange(url, cdOffset + '-' + (cdOffset + cdSize - 1))
+            .then(function(r) { return r.data; });
+    return cd.then(function(cd) {
+      const entries = zipCentralDirectory(cd);
+      // a local record ends where the next one or the central directory
+      // starts
+      const ends = entries.map(function(e) { return e.offset; })
+                       .concat([cdOffset]).sort(function(a, b) { return a - b; });
+      const fetchEntries = function(entries) {
+        return Promise.all(entries.map(function(e) {
+          const end = ends.find(function(o) { return o > e.offset; });
+          return fetchRange(url, e.offset + '-' + (end - 1))
+              .then(function(r) { e.data = r.data; });
+        }));
+      };
+      const first = entries.filter(function(e) { return !isDeferredExampleEntry(e.name); });
+      const rest = entries.filter(function(e) { return isDeferredExampleEntry(e.name); });
+      return fetchEntries(first).then(function() {
+        return open(makeZip(first), 'openExampleProject');
+      }).then(function() {
+        if (rest.length == 0 || request != exampleRequest) return;
+        return fetchEntries(rest).then(function() {
+          return open(makeZip(entries), 'loadExampleProjectImages');
+        });
+      });
+    });
+  }).catch(function(error) {
+    console.log(error);
+    if (request == exampleRequest) alert('The example could not be loaded.');
+  });
+}
+
 // open/save project, import/export template
 $('#dropdownOpenProject').click(function() {
   $('#buttonOpenProject').click();
@@ -31,24 +213,25 @@ $('#dropdownOpenProject').click(function() {
 $('#buttonOpenProject').change(function() {
   $('#buttonDraw').click();
   importFile(this, "/tmp/projectOpened.zip", function() {
-    Module._openProject();
+    exampleRequest++;
+    mm.call('openProject');
   });
 });
 $('#buttonSaveProject, #dropdownSaveProject').click(function() {
-  Module._saveProject();
+  mm.call('saveProject');
 });
 $('#buttonExportTextureTemplate, #buttonExportTextureTemplateFileMenu').click(function() {
-  Module._exportTextureTemplate();
+  mm.call('exportTextureTemplate');
 });
 $('#buttonImportTemplateImage').change(function() {
   importFile(this, "/tmp/template.img", function() {
-    Module._loadTemplateImage();
+    mm.call('loadTemplateImage');
     $('#buttonShowTemplateImage').prop('checked', true);
   });
 });
 $('#buttonImportBackgroundImage').change(function() {
   importFile(this, "/tmp/bg.img", function() {
-    Module._loadBackgroundImage();
+    mm.call('loadBackgroundImage');
     $('#buttonShowBackgroundImage').prop('checked', true);
   });
 });
@@ -89,7 +272,9 @@ function js_frameExportedToOBJ() {
   var blob = new Blob([content], {type: "model/obj" });
   saveAs(blob, "mm_frame.obj");
   
-  if (Module._hasTemplateImage() && Module._getTemplateImageVisibility()) {
+  Promise.all([mm.call('hasTemplateImage'),
+               mm.call('getTemplateImageVisibility')]).then(function(r) {
+    if (!r[0] || !r[1]) return;
     var timeout = 100;
     setTimeout(function() {
         const content = FS.readFile("/tmp/mm_frame.mtl");
@@ -101,7 +286,7 @@ function js_frameExportedToOBJ() {
         var blob = new Blob([content], {type: "image/png" });
         saveAs(blob, "mm_frame.png");
     }, 2*timeout);
-  }
+  });
 }
 function js_exportAnimationProgress(progress) {
   var progressEl = $('#exportAnimationProgress');
@@ -117,10 +302,23 @@ function js_exportAnimationFinished() {
   abortBtnEl.addClass('disabled');
   abortBtnEl.prop('disabled', true);
   progressEl.addClass('bg-success');
+  exportAnimationRunning = false;
 
-  const content = FS.readFile("/tmp/mm_project.glb");
-  var blob = new Blob([content], { type: "application/octet-stream" });
-  saveAs(blob, "mm_project.glb");
+  // the GLB is read from the WASM memory, the view is only valid until the
+  // memory grows, and a view of shared memory (pthreads build) can't be
+  // passed to a blob without copying it first
+  Promise.all([mm.call('getExportedModelData'),
+               mm.call('getExportedModelSize')]).then(function(r) {
+    const ptr = r[0], size = r[1];
+    var content = HEAPU8.subarray(ptr, ptr + size);
+    if (typeof SharedArrayBuffer !== "undefined" &&
+        content.buffer instanceof SharedArrayBuffer) {
+      content = content.slice();
+    }
+    var blob = new Blob([content], { type: "application/octet-stream" });
+    mm.call('releaseExportedModel');
+    saveAs(blob, "mm_project.glb");
+  });
 }
 function js_recordingModeStopped() {
   $('.buttonRecord').removeClass('active');
@@ -128,18 +326,27 @@ function js_recordingModeStopped() {
 
 function resetToModuleState() {
   $('#buttonRotate').removeClass('active');
-  if (Module._isMiddleMouseSimulationEnabled()) $('#buttonRotate').addClass('active');
-  $('#buttonShowControlPins').prop('checked', Module._getCPsVisibility());
-  $('#buttonShowTemplateImage').prop('checked', Module._getTemplateImageVisibility());
-  $('#buttonShowBackgroundImage').prop('checked', Module._getBackgroundImageVisibility());
-  $('#buttonUseTextureShading').prop('checked', Module._isTextureShadingEnabled());
-  $('#buttonEnableArmpitsStitching').prop('checked', Module._isArmpitsStitchingEnabled());
-  $('#buttonEnableNormalSmoothing').prop('checked', Module._isNormalSmoothingEnabled());
+  mm.call('isMiddleMouseSimulationEnabled').then(function(enabled) {
+    if (enabled) $('#buttonRotate').addClass('active');
+  });
+  var setChecked = function(selector, getter) {
+    mm.call(getter).then(function(checked) {
+      $(selector).prop('checked', !!checked);
+    });
+  };
+  setChecked('#buttonShowControlPins', 'getCPsVisibility');
+  setChecked('#buttonShowTemplateImage', 'getTemplateImageVisibility');
+  setChecked('#buttonShowBackgroundImage', 'getBackgroundImageVisibility');
+  setChecked('#buttonUseTextureShading', 'isTextureShadingEnabled');
+  setChecked('#buttonEnableArmpitsStitching', 'isArmpitsStitchingEnabled');
+  setChecked('#buttonEnableNormalSmoothing', 'isNormalSmoothingEnabled');
 
-  var $buttonPlayPauseCurr = $('input[name=buttonPlayPause][value='+Module._isAnimationPlaying()+']');
-  $('input[name=buttonPlayPause]').parent().parent().removeClass('active');
-  $buttonPlayPauseCurr.parent().parent().addClass('active');
-  $buttonPlayPauseCurr.prop('checked', true);
+  mm.call('isAnimationPlaying').then(function(playing) {
+    var $buttonPlayPauseCurr = $('input[name=buttonPlayPause][value='+(playing ? 'true' : 'false')+']');
+    $('input[name=buttonPlayPause]').parent().parent().removeClass('active');
+    $buttonPlayPauseCurr.parent().parent().addClass('active');
+    $buttonPlayPauseCurr.prop('checked', true);
+  });
 
   $('.buttonRecord').removeClass('active');
 }
@@ -162,17 +369,23 @@ $(window).keydown(function(e) {
   if (e.which === 72) $('#buttonShowControlPins').click();
   if (e.ctrlKey && e.which === 79) $('#buttonOpenProject').click();
   if (e.ctrlKey && e.which === 83) $('#buttonSaveProject').click();
-  if (e.ctrlKey && e.which === 67) Module._copySelectedAnim();
-  if (e.ctrlKey && e.which === 86) Module._pasteSelectedAnim();
-  if (e.ctrlKey && e.which === 65) Module._selectAll();
-  if (e.which === 27) Module._deselectAll();
-  if (e.which === 107 || e.which === 187 || (e.shiftKey && e.which === 187)) Module._offsetSelectedCpAnimsByFrames(1);
-  if (e.which === 109 || e.which === 189) Module._offsetSelectedCpAnimsByFrames(-1);
-  if (e.which === 46 || e.which === 8) Module._removeControlPointOrRegion();
-  if (e.which === 33) Module._moveSelectedLayersInDepth(1, true); // PageUp
-  if (e.which === 34) Module._moveSelectedLayersInDepth(-1, true); // PageDown
-  if (e.which === 36) Module._moveSelectedLayersInDepth(Module._getNumberOfLayers(), false); // Home
-  if (e.which === 35) Module._moveSelectedLayersInDepth(-Module._getNumberOfLayers(), false); // End
+  if (e.ctrlKey && e.which === 67) mm.call('copySelectedAnim');
+  if (e.ctrlKey && e.which === 86) mm.call('pasteSelectedAnim');
+  if (e.ctrlKey && e.which === 65) mm.call('selectAll');
+  if (e.ctrlKey && e.which === 90) mm.call('undoDrawing');
+  if (e.ctrlKey && e.which === 89) mm.call('redoDrawing');
+  if (e.which === 27) mm.call('deselectAll');
+  if (e.which === 107 || e.which === 187 || (e.shiftKey && e.which === 187)) mm.call('offsetSelectedCpAnimsByFrames', 1);
+  if (e.which === 109 || e.which === 189) mm.call('offsetSelectedCpAnimsByFrames', -1);
+  if (e.which === 46 || e.which === 8) mm.call('removeControlPointOrRegion');
+  if (e.which === 33) mm.call('moveSelectedLayersInDepth', 1, true); // PageUp
+  if (e.which === 34) mm.call('moveSelectedLayersInDepth', -1, true); // PageDown
+  if (e.which === 36 || e.which === 35) { // Home, End
+    const sign = e.which === 36 ? 1 : -1;
+    mm.call('getNumberOfLayers').then(function(numLayers) {
+      mm.call('moveSelectedLayersInDepth', sign*numLayers, false);
+    });
+  }
 });
 
 function showRecordButton() {
@@ -238,54 +451,57 @@ $('.dropdownImageMode').click(function(e) {
 $('.buttonMode').click(function(e) {
   var id = this.id;
   $('.buttonMode').removeClass('active');
-  var mode = 0;
-  var prevMode = Module._getManipulationMode();
-  if (id == 'buttonDraw') {
-    mode = 0;
-    hideAnimationModeControls();
-    hideGeometryModeControls();
-  } else if (id == 'buttonRedraw') {
-    mode = 1;
-    hideAnimationModeControls();
-    hideGeometryModeControls();
-  } else if (id == 'buttonInflateMode') {
-    if (prevMode < 2) {
-      $('#spinnerInflateMode').css('display', 'inline-block');
+  mm.call('getManipulationMode').then(function(prevMode) {
+    var mode = 0;
+    if (id == 'buttonDraw') {
+      mode = 0;
+      hideAnimationModeControls();
+      hideGeometryModeControls();
+    } else if (id == 'buttonRedraw') {
+      mode = 1;
+      hideAnimationModeControls();
+      hideGeometryModeControls();
+    } else if (id == 'buttonInflateMode') {
+      if (prevMode < 2) {
+        $('#spinnerInflateMode').css('display', 'inline-block');
+      }
+      mode = 2;
+      hideAnimationModeControls();
+      showGeometryModeControls();
+    } else if (id == 'buttonAnimate') {
+      if (prevMode < 2) {
+        $('#spinnerAnimate').css('display', 'inline-block');
+      }        
+      mode = 3;
+      showAnimationModeControls();
+      showGeometryModeControls();
     }
-    mode = 2;
-    hideAnimationModeControls();
-    showGeometryModeControls();
-  } else if (id == 'buttonAnimate') {
-    if (prevMode < 2) {
-      $('#spinnerAnimate').css('display', 'inline-block');
-    }        
-    mode = 3;
-    showAnimationModeControls();
-    showGeometryModeControls();
-  }
-  var timeout = 50;
-  setTimeout(function() {
-    Module._setManipulationMode(mode);
-    var currMode = Module._getManipulationMode();
-    if (mode != currMode) {
-      js_manipulationModeChanged(currMode);
-    }
-  }, timeout);
+    var timeout = 50;
+    setTimeout(function() {
+      mm.call('setManipulationMode', mode);
+      mm.call('getManipulationMode').then(function(currMode) {
+        if (mode != currMode) {
+          js_manipulationModeChanged(currMode);
+        }
+      });
+    }, timeout);
+  });
 });
 
 $('#buttonNewProject, #buttonNewProjectFileMenu').click(function() {
   if (confirm('Do you want to start over from scratch?')) {
-    Module._reset();
+    exampleRequest++;
+    mm.call('reset');
     resetToModuleState();
-    js_manipulationModeChanged(Module._getManipulationMode());
+    mm.call('getManipulationMode').then(js_manipulationModeChanged);
   }
 });
 $('#buttonRemove').click(function() {
-  Module._removeControlPointOrRegion();
+  mm.call('removeControlPointOrRegion');
 });
 $('#buttonRotate').change(function(e) {
   var active = $(this).hasClass('active');
-  Module._enableMiddleMouseSimulation(active);
+  mm.call('enableMiddleMouseSimulation', active);
   var animateModeActive = $('#buttonAnimate').hasClass('active');
   if (animateModeActive) {
     if (active) hideRecordButton();
@@ -293,16 +509,16 @@ $('#buttonRotate').change(function(e) {
   }
 });
 $('#buttonResetView').click(function() {
-  Module._resetView();
+  mm.call('resetView');
 });
 $('#buttonShowControlPins').change(function() {
-  Module._setCPsVisibility(this.checked);
+  mm.call('setCPsVisibility', this.checked);
 });
 $('#buttonRecord').click(function() {
-  Module._cpRecordingRequestOrCancel();
+  mm.call('cpRecordingRequestOrCancel');
 });
 $('input[name=buttonPlayPause]').change(function() {
-  Module._toggleAnimationPlayback();
+  mm.call('toggleAnimationPlayback');
 });
 $('#buttonShowHelp').click(function() {
   $('.tutorialVideos video').trigger('pause');
@@ -320,47 +536,49 @@ $('#buttonShowHelp').click(function() {
   $('#modalDialogQuickTutorial').modal();
 });
 $('#buttonShowTemplateImage').click(function() {
-  Module._setTemplateImageVisibility(this.checked);
+  mm.call('setTemplateImageVisibility', this.checked);
 });
 $('#buttonShowBackgroundImage').click(function() {
-  Module._setBackgroundImageVisibility(this.checked);
+  mm.call('setBackgroundImageVisibility', this.checked);
 });
 $('#buttonUseTextureShading').change(function() {
-  Module._enableTextureShading(this.checked);
+  mm.call('enableTextureShading', this.checked);
 });
 $('#buttonShowSettings').click(function() {
   $('#modalDialogSettings').modal();
 });
 $('input[type=radio][name=animRecordMode]').change(function() {
-  Module._setAnimRecMode(this.value);
+  mm.call('setAnimRecMode', this.value);
 });
 $('#buttonTuneAnimation').click(function() {
   $('#modalDialogAnimationTuning').modal();
 });
 $('#buttonEnableArmpitsStitching').change(function() {
-  var currMode = Module._getManipulationMode();
-  var msg = '';
-  if (currMode >= 2) {
-    msg += (this.checked ? 'Enabling' : 'Disabling') + ' this setting in animation mode requires recreation of the 3D model. ';
-  }
-  if (this.checked) {
-    msg += 'Note that this is an experimental feature that may cause Monster Mash to crash and you may lose the current project. ';
-  }
-  if (msg == '') {
-    Module._enableArmpitsStitching(this.checked);
-  } else
-  if (confirm(msg + 'Proceed?')) {
-    Module._enableArmpitsStitching(this.checked);
+  var button = this;
+  mm.call('getManipulationMode').then(function(currMode) {
+    var msg = '';
     if (currMode >= 2) {
-      $('#buttonDraw').click();
-      js_manipulationModeChanged(currMode);
+      msg += (button.checked ? 'Enabling' : 'Disabling') + ' this setting in animation mode requires recreation of the 3D model. ';
     }
-  } else {
-    this.checked = !this.checked;
-  }
+    if (button.checked) {
+      msg += 'Note that this is an experimental feature that may cause Monster Mash to crash and you may lose the current project. ';
+    }
+    if (msg == '') {
+      mm.call('enableArmpitsStitching', button.checked);
+    } else
+    if (confirm(msg + 'Proceed?')) {
+      mm.call('enableArmpitsStitching', button.checked);
+      if (currMode >= 2) {
+        $('#buttonDraw').click();
+        js_manipulationModeChanged(currMode);
+      }
+    } else {
+      button.checked = !button.checked;
+    }
+  });
 });
 $('#buttonEnableNormalSmoothing').change(function() {
-  Module._enableNormalSmoothing(this.checked);
+  mm.call('enableNormalSmoothing', this.checked);
 });
 $('.tutorialVideos').click(function() {
   $('.tutorialVideos div').show();
@@ -374,23 +592,23 @@ $('.examples').click(function() {
   if (confirm('Do you want to discard the current project and open this example?')) {
     $('#modalDialogQuickTutorial').modal('hide');
     var exampleId = $(this).data("exampleid");
-    Module._openExampleProject(exampleId);
+    openExample(exampleId);
   }
 });
 $('#buttonSelectAll').click(function() {
-  Module._selectAll();
+  mm.call('selectAll');
 });
 $('#buttonDeselectAll').click(function() {
-  Module._deselectAll();
+  mm.call('deselectAll');
 });
 $('#buttonCopyAnimation').click(function() {
-  Module._copySelectedAnim();
+  mm.call('copySelectedAnim');
 });
 $('#buttonPasteAnimation').click(function() {
-  Module._pasteSelectedAnim();
+  mm.call('pasteSelectedAnim');
 });
 $('#buttonExportAsOBJ').click(function() {
-  Module._exportAsOBJ();
+  mm.call('exportAsOBJ');
 });
 function exportAnimationPrerollFramesCheck(el) {
   const max = parseInt(el.attr('max'));
@@ -399,21 +617,24 @@ function exportAnimationPrerollFramesCheck(el) {
   if (curr > max) el.val(max);
   else if (curr < min) el.val(min);
 }
+// tracked here, the dialog has to decide synchronously whether it can close
+var exportAnimationRunning = false;
 $('#exportAnimationPrerollFrames').change(function() {
   exportAnimationPrerollFramesCheck($(this));
 });
 $('#buttonExportAnimation').click(function() {
   var prerollFramesEl = $('#exportAnimationPrerollFrames');
   var progressEl = $('#exportAnimationProgress');
-  const nFrames = Module._getNumberOfAnimationFrames();
-  prerollFramesEl.attr({'min': '0', 'max': nFrames*5});
-  exportAnimationPrerollFramesCheck(prerollFramesEl);
-  progressEl.text("");
-  progressEl.css("width", "0%");
-  progressEl.removeClass('bg-success');
-  $('#exportAnimationNumFrames').text(nFrames);
-//   prerollFramesEl.val(Math.max(Math.round(0.25*nFrames)), 5);
-  $('#modalDialogExportAnimation').modal();
+  mm.call('getNumberOfAnimationFrames').then(function(nFrames) {
+    prerollFramesEl.attr({'min': '0', 'max': nFrames*5});
+    exportAnimationPrerollFramesCheck(prerollFramesEl);
+    progressEl.text("");
+    progressEl.css("width", "0%");
+    progressEl.removeClass('bg-success');
+    $('#exportAnimationNumFrames').text(nFrames);
+  //   prerollFramesEl.val(Math.max(Math.round(0.25*nFrames)), 5);
+    $('#modalDialogExportAnimation').modal();
+  });
 });
 $('#exportAnimationButtonExport').click(function() {
   var prerollFramesEl = $('#exportAnimationPrerollFrames');
@@ -429,7 +650,8 @@ $('#exportAnimationButtonExport').click(function() {
   progressEl.text("");
   progressEl.css("width", "0%");
   progressEl.removeClass('bg-success');
-  Module._exportAnimationStart(prerollFramesEl.val(), resolveDepth, perFrameNormals);
+  exportAnimationRunning = true;
+  mm.call('exportAnimationStart', prerollFramesEl.val(), resolveDepth, perFrameNormals);
 });
 $('#exportAnimationButtonCancel').click(function() {
   var exportBtnEl = $('#exportAnimationButtonExport');
@@ -441,11 +663,12 @@ $('#exportAnimationButtonCancel').click(function() {
   abortBtnEl.prop('disabled', true);
   progressEl.text("");
   progressEl.css("width", "0%");
-  Module._exportAnimationAbort();
+  exportAnimationRunning = false;
+  mm.call('exportAnimationAbort');
 });
 $('#modalDialogExportAnimation').on('hide.bs.modal', function() {
   var ret = true;
-  if (Module._exportAnimationRunning()) {
+  if (exportAnimationRunning) {
     ret = confirm('Are you sure you want cancel the export?');
     if (ret) $('#exportAnimationButtonCancel').click();
   }
@@ -454,13 +677,13 @@ $('#modalDialogExportAnimation').on('hide.bs.modal', function() {
 
 // after showing modal dialogs, disable SDL keyboard events and pause animation
 $('div.modal').on('show.bs.modal', function() {
-  Module._disableKeyboardEvents();
-  Module._pauseAnimation();
+  mm.call('disableKeyboardEvents');
+  mm.call('pauseAnimation');
 });
 // after hiding modal dialogs, enable SDL keyboard events and resume animation
 $('div.modal').on('hide.bs.modal', function() {
-  Module._enableKeyboardEvents();
-  Module._resumeAnimation();
+  mm.call('enableKeyboardEvents');
+  mm.call('resumeAnimation');
 });
 
 // initialize tooltips
@@ -480,7 +703,9 @@ function handleResize() {
 }
 $(window).resize(handleResize);
 $(window).on('mainContentVisible', function() {
-  $('.appVersion').text(Module._getVersion());
+  mm.call('getVersion').then(function(version) {
+    $('.appVersion').text(version);
+  });
   handleResize();
   
   var $buttonHelpToolTip = $('#buttonShowHelp[data-tooltip="tooltip"]');
@@ -0,0 +1,123 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "vertexcache.h"
+
+#include <miscutils/macros.h>
+
+using namespace std;
+
+void optimizeVertexCache(vector<unsigned int> &indices, int nVertices,
+                         int cacheSize) {
+  const int nTriangles = indices.size() / 3;
+  if (nTriangles == 0) return;
+
+  // the triangles of each vertex
+  vector<int> adjacencyStart(nVertices + 1, 0);
+  for (unsigned int v : indices) adjacencyStart[v + 1]++;
+  fora(v, 0, nVertices) adjacencyStart[v + 1] += adjacencyStart[v];
+  vector<int> adjacency(indices.size());
+  {
+    vector<int> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+    fora(t, 0, nTriangles) fora(j, 0, 3) {
+      adjacency[fill[indices[3 * t + j]]++] = t;
+    }
+  }
+
+  // live triangles of each vertex, time stamp of entering the cache
+  vector<int> live(nVertices);
+  fora(v, 0, nVertices) live[v] = adjacencyStart[v + 1] - adjacencyStart[v];
+  vector<int> cacheTime(nVertices, 0);
+  vector<char> emitted(nTriangles, 0);
+  vector<int> deadEnd, candidates;
+  vector<unsigned int> result;
+  result.reserve(indices.size());
+  int time = cacheSize + 1, cursor = 0;
+
+  // a vertex with live triangles which is still in the cache after emitting
+  // them, the oldest one is preferred to be used up before it is evicted
+  auto nextVertex = [&]() {
+    int best = -1, bestPriority = -1;
+    for (int v : candidates) {
+      if (live[v] == 0) continue;
+      int priority = 0;
+      if (time - cacheTime[v] + 2 * live[v] <= cacheSize) {
+        priority = time - cacheTime[v];
+      }
+      if (priority > bestPriority) {
+        bestPriority = priority;
+        best = v;
+      }
+    }
+    if (best != -1) return best;
+    while (!deadEnd.empty()) {
+      const int v = deadEnd.back();
+      deadEnd.pop_back();
+      if (live[v] > 0) return v;
+    }
+    while (cursor < nVertices) {
+      if (live[cursor] > 0) return cursor;
+      cursor++;
+    }
+    return -1;
+  };
+
+  int fan = nextVertex();
+  while (fan != -1) {
+    candidates.clear();
+    fora(i, adjacencyStart[fan], adjacencyStart[fan + 1]) {
+      const int t = adjacency[i];
+      if (emitted[t]) continue;
+      emitted[t] = 1;
+      fora(j, 0, 3) {
+        const int v = indices[3 * t + j];
+        result.push_back(v);
+        deadEnd.push_back(v);
+        candidates.push_back(v);
+        live[v]--;
+        if (time - cacheTime[v] > cacheSize) cacheTime[v] = time++;
+      }
+    }
+    fan = nextVertex();
+  }
+  indices.swap(result);
+}
+
+vector<int> optimizeVertexFetch(vector<unsigned int> &indices, int nVertices) {
+  vector<int> newIndex(nVertices, -1), order;
+  order.reserve(nVertices);
+  for (unsigned int &v : indices) {
+    if (newIndex[v] == -1) {
+      newIndex[v] = order.size();
+      order.push_back(v);
+    }
+    v = newIndex[v];
+  }
+  fora(v, 0, nVertices) {
+    if (newIndex[v] == -1) order.push_back(v);
+  }
+  return order;
+}
+
+double averageCacheMissRatio(const vector<unsigned int> &indices,
+                             int nVertices, int cacheSize) {
+  if (indices.empty()) return 0;
+  vector<int> cacheTime(nVertices, -cacheSize - 1);
+  int misses = 0;
+  for (unsigned int v : indices) {
+    if (misses - cacheTime[v] > cacheSize) cacheTime[v] = misses++;
+  }
+  return misses / (indices.size() / 3.0);
+}
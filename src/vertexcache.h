@@ -0,0 +1,42 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef VERTEXCACHE_H
+#define VERTEXCACHE_H
+
+#include <vector>
+
+// Reorders the triangles (3 consecutive indices each) for the
+// post-transform vertex cache of the GPU with the Tipsify algorithm [Sander
+// et al. 2007, Fast Triangle Reordering for Vertex Locality and Reduced
+// Overdraw]: triangles are emitted in fans around vertices chosen to still
+// be in a FIFO cache of cacheSize entries, falling back to recently used
+// vertices when the fan runs out.
+void optimizeVertexCache(std::vector<unsigned int> &indices, int nVertices,
+                         int cacheSize = 16);
+
+// Renumbers the vertices in the order they are first used by indices, so
+// that they are fetched sequentially. Returns the old index of each new
+// vertex, unused vertices are moved to the end.
+std::vector<int> optimizeVertexFetch(std::vector<unsigned int> &indices,
+                                     int nVertices);
+
+// Average number of vertex shader invocations per triangle with a FIFO
+// cache of cacheSize entries (0.5 is the optimum for large meshes, 3 the
+// worst case).
+double averageCacheMissRatio(const std::vector<unsigned int> &indices,
+                             int nVertices, int cacheSize = 16);
+
+#endif  // VERTEXCACHE_H
@@ -0,0 +1,131 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "vertexcodec.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace {
+
+const unsigned char header = 0xa0;
+const size_t groupSize = 16;
+const size_t blockMaxSize = 256;
+const size_t blockMaxBytes = 8192;
+// the first element is stored at the end, padded to tailMinSize
+const size_t tailMinSize = 32;
+
+size_t blockSize(size_t stride) {
+  const size_t size = blockMaxBytes / stride & ~(groupSize - 1);
+  return min(size, blockMaxSize);
+}
+
+unsigned char zigzag(unsigned char v) {
+  return (v & 0x80) ? ((~v << 1) | 1) : (v << 1);
+}
+
+unsigned char unzigzag(unsigned char v) { return -(v & 1) ^ (v >> 1); }
+
+// bytes needed to pack the group with the given bits per value, the values
+// not fitting are stored after the packed ones
+size_t groupEncodedSize(const unsigned char *group, int bits) {
+  if (bits == 8) return groupSize;
+  const unsigned char sentinel = (1 << bits) - 1;
+  size_t size = groupSize * bits / 8;
+  for (size_t i = 0; i < groupSize; i++) size += group[i] >= sentinel;
+  return size;
+}
+
+void encodeGroup(const unsigned char *group, int bits,
+                 vector<unsigned char> &out) {
+  if (bits == 0) return;
+  if (bits == 8) {
+    out.insert(out.end(), group, group + groupSize);
+    return;
+  }
+  const unsigned char sentinel = (1 << bits) - 1;
+  const int perByte = 8 / bits;
+  for (size_t i = 0; i < groupSize; i += perByte) {
+    unsigned char byte = 0;
+    for (int k = 0; k < perByte; k++) {
+      byte = (byte << bits) | min(group[i + k], sentinel);
+    }
+    out.push_back(byte);
+  }
+  for (size_t i = 0; i < groupSize; i++) {
+    if (group[i] >= sentinel) out.push_back(group[i]);
+  }
+}
+
+// deltas of one byte of all elements of a block padded to full groups,
+// with a header of 2 bits per group selecting 0, 2, 4 or 8 bits
+void encodeBytes(const unsigned char *deltas, size_t size,
+                 vector<unsigned char> &out) {
+  const size_t headerOffset = out.size();
+  out.resize(out.size() + (size / groupSize + 3) / 4, 0);
+  for (size_t i = 0; i < size; i += groupSize) {
+    const unsigned char *group = deltas + i;
+    int code = 0;
+    if (any_of(group, group + groupSize, [](unsigned char v) { return v; })) {
+      code = 1;
+      size_t best = groupEncodedSize(group, 2);
+      for (int c = 2; c <= 3; c++) {
+        const size_t size = groupEncodedSize(group, c == 2 ? 4 : 8);
+        if (size < best) {
+          best = size;
+          code = c;
+        }
+      }
+    }
+    const size_t g = i / groupSize;
+    out[headerOffset + g / 4] |= code << (g % 4 * 2);
+    encodeGroup(group, code == 0 ? 0 : 1 << code, out);
+  }
+}
+
+}  // namespace
+
+vector<unsigned char> encodeVertexBuffer(const unsigned char *data,
+                                         size_t count, size_t stride) {
+  vector<unsigned char> out = {header};
+  vector<unsigned char> last(stride, 0);
+  if (count > 0) memcpy(last.data(), data, stride);
+  const vector<unsigned char> first = last;
+
+  const size_t maxBlock = blockSize(stride);
+  vector<unsigned char> deltas(maxBlock);
+  for (size_t begin = 0; begin < count; begin += maxBlock) {
+    const size_t n = min(maxBlock, count - begin);
+    const size_t nAligned = (n + groupSize - 1) & ~(groupSize - 1);
+    const unsigned char *block = data + begin * stride;
+    for (size_t k = 0; k < stride; k++) {
+      fill(deltas.begin(), deltas.end(), 0);
+      unsigned char prev = last[k];
+      for (size_t i = 0; i < n; i++) {
+        const unsigned char v = block[i * stride + k];
+        deltas[i] = zigzag(v - prev);
+        prev = v;
+      }
+      encodeBytes(deltas.data(), nAligned, out);
+    }
+    memcpy(last.data(), block + (n - 1) * stride, stride);
+  }
+
+  if (stride < tailMinSize) out.resize(out.size() + tailMinSize - stride, 0);
+  out.insert(out.end(), first.begin(), first.end());
+  return out;
+}
@@ -0,0 +1,32 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef VERTEXCODEC_H
+#define VERTEXCODEC_H
+
+#include <cstddef>
+#include <vector>
+
+// Encodes count elements of stride bytes (a multiple of 4, at most 256) with
+// the attribute codec of EXT_meshopt_compression (mode ATTRIBUTES, version
+// 0). The elements are split into blocks, each byte of the elements is
+// delta coded from the previous element and the deltas are packed in
+// groups of 16 with 0, 2, 4 or 8 bits each, so smooth and repeated data
+// compresses well on its own and even better with a general purpose
+// compression of the file on top.
+std::vector<unsigned char> encodeVertexBuffer(const unsigned char *data,
+                                              size_t count, size_t stride);
+
+#endif  // VERTEXCODEC_H
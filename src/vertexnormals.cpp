@@ -0,0 +1,63 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "vertexnormals.h"
+
+#include <cmath>
+
+using namespace Eigen;
+
+void VertexNormals::updateAdjacency(const MatrixXi &F, int nVertices) {
+  if (faceStart.size() == static_cast<size_t>(nVertices) + 1 && adjF.rows() == F.rows() &&
+      adjF.cols() == F.cols() && adjF == F)
+    return;
+  adjF = F;
+  faceStart.assign(nVertices + 1, 0);
+  for (int f = 0; f < F.rows(); f++)
+    for (int k = 0; k < F.cols(); k++) faceStart[F(f, k) + 1]++;
+  for (int i = 0; i < nVertices; i++) faceStart[i + 1] += faceStart[i];
+  faces.resize(faceStart[nVertices]);
+  std::vector<int> next(faceStart.begin(), faceStart.end() - 1);
+  for (int f = 0; f < F.rows(); f++)
+    for (int k = 0; k < F.cols(); k++) faces[next[F(f, k)]++] = f;
+}
+
+void VertexNormals::compute(const MatrixXd &V, const MatrixXi &F, MatrixXd &N,
+                            WorkerPool *pool) {
+  const int n = V.rows();
+  updateAdjacency(F, n);
+  N.resize(n, 3);
+  auto body = [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      Vector3d sum = Vector3d::Zero();
+      for (int j = faceStart[i]; j < faceStart[i + 1]; j++) {
+        const int f = faces[j];
+        const Vector3d a = V.row(F(f, 0)).transpose();
+        const Vector3d e1 = V.row(F(f, 1)).transpose() - a;
+        const Vector3d e2 = V.row(F(f, 2)).transpose() - a;
+        sum += e1.cross(e2);
+      }
+      const double norm = sum.norm();
+      if (norm > 0 && std::isfinite(norm))
+        N.row(i) = (sum / norm).transpose();
+      else
+        N.row(i) = RowVector3d(0, 0, 1);
+    }
+  };
+  if (pool != nullptr)
+    pool->parallelFor(n, 1024, body);
+  else
+    body(0, n);
+}
@@ -0,0 +1,46 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef VERTEXNORMALS_H
+#define VERTEXNORMALS_H
+
+#include <Eigen/Dense>
+#include <vector>
+
+#include "workerpool.h"
+
+// Area-weighted vertex normals, the same as igl::per_vertex_normals with the
+// default weighting, computed in a single pass over the vertices: each
+// vertex sums the cross products of its incident triangles (twice their
+// area times their normal) and normalizes the sum. Vertices without a
+// non-degenerate triangle get (0, 0, 1) instead of NaN's. The vertex to
+// triangle adjacency is cached and rebuilt only when F changes, and no
+// per-face temporaries are allocated.
+class VertexNormals {
+ public:
+  // pool splits the vertices into chunks, computed serially if null
+  void compute(const Eigen::MatrixXd &V, const Eigen::MatrixXi &F,
+               Eigen::MatrixXd &N, WorkerPool *pool = nullptr);
+
+ private:
+  void updateAdjacency(const Eigen::MatrixXi &F, int nVertices);
+
+  // triangles incident to vertex i are faces[faceStart[i] ..
+  // faceStart[i + 1] - 1], built for adjF
+  Eigen::MatrixXi adjF;
+  std::vector<int> faceStart, faces;
+};
+
+#endif  // VERTEXNORMALS_H
@@ -0,0 +1,149 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "workerpool.h"
+
+#include <algorithm>
+#include <memory>
+
+#ifdef __EMSCRIPTEN_PTHREADS__
+#include <emscripten/threading.h>
+#endif
+
+using namespace std;
+
+WorkerPool::WorkerPool(int numThreads) {
+#ifdef WORKERPOOL_THREADS_AVAILABLE
+  for (int i = 0; i < numThreads; i++) {
+    threads.push_back(thread(&WorkerPool::loop, this));
+  }
+#endif
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    lock_guard<mutex> lock(tasksMutex);
+    terminate = true;
+  }
+  taskAvailable.notify_all();
+  for (auto &t : threads) t.join();
+}
+
+void WorkerPool::run(const function<void()> &task) {
+  if (threads.empty()) {
+    // no threads available, execute synchronously
+    task();
+    return;
+  }
+  {
+    lock_guard<mutex> lock(tasksMutex);
+    tasks.push_back(task);
+  }
+  taskAvailable.notify_one();
+}
+
+void WorkerPool::wait() {
+  unique_lock<mutex> lock(tasksMutex);
+  while (true) {
+    // The queued tasks are taken by the caller as well, the workers may not
+    // be running yet (in the browser a worker beyond the preallocated ones
+    // starts only after the main thread yields).
+    while (!tasks.empty()) {
+      function<void()> task = move(tasks.front());
+      tasks.pop_front();
+      numRunning++;
+      lock.unlock();
+      task();
+      lock.lock();
+      numRunning--;
+    }
+    if (numRunning == 0) break;
+    tasksDone.wait(lock);
+  }
+}
+
+int WorkerPool::size() const { return threads.size(); }
+
+void WorkerPool::parallelFor(int n, int chunkSize,
+                             const function<void(int, int)> &body) {
+  const int nChunks = (n + chunkSize - 1) / chunkSize;
+  if (nChunks <= 1 || threads.empty()) {
+    for (int i = 0; i < n; i += chunkSize) body(i, min(i + chunkSize, n));
+    return;
+  }
+
+  // Helper tasks may start only after all chunks were done (e.g. when the
+  // pool is busy), hence the shared state. The body is accessed only for a
+  // claimed chunk, i.e. while the caller still waits.
+  struct State {
+    atomic<int> next{0};
+    int done = 0;
+    mutex doneMutex;
+    condition_variable allDone;
+  };
+  auto state = make_shared<State>();
+  const function<void(int, int)> *bodyPtr = &body;
+  auto work = [state, bodyPtr, n, nChunks, chunkSize]() {
+    int chunk, processed = 0;
+    while ((chunk = state->next++) < nChunks) {
+      const int begin = chunk * chunkSize;
+      (*bodyPtr)(begin, min(begin + chunkSize, n));
+      processed++;
+    }
+    if (processed == 0) return;
+    lock_guard<mutex> lock(state->doneMutex);
+    state->done += processed;
+    if (state->done == nChunks) state->allDone.notify_all();
+  };
+  const int nHelpers = min(static_cast<int>(threads.size()), nChunks - 1);
+  for (int i = 0; i < nHelpers; i++) run(work);
+  work();
+  unique_lock<mutex> lock(state->doneMutex);
+  state->allDone.wait(lock, [&]() { return state->done == nChunks; });
+}
+
+int WorkerPool::defaultNumThreads() {
+#if defined(__EMSCRIPTEN_PTHREADS__)
+  // The pools of the main thread, the reconstruction and the deformation
+  // share the preallocated workers (PTHREAD_POOL_SIZE), three of them are
+  // left for the background reconstruction, deformation and export.
+  const int perPool = (WORKERPOOL_WEB_WORKERS - 3) / 3;
+  return max(1, min(emscripten_num_logical_cores() - 1, perPool));
+#elif defined(__EMSCRIPTEN__)
+  return 2;
+#else
+  const int n = thread::hardware_concurrency();
+  return n > 1 ? n - 1 : 1;
+#endif
+}
+
+void WorkerPool::loop() {
+  while (true) {
+    function<void()> task;
+    {
+      unique_lock<mutex> lock(tasksMutex);
+      taskAvailable.wait(lock, [&]() { return terminate || !tasks.empty(); });
+      if (terminate && tasks.empty()) return;
+      task = tasks.front();
+      tasks.pop_front();
+      numRunning++;
+    }
+    task();
+    {
+      lock_guard<mutex> lock(tasksMutex);
+      numRunning--;
+    }
+    tasksDone.notify_all();
+  }
+}
@@ -0,0 +1,73 @@
+// Copyright 2020-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Threads are available natively and in the Emscripten build compiled with
+// pthreads support (see MM_EMSCRIPTEN_PTHREADS in CMakeLists.txt).
+#if !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+#define WORKERPOOL_THREADS_AVAILABLE
+#endif
+
+// number of web workers preallocated in the Emscripten pthreads build
+#ifndef WORKERPOOL_WEB_WORKERS
+#define WORKERPOOL_WEB_WORKERS 8
+#endif
+
+// Small persistent pool of worker threads. Tasks are started with run() and
+// wait() blocks until all of them finished, running the ones not started yet
+// on the calling thread. parallelFor() splits a loop into
+// chunks processed by the pool and the calling thread.
+class WorkerPool {
+ public:
+  explicit WorkerPool(int numThreads = 1);
+  ~WorkerPool();
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  void run(const std::function<void()> &task);
+  void wait();
+  int size() const;
+
+  // Calls body(begin, end) for consecutive chunks of [0, n) of at most
+  // chunkSize indices and returns when all of them were processed. The
+  // calling thread takes chunks as well and only waits for the chunks, not
+  // for all tasks of the pool, i.e. it can be used from within a task.
+  void parallelFor(int n, int chunkSize,
+                   const std::function<void(int, int)> &body);
+
+  // number of worker threads to use besides the calling thread
+  static int defaultNumThreads();
+
+ private:
+  void loop();
+
+  std::vector<std::thread> threads;
+  std::deque<std::function<void()>> tasks;
+  std::mutex tasksMutex;
+  std::condition_variable taskAvailable, tasksDone;
+  int numRunning = 0;
+  bool terminate = false;
+};
+
+#endif  // WORKERPOOL_H
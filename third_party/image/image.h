@@ -20,6 +20,12 @@
 #include <map>
 #include <algorithm>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#endif
+
 #ifndef DEBUG_CMD_IMG
   #ifdef ENABLE_DEBUG_CMD_IMG
     #define DEBUG_CMD_IMG(x) {x}
@@ -84,6 +90,8 @@ public:
   // If the input image has shared data, the result is an image also with shared data.
   // The same holds for new data.
   Img(const Img &img);
+  // Takes over the data (owned or shared) of the image on the right, which becomes NULL image.
+  Img(Img &&img) noexcept;
   Img();
   Img(int w, int h, int channels, int alphaChannel = -1);
   Img(T *data, int w, int h, int channels);
@@ -159,11 +167,16 @@ public:
   // If the image on the left has not shared data then the data will be freed.
   Img& shallowCopy(const Img &img);
 
+  // Exchanges the data (without copying it) and the dimensions with the image on the right.
+  Img& swap(Img &img);
+
   // If the image on the left has shared data, it will still have shared data after the assignment.
   // The same holds for new data.
   const Img& operator=(const Img &img);
 
-//  Img& operator=(Img &&img);
+  // Takes over the data of the image on the right (which becomes NULL image) if the image on the left is NULL
+  // image, otherwise the same as the copy assignment.
+  Img& operator=(Img &&img);
 
   // check out of range
   const T& at(int x, int y, int channel) const;
@@ -325,6 +338,8 @@ private:
 #ifdef IMAGE_SCALE
 public:
   Img scale(int newW, int newH);
+  // Writes the rows [y0, y1) of the image scaled to the size of O into O, the strips of O can be scaled in parallel.
+  void scaleRows(Img &O, int y0, int y1) const;
   // scale width and keep aspect ratio
   Img scaleWidth(int newW);
   // scale height and keep aspect ratio
@@ -345,6 +360,128 @@ typedef Img<const unsigned char> Imagec8;
 typedef Img<unsigned short> Image16;
 typedef Img<const unsigned short> Imagec16;
 
+// Kernels of the whole-image operations working on the raw data. The
+// unsigned char and float variants use SSE2 or wasm SIMD128 when enabled.
+namespace imgkernels {
+
+template<typename T>
+void fill(T *data, int n, T value)
+{
+  std::fill(data, data+n, value);
+}
+
+inline void fill(unsigned char *data, int n, unsigned char value)
+{
+  if (n > 0) std::memset(data, value, n);
+}
+
+inline void fill(float *data, int n, float value)
+{
+  int i = 0;
+#if defined(__SSE2__)
+  const __m128 v = _mm_set1_ps(value);
+  for (; i+8 <= n; i += 8) {
+    _mm_storeu_ps(data+i, v);
+    _mm_storeu_ps(data+i+4, v);
+  }
+#elif defined(__wasm_simd128__)
+  const v128_t v = wasm_f32x4_splat(value);
+  for (; i+8 <= n; i += 8) {
+    wasm_v128_store(data+i, v);
+    wasm_v128_store(data+i+4, v);
+  }
+#endif
+  for (; i < n; i++) data[i] = value;
+}
+
+// data[0..n) is filled with the repeated pattern (e.g. a pixel), n is a
+// multiple of the pattern size
+template<typename T>
+void fillPattern(T *data, int n, const T *pattern, int patternSize)
+{
+  if (n <= 0) return;
+  if (patternSize == 1) { fill(data, n, pattern[0]); return; }
+  int filled = std::min(patternSize, n);
+  std::memcpy(data, pattern, filled*sizeof(T));
+  while (filled < n) {
+    const int m = std::min(filled, n-filled);
+    std::memcpy(data+filled, data, m*sizeof(T));
+    filled += m;
+  }
+}
+
+// out[i] = (U)(in[i]*scale)
+template<typename T, typename U>
+void convert(const T *in, U *out, int n, double scale)
+{
+  for (int i = 0; i < n; i++) out[i] = (U)(in[i]*scale);
+}
+
+// through a table of all the 256 values
+template<typename U>
+void convert(const unsigned char *in, U *out, int n, double scale)
+{
+  U table[256];
+  for (int v = 0; v < 256; v++) table[v] = (U)(v*scale);
+  for (int i = 0; i < n; i++) out[i] = table[in[i]];
+}
+
+// The product is computed in double precision as in the generic version.
+// The vector paths saturate values out of the range of unsigned char.
+inline void convert(const float *in, unsigned char *out, int n, double scale)
+{
+  int i = 0;
+#if defined(__SSE2__)
+  const __m128d s = _mm_set1_pd(scale);
+  auto toInt = [&](__m128 f) {
+    const __m128i lo = _mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtps_pd(f), s));
+    const __m128i hi = _mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(f, f)), s));
+    return _mm_unpacklo_epi64(lo, hi);
+  };
+  for (; i+8 <= n; i += 8) {
+    const __m128i a = toInt(_mm_loadu_ps(in+i));
+    const __m128i b = toInt(_mm_loadu_ps(in+i+4));
+    const __m128i w = _mm_packs_epi32(a, b);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out+i), _mm_packus_epi16(w, w));
+  }
+#elif defined(__wasm_simd128__)
+  const v128_t s = wasm_f64x2_splat(scale);
+  auto toInt = [&](v128_t f) {
+    const v128_t lo = wasm_i32x4_trunc_sat_f64x2_zero(wasm_f64x2_mul(wasm_f64x2_promote_low_f32x4(f), s));
+    const v128_t fHi = wasm_i32x4_shuffle(f, f, 2, 3, 0, 1);
+    const v128_t hi = wasm_i32x4_trunc_sat_f64x2_zero(wasm_f64x2_mul(wasm_f64x2_promote_low_f32x4(fHi), s));
+    return wasm_i32x4_shuffle(lo, hi, 0, 1, 4, 5);
+  };
+  for (; i+8 <= n; i += 8) {
+    const v128_t a = toInt(wasm_v128_load(in+i));
+    const v128_t b = toInt(wasm_v128_load(in+i+4));
+    const v128_t w = wasm_i16x8_narrow_i32x4(a, b);
+    wasm_v128_store64_lane(out+i, wasm_u8x16_narrow_i16x8(w, w), 0);
+  }
+#endif
+  for (; i < n; i++) out[i] = (unsigned char)(in[i]*scale);
+}
+
+// out[i] = (U)in[i]
+template<typename T, typename U>
+void cast(const T *in, U *out, int n)
+{
+  for (int i = 0; i < n; i++) out[i] = (U)in[i];
+}
+
+template<typename U>
+void cast(const unsigned char *in, U *out, int n)
+{
+  convert(in, out, n, 1.0);
+}
+
+inline void cast(const float *in, unsigned char *out, int n)
+{
+  convert(in, out, n, 1.0);
+}
+
+} // namespace imgkernels
+
 #ifdef IMAGE_READ_WRITE
 #include "imageReadWrite.hpp"
 #endif
@@ -595,6 +732,13 @@ Img<T>::Img(const Img &img)
   *this = img;
 }
 
+template<typename T>
+Img<T>::Img(Img &&img) noexcept : data(img.data), w(img.w), h(img.h), ch(img.ch), alphaChannel(img.alphaChannel), sharedData(img.sharedData), valuesPerChannel(img.valuesPerChannel)
+{
+  img.data = nullptr;
+  img.w = 0; img.h = 0; img.ch = 0; img.alphaChannel = -1; img.sharedData = false;
+}
+
 template<typename T>
 Img<T>::Img() : data(nullptr), /*dataC(nullptr),*/ w(0), h(0), ch(0), alphaChannel(0), sharedData(false)
 {}
@@ -660,6 +804,19 @@ Img<T>& Img<T>::setNull()
   return *this;
 }
 
+template<typename T>
+Img<T>& Img<T>::swap(Img &img)
+{
+  std::swap(data, img.data);
+  std::swap(w, img.w);
+  std::swap(h, img.h);
+  std::swap(ch, img.ch);
+  std::swap(alphaChannel, img.alphaChannel);
+  std::swap(sharedData, img.sharedData);
+  std::swap(valuesPerChannel, img.valuesPerChannel);
+  return *this;
+}
+
 template<typename T>
 const Img<T> Img<T>::nullImage() {
   return Img();
@@ -676,17 +833,16 @@ template<typename T>
 Img<T>& Img<T>::fill(const Color<T> &color)
 {
   assert(ch == color.ch);
-  fora(y,0,h) fora(x,0,w) fora(c,0,ch) {
-    operator()(x,y,c) = color(c);
-  }
+  std::vector<T> pixel(ch);
+  fora(c,0,ch) pixel[c] = color(c);
+  imgkernels::fillPattern(data, w*h*ch, pixel.data(), ch);
   return *this;
 }
 
 template<typename T>
 Img<T>& Img<T>::fill(const T &value)
 {
-  int i = 0;
-  while (i<w*h*ch) data[i++] = value;
+  imgkernels::fill(data, w*h*ch, value);
   return *this;
 }
 
@@ -695,7 +851,7 @@ template<typename U>
 Img<U> Img<T>::cast() const
 {
   Img<U> img(w, h, ch, alphaChannel);
-  fora(y, 0, h) fora(x, 0, w) fora(c, 0, ch) img(x,y,c) = (U)operator()(x,y,c);
+  imgkernels::cast(data, img.data, w*h*ch);
   return img;
 }
 
@@ -712,7 +868,7 @@ Img<T>& Img<T>::cast(const Img<U> &img)
 {
   if (isNull()) initImage(img, false);
   assert(img.w == w && img.h == h && img.ch == ch);
-  fora(y, 0, h) fora(x, 0, w) fora(c, 0, ch) operator()(x,y,c) = (T)img(x,y,c);
+  imgkernels::cast(img.data, data, w*h*ch);
   return *this;
 }
 
@@ -729,7 +885,7 @@ template<typename U>
 Img<U> Img<T>::castAndConvert() const
 {
   Img<U> img(w, h, ch, alphaChannel);
-  fora(y, 0, h) fora(x, 0, w) fora(c, 0, ch) img(x,y,c) = (U)(operator()(x,y,c)*(Img<U>::getValuesPerChannel()/(double)getValuesPerChannel()));
+  imgkernels::convert(data, img.data, w*h*ch, img.getValuesPerChannel()/(double)getValuesPerChannel());
   return img;
 }
 
@@ -745,7 +901,7 @@ template<typename U>
 Img<T>& Img<T>::castAndConvert(const Img<U> &img) {
   if (isNull()) initImage(img, false);
   assert(img.w == w && img.h == h && img.ch == ch);
-  fora(y, 0, h) fora(x, 0, w) fora(c, 0, ch) operator()(x,y,c) = (T)(img(x,y,c)*(getValuesPerChannel()/(double)Img<U>::getValuesPerChannel()));
+  imgkernels::convert(img.data, data, w*h*ch, getValuesPerChannel()/(double)img.getValuesPerChannel());
   return *this;
 }
 
@@ -846,17 +1002,23 @@ const Img<T>& Img<T>::operator=(const Img &img)
   return *this;
 }
 
-//template<typename T>
-//Img<T>& Img<T>::operator=(Img &&img)
-//{
-//  if(this != &other) { // no self assignment
-
-//    delete[] mArray;                               // delete this storage
-//    mArray = std::exchange(other.mArray, nullptr); // leave moved-from in valid state
-//    size = std::exchange(other.size, 0);
-//  }
-//  return *this;
-//}
+template<typename T>
+Img<T>& Img<T>::operator=(Img &&img)
+{
+  // Only a null image takes over the data, an image with data keeps it as
+  // other images may share it (the same as the copy assignment).
+  if (this == &img || !isNull()) {
+    operator=(static_cast<const Img&>(img));
+    return *this;
+  }
+  if (!sharedData && data != nullptr) delete[] data;
+  data = img.data;
+  w = img.w; h = img.h; ch = img.ch; alphaChannel = img.alphaChannel; sharedData = img.sharedData;
+  valuesPerChannel = img.valuesPerChannel;
+  img.data = nullptr;
+  img.w = 0; img.h = 0; img.ch = 0; img.alphaChannel = -1; img.sharedData = false;
+  return *this;
+}
 
 template<typename T>
 const T& Img<T>::at(int x, int y, int channel) const
@@ -1245,14 +1407,24 @@ Img<T> Img<T>::resize(int w, int h, int shiftX, int shiftY, const Color<T> &colo
 
   // resize
   Img img(w, h, ch, alphaChannel);
-  fora(y, 0, h) fora(x, 0, w) fora(c, 0, ch) {
-    if (x-shiftX >= 0 && y-shiftY >= 0 && x-shiftX < this->w && y-shiftY < this->h) {
-      img(x,y,c) = operator()(x-shiftX,y-shiftY,c);
-    } else {
-      // fill new areas with specified color
-      if (c < color.ch) img(x,y,c) = color(c);
-      else img(x,y,c) = color(0); // if color does not specify all channels, use colors(0) for the rest
+  // fill new areas with specified color
+  std::vector<T> pixel(ch);
+  fora(c, 0, ch) {
+    if (c < color.ch) pixel[c] = color(c);
+    else pixel[c] = color(0); // if color does not specify all channels, use colors(0) for the rest
+  }
+  // columns of the new image covered by the old one
+  const int x0 = std::max(shiftX, 0), x1 = std::max(std::min(this->w+shiftX, w), x0);
+  fora(y, 0, h) {
+    T *row = &img.data[y*w*ch];
+    const int srcY = y-shiftY;
+    if (srcY < 0 || srcY >= this->h || x0 == x1) {
+      imgkernels::fillPattern(row, w*ch, pixel.data(), ch);
+      continue;
     }
+    imgkernels::fillPattern(row, x0*ch, pixel.data(), ch);
+    std::memcpy(row+x0*ch, &data[(srcY*this->w+x0-shiftX)*ch], (x1-x0)*ch*sizeof(T));
+    imgkernels::fillPattern(row+x1*ch, (w-x1)*ch, pixel.data(), ch);
   }
   return img;
 }
@@ -1643,7 +1815,10 @@ inline bool operator==(const Img<T> &I1, const Img<T> &I2)
 template<typename T>
 inline Img<T>& Img<T>::operator+=(const T &t)
 {
-  fora(i, 0, w*h*ch) data[i] += t;
+  T *d = data;
+  const auto v = t;
+  const int n = w*h*ch;
+  fora(i, 0, n) d[i] += v;
   return *this;
 }
 
@@ -1651,21 +1826,30 @@ template<typename T>
 template<typename U>
 inline Img<T>& Img<T>::operator-=(const U &t)
 {
-  fora(i, 0, w*h*ch) data[i] -= t;
+  T *d = data;
+  const auto v = t;
+  const int n = w*h*ch;
+  fora(i, 0, n) d[i] -= v;
   return *this;
 }
 
 template<typename T>
 inline Img<T>& Img<T>::operator*=(const T &t)
 {
-  fora(i, 0, w*h*ch) data[i] *= t;
+  T *d = data;
+  const auto v = t;
+  const int n = w*h*ch;
+  fora(i, 0, n) d[i] *= v;
   return *this;
 }
 
 template<typename T>
 inline Img<T>& Img<T>::operator/=(const T &t)
 {
-  fora(i, 0, w*h*ch) data[i] /= t;
+  T *d = data;
+  const auto v = t;
+  const int n = w*h*ch;
+  fora(i, 0, n) d[i] /= v;
   return *this;
 }
 
@@ -1673,7 +1857,10 @@ template<typename T>
 inline Img<T>& Img<T>::operator+=(const Img<T> &rhs)
 {
   assert(w == rhs.w && h == rhs.h && ch == rhs.ch);
-  fora(i, 0, w*h*ch) data[i] += rhs.data[i];
+  T *d = data;
+  const T *r = rhs.data;
+  const int n = w*h*ch;
+  fora(i, 0, n) d[i] += r[i];
   return *this;
 }
 
@@ -1681,7 +1868,10 @@ template<typename T>
 inline Img<T>& Img<T>::operator-=(const Img<T> &rhs)
 {
   assert(w == rhs.w && h == rhs.h && ch == rhs.ch);
-  fora(i, 0, w*h*ch) data[i] -= rhs.data[i];
+  T *d = data;
+  const T *r = rhs.data;
+  const int n = w*h*ch;
+  fora(i, 0, n) d[i] -= r[i];
   return *this;
 }
 
@@ -1689,7 +1879,10 @@ template<typename T>
 inline Img<T>& Img<T>::operator*=(const Img<T> &rhs)
 {
   assert(w == rhs.w && h == rhs.h && ch == rhs.ch);
-  fora(i, 0, w*h*ch) data[i] *= rhs.data[i];
+  T *d = data;
+  const T *r = rhs.data;
+  const int n = w*h*ch;
+  fora(i, 0, n) d[i] *= r[i];
   return *this;
 }
 
@@ -1697,7 +1890,10 @@ template<typename T>
 inline Img<T>& Img<T>::operator/=(const Img<T> &rhs)
 {
   assert(w == rhs.w && h == rhs.h && ch == rhs.ch);
-  fora(i, 0, w*h*ch) data[i] /= rhs.data[i];
+  T *d = data;
+  const T *r = rhs.data;
+  const int n = w*h*ch;
+  fora(i, 0, n) d[i] /= r[i];
   return *this;
 }
 
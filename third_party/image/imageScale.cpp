@@ -16,6 +16,17 @@ Imguc Imguc::scale(int newW, int newH)
   return O;
 }
 
+template<>
+void Imguc::scaleRows(Imguc &O, int y0, int y1) const
+{
+  assert(O.ch == ch && y0 >= 0 && y1 <= O.h);
+  if (y0 >= y1) return;
+  // the same filters as stbir_resize_uint8, the strip is shifted by y0 output rows
+  stbir_resize_subpixel(data, w, h, 0, &O.data[y0*O.w*ch], O.w, y1-y0, 0, STBIR_TYPE_UINT8, ch, STBIR_ALPHA_CHANNEL_NONE, 0,
+                        STBIR_EDGE_CLAMP, STBIR_EDGE_CLAMP, STBIR_FILTER_DEFAULT, STBIR_FILTER_DEFAULT, STBIR_COLORSPACE_LINEAR,
+                        nullptr, O.w/static_cast<float>(w), O.h/static_cast<float>(h), 0, y0);
+}
+
 template<>
 Imguc Imguc::scaleWidth(int newW)
 {
@@ -2,49 +2,59 @@
 // Licensed under the MIT License.
 
 #include "imageUtils.h"
-#include <stack>
+#include <vector>
 
 using namespace std;
 using namespace Eigen;
 
-void floodFill(Imguc &I, int startX, int startY, unsigned char targetColor, unsigned char replacementColor)
+namespace {
+
+// Scanline flood fill of the 4-connected pixels for which inside(x,y) is
+// true, fill(x,y) has to make inside(x,y) false. Whole spans are filled at
+// once and only the start of each span of the neighbouring rows is pushed to
+// the stack, which is kept between calls.
+template<typename Inside, typename Fill>
+void scanlineFloodFill(int w, int h, int startX, int startY, Inside inside, Fill fill)
 {
-  stack<pair<int,int>> S;
-  S.push(make_pair(startX,startY));
+  if (startX < 0 || startX >= w || startY < 0 || startY >= h || !inside(startX, startY)) return;
+  thread_local vector<pair<int,int>> S;
+  S.clear();
+  S.emplace_back(startX, startY);
   while (!S.empty()) {
-    const pair<int,int> &front = S.top();
-    const int x = front.first, y = front.second;
-    S.pop();
-    if (x < 0 || x >= I.w || y < 0 || y >= I.h) continue;
-    unsigned char &sample = I(x, y, 0);
-    if (targetColor == replacementColor || sample != targetColor) continue;
-    sample = replacementColor;
-    S.push(make_pair(x, y+1));
-    S.push(make_pair(x, y-1));
-    S.push(make_pair(x-1, y));
-    S.push(make_pair(x+1, y));
+    const int x = S.back().first, y = S.back().second;
+    S.pop_back();
+    if (!inside(x, y)) continue; // filled since it was pushed
+    int l = x, r = x;
+    while (l > 0 && inside(l-1, y)) l--;
+    while (r+1 < w && inside(r+1, y)) r++;
+    fora(i, l, r+1) fill(i, y);
+    for (const int ny : {y-1, y+1}) {
+      if (ny < 0 || ny >= h) continue;
+      bool prevInside = false;
+      fora(i, l, r+1) {
+        const bool in = inside(i, ny);
+        if (in && !prevInside) S.emplace_back(i, ny);
+        prevInside = in;
+      }
+    }
   }
 }
 
+}
+
+void floodFill(Imguc &I, int startX, int startY, unsigned char targetColor, unsigned char replacementColor)
+{
+  if (targetColor == replacementColor) return;
+  scanlineFloodFill(I.w, I.h, startX, startY,
+    [&](int x, int y) { return I(x, y, 0) == targetColor; },
+    [&](int x, int y) { I(x, y, 0) = replacementColor; });
+}
+
 void floodFill(const Imguc &I, Imguc &O, int startX, int startY, unsigned char targetColor, unsigned char replacementColor)
 {
-  stack<pair<int,int>> S;
-  S.push(make_pair(startX,startY));
-  while (!S.empty()) {
-    const pair<int,int> &front = S.top();
-    const int x = front.first, y = front.second;
-    S.pop();
-    if (x < 0 || x >= I.w || y < 0 || y >= I.h) continue;
-    const unsigned char &sampleI = I(x, y, 0);
-    unsigned char &sampleO = O(x, y, 0);
-    if (sampleI != targetColor || sampleO == replacementColor) continue;
-//    sampleI == targetColor && sampleO != replacementColor
-    sampleO = replacementColor;
-    S.push(make_pair(x, y+1));
-    S.push(make_pair(x, y-1));
-    S.push(make_pair(x-1, y));
-    S.push(make_pair(x+1, y));
-  }
+  scanlineFloodFill(I.w, I.h, startX, startY,
+    [&](int x, int y) { return I(x, y, 0) == targetColor && O(x, y, 0) != replacementColor; },
+    [&](int x, int y) { O(x, y, 0) = replacementColor; });
 }
 
 void scanlineFillOutline(const Imguc &outline, Imguc &out, unsigned char outlineColor)
@@ -6,6 +6,7 @@
 
 #include "image.h"
 #include <iostream>
+#include <vector>
 #include <Eigen/Core>
 
 void floodFill(Imguc &I, int startX, int startY, unsigned char targetColor, unsigned char replacementColor);
@@ -124,31 +125,72 @@ START:
   return true;
 }
 
+// Square structuring elements are separable: a pass over the rows finds the
+// nearest pixel of interest in the horizontal window of each pixel, a pass
+// over the columns then looks for the nearest row whose window has one. Both
+// use running "next index" scans, so the cost is O(w*h) regardless of N.
+
+// mask[i] != 0 if the i-th pixel of I has the given color
+template<typename T>
+std::vector<unsigned char> colorMask(const Img<T> &I, const Color<T> &color)
+{
+  std::vector<unsigned char> mask(I.w*I.h);
+  const T *p = &I(0,0,0);
+  fora(i, 0, I.w*I.h) {
+    bool same = true;
+    fora(c, 0, I.ch) if (p[c] != color(c)) { same = false; break; }
+    mask[i] = same;
+    p += I.ch;
+  }
+  return mask;
+}
+
+// rows[i] is the first row y' >= y of the column of the i-th pixel (y) with
+// hit(y'*w+x), h if there is none
+template<typename F>
+void nextRows(int w, int h, F hit, std::vector<int> &rows)
+{
+  rows.resize(w*h);
+  for (int y = h-1; y >= 0; y--) fora(x, 0, w) {
+    const int i = y*w+x;
+    rows[i] = hit(i) ? y : (y+1 < h ? rows[i+w] : h);
+  }
+}
+
+// O(x,y) is the first pixel different from backgroundColor in the
+// (2N+1)x(2N+1) window around (x,y) in row-major order, backgroundColor if
+// there is none
 template<typename T>
 void dilateSquare(const Img<T> &I, Img<T> &O, const Color<T> &backgroundColor, const int N = 1)
 {
+  using namespace std;
   if (!I.equalDimension(O)) O.initImage(I);
   O.fill(backgroundColor);
-  fora(y, 0, I.h) fora(x, 0, I.w) {
-    bool hit = false;
-    Color<T> color;
-    fora(j, -N, N+1) fora(i, -N, N+1) {
-      if (I.checkBounds(x+i, y+j, 0)) {
-        color = I.getPixel(x+i,y+j);
-        if (color != backgroundColor) {
-          hit = true;
-          goto EXIT;
-        }
-      }
-    }
-    EXIT:
-    if (hit) {
-      fora(c, 0, I.ch) {
-//        O(x,y,c) = I(x,y,c);
-        O.getPixel(x,y) = color;
-      }
+  const int w = I.w, h = I.h;
+  if (w == 0 || h == 0) return;
+  const vector<unsigned char> bg = colorMask(I, backgroundColor);
+
+  // column of the first foreground pixel in the horizontal window, -1 if none
+  vector<int> cols(w*h), next(w+1);
+  fora(y, 0, h) {
+    const unsigned char *row = &bg[y*w];
+    next[w] = w;
+    for (int x = w-1; x >= 0; x--) next[x] = row[x] ? next[x+1] : x;
+    fora(x, 0, w) {
+      const int col = next[max(x-N, 0)];
+      cols[y*w+x] = col <= min(x+N, w-1) ? col : -1;
     }
   }
+
+  vector<int> rows;
+  nextRows(w, h, [&](int i) { return cols[i] != -1; }, rows);
+  fora(y, 0, h) fora(x, 0, w) {
+    const int row = rows[max(y-N, 0)*w+x];
+    if (row > min(y+N, h-1)) continue;
+    const T *src = &I(cols[row*w+x],row,0);
+    T *dst = &O(x,y,0);
+    fora(c, 0, I.ch) dst[c] = src[c];
+  }
 }
 
 template<typename T>
@@ -159,29 +201,36 @@ Img<T> dilateSquare(const Img<T> &I, const Color<T> &backgroundColor, const int
   return O;
 }
 
+// O(x,y) is I(x,y) if there is no pixel of backgroundColor in the
+// (2N+1)x(2N+1) window around (x,y), backgroundColor otherwise (the color is
+// taken from the last pixel of the window clipped by the image)
 template<typename T>
 void erodeSquare(const Img<T> &I, Img<T> &O, const Color<T> &backgroundColor, const int N = 1)
 {
+  using namespace std;
   if (!I.equalDimension(O)) O.initImage(I);
   O.fill(backgroundColor);
-  fora(y, 0, I.h) fora(x, 0, I.w) {
-    bool miss = false;
-    Color<T> color;
-    fora(j, -N, N+1) fora(i, -N, N+1) {
-      if (I.checkBounds(x+i, y+j, 0)) {
-        color = I.getPixel(x+i,y+j);
-        if (color == backgroundColor) {
-          miss = true;
-          goto EXIT;
-        }
-      }
-    }
-    EXIT:
-    if (!miss) {
-      fora(c, 0, I.ch) {
-        O.getPixel(x,y) = color;
-      }
-    }
+  const int w = I.w, h = I.h;
+  if (w == 0 || h == 0) return;
+  const vector<unsigned char> bg = colorMask(I, backgroundColor);
+
+  // the horizontal window contains background
+  vector<unsigned char> miss(w*h);
+  vector<int> next(w+1);
+  fora(y, 0, h) {
+    const unsigned char *row = &bg[y*w];
+    next[w] = w;
+    for (int x = w-1; x >= 0; x--) next[x] = row[x] ? x : next[x+1];
+    fora(x, 0, w) miss[y*w+x] = next[max(x-N, 0)] <= min(x+N, w-1);
+  }
+
+  vector<int> rows;
+  nextRows(w, h, [&](int i) { return miss[i] != 0; }, rows);
+  fora(y, 0, h) fora(x, 0, w) {
+    if (rows[max(y-N, 0)*w+x] <= min(y+N, h-1)) continue;
+    const T *src = &I(min(x+N, w-1),min(y+N, h-1),0);
+    T *dst = &O(x,y,0);
+    fora(c, 0, I.ch) dst[c] = src[c];
   }
 }
 
@@ -10,8 +10,10 @@
 #include <igl/remove_unreferenced.h>
 #include <igl/adjacency_matrix.h>
 #include <igl/writeOBJ.h>
+#include <cstdint>
 #include <unordered_map>
 #include <tuple>
+#include <functional>
 #include <set>
 
 #ifndef DEBUG_CMD_IR
@@ -223,15 +225,64 @@ void MeshBuilder::getBoundary(int num, vector<int> &bnd, vector<int> &neumannBnd
   bnd = bnds[num];
 }
 
+// Vertices of a part hashed into a uniform grid by their X,Y coordinates. A query returns the vertex of the
+// part that findCorrespondences would find by going through the part from its end, i.e. the one with the
+// highest position in the part among those with eequal coordinates.
+class MeshBuilder::VertexGrid
+{
+public:
+  VertexGrid(const MatrixXd &mesh, const vector<int> &part, int X_COORD, int Y_COORD)
+    : mesh(mesh), part(part), X_COORD(X_COORD), Y_COORD(Y_COORD)
+  {
+    cells.reserve(part.size());
+    forlist(j2, part) {
+      const int j = part[j2];
+      cells[key(cellCoord(mesh(j,X_COORD)), cellCoord(mesh(j,Y_COORD)))].push_back(j2);
+    }
+  }
+
+  // index of the matching vertex of the mesh or -1 if there is none
+  int find(const Vector3d &coord) const
+  {
+    const int64_t cx = cellCoord(coord(X_COORD)), cy = cellCoord(coord(Y_COORD));
+    int best = -1;
+    // the cells are larger than the eequal tolerance, so the neighbouring cells contain all matches
+    fora(dy, -1, 2) fora(dx, -1, 2) {
+      const auto it = cells.find(key(cx+dx, cy+dy));
+      if (it == cells.end()) continue;
+      for(const int j2 : it->second) {
+        const int j = part[j2];
+        if (j2 > best && eequal(coord(X_COORD), mesh(j,X_COORD)) && eequal(coord(Y_COORD), mesh(j,Y_COORD))) best = j2;
+      }
+    }
+    return best == -1 ? -1 : part[best];
+  }
+
+private:
+  static int64_t cellCoord(double x) { return static_cast<int64_t>(floor(x / 0.001)); }
+  static uint64_t key(int64_t cx, int64_t cy) { return (static_cast<uint64_t>(cy) << 32) ^ static_cast<uint64_t>(cx & 0xffffffff); }
+
+  const MatrixXd &mesh;
+  const vector<int> &part;
+  int X_COORD, Y_COORD;
+  unordered_map<uint64_t, vector<int>> cells;
+};
+
 // get<0>(candidates) is index, get<1>(candidates) are vertex coordinates, get<2>(V) is custom number for a vertex
 // get<0>(corr) is index of vertex anywhere (inside/boundary) on the mesh, get<1>(corr) is index of candidate vertex (typically the boundary), get<3>(V) is custom number for a vertex
 void MeshBuilder::findCorrespondences(const vector<V2VCorrCandidate> &candidates, const MatrixXd &mesh, vector<V2VCorr> &corr, int maxindex, const vector<int> &part, const vector<bool> &isBnd)
+{
+  if (candidates.size() == 0) return;
+  const VertexGrid grid(mesh, part, (Z_COORD+1)%3, (Z_COORD+2)%3);
+  findCorrespondences(candidates, grid, corr, maxindex, isBnd);
+}
+
+void MeshBuilder::findCorrespondences(const vector<V2VCorrCandidate> &candidates, const VertexGrid &grid, vector<V2VCorr> &corr, int maxindex, const vector<bool> &isBnd)
 {
   if (candidates.size() == 0) return;
 
   vector<bool> used(maxindex, false);
 
-  int X_COORD = (Z_COORD+1)%3, Y_COORD = (Z_COORD+2)%3;
   bool subsequent = true;
   int i = 0;
   fora(k, -1, (int)candidates.size()) {
@@ -239,22 +290,14 @@ void MeshBuilder::findCorrespondences(const vector<V2VCorrCandidate> &candidates
     if (k == -1) i = candidates.size()-1; else i = k;
 
     const int candidateVInd = candidates[i].ind;
-    const Vector3d &candidateVCoord = candidates[i].coord;
-    for (int j2=part.size()-1; j2>=0; j2--) {
-      int j = part[j2];
-      if (eequal(candidateVCoord(X_COORD), mesh(j,X_COORD)) &&
-          eequal(candidateVCoord(Y_COORD), mesh(j,Y_COORD))) {
-        // if there are multiple correspondences, record only the first one
-        if (maxindex == 0 || !used[candidateVInd]) {
-          if (k >= 0) {
-            corr.push_back(V2VCorr{candidates[i].type, (isBnd[j]?VertexType::bnd:VertexType::in), candidateVInd, j, candidates[i].customNum, subsequent});
-//             if (!subsequent) printf("notsubs: %d\n",i);
-            if (maxindex > 0) used[candidateVInd] = true;
-          }
-          found = true;
-          break;
-        }
+    const int j = grid.find(candidates[i].coord);
+    // if there are multiple correspondences, record only the first one
+    if (j != -1 && (maxindex == 0 || !used[candidateVInd])) {
+      if (k >= 0) {
+        corr.push_back(V2VCorr{candidates[i].type, (isBnd[j]?VertexType::bnd:VertexType::in), candidateVInd, j, candidates[i].customNum, subsequent});
+        if (maxindex > 0) used[candidateVInd] = true;
       }
+      found = true;
     }
     subsequent = found;
   }
@@ -476,25 +519,33 @@ void MeshBuilder::createCompleteMesh()
   for(int ind : neumannBndc) isBnd[ind] = true;
 
   mergingCorr = vector<vector<vector<pair<int,int>>>>(counter, vector<vector<pair<int,int>>>(counter));
+  mergingCorrByBnd = vector<vector<unordered_map<int,int>>>(counter, vector<unordered_map<int,int>>(counter));
   eqCorr = ineqCorr = vector<vector<vector<V2VCorr>>>(counter, vector<vector<V2VCorr>>(counter));
+  // vertices of each part are hashed once and queried by the candidates of all other parts
+  vector<VertexGrid> grids;
+  grids.reserve(counter);
+  fora(b, 0, counter) grids.emplace_back(Vc, parts1[b], (Z_COORD+1)%3, (Z_COORD+2)%3);
+
   vector<V2VCorr> corr2;
   fora(a, 0, counter) {
     fora(b, 0, counter) {
       if (a == b) continue;
       DEBUG_CMD_IR(printf("[%d,%d] ", a, b););
       corr2.clear();
-      vector<int> parts(parts1[b].size());
-      forlist(i, parts1[b]) parts[i] = parts1[b][i];
-      findCorrespondences(eqCandidates[a], Vc, corr2, Vc.rows(), parts, isBnd);
+      const VertexGrid &grid = grids[b];
+      findCorrespondences(eqCandidates[a], grid, corr2, Vc.rows(), isBnd);
       fora(i, 0, corr2.size()) eqCorr[a][b].push_back(corr2[i]);
       DEBUG_CMD_IR(printf("bcondsEq: %6ld, ", corr2.size()););
       corr2.clear();
-      findCorrespondences(ineqCandidates[a], Vc, corr2, Vc.rows(), parts, isBnd);
+      findCorrespondences(ineqCandidates[a], grid, corr2, Vc.rows(), isBnd);
       fora(i, 0, corr2.size()) ineqCorr[a][b].push_back(corr2[i]);
       DEBUG_CMD_IR(printf("bcondsIneq: %6ld, ", corr2.size()););
       corr2.clear();
-      findCorrespondences(graftingBndCandidates[a], Vc, corr2, Vc.rows(), parts, isBnd);
-      fora(i, 0, corr2.size()) mergingCorr[a][b].push_back(make_pair(corr2[i].b, corr2[i].a));
+      findCorrespondences(graftingBndCandidates[a], grid, corr2, Vc.rows(), isBnd);
+      fora(i, 0, corr2.size()) {
+        mergingCorr[a][b].push_back(make_pair(corr2[i].b, corr2[i].a));
+        mergingCorrByBnd[a][b].emplace(corr2[i].a, corr2[i].b);
+      }
       DEBUG_CMD_IR(printf("merge: %6ld/%6ld (candidates/corrs)", graftingBndCandidates[a].size(), corr2.size()););
       DEBUG_CMD_IR(printf("\n"););
     }
@@ -608,83 +659,78 @@ void MeshBuilder::meshMergeAndRemoveDuplicates(const Eigen::MatrixXd &inV, const
   meshMergeAndRemoveDuplicates(inV, inF, verticesToMerge, outV, outF, inVerticesOfParts, outVerticesOfParts, removeV, reindex);
 }
 
-void MeshBuilder::meshMergeAndRemoveDuplicates(const Eigen::MatrixXd &inV, const Eigen::MatrixXi &inF, const std::vector<std::pair<int,int>> &verticesToMerge, Eigen::MatrixXd &outV, Eigen::MatrixXi &outF, std::vector<std::vector<int>> &inVerticesOfParts, std::vector<std::vector<int>> &outVerticesOfParts, std::vector<bool> &removeV, std::vector<int> &reindex)
-{
-  unordered_map<int,vector<int>> verticesToMergeMap;
-  for(auto &el : verticesToMerge) {
-    verticesToMergeMap[el.first].push_back(el.second);
-  }
-  meshMergeAndRemoveDuplicates(inV, inF, verticesToMergeMap, outV, outF, inVerticesOfParts, outVerticesOfParts, removeV, reindex);
-}
-
-void MeshBuilder::meshMergeAndRemoveDuplicates(const Eigen::MatrixXd &inV, const Eigen::MatrixXi &inF, const std::unordered_map<int,std::set<int>> &verticesToMerge, Eigen::MatrixXd &outV, Eigen::MatrixXi &outF, std::vector<std::vector<int>> &inVerticesOfParts, std::vector<std::vector<int>> &outVerticesOfParts, std::vector<bool> &removeV, std::vector<int> &reindex)
+// Merges the vertices given by forEachPair(f), which calls f(indVRemain, indVRemove) for each pair, and removes
+// the merged ones. The pairs are joined by union-find, so chains of merges (a vertex to remain is itself removed
+// by another pair) end up in the same vertex. All removed vertices of a class are reconnected to its first kept
+// vertex. The working arrays are kept per thread and reused by subsequent calls.
+template<typename ForEachPair>
+static void mergeAndRemoveDuplicates(const MatrixXd &inV, const MatrixXi &inF, const ForEachPair &forEachPair, MatrixXd &outV, MatrixXi &outF, const vector<vector<int>> &inVerticesOfParts, vector<vector<int>> &outVerticesOfParts, vector<bool> &removeV, vector<int> &reindex)
 {
-  unordered_map<int,vector<int>> verticesToMergeMap;
-  for(auto &el : verticesToMerge) {
-    for(auto &el2 : el.second) {
-      verticesToMergeMap[el.first].push_back(el2);
-    }
-  }
-  meshMergeAndRemoveDuplicates(inV, inF, verticesToMergeMap, outV, outF, inVerticesOfParts, outVerticesOfParts, removeV, reindex);
-}
-
-/**
- * verticesToMergeMap: first: index of vertex that will remain, second: vertices to be merged with first and then removed
- */
-void MeshBuilder::meshMergeAndRemoveDuplicates(const Eigen::MatrixXd &inV, const Eigen::MatrixXi &inF, const std::unordered_map<int,std::vector<int>> &verticesToMerge, Eigen::MatrixXd &outV, Eigen::MatrixXi &outF, std::vector<std::vector<int>> &inVerticesOfParts, std::vector<std::vector<int>> &outVerticesOfParts, std::vector<bool> &removeV, std::vector<int> &reindex)
-{
-  // find incident faces for all vertices
   const int nF = inF.rows();
   const int nV = inV.rows();
 
-  removeV.resize(nV, false);
-  reindex.resize(nV, -1);
-
-  vector<vector<pair<int,int>>> incidentFaces(nV);
-  fora(i, 0, nF) fora(j, 0, 3) incidentFaces[inF(i,j)].push_back(make_pair(i,j));
-
-  // mark unused vertices for removal
-  int nRemoved = 0;
-  for(auto &el : verticesToMerge) {
-    for(auto &indV : el.second) {
-      removeV[indV] = true;
-      nRemoved++;
-    }
-  }
-  const int nNew = nV-nRemoved;
-  outV.resize(nNew,3);
-  int j = 0;
+  removeV.assign(nV, false);
+  reindex.assign(nV, -1);
+
+  static thread_local vector<int> parent, kept;
+  parent.resize(nV);
+  fora(i, 0, nV) parent[i] = i;
+  auto find = [&](int i) {
+    while (parent[i] != i) { parent[i] = parent[parent[i]]; i = parent[i]; }
+    return i;
+  };
+
+  // join the merged vertices and mark them for removal
+  forEachPair([&](const int indVRemain, const int indVRemove) {
+    removeV[indVRemove] = true;
+    const int a = find(indVRemain), b = find(indVRemove);
+    if (a != b) parent[max(a,b)] = min(a,b);
+  });
+
+  // compact vertices: prefix sum of the kept ones, and the first kept vertex of each class
+  kept.assign(nV, -1);
+  int nNew = 0;
   fora(i, 0, nV) {
-    if (!removeV[i]) {
-      reindex[i] = j;
-      outV.row(j) = inV.row(i);
-      j++;
-    }
+    if (removeV[i]) continue;
+    reindex[i] = nNew++;
+    int &k = kept[find(i)];
+    if (k == -1) k = i;
   }
-
-  // copy faces
-  outF.resize(nF,inF.cols());
-  fora(i, 0, nF) fora(j, 0, outF.cols()) outF(i,j) = reindex[inF(i,j)];
-  // merge faces
-  for(auto &el : verticesToMerge) {
-    const int indVRemain = el.first;
-    for(const int indVRemove : el.second) {
-      // reconnect
-      forlist(j, incidentFaces[indVRemove]) {
-        const pair<int,int> &indF = incidentFaces[indVRemove][j];
-        outF(indF.first,indF.second) = reindex[indVRemain];
-      }
+  outV.resize(nNew, 3);
+  fora(i, 0, nV) if (!removeV[i]) outV.row(reindex[i]) = inV.row(i);
+
+  // copy faces, reconnect the removed vertices
+  outF.resize(nF, inF.cols());
+  fora(i, 0, nF) fora(j, 0, outF.cols()) {
+    const int ind = inF(i,j);
+    if (!removeV[ind]) outF(i,j) = reindex[ind];
+    else {
+      const int k = kept[find(ind)];
+      outF(i,j) = k == -1 ? -1 : reindex[k];
     }
   }
 
-  // update verticesOfParts
-  outVerticesOfParts.clear();
+  // update verticesOfParts, reusing the already allocated lists
+  outVerticesOfParts.resize(inVerticesOfParts.size());
   forlist(i, inVerticesOfParts) {
-    vector<int> verts;
-    forlist(j, inVerticesOfParts[i]) {
-      int ind = inVerticesOfParts[i][j];
-      if (!removeV[ind]) verts.push_back(reindex[ind]);
-    }
-    outVerticesOfParts.push_back(verts);
+    vector<int> &verts = outVerticesOfParts[i];
+    verts.clear();
+    for(const int ind : inVerticesOfParts[i]) if (!removeV[ind]) verts.push_back(reindex[ind]);
   }
 }
+
+void MeshBuilder::meshMergeAndRemoveDuplicates(const Eigen::MatrixXd &inV, const Eigen::MatrixXi &inF, const std::vector<std::pair<int,int>> &verticesToMerge, Eigen::MatrixXd &outV, Eigen::MatrixXi &outF, std::vector<std::vector<int>> &inVerticesOfParts, std::vector<std::vector<int>> &outVerticesOfParts, std::vector<bool> &removeV, std::vector<int> &reindex)
+{
+  auto forEachPair = [&](const function<void(int,int)> &f) { for(const auto &el : verticesToMerge) f(el.first, el.second); };
+  mergeAndRemoveDuplicates(inV, inF, forEachPair, outV, outF, inVerticesOfParts, outVerticesOfParts, removeV, reindex);
+}
+void MeshBuilder::meshMergeAndRemoveDuplicates(const Eigen::MatrixXd &inV, const Eigen::MatrixXi &inF, const std::unordered_map<int,std::set<int>> &verticesToMerge, Eigen::MatrixXd &outV, Eigen::MatrixXi &outF, std::vector<std::vector<int>> &inVerticesOfParts, std::vector<std::vector<int>> &outVerticesOfParts, std::vector<bool> &removeV, std::vector<int> &reindex)
+{
+  auto forEachPair = [&](const function<void(int,int)> &f) { for(const auto &el : verticesToMerge) for(const int el2 : el.second) f(el.first, el2); };
+  mergeAndRemoveDuplicates(inV, inF, forEachPair, outV, outF, inVerticesOfParts, outVerticesOfParts, removeV, reindex);
+}
+void MeshBuilder::meshMergeAndRemoveDuplicates(const Eigen::MatrixXd &inV, const Eigen::MatrixXi &inF, const std::unordered_map<int,std::vector<int>> &verticesToMerge, Eigen::MatrixXd &outV, Eigen::MatrixXi &outF, std::vector<std::vector<int>> &inVerticesOfParts, std::vector<std::vector<int>> &outVerticesOfParts, std::vector<bool> &removeV, std::vector<int> &reindex)
+{
+  auto forEachPair = [&](const function<void(int,int)> &f) { for(const auto &el : verticesToMerge) for(const int el2 : el.second) f(el.first, el2); };
+  mergeAndRemoveDuplicates(inV, inF, forEachPair, outV, outF, inVerticesOfParts, outVerticesOfParts, removeV, reindex);
+}
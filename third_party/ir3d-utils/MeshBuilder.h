@@ -37,6 +37,7 @@ public:
   void parseAnnotations(int ann, std::vector<int> &annParsed);
 
   template<typename ValueT> class mymap;
+  class VertexGrid;
 
 public:
   enum VertexType { all=-1, bnd=0, in=1 };
@@ -62,6 +63,7 @@ public:
   std::vector<int> pits;
   std::vector<std::vector<std::pair<int,int>>> graftingCorr;
   std::vector<std::vector<std::vector<std::pair<int,int>>>> mergingCorr; //a,b
+  std::vector<std::vector<std::unordered_map<int,int>>> mergingCorrByBnd; //a,b: boundary vertex -> its first counterpart in mergingCorr
   std::vector<std::vector<std::vector<V2VCorr>>> eqCorr, ineqCorr;
   std::vector<std::vector<int>> graftingCorrN;
   bool neumannAtGraftingBnd = false;
@@ -80,6 +82,7 @@ public:
   void processTwoSidedMesh(Eigen::MatrixXd &Vin1, Eigen::MatrixXi &Fin1, Eigen::MatrixXd &Vin2, Eigen::MatrixXi &Fin2, const bool computeBnds, std::vector<std::vector<int>> &customBnds, const bool removeUnreferenced);
   void createCompleteMesh();
   void findCorrespondences(const std::vector<V2VCorrCandidate> &candidates, const Eigen::MatrixXd &mesh, std::vector<V2VCorr> &corr, int maxindex, const std::vector<int> &part, const std::vector<bool> &isBnd);
+  void findCorrespondences(const std::vector<V2VCorrCandidate> &candidates, const VertexGrid &grid, std::vector<V2VCorr> &corr, int maxindex, const std::vector<bool> &isBnd);
   void findBndCandidates(std::vector<std::vector<V2VCorrCandidate> > &ineqCandidates,
                          std::vector<std::vector<V2VCorrCandidate> > &eqCandidates,
                          std::vector<std::vector<V2VCorrCandidate> > &graftingBndCandidates);
@@ -4,6 +4,11 @@
 #include "regionToMesh.h"
 #include <image/imageUtils.h>
 #include <igl/triangle/triangulate.h>
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <mutex>
+#include <unordered_set>
 
 using namespace std;
 using namespace Eigen;
@@ -74,25 +79,99 @@ void outlineToRegion(const Imguc &Io, Imguc &Ir)
   fora(y, 0, Ir.h) fora(x, 0, Ir.w) Ir(x,y,0) = Ir(x,y,0) == 128 ? 0 : 255;
 }
 
-void findRegionBoundary(const Imguc &S, std::vector<std::vector<Eigen::Vector2f>> &bnds, std::vector<Vector2f> &holePts)
+// Read access to an image surrounded by a 1 pixel wide frame of background (0) without copying it, i.e.
+// coordinates are shifted by one.
+class PaddedView
 {
+public:
+  PaddedView(const Imguc &I) : I(I), w(I.w+2), h(I.h+2) {}
+  unsigned char operator()(int x, int y) const
+  {
+    x--; y--;
+    return (x >= 0 && y >= 0 && x < I.w && y < I.h) ? I(x,y,0) : 0;
+  }
+
+  const Imguc &I;
+  const int w, h;
+};
+
+// floodFill(I, O, ...) of the padded image
+static void floodFill(const PaddedView &I, Imguc &O, int startX, int startY, unsigned char targetColor, unsigned char replacementColor)
+{
+  vector<pair<int,int>> S;
+  S.push_back(make_pair(startX,startY));
+  while (!S.empty()) {
+    const int x = S.back().first, y = S.back().second;
+    S.pop_back();
+    if (x < 0 || x >= I.w || y < 0 || y >= I.h) continue;
+    unsigned char &sampleO = O(x, y, 0);
+    if (I(x, y) != targetColor || sampleO == replacementColor) continue;
+    sampleO = replacementColor;
+    S.push_back(make_pair(x, y+1));
+    S.push_back(make_pair(x, y-1));
+    S.push_back(make_pair(x-1, y));
+    S.push_back(make_pair(x+1, y));
+  }
+}
+
+// traceRegion(M, fcn, startX, startY) that continues searching for the start from the previous start
+// (startX, startY), pixels before it are already in the mask.
+template<typename T>
+static bool traceNextComponent(const Imguc &M, T fcn, int &startX, int &startY)
+{
+  int x0 = -1, y0 = -1;
+  for (int y = max(startY, 0), x = max(startX, 0); y < M.h; y++, x = 0) {
+    for (; x < M.w; x++) if (M(x,y,0) == 0) { x0 = x; y0 = y; goto EXIT; }
+  }
+  EXIT:;
+  startX = x0; startY = y0;
+  if (x0 == -1) return false;
+
+  // possible directions: >, v, <, ^
+  static const int dir[4][2] = { {1,0}, {0,1}, {-1,0}, {0,-1} };
+  auto isForeground = [&](int x, int y) { return M.checkBounds(x,y,0) && M(x,y,0) == 0; };
+  int currentDir = 0;
+  int x = x0, y = y0;
+  int inPlaceCount = 0;
+  do {
+    // no wall on the left side, turn left, otherwise turn right while there is a wall ahead
+    const int l = (4+currentDir-1)%4;
+    if (isForeground(x+dir[l][0], y+dir[l][1])) currentDir = l;
+    else {
+      while (!isForeground(x+dir[currentDir][0], y+dir[currentDir][1]) && inPlaceCount <= 3) {
+        currentDir = (currentDir+1)%4;
+        inPlaceCount++;
+      }
+      if (inPlaceCount > 3) break;
+    }
+    inPlaceCount = 0;
+    fcn(x,y);
+    x += dir[currentDir][0]; y += dir[currentDir][1]; // step ahead
+  } while (!(x == x0 && y == y0));
+  return true;
+}
+
+void findRegionBoundary(const Imguc &segImg, std::vector<std::vector<Eigen::Vector2f>> &bnds, std::vector<Vector2f> &holePts)
+{
+  // The image boundary is handled by tracing the image as if it was surrounded by background, the traced
+  // coordinates are shifted back at the end.
+  const PaddedView S(segImg);
   // create a mask from the input segment
-  Imguc M; M.initImage(S); M.clear();
-  Imguc O; O.initImage(S); O.clear(); // outline image - used for finding hole points
-  // find the first background pixel and use flood fill to add background to the mask image
-  int startX=-1, startY=-1;
-  fora(y,0,M.h) fora(x,0,M.w) if (S(x,y,0) == 0) { startX=x; startY=y; goto EXIT1; } EXIT1:;
+  Imguc M(S.w, S.h, 1); M.clear();
+  // the frame is background, use flood fill to add background to the mask image
+  int startX=0, startY=0;
   floodFill(S, M, startX, startY, 0, 255);
 
   bnds.clear();
   vector<Vector2f> bnd;
   auto getBoundary = [&](int x,int y) { bnd.push_back(Vector2f(x,y)); };
+  unordered_set<int> outline; // pixels of the current boundary, used for finding hole points
   startX=-1; startY=-1;
   int j = 1;
-  while (traceRegion(M, getBoundary, startX, startY)) {
+  while (traceNextComponent(M, getBoundary, startX, startY)) {
     // if the region is composed of several separated components, save the current component as a separate boundary
     const int nBnd = bnd.size();
-    const int &color = S(startX,startY,0);
+    const int color = S(startX,startY);
     DEBUG_CMD_IR(cout << "new component of region " << color << ", size: " << nBnd;);
     if (color == 0) DEBUG_CMD_IR(cout << ", it is a hole";);
     if (nBnd > 10) {
@@ -105,12 +184,13 @@ void findRegionBoundary(const Imguc &S, std::vector<std::vector<Eigen::Vector2f>
 
     if (color == 0) {
       // the component is a hole, find a single point that is inside it (assuming that the shape may be concave)
-      O.clear(); fora(k, 0, nBnd) O(bnd[k](0), bnd[k](1), 0) = 255; // fill outline image
+      outline.clear(); fora(k, 0, nBnd) outline.insert(bnd[k](1)*S.w + bnd[k](0));
       fora(k, 0, nBnd) fora(l, nBnd/2, 3*nBnd/2) {
         if (k==l) continue;
         const Vector2i centroid = (0.5*(bnd[k]+bnd[l])).cast<int>();
-        if (S(centroid(0), centroid(1), 0) == 0 && M(centroid(0), centroid(1), 0) == 255 && O(centroid(0), centroid(1), 0) == 0) {
-          holePts.push_back(centroid.cast<float>());
+        if (S(centroid(0), centroid(1)) == 0 && M(centroid(0), centroid(1), 0) == 255 &&
+            outline.find(centroid(1)*S.w + centroid(0)) == outline.end()) {
+          holePts.push_back(centroid.cast<float>() - Vector2f(1,1));
           goto EXIT2;
         }
       }
@@ -120,6 +200,9 @@ void findRegionBoundary(const Imguc &S, std::vector<std::vector<Eigen::Vector2f>
     bnd.clear();
     j++;
   }
+
+  // back to coordinates of the original image
+  for(auto &b : bnds) for(auto &p : b) p -= Vector2f(1,1);
   DEBUG_CMD_IR(cout << "Tracing boundary done; total components: " << bnds.size() << endl;);
 }
 
@@ -135,48 +218,52 @@ void outlineToMesh(const std::vector<Imguc> &outlines, const std::vector<Imguc>
   outlineToMesh(outlines, segs, aboveOnly, belowOnly, interiorMergingPtsOnly, triangleOpts, mergeBothSides, Vs, Fs, smoothFactor, regionsBnds, triData);
 }
 
-void outlineToMesh(const std::vector<Imguc> &outlines, const std::vector<Imguc> &segs,
-              const bool aboveOnly, const bool belowOnly, const bool interiorMergingPtsOnly,
-              const std::string &triangleOpts,
-              std::set<int> &mergeBothSides,
-              std::vector<Eigen::MatrixXd> &Vs, std::vector<Eigen::MatrixXi> &Fs,
-              const int smoothFactor,
-              std::vector<std::vector<std::vector<Eigen::Vector2f>>> &regionsBnds,
-              std::vector<TriData> &triData)
+struct BndHints {
+  bool missingBoundary = false;
+  bool surrounded = false;
+};
+
+static void serialFor(int n, const std::function<void(int)> &body)
 {
-  assert(outlines.size() == segs.size());
+  fora(i, 0, n) body(i);
+}
 
-  triData.resize(segs.size());
+// Boundaries of all regions (smoothed) with their hole points and hints. Each region is processed by a
+// separate call of parallelFor's body.
+static void findRegionsBoundaries(const std::vector<Imguc> &outlines, const std::vector<Imguc> &segs,
+                                  const int smoothFactor,
+                                  std::vector<std::vector<std::vector<Eigen::Vector2f>>> &regionsBnds,
+                                  vector<vector<Vector2f>> &regionsHolePts,
+                                  vector<vector<vector<BndHints>>> &regionsBndsHints,
+                                  const ParallelForFn &parallelFor)
+{
+  assert(outlines.size() == segs.size());
 
-  vector<vector<Vector2f>> regionsHolePts;
+  regionsBnds.assign(segs.size(), vector<vector<Vector2f>>());
+  regionsHolePts.assign(segs.size(), vector<Vector2f>());
+  regionsBndsHints.assign(segs.size(), vector<vector<BndHints>>());
 
   // find region boundaries
-  forlist(i, segs) {
-    const Imguc &S = segs[i].resize(segs[i].w+2, segs[i].h+2, 1, 1, Cu{0}); // handle image boundary
-
-    vector<vector<Vector2f>> bnds;
-    vector<Vector2f> holePts;
-    findRegionBoundary(S, bnds, holePts);
-
-    // back coordinates of original image
-    for(auto &bnd : bnds) {
-      for(auto &p : bnd) p -= Vector2f(1,1);
+  parallelFor(segs.size(), [&](int i) {
+    findRegionBoundary(segs[i], regionsBnds[i], regionsHolePts[i]);
+  });
+
+  // number of regions covering each pixel, i.e. the test whether a boundary point is covered by other regions
+  // below is a single lookup
+  const int w = segs.empty() ? 0 : segs[0].w, h = segs.empty() ? 0 : segs[0].h;
+  vector<int> coverage(w*h, 0);
+  parallelFor(h, [&](int y) {
+    for(const Imguc &S : segs) {
+      assert(S.w == w && S.h == h);
+      fora(x, 0, w) if (S(x,y,0) != 0) coverage[y*w+x]++;
     }
-    for(auto &p : holePts) p -= Vector2f(1,1);
+  });
 
-    regionsBnds.push_back(bnds);
-    regionsHolePts.push_back(holePts);
-  }
-
-  struct BndHints {
-    bool missingBoundary = false;
-    bool surrounded = false;
-  };
   // find a part of region boundary which does not have an outline (i.e. interconnection boundary)
-  vector<vector<vector<BndHints>>> regionsBndsHints(regionsBnds.size());
-  int n = 0;
-  forlist(i, regionsBnds) {
+  vector<int> nInterconnection(regionsBnds.size(), 0);
+  parallelFor(regionsBnds.size(), [&](int i) {
     const Imguc &Oorig = outlines[i];
+    int &n = nInterconnection[i];
     forlist(j, regionsBnds[i]) {
       if (j == 0) regionsBndsHints[i].resize(regionsBnds[i].size());
       bool surrounded = true;
@@ -193,8 +280,8 @@ void outlineToMesh(const std::vector<Imguc> &outlines, const std::vector<Imguc>
           // Check if the region boundary is surrounded by other regions:
           // If there is at least one boundary point of other regions with foreground pixel, then
           // we treat the region as surrounded.
-          bool foregroundPresent = false;
-          forlist(l, segs) if (l != i) if (segs[l](p(0),p(1),0) != 0) { foregroundPresent = true; break; }
+          const int x = p(0), y = p(1);
+          const bool foregroundPresent = coverage[y*w+x] - (segs[i](x,y,0) != 0 ? 1 : 0) > 0;
           surrounded = foregroundPresent;
         }
       }
@@ -205,11 +292,8 @@ void outlineToMesh(const std::vector<Imguc> &outlines, const std::vector<Imguc>
         }
       }
     }
-  }
-  DEBUG_CMD_IR(cout << "interconnectionBnd: " << n << endl;);
 
-  // boundary smoothing
-  forlist(i, regionsBnds) {
+    // boundary smoothing
     forlist(j, regionsBnds[i]) {
       fora(s,0,smoothFactor) {
         vector<Vector2f> &bnd = regionsBnds[i][j];
@@ -221,78 +305,273 @@ void outlineToMesh(const std::vector<Imguc> &outlines, const std::vector<Imguc>
         }
       }
     }
+  });
+  int n = 0;
+  for(int ni : nInterconnection) n += ni;
+  DEBUG_CMD_IR(cout << "interconnectionBnd: " << n << endl;);
+}
+
+// Edges of closed polygons bucketed by the image rows they span. Used for even-odd point-in-polygon tests
+// that only visit the edges crossing the row of the query point.
+class PolygonEdgeTable
+{
+public:
+  PolygonEdgeTable(const vector<vector<Vector2f>> &polys)
+  {
+    float minY = numeric_limits<float>::max(), maxY = numeric_limits<float>::lowest();
+    for(const auto &poly : polys) for(const auto &p : poly) { minY = min(minY, p(1)); maxY = max(maxY, p(1)); }
+    if (minY > maxY) return;
+    y0 = floor(minY);
+    rows.resize(static_cast<int>(floor(maxY) - y0) + 1);
+    for(const auto &poly : polys) {
+      forlist(k, poly) {
+        const Vector2f &a = poly[k], &b = poly[(k+1) % poly.size()];
+        if (a(1) == b(1)) continue; // horizontal edges never cross the ray
+        const int r0 = floor(min(a(1),b(1))) - y0, r1 = floor(max(a(1),b(1))) - y0;
+        fora(r, r0, r1+1) rows[r].push_back(make_pair(a, b));
+      }
+    }
   }
 
-  // it is necessary to regenerate the segmentation and outline images according to the smoothed boundary
-  vector<Imguc> segsSmooth(segs.size()), outlinesSmooth(segs.size());
-  forlist(i, segs) {
-    Imguc &S = segsSmooth[i]; S.initImage(segs[i]); S.clear();
-    const vector<vector<Vector2f>> &bnds = regionsBnds[i];
-    for(const auto &bnd : bnds) for(const auto &p : bnd) {
-      S(p(0),p(1),0) = 255;
+  bool inside(const Vector2f &p) const
+  {
+    const int r = floor(p(1)) - y0;
+    if (r < 0 || r >= static_cast<int>(rows.size())) return false;
+    bool in = false;
+    for(const auto &e : rows[r]) {
+      const Vector2f &a = e.first, &b = e.second;
+      if ((a(1) > p(1)) == (b(1) > p(1))) continue;
+      const float x = a(0) + (p(1) - a(1)) * (b(0) - a(0)) / (b(1) - a(1));
+      if (x > p(0)) in = !in;
+    }
+    return in;
+  }
+
+private:
+  int y0 = 0;
+  vector<vector<pair<Vector2f,Vector2f>>> rows;
+};
+
+// Uniform grid of the boundary points of all regions. Lets a region visit only the boundary points of the
+// other regions that lay within its bounding box instead of all of them.
+class BoundaryGrid
+{
+public:
+  // index of a boundary point: region, boundary, point
+  typedef array<int,3> PointRef;
+
+  BoundaryGrid(const vector<vector<vector<Vector2f>>> &regionsBnds, const int cellSize = 16)
+    : cellSize(cellSize)
+  {
+    float minX = numeric_limits<float>::max(), minY = minX, maxX = numeric_limits<float>::lowest(), maxY = maxX;
+    for(const auto &bnds : regionsBnds) for(const auto &bnd : bnds) for(const auto &p : bnd) {
+      minX = min(minX, p(0)); maxX = max(maxX, p(0));
+      minY = min(minY, p(1)); maxY = max(maxY, p(1));
     }
+    if (minX > maxX) return;
+    x0 = floor(minX); y0 = floor(minY);
+    gw = (static_cast<int>(floor(maxX)) - x0) / cellSize + 1;
+    gh = (static_cast<int>(floor(maxY)) - y0) / cellSize + 1;
+    cells.resize(gw*gh);
+    forlist(j, regionsBnds) forlist(k, regionsBnds[j]) forlist(l, regionsBnds[j][k]) {
+      const Vector2f &p = regionsBnds[j][k][l];
+      cells[cellY(p(1))*gw + cellX(p(0))].push_back({{static_cast<int>(j), static_cast<int>(k), static_cast<int>(l)}});
+    }
+  }
 
-    // fill the interior of the outline to obtain region
-    scanlineFillOutline(S.deepCopy(), S, 255);
+  // References to the points within the bounding box of the given boundaries, in the order of regions,
+  // boundaries and points.
+  vector<PointRef> query(const vector<vector<Vector2f>> &bnds) const
+  {
+    vector<PointRef> refs;
+    if (cells.empty()) return refs;
+    float minX = numeric_limits<float>::max(), minY = minX, maxX = numeric_limits<float>::lowest(), maxY = maxX;
+    for(const auto &bnd : bnds) for(const auto &p : bnd) {
+      minX = min(minX, p(0)); maxX = max(maxX, p(0));
+      minY = min(minY, p(1)); maxY = max(maxY, p(1));
+    }
+    if (minX > maxX) return refs;
+    const int cx0 = cellX(minX), cx1 = cellX(maxX), cy0 = cellY(minY), cy1 = cellY(maxY);
+    fora(cy, cy0, cy1+1) fora(cx, cx0, cx1+1) {
+      const auto &cell = cells[cy*gw + cx];
+      refs.insert(refs.end(), cell.begin(), cell.end());
+    }
+    sort(refs.begin(), refs.end());
+    return refs;
   }
 
-  // process region boundaries
-  forlist(i, segs) {
-    const Imguc &S = segs[i];
-    Imguc O; O.initImage(S); O.clear(); // outline image
-    for(const auto &bnd : regionsBnds[i]) for(const auto &p : bnd) O(p(0),p(1),0) = 255;
-
-    // find interior points from other region boundaries
-    vector<Vector2f> interiorPts;
-    forlist(j, regionsBnds) {
-      if (i == j) continue;
-      bool bothSides = mergeBothSides.find(j) != mergeBothSides.end();
-      if (!bothSides) {
-        if (aboveOnly && j < i) continue;
-        if (belowOnly && j > i) continue;
-      }
-      const vector<vector<Vector2f>> &bnds = regionsBnds[j];
-      forlist(k, bnds) {
-        const auto &bnd = bnds[k];
-        forlist(l, bnd) {
-          const Vector2f &p = bnd[l];
-          // If a boundary point of some other region lays inside the current region
-          // and it is not on the current region's outline then it is an interior point.
-          if (S(p(0),p(1),0) != 0 && O(p(0),p(1),0) == 0) {
-            if (!interiorMergingPtsOnly || regionsBndsHints[j][k][l].missingBoundary) interiorPts.push_back(p);
-          }
-        }
-      }
+private:
+  int cellX(const float x) const { return max(0, min(gw-1, (static_cast<int>(floor(x)) - x0) / cellSize)); }
+  int cellY(const float y) const { return max(0, min(gh-1, (static_cast<int>(floor(y)) - y0) / cellSize)); }
+
+  int cellSize, x0 = 0, y0 = 0, gw = 0, gh = 0;
+  vector<vector<PointRef>> cells;
+};
+
+// Interior points of the region i from the boundaries of the other regions above (aboveOnly) or below
+// (belowOnly) it. The points are tested against the smoothed boundaries of the region, i.e. the polygon
+// that is triangulated, so no image of the region is needed. Only the boundary points found in the grid
+// within the region's bounding box are visited.
+static vector<Vector2f> regionInteriorPts(const int i,
+                                          const bool aboveOnly, const bool belowOnly,
+                                          const bool interiorMergingPtsOnly,
+                                          const std::set<int> &mergeBothSides,
+                                          const std::vector<std::vector<std::vector<Eigen::Vector2f>>> &regionsBnds,
+                                          const vector<vector<vector<BndHints>>> &regionsBndsHints,
+                                          const BoundaryGrid &grid)
+{
+  const PolygonEdgeTable polygon(regionsBnds[i]);
+  // pixels of the region's outline
+  auto pixelKey = [](const Vector2f &p) { return (static_cast<uint64_t>(static_cast<uint32_t>(p(1))) << 32) | static_cast<uint32_t>(p(0)); };
+  unordered_set<uint64_t> outline;
+  for(const auto &bnd : regionsBnds[i]) for(const auto &p : bnd) outline.insert(pixelKey(p));
+
+  // find interior points from other region boundaries
+  vector<Vector2f> interiorPts;
+  for(const auto &ref : grid.query(regionsBnds[i])) {
+    const int j = ref[0], k = ref[1], l = ref[2];
+    if (i == j) continue;
+    bool bothSides = mergeBothSides.find(j) != mergeBothSides.end();
+    if (!bothSides) {
+      if (aboveOnly && j < i) continue;
+      if (belowOnly && j > i) continue;
     }
-    DEBUG_CMD_IR(cout << "interiorPts: " << interiorPts.size() << endl;);
-
-    // prepare data for triangulation
-    const vector<vector<Vector2f>> &bnds = regionsBnds[i];
-    vector<int> interconnectionBnd, eqBnd;
-    int n = 0;
-    forlist(k, bnds) {
-      const auto &bnd = bnds[k];
-      forlist(l, bnd) {
-        if (regionsBndsHints[i][k][l].missingBoundary) interconnectionBnd.push_back(n+l);
-        if (regionsBndsHints[i][k][l].surrounded) eqBnd.push_back(n+l);
-      }
-      n += bnd.size();
+    const Vector2f &p = regionsBnds[j][k][l];
+    // If a boundary point of some other region lays inside the current region
+    // and it is not on the current region's outline then it is an interior point.
+    if (polygon.inside(p) && outline.find(pixelKey(p)) == outline.end()) {
+      if (!interiorMergingPtsOnly || regionsBndsHints[j][k][l].missingBoundary) interiorPts.push_back(p);
     }
+  }
+  DEBUG_CMD_IR(cout << "interiorPts: " << interiorPts.size() << endl;);
+  return interiorPts;
+}
 
-    MatrixXd Vout;
-    MatrixXi Fout;
-    triData[i] = TriData(regionsBnds[i], regionsHolePts[i], interiorPts, triangleOpts);
-    triangulate(triData[i], Vout, Fout);
+// Triangulation of the region i with the given interior points.
+static void regionToMesh(const int i, const vector<Vector2f> &interiorPts,
+                         const std::string &triangleOpts,
+                         const std::vector<std::vector<std::vector<Eigen::Vector2f>>> &regionsBnds,
+                         const vector<vector<Vector2f>> &regionsHolePts,
+                         const vector<vector<vector<BndHints>>> &regionsBndsHints,
+                         Eigen::MatrixXd &Vout, Eigen::MatrixXi &Fout, TriData &triData,
+                         const TriangulateFn &triangulateFn,
+                         const TriDataTriangulateFn &triDataTriangulateFn = TriDataTriangulateFn())
+{
+  // prepare data for triangulation
+  const vector<vector<Vector2f>> &bnds = regionsBnds[i];
+  vector<int> interconnectionBnd, eqBnd;
+  int n = 0;
+  forlist(k, bnds) {
+    const auto &bnd = bnds[k];
+    forlist(l, bnd) {
+      if (regionsBndsHints[i][k][l].missingBoundary) interconnectionBnd.push_back(n+l);
+      if (regionsBndsHints[i][k][l].surrounded) eqBnd.push_back(n+l);
+    }
+    n += bnd.size();
+  }
+
+  triData = TriData(regionsBnds[i], regionsHolePts[i], interiorPts, triangleOpts);
+  if (triDataTriangulateFn) triDataTriangulateFn(triData, Vout, Fout);
+  else triangulate(triData, Vout, Fout, triangulateFn);
 
-    // add annotations for the interconnection boundary points to the final triangulation
-    for(const auto &el : interconnectionBnd) Vout(el,2) = 1100;
+  // add annotations for the interconnection boundary points to the final triangulation
+  for(const auto &el : interconnectionBnd) Vout(el,2) = 1100;
+}
 
+void outlineToMesh(const std::vector<Imguc> &outlines, const std::vector<Imguc> &segs,
+              const bool aboveOnly, const bool belowOnly, const bool interiorMergingPtsOnly,
+              const std::string &triangleOpts,
+              std::set<int> &mergeBothSides,
+              std::vector<Eigen::MatrixXd> &Vs, std::vector<Eigen::MatrixXi> &Fs,
+              const int smoothFactor,
+              std::vector<std::vector<std::vector<Eigen::Vector2f>>> &regionsBnds,
+              std::vector<TriData> &triData,
+              const TriangulateFn &triangulateFn)
+{
+  vector<vector<Vector2f>> regionsHolePts;
+  vector<vector<vector<BndHints>>> regionsBndsHints;
+  findRegionsBoundaries(outlines, segs, smoothFactor, regionsBnds, regionsHolePts, regionsBndsHints, serialFor);
+
+  // process region boundaries
+  const BoundaryGrid grid(regionsBnds);
+  triData.resize(segs.size());
+  forlist(i, segs) {
+    MatrixXd Vout;
+    MatrixXi Fout;
+    const vector<Vector2f> interiorPts = regionInteriorPts(i, aboveOnly, belowOnly, interiorMergingPtsOnly,
+                                                           mergeBothSides, regionsBnds, regionsBndsHints, grid);
+    regionToMesh(i, interiorPts, triangleOpts, regionsBnds, regionsHolePts, regionsBndsHints, Vout, Fout,
+                 triData[i], triangulateFn);
     Vs.push_back(Vout);
     Fs.push_back(Fout);
   }
 }
 
-void triangulate(TriData &triData, MatrixXd &Vout, MatrixXi &Fout)
+void outlineToMeshBothSides(const std::vector<Imguc> &outlines, const std::vector<Imguc> &segs,
+              const bool interiorMergingPtsOnly,
+              const std::vector<std::string> &triangleOpts,
+              std::set<int> &mergeBothSides,
+              std::vector<Eigen::MatrixXd> &VsFront, std::vector<Eigen::MatrixXi> &FsFront,
+              std::vector<Eigen::MatrixXd> &VsBack, std::vector<Eigen::MatrixXi> &FsBack,
+              const int smoothFactor,
+              std::vector<std::vector<std::vector<Eigen::Vector2f>>> &regionsBnds,
+              std::vector<TriData> &triData,
+              const TriangulateFn &triangulateFn,
+              const ParallelForFn &parallelFor,
+              const TriDataTriangulateFn &triDataTriangulateFn)
+{
+  const ParallelForFn &pf = parallelFor ? parallelFor : ParallelForFn(serialFor);
+  vector<vector<Vector2f>> regionsHolePts;
+  vector<vector<vector<BndHints>>> regionsBndsHints;
+  findRegionsBoundaries(outlines, segs, smoothFactor, regionsBnds, regionsHolePts, regionsBndsHints, pf);
+
+  // interior points of both sides, the grid of all region boundaries is shared by them
+  const int N = segs.size();
+  const BoundaryGrid grid(regionsBnds);
+  vector<vector<Vector2f>> interiorPtsFront(N), interiorPtsBack(N);
+  pf(N, [&](int i) {
+    interiorPtsFront[i] = regionInteriorPts(i, true, false, interiorMergingPtsOnly, mergeBothSides,
+                                            regionsBnds, regionsBndsHints, grid);
+    interiorPtsBack[i] = regionInteriorPts(i, false, true, interiorMergingPtsOnly, mergeBothSides,
+                                           regionsBnds, regionsBndsHints, grid);
+  });
+
+  // The back side is triangulated only if its interior points differ from the front side ones (often they
+  // are the same, e.g. for regions without merging), otherwise the front side triangulation is copied.
+  // Results are written by index, i.e. the order does not depend on scheduling.
+  vector<int> tasks;
+  fora(i, 0, N) tasks.push_back(i);
+  fora(i, 0, N) if (interiorPtsBack[i] != interiorPtsFront[i]) tasks.push_back(N+i);
+  triData.resize(N);
+  vector<TriData> triDataBack(N);
+  VsFront.resize(N); FsFront.resize(N);
+  VsBack.resize(N); FsBack.resize(N);
+  pf(tasks.size(), [&](int k) {
+    const int i = tasks[k] % N;
+    const bool front = tasks[k] < N;
+    regionToMesh(i, front ? interiorPtsFront[i] : interiorPtsBack[i], triangleOpts[i],
+                 regionsBnds, regionsHolePts, regionsBndsHints,
+                 front ? VsFront[i] : VsBack[i], front ? FsFront[i] : FsBack[i],
+                 front ? triData[i] : triDataBack[i], triangulateFn, triDataTriangulateFn);
+  });
+  fora(i, 0, N) {
+    if (interiorPtsBack[i] != interiorPtsFront[i]) continue;
+    VsBack[i] = VsFront[i];
+    FsBack[i] = FsFront[i];
+  }
+}
+
+void triangulateSerialized(const Eigen::MatrixXd &V, const Eigen::MatrixXi &E, const Eigen::MatrixXd &H,
+                           const std::string &opts, Eigen::MatrixXd &Vout, Eigen::MatrixXi &Fout)
+{
+  // Triangle keeps a global state (the random seed and the constants of exact arithmetic), which it
+  // reinitializes in every call, i.e. calls must not overlap
+  static mutex triangleMutex;
+  lock_guard<mutex> lock(triangleMutex);
+  triangle::triangulate(V, E, H, opts, Vout, Fout);
+}
+
+void triangulate(TriData &triData, MatrixXd &Vout, MatrixXi &Fout, const TriangulateFn &triangulateFn)
 {
   const vector<vector<Vector2f>> &bnds = triData.regionBnds;
   const vector<Vector2f> &holePts = triData.regionHolePts;
@@ -326,7 +605,8 @@ void triangulate(TriData &triData, MatrixXd &Vout, MatrixXi &Fout)
   forlist(l, holePts) H.row(l) = holePts[l].cast<double>();
 
   MatrixXd Vout2;
-  triangle::triangulate(V, E, H, triData.triangleOpts, Vout2, Fout);
+  if (triangulateFn) triangulateFn(V, E, H, triData.triangleOpts, Vout2, Fout);
+  else triangulateSerialized(V, E, H, triData.triangleOpts, Vout2, Fout);
   Vout.resize(Vout2.rows(), 3);
   Vout.col(0) = Vout2.col(0);
   Vout.col(1) = Vout2.col(1);
@@ -8,6 +8,7 @@
 #include <vector>
 #include <image/image.h>
 #include <set>
+#include <functional>
 
 class TriData
 {
@@ -34,7 +35,22 @@ public:
   float scaling = 1;
 };
 
-void triangulate(TriData &triData, Eigen::MatrixXd &Vout, Eigen::MatrixXi &Fout);
+// replacement of igl::triangle::triangulate(V, E, H, opts, Vout, Fout), e.g. for caching
+typedef std::function<void(const Eigen::MatrixXd &V, const Eigen::MatrixXi &E, const Eigen::MatrixXd &H,
+                           const std::string &opts, Eigen::MatrixXd &Vout, Eigen::MatrixXi &Fout)> TriangulateFn;
+
+// replacement of the whole triangulate(triData, Vout, Fout), e.g. a mesher that does not need the V, E, H
+// matrices of Triangle; Vout has 3 columns
+typedef std::function<void(const TriData &triData, Eigen::MatrixXd &Vout, Eigen::MatrixXi &Fout)> TriDataTriangulateFn;
+
+// calls body(i) for all i in [0, n), possibly concurrently
+typedef std::function<void(int n, const std::function<void(int)> &body)> ParallelForFn;
+
+void triangulate(TriData &triData, Eigen::MatrixXd &Vout, Eigen::MatrixXi &Fout,
+                 const TriangulateFn &triangulateFn = TriangulateFn());
+// igl::triangle::triangulate, safe to be called from several threads (the calls are serialized)
+void triangulateSerialized(const Eigen::MatrixXd &V, const Eigen::MatrixXi &E, const Eigen::MatrixXd &H,
+                           const std::string &opts, Eigen::MatrixXd &Vout, Eigen::MatrixXi &Fout);
 void outlineToMesh(const std::vector<Imguc> &outlines, const std::vector<Imguc> &segs,
               const bool aboveOnly, const bool belowOnly, const bool interiorMergingPtsOnly,
               const std::string &triangleOpts, std::set<int> &mergeBothSides, std::vector<Eigen::MatrixXd> &Vs, std::vector<Eigen::MatrixXi> &Fs, const int smoothFactor);
@@ -43,7 +59,26 @@ void outlineToMesh(const std::vector<Imguc> &outlines, const std::vector<Imguc>
               const std::string &triangleOpts, std::set<int> &mergeBothSides, std::vector<Eigen::MatrixXd> &Vs, std::vector<Eigen::MatrixXi> &Fs,
               const int smoothFactor,
               std::vector<std::vector<std::vector<Eigen::Vector2f>>> &regionsBnds,
-              std::vector<TriData> &triData);
+              std::vector<TriData> &triData,
+              const TriangulateFn &triangulateFn = TriangulateFn());
+// Same as outlineToMesh with aboveOnly (front side) followed by outlineToMesh with belowOnly (back side),
+// but the region boundaries are found only once and the regions of both sides are processed through
+// parallelFor. The output does not depend on the order in which they are processed. triData is of the front
+// side, triangulateFn must be safe to be called concurrently. triangleOpts are given for each region.
+// triDataTriangulateFn, if given, is used instead of triangulate() and triangulateFn.
+void outlineToMeshBothSides(const std::vector<Imguc> &outlines, const std::vector<Imguc> &segs,
+              const bool interiorMergingPtsOnly,
+              const std::vector<std::string> &triangleOpts, std::set<int> &mergeBothSides,
+              std::vector<Eigen::MatrixXd> &VsFront, std::vector<Eigen::MatrixXi> &FsFront,
+              std::vector<Eigen::MatrixXd> &VsBack, std::vector<Eigen::MatrixXi> &FsBack,
+              const int smoothFactor,
+              std::vector<std::vector<std::vector<Eigen::Vector2f>>> &regionsBnds,
+              std::vector<TriData> &triData,
+              const TriangulateFn &triangulateFn = TriangulateFn(),
+              const ParallelForFn &parallelFor = ParallelForFn(),
+              const TriDataTriangulateFn &triDataTriangulateFn = TriDataTriangulateFn());
+// Boundaries of the components of the region S (non-zero pixels) and points inside of its holes. Pixels
+// outside of S are treated as background, so S does not need to be padded.
 void findRegionBoundary(const Imguc &S, std::vector<std::vector<Eigen::Vector2f>> &bnds, std::vector<Eigen::Vector2f> &holePts);
 void outlineToRegion(const Imguc &Io, Imguc &Ir);
 void regionToOutline(Imguc &Ir, Imguc &Io, bool keepSingleRegion = true, bool addBoundaryToRegion = false);
@@ -8,6 +8,8 @@
 #ifndef IGL_PARALLEL_FOR_H
 #define IGL_PARALLEL_FOR_H
 #include "igl_inline.h"
+#include <atomic>
+#include <cstddef>
 #include <functional>
 
 //#warning "Defining IGL_PARALLEL_FOR_FORCE_SERIAL"
@@ -15,6 +17,19 @@
 
 namespace igl
 {
+  // Number of threads used by parallel_for, 0 (default) for the hardware
+  // concurrency and 1 for serial loops. Can be changed at any time.
+  inline std::atomic<size_t> & parallel_for_num_threads()
+  {
+    static std::atomic<size_t> n(0);
+    return n;
+  }
+  // Loops shorter than this run serially regardless of min_parallel {0}.
+  inline std::atomic<size_t> & parallel_for_min_loop_size()
+  {
+    static std::atomic<size_t> n(0);
+    return n;
+  }
   // PARALLEL_FOR Functional implementation of a basic, open-mp style, parallel
   // for loop. If the inner block of a for-loop can be rewritten/encapsulated in
   // a single (anonymous/lambda) function call `func` so that the serial code
@@ -126,13 +141,15 @@ inline bool igl::parallel_for(
   // Estimate number of threads in the pool
   // http://ideone.com/Z7zldb
   const static size_t sthc = std::thread::hardware_concurrency();
+  const size_t requested = parallel_for_num_threads();
+  const size_t min_size = std::max(min_parallel, (size_t)parallel_for_min_loop_size());
   const size_t nthreads = 
 #ifdef IGL_PARALLEL_FOR_FORCE_SERIAL
     0;
 #else
-    loop_size<min_parallel?0:(sthc==0?8:sthc);
+    (size_t)loop_size<min_size?0:(requested>0?requested:(sthc==0?8:sthc));
 #endif
-  if(nthreads==0)
+  if(nthreads<=1)
   {
     // serial
     prep_func(1);
@@ -4,6 +4,8 @@
 #include "def3d.h"
 #include "mesh3d.h"
 #include <unordered_set>
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <vector>
 
@@ -20,49 +22,186 @@ Def3D::~Def3D()
 
 void Def3D::updatePtsAccordingToCPs(Mesh3D &inMesh)
 {
-  for(const auto &it : cps) {
-    const CP &cp = *it.second;
-    inMesh.VCurr.row(cp.ptId) = cp.pos;
-//      p.weight = cp.weight;
-//      p.fixed = cp.fixed;
+  const vector<int> &ptIds = cps.getPtIds();
+  const vector<Vector3d> &pos = cps.getPos();
+  fora(i, 0, ptIds.size()) {
+    inMesh.VCurr.row(ptIds[i]) = pos[i];
   }
 }
 
-const Def3D::CP& Def3D::getCP(int index) const
+Def3D::ConstCPRef Def3D::getCP(int index) const
 {
-  const auto &it = cps.find(index);
-  if (it == cps.end()) {
+  const int slot = cps.getSlot(index);
+  if (slot == -1) {
     throw(out_of_range("Def3D::getCP: index (" + to_string(index) + ") not found"));
   }
-  return *it->second;
+  return cps.at(slot);
 }
 
-Def3D::CP& Def3D::getCP(int index)
+Def3D::CPRef Def3D::getCP(int index)
 {
-  return const_cast<CP&>(static_cast<const Def3D&>(*this).getCP(index));
+  const int slot = cps.getSlot(index);
+  if (slot == -1) {
+    throw(out_of_range("Def3D::getCP: index (" + to_string(index) + ") not found"));
+  }
+  return getCPAt(slot);
+}
+
+Def3D::CPRef Def3D::getCPAt(int slot)
+{
+  // the control point may be moved
+  grid.valid = false;
+  return cps.at(slot);
 }
 
-const std::map<int,std::shared_ptr<Def3D::CP>>& Def3D::getCPs() const
+const Def3D::CPs& Def3D::getCPs() const
 {
   return cps;
 }
 
-int Def3D::addCP(CP &cp)
+void Def3D::CPs::add(int id, const CP &cp)
+{
+  slots[id] = ids.size();
+  ids.push_back(id);
+  ptIds.push_back(cp.ptId);
+  pos.push_back(cp.pos);
+  prevPos.push_back(cp.prevPos);
+  fixed.push_back(cp.fixed);
+  weights.push_back(cp.weight);
+}
+
+void Def3D::CPs::insert(int id, const CP &cp)
 {
-  cps[nextId] = make_shared<CP>(cp);
+  const int slot = std::lower_bound(ids.begin(), ids.end(), id) - ids.begin();
+  ids.insert(ids.begin()+slot, id);
+  ptIds.insert(ptIds.begin()+slot, cp.ptId);
+  pos.insert(pos.begin()+slot, cp.pos);
+  prevPos.insert(prevPos.begin()+slot, cp.prevPos);
+  fixed.insert(fixed.begin()+slot, cp.fixed);
+  weights.insert(weights.begin()+slot, cp.weight);
+  fora(i, slot, ids.size()) slots[ids[i]] = i;
+}
+
+void Def3D::CPs::remove(int slot)
+{
+  slots.erase(ids[slot]);
+  ids.erase(ids.begin()+slot);
+  ptIds.erase(ptIds.begin()+slot);
+  pos.erase(pos.begin()+slot);
+  prevPos.erase(prevPos.begin()+slot);
+  fixed.erase(fixed.begin()+slot);
+  weights.erase(weights.begin()+slot);
+  fora(i, slot, ids.size()) slots[ids[i]] = i;
+}
+
+void Def3D::CPs::clear()
+{
+  ids.clear(); ptIds.clear();
+  pos.clear(); prevPos.clear();
+  fixed.clear(); weights.clear();
+  slots.clear();
+}
+
+int Def3D::addCP(const CP &cp)
+{
+  // ids only grow, so appending keeps the slots ordered by ids
+  cps.add(nextId, cp);
+  grid.valid = false;
   nextId++;
   cpChangedNum++;
   return nextId-1;
 }
 
+bool Def3D::restoreCP(int id, const CP &cp)
+{
+  if (id < 0 || cps.getSlot(id) != -1) return false;
+  cps.insert(id, cp);
+  grid.valid = false;
+  nextId = std::max(nextId, id+1);
+  cpChangedNum++;
+  return true;
+}
+
+void Def3D::updateGrid(const Eigen::Matrix4d &M)
+{
+  if (grid.valid && grid.M == M) return;
+  grid.valid = true;
+  grid.M = M;
+
+  const int n = cps.size();
+  grid.proj.resize(n, 3);
+  grid.nonFinite.clear();
+  double xMin = numeric_limits<double>::infinity(), yMin = xMin, xMax = -xMin, yMax = -xMin;
+  fora(i, 0, n) {
+    const Vector3d p = (M * cps.pos[i].homogeneous()).hnormalized();
+    grid.proj.row(i) = p;
+    if (!isfinite(p(0)) || !isfinite(p(1))) continue;
+    xMin = min(xMin, p(0)); xMax = max(xMax, p(0));
+    yMin = min(yMin, p(1)); yMax = max(yMax, p(1));
+  }
+  if (xMin > xMax) {
+    xMin = xMax = yMin = yMax = 0;
+  }
+
+  // about one control point per cell
+  grid.x0 = xMin;
+  grid.y0 = yMin;
+  grid.cellSize = max(max(xMax-xMin, yMax-yMin) / ceil(sqrt(max(n, 1))), 1e-6);
+  grid.w = static_cast<int>((xMax-xMin) / grid.cellSize) + 1;
+  grid.h = static_cast<int>((yMax-yMin) / grid.cellSize) + 1;
+
+  // counting sort of the slots to the cells
+  vector<int> cellIds(n, -1);
+  grid.cellStart.assign(grid.w*grid.h+1, 0);
+  fora(i, 0, n) {
+    const double x = grid.proj(i,0), y = grid.proj(i,1);
+    if (!isfinite(x) || !isfinite(y)) {
+      grid.nonFinite.push_back(i);
+      continue;
+    }
+    const int cx = min(static_cast<int>((x-grid.x0) / grid.cellSize), grid.w-1);
+    const int cy = min(static_cast<int>((y-grid.y0) / grid.cellSize), grid.h-1);
+    cellIds[i] = cy*grid.w + cx;
+    grid.cellStart[cellIds[i]+1]++;
+  }
+  fora(i, 0, grid.w*grid.h) grid.cellStart[i+1] += grid.cellStart[i];
+  grid.cellSlots.resize(n - grid.nonFinite.size());
+  vector<int> fill(grid.cellStart.begin(), grid.cellStart.end()-1);
+  fora(i, 0, n) {
+    if (cellIds[i] != -1) grid.cellSlots[fill[cellIds[i]]++] = i;
+  }
+}
+
+std::vector<int> Def3D::getGridSlots(double x1, double y1, double x2, double y2) const
+{
+  vector<int> slots = grid.nonFinite;
+  if (!(x1 <= x2 && y1 <= y2)) return slots;
+  auto cell = [&](double v, double v0, int size) {
+    const double c = floor((v-v0) / grid.cellSize);
+    return static_cast<int>(max(0.0, min(c, size-1.0)));
+  };
+  // the rectangle does not overlap the grid
+  if (x2 < grid.x0 || y2 < grid.y0 || x1 > grid.x0 + grid.w*grid.cellSize || y1 > grid.y0 + grid.h*grid.cellSize) return slots;
+  const int cx1 = cell(x1, grid.x0, grid.w), cx2 = cell(x2, grid.x0, grid.w);
+  const int cy1 = cell(y1, grid.y0, grid.h), cy2 = cell(y2, grid.y0, grid.h);
+  fora(cy, cy1, cy2+1) {
+    fora(cx, cx1, cx2+1) {
+      const int c = cy*grid.w + cx;
+      slots.insert(slots.end(), grid.cellSlots.begin()+grid.cellStart[c], grid.cellSlots.begin()+grid.cellStart[c+1]);
+    }
+  }
+  // in the order of ids as the control points are stored
+  sort(slots.begin(), slots.end());
+  return slots;
+}
+
 std::vector<int> Def3D::getControlPointsInsideRect(double x1, double y1, double x2, double y2, const Eigen::Matrix4d &M)
 {
+  updateGrid(M);
   vector<int> ids;
-  for(const auto &it : cps) {
-    const CP &cp = *it.second;
-    const int cpId = it.first;
-    const Vector3d p = (M * cp.pos.homogeneous()).hnormalized();
-    if (p(0) >= x1 && p(1) >= y1 && p(0) <= x2 && p(1) <= y2) ids.push_back(cpId);
+  for(int slot : getGridSlots(x1, y1, x2, y2)) {
+    const Vector3d &p = grid.proj.row(slot);
+    if (p(0) >= x1 && p(1) >= y1 && p(0) <= x2 && p(1) <= y2) ids.push_back(cps.ids[slot]);
   }
   return ids;
 }
@@ -73,10 +212,11 @@ int Def3D::getControlPoint(double x, double y, double radius, double depth, bool
   double extDepth = highestDepth ? -numeric_limits<double>::infinity() : numeric_limits<double>::infinity();
   double minDist = numeric_limits<double>::infinity();
   Vector3d pos(x,y,depth);
-  for(const auto &it : cps) {
-    CP &cp = *it.second;
-    const int cpId = it.first;
-    const Vector3d p = (M * cp.pos.homogeneous()).hnormalized();
+  // a control point within the radius is within the radius in the projection plane as well
+  updateGrid(M);
+  for(int slot : getGridSlots(x-radius, y-radius, x+radius, y+radius)) {
+    const int cpId = cps.ids[slot];
+    const Vector3d &p = grid.proj.row(slot);
     double d;
     if (considerDepth) d = (pos-p).norm();
     else d = (pos.head(2)-p.head(2)).norm();
@@ -110,32 +250,69 @@ bool Def3D::addControlPointOnFace(const MatrixXd &V, const MatrixXi &F, double x
     index = -1;
     return false;
   }
+  const VectorXi facePts = F.row(faceId);
+  MatrixXd facePtsProj(facePts.size(), 3);
+  fora(i, 0, facePts.size()) facePtsProj.row(i) = VProj.row(facePts(i));
+  return addControlPointOnProjectedFace(facePts, facePtsProj, x, y, index, M);
+}
+
+bool Def3D::addControlPointOnFace(const MeshPicker &picker, double x, double y, double planarRadius, bool highest, bool reverseDirection, int &index)
+{
+  int ind = getControlPoint(x, y, planarRadius, 0, false, highest, picker.getM());
+  if (ind != -1) {
+    index = ind;
+    return false;
+  }
 
-  const VectorXi &facePts = F.row(faceId);
+  int faceId = picker.getMeshFace(x, y, highest, reverseDirection);
+  if (faceId == -1) {
+    index = -1;
+    return false;
+  }
+  const VectorXi facePts = picker.getFaces().row(faceId);
+  MatrixXd facePtsProj(facePts.size(), 3);
+  fora(i, 0, facePts.size()) facePtsProj.row(i) = picker.getVProj().row(facePts(i));
+  return addControlPointOnProjectedFace(facePts, facePtsProj, x, y, index, picker.getM());
+}
+
+bool Def3D::addControlPointOnFaceId(const MatrixXd &V, const MatrixXi &F, int faceId, double x, double y, int &index, const Eigen::Matrix4d &M)
+{
+  if (faceId < 0 || faceId >= F.rows()) {
+    index = -1;
+    return false;
+  }
+  const VectorXi facePts = F.row(faceId);
+  MatrixXd facePtsProj(facePts.size(), 3);
+  fora(i, 0, facePts.size()) facePtsProj.row(i) = (M * V.row(facePts(i)).transpose().homogeneous()).hnormalized().transpose();
+  return addControlPointOnProjectedFace(facePts, facePtsProj, x, y, index, M);
+}
+
+// Adds a control point to the point of a face nearest to [x,y]. facePtsProj are the points facePts of the
+// face projected by M.
+bool Def3D::addControlPointOnProjectedFace(const VectorXi &facePts, const MatrixXd &facePtsProj, double x, double y, int &index, const Eigen::Matrix4d &M)
+{
   // choose the nearest point of the face
   double min = numeric_limits<double>::infinity();
   Vector2d pos(x,y);
-  int ptId = -1;
+  int ptIndex = -1;
   fora(i, 0, facePts.size()) {
-    const Vector3d &p = VProj.row(facePts(i));
+    const Vector3d &p = facePtsProj.row(i);
     double d = (p.head(2)-pos).norm();
     if (d < min) {
       min = d;
-      ptId = facePts[i];
+      ptIndex = i;
     }
   }
-  ind = ptId;
+  const int ind = facePts(ptIndex);
 
   // check if such control point is associated to a mesh point
-  for(const auto &it : cps) {
-    const int cpId = it.first;
-    const CP &cp = *it.second;
-    if (cp.ptId == ind) {
-      index = cpId;
-      return false;
-    }
+  const vector<int> &ptIds = cps.getPtIds();
+  const auto it = find(ptIds.begin(), ptIds.end(), ind);
+  if (it != ptIds.end()) {
+    index = cps.getIds()[it - ptIds.begin()];
+    return false;
   }
-  double z = VProj(ind,2);
+  double z = facePtsProj(ptIndex,2);
   const Vector3d unproj = (M.inverse() * Vector3d(x,y,z).homogeneous()).hnormalized();
   CP cp(unproj, cpDefaultFixed, cpDefaultWeight);
   cp.prevPos = cp.pos;
@@ -205,11 +382,7 @@ bool Def3D::addControlPointExhaustive(const Eigen::MatrixXd &V, double x, double
   // find the nearest mesh point that is not associated with a control point
   int bestInd = -1;
   int occupiedInd = -1;
-  unordered_set<int> occupiedInds;
-  for(const auto &it : cps) {
-    int ptInd = it.second->ptId;
-    occupiedInds.insert(ptInd);
-  }
+  unordered_set<int> occupiedInds(cps.getPtIds().begin(), cps.getPtIds().end());
   double min = numeric_limits<double>::infinity();
   fora(ind, 0, nPts) {
     const Vector3d &p = V.row(ind);
@@ -243,9 +416,10 @@ bool Def3D::addControlPointExhaustive(const Eigen::MatrixXd &V, double x, double
 
 bool Def3D::removeControlPoint(int index)
 {
-  const auto &it = cps.find(index);
-  if (it == cps.end()) return false;
-  cps.erase(it);
+  const int slot = cps.getSlot(index);
+  if (slot == -1) return false;
+  cps.remove(slot);
+  grid.valid = false;
   cpChangedNum++;
   return true;
 }
@@ -264,6 +438,7 @@ bool Def3D::removeLastControlPoint()
 void Def3D::removeControlPoints()
 {
   cps.clear();
+  grid.valid = false;
   cpChangedNum++;
 }
 
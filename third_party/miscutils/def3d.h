@@ -5,9 +5,12 @@
 #define DEF3D_H
 
 #include "mesh3d.h"
+#include "meshpicker.h"
 #include <memory>
 #include <limits>
 #include <map>
+#include <unordered_map>
+#include <vector>
 #include <Eigen/Dense>
 #include <miscutils/macros.h>
 
@@ -26,19 +29,88 @@ public:
     CP() : CP(Eigen::Vector3d(0,0,0), false, 1) {}
   };
 
+  // References to the data of a control point stored in CPs, valid until a control point is added or removed.
+  template<typename V, typename B, typename D, typename I>
+  struct CPRefT
+  {
+    V &pos, &prevPos;
+    B &fixed;
+    D &weight;
+    I &ptId;
+  };
+  typedef CPRefT<Eigen::Vector3d, char, double, int> CPRef;
+  typedef CPRefT<const Eigen::Vector3d, const char, const double, const int> ConstCPRef;
+
+  // Control points stored as arrays of their attributes (one entry per slot) in the order of their ids
+  // with a map from ids to slots. Iterating yields pairs (id, ConstCPRef).
+  class CPs
+  {
+  public:
+    class const_iterator
+    {
+    public:
+      const_iterator(const CPs *cps, int slot) : cps(cps), slot(slot) {}
+      std::pair<int, ConstCPRef> operator*() const { return std::make_pair(cps->ids[slot], cps->at(slot)); }
+      const_iterator& operator++() { slot++; return *this; }
+      bool operator==(const const_iterator &other) const { return slot == other.slot; }
+      bool operator!=(const const_iterator &other) const { return slot != other.slot; }
+    private:
+      const CPs *cps;
+      int slot;
+    };
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, ids.size()); }
+    const_iterator find(int id) const { const int slot = getSlot(id); return slot == -1 ? end() : const_iterator(this, slot); }
+    size_t size() const { return ids.size(); }
+    bool empty() const { return ids.empty(); }
+    // slot of the control point id or -1
+    int getSlot(int id) const { const auto it = slots.find(id); return it == slots.end() ? -1 : it->second; }
+    ConstCPRef at(int slot) const { return ConstCPRef{pos[slot], prevPos[slot], fixed[slot], weights[slot], ptIds[slot]}; }
+
+    const std::vector<int> &getIds() const { return ids; }
+    const std::vector<int> &getPtIds() const { return ptIds; }
+    const std::vector<Eigen::Vector3d> &getPos() const { return pos; }
+    const std::vector<Eigen::Vector3d> &getPrevPos() const { return prevPos; }
+
+  private:
+    friend class Def3D;
+    CPRef at(int slot) { return CPRef{pos[slot], prevPos[slot], fixed[slot], weights[slot], ptIds[slot]}; }
+    void add(int id, const CP &cp);
+    // adds a control point at the slot its id belongs to
+    void insert(int id, const CP &cp);
+    void remove(int slot);
+    void clear();
+
+    std::vector<int> ids, ptIds;
+    std::vector<Eigen::Vector3d> pos, prevPos;
+    std::vector<char> fixed;
+    std::vector<double> weights;
+    std::unordered_map<int,int> slots;
+  };
+
   Def3D();
   virtual ~Def3D();
 
   void updatePtsAccordingToCPs(Mesh3D &inMesh);
 
-  const CP& getCP(int index) const;
-  CP& getCP(int index);
-  const std::map<int, std::shared_ptr<CP> > &getCPs() const;
-  int addCP(CP &cp);
+  // throw out_of_range if there is no control point index
+  ConstCPRef getCP(int index) const;
+  CPRef getCP(int index);
+  // the control point in the slot of getCPs(), for loops over many control points without the lookups
+  CPRef getCPAt(int slot);
+  const CPs &getCPs() const;
+  int addCP(const CP &cp);
+  // adds a control point under an id it had before, e.g. to undo its removal, false if the id is in use
+  bool restoreCP(int id, const CP &cp);
   int getControlPoint(double x, double y, double radius, double depth, bool considerDepth, bool highestDepth, const Eigen::Matrix4d &M = Eigen::Matrix4d::Identity());
   std::vector<int> getControlPointsInsideRect(double x1, double y1, double x2, double y2, const Eigen::Matrix4d &M = Eigen::Matrix4d::Identity());
   bool addControlPointOnFace(const Eigen::MatrixXd &V, const Eigen::MatrixXi &F, double x, double y, double planarRadius, bool highest, bool reverseDirection, int &index, const Eigen::Matrix4d &M = Eigen::Matrix4d::Identity());
   bool addControlPointOnFace(const Eigen::MatrixXd &V, const Eigen::MatrixXi &F, double x, double y, double planarRadius, bool highest, bool reverseDirection);
+  // same as above for the mesh, faces and projection of the picker
+  bool addControlPointOnFace(const MeshPicker &picker, double x, double y, double planarRadius, bool highest, bool reverseDirection, int &index);
+  // same as above for a face already picked, e.g. from an ID buffer
+  bool addControlPointOnFaceId(const Eigen::MatrixXd &V, const Eigen::MatrixXi &F, int faceId, double x, double y, int &index, const Eigen::Matrix4d &M = Eigen::Matrix4d::Identity());
   bool addControlPoint(const Eigen::MatrixXd &V, double x, double y, double planarRadius, bool highest, int &index, const Eigen::MatrixXd &M = Eigen::Matrix4d::Identity());
   bool addControlPoint(const Eigen::MatrixXd &V, double x, double y, double radius, double depth = 0.0, bool considerDepth = true);
   bool addControlPoint(const Eigen::MatrixXd &V, double x, double y, double radius, double depth, int &index, bool considerDepth = true);
@@ -53,7 +125,27 @@ public:
   bool cpDefaultFixed = true; // default behavior of control points for control points created by addControlPoint... functions
 
 protected:
-  std::map<int,std::shared_ptr<CP>> cps;
+  bool addControlPointOnProjectedFace(const Eigen::VectorXi &facePts, const Eigen::MatrixXd &facePtsProj, double x, double y, int &index, const Eigen::Matrix4d &M);
+
+  // 2D grid of the control points projected by M, rebuilt lazily by the queries when the control points
+  // or M change. Slots of the cell i are cellSlots[cellStart[i]..cellStart[i+1]).
+  struct CPGrid
+  {
+    bool valid = false;
+    Eigen::Matrix4d M;
+    Eigen::MatrixXd proj; // projected control points, one row per slot
+    double x0 = 0, y0 = 0, cellSize = 1;
+    int w = 0, h = 0;
+    std::vector<int> cellStart, cellSlots;
+    std::vector<int> nonFinite; // slots projected outside of any cell
+  };
+
+  void updateGrid(const Eigen::Matrix4d &M);
+  // slots of the control points in the cells overlapping the rectangle, sorted
+  std::vector<int> getGridSlots(double x1, double y1, double x2, double y2) const;
+
+  CPs cps;
+  CPGrid grid;
   long cpChangedNum = 0;
   int nextId = 0;
 };
@@ -33,43 +33,46 @@ void Mesh3D::loadMesh(const std::string &fn)
 }
 
 // Works for triangular faces only.
-int Mesh3D::getMeshFace(const MatrixXd &V, const MatrixXi &F, double x, double y, bool highestZ, bool reverseDirection, double &w1, double &w2, double &w3)
+bool Mesh3D::isInsideFace(const MatrixXd &V, const MatrixXi &F, int faceId, double x, double y, bool reverseDirection, double &w1, double &w2, double &w3, double &z)
 {
   auto edgeFunction = [](const Vector3d &a, const Vector3d &b, const Vector3d &c)->double
   { return (c(0) - a(0)) * (b(1) - a(1)) - (c(1) - a(1)) * (b(0) - a(0)); };
 
   Vector3d pos(x,y,0);
+  double *ws[] = {&w1, &w2, &w3};
+  double area = 0;
+  z = 0;
+  const int n = F.cols();
+  fora(j, 0, n) {
+    int ptIdFrom = F(faceId,j);
+    int ptIdTo = F(faceId,(j+1)%n);
+    int ptIdOpposite = F(faceId,(j+2)%n); // only for triangular faces!
+    const Vector3d &pFrom = V.row(ptIdFrom);
+    const Vector3d &pTo = V.row(ptIdTo);
+    const Vector3d &pOpposite = V.row(ptIdOpposite);
+    double &w = *ws[j];
+    w = edgeFunction(pFrom, pTo, pos);
+    if (reverseDirection) w *= -1;
+    if (w < 0) return false;
+    z += w * pOpposite(2);
+    area += w;
+  }
+  z /= area;
+  return true;
+}
+
+// Works for triangular faces only.
+int Mesh3D::getMeshFace(const MatrixXd &V, const MatrixXi &F, double x, double y, bool highestZ, bool reverseDirection, double &w1, double &w2, double &w3)
+{
   double extZ = highestZ ? -numeric_limits<double>::infinity() : numeric_limits<double>::infinity();
   int ind = -1;
-  vector<double*> ws{&w1, &w2, &w3};
   fora(i, 0, F.rows()) {
-    const VectorXi &f = F.row(i);
-    bool inside = true;
-    double area = 0;
-    double z = 0;
-    fora(j, 0, f.size()) {
-      int ptIdFrom = f(j);
-      int ptIdTo = f((j+1)%f.size());
-      int ptIdOpposite = f((j+2)%f.size()); // only for triangular faces!
-      const Vector3d &pFrom = V.row(ptIdFrom);
-      const Vector3d &pTo = V.row(ptIdTo);
-      const Vector3d &pOpposite = V.row(ptIdOpposite);
-      double &w = *ws[j];
-      w = edgeFunction(pFrom, pTo, pos);
-      if (reverseDirection) w *= -1;
-      if (w < 0) {
-        inside = false;
-        break;
-      }
-      z += w * pOpposite(2);
-      area += w;
-    }
-
-    if (inside) {
-      z /= area;
+    double v1, v2, v3, z;
+    if (isInsideFace(V, F, i, x, y, reverseDirection, v1, v2, v3, z)) {
       if (highestZ ? z>extZ : z<extZ) {
         extZ = z;
         ind = i;
+        w1 = v1; w2 = v2; w3 = v3;
       }
     }
   }
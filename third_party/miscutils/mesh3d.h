@@ -6,6 +6,10 @@
 
 #include <Eigen/Dense>
 
+// Per-vertex data (positions, normals) interleaved in single precision, the layout of the GPU buffers and of
+// the exported glTF accessors, so that they are filled by a plain copy.
+typedef Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> MatrixX3fR;
+
 class Mesh3D
 {
 public:
@@ -19,6 +23,9 @@ public:
   static int getMeshPoint(const Eigen::MatrixXd &V, double x, double y, double planarRadius, bool highest);
   static int getMeshFace(const Eigen::MatrixXd &V, const Eigen::MatrixXi &F, double x, double y, bool highestZ, bool reverseDirection);
   static int getMeshFace(const Eigen::MatrixXd &V, const Eigen::MatrixXi &F, double x, double y, bool highestZ, bool reverseDirection, double &w1, double &w2, double &w3);
+  // Tests if [x,y] lies inside of the projection of the triangle faceId, returns its barycentric coordinates
+  // (not normalized) and the interpolated z-coordinate.
+  static bool isInsideFace(const Eigen::MatrixXd &V, const Eigen::MatrixXi &F, int faceId, double x, double y, bool reverseDirection, double &w1, double &w2, double &w3, double &z);
 
   int getNumPoints() const;
   int getNumFaces() const;
@@ -0,0 +1,144 @@
+// Copyright (c) 2018 Marek Dvoroznak
+// Licensed under the MIT License.
+
+#include "meshpicker.h"
+#include "mesh3d.h"
+#include <miscutils/macros.h>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+using namespace std;
+using namespace Eigen;
+
+static const int maxLeafSize = 4;
+
+void MeshBVH2D::build(const MatrixXd &V, const MatrixXi &F)
+{
+  nodes.clear();
+  faceIds.resize(F.rows());
+  fora(i, 0, F.rows()) faceIds[i] = i;
+  if (F.rows() == 0) return;
+  MatrixXd centroids = MatrixXd::Zero(F.rows(), 2);
+  fora(i, 0, F.rows()) {
+    fora(j, 0, F.cols()) centroids.row(i) += V.row(F(i,j)).head(2);
+  }
+  centroids /= F.cols();
+  nodes.reserve(2 * F.rows() / maxLeafSize + 1);
+  buildNode(centroids, 0, F.rows());
+  refit(V, F);
+}
+
+// Splits the faces at the median of the centroids along the longer side of their bounding box.
+int MeshBVH2D::buildNode(const MatrixXd &centroids, int begin, int end)
+{
+  const int id = nodes.size();
+  nodes.emplace_back();
+  nodes[id].begin = begin;
+  nodes[id].end = end;
+  if (end - begin <= maxLeafSize) return id;
+
+  AlignedBox2d box;
+  fora(i, begin, end) box.extend(Vector2d(centroids.row(faceIds[i])));
+  const Vector2d size = box.sizes();
+  const int axis = size(0) >= size(1) ? 0 : 1;
+  const int mid = (begin + end) / 2;
+  nth_element(faceIds.begin() + begin, faceIds.begin() + mid, faceIds.begin() + end,
+              [&](int a, int b) { return centroids(a,axis) < centroids(b,axis); });
+  const int left = buildNode(centroids, begin, mid);
+  const int right = buildNode(centroids, mid, end);
+  nodes[id].left = left;
+  nodes[id].right = right;
+  return id;
+}
+
+void MeshBVH2D::fitLeaf(Node &node, const MatrixXd &V, const MatrixXi &F)
+{
+  node.box.setEmpty();
+  fora(i, node.begin, node.end) {
+    fora(j, 0, F.cols()) node.box.extend(Vector2d(V.row(F(faceIds[i],j)).head(2)));
+  }
+}
+
+void MeshBVH2D::refit(const MatrixXd &V, const MatrixXi &F)
+{
+  // children are after their parents, so going backwards fits them first
+  for (int i = nodes.size()-1; i >= 0; i--) {
+    Node &node = nodes[i];
+    if (node.left == -1) fitLeaf(node, V, F);
+    else node.box = nodes[node.left].box.merged(nodes[node.right].box);
+  }
+}
+
+int MeshBVH2D::getMeshFace(const MatrixXd &V, const MatrixXi &F, double x, double y, bool highestZ, bool reverseDirection, double &w1, double &w2, double &w3) const
+{
+  double extZ = highestZ ? -numeric_limits<double>::infinity() : numeric_limits<double>::infinity();
+  int ind = -1;
+  if (nodes.empty()) return ind;
+  const Vector2d pos(x,y);
+  vector<int> stack{0};
+  while (!stack.empty()) {
+    const Node &node = nodes[stack.back()];
+    stack.pop_back();
+    if (!node.box.contains(pos)) continue;
+    if (node.left != -1) {
+      stack.push_back(node.left);
+      stack.push_back(node.right);
+      continue;
+    }
+    fora(i, node.begin, node.end) {
+      const int faceId = faceIds[i];
+      double v1, v2, v3, z;
+      if (!Mesh3D::isInsideFace(V, F, faceId, x, y, reverseDirection, v1, v2, v3, z)) continue;
+      // ties are resolved to the lowest face id as in the linear search
+      if ((highestZ ? z>extZ : z<extZ) || (z == extZ && faceId < ind)) {
+        extZ = z;
+        ind = faceId;
+        w1 = v1; w2 = v2; w3 = v3;
+      }
+    }
+  }
+  return ind;
+}
+
+void MeshPicker::update(const MatrixXd &V, const MatrixXi &F, const Matrix4d &M, std::uint64_t version)
+{
+  const bool facesChanged = !(F.rows() == this->F.rows() && F.cols() == this->F.cols() &&
+                              memcmp(F.data(), this->F.data(), F.size() * sizeof(int)) == 0);
+  if (!facesChanged && version == this->version && M == this->M && V.rows() == VProj.rows()) return;
+  this->version = version;
+  this->M = M;
+  VProj = (V.rowwise().homogeneous() * M.transpose()).rowwise().hnormalized();
+  if (facesChanged) {
+    this->F = F;
+    bvh.build(VProj, F);
+  } else {
+    bvh.refit(VProj, F);
+  }
+}
+
+int MeshPicker::getMeshFace(double x, double y, bool highestZ, bool reverseDirection, double &w1, double &w2, double &w3) const
+{
+  return bvh.getMeshFace(VProj, F, x, y, highestZ, reverseDirection, w1, w2, w3);
+}
+
+int MeshPicker::getMeshFace(double x, double y, bool highestZ, bool reverseDirection) const
+{
+  double w1, w2, w3;
+  return getMeshFace(x, y, highestZ, reverseDirection, w1, w2, w3);
+}
+
+const MatrixXd &MeshPicker::getVProj() const
+{
+  return VProj;
+}
+
+const MatrixXi &MeshPicker::getFaces() const
+{
+  return F;
+}
+
+const Matrix4d &MeshPicker::getM() const
+{
+  return M;
+}
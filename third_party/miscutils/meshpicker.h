@@ -0,0 +1,56 @@
+// Copyright (c) 2018 Marek Dvoroznak
+// Licensed under the MIT License.
+
+#ifndef MESHPICKER_H
+#define MESHPICKER_H
+
+#include <Eigen/Dense>
+#include <cstdint>
+#include <vector>
+
+// Bounding volume hierarchy over the planar projections (x,y) of the triangles of a mesh. The tree is built
+// once for a set of faces, when the vertices move only the bounding boxes are refit.
+class MeshBVH2D
+{
+public:
+  void build(const Eigen::MatrixXd &V, const Eigen::MatrixXi &F);
+  void refit(const Eigen::MatrixXd &V, const Eigen::MatrixXi &F);
+  // Same as Mesh3D::getMeshFace for the V and F of the last build or refit.
+  int getMeshFace(const Eigen::MatrixXd &V, const Eigen::MatrixXi &F, double x, double y, bool highestZ, bool reverseDirection, double &w1, double &w2, double &w3) const;
+
+private:
+  struct Node
+  {
+    Eigen::AlignedBox2d box;
+    int left = -1, right = -1; // children, -1 for leaves
+    int begin = 0, end = 0;    // range of faceIds of leaves
+  };
+  int buildNode(const Eigen::MatrixXd &centroids, int begin, int end);
+  void fitLeaf(Node &node, const Eigen::MatrixXd &V, const Eigen::MatrixXi &F);
+
+  std::vector<Node> nodes; // children are stored after their parents
+  std::vector<int> faceIds;
+};
+
+// Copy of a mesh projected by M with a MeshBVH2D over it for picking faces in screen space. The vertices
+// are projected again and the tree refit only when the version of the mesh or M change, the tree is rebuilt
+// only when the faces change.
+class MeshPicker
+{
+public:
+  void update(const Eigen::MatrixXd &V, const Eigen::MatrixXi &F, const Eigen::Matrix4d &M, std::uint64_t version);
+  int getMeshFace(double x, double y, bool highestZ, bool reverseDirection) const;
+  int getMeshFace(double x, double y, bool highestZ, bool reverseDirection, double &w1, double &w2, double &w3) const;
+  const Eigen::MatrixXd &getVProj() const;
+  const Eigen::MatrixXi &getFaces() const;
+  const Eigen::Matrix4d &getM() const;
+
+private:
+  Eigen::MatrixXd VProj;
+  Eigen::MatrixXi F;
+  Eigen::Matrix4d M = Eigen::Matrix4d::Zero();
+  std::uint64_t version = UINT64_MAX;
+  MeshBVH2D bvh;
+};
+
+#endif // MESHPICKER_H
@@ -1,3 +1,4 @@
+#include <cstring>
 #include <iostream>
 #include "opengltools.h"
 #include <miscutils/fsutils.h>
@@ -16,54 +17,86 @@ void GLMeshInitBuffers(GLMeshData &data)
   glGenBuffers(1, &data.VBO_C);
   glGenBuffers(1, &data.VBO_PARTID);
   glGenBuffers(1, &data.VBO_F);
+  // the new buffers are empty
+  data.F_uploaded.resize(0,0); data.T_uploaded.resize(0,0); data.C_uploaded.resize(0,0); data.PARTID_uploaded.resize(0,0);
+  data.bytesV = data.bytesN = data.bytesT = data.bytesC = data.bytesPARTID = data.bytesF = 0;
+  fora(i, 0, MESH_ATTRIB_COUNT) data.attribSize[i] = 0;
 }
 
-void GLMeshFillBuffers(GLuint program, GLMeshData &data, const MatrixXd &V, const MatrixXi &F, const MatrixXd &N, const MatrixXd &T, const MatrixXd &C, const MatrixXi &PARTID)
+// Uploads the data to the bound buffer, in place if the size of the buffer did not change.
+static void uploadBuffer(GLenum target, const void *data, GLsizeiptr bytes, GLsizeiptr &bufferBytes, GLenum usage)
 {
-  // convert input matrices for usage in OpenGL
-  data.V_converted = V.cast<float>();
-  data.F_converted = F.cast<unsigned int>();
-  data.N_converted = N.cast<float>();
-  data.T_converted = T.cast<float>();
-  data.C_converted = C.cast<float>();
-  data.PARTID_converted = PARTID.cast<int>();
-
-  // fill buffers
-  glBindVertexArrayOES(data.VAO);
-  // position
-  GLint id;
-  glBindBuffer(GL_ARRAY_BUFFER, data.VBO_V);
-  glBufferData(GL_ARRAY_BUFFER, data.V_converted.size() * sizeof(float), data.V_converted.data(), GL_DYNAMIC_DRAW);
-  id = glGetAttribLocation(program, "position");
-  glVertexAttribPointer(id, data.V_converted.cols(), GL_FLOAT, GL_FALSE, 0, 0);
-  glEnableVertexAttribArray(id);
-  // normal
-  if (N.size() > 0) {
-    glBindBuffer(GL_ARRAY_BUFFER, data.VBO_N);
-    glBufferData(GL_ARRAY_BUFFER, data.N_converted.size() * sizeof(float), data.N_converted.data(), GL_DYNAMIC_DRAW);
-    id = glGetAttribLocation(program, "normal");
-    glVertexAttribPointer(id, data.N_converted.cols(), GL_FLOAT, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(id);
+  if (bytes == bufferBytes) glBufferSubData(target, 0, bytes, data);
+  else {
+    glBufferData(target, bytes, data, usage);
+    bufferBytes = bytes;
   }
-  // texture coords
-  if (T.size() > 0) {
-    glBindBuffer(GL_ARRAY_BUFFER, data.VBO_T);
-    glBufferData(GL_ARRAY_BUFFER, data.T_converted.size() * sizeof(float), data.T_converted.data(), GL_DYNAMIC_DRAW);
-    id = glGetAttribLocation(program, "texCoord");
-    glVertexAttribPointer(id, data.T_converted.cols(), GL_FLOAT, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(id);
+}
+
+// Returns true and stores M to uploaded if M differs from it.
+template<typename Derived>
+static bool changedSinceUpload(const Eigen::PlainObjectBase<Derived> &M, Eigen::PlainObjectBase<Derived> &uploaded)
+{
+  if (M.rows() == uploaded.rows() && M.cols() == uploaded.cols() &&
+      memcmp(M.data(), uploaded.data(), M.size() * sizeof(typename Derived::Scalar)) == 0) return false;
+  uploaded = M;
+  return true;
+}
+
+// V and N are row-major float matrices ready for the upload
+template<typename MatrixVf>
+static void fillBuffers(GLMeshData &data, const MatrixVf &V, const MatrixXi &F, const MatrixVf &N, const MatrixXd &T, const MatrixXd &C, const MatrixXi &PARTID, bool dynamicChanged)
+{
+  // convert the static input matrices for usage in OpenGL only if they changed
+  const bool changedF = changedSinceUpload(F, data.F_uploaded);
+  const bool changedT = changedSinceUpload(T, data.T_uploaded);
+  const bool changedC = changedSinceUpload(C, data.C_uploaded);
+  if (changedF) data.F_converted = F.cast<unsigned int>();
+  if (changedT) data.T_converted = T.cast<float>();
+  if (changedC) data.C_converted = C.cast<float>();
+  const bool changedPARTID = changedSinceUpload(PARTID, data.PARTID_uploaded);
+  if (changedPARTID) data.PARTID_converted = PARTID.cast<float>();
+
+  // fill buffers, the attribute pointers are stored in the VAO and specified again only if the number of
+  // components changes, the buffers keep their names when they are reallocated
+  glBindVertexArrayOES(data.VAO);
+  auto fillAttrib = [&](int attrib, GLuint VBO, const float *X, int rows, int cols, bool changed, GLsizeiptr &bytes, GLenum usage) {
+    if (rows == 0) return;
+    const bool specify = data.attribSize[attrib] != cols;
+    if (!changed && !specify) return;
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    if (changed) uploadBuffer(GL_ARRAY_BUFFER, X, rows * cols * sizeof(float), bytes, usage);
+    if (specify) {
+      glVertexAttribPointer(attrib, cols, GL_FLOAT, GL_FALSE, 0, 0);
+      glEnableVertexAttribArray(attrib);
+      data.attribSize[attrib] = cols;
+    }
+  };
+  fillAttrib(MESH_ATTRIB_POSITION, data.VBO_V, V.data(), V.rows(), V.cols(), dynamicChanged, data.bytesV, GL_DYNAMIC_DRAW);
+  fillAttrib(MESH_ATTRIB_NORMAL, data.VBO_N, N.data(), N.rows(), N.cols(), dynamicChanged, data.bytesN, GL_DYNAMIC_DRAW);
+  fillAttrib(MESH_ATTRIB_TEXCOORD, data.VBO_T, data.T_converted.data(), data.T_converted.rows(), data.T_converted.cols(), changedT, data.bytesT, GL_STATIC_DRAW);
+  fillAttrib(MESH_ATTRIB_COLOR, data.VBO_C, data.C_converted.data(), data.C_converted.rows(), data.C_converted.cols(), changedC, data.bytesC, GL_STATIC_DRAW);
+  fillAttrib(MESH_ATTRIB_PARTID, data.VBO_PARTID, data.PARTID_converted.data(), data.PARTID_converted.rows(), data.PARTID_converted.cols(), changedPARTID, data.bytesPARTID, GL_STATIC_DRAW);
+  // faces, the element buffer binding is part of the VAO as well
+  if (changedF) {
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, data.VBO_F);
+    uploadBuffer(GL_ELEMENT_ARRAY_BUFFER, data.F_converted.data(), data.F_converted.size() * sizeof(unsigned int), data.bytesF, GL_STATIC_DRAW);
   }
-  // color
-  if (C.size() > 0) {
-    glBindBuffer(GL_ARRAY_BUFFER, data.VBO_C);
-    glBufferData(GL_ARRAY_BUFFER, data.C_converted.size() * sizeof(float), data.C_converted.data(), GL_DYNAMIC_DRAW);
-    id = glGetAttribLocation(program, "color");
-    glVertexAttribPointer(id, data.C_converted.cols(), GL_FLOAT, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(id);
+}
+
+void GLMeshFillBuffers(GLMeshData &data, const MatrixXd &V, const MatrixXi &F, const MatrixXd &N, const MatrixXd &T, const MatrixXd &C, const MatrixXi &PARTID, bool dynamicChanged)
+{
+  // convert the dynamic input matrices for usage in OpenGL
+  if (dynamicChanged) {
+    data.V_converted = V.cast<float>();
+    data.N_converted = N.cast<float>();
   }
-  // faces
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, data.VBO_F);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, data.F_converted.size() * sizeof(unsigned int), data.F_converted.data(), GL_DYNAMIC_DRAW);
+  fillBuffers(data, data.V_converted, F, data.N_converted, T, C, PARTID, dynamicChanged);
+}
+
+void GLMeshFillBuffers(GLMeshData &data, const MatrixX3fR &V, const MatrixXi &F, const MatrixX3fR &N, const MatrixXd &T, const MatrixXd &C, const MatrixXi &PARTID, bool dynamicChanged)
+{
+  fillBuffers(data, V, F, N, T, C, PARTID, dynamicChanged);
 }
 
 void GLMeshDestroyBuffers(GLMeshData &data)
@@ -99,12 +132,21 @@ void rasterizeGPUClear()
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 }
 
-void uploadCameraMatrices(GLuint shader, const Eigen::Matrix4d &P, const Eigen::Matrix4d &M, const Eigen::Matrix4d &normalMatrix)
+GLCameraUniforms getCameraUniforms(GLuint shader)
+{
+  GLCameraUniforms uniforms;
+  uniforms.view = glGetUniformLocation(shader, "view");
+  uniforms.proj = glGetUniformLocation(shader, "proj");
+  uniforms.normalMatrix = glGetUniformLocation(shader, "normalMatrix");
+  return uniforms;
+}
+
+void uploadCameraMatrices(GLuint shader, const GLCameraUniforms &uniforms, const Eigen::Matrix4d &P, const Eigen::Matrix4d &M, const Eigen::Matrix4d &normalMatrix)
 {
   glUseProgram(shader);
-  glUniform(glGetUniformLocation(shader, "view"), M.cast<float>());
-  glUniform(glGetUniformLocation(shader, "proj"), P.cast<float>());
-  glUniform(glGetUniformLocation(shader, "normalMatrix"), normalMatrix.cast<float>());
+  glUniform(uniforms.view, M.cast<float>());
+  glUniform(uniforms.proj, P.cast<float>());
+  glUniform(uniforms.normalMatrix, normalMatrix.cast<float>());
 }
 
 GLuint loadShaders(const char *vertexShaderSrc, const char *fragmentShaderSrc){
@@ -137,6 +179,12 @@ GLuint loadShaders(const char *vertexShaderSrc, const char *fragmentShaderSrc){
   GLuint program = glCreateProgram();
   glAttachShader(program, vertexShader);
   glAttachShader(program, fragmentShader);
+  // fixed locations of the mesh attributes, see GLMeshAttrib
+  glBindAttribLocation(program, MESH_ATTRIB_POSITION, "position");
+  glBindAttribLocation(program, MESH_ATTRIB_NORMAL, "normal");
+  glBindAttribLocation(program, MESH_ATTRIB_TEXCOORD, "texCoord");
+  glBindAttribLocation(program, MESH_ATTRIB_COLOR, "color");
+  glBindAttribLocation(program, MESH_ATTRIB_PARTID, "partId");
   glLinkProgram(program);
   GLint res = GL_FALSE;
   int length;
@@ -212,18 +260,21 @@ void loadTextureToGPU(const Imguc &I, GLuint &textureName)
     return;
   }
 
-  Imguc I2(I.w, I.h, 4, 3);;
-  if (I.ch == 3) {
-    // convert RGB to RGBA
-    fora(y, 0, I.h) fora(x, 0, I.w) {
-      fora(i, 0, 3) I2(x,y,i) = I(x,y,i);
-      I2(x,y,3) = 255;
-    }
-  } else {
-    I2 = I;
+  if (I.ch == 4) {
+    // uploaded as is, without a copy
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, I.w, I.h, 0, GL_RGBA, GL_UNSIGNED_BYTE, I.data);
+    return;
   }
 
-  if (!I2.isNull()) {
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, I2.w, I2.h, 0, GL_RGBA, GL_UNSIGNED_BYTE, I2.data);
+  // convert to RGBA
+  Imguc I2(I.w, I.h, 4, 3);
+  const int n = I.w*I.h;
+  const unsigned char *src = I.data;
+  unsigned char *dst = I2.data;
+  fora(i, 0, n) {
+    fora(c, 0, 3) dst[4*i+c] = src[I.ch*i+c];
+    dst[4*i+3] = 255;
   }
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, I2.w, I2.h, 0, GL_RGBA, GL_UNSIGNED_BYTE, I2.data);
+}
 }
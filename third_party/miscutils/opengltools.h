@@ -4,25 +4,52 @@
 #include <deque>
 #include <Eigen/Dense>
 #include <image/image.h>
+#include "mesh3d.h"
 #define GL_GLEXT_PROTOTYPES 1
 #include <SDL_opengles2.h>
 
+// Attribute locations bound by loadShaders in every program, so that the vertex array object of a mesh is
+// specified once and works with any of them.
+enum GLMeshAttrib { MESH_ATTRIB_POSITION = 0, MESH_ATTRIB_NORMAL, MESH_ATTRIB_TEXCOORD, MESH_ATTRIB_COLOR, MESH_ATTRIB_PARTID, MESH_ATTRIB_COUNT };
+
 struct GLMeshData
 {
   GLuint VAO, VBO_V, VBO_N, VBO_T, VBO_C, VBO_PARTID, VBO_F;
   // matrices converted for usage in OpenGL
   Eigen::Matrix<float,Eigen::Dynamic,Eigen::Dynamic,Eigen::RowMajor> V_converted, N_converted, T_converted, C_converted;
-  Eigen::Matrix<int,Eigen::Dynamic,Eigen::Dynamic,Eigen::RowMajor> PARTID_converted;
+  // float, OpenGL ES 2.0 has no integer attributes
+  Eigen::Matrix<float,Eigen::Dynamic,Eigen::Dynamic,Eigen::RowMajor> PARTID_converted;
   Eigen::Matrix<unsigned int,Eigen::Dynamic,Eigen::Dynamic,Eigen::RowMajor> F_converted;
+  // inputs of the static attributes (F, T, C, PARTID) as last uploaded, they are uploaded again only if they change
+  Eigen::MatrixXi F_uploaded, PARTID_uploaded;
+  Eigen::MatrixXd T_uploaded, C_uploaded;
+  // sizes of the buffers in bytes, buffers of the same size are updated in place
+  GLsizeiptr bytesV = 0, bytesN = 0, bytesT = 0, bytesC = 0, bytesPARTID = 0, bytesF = 0;
+  // components of each attribute as specified in VAO, 0 if not enabled yet
+  GLint attribSize[MESH_ATTRIB_COUNT] = {};
+};
+
+// uniform locations of the camera matrices in a program
+struct GLCameraUniforms
+{
+  GLint view = -1, proj = -1, normalMatrix = -1;
 };
 
 void GLMeshInitBuffers(GLMeshData &data);
-void GLMeshFillBuffers(GLuint program, GLMeshData &data, const Eigen::MatrixXd &V, const Eigen::MatrixXi &F,
-                       const Eigen::MatrixXd &N = Eigen::MatrixXd(), const Eigen::MatrixXd &T = Eigen::MatrixXd(), const Eigen::MatrixXd &C = Eigen::MatrixXd(), const Eigen::MatrixXi &PARTID = Eigen::MatrixXi());
+// V and N are uploaded if dynamicChanged is set, F, T, C and PARTID only if they differ from the last upload,
+// they are bound to the attributes position, normal, texCoord, color and partId (see GLMeshAttrib)
+void GLMeshFillBuffers(GLMeshData &data, const Eigen::MatrixXd &V, const Eigen::MatrixXi &F,
+                       const Eigen::MatrixXd &N = Eigen::MatrixXd(), const Eigen::MatrixXd &T = Eigen::MatrixXd(), const Eigen::MatrixXd &C = Eigen::MatrixXd(), const Eigen::MatrixXi &PARTID = Eigen::MatrixXi(),
+                       bool dynamicChanged = true);
+// as above with V and N already interleaved in float, they are uploaded without a conversion
+void GLMeshFillBuffers(GLMeshData &data, const MatrixX3fR &V, const Eigen::MatrixXi &F,
+                       const MatrixX3fR &N, const Eigen::MatrixXd &T = Eigen::MatrixXd(), const Eigen::MatrixXd &C = Eigen::MatrixXd(), const Eigen::MatrixXi &PARTID = Eigen::MatrixXi(),
+                       bool dynamicChanged = true);
 void GLMeshDestroyBuffers(GLMeshData &data);
 void GLMeshDraw(GLMeshData &data, GLuint type);
 void rasterizeGPUClear();
-void uploadCameraMatrices(GLuint shader, const Eigen::Matrix4d &P, const Eigen::Matrix4d &M, const Eigen::Matrix4d &normalMatrix);
+GLCameraUniforms getCameraUniforms(GLuint shader);
+void uploadCameraMatrices(GLuint shader, const GLCameraUniforms &uniforms, const Eigen::Matrix4d &P, const Eigen::Matrix4d &M, const Eigen::Matrix4d &normalMatrix);
 GLuint loadShaders(const char *vertexShaderSrc, const char *fragmentShaderSrc);
 GLuint loadShadersFromFile(const std::string &vertexShaderFn, const std::string &fragmentShaderFn);
 void loadTexturesToGPU(const std::deque<std::string> &fn, std::vector<GLuint> &textureNames);
@@ -1060,6 +1060,9 @@ struct Buffer {
             // uri is not decoded(e.g. whitespace may be represented as %20)
   Value extras;
   ExtensionMap extensions;
+  // written instead of data.size() for a buffer without data and uri
+  // (e.g. the fallback buffer of EXT_meshopt_compression)
+  size_t byteLength{0};
 
   // Filled when SetStoreOriginalJSONForExtrasAndExtensions is enabled.
   std::string extras_json_string;
@@ -6681,6 +6684,30 @@ static void SerializeGltfAccessor(Accessor &accessor, json &o) {
   SerializeStringProperty("type", type, o);
   if (!accessor.name.empty()) SerializeStringProperty("name", accessor.name, o);
 
+  if (accessor.sparse.isSparse) {
+    json sparse;
+    SerializeNumberProperty<int>("count", accessor.sparse.count, sparse);
+    {
+      json indices;
+      SerializeNumberProperty<int>("bufferView",
+                                   accessor.sparse.indices.bufferView, indices);
+      SerializeNumberProperty<int>("byteOffset",
+                                   accessor.sparse.indices.byteOffset, indices);
+      SerializeNumberProperty<int>(
+          "componentType", accessor.sparse.indices.componentType, indices);
+      JsonAddMember(sparse, "indices", std::move(indices));
+    }
+    {
+      json values;
+      SerializeNumberProperty<int>("bufferView",
+                                   accessor.sparse.values.bufferView, values);
+      SerializeNumberProperty<int>("byteOffset",
+                                   accessor.sparse.values.byteOffset, values);
+      JsonAddMember(sparse, "values", std::move(values));
+    }
+    JsonAddMember(o, "sparse", std::move(sparse));
+  }
+
   if (accessor.extras.Type() != NULL_TYPE) {
     SerializeValue("extras", accessor.extras, o);
   }
@@ -6789,6 +6816,14 @@ static void SerializeGltfBufferBin(Buffer &buffer, json &o,
 }
 
 static void SerializeGltfBuffer(Buffer &buffer, json &o) {
+  if (buffer.data.empty() && buffer.uri.empty() && buffer.byteLength > 0) {
+    // the data is stored elsewhere (e.g. the binary chunk of a GLB written
+    // separately or the fallback buffer of EXT_meshopt_compression)
+    SerializeNumberProperty<size_t>("byteLength", buffer.byteLength, o);
+    if (buffer.name.size()) SerializeStringProperty("name", buffer.name, o);
+    SerializeExtensionMap(buffer.extensions, o);
+    return;
+  }
   SerializeNumberProperty("byteLength", buffer.data.size(), o);
   SerializeGltfBufferData(buffer.data, o);
 
@@ -6838,6 +6873,8 @@ static void SerializeGltfBufferView(BufferView &bufferView, json &o) {
   if (bufferView.extras.Type() != NULL_TYPE) {
     SerializeValue("extras", bufferView.extras, o);
   }
+
+  SerializeExtensionMap(bufferView.extensions, o);
 }
 
 static void SerializeGltfImage(Image &image, json &o) {
@@ -7684,7 +7721,9 @@ bool TinyGLTF::WriteGltfSceneToFile(Model *model, const std::string &filename,
       json buffer;
       if (writeBinary && i == 0 && model->buffers[i].uri.empty()) {
         SerializeGltfBufferBin(model->buffers[i], buffer, binBuffer);
-      } else if (embedBuffers) {
+      } else if (embedBuffers || (model->buffers[i].data.empty() &&
+                                  model->buffers[i].uri.empty() &&
+                                  model->buffers[i].byteLength > 0)) {
         SerializeGltfBuffer(model->buffers[i], buffer);
       } else {
         std::string binSavePath;
@@ -558,6 +558,43 @@ unsigned int zip_entry_crc32(struct zip_t *zip) {
   return zip ? zip->entry.uncomp_crc32 : 0;
 }
 
+ssize_t zip_entry_stored_offset(struct zip_t *zip) {
+  mz_zip_archive *pzip = NULL;
+  mz_uint8 header[MZ_ZIP_LOCAL_DIR_HEADER_SIZE];
+
+  if (!zip || zip->entry.method != 0) {
+    return -1;
+  }
+  pzip = &(zip->archive);
+  if (pzip->m_zip_mode != MZ_ZIP_MODE_READING) {
+    return -1;
+  }
+  if (pzip->m_pRead(pzip->m_pIO_opaque, zip->entry.header_offset, header,
+                    sizeof(header)) != sizeof(header) ||
+      MZ_READ_LE32(header) != MZ_ZIP_LOCAL_DIR_HEADER_SIG) {
+    // Cannot read the local header of the entry
+    return -1;
+  }
+  return (ssize_t)(zip->entry.header_offset + sizeof(header) +
+                   MZ_READ_LE16(header + MZ_ZIP_LDH_FILENAME_LEN_OFS) +
+                   MZ_READ_LE16(header + MZ_ZIP_LDH_EXTRA_LEN_OFS));
+}
+
+int zip_set_level(struct zip_t *zip, int level) {
+  if (!zip) {
+    return -1;
+  }
+  if (level < 0) {
+    level = MZ_DEFAULT_LEVEL;
+  }
+  if ((level & 0xF) > MZ_UBER_COMPRESSION) {
+    // Wrong compression level
+    return -1;
+  }
+  zip->level = (mz_uint)level;
+  return 0;
+}
+
 int zip_entry_write(struct zip_t *zip, const void *buf, size_t bufsize) {
   mz_uint level;
   mz_zip_archive *pzip = NULL;
@@ -189,6 +189,29 @@ extern unsigned long long zip_entry_size(struct zip_t *zip);
  */
 extern unsigned int zip_entry_crc32(struct zip_t *zip);
 
+/**
+ * Returns the offset of the data of the current zip entry in the archive if
+ * it is stored without compression, so that it can be read in place (e.g.
+ * from a memory mapped archive).
+ *
+ * @param zip zip archive handler.
+ *
+ * @return the offset in bytes, negative number (< 0) if the entry is
+ *         compressed or on error.
+ */
+extern ssize_t zip_entry_stored_offset(struct zip_t *zip);
+
+/**
+ * Sets the compression level of the zip entries opened from now on.
+ *
+ * @param zip zip archive handler.
+ * @param level compression level (0-9 are the standard zlib-style levels,
+ *              0 stores the entries without compression).
+ *
+ * @return the return code - 0 on success, negative number (< 0) on error.
+ */
+extern int zip_set_level(struct zip_t *zip, int level);
+
 /**
  * Compresses an input buffer for the current zip entry.
  *